@@ -0,0 +1,403 @@
+//This module provides an immutable, flattened form of PolygonCollection for fast repeated geometric queries
+//Author: Bryan Poling
+//Copyright (c) 2022 Sentek Systems, LLC. All rights reserved.
+
+//System Includes
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+//Project Includes
+#include "CompiledPolygon.hpp"
+
+#define TOLERANCE 1e-10
+
+//The edge grid is only worth building when there are enough edges for a band to skip most of them
+static constexpr size_t MinEdgesForGrid = 32U;
+static constexpr size_t EdgesPerBand    = 8U;
+static constexpr int    MaxBands        = 4096;
+
+// ************************************************************************************************************************************************
+// *******************************************************   Generic Local Utility Functions   ****************************************************
+// ************************************************************************************************************************************************
+
+//Count the edges (X0[n],Y0[n]) -> (X1[n],Y1[n]) crossed by the ray from (PX,PY) in the +X direction. This is the crossing rule from the winding
+//number test in Polygon.cpp (half-open in Y, side decided by the sign of isLeft), so parity agrees with SimplePolygon::ContainsPoint().
+static inline int CountRayCrossings(double const * X0, double const * Y0, double const * X1, double const * Y1, size_t N, double PX, double PY) {
+	int count = 0;
+	size_t n = 0U;
+	#if defined(__AVX2__)
+	{
+		__m256d const px   = _mm256_set1_pd(PX);
+		__m256d const py   = _mm256_set1_pd(PY);
+		__m256d const zero = _mm256_setzero_pd();
+		__m256i acc = _mm256_setzero_si256();
+		for (; n + 4U <= N; n += 4U) {
+			__m256d x0 = _mm256_loadu_pd(X0 + n);
+			__m256d y0 = _mm256_loadu_pd(Y0 + n);
+			__m256d x1 = _mm256_loadu_pd(X1 + n);
+			__m256d y1 = _mm256_loadu_pd(Y1 + n);
+
+			//Upward crossing: Y0 <= PY < Y1. Downward crossing: Y1 <= PY < Y0.
+			__m256d startBelow = _mm256_cmp_pd(y0, py, _CMP_LE_OQ);
+			__m256d endBelow   = _mm256_cmp_pd(y1, py, _CMP_LE_OQ);
+			__m256d up   = _mm256_andnot_pd(endBelow, startBelow);
+			__m256d down = _mm256_andnot_pd(startBelow, endBelow);
+
+			//isLeft = (X1 - X0)*(PY - Y0) - (PX - X0)*(Y1 - Y0)
+			__m256d isLeft = _mm256_sub_pd(_mm256_mul_pd(_mm256_sub_pd(x1, x0), _mm256_sub_pd(py, y0)),
+			                               _mm256_mul_pd(_mm256_sub_pd(px, x0), _mm256_sub_pd(y1, y0)));
+			__m256d cross = _mm256_or_pd(_mm256_and_pd(up,   _mm256_cmp_pd(isLeft, zero, _CMP_GT_OQ)),
+			                             _mm256_and_pd(down, _mm256_cmp_pd(isLeft, zero, _CMP_LT_OQ)));
+
+			//Lanes of cross are all ones (-1) where the edge is crossed
+			acc = _mm256_sub_epi64(acc, _mm256_castpd_si256(cross));
+		}
+		alignas(32) int64_t lanes[4];
+		_mm256_store_si256((__m256i *) lanes, acc);
+		count = int(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+	}
+	#endif
+
+	//Scalar path (and tail for the AVX2 path)
+	for (; n < N; n++) {
+		bool startBelow = (Y0[n] <= PY);
+		bool endBelow   = (Y1[n] <= PY);
+		if (startBelow == endBelow)
+			continue;
+		double isLeft = (X1[n] - X0[n]) * (PY - Y0[n]) - (PX - X0[n]) * (Y1[n] - Y0[n]);
+		if (startBelow ? (isLeft > 0.0) : (isLeft < 0.0))
+			count++;
+	}
+	return count;
+}
+
+//Same as LineSegment::ProjectPoint()
+static inline Eigen::Vector2d ProjectPointToSegment(Eigen::Vector2d const & P, Eigen::Vector2d const & A, Eigen::Vector2d const & B) {
+	Eigen::Vector2d AB = B - A;
+	double length = AB.norm();
+	if (length < TOLERANCE)
+		return A;
+	Eigen::Vector2d v1 = AB / length;
+	double projectionOnLine = v1.dot(P - A);
+	if ((projectionOnLine >= 0.0) && (projectionOnLine <= length))
+		return A + projectionOnLine * v1;
+	return ((P - A).norm() < (P - B).norm()) ? A : B;
+}
+
+//Lower bound on the distance from a point to anything in the given AABB: (XMin, XMax, YMin, YMax)
+static inline double DistanceToAABB(Eigen::Vector2d const & P, Eigen::Vector4d const & AABB) {
+	double dx = std::max(std::max(AABB(0) - P(0), P(0) - AABB(1)), 0.0);
+	double dy = std::max(std::max(AABB(2) - P(1), P(1) - AABB(3)), 0.0);
+	return std::sqrt(dx*dx + dy*dy);
+}
+
+// ************************************************************************************************************************************************
+// ***************************************************   CompiledPolygonCollection Definitions   **************************************************
+// ************************************************************************************************************************************************
+
+//Replace the contents of this object with a compiled copy of the given collection
+void CompiledPolygonCollection::Compile(PolygonCollection const & Collection, bool BuildEdgeGrid) {
+	Clear();
+
+	size_t numVertices = 0U;
+	size_t numRings    = 0U;
+	for (Polygon const & comp : Collection.m_components) {
+		if (comp.m_boundary.Empty())
+			continue;
+		numVertices += comp.m_boundary.NumVertices() + 1U;
+		for (SimplePolygon const & hole : comp.m_holes)
+			numVertices += hole.Empty() ? 0U : hole.NumVertices() + 1U;
+		numRings += 1U + comp.m_holes.size();
+	}
+	m_x.reserve(numVertices);
+	m_y.reserve(numVertices);
+	m_ringStart.reserve(numRings + 1U);
+	m_ringAABBs.reserve(numRings);
+
+	auto addRing = [this](SimplePolygon const & Ring) {
+		std::Evector<Eigen::Vector2d> const & vertices(Ring.GetVertices());
+		m_ringStart.push_back(uint32_t(m_x.size()));
+		m_ringAABBs.push_back(Ring.GetAABB());
+		for (Eigen::Vector2d const & v : vertices) {
+			m_x.push_back(v(0));
+			m_y.push_back(v(1));
+		}
+		if (! vertices.empty()) {
+			m_x.push_back(vertices.front()(0));
+			m_y.push_back(vertices.front()(1));
+		}
+	};
+
+	m_area = 0.0;
+	for (Polygon const & comp : Collection.m_components) {
+		if (comp.m_boundary.Empty())
+			continue;
+		m_componentFirstRing.push_back(uint32_t(m_ringStart.size()));
+		addRing(comp.m_boundary);
+		for (SimplePolygon const & hole : comp.m_holes)
+			addRing(hole);
+		m_area += comp.GetArea();
+
+		Eigen::Vector4d const & compAABB(m_ringAABBs[m_componentFirstRing.back()]);
+		if (std::isnan(m_AABB(0)))
+			m_AABB = compAABB;
+		m_AABB(0) = std::min(m_AABB(0), compAABB(0));
+		m_AABB(1) = std::max(m_AABB(1), compAABB(1));
+		m_AABB(2) = std::min(m_AABB(2), compAABB(2));
+		m_AABB(3) = std::max(m_AABB(3), compAABB(3));
+	}
+	if (m_componentFirstRing.empty())
+		return;
+	m_componentFirstRing.push_back(uint32_t(m_ringStart.size()));
+	m_ringStart.push_back(uint32_t(m_x.size()));
+
+	if (BuildEdgeGrid)
+		this->BuildEdgeGrid();
+}
+
+void CompiledPolygonCollection::Clear(void) {
+	m_x.clear();
+	m_y.clear();
+	m_ringStart.clear();
+	m_componentFirstRing.clear();
+	m_ringAABBs.clear();
+	m_AABB = Eigen::Vector4d(std::nan(""), std::nan(""), std::nan(""), std::nan(""));
+	m_area = 0.0;
+
+	m_numBands = 0;
+	m_gridYMin = 0.0;
+	m_gridInvBandHeight = 0.0;
+	m_bandFirstRun.clear();
+	m_runs.clear();
+	m_edgeX0.clear();
+	m_edgeY0.clear();
+	m_edgeX1.clear();
+	m_edgeY1.clear();
+}
+
+//Convert back to a regular (editable) polygon collection
+PolygonCollection CompiledPolygonCollection::ToPolygonCollection(void) const {
+	PolygonCollection collection;
+	collection.m_components.resize(NumComponents());
+	for (size_t compIndex = 0U; compIndex < NumComponents(); compIndex++) {
+		Polygon & comp(collection.m_components[compIndex]);
+		for (size_t ringIndex = m_componentFirstRing[compIndex]; ringIndex < m_componentFirstRing[compIndex + 1U]; ringIndex++) {
+			//Drop the closing vertex
+			size_t start = m_ringStart[ringIndex];
+			size_t end   = std::max(m_ringStart[ringIndex + 1U], m_ringStart[ringIndex] + 1U) - 1U;
+			std::Evector<Eigen::Vector2d> vertices;
+			vertices.reserve(end - start);
+			for (size_t n = start; n < end; n++)
+				vertices.push_back(Eigen::Vector2d(m_x[n], m_y[n]));
+
+			if (ringIndex == m_componentFirstRing[compIndex])
+				comp.m_boundary.SetBoundary(vertices);
+			else
+				comp.m_holes.emplace_back(vertices);
+		}
+	}
+	return collection;
+}
+
+Eigen::Vector4d CompiledPolygonCollection::GetRingAABB(size_t RingIndex) const {
+	if (RingIndex >= m_ringAABBs.size())
+		return Eigen::Vector4d(std::nan(""), std::nan(""), std::nan(""), std::nan(""));
+	return m_ringAABBs[RingIndex];
+}
+
+//Test to see if the collection contains a point
+bool CompiledPolygonCollection::ContainsPoint(Eigen::Vector2d const & Point) const {
+	double X = Point(0);
+	double Y = Point(1);
+	//Negated comparisons so that NaN points (and an empty collection, which has a NaN AABB) are rejected
+	if (! ((X >= m_AABB(0)) && (X <= m_AABB(1)) && (Y >= m_AABB(2)) && (Y < m_AABB(3))))
+		return false;
+	return HasEdgeGrid() ? ContainsPoint_Grid(X, Y) : ContainsPoint_Rings(X, Y);
+}
+
+//Batch containment test. Results[n] is set to 1 if Points[n] is in the collection and 0 otherwise. Results must have room for NumPoints.
+void CompiledPolygonCollection::ContainsPoints(Eigen::Vector2d const * Points, size_t NumPoints, uint8_t * Results) const {
+	if (Empty()) {
+		std::fill(Results, Results + NumPoints, uint8_t(0));
+		return;
+	}
+	if (HasEdgeGrid()) {
+		for (size_t n = 0U; n < NumPoints; n++) {
+			double X = Points[n](0);
+			double Y = Points[n](1);
+			bool inAABB = (X >= m_AABB(0)) && (X <= m_AABB(1)) && (Y >= m_AABB(2)) && (Y < m_AABB(3));
+			Results[n] = (inAABB && ContainsPoint_Grid(X, Y)) ? 1U : 0U;
+		}
+	}
+	else {
+		for (size_t n = 0U; n < NumPoints; n++) {
+			double X = Points[n](0);
+			double Y = Points[n](1);
+			bool inAABB = (X >= m_AABB(0)) && (X <= m_AABB(1)) && (Y >= m_AABB(2)) && (Y < m_AABB(3));
+			Results[n] = (inAABB && ContainsPoint_Rings(X, Y)) ? 1U : 0U;
+		}
+	}
+}
+
+std::vector<uint8_t> CompiledPolygonCollection::ContainsPoints(std::Evector<Eigen::Vector2d> const & Points) const {
+	std::vector<uint8_t> results(Points.size(), uint8_t(0));
+	ContainsPoints(Points.data(), Points.size(), results.data());
+	return results;
+}
+
+//Get the point inside or on the boundary of the collection nearest to the provided point
+Eigen::Vector2d CompiledPolygonCollection::ProjectPoint(Eigen::Vector2d const & Point) const {
+	if (ContainsPoint(Point))
+		return Point;
+	return ProjectPointToBoundary(Point);
+}
+
+//Get the point on the boundary (outer boundaries or holes) of the collection nearest to the provided point
+Eigen::Vector2d CompiledPolygonCollection::ProjectPointToBoundary(Eigen::Vector2d const & Point) const {
+	Eigen::Vector2d bestProjPt = Point;
+	double distToBestProjPt = std::numeric_limits<double>::infinity();
+	for (size_t ringIndex = 0U; ringIndex < NumRings(); ringIndex++) {
+		size_t start = m_ringStart[ringIndex];
+		size_t end   = m_ringStart[ringIndex + 1U];
+		if (end == start)
+			continue;
+		if (DistanceToAABB(Point, m_ringAABBs[ringIndex]) > distToBestProjPt)
+			continue;
+
+		if (end - start == 2U) {
+			//Single-vertex ring (stored closed)
+			Eigen::Vector2d v(m_x[start], m_y[start]);
+			double dist = (Point - v).norm();
+			if (dist < distToBestProjPt) {
+				bestProjPt = v;
+				distToBestProjPt = dist;
+			}
+			continue;
+		}
+		for (size_t n = start; n + 1U < end; n++) {
+			Eigen::Vector2d projection = ProjectPointToSegment(Point, Eigen::Vector2d(m_x[n], m_y[n]), Eigen::Vector2d(m_x[n + 1U], m_y[n + 1U]));
+			double dist = (Point - projection).norm();
+			if (dist < distToBestProjPt) {
+				bestProjPt = projection;
+				distToBestProjPt = dist;
+			}
+		}
+	}
+	return bestProjPt;
+}
+
+//Bin the non-horizontal edges of every ring into horizontal bands. Within each band the edges are grouped by component.
+void CompiledPolygonCollection::BuildEdgeGrid(void) {
+	//Visit every non-horizontal edge (horizontal edges can never be crossed) in component order so each band comes out grouped by component
+	auto forEachEdge = [this](auto && Func) {
+		for (size_t compIndex = 0U; compIndex < NumComponents(); compIndex++) {
+			for (size_t ringIndex = m_componentFirstRing[compIndex]; ringIndex < m_componentFirstRing[compIndex + 1U]; ringIndex++) {
+				for (size_t n = m_ringStart[ringIndex]; n + 1U < m_ringStart[ringIndex + 1U]; n++) {
+					if (m_y[n] != m_y[n + 1U])
+						Func(compIndex, n);
+				}
+			}
+		}
+	};
+	size_t numEdges = 0U;
+	forEachEdge([&numEdges](size_t CompIndex, size_t n) { numEdges++; });
+	double height = m_AABB(3) - m_AABB(2);
+	if ((numEdges < MinEdgesForGrid) || (! std::isfinite(height)) || (height <= 0.0))
+		return;
+
+	m_numBands = int(std::clamp(numEdges / EdgesPerBand, size_t(1U), size_t(MaxBands)));
+	m_gridYMin = m_AABB(2);
+	m_gridInvBandHeight = double(m_numBands) / height;
+
+	//Counting sort of the edges by band (an edge goes in every band its Y extent touches)
+	std::vector<uint32_t> bandCounts(m_numBands + 1, 0U);
+	forEachEdge([&](size_t CompIndex, size_t n) {
+		int b0 = GetBandIndex(std::min(m_y[n], m_y[n + 1U]));
+		int b1 = GetBandIndex(std::max(m_y[n], m_y[n + 1U]));
+		for (int b = b0; b <= b1; b++)
+			bandCounts[b + 1]++;
+	});
+	for (int b = 0; b < m_numBands; b++)
+		bandCounts[b + 1] += bandCounts[b];
+
+	size_t totalEdges = bandCounts[m_numBands];
+	m_edgeX0.resize(totalEdges);
+	m_edgeY0.resize(totalEdges);
+	m_edgeX1.resize(totalEdges);
+	m_edgeY1.resize(totalEdges);
+	std::vector<uint32_t> edgeComponent(totalEdges);
+	std::vector<uint32_t> bandCursor(bandCounts.begin(), bandCounts.end() - 1);
+	forEachEdge([&](size_t CompIndex, size_t n) {
+		int b0 = GetBandIndex(std::min(m_y[n], m_y[n + 1U]));
+		int b1 = GetBandIndex(std::max(m_y[n], m_y[n + 1U]));
+		for (int b = b0; b <= b1; b++) {
+			uint32_t slot = bandCursor[b]++;
+			m_edgeX0[slot] = m_x[n];
+			m_edgeY0[slot] = m_y[n];
+			m_edgeX1[slot] = m_x[n + 1U];
+			m_edgeY1[slot] = m_y[n + 1U];
+			edgeComponent[slot] = uint32_t(CompIndex);
+		}
+	});
+
+	//Split each band into per-component runs
+	m_bandFirstRun.assign(m_numBands + 1, 0U);
+	for (int b = 0; b < m_numBands; b++) {
+		m_bandFirstRun[b] = uint32_t(m_runs.size());
+		for (uint32_t e = bandCounts[b]; e < bandCounts[b + 1]; e++) {
+			if (m_runs.empty() || (m_runs.size() == m_bandFirstRun[b]) || (m_runs.back().Component != edgeComponent[e]))
+				m_runs.push_back(EdgeRun{edgeComponent[e], e, e + 1U});
+			else
+				m_runs.back().EndEdge = e + 1U;
+		}
+	}
+	m_bandFirstRun[m_numBands] = uint32_t(m_runs.size());
+}
+
+//Band containing the given Y value, clamped to the grid. This is monotone in Y so an edge spanning [YMin, YMax] is found by every Y in that range.
+inline int CompiledPolygonCollection::GetBandIndex(double Y) const {
+	int b = int(std::floor((Y - m_gridYMin) * m_gridInvBandHeight));
+	return std::clamp(b, 0, m_numBands - 1);
+}
+
+bool CompiledPolygonCollection::ContainsPoint_Grid(double X, double Y) const {
+	int b = GetBandIndex(Y);
+	for (uint32_t runIndex = m_bandFirstRun[b]; runIndex < m_bandFirstRun[b + 1]; runIndex++) {
+		EdgeRun const & run(m_runs[runIndex]);
+		size_t first = run.FirstEdge;
+		int crossings = CountRayCrossings(&m_edgeX0[first], &m_edgeY0[first], &m_edgeX1[first], &m_edgeY1[first], run.EndEdge - run.FirstEdge, X, Y);
+		if (crossings % 2 == 1)
+			return true;
+	}
+	return false;
+}
+
+bool CompiledPolygonCollection::ContainsPoint_Rings(double X, double Y) const {
+	for (size_t compIndex = 0U; compIndex < NumComponents(); compIndex++) {
+		size_t boundaryRing = m_componentFirstRing[compIndex];
+		Eigen::Vector4d const & compAABB(m_ringAABBs[boundaryRing]);
+		if ((X < compAABB(0)) || (X > compAABB(1)) || (Y < compAABB(2)) || (Y >= compAABB(3)))
+			continue;
+		if (m_ringStart[boundaryRing + 1U] - m_ringStart[boundaryRing] < 4U)
+			continue; //Boundary has fewer than 3 vertices - can't contain anything
+
+		int crossings = 0;
+		for (size_t ringIndex = boundaryRing; ringIndex < m_componentFirstRing[compIndex + 1U]; ringIndex++) {
+			Eigen::Vector4d const & ringAABB(m_ringAABBs[ringIndex]);
+			if ((X > ringAABB(1)) || (Y < ringAABB(2)) || (Y >= ringAABB(3)))
+				continue; //The ray can't cross this ring
+			size_t start = m_ringStart[ringIndex];
+			size_t end   = m_ringStart[ringIndex + 1U];
+			if (end - start < 2U)
+				continue;
+			crossings += CountRayCrossings(&m_x[start], &m_y[start], &m_x[start + 1U], &m_y[start + 1U], end - start - 1U, X, Y);
+		}
+		if (crossings % 2 == 1)
+			return true;
+	}
+	return false;
+}
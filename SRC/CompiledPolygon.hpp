@@ -0,0 +1,102 @@
+//This module provides an immutable, flattened form of PolygonCollection for fast repeated geometric queries
+//Author: Bryan Poling
+//Copyright (c) 2022 Sentek Systems, LLC. All rights reserved.
+#pragma once
+
+//System Includes
+#include <vector>
+#include <cstdint>
+
+//Project Includes
+#include "EigenAliases.h"
+#include "Polygon.hpp"
+
+//A CompiledPolygonCollection is a read-only snapshot of a PolygonCollection, laid out for queries rather than editing. A PolygonCollection is
+//a three-level nest of separately allocated vectors, so every ContainsPoint() or ProjectPoint() call chases pointers through it (and
+//SimplePolygon::ContainsPoint() copies the vertex vector on each call). The compiled form instead stores:
+//  - the vertices of every ring (component boundaries and holes) in contiguous x[] and y[] arrays, with ring offsets,
+//  - the AABB of each ring and of the whole collection, and the area of the collection,
+//  - optionally, an edge grid: the collection's Y range is split into horizontal bands and each band holds a contiguous (SoA) copy of the
+//    non-horizontal edges that cross it, grouped by component. A containment test then only looks at the edges of a single band.
+//Containment uses crossing parity, which is equivalent to the winding number test used by SimplePolygon for valid objects (simple rings,
+//holes inside their boundaries and not overlapping one another). Components are tested independently, so overlapping components behave
+//like PolygonCollection::ContainsPoint() (union). The edge crossing counts are computed 4 edges at a time with AVX2 when available.
+//As with the source classes, containment is not stable for points on the boundary.
+//Components with empty boundaries are dropped when compiling. Mutable editing should stay on the regular classes - compile once after
+//the geometry is final and recompile if it changes. All methods are const, so one object can be shared between threads.
+class CompiledPolygonCollection {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	CompiledPolygonCollection() = default;
+	CompiledPolygonCollection(PolygonCollection const & Collection, bool BuildEdgeGrid = true) { Compile(Collection, BuildEdgeGrid); }
+	CompiledPolygonCollection(Polygon const & Poly, bool BuildEdgeGrid = true) { Compile(PolygonCollection(Poly), BuildEdgeGrid); }
+	~CompiledPolygonCollection() = default;
+
+	//Replace the contents of this object with a compiled copy of the given collection
+	void Compile(PolygonCollection const & Collection, bool BuildEdgeGrid = true);
+	void Clear(void);
+
+	//Convert back to a regular (editable) polygon collection
+	PolygonCollection ToPolygonCollection(void) const;
+
+	bool   Empty(void)         const { return m_componentFirstRing.size() < 2U; }
+	size_t NumComponents(void) const { return Empty() ? 0U : m_componentFirstRing.size() - 1U; }
+	size_t NumRings(void)      const { return m_ringStart.empty() ? 0U : m_ringStart.size() - 1U; }
+	bool   HasEdgeGrid(void)   const { return m_numBands > 0; }
+
+	//Get the X and Y bounds of the collection or of a single ring. Returned as a vector: (XMin, XMax, YMin, YMax). NaN if empty.
+	Eigen::Vector4d GetAABB(void) const { return m_AABB; }
+	Eigen::Vector4d GetRingAABB(size_t RingIndex) const;
+
+	//Get the area of the collection (cached from PolygonCollection::GetArea() at compile time)
+	double GetArea(void) const { return m_area; }
+
+	//Test to see if the collection contains a point
+	bool ContainsPoint(Eigen::Vector2d const & Point) const;
+
+	//Batch containment test. Results[n] is set to 1 if Points[n] is in the collection and 0 otherwise. Results must have room for NumPoints.
+	void ContainsPoints(Eigen::Vector2d const * Points, size_t NumPoints, uint8_t * Results) const;
+	std::vector<uint8_t> ContainsPoints(std::Evector<Eigen::Vector2d> const & Points) const;
+
+	//Get the point inside or on the boundary of the collection nearest to the provided point (matches PolygonCollection::ProjectPoint())
+	Eigen::Vector2d ProjectPoint(Eigen::Vector2d const & Point) const;
+
+	//Get the point on the boundary (outer boundaries or holes) of the collection nearest to the provided point
+	Eigen::Vector2d ProjectPointToBoundary(Eigen::Vector2d const & Point) const;
+
+private:
+	//Ring vertices. Each ring is stored closed (its first vertex is repeated at the end) so edge k of the collection always runs from
+	//vertex k to vertex k+1. Ring r occupies [m_ringStart[r], m_ringStart[r+1]). The first ring of each component is its outer boundary
+	//and the rest are its holes - component c owns rings [m_componentFirstRing[c], m_componentFirstRing[c+1]).
+	std::vector<double>   m_x;
+	std::vector<double>   m_y;
+	std::vector<uint32_t> m_ringStart;
+	std::vector<uint32_t> m_componentFirstRing;
+	std::Evector<Eigen::Vector4d> m_ringAABBs;
+
+	Eigen::Vector4d m_AABB = Eigen::Vector4d(std::nan(""), std::nan(""), std::nan(""), std::nan(""));
+	double m_area = 0.0;
+
+	//Edge grid. Band b covers Y in [m_gridYMin + b/m_gridInvBandHeight, m_gridYMin + (b+1)/m_gridInvBandHeight). The runs for band b are
+	//[m_bandFirstRun[b], m_bandFirstRun[b+1]) and each run is a contiguous block of edges in the SoA arrays belonging to one component.
+	struct EdgeRun {
+		uint32_t Component;
+		uint32_t FirstEdge;
+		uint32_t EndEdge;
+	};
+	int    m_numBands = 0;
+	double m_gridYMin = 0.0;
+	double m_gridInvBandHeight = 0.0;
+	std::vector<uint32_t> m_bandFirstRun;
+	std::vector<EdgeRun>  m_runs;
+	std::vector<double>   m_edgeX0;
+	std::vector<double>   m_edgeY0;
+	std::vector<double>   m_edgeX1;
+	std::vector<double>   m_edgeY1;
+
+	void BuildEdgeGrid(void);
+	int  GetBandIndex(double Y) const;
+	bool ContainsPoint_Grid(double X, double Y) const;
+	bool ContainsPoint_Rings(double X, double Y) const;
+};
@@ -0,0 +1,141 @@
+//This module provides a small publish/subscribe channel for immutable, reference-counted frames (shadow maps, TA functions, etc.).
+//A producer publishes each frame once, as a std::shared_ptr<const T>, and every subscriber receives a handle to the same object. No
+//pixel data is copied and no mutex is held while frames are handed out. Frames are immutable once published - a consumer that needs
+//to modify a frame must make its own copy (and should report it to FrameCopyStats).
+//
+//Publish() and Latest() never take a lock of their own: the most recent frame and the subscriber list are each held in a shared_ptr
+//that is swapped with the atomic shared_ptr operations of the standard library. Subscribe() and Unsubscribe() copy the (short)
+//subscriber list and swap in the new one. Since Publish() works from a snapshot of the list, a callback may still be invoked once
+//by a Publish() that was already underway when Unsubscribe() was called.
+//Author: Bryan Poling
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+#pragma once
+
+//System Includes
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+//External Includes
+#include <opencv2/opencv.hpp>
+
+//Process-wide accounting of frame data moved between modules, for measuring the cost of fan-out. Deep copies of frame data on the
+//way from a producer to a consumer are reported as copied bytes (CountedCopy() does this for cv::Mat). Handles delivered by a
+//FrameChannel are reported as shared bytes - this is what the same fan-out would have copied if each consumer got its own copy.
+class FrameCopyStats {
+	public:
+		static FrameCopyStats & Instance() { static FrameCopyStats Obj; return Obj; }
+
+		FrameCopyStats() : m_bytesCopied(0U), m_bytesShared(0U) { Reset(); }
+		~FrameCopyStats() = default;
+
+		inline void AddCopied(uint64_t Bytes) { m_bytesCopied += Bytes; }
+		inline void AddShared(uint64_t Bytes) { m_bytesShared += Bytes; }
+
+		inline uint64_t BytesCopied(void) const { return m_bytesCopied; }
+		inline uint64_t BytesShared(void) const { return m_bytesShared; }
+
+		//Rates are averaged over the time since construction or the last call to Reset()
+		inline double BytesCopiedPerSecond(void) const { return double(m_bytesCopied) / SecondsSinceReset(); }
+		inline double BytesSharedPerSecond(void) const { return double(m_bytesShared) / SecondsSinceReset(); }
+
+		inline void Reset(void) {
+			m_bytesCopied = 0U;
+			m_bytesShared = 0U;
+			m_resetTime   = std::chrono::steady_clock::now().time_since_epoch().count();
+		}
+
+	private:
+		std::atomic<uint64_t> m_bytesCopied;
+		std::atomic<uint64_t> m_bytesShared;
+		std::atomic<std::chrono::steady_clock::rep> m_resetTime;
+
+		inline double SecondsSinceReset(void) const {
+			std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now().time_since_epoch() -
+			                                              std::chrono::steady_clock::duration(m_resetTime.load());
+			return std::max(std::chrono::duration<double>(elapsed).count(), 1e-9);
+		}
+};
+
+//Number of bytes of pixel data in a cv::Mat
+inline uint64_t MatBytes(cv::Mat const & Mat) { return uint64_t(Mat.total()) * uint64_t(Mat.elemSize()); }
+
+//Deep copy Src to Dst and report the copy to FrameCopyStats
+inline void CountedCopy(cv::Mat const & Src, cv::Mat & Dst) {
+	Src.copyTo(Dst);
+	FrameCopyStats::Instance().AddCopied(MatBytes(Dst));
+}
+
+template <typename T>
+class FrameChannel {
+	public:
+		using Handle   = std::shared_ptr<const T>;
+		using Callback = std::function<void(Handle const & Frame)>;
+
+		//PayloadBytes is used to report shared bytes to FrameCopyStats on each delivery (optional)
+		FrameChannel(std::function<uint64_t(T const & Frame)> PayloadBytes = nullptr) : m_payloadBytes(PayloadBytes),
+			m_subscribers(std::make_shared<const SubscriberList>()) { }
+		~FrameChannel() = default;
+
+		inline int    Subscribe(Callback CB);      //Register callback for new frames (returns handle)
+		inline void   Unsubscribe(int Token);      //Unregister callback (input is token returned by Subscribe())
+		inline void   Publish(Handle const & Frame); //Make Frame the latest frame and pass it to all subscribers (on the calling thread)
+		inline Handle Latest(void) const;          //Most recently published frame (nullptr if none)
+		inline void   Clear(void);                 //Forget the most recently published frame
+
+	private:
+		using SubscriberList = std::vector<std::pair<int, Callback>>;
+
+		std::function<uint64_t(T const & Frame)> m_payloadBytes;
+		std::mutex m_subscribeMutex; //Serializes Subscribe() and Unsubscribe() - never held by Publish() or Latest()
+		std::shared_ptr<const SubscriberList> m_subscribers; //Access through std::atomic_load() and std::atomic_store() only
+		Handle m_latest;                                     //Access through std::atomic_load() and std::atomic_store() only
+};
+
+template <typename T>
+inline int FrameChannel<T>::Subscribe(Callback CB) {
+	std::scoped_lock lock(m_subscribeMutex);
+	std::shared_ptr<SubscriberList> newList = std::make_shared<SubscriberList>(*std::atomic_load(&m_subscribers));
+	int token = 0;
+	while (std::find_if(newList->begin(), newList->end(), [token](auto const & Item) { return Item.first == token; }) != newList->end())
+		token++;
+	newList->push_back(std::make_pair(token, CB));
+	std::atomic_store(&m_subscribers, std::shared_ptr<const SubscriberList>(newList));
+	return token;
+}
+
+template <typename T>
+inline void FrameChannel<T>::Unsubscribe(int Token) {
+	std::scoped_lock lock(m_subscribeMutex);
+	std::shared_ptr<SubscriberList> newList = std::make_shared<SubscriberList>(*std::atomic_load(&m_subscribers));
+	newList->erase(std::remove_if(newList->begin(), newList->end(), [Token](auto const & Item) { return Item.first == Token; }), newList->end());
+	std::atomic_store(&m_subscribers, std::shared_ptr<const SubscriberList>(newList));
+}
+
+template <typename T>
+inline void FrameChannel<T>::Publish(Handle const & Frame) {
+	std::atomic_store(&m_latest, Frame);
+	if (Frame == nullptr)
+		return;
+	std::shared_ptr<const SubscriberList> subscribers = std::atomic_load(&m_subscribers);
+	for (auto const & item : *subscribers)
+		item.second(Frame);
+	if (m_payloadBytes)
+		FrameCopyStats::Instance().AddShared(m_payloadBytes(*Frame) * uint64_t(subscribers->size()));
+}
+
+template <typename T>
+inline typename FrameChannel<T>::Handle FrameChannel<T>::Latest(void) const {
+	return std::atomic_load(&m_latest);
+}
+
+template <typename T>
+inline void FrameChannel<T>::Clear(void) {
+	std::atomic_store(&m_latest, Handle());
+}
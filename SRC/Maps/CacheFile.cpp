@@ -14,13 +14,15 @@
 
 namespace Maps {
 
-CacheFile::CacheFile(ITileFileReceiver * receiver, Journal & LogRef) : Log(LogRef), m_receiver(receiver), m_threads(4) {
-	//Find the Local App cache directory (create it is it doesn't exist) and compute the path to the cache file
-	std::filesystem::path SatCachePath = Handy::Paths::CacheDirectory("SentekRecon") / "SatCache";
-	
-	m_file = new SimpleKVStore(SatCachePath, Log);
+//Find the Local App cache directory (create it is it doesn't exist) and use the cache file there
+CacheFile::CacheFile(ITileFileReceiver * receiver, Journal & LogRef)
+	: CacheFile(receiver, LogRef, Handy::Paths::CacheDirectory("SentekRecon") / "SatCache") { }
+
+CacheFile::CacheFile(ITileFileReceiver * receiver, Journal & LogRef, std::filesystem::path const & StorePath)
+	: Log(LogRef), m_receiver(receiver), m_requests(4U, MaxOutstandingRequests, MaxPendingPrefetches) {
+	m_file = new SimpleKVStore(StorePath, Log);
 	if (! m_file->IsOpen())
-		Log.print("Error: Failed to open sat tile cache: " + SatCachePath.string());
+		Log.print("Error: Failed to open sat tile cache: " + StorePath.string());
 }
 
 CacheFile::~CacheFile() {
@@ -37,15 +39,16 @@ uint64_t CacheFile::GetNumItems()       { return m_file->GetNumItems();       }
 uint64_t CacheFile::GetNumBytes()       { return m_file->GetNumBytes();       }
 uint64_t CacheFile::GetNumBytesOnDisk() { return m_file->GetNumBytesOnDisk(); }
 
-std::shared_ptr<std::vector<uint8_t>> CacheFile::BlockTryGet(Tile tile, SatelliteSource source) {
+bool CacheFile::BlockTryGet(Tile tile, SatelliteSource source, std::shared_ptr<uint8_t const> & data, size_t & size) {
 	std::string Identifier = GetTileIdentifier(tile, source);
-	std::vector<uint8_t> * v = new std::vector<uint8_t>();
-	if (m_file->Get(Identifier, *v))
-		return std::shared_ptr<std::vector<uint8_t>>(v);
-	else {
-		delete v;
-		return nullptr;
+	uint64_t numBytes = 0U;
+	if (! m_file->GetView(Identifier, data, numBytes)) {
+		data.reset();
+		size = 0U;
+		return false;
 	}
+	size = (size_t) numBytes;
+	return true;
 }
 
 void CacheFile::BlockAdd(Tile tile, SatelliteSource source, std::vector<uint8_t> const & data) {
@@ -54,38 +57,42 @@ void CacheFile::BlockAdd(Tile tile, SatelliteSource source, std::vector<uint8_t>
 		Log.print("Warning in CacheFile::BlockAdd: Item either already exists in cache or adding to store failed. Tile: " + tile.ToString());
 }
 
+//Add many tiles in one store transaction (used for bulk seeding). Tiles that are already in the cache are left alone.
+size_t CacheFile::BlockAddBatch(SatelliteSource source, std::vector<std::tuple<Tile, std::vector<uint8_t>>> const & tiles) {
+	std::vector<std::pair<std::string, std::vector<uint8_t>>> items;
+	items.reserve(tiles.size());
+	for (auto const & item : tiles)
+		items.emplace_back(GetTileIdentifier(std::get<0>(item), source), std::get<1>(item));
+	return m_file->PutBatch(items, true);
+}
+
+bool CacheFile::BlockHas(Tile tile, SatelliteSource source) {
+	return m_file->Has(GetTileIdentifier(tile, source));
+}
+
 void CacheFile::BlockRemove(Tile tile, SatelliteSource source) {
 	std::string Identifier = GetTileIdentifier(tile, source);
 	m_file->Delete(Identifier);
 }
 
 void CacheFile::WaitFinish() {
-	m_threads.Wait();
+	m_requests.Wait();
 }
 
-void CacheFile::RetrieveAsync(Tile tile, SatelliteSource source) {
-	std::tuple<Tile, SatelliteSource> request(tile, source);
-	bool begin = false;
-	{
-		std::lock_guard<std::mutex> lock(m_requests_mtx);
-		if ((! Handy::Contains(m_requests, request)) && (m_requests.size() < MaxOutstandingRequests)) {
-			m_requests.insert(request);
-			begin = true;
+void CacheFile::RetrieveAsync(Tile tile, SatelliteSource source, double Priority) {
+	//If the request is already queued this just updates its priority. If there is no room we drop it - since tiles are requested every
+	//frame while they are needed it will simply be requested again. A miss is forwarded at the priority the request has when it runs, so
+	//a prefetch that was upgraded to a demand request while it waited is downloaded as one.
+	m_requests.Submit(std::make_tuple(tile, source), Priority, [this,tile,source](double EffectivePriority) {
+		try {
+			std::shared_ptr<uint8_t const> data;
+			size_t size = 0U;
+			BlockTryGet(tile, source, data, size);
+			m_receiver->OnReceivedFile(tile, source, data, size, EffectivePriority); //Called, even if we failed to retrieve the file (Triggers web retrieval)
+		} catch(...) {
+			Log.print("Error in CacheFile::RetrieveAsync: Retrieval failed for tile: " + tile.ToString());
 		}
-	}
-	
-	if (begin) {
-		m_threads.AddJobToFront([this,tile,source,request]() {
-			try {
-				auto data = BlockTryGet(tile, source);
-				m_receiver->OnReceivedFile(tile, source, data); //Called, even if we failed to retrieve the file (Triggers web retrieval)
-			} catch(...) {
-				Log.print("Error in CacheFile::RetrieveAsync: Retrieval failed for tile: " + tile.ToString());
-			}
-			std::lock_guard<std::mutex> lock(m_requests_mtx);
-			m_requests.erase(request);
-		});
-	}
+	});
 }
 }
 
@@ -9,6 +9,7 @@
 //Project Includes
 #include "Tile.hpp"
 #include "Interfaces.hpp"
+#include "TileRequestQueue.hpp"
 #include "SatelliteSources.hpp"
 #include "../Journal.h"
 
@@ -18,30 +19,31 @@ namespace Maps {
 	class CacheFile {
 		public:
 			static constexpr int32_t MaxOutstandingRequests = 16;
+			static constexpr int32_t MaxPendingPrefetches   = 8; //Prefetch requests can only take up this much of the queue
 
 		private:
 			Journal & Log;
-			std::mutex m_requests_mtx;
 			
 			SimpleKVStore     * m_file     = nullptr;
 			ITileFileReceiver * m_receiver = nullptr;
-			std::unordered_set<std::tuple<Tile,SatelliteSource>> m_requests;
 
-			Handy::ThreadPool m_threads;
+			TileRequestQueue<std::tuple<Tile,SatelliteSource>> m_requests;
 
 		public:
-			size_t NumOutstandingRequests() {
-				std::lock_guard<std::mutex> lock(m_requests_mtx);
-				return m_requests.size();
-			}
+			size_t NumOutstandingRequests() { return m_requests.NumOutstanding(); }
 
 			CacheFile(ITileFileReceiver * receiver, Journal & LogRef);
+			CacheFile(ITileFileReceiver * receiver, Journal & LogRef, std::filesystem::path const & StorePath); //Store somewhere other than the app cache
 			~CacheFile();
 
 			void BlockAdd(Tile tile, SatelliteSource source, std::vector<uint8_t> const & data);
+			size_t BlockAddBatch(SatelliteSource source, std::vector<std::tuple<Tile, std::vector<uint8_t>>> const & tiles); //Skips cached tiles - returns # added
+			bool BlockHas(Tile tile, SatelliteSource source);
 			void BlockRemove(Tile tile, SatelliteSource source);
 
-			void RetrieveAsync(Tile tile, SatelliteSource source);
+			//Priority < TileDemandPriority makes this a prefetch request (see TileRequestQueue.hpp)
+			void RetrieveAsync(Tile tile, SatelliteSource source, double Priority = TileDemandPriority);
+			void CancelStalePrefetches(std::chrono::time_point<std::chrono::steady_clock> Cutoff) { m_requests.CancelStalePrefetches(Cutoff); }
 			void WaitFinish();
 
 			void PurgeAll();
@@ -51,7 +53,8 @@ namespace Maps {
 			uint64_t GetNumBytes();
 			uint64_t GetNumBytesOnDisk();
 
-			std::shared_ptr<std::vector<uint8_t>> BlockTryGet(Tile tile, SatelliteSource source);
+			//Get a zero-copy view of a tile in the cache file. data keeps the underlying file mapping alive for as long as it is held.
+			bool BlockTryGet(Tile tile, SatelliteSource source, std::shared_ptr<uint8_t const> & data, size_t & size);
 	};
 }
 
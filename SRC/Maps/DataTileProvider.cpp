@@ -12,6 +12,9 @@
 
 //System Includes
 #include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 //External Includes
 #include "../HandyImGuiInclude.hpp"
@@ -21,6 +24,7 @@
 #include "DataTileVizEvaluator.hpp"
 #include "MapUtils.hpp"
 #include "../Utilities.hpp"
+#include "../WorkStealingPool.hpp"
 
 namespace Maps {
 	//Instantiate static fields
@@ -241,6 +245,21 @@ namespace Maps {
 		else
 			m_FRFFileStore->RetrieveAsync(Key);
 	}
+	
+	//Start a low-priority load of an FRF tile if it isn't loaded. Loaded tiles are not touched. Returns true if the tile is already loaded.
+	bool DataTileProvider::PrefetchFRFTile(Tile Key, double Priority) {
+		if ((Key.Zoom < DataTileMinZoomLevel) || (Key.Zoom > TileEditZoomLevel))
+			return false;
+		std::scoped_lock cacheLock(m_cache_mtx);
+		if (m_cache.count(Key) > 0U)
+			return true;
+		m_FRFFileStore->RetrieveAsync(Key, Priority);
+		return false;
+	}
+	
+	void DataTileProvider::CancelStalePrefetches(TimePoint Cutoff) {
+		m_FRFFileStore->CancelStalePrefetches(Cutoff);
+	}
 
 	//Retrieve the given visualization tile. Load the source FRF tile into the memory cache if necessary.
 	//If a visualization tile is already loaded with the same tile key as the argument, update the existing
@@ -308,8 +327,8 @@ namespace Maps {
 				cacheItemsToDestroy.reserve(64U);
 				for (auto & kv : m_cache) {
 					auto ageSeconds = std::chrono::duration_cast<std::chrono::seconds>(now - kv.second.m_lastTouch);
-					if ((ageSeconds > ExpirationTimeSeconds) && (m_TilesWithcurrentVizEvalJobs.count(kv.first) == 0U)) {
-						//The tile has not been used in a long time and we don't have a job queued up that needs it.
+					if ((ageSeconds > ExpirationTimeSeconds) && (m_TilesWithcurrentVizEvalJobs.count(kv.first) == 0U) && (kv.second.m_pinCount == 0)) {
+						//The tile has not been used in a long time and we don't have a job queued up (or a low-res update underway) that needs it.
 						cacheItemsToDestroy.push_back(kv.first);
 					}
 				}
@@ -437,40 +456,110 @@ namespace Maps {
 		}
 	}
 	
-	//Compute the average of 4 adjacent pixels (in a square) from the source FRF image and put the result in the given location in the destination image.
-	//The average happens layer-by-layer and assumes identical layer ordering (for speed).
-	static void BlockAverageFRF(FRFImage * SourceImage, FRFImage * DestImage, int SourceFirstRow, int SourceFirstCol, int DestRow, int DestCol) {
-		for (uint16_t layerIndex = 0U; layerIndex < SourceImage->NumberOfLayers(); layerIndex++) {
-			double val00 = SourceImage->Layer(layerIndex)->GetValue(uint32_t(SourceFirstRow),  uint32_t(SourceFirstCol));
-			double val01 = SourceImage->Layer(layerIndex)->GetValue(uint32_t(SourceFirstRow),  uint32_t(SourceFirstCol+1));
-			double val10 = SourceImage->Layer(layerIndex)->GetValue(uint32_t(SourceFirstRow+1), uint32_t(SourceFirstCol));
-			double val11 = SourceImage->Layer(layerIndex)->GetValue(uint32_t(SourceFirstRow+1), uint32_t(SourceFirstCol+1));
-			int tally = 0;
-			double sum = 0.0;
-			if (! std::isnan(val00)) {
-				sum += val00;
-				tally++;
+	//2x2 NaN-aware block average of a pair of source rows: Dest[n] is the mean of the non-NaN values among Row0[2n], Row0[2n+1], Row1[2n], and
+	//Row1[2n+1], or NaN if all four are NaN. The vector and scalar paths add in the same order so they give identical results.
+	static inline void AverageRowPairs(double const * Row0, double const * Row1, double * Dest, size_t N) {
+		size_t numVectorized = 0U;
+		#if defined(__AVX2__)
+		{
+			__m256d const one = _mm256_set1_pd(1.0);
+			numVectorized = N - N % 4U;
+			for (size_t n = 0U; n < numVectorized; n += 4U) {
+				__m256d a0 = _mm256_loadu_pd(Row0 + 2U*n);     //Row 0, source cols 2n .. 2n+3
+				__m256d a1 = _mm256_loadu_pd(Row0 + 2U*n + 4U); //Row 0, source cols 2n+4 .. 2n+7
+				__m256d b0 = _mm256_loadu_pd(Row1 + 2U*n);
+				__m256d b1 = _mm256_loadu_pd(Row1 + 2U*n + 4U);
+
+				//Zero out NaNs and count the values that aren't NaN
+				__m256d va0 = _mm256_cmp_pd(a0, a0, _CMP_ORD_Q);
+				__m256d va1 = _mm256_cmp_pd(a1, a1, _CMP_ORD_Q);
+				__m256d vb0 = _mm256_cmp_pd(b0, b0, _CMP_ORD_Q);
+				__m256d vb1 = _mm256_cmp_pd(b1, b1, _CMP_ORD_Q);
+				__m256d sum0 = _mm256_add_pd(_mm256_and_pd(va0, a0),  _mm256_and_pd(vb0, b0));
+				__m256d sum1 = _mm256_add_pd(_mm256_and_pd(va1, a1),  _mm256_and_pd(vb1, b1));
+				__m256d cnt0 = _mm256_add_pd(_mm256_and_pd(va0, one), _mm256_and_pd(vb0, one));
+				__m256d cnt1 = _mm256_add_pd(_mm256_and_pd(va1, one), _mm256_and_pd(vb1, one));
+
+				//Add horizontal neighbors. hadd interleaves its inputs by 128-bit lane, so put the results back in column order.
+				__m256d sum = _mm256_permute4x64_pd(_mm256_hadd_pd(sum0, sum1), 0xD8);
+				__m256d cnt = _mm256_permute4x64_pd(_mm256_hadd_pd(cnt0, cnt1), 0xD8);
+
+				//A count of 0 gives 0/0 = NaN, which is what we want
+				_mm256_storeu_pd(Dest + n, _mm256_div_pd(sum, cnt));
 			}
-			if (! std::isnan(val01)) {
-				sum += val01;
-				tally++;
+		}
+		#endif
+
+		//Scalar path (and tail for the AVX2 path)
+		for (size_t n = numVectorized; n < N; n++) {
+			double v[4] = { Row0[2U*n], Row1[2U*n], Row0[2U*n + 1U], Row1[2U*n + 1U] };
+			double sum[2] = { 0.0, 0.0 };
+			double cnt[2] = { 0.0, 0.0 };
+			for (int k = 0; k < 4; k++) {
+				if (! std::isnan(v[k])) {
+					sum[k/2] += v[k];
+					cnt[k/2] += 1.0;
+				}
 			}
-			if (! std::isnan(val10)) {
-				sum += val10;
-				tally++;
+			Dest[n] = (sum[0] + sum[1]) / (cnt[0] + cnt[1]);
+		}
+	}
+	
+	//Update one quadrant of a layer of a low-res tile from the child tile that covers it. The quadrant is the 128x128 block with UL corner
+	//(DestFirstRow, DestFirstCol). Rows are decoded into buffers so the averaging runs on plain arrays.
+	static void DownsampleQuadrant(FRFLayer * SourceLayer, FRFLayer * DestLayer, int DestFirstRow, int DestFirstCol) {
+		double row0[256], row1[256], destRow[128];
+		for (int row = 0; row < 128; row++) {
+			for (int col = 0; col < 256; col++) {
+				row0[col] = SourceLayer->GetValue(uint32_t(2*row),     uint32_t(col));
+				row1[col] = SourceLayer->GetValue(uint32_t(2*row + 1), uint32_t(col));
 			}
-			if (! std::isnan(val11)) {
-				sum += val11;
-				tally++;
+			AverageRowPairs(row0, row1, destRow, 128U);
+			for (int col = 0; col < 128; col++)
+				DestLayer->SetValue(uint32_t(DestFirstRow + row), uint32_t(DestFirstCol + col), destRow[col]);
+		}
+	}
+	
+	//Update the given tiles on one level from their children on the level above. Only quadrants whose child is in ChildTiles are updated - in
+	//general we won't have (and don't need) all of the child tiles in memory, just the ones that may have changed. All tiles involved must be
+	//pinned and in FRFTiles. Each (tile, layer) pair is a separate job on the work-stealing pool; jobs write disjoint data and only read the level
+	//above, which is finished. This assumes identical layer ordering in all tiles (for speed).
+	void DataTileProvider::UpdateLowResLevel(std::vector<Tile> const & LowResTiles, std::unordered_set<Tile> const & ChildTiles,
+	                                         std::unordered_map<Tile, FRFImage *> const & FRFTiles) {
+		struct Job {
+			FRFImage * DestTile;
+			FRFImage * Children[4]; //UL, UR, LL, LR - null if the quadrant doesn't need updating
+			uint16_t LayerIndex;
+		};
+		std::vector<Job> jobs;
+		for (Tile lowResTile : LowResTiles) {
+			Job job;
+			job.DestTile = FRFTiles.at(lowResTile);
+			for (int quadrant = 0; quadrant < 4; quadrant++) {
+				Tile child(lowResTile.Xi*2 + quadrant % 2, lowResTile.Yi*2 + quadrant / 2, lowResTile.Zoom + 1);
+				job.Children[quadrant] = (ChildTiles.count(child) > 0U) ? FRFTiles.at(child) : nullptr;
+			}
+			for (uint16_t layerIndex = 0U; layerIndex < job.DestTile->NumberOfLayers(); layerIndex++) {
+				job.LayerIndex = layerIndex;
+				jobs.push_back(job);
 			}
-			double destVal = (tally == 0) ? std::nan("") : sum / double(tally);
-			DestImage->Layer(layerIndex)->SetValue(uint32_t(DestRow), uint32_t(DestCol), destVal);
 		}
+		
+		WorkStealingPool::Instance().ParallelFor(jobs.size(), [&jobs](size_t JobIndex) {
+			Job const & job(jobs[JobIndex]);
+			FRFLayer * destLayer = job.DestTile->Layer(job.LayerIndex);
+			for (int quadrant = 0; quadrant < 4; quadrant++) {
+				if (job.Children[quadrant] != nullptr)
+					DownsampleQuadrant(job.Children[quadrant]->Layer(job.LayerIndex), destLayer, 128*(quadrant / 2), 128*(quadrant % 2));
+			}
+		});
 	}
 	
 	//We could do some sophistocated stuff here like trying to figure out on which zoom level a given edit will result in a change of size less than
 	//a certain number of pixels. However, to keep it simple we will just go up a fixed number of levels from the edit level. Note that if we go
 	//up 8 zoom levels an entire tile at the edit level will ocupy a single pixel, so this seems like overkill.
+	//The cache lock is only held to pin the tiles we need, to mark each level as edited when it is done, and to unpin them at the end, so
+	//viz tile evaluation and data access aren't blocked while a big edit propagates.
 	void DataTileProvider::UpdateLowerResTiles(std::unordered_set<Tile> const & EditedTiles) {
 		std::cerr << "Updating low res tiles. Edited tiles at edit level: " << EditedTiles.size() << "\r\n";
 		
@@ -494,76 +583,41 @@ namespace Maps {
 		//Initiate a load on all required tiles and wait until they are all loaded - note that we need the edited tiles loaded even though we don't modify them
 		TouchLoadFRFTilesAndWait(TilesRequired);
 		
+		//Pin the tiles so they stay in the cache while we work on them without the lock
+		std::unordered_map<Tile, FRFImage *> FRFTiles;
 		{
 			std::scoped_lock cacheLock(m_cache_mtx); //Lock the cache
-			if (! AllTilesPresent(TilesRequired))
+			if (! AllTilesPresent(TilesRequired)) {
 				Log.print("Internal Error - needed tile removed from cache before low-res update could take place.");
-			else {
-				//Starting with the highest zoom level and working down, update tiles based on the next highest level.
-				for (size_t batch = 1U; batch < RelaventTiles.size(); batch++) {
-					for (Tile lowResTile : RelaventTiles[batch]) {
-						//We don't want to just fill in every pixel because in general we won't have (and don't need)
-						//all of the child tiles in memory... we just need to update the portion of the tile impacted by possible
-						//changes in one of the edited tiles. So we do it in quarters and check for whether the corresponding
-						//child tiles for a given quarter is in the RelaventTiles vector on the previous level.
-						FRFImage * DestTile = m_cache.at(lowResTile).m_FRFTile.get();
-						
-						//Update UL Quadrant if needed
-						Tile ULChild(lowResTile.Xi*2, lowResTile.Yi*2, lowResTile.Zoom + 1);
-						if (RelaventTiles[batch - 1U].count(ULChild) > 0U) {
-							//Update the UL Quadrant
-							for (int row = 0; row < 128; row++) {
-								for (int col = 0; col < 128; col++) {
-									FRFImage * SourceTile = m_cache.at(ULChild).m_FRFTile.get();
-									BlockAverageFRF(SourceTile, DestTile, 2*row, 2*col, row, col);
-								}
-							}
-						}
-						
-						//Update UR Quadrant if needed
-						Tile URChild(lowResTile.Xi*2 + 1, lowResTile.Yi*2, lowResTile.Zoom + 1);
-						if (RelaventTiles[batch - 1U].count(URChild) > 0U) {
-							//Update the UR Quadrant
-							for (int row = 0; row < 128; row++) {
-								for (int col = 0; col < 128; col++) {
-									FRFImage * SourceTile = m_cache.at(URChild).m_FRFTile.get();
-									BlockAverageFRF(SourceTile, DestTile, 2*row, 2*col, row, 128 + col);
-								}
-							}
-						}
-						
-						//Update LL Quadrant if needed
-						Tile LLChild(lowResTile.Xi*2, lowResTile.Yi*2 + 1, lowResTile.Zoom + 1);
-						if (RelaventTiles[batch - 1U].count(LLChild) > 0U) {
-							//Update the LL Quadrant
-							for (int row = 0; row < 128; row++) {
-								for (int col = 0; col < 128; col++) {
-									FRFImage * SourceTile = m_cache.at(LLChild).m_FRFTile.get();
-									BlockAverageFRF(SourceTile, DestTile, 2*row, 2*col, 128 + row, col);
-								}
-							}
-						}
-						
-						//Update LR Quadrant if needed
-						Tile LRChild(lowResTile.Xi*2 + 1, lowResTile.Yi*2 + 1, lowResTile.Zoom + 1);
-						if (RelaventTiles[batch - 1U].count(LRChild) > 0U) {
-							//Update the LR Quadrant
-							for (int row = 0; row < 128; row++) {
-								for (int col = 0; col < 128; col++) {
-									FRFImage * SourceTile = m_cache.at(LRChild).m_FRFTile.get();
-									BlockAverageFRF(SourceTile, DestTile, 2*row, 2*col, 128 + row, 128 + col);
-								}
-							}
-						}
-						
-						//Mark the tile as edited and update timestamps
-						m_cache.at(lowResTile).m_FRFEdited = true;
-						m_cache.at(lowResTile).m_LastEditTime = std::chrono::steady_clock::now();
-						DataTileCacheItem::UpdateFRFTileTimeTag(DestTile);
-					}
-				}
+				return;
+			}
+			for (Tile tile : TilesRequired) {
+				DataTileCacheItem & cacheItem(m_cache.at(tile));
+				cacheItem.m_pinCount++;
+				FRFTiles[tile] = cacheItem.m_FRFTile.get();
 			}
 		}
+		
+		//Starting with the highest zoom level and working down, update tiles based on the next highest level.
+		for (size_t batch = 1U; batch < RelaventTiles.size(); batch++) {
+			std::vector<Tile> lowResTiles(RelaventTiles[batch].cbegin(), RelaventTiles[batch].cend());
+			UpdateLowResLevel(lowResTiles, RelaventTiles[batch - 1U], FRFTiles);
+			
+			//Mark the tiles on this level as edited and update timestamps
+			std::scoped_lock cacheLock(m_cache_mtx); //Lock the cache
+			for (Tile lowResTile : lowResTiles) {
+				DataTileCacheItem & cacheItem(m_cache.at(lowResTile));
+				cacheItem.m_FRFEdited = true;
+				cacheItem.m_LastEditTime = std::chrono::steady_clock::now();
+				DataTileCacheItem::UpdateFRFTileTimeTag(cacheItem.m_FRFTile.get());
+			}
+		}
+		
+		{
+			std::scoped_lock cacheLock(m_cache_mtx); //Lock the cache
+			for (Tile tile : TilesRequired)
+				m_cache.at(tile).m_pinCount--;
+		}
 	}
 	
 	//Return index of the given layer in an FRF file. Returns -1 if not found.
@@ -781,6 +835,8 @@ namespace Maps {
 		for (auto & kv : m_cache) {
 			if (m_TilesWithcurrentVizEvalJobs.count(kv.first) > 0U)
 				Log.print("Warning in PurgeAllTiles(): Skipping item because a viz eval job is underway for it.");
+			else if (kv.second.m_pinCount > 0)
+				Log.print("Warning in PurgeAllTiles(): Skipping item because a low-res update is underway for it.");
 			else
 				cacheItemsToDestroy.push_back(kv.first);
 		}
@@ -42,6 +42,7 @@ namespace Maps {
 			std::unique_ptr<FRFImage> m_FRFTile;
 			bool m_FRFEdited = false;
 			TimePoint m_LastEditTime;
+			int m_pinCount = 0; //While > 0 the item is in use outside the cache lock (by a low-res update) and can't be garbage collected
 			
 			//Vis tiles are not explicitly double-buffered. Instead, to prevent screen blanking, we use delayed texture deletion
 			bool m_vizValid = false;
@@ -127,6 +128,8 @@ namespace Maps {
 			bool AllTilesPresent(std::vector<Tile> const & Tiles);
 			void TouchLoadFRFTilesAndWait(std::vector<Tile> const & Tiles);
 			void UpdateLowerResTiles(std::unordered_set<Tile> const & EditedTiles);
+			void UpdateLowResLevel(std::vector<Tile> const & LowResTiles, std::unordered_set<Tile> const & ChildTiles,
+			                       std::unordered_map<Tile, FRFImage *> const & FRFTiles);
 			bool ExecuteEditActionOnTile_Circle(PaintActionItem const & Action, Tile tile, Eigen::Vector4d const & AABB_NM);
 			bool ExecuteEditActionOnTile_Rectangle(PaintActionItem const & Action, Tile tile, Eigen::Vector4d const & AABB_NM);
 			
@@ -166,6 +169,13 @@ namespace Maps {
 			inline void Paint_Rect(Eigen::Vector2d const & Center_NM, double LengthX, double LengthY, double AngleDeg, DataLayer layer, double Value);
 			inline void Erase_Rect(Eigen::Vector2d const & Center_NM, double LengthX, double LengthY, double AngleDeg, DataLayer layer);
 			
+			//Prefetch support (see TilePrefetcher.hpp). PrefetchFRFTile() starts a load of an FRF tile at the given prefetch priority
+			//(< TileDemandPriority) if it isn't in memory already and returns true if it is. Loaded tiles are not touched, so prefetching never
+			//keeps tiles alive. Viz tiles are not prefetched - they are evaluated on demand from the (then loaded) FRF tiles.
+			//CancelStalePrefetches() drops queued prefetch requests that haven't been repeated since Cutoff.
+			bool PrefetchFRFTile(Tile Key, double Priority);
+			void CancelStalePrefetches(TimePoint Cutoff);
+			
 			//Force-purge tiles from cache. Note that the cache will self-garbage-collect so this is only needed if you are changing things on disk
 			//or want to force a flush of cached data back to disk (like on exit)
 			void PurgeAllTiles();
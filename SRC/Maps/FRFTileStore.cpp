@@ -16,7 +16,8 @@
 
 namespace Maps {
 
-FRFTileStore::FRFTileStore(IFRFFileReceiver * receiver, Journal & LogRef) : Log(LogRef), m_receiver(receiver), m_threads(4) {
+FRFTileStore::FRFTileStore(IFRFFileReceiver * receiver, Journal & LogRef)
+	: Log(LogRef), m_receiver(receiver), m_requests(4U, MaxOutstandingRequests, MaxPendingPrefetches) {
 	std::filesystem::path KVStorePath = Handy::Paths::ThisExecutableDirectory() / "Recon_FRFTileStore";
 	
 	m_file = new SimpleKVStore(KVStorePath, Log);
@@ -63,44 +64,32 @@ void FRFTileStore::BlockRemove(Tile tile) {
 }
 
 void FRFTileStore::WaitFinish() {
-	m_threads.Wait();
+	m_requests.Wait();
 }
 
-void FRFTileStore::RetrieveAsync(Tile tile) {
-	bool begin = false;
-	{
-		std::scoped_lock lock(m_requests_mtx);
-		if ((! Handy::Contains(m_requests, tile)) && (m_requests.size() < MaxOutstandingRequests)) {
-			m_requests.insert(tile);
-			begin = true;
-		}
-	}
-	
-	if (begin) {
-		m_threads.AddJobToFront([this,tile]() {
-			try {
-				auto data = BlockTryGet(tile);
-				
-				//Decode the data in the buffer into an FRFImage Object. ImagePtr will be nullptr on failure
-				FRFImage * ImagePtr = nullptr;
-				if (data != nullptr) {
-					ImagePtr = new FRFImage;
-					ImagePtr->LoadFromRAM(*data); //Will be an empty image on failure
-					if ((ImagePtr->Width() == 0U) || (ImagePtr->Height() == 0U)) {
-						delete ImagePtr;
-						ImagePtr = nullptr;
-					}
+void FRFTileStore::RetrieveAsync(Tile tile, double Priority) {
+	//If the request is already queued this just updates its priority. If there is no room we drop it - callers re-request tiles until they arrive.
+	m_requests.Submit(tile, Priority, [this,tile](double) {
+		try {
+			auto data = BlockTryGet(tile);
+			
+			//Decode the data in the buffer into an FRFImage Object. ImagePtr will be nullptr on failure
+			FRFImage * ImagePtr = nullptr;
+			if (data != nullptr) {
+				ImagePtr = new FRFImage;
+				ImagePtr->LoadFromRAM(*data); //Will be an empty image on failure
+				if ((ImagePtr->Width() == 0U) || (ImagePtr->Height() == 0U)) {
+					delete ImagePtr;
+					ImagePtr = nullptr;
 				}
-				
-				//Call OnReceivedFRFTile even if we failed to retrieve or decode the file. This serves to notify of failed attempt.
-				m_receiver->OnReceivedFRFTile(tile, ImagePtr);
-			} catch(...) {
-				Log.print("Error in FRFTileStore::RetrieveAsync: Retrieval failed for tile: " + tile.ToString());
 			}
-			std::scoped_lock lock(m_requests_mtx);
-			m_requests.erase(tile);
-		});
-	}
+			
+			//Call OnReceivedFRFTile even if we failed to retrieve or decode the file. This serves to notify of failed attempt.
+			m_receiver->OnReceivedFRFTile(tile, ImagePtr);
+		} catch(...) {
+			Log.print("Error in FRFTileStore::RetrieveAsync: Retrieval failed for tile: " + tile.ToString());
+		}
+	});
 }
 }
 
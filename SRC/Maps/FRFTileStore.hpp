@@ -11,6 +11,7 @@
 //Project Includes
 #include "Tile.hpp"
 #include "Interfaces.hpp"
+#include "TileRequestQueue.hpp"
 #include "../Journal.h"
 
 class SimpleKVStore;
@@ -19,22 +20,18 @@ namespace Maps {
 	class FRFTileStore {
 		public:
 			static constexpr int32_t MaxOutstandingRequests = 16;
+			static constexpr int32_t MaxPendingPrefetches   = 8; //Prefetch requests can only take up this much of the queue
 
 		private:
 			Journal & Log;
-			std::mutex m_requests_mtx;
 			
 			SimpleKVStore    * m_file     = nullptr;
 			IFRFFileReceiver * m_receiver = nullptr;
-			std::unordered_set<Tile> m_requests;
 
-			Handy::ThreadPool m_threads;
+			TileRequestQueue<Tile> m_requests;
 
 		public:
-			size_t NumOutstandingRequests() {
-				std::scoped_lock lock(m_requests_mtx);
-				return m_requests.size();
-			}
+			size_t NumOutstandingRequests() { return m_requests.NumOutstanding(); }
 
 			FRFTileStore(IFRFFileReceiver * receiver, Journal & LogRef);
 			~FRFTileStore();
@@ -42,7 +39,9 @@ namespace Maps {
 			void BlockAdd(Tile tile, FRFImage const * Data);
 			void BlockRemove(Tile tile);
 
-			void RetrieveAsync(Tile tile);
+			//Priority < TileDemandPriority makes this a prefetch request (see TileRequestQueue.hpp)
+			void RetrieveAsync(Tile tile, double Priority = TileDemandPriority);
+			void CancelStalePrefetches(std::chrono::time_point<std::chrono::steady_clock> Cutoff) { m_requests.CancelStalePrefetches(Cutoff); }
 			void WaitFinish();
 
 			void PurgeAll();
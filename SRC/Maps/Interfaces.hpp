@@ -14,9 +14,11 @@
 
 namespace Maps {
 
+	//data points directly into the cache file mapping (size bytes) and keeps it alive - it is nullptr if the tile wasn't in the cache.
+	//Priority is the priority the tile was requested with, so a cache miss can be forwarded to the web retriever at the same priority.
 	struct ITileFileReceiver {
 		virtual ~ITileFileReceiver() = default;
-		virtual void OnReceivedFile(Tile tile, SatelliteSource source, std::shared_ptr<std::vector<uint8_t>> data) = 0;
+		virtual void OnReceivedFile(Tile tile, SatelliteSource source, std::shared_ptr<uint8_t const> data, size_t size, double Priority) = 0;
 	};
 
 	struct ITileWebReceiver {
@@ -0,0 +1,252 @@
+//This module provides a local tangent-plane (ENU) context for cheap, batched coordinate conversions over a limited area
+//Author: Bryan Poling
+//Copyright (c) 2022 Sentek Systems, LLC. All rights reserved.
+
+//System Includes
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+//Eigen Includes
+#include "../../../eigen/Eigen/QR"
+
+//Project Includes
+#include "LocalTangentPlane.hpp"
+
+//LatLonToNM() and NMToLatLon() use this (truncated) value of pi - we use the same one so NM results agree with them exactly
+static constexpr double PI_NM = 3.14159265358979;
+
+//The models are fitted over a slightly larger square than the one they are advertised for, so accuracy doesn't fall off at the edges.
+//Errors are measured on a grid that doesn't coincide with the fit grid.
+static constexpr double FitMargin       = 1.1;
+static constexpr int    FitGridSize     = 9;
+static constexpr int    CheckGridSize   = 11;
+
+// ************************************************************************************************************************************************
+// *******************************************************   Generic Local Utility Functions   ****************************************************
+// ************************************************************************************************************************************************
+
+//Least-squares fit of a full cubic in (s,t): 1, s, t, s^2, st, t^2, s^3, s^2 t, s t^2, t^3. Each column of Values is fitted separately
+//(sharing one factorization) and the coefficients are returned in the corresponding column of the result.
+static Eigen::MatrixXd FitCubic2D(std::vector<double> const & S, std::vector<double> const & T, Eigen::MatrixXd const & Values) {
+	Eigen::MatrixXd A(S.size(), 10);
+	for (size_t n = 0U; n < S.size(); n++) {
+		double s = S[n];
+		double t = T[n];
+		A.row(n) << 1.0, s, t, s*s, s*t, t*t, s*s*s, s*s*t, s*t*t, t*t*t;
+	}
+	return A.colPivHouseholderQr().solve(Values);
+}
+
+//Least-squares fit of a quintic in u: 1, u, u^2, u^3, u^4, u^5
+static Eigen::VectorXd FitPoly1D(std::vector<double> const & U, std::vector<double> const & Values) {
+	Eigen::MatrixXd A(U.size(), 6);
+	Eigen::VectorXd b(U.size());
+	for (size_t n = 0U; n < U.size(); n++) {
+		double u = U[n];
+		A.row(n) << 1.0, u, u*u, u*u*u, u*u*u*u, u*u*u*u*u;
+		b(n) = Values[n];
+	}
+	return A.colPivHouseholderQr().solve(b);
+}
+
+//Copy a column of fitted coefficients into a fixed-size coefficient array
+template<size_t K> static std::array<double, K> ToCoeffs(Eigen::MatrixXd const & X, int Col) {
+	std::array<double, K> C;
+	for (size_t n = 0U; n < K; n++)
+		C[n] = X(n, Col);
+	return C;
+}
+
+// ************************************************************************************************************************************************
+// ******************************************************   LocalTangentPlane Definitions   *******************************************************
+// ************************************************************************************************************************************************
+
+LocalTangentPlane::LocalTangentPlane(Eigen::Vector3d const & Origin_LLA, double Radius) {
+	m_origin_LLA  = Origin_LLA;
+	m_origin_ECEF = LLA2ECEF(Origin_LLA);
+	m_origin_NM   = LatLonToNM(Eigen::Vector2d(Origin_LLA(0), Origin_LLA(1)));
+	m_C_ECEF_ENU  = latLon_2_C_ECEF_ENU(Origin_LLA(0), Origin_LLA(1));
+	m_radius      = std::max(Radius, 1.0);
+	m_metersPerNMUnit = NMUnitsToMeters(1.0, m_origin_NM(1));
+	m_cosLat0     = std::cos(Origin_LLA(0));
+	Fit();
+}
+
+LocalTangentPlane::LocalTangentPlane(Eigen::Vector2d const & Origin_NM, double Radius) :
+	LocalTangentPlane(Eigen::Vector3d(NMToLatLon(Origin_NM)(0), NMToLatLon(Origin_NM)(1), 0.0), Radius) { }
+
+LocalTangentPlane LocalTangentPlane::Covering(double const * Lat, double const * Lon, size_t N, double MinRadius) {
+	if (N == 0U)
+		return LocalTangentPlane(Eigen::Vector3d(0.0, 0.0, 0.0), MinRadius);
+	double minLat = Lat[0], maxLat = Lat[0], minLon = Lon[0], maxLon = Lon[0];
+	for (size_t n = 1U; n < N; n++) {
+		minLat = std::min(minLat, Lat[n]);
+		maxLat = std::max(maxLat, Lat[n]);
+		minLon = std::min(minLon, Lon[n]);
+		maxLon = std::max(maxLon, Lon[n]);
+	}
+	double lat0 = 0.5*(minLat + maxLat);
+	double lon0 = 0.5*(minLon + maxLon);
+
+	//6.4e6 m bounds both radii of curvature of the ref ellipsoid, so the fitted square contains every point. Add 5% so points don't sit on its edge.
+	double R = 6.4e6;
+	double radius = 1.05*std::max(0.5*(maxLat - minLat)*R, 0.5*(maxLon - minLon)*R*std::cos(lat0));
+	return LocalTangentPlane(Eigen::Vector3d(lat0, lon0, 0.0), std::max(radius, MinRadius));
+}
+
+//Fit the polynomial models to the exact routines and measure their worst-case error
+void LocalTangentPlane::Fit(void) {
+	//Radii of curvature of the ref ellipsoid at the origin (meridian and prime vertical) - these set the angular size of the fitted square
+	double a = 6378137.0;
+	double ecc = 0.081819190842621;
+	double eccSquared = ecc*ecc;
+	double sinLat0 = std::sin(m_origin_LLA(0));
+	double w = 1.0 - eccSquared*sinLat0*sinLat0;
+	double R_M = a*(1.0 - eccSquared)/(w*std::sqrt(w));
+	double R_N = a/std::sqrt(w);
+	m_latScale = R_M/m_radius;
+	m_lonScale = R_N*std::max(m_cosLat0, 1e-6)/m_radius;
+	double dLatMax = 1.0/m_latScale;
+	double dNMYMax = dLatMax/(PI_NM*std::max(std::cos(std::fabs(m_origin_LLA(0)) + dLatMax), 1e-6));
+	m_nmYScale = 1.0/dNMYMax;
+
+	//Sample the exact routines
+	int numSamples = FitGridSize*FitGridSize;
+	std::vector<double> S, T, SInv, TInv;
+	Eigen::MatrixXd ENU_Samples(numSamples, 3);
+	Eigen::MatrixXd dLL_Samples(numSamples, 2);
+	for (int i = 0; i < FitGridSize; i++) {
+		for (int j = 0; j < FitGridSize; j++) {
+			double s = FitMargin*(2.0*double(i)/double(FitGridSize - 1) - 1.0);
+			double t = FitMargin*(2.0*double(j)/double(FitGridSize - 1) - 1.0);
+			double dLat = s/m_latScale;
+			double dLon = t/m_lonScale;
+			Eigen::Vector3d ENU = LLAToENU_Exact(Eigen::Vector3d(m_origin_LLA(0) + dLat, m_origin_LLA(1) + dLon, 0.0));
+			int row = int(S.size());
+			S.push_back(s);
+			T.push_back(t);
+			SInv.push_back(ENU(0)/m_radius);
+			TInv.push_back(ENU(1)/m_radius);
+			ENU_Samples.row(row) = ENU.transpose();
+			dLL_Samples.row(row) << dLat, dLon;
+		}
+	}
+	Eigen::MatrixXd fwd = FitCubic2D(S, T, ENU_Samples);
+	Eigen::MatrixXd inv = FitCubic2D(SInv, TInv, dLL_Samples);
+	m_E_fromLL    = ToCoeffs<10>(fwd, 0);
+	m_N_fromLL    = ToCoeffs<10>(fwd, 1);
+	m_U_fromLL    = ToCoeffs<10>(fwd, 2);
+	m_dLat_fromEN = ToCoeffs<10>(inv, 0);
+	m_dLon_fromEN = ToCoeffs<10>(inv, 1);
+
+	std::vector<double> dLats, dNMYs, Us, Ss;
+	for (int i = 0; i < 3*FitGridSize; i++) {
+		double s = FitMargin*(2.0*double(i)/double(3*FitGridSize - 1) - 1.0);
+		double dLat = s/m_latScale;
+		double dNMY = LatLonToNM(Eigen::Vector2d(m_origin_LLA(0) + dLat, m_origin_LLA(1)))(1) - m_origin_NM(1);
+		Ss.push_back(s);
+		Us.push_back(dNMY*m_nmYScale);
+		dLats.push_back(dLat);
+		dNMYs.push_back(dNMY);
+	}
+	m_dLat_fromNMY = ToCoeffs<6>(FitPoly1D(Us, dLats), 0);
+	m_NMY_fromdLat = ToCoeffs<6>(FitPoly1D(Ss, dNMYs), 0);
+
+	//Measure the worst horizontal error of each conversion against the exact routines, over the advertised square
+	m_maxError = 0.0;
+	for (int i = 0; i < CheckGridSize; i++) {
+		for (int j = 0; j < CheckGridSize; j++) {
+			double s = 2.0*double(i)/double(CheckGridSize - 1) - 1.0;
+			double t = 2.0*double(j)/double(CheckGridSize - 1) - 1.0;
+			Eigen::Vector2d LL(m_origin_LLA(0) + s/m_latScale, m_origin_LLA(1) + t/m_lonScale);
+			Eigen::Vector3d ENU_Exact = LLAToENU_Exact(Eigen::Vector3d(LL(0), LL(1), 0.0));
+			Eigen::Vector2d EN_Exact(ENU_Exact(0), ENU_Exact(1));
+			Eigen::Vector2d NM_Exact = LatLonToNM(LL);
+
+			Eigen::Vector2d LLErr = ENToLatLon(EN_Exact) - LL;
+			Eigen::Vector2d NMErr = ENToNM(EN_Exact) - NM_Exact;
+			double errLLToEN = (LatLonToEN(LL) - EN_Exact).norm();
+			double errENToLL = Eigen::Vector2d(LLErr(0)*R_M, LLErr(1)*R_N*m_cosLat0).norm();
+			double errNMToEN = (NMToEN(NM_Exact) - EN_Exact).norm();
+			double errENToNM = NMErr.norm()*NMUnitsToMeters(1.0, NM_Exact(1));
+			double errU      = std::fabs(LLAToENU(Eigen::Vector3d(LL(0), LL(1), 0.0))(2) - ENU_Exact(2));
+			m_maxError = std::max({m_maxError, errLLToEN, errENToLL, errNMToEN, errENToNM, errU});
+		}
+	}
+}
+
+void LocalTangentPlane::LLAToENU(double const * Lat, double const * Lon, double const * Alt, size_t N, double * E, double * North, double * U) const {
+	double const lat0 = m_origin_LLA(0);
+	double const lon0 = m_origin_LLA(1);
+	double const cosLat0 = m_cosLat0;
+	double const sinLat0 = std::sin(lat0);
+	for (size_t n = 0U; n < N; n++) {
+		double dLat = Lat[n] - lat0;
+		double dLon = Lon[n] - lon0;
+		double s = dLat*m_latScale;
+		double t = dLon*m_lonScale;
+		double h = (Alt == nullptr) ? 0.0 : Alt[n];
+
+		//Point on the ref ellipsoid plus h times the local vertical (to second order in the offsets from the origin)
+		E[n]     = EvalCubic(m_E_fromLL, s, t) + h*(cosLat0*dLon - sinLat0*dLat*dLon);
+		North[n] = EvalCubic(m_N_fromLL, s, t) + h*(dLat + 0.5*sinLat0*cosLat0*dLon*dLon);
+		U[n]     = EvalCubic(m_U_fromLL, s, t) + h*(1.0 - 0.5*(dLat*dLat + cosLat0*cosLat0*dLon*dLon));
+	}
+}
+
+void LocalTangentPlane::ENUToLLA(double const * E, double const * North, double const * U, size_t N, double * Lat, double * Lon, double * Alt) const {
+	double const lat0 = m_origin_LLA(0);
+	double const lon0 = m_origin_LLA(1);
+	double const cosLat0 = m_cosLat0;
+	double const sinLat0 = std::sin(lat0);
+	for (size_t n = 0U; n < N; n++) {
+		//Invert assuming the point is on the ref ellipsoid, estimate the altitude and then invert again with the horizontal offset due to
+		//the tilt of the local vertical removed. A single correction is enough at drone altitudes.
+		double dLat = EvalCubic(m_dLat_fromEN, E[n]/m_radius, North[n]/m_radius);
+		double dLon = EvalCubic(m_dLon_fromEN, E[n]/m_radius, North[n]/m_radius);
+		double h = 0.0;
+		if (U != nullptr) {
+			h = U[n] - EvalCubic(m_U_fromLL, dLat*m_latScale, dLon*m_lonScale);
+			double e = E[n]     - h*(cosLat0*dLon - sinLat0*dLat*dLon);
+			double v = North[n] - h*(dLat + 0.5*sinLat0*cosLat0*dLon*dLon);
+			dLat = EvalCubic(m_dLat_fromEN, e/m_radius, v/m_radius);
+			dLon = EvalCubic(m_dLon_fromEN, e/m_radius, v/m_radius);
+			h = (U[n] - EvalCubic(m_U_fromLL, dLat*m_latScale, dLon*m_lonScale)) / (1.0 - 0.5*(dLat*dLat + cosLat0*cosLat0*dLon*dLon));
+		}
+		Lat[n] = lat0 + dLat;
+		Lon[n] = lon0 + dLon;
+		if (Alt != nullptr)
+			Alt[n] = h;
+	}
+}
+
+void LocalTangentPlane::NMToEN(double const * X, double const * Y, size_t N, double * E, double * North) const {
+	for (size_t n = 0U; n < N; n++) {
+		double dLon = PI_NM*(X[n] - m_origin_NM(0));
+		double dLat = EvalPoly(m_dLat_fromNMY, (Y[n] - m_origin_NM(1))*m_nmYScale);
+		double s = dLat*m_latScale;
+		double t = dLon*m_lonScale;
+		E[n]     = EvalCubic(m_E_fromLL, s, t);
+		North[n] = EvalCubic(m_N_fromLL, s, t);
+	}
+}
+
+void LocalTangentPlane::ENToNM(double const * E, double const * North, size_t N, double * X, double * Y) const {
+	for (size_t n = 0U; n < N; n++) {
+		double s = E[n]/m_radius;
+		double t = North[n]/m_radius;
+		double dLat = EvalCubic(m_dLat_fromEN, s, t);
+		double dLon = EvalCubic(m_dLon_fromEN, s, t);
+		X[n] = m_origin_NM(0) + dLon/PI_NM;
+		Y[n] = m_origin_NM(1) + EvalPoly(m_NMY_fromdLat, dLat*m_latScale);
+	}
+}
+
+Eigen::Vector3d LocalTangentPlane::LLAToENU_Exact(Eigen::Vector3d const & Position_LLA) const {
+	return m_C_ECEF_ENU*(LLA2ECEF(Position_LLA) - m_origin_ECEF);
+}
+
+Eigen::Vector3d LocalTangentPlane::ENUToLLA_Exact(Eigen::Vector3d const & Position_ENU) const {
+	return ECEF2LLA(m_origin_ECEF + m_C_ECEF_ENU.transpose()*Position_ENU);
+}
@@ -0,0 +1,159 @@
+//This module provides a local tangent-plane (ENU) context for cheap, batched coordinate conversions over a limited area
+//Author: Bryan Poling
+//Copyright (c) 2022 Sentek Systems, LLC. All rights reserved.
+#pragma once
+
+//System Includes
+#include <cstddef>
+#include <cmath>
+#include <array>
+
+//Eigen Includes
+#include "../../../eigen/Eigen/Core"
+
+//Project Includes
+#include "MapUtils.hpp"
+
+//A LocalTangentPlane is an ENU (East, North, Up) frame anchored at an origin on the WGS84 ellipsoid, along with precomputed polynomial
+//models of the conversions between that frame, (Lat, Lon, Alt) and Normalized Mercator. It is meant for code that converts many points
+//near one place - guidance, planning and simulation can work in metres with linear math instead of calling LLA2ECEF() / ECEF2LLA() (or the
+//trig in MetersToNMUnits()) for every point.
+//
+//The ENU frame is the exact one used elsewhere in the project: ENU = C_ECEF_ENU * (ECEF(point) - ECEF(origin)), with C_ECEF_ENU from
+//latLon_2_C_ECEF_ENU() at the origin. Rather than evaluating that with trig for every point, the constructor fits cubic polynomials (in
+//Lat/Lon offsets from the origin, or in E/N for the inverse) to the exact routines over a square of half-width Radius metres around the
+//origin. Altitude is handled with a second-order model of the tilt of the local vertical, which is good to well under a millimetre for
+//drone altitudes.
+//
+//Error bounds (horizontal position, versus LLA2ECEF()/ECEF2LLA() and LatLonToNM()/NMToLatLon()), for points within the fitted square:
+//  - The constructor measures the worst error of every conversion on a grid that is denser than the fit grid and stores it. Use
+//    GetMaxError() to check it for a particular context.
+//  - With the default radius (20 km) the measured error is under 0.5 mm at mid-latitudes (about 2 mm at 60 degrees and 5 cm at 80 degrees).
+//    For a 5 km radius it is under 0.01 mm at mid-latitudes. It grows roughly with Radius^4 - a 100 km context is only good to ~25 cm.
+//  - Altitudes up to a few hundred metres add well under a millimetre.
+//  - Outside the fitted square the polynomials degrade quickly. Check IsInRange() or re-anchor the context (e.g. a moving vehicle).
+//
+//The batch conversions take and return structure-of-arrays data (separate arrays for each coordinate). They do no trig and no allocation
+//(just a few polynomial evaluations per point), so the compiler can vectorize them. Objects are immutable after construction and safe to
+//share between threads.
+class LocalTangentPlane {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	static constexpr double DefaultRadius = 20000.0; //meters
+
+	LocalTangentPlane() : LocalTangentPlane(Eigen::Vector3d(0.0, 0.0, 0.0)) { }
+	LocalTangentPlane(Eigen::Vector3d const & Origin_LLA, double Radius = DefaultRadius); //Origin: [Lat (radians), Lon (radians), Alt (m)]
+	LocalTangentPlane(Eigen::Vector2d const & Origin_NM, double Radius = DefaultRadius);  //Origin in Normalized Mercator, on the ref ellipsoid
+	~LocalTangentPlane() = default;
+
+	//Get a context anchored at the center of the Lat/Lon bounding box of the given points (radians), with a radius that covers all of them
+	static LocalTangentPlane Covering(double const * Lat, double const * Lon, size_t N, double MinRadius = 1000.0);
+
+	Eigen::Vector3d GetOrigin_LLA(void)  const { return m_origin_LLA; }
+	Eigen::Vector3d GetOrigin_ECEF(void) const { return m_origin_ECEF; }
+	Eigen::Vector2d GetOrigin_NM(void)   const { return m_origin_NM; }
+	Eigen::Matrix3d GetC_ECEF_ENU(void)  const { return m_C_ECEF_ENU; }
+	double GetRadius(void)   const { return m_radius; }
+	double GetMaxError(void) const { return m_maxError; } //Worst measured horizontal error of any conversion in the fitted square (meters)
+
+	//Scale factors at the origin (same definition as MetersToNMUnits() and NMUnitsToMeters())
+	double GetMetersPerNMUnit(void) const { return m_metersPerNMUnit; }
+	double GetNMUnitsPerMeter(void) const { return 1.0/m_metersPerNMUnit; }
+
+	//Returns true if the given point is in the square the conversions were fitted over (given as EN or as [Lat, Lon])
+	bool IsInRange(Eigen::Vector2d const & Position_EN) const { return (std::fabs(Position_EN(0)) <= m_radius) && (std::fabs(Position_EN(1)) <= m_radius); }
+	bool IsInRangeLatLon(Eigen::Vector2d const & Position_LL) const {
+		return (std::fabs((Position_LL(0) - m_origin_LLA(0))*m_latScale) <= 1.0) && (std::fabs((Position_LL(1) - m_origin_LLA(1))*m_lonScale) <= 1.0);
+	}
+
+	//Single-point conversions. LLA: [Lat (radians), Lon (radians), Alt (m)]. LL: [Lat, Lon] on the ref ellipsoid. EN: the East and North components
+	//of ENU for a point on the ref ellipsoid (so EN <-> NM and EN <-> LL describe points on the ellipsoid, like the rest of the map code).
+	inline Eigen::Vector3d LLAToENU(Eigen::Vector3d const & Position_LLA) const;
+	inline Eigen::Vector3d ENUToLLA(Eigen::Vector3d const & Position_ENU) const;
+	inline Eigen::Vector2d LatLonToEN(Eigen::Vector2d const & Position_LL) const;
+	inline Eigen::Vector2d ENToLatLon(Eigen::Vector2d const & Position_EN) const;
+	inline Eigen::Vector2d NMToEN(Eigen::Vector2d const & Position_NM) const;
+	inline Eigen::Vector2d ENToNM(Eigen::Vector2d const & Position_EN) const;
+
+	//Batch conversions of N points (structure of arrays). In LLAToENU(), Alt may be nullptr (all points on the ref ellipsoid). In ENUToLLA(),
+	//U may be nullptr (points are taken to be on the ref ellipsoid and Alt is set to 0) and Alt may be nullptr if altitude isn't needed.
+	void LLAToENU(double const * Lat, double const * Lon, double const * Alt, size_t N, double * E, double * North, double * U) const;
+	void ENUToLLA(double const * E, double const * North, double const * U, size_t N, double * Lat, double * Lon, double * Alt) const;
+	void NMToEN(double const * X, double const * Y, size_t N, double * E, double * North) const;
+	void ENToNM(double const * E, double const * North, size_t N, double * X, double * Y) const;
+
+	//Exact (trig-based) reference conversions for the same frame. These are what the polynomial models are fitted to and checked against.
+	Eigen::Vector3d LLAToENU_Exact(Eigen::Vector3d const & Position_LLA) const;
+	Eigen::Vector3d ENUToLLA_Exact(Eigen::Vector3d const & Position_ENU) const;
+
+private:
+	using Cubic2D = std::array<double, 10>; //Coefficients of: 1, s, t, s^2, st, t^2, s^3, s^2 t, s t^2, t^3
+	using Poly1D  = std::array<double, 6>;  //Coefficients of: 1, u, u^2, u^3, u^4, u^5
+
+	Eigen::Vector3d m_origin_LLA;
+	Eigen::Vector3d m_origin_ECEF;
+	Eigen::Vector2d m_origin_NM;
+	Eigen::Matrix3d m_C_ECEF_ENU;
+	double m_radius;
+	double m_maxError = 0.0;
+	double m_metersPerNMUnit;
+	double m_cosLat0;
+
+	//Normalization: s = dLat * m_latScale, t = dLon * m_lonScale (both in [-1, 1] over the fitted square) and s = E/m_radius, t = N/m_radius
+	//for the inverse. The NM latitude model maps u = dY_NM * m_nmYScale to dLat.
+	double m_latScale;
+	double m_lonScale;
+	double m_nmYScale;
+	Cubic2D m_E_fromLL, m_N_fromLL, m_U_fromLL; //(s, t) from (dLat, dLon) -> ENU of the point on the ref ellipsoid
+	Cubic2D m_dLat_fromEN, m_dLon_fromEN;       //(s, t) from (E, N) -> (dLat, dLon)
+	Poly1D  m_dLat_fromNMY;                     //u from dY_NM -> dLat
+	Poly1D  m_NMY_fromdLat;                     //s from dLat -> dY_NM
+
+	void Fit(void);
+
+	static inline double EvalCubic(Cubic2D const & C, double s, double t) {
+		return C[0] + s*(C[1] + s*(C[3] + s*C[6] + t*C[7])) + t*(C[2] + t*(C[5] + t*C[9] + s*C[8]) + s*C[4]);
+	}
+	static inline double EvalPoly(Poly1D const & C, double u) {
+		return C[0] + u*(C[1] + u*(C[2] + u*(C[3] + u*(C[4] + u*C[5]))));
+	}
+};
+
+// *********************************************************************************************************************************
+// *******************************************   LocalTangentPlane Inline Definitions   ********************************************
+// *********************************************************************************************************************************
+inline Eigen::Vector3d LocalTangentPlane::LLAToENU(Eigen::Vector3d const & Position_LLA) const {
+	Eigen::Vector3d ENU;
+	LLAToENU(&Position_LLA(0), &Position_LLA(1), &Position_LLA(2), 1U, &ENU(0), &ENU(1), &ENU(2));
+	return ENU;
+}
+
+inline Eigen::Vector3d LocalTangentPlane::ENUToLLA(Eigen::Vector3d const & Position_ENU) const {
+	Eigen::Vector3d LLA;
+	ENUToLLA(&Position_ENU(0), &Position_ENU(1), &Position_ENU(2), 1U, &LLA(0), &LLA(1), &LLA(2));
+	return LLA;
+}
+
+inline Eigen::Vector2d LocalTangentPlane::LatLonToEN(Eigen::Vector2d const & Position_LL) const {
+	double s = (Position_LL(0) - m_origin_LLA(0)) * m_latScale;
+	double t = (Position_LL(1) - m_origin_LLA(1)) * m_lonScale;
+	return Eigen::Vector2d(EvalCubic(m_E_fromLL, s, t), EvalCubic(m_N_fromLL, s, t));
+}
+
+inline Eigen::Vector2d LocalTangentPlane::ENToLatLon(Eigen::Vector2d const & Position_EN) const {
+	double s = Position_EN(0) / m_radius;
+	double t = Position_EN(1) / m_radius;
+	return Eigen::Vector2d(m_origin_LLA(0) + EvalCubic(m_dLat_fromEN, s, t), m_origin_LLA(1) + EvalCubic(m_dLon_fromEN, s, t));
+}
+
+inline Eigen::Vector2d LocalTangentPlane::NMToEN(Eigen::Vector2d const & Position_NM) const {
+	Eigen::Vector2d EN;
+	NMToEN(&Position_NM(0), &Position_NM(1), 1U, &EN(0), &EN(1));
+	return EN;
+}
+
+inline Eigen::Vector2d LocalTangentPlane::ENToNM(Eigen::Vector2d const & Position_EN) const {
+	Eigen::Vector2d NM;
+	ENToNM(&Position_EN(0), &Position_EN(1), 1U, &NM(0), &NM(1));
+	return NM;
+}
@@ -5,12 +5,16 @@
 
 //System Includes
 #include <cstdint>
+#include <vector>
 #include <tuple>
 #include <cmath>
 
 //Eigen Includes
 #include "../../../eigen/Eigen/Core"
 
+//Project Includes
+#include "Tile.hpp"
+
 //We have two map coordinate systems. The first is Widget coordinates. This is the position of a pixel relative to the upper-left corner of the
 //map widget, in pixels. X goes right and y goes down. The second coordinate system is Normalized Mercator, which is used to reference
 //locations on the Earth. We have utilities to map back and forth between NM and widget coordinates. We also sometimes need to go back and
@@ -233,6 +237,31 @@ inline Eigen::Vector2d GetNMCoordsOfLRCornerOfTile(int32_t TileX, int32_t TileY,
 	return Eigen::Vector2d(xNM, yNM);
 }
 
+//Get the range of tiles on the given pyramid level that intersect the given NM AABB (XMin, XMax, YMin, YMax). Returned in the same form (tile
+//columns and rows, inclusive). Parts of the AABB off the edge of the map are ignored.
+inline std::tuple<int32_t, int32_t, int32_t, int32_t> GetTileRangeCoveringAABB(Eigen::Vector4d const & AABB_NM, int32_t PyramidLevel) {
+	auto [XMin, YMin] = getCoordsOfTileContainingPoint(Eigen::Vector2d(AABB_NM(0), AABB_NM(3)), PyramidLevel);
+	auto [XMax, YMax] = getCoordsOfTileContainingPoint(Eigen::Vector2d(AABB_NM(1), AABB_NM(2)), PyramidLevel);
+	return std::make_tuple(XMin, XMax, YMin, YMax);
+}
+
+//Get the tiles on the given pyramid level that intersect the given NM AABB (XMin, XMax, YMin, YMax). Returns false (and leaves Tiles empty)
+//if there are more than MaxTiles of them or the level is invalid.
+inline bool GetTilesCoveringAABB(Eigen::Vector4d const & AABB_NM, int32_t PyramidLevel, size_t MaxTiles, std::vector<Maps::Tile> & Tiles) {
+	Tiles.clear();
+	if ((PyramidLevel < 0) || (PyramidLevel > 30))
+		return false;
+	auto [XMin, XMax, YMin, YMax] = GetTileRangeCoveringAABB(AABB_NM, PyramidLevel);
+	if (uint64_t(XMax - XMin + 1)*uint64_t(YMax - YMin + 1) > uint64_t(MaxTiles))
+		return false;
+	Tiles.reserve(size_t(XMax - XMin + 1)*size_t(YMax - YMin + 1));
+	for (int32_t Xi = XMin; Xi <= XMax; Xi++) {
+		for (int32_t Yi = YMin; Yi <= YMax; Yi++)
+			Tiles.push_back(Maps::Tile(Xi, Yi, PyramidLevel));
+	}
+	return true;
+}
+
 
 
 
@@ -43,6 +43,20 @@ ImTextureID SatelliteCacheMaster::TryGetTouchReq(Tile tile) {
 	}
 }
 
+bool SatelliteCacheMaster::Prefetch(Tile tile, double Priority) {
+	if ((tile.Zoom > MaxZoom) || (tile.Zoom < 0))
+		return false;
+	if (m_cacheMem->Has(tile, m_source))
+		return true;
+	m_cacheFile->RetrieveAsync(tile, m_source, Priority);
+	return false;
+}
+
+void SatelliteCacheMaster::CancelStalePrefetches(std::chrono::time_point<std::chrono::steady_clock> Cutoff) {
+	m_cacheFile->CancelStalePrefetches(Cutoff);
+	m_webRetriever->CancelStalePrefetches(Cutoff);
+}
+
 void SatelliteCacheMaster::PurgeAll() {
 	m_webRetriever->WaitFinish();
 	m_cacheFile->WaitFinish();
@@ -63,17 +77,18 @@ void SatelliteCacheMaster::GarbageCollectionThreadMain(void) {
 	}
 }
 
-void SatelliteCacheMaster::OnReceivedFile(Tile tile, SatelliteSource source, std::shared_ptr<std::vector<uint8_t>> data) {
+void SatelliteCacheMaster::OnReceivedFile(Tile tile, SatelliteSource source, std::shared_ptr<uint8_t const> data, size_t size, double Priority) {
 	if (data == nullptr) {
 		//The cache file did not have the file - pass on to the web retriever
 		//Log.print("Cache file miss. Passing tile request to web retriever: " + tile.ToString());
-		m_webRetriever->RetrieveAsync(tile, source);
+		m_webRetriever->RetrieveAsync(tile, source, Priority);
 	}
 	else {
 		//The cache file did have the file
 		//Log.print("Cache file hit. Retrieval succeeded for tile: " + tile.ToString());
+		//Decode straight from the cache file mapping - data keeps it alive until we are done
 		int width, height, bpp;
-		unsigned char * rgba = stbi_load_from_memory(&(*data)[0], (int)data->size(), &width, &height, &bpp, 4);
+		unsigned char * rgba = stbi_load_from_memory(data.get(), (int)size, &width, &height, &bpp, 4);
 		if (rgba != nullptr) {
 			m_cacheMem->Add(tile, source, rgba, width, height);
 			stbi_image_free(rgba);
@@ -81,7 +96,7 @@ void SatelliteCacheMaster::OnReceivedFile(Tile tile, SatelliteSource source, std
 		else {
 			Log.print("Failed to decode image data from cache for tile: " + tile.ToString());
 			m_cacheFile->BlockRemove(tile, source);
-			m_webRetriever->RetrieveAsync(tile, source);
+			m_webRetriever->RetrieveAsync(tile, source, Priority);
 		}
 	}
 }
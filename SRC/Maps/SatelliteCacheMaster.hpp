@@ -15,13 +15,16 @@
 namespace Maps {
 	//Singleton class for serving and managing sat imagery
 	class SatelliteCacheMaster : ITileWebReceiver, ITileFileReceiver {
+	public:
+		static constexpr SatelliteSource DefaultSource = SatelliteSource::HEREHybridMaps;
+
 	private:
 		static constexpr int32_t MaxZoom = 20;
 		static SatelliteCacheMaster * s_instance;
 		
 		//SatelliteSource m_source = SatelliteSource::OSMPublicServer;
 		//SatelliteSource m_source = SatelliteSource::HERESatelliteMaps;
-		SatelliteSource m_source = SatelliteSource::HEREHybridMaps;
+		SatelliteSource m_source = DefaultSource;
 		Journal & Log;
 		
 		CacheMem     * m_cacheMem;
@@ -44,6 +47,16 @@ namespace Maps {
 		size_t NumOutstandingRequests() const { return m_cacheFile->NumOutstandingRequests() + m_webRetriever->NumOutstandingRequests(); }
 		ImTextureID TryGetTouchReq(Tile tile);
 
+		//Prefetch support (see TilePrefetcher.hpp). Prefetch() requests a tile at the given prefetch priority (< TileDemandPriority) if it isn't
+		//in memory already and returns true if it is. Unlike TryGetTouchReq() it doesn't touch tiles that are already loaded, so prefetching
+		//never keeps tiles alive. CancelStalePrefetches() drops queued prefetch requests that haven't been repeated since Cutoff.
+		bool Prefetch(Tile tile, double Priority);
+		void CancelStalePrefetches(std::chrono::time_point<std::chrono::steady_clock> Cutoff);
+
+		//Access to the cache file and source, for writing tiles into the cache directly (see TileSeeder.hpp)
+		CacheFile &     GetCacheFile() { return *m_cacheFile; }
+		SatelliteSource GetSource() const { return m_source; }
+
 		//Force-purge tiles from cache. Note that the cache will self-garbage-collect so this is only needed if you are changing things on disk.
 		void PurgeAll();
 		
@@ -52,7 +65,7 @@ namespace Maps {
 		uint64_t CacheFile_GetNumBytes()       { return m_cacheFile->GetNumBytes();       }
 		uint64_t CacheFile_GetNumBytesOnDisk() { return m_cacheFile->GetNumBytesOnDisk(); }
 
-		void OnReceivedFile(Tile tile, SatelliteSource source, std::shared_ptr<std::vector<uint8_t>> data) override;
+		void OnReceivedFile(Tile tile, SatelliteSource source, std::shared_ptr<uint8_t const> data, size_t size, double Priority) override;
 		void OnReceivedWeb (Tile tile, SatelliteSource source, std::shared_ptr<std::vector<uint8_t>> data) override;
 	};
 }
@@ -0,0 +1,225 @@
+//This module prefetches satellite and data tiles so they are loaded before the map widget needs to draw them
+//Author: Bryan Poling
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+
+//System Includes
+#include <algorithm>
+#include <unordered_map>
+
+//Project Includes
+#include "TilePrefetcher.hpp"
+#include "TileRequestQueue.hpp"
+#include "SatelliteCacheMaster.hpp"
+#include "DataTileProvider.hpp"
+#include "MapUtils.hpp"
+
+namespace Maps {
+	//Instantiate static fields
+	TilePrefetcher * TilePrefetcher::s_instance = nullptr;
+
+	//Width of a tile on the given level, in NM units
+	static double TileWidth_NM(int32_t Level) { return 2.0 / double(uint64_t(1U) << Level); }
+
+	TilePrefetcher::TilePrefetcher(Journal & LogRef) : Log(LogRef), m_abort(false) {
+		m_viewport_NM.setZero();
+		m_viewportVelocity_NM.setZero();
+		m_animationTarget_NM.setZero();
+		m_schedulerThread = std::thread(&TilePrefetcher::SchedulerThreadMain, this);
+	}
+
+	TilePrefetcher::~TilePrefetcher() {
+		m_abort = true;
+		if (m_schedulerThread.joinable())
+			m_schedulerThread.join();
+	}
+
+	void TilePrefetcher::SetViewport(Eigen::Vector4d const & ViewableArea_NM, int32_t SatZoomLevel, int32_t DataZoomLevel) {
+		TimePoint now = std::chrono::steady_clock::now();
+		std::scoped_lock lock(m_mutex);
+		if (m_viewportValid) {
+			//Update the smoothed velocity of the viewport center. Restart from 0 after a gap (e.g. the map wasn't drawn for a while) or a
+			//zoom change, since the change in center position isn't motion we can extrapolate in those cases.
+			double dt = std::chrono::duration_cast<std::chrono::duration<double>>(now - m_viewportTimestamp).count();
+			if ((dt > 0.5) || (SatZoomLevel != m_viewportSatZoom))
+				m_viewportVelocity_NM.setZero();
+			else if (dt > 0.0) {
+				Eigen::Vector2d oldCenter(0.5*(m_viewport_NM(0) + m_viewport_NM(1)), 0.5*(m_viewport_NM(2) + m_viewport_NM(3)));
+				Eigen::Vector2d newCenter(0.5*(ViewableArea_NM(0) + ViewableArea_NM(1)), 0.5*(ViewableArea_NM(2) + ViewableArea_NM(3)));
+				double alpha = std::min(1.0, dt/0.2); //First-order filter with a 0.2 s time constant
+				m_viewportVelocity_NM = (1.0 - alpha)*m_viewportVelocity_NM + alpha*(newCenter - oldCenter)/dt;
+			}
+		}
+		else
+			m_viewportVelocity_NM.setZero();
+
+		m_viewportValid     = true;
+		m_viewport_NM       = ViewableArea_NM;
+		m_viewportSatZoom   = SatZoomLevel;
+		m_viewportDataZoom  = DataZoomLevel;
+		m_viewportTimestamp = now;
+	}
+
+	void TilePrefetcher::SetAnimationTarget(Eigen::Vector4d const & TargetArea_NM, int32_t SatZoomLevel, int32_t DataZoomLevel) {
+		std::scoped_lock lock(m_mutex);
+		m_animationTargetValid = true;
+		m_animationTarget_NM   = TargetArea_NM;
+		m_animationSatZoom     = SatZoomLevel;
+		m_animationDataZoom    = DataZoomLevel;
+	}
+
+	void TilePrefetcher::ClearAnimationTarget(void) {
+		std::scoped_lock lock(m_mutex);
+		m_animationTargetValid = false;
+	}
+
+	void TilePrefetcher::SetMissionAreas(std::Evector<Eigen::Vector4d> const & Areas_NM) {
+		std::scoped_lock lock(m_mutex);
+		m_missionAreas_NM = Areas_NM;
+		m_missionSatTilesDone.clear();
+		m_missionDataTilesDone.clear();
+		m_missionAreasVersion++;
+	}
+
+	void TilePrefetcher::SchedulerThreadMain(void) {
+		while (! m_abort) {
+			SchedulePass();
+			std::this_thread::sleep_for(SchedulingPeriod);
+		}
+	}
+
+	void TilePrefetcher::SchedulePass(void) {
+		SatelliteCacheMaster * satCache  = SatelliteCacheMaster::Instance();
+		DataTileProvider     * dataCache = DataTileProvider::Instance();
+		if ((satCache == nullptr) || (dataCache == nullptr))
+			return;
+		TimePoint passStart = std::chrono::steady_clock::now();
+
+		//Collect the wanted tiles and the highest priority each one is wanted at. Tiles visible right now are skipped - the map widget
+		//already requests those on demand.
+		struct Wanted {
+			double Priority;
+			bool   ForMission;
+		};
+		std::unordered_map<Tile, Wanted> satTiles, dataTiles;
+		std::unordered_set<Tile> visibleTiles;
+		auto want = [&visibleTiles](std::unordered_map<Tile, Wanted> & Tiles, Eigen::Vector4d const & Area_NM, int32_t Level,
+		                            double Priority, size_t MaxTiles, bool ForMission, std::unordered_set<Tile> const * Done) {
+			std::vector<Tile> tiles;
+			GetTilesCoveringAABB(Area_NM, Level, MaxTiles, tiles);
+			for (Tile const & tile : tiles) {
+				if ((visibleTiles.count(tile) > 0U) || ((Done != nullptr) && (Done->count(tile) > 0U)))
+					continue;
+				auto iter = Tiles.find(tile);
+				if (iter == Tiles.end())
+					Tiles.emplace(tile, Wanted{Priority, ForMission});
+				else {
+					iter->second.Priority   = std::max(iter->second.Priority, Priority);
+					iter->second.ForMission = iter->second.ForMission || ForMission;
+				}
+			}
+		};
+
+		uint64_t missionAreasVersion = 0U;
+		{
+			std::scoped_lock lock(m_mutex);
+			missionAreasVersion = m_missionAreasVersion;
+
+			if (m_viewportValid) {
+				std::vector<Tile> tiles;
+				GetTilesCoveringAABB(m_viewport_NM, m_viewportSatZoom, MaxTilesPerArea, tiles);
+				visibleTiles.insert(tiles.begin(), tiles.end());
+				GetTilesCoveringAABB(m_viewport_NM, m_viewportDataZoom, MaxTilesPerArea, tiles);
+				visibleTiles.insert(tiles.begin(), tiles.end());
+			}
+
+			if (m_animationTargetValid) {
+				//We are flying to a known place - load it (and the level below it, which is drawn while finer tiles load). The viewport
+				//motion during an animation isn't worth extrapolating.
+				for (int32_t level = m_animationSatZoom - 1; level <= m_animationSatZoom; level++)
+					want(satTiles, m_animationTarget_NM, level, Priority_AnimationTarget, MaxTilesPerArea, false, nullptr);
+				want(dataTiles, m_animationTarget_NM, m_animationDataZoom, Priority_AnimationTarget, MaxTilesPerArea, false, nullptr);
+			}
+			else if (m_viewportValid) {
+				//Extrapolate the viewport along its current velocity
+				double speedTilesPerSec = m_viewportVelocity_NM.norm() / TileWidth_NM(std::max(m_viewportSatZoom, 0));
+				if (speedTilesPerSec >= MinSpeedTilesPerSec) {
+					for (int step = 1; step <= NumLookaheadSteps; step++) {
+						double t = LookaheadSeconds*double(step)/double(NumLookaheadSteps);
+						double priority = Priority_LookaheadMax - (Priority_LookaheadMax - Priority_LookaheadMin)*double(step - 1)/double(NumLookaheadSteps - 1);
+						Eigen::Vector2d shift = t*m_viewportVelocity_NM;
+						Eigen::Vector4d area = m_viewport_NM + Eigen::Vector4d(shift(0), shift(0), shift(1), shift(1));
+						want(satTiles,  area, m_viewportSatZoom,  priority, MaxTilesPerArea, false, nullptr);
+						want(dataTiles, area, m_viewportDataZoom, priority, MaxTilesPerArea, false, nullptr);
+					}
+				}
+
+				//Ring of tiles around the viewport (one tile wide on each level)
+				if (m_viewportSatZoom >= 0) {
+					double w = TileWidth_NM(m_viewportSatZoom);
+					Eigen::Vector4d area = m_viewport_NM + Eigen::Vector4d(-w, w, -w, w);
+					want(satTiles, area, m_viewportSatZoom, Priority_ViewportRing, MaxTilesPerArea, false, nullptr);
+				}
+				if (m_viewportDataZoom >= 0) {
+					double w = TileWidth_NM(m_viewportDataZoom);
+					Eigen::Vector4d area = m_viewport_NM + Eigen::Vector4d(-w, w, -w, w);
+					want(dataTiles, area, m_viewportDataZoom, Priority_ViewportRing, MaxTilesPerArea, false, nullptr);
+				}
+			}
+
+			//Mission areas: imagery on the finest level that covers each area with a bounded number of tiles, and data on the edit level
+			//(where the guidance engine samples it) when that is affordable.
+			for (Eigen::Vector4d const & area : m_missionAreas_NM) {
+				std::vector<Tile> tiles;
+				for (int32_t level = MaxMissionSatZoomLevel; level >= MinMissionSatZoomLevel; level--) {
+					if (GetTilesCoveringAABB(area, level, MaxTilesPerMissionArea, tiles)) {
+						want(satTiles, area, level, Priority_MissionAreas, MaxTilesPerMissionArea, true, &m_missionSatTilesDone);
+						break;
+					}
+				}
+				want(dataTiles, area, DataTileProvider::TileEditZoomLevel, Priority_MissionAreas, MaxTilesPerMissionArea, true, &m_missionDataTilesDone);
+			}
+		}
+
+		//Submit requests, most important first. The loader queues only take a limited number of prefetch requests, so the rest are
+		//rejected and will be tried again on a later pass.
+		struct Request {
+			Tile   tile;
+			double Priority;
+			bool   ForMission;
+			bool   IsDataTile;
+		};
+		std::vector<Request> requests;
+		requests.reserve(satTiles.size() + dataTiles.size());
+		for (auto const & kv : satTiles)
+			requests.push_back(Request{kv.first, kv.second.Priority, kv.second.ForMission, false});
+		for (auto const & kv : dataTiles)
+			requests.push_back(Request{kv.first, kv.second.Priority, kv.second.ForMission, true});
+		std::sort(requests.begin(), requests.end(), [](Request const & A, Request const & B) { return A.Priority > B.Priority; });
+
+		std::vector<Tile> missionSatTilesLoaded, missionDataTilesLoaded;
+		for (Request const & request : requests) {
+			if (request.IsDataTile) {
+				if (dataCache->PrefetchFRFTile(request.tile, request.Priority) && request.ForMission)
+					missionDataTilesLoaded.push_back(request.tile);
+			}
+			else {
+				if (satCache->Prefetch(request.tile, request.Priority) && request.ForMission)
+					missionSatTilesLoaded.push_back(request.tile);
+			}
+		}
+
+		//Drop prefetch requests we've stopped asking for. We allow some slack because a satellite prefetch that misses the cache file is
+		//re-submitted to the web retriever from a loader thread, which can lag behind this pass.
+		satCache->CancelStalePrefetches(passStart - StalePrefetchAge);
+		dataCache->CancelStalePrefetches(passStart - StalePrefetchAge);
+
+		//Mission tiles that have been loaded once are cached on disk now - stop asking for them
+		if ((! missionSatTilesLoaded.empty()) || (! missionDataTilesLoaded.empty())) {
+			std::scoped_lock lock(m_mutex);
+			if (m_missionAreasVersion == missionAreasVersion) {
+				m_missionSatTilesDone.insert(missionSatTilesLoaded.begin(), missionSatTilesLoaded.end());
+				m_missionDataTilesDone.insert(missionDataTilesLoaded.begin(), missionDataTilesLoaded.end());
+			}
+		}
+	}
+}
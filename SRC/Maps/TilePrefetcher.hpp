@@ -0,0 +1,100 @@
+//This module prefetches satellite and data tiles so they are loaded before the map widget needs to draw them (and before the guidance
+//engine needs data for a sub-region). Other modules tell it where tiles are likely to be needed soon:
+//  - The map widget reports its viewport every frame. We track how fast it is moving and prefetch the areas it is heading into, plus a
+//    one-tile ring around the current view.
+//  - The map widget reports the target area of a navigation animation when one starts, so that area is loaded by the time we get there.
+//  - The guidance engine reports the bounding boxes of the sub-regions of the current survey mission.
+//A background thread turns this into prefetch requests (see TileRequestQueue.hpp) every SchedulingPeriod. Each pass re-requests everything
+//it still wants and then cancels queued prefetch requests that weren't repeated, so requests for areas the map moved away from are dropped.
+//Author: Bryan Poling
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+#pragma once
+
+//System Includes
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+//Project Includes
+#include "../EigenAliases.h"
+#include "Tile.hpp"
+#include "../Journal.h"
+
+namespace Maps {
+	//TilePrefetcher is a singleton class. All public methods are thread-safe.
+	class TilePrefetcher {
+		public:
+			EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+			using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+			static constexpr std::chrono::milliseconds SchedulingPeriod = std::chrono::milliseconds(100);
+			static constexpr double  LookaheadSeconds     = 1.0;  //How far ahead (s) to extrapolate the viewport motion
+			static constexpr int     NumLookaheadSteps    = 4;    //Number of extrapolated viewports between now and LookaheadSeconds
+			static constexpr double  MinSpeedTilesPerSec  = 0.1;  //Don't extrapolate motion slower than this (tiles/s on the viewed level)
+			static constexpr size_t  MaxTilesPerArea      = 128U; //Skip a viewport-related area on a level if it needs more tiles than this
+			static constexpr size_t  MaxTilesPerMissionArea = 256U; //Same, for mission areas (these are only loaded once per mission)
+			static constexpr int32_t MaxMissionSatZoomLevel = 18;   //Finest level to prefetch sat imagery on for mission areas
+			static constexpr int32_t MinMissionSatZoomLevel = 10;   //Coarsest level to prefetch sat imagery on for mission areas
+			static constexpr std::chrono::seconds StalePrefetchAge = std::chrono::seconds(1); //Cancel queued prefetches not repeated for this long
+
+			//Prefetch priorities (all below TileDemandPriority). Sooner and surer needs come first.
+			static constexpr double  Priority_AnimationTarget = 0.9;
+			static constexpr double  Priority_LookaheadMax    = 0.85; //For the first extrapolated viewport - later ones get less
+			static constexpr double  Priority_LookaheadMin    = 0.6;  //For the last extrapolated viewport
+			static constexpr double  Priority_ViewportRing    = 0.5;
+			static constexpr double  Priority_MissionAreas    = 0.2;
+
+		private:
+			static TilePrefetcher * s_instance;
+
+			Journal & Log;
+			std::mutex m_mutex; //Protects the fields below
+
+			//Viewport state - Areas are NM AABBs: (XMin, XMax, YMin, YMax)
+			bool            m_viewportValid = false;
+			Eigen::Vector4d m_viewport_NM;
+			int32_t         m_viewportSatZoom  = -1;
+			int32_t         m_viewportDataZoom = -1; //-1 when data tiles aren't being drawn
+			Eigen::Vector2d m_viewportVelocity_NM;   //Smoothed velocity of the viewport center (NM units/s)
+			TimePoint       m_viewportTimestamp;
+
+			//Navigation animation target
+			bool            m_animationTargetValid = false;
+			Eigen::Vector4d m_animationTarget_NM;
+			int32_t         m_animationSatZoom  = -1;
+			int32_t         m_animationDataZoom = -1;
+
+			//Mission sub-region areas. Tiles that have been seen loaded are only prefetched once per set of areas, so we don't keep
+			//reloading the (potentially many) tiles of a survey region every time the memory caches expire them.
+			std::Evector<Eigen::Vector4d> m_missionAreas_NM;
+			std::unordered_set<Tile> m_missionSatTilesDone;
+			std::unordered_set<Tile> m_missionDataTilesDone;
+			uint64_t m_missionAreasVersion = 0U; //Incremented when the mission areas change
+
+			std::thread m_schedulerThread;
+			std::atomic_bool m_abort;
+			void SchedulerThreadMain(void);
+			void SchedulePass(void);
+
+		public:
+			static void             Init(Journal & LogRef) { s_instance = new TilePrefetcher(LogRef); }
+			static void             Destroy(void)          { delete s_instance; s_instance = nullptr; }
+			static TilePrefetcher * Instance(void)         { return s_instance; }
+
+			TilePrefetcher(Journal & LogRef);
+			~TilePrefetcher();
+
+			//Called by the map widget every frame. DataZoomLevel should be -1 if data tiles aren't being drawn.
+			void SetViewport(Eigen::Vector4d const & ViewableArea_NM, int32_t SatZoomLevel, int32_t DataZoomLevel);
+
+			//Called by the map widget when a navigation animation starts and ends
+			void SetAnimationTarget(Eigen::Vector4d const & TargetArea_NM, int32_t SatZoomLevel, int32_t DataZoomLevel);
+			void ClearAnimationTarget(void);
+
+			//Called by the guidance engine when a mission is planned and when it is over
+			void SetMissionAreas(std::Evector<Eigen::Vector4d> const & Areas_NM);
+			void ClearMissionAreas(void) { SetMissionAreas(std::Evector<Eigen::Vector4d>()); }
+	};
+}
@@ -0,0 +1,231 @@
+//This module provides the job queue behind the tile loaders (CacheFile, FRFTileStore, and WebRetriever). It is a small thread pool whose
+//pending jobs are ordered by priority and keyed by the tile they load, so each tile is requested at most once at a time.
+//
+//There are two classes of requests: demand requests (Priority >= TileDemandPriority) for tiles that are needed right now (e.g. they are on
+//screen and missing), and prefetch requests (Priority < TileDemandPriority) for tiles we expect to need soon. Jobs run highest priority first
+//and, among equal priorities, most recently submitted first (so the newest frame's tiles win, like the old AddJobToFront() LIFO). Prefetch
+//requests only get a limited share of the queue and are evicted to make room for demand requests. Re-submitting a pending request updates
+//its priority, and prefetch requests that haven't been re-submitted since a given time can be cancelled - this is how the prefetch
+//scheduler drops requests for areas the map moved away from.
+//Author: Bryan Poling
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+#pragma once
+
+//System Includes
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <tuple>
+#include <algorithm>
+
+namespace Maps {
+	//Requests with priority below this are prefetch requests
+	constexpr double TileDemandPriority = 1.0;
+
+	//Key must be default-constructible and hashable with std::hash (Tile and tuples of tiles and sources are, via Handy)
+	template <typename Key>
+	class TileRequestQueue {
+		public:
+			using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+			TileRequestQueue(unsigned int NumThreads, size_t MaxOutstanding, size_t MaxPendingPrefetches);
+			~TileRequestQueue(); //Abandons pending jobs and waits for running jobs to finish
+			TileRequestQueue(TileRequestQueue const &) = delete;
+			TileRequestQueue & operator=(TileRequestQueue const &) = delete;
+
+			static bool IsPrefetch(double Priority) { return Priority < TileDemandPriority; }
+
+			//Queue a job to load the tile with the given key. Returns true if the job was queued. If a request for the key is already pending its
+			//priority is updated (a demand request is never lowered to a prefetch) and false is returned. Also returns false if the key is
+			//being loaded right now or if there is no room for the request (in which case the caller should simply try again later).
+			//The job is passed the priority of the request when it runs, which may be higher than the priority it was submitted with.
+			bool Submit(Key const & K, double Priority, std::function<void(double)> Job);
+
+			//Drop pending prefetch requests that have not been (re-)submitted since Cutoff. Returns the number of requests dropped.
+			size_t CancelStalePrefetches(TimePoint Cutoff);
+
+			bool   IsOutstanding(Key const & K);  //True if a request for the key is pending or running
+			size_t NumOutstanding(void);          //Number of requests pending or running
+			void   Wait(void);                    //Block until there are no requests pending or running
+
+		private:
+			//Pending jobs sorted so the next one to run is first: highest priority, then highest sequence number (most recent)
+			using OrderKey = std::tuple<double, uint64_t>;
+			struct OrderCompare {
+				bool operator()(OrderKey const & A, OrderKey const & B) const { return A > B; }
+			};
+			struct PendingJob {
+				Key K;
+				std::function<void(double)> Job;
+				TimePoint LastSubmitted;
+			};
+			using PendingMap = std::map<OrderKey, PendingJob, OrderCompare>;
+
+			std::mutex m_mutex;
+			std::condition_variable m_workCV;
+			std::condition_variable m_idleCV;
+			PendingMap m_pending;
+			std::unordered_map<Key, typename PendingMap::iterator> m_pendingByKey;
+			std::unordered_set<Key> m_running; //Keys of jobs being run
+			size_t   m_numPendingPrefetches = 0U;
+			uint64_t m_nextSequence = 0U;
+			size_t   m_maxOutstanding;
+			size_t   m_maxPendingPrefetches;
+			bool     m_stop = false;
+			std::vector<std::thread> m_workers;
+
+			void ErasePending(typename PendingMap::iterator Iter); //Called with m_mutex held
+			void WorkerMain(void);
+	};
+
+	template <typename Key>
+	TileRequestQueue<Key>::TileRequestQueue(unsigned int NumThreads, size_t MaxOutstanding, size_t MaxPendingPrefetches)
+		: m_maxOutstanding(MaxOutstanding), m_maxPendingPrefetches(MaxPendingPrefetches) {
+		for (unsigned int n = 0U; n < NumThreads; n++)
+			m_workers.emplace_back(&TileRequestQueue<Key>::WorkerMain, this);
+	}
+
+	template <typename Key>
+	TileRequestQueue<Key>::~TileRequestQueue() {
+		{
+			std::scoped_lock lock(m_mutex);
+			m_stop = true;
+			m_pending.clear();
+			m_pendingByKey.clear();
+			m_numPendingPrefetches = 0U;
+		}
+		m_workCV.notify_all();
+		for (std::thread & worker : m_workers)
+			worker.join();
+	}
+
+	template <typename Key>
+	bool TileRequestQueue<Key>::Submit(Key const & K, double Priority, std::function<void(double)> Job) {
+		TimePoint now = std::chrono::steady_clock::now();
+		std::unique_lock lock(m_mutex);
+		if (m_stop || (m_running.count(K) > 0U))
+			return false;
+
+		auto existing = m_pendingByKey.find(K);
+		if (existing != m_pendingByKey.end()) {
+			//Already pending - re-queue it at its new priority (this also makes it the most recent request at that priority)
+			double oldPriority = std::get<0>(existing->second->first);
+			double newPriority = (IsPrefetch(oldPriority) && IsPrefetch(Priority)) ? Priority : std::max(oldPriority, Priority);
+			PendingJob job{K, std::move(existing->second->second.Job), now};
+			ErasePending(existing->second);
+			auto iter = m_pending.emplace(OrderKey(newPriority, m_nextSequence++), std::move(job)).first;
+			m_pendingByKey[K] = iter;
+			if (IsPrefetch(newPriority))
+				m_numPendingPrefetches++;
+			return false;
+		}
+
+		if (IsPrefetch(Priority)) {
+			if ((m_numPendingPrefetches >= m_maxPendingPrefetches) || (m_pending.size() + m_running.size() >= m_maxOutstanding))
+				return false;
+		}
+		else if (m_pending.size() + m_running.size() >= m_maxOutstanding) {
+			//Make room by evicting the least important pending prefetch (the last item in m_pending), if there is one
+			if (m_pending.empty() || (! IsPrefetch(std::get<0>(std::prev(m_pending.end())->first))))
+				return false;
+			ErasePending(std::prev(m_pending.end()));
+		}
+
+		auto iter = m_pending.emplace(OrderKey(Priority, m_nextSequence++), PendingJob{K, std::move(Job), now}).first;
+		m_pendingByKey[K] = iter;
+		if (IsPrefetch(Priority))
+			m_numPendingPrefetches++;
+		lock.unlock();
+		m_workCV.notify_one();
+		return true;
+	}
+
+	template <typename Key>
+	size_t TileRequestQueue<Key>::CancelStalePrefetches(TimePoint Cutoff) {
+		size_t numCancelled = 0U;
+		bool nowIdle = false;
+		{
+			std::scoped_lock lock(m_mutex);
+			//Prefetches are at the end of m_pending - walk back from the end until we hit a demand request
+			auto iter = m_pending.end();
+			while (iter != m_pending.begin()) {
+				--iter;
+				if (! IsPrefetch(std::get<0>(iter->first)))
+					break;
+				if (iter->second.LastSubmitted < Cutoff) {
+					auto victim = iter++;
+					ErasePending(victim);
+					numCancelled++;
+				}
+			}
+			nowIdle = m_pending.empty() && m_running.empty();
+		}
+		if (nowIdle)
+			m_idleCV.notify_all();
+		return numCancelled;
+	}
+
+	template <typename Key>
+	bool TileRequestQueue<Key>::IsOutstanding(Key const & K) {
+		std::scoped_lock lock(m_mutex);
+		return (m_pendingByKey.count(K) > 0U) || (m_running.count(K) > 0U);
+	}
+
+	template <typename Key>
+	size_t TileRequestQueue<Key>::NumOutstanding(void) {
+		std::scoped_lock lock(m_mutex);
+		return m_pending.size() + m_running.size();
+	}
+
+	template <typename Key>
+	void TileRequestQueue<Key>::Wait(void) {
+		std::unique_lock lock(m_mutex);
+		m_idleCV.wait(lock, [this]() { return m_pending.empty() && m_running.empty(); });
+	}
+
+	template <typename Key>
+	void TileRequestQueue<Key>::ErasePending(typename PendingMap::iterator Iter) {
+		if (IsPrefetch(std::get<0>(Iter->first)))
+			m_numPendingPrefetches--;
+		m_pendingByKey.erase(Iter->second.K);
+		m_pending.erase(Iter);
+	}
+
+	template <typename Key>
+	void TileRequestQueue<Key>::WorkerMain(void) {
+		while (true) {
+			Key key;
+			std::function<void(double)> job;
+			double priority = 0.0;
+			{
+				std::unique_lock lock(m_mutex);
+				m_workCV.wait(lock, [this]() { return m_stop || (! m_pending.empty()); });
+				if (m_stop)
+					return;
+				auto iter = m_pending.begin();
+				key = iter->second.K;
+				job = std::move(iter->second.Job);
+				priority = std::get<0>(iter->first);
+				ErasePending(iter);
+				m_running.insert(key);
+			}
+
+			try { job(priority); }
+			catch (...) { }
+
+			bool nowIdle = false;
+			{
+				std::scoped_lock lock(m_mutex);
+				m_running.erase(key);
+				nowIdle = m_pending.empty() && m_running.empty();
+			}
+			if (nowIdle)
+				m_idleCV.notify_all();
+		}
+	}
+}
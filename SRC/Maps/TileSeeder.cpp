@@ -0,0 +1,238 @@
+//This module provides bulk pre-seeding of the satellite tile cache
+//Author: Bryan Poling
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+
+//System Includes
+#include <cmath>
+#include <algorithm>
+
+//Project Includes
+#include "TileSeeder.hpp"
+#include "WebRetriever.hpp"
+#include "MapUtils.hpp"
+#include "../CompiledPolygon.hpp"
+
+namespace Maps {
+	static bool ZoomRangeValid(int32_t MinZoom, int32_t MaxZoom) {
+		return (MinZoom >= 0) && (MaxZoom <= TileSeeder::MaxSeedZoom) && (MinZoom <= MaxZoom);
+	}
+
+	bool TileSeeder::EnumerateTiles(Eigen::Vector4d const & AABB_NM, int32_t MinZoom, int32_t MaxZoom, std::vector<Tile> & Tiles) {
+		Tiles.clear();
+		if ((! ZoomRangeValid(MinZoom, MaxZoom)) || (! AABB_NM.allFinite()))
+			return false;
+		std::vector<Tile> levelTiles;
+		for (int32_t level = MinZoom; level <= MaxZoom; level++) {
+			if (! GetTilesCoveringAABB(AABB_NM, level, MaxTilesPerJob - Tiles.size(), levelTiles)) {
+				Tiles.clear();
+				return false;
+			}
+			Tiles.insert(Tiles.end(), levelTiles.begin(), levelTiles.end());
+		}
+		return true;
+	}
+
+	//A tile intersects the region if the region comes within half a tile diagonal of the tile center. This also admits some tiles that just
+	//come close to the region near their corners, which is harmless. Since a tile that misses the region has no children that hit it, each
+	//level only needs to test the children of the tiles kept on the level above it.
+	bool TileSeeder::EnumerateTiles(PolygonCollection const & Region, int32_t MinZoom, int32_t MaxZoom, std::vector<Tile> & Tiles) {
+		Tiles.clear();
+		if (! ZoomRangeValid(MinZoom, MaxZoom))
+			return false;
+		CompiledPolygonCollection compiledRegion(Region);
+		if (compiledRegion.Empty() || (! compiledRegion.GetAABB().allFinite()))
+			return false;
+
+		std::vector<Tile> candidates;
+		if (! GetTilesCoveringAABB(compiledRegion.GetAABB(), MinZoom, MaxTilesPerJob, candidates))
+			return false;
+		std::vector<Tile> kept;
+		for (int32_t level = MinZoom; level <= MaxZoom; level++) {
+			if (level > MinZoom) {
+				candidates.clear();
+				candidates.reserve(4U*kept.size());
+				for (Tile & tile : kept) {
+					std::vector<Tile> children = tile.GetChildTiles();
+					candidates.insert(candidates.end(), children.begin(), children.end());
+				}
+			}
+
+			kept.clear();
+			double halfDiagonal = std::sqrt(2.0) / double(uint64_t(1U) << level); //Tiles are 2/2^level NM units wide
+			for (Tile const & tile : candidates) {
+				Eigen::Vector2d center = 0.5*(GetNMCoordsOfULCornerOfTile(tile.Xi, tile.Yi, level) + GetNMCoordsOfLRCornerOfTile(tile.Xi, tile.Yi, level));
+				if ((compiledRegion.ProjectPoint(center) - center).norm() <= halfDiagonal)
+					kept.push_back(tile);
+			}
+			if (Tiles.size() + kept.size() > MaxTilesPerJob) {
+				Tiles.clear();
+				return false;
+			}
+			Tiles.insert(Tiles.end(), kept.begin(), kept.end());
+		}
+		return true;
+	}
+
+	std::string TileSeeder::FormatTileURL(std::string const & URLTemplate, Tile tile) {
+		std::string URL = URLTemplate;
+		auto substitute = [&URL](std::string const & Field, int32_t Value) {
+			size_t pos = 0U;
+			while ((pos = URL.find(Field, pos)) != std::string::npos) {
+				std::string valueStr = std::to_string(Value);
+				URL.replace(pos, Field.size(), valueStr);
+				pos += valueStr.size();
+			}
+		};
+		substitute("{z}", tile.Zoom);
+		substitute("{x}", tile.Xi);
+		substitute("{y}", tile.Yi);
+		return URL;
+	}
+
+	TileSeeder::TileSeeder(CacheFile & Cache, SatelliteSource Source, std::vector<Tile> Tiles, Journal & LogRef,
+	                       unsigned int NumFetchThreads, std::string const & URLTemplate, DownloadFunction Downloader)
+		: Log(LogRef), m_cache(Cache), m_source(Source), m_tiles(std::move(Tiles)), m_URLTemplate(URLTemplate), m_download(std::move(Downloader)) {
+		if (! m_download)
+			m_download = &WebRetriever::Download;
+		m_startTime = std::chrono::steady_clock::now();
+		m_endTime   = m_startTime;
+		NumFetchThreads = std::max(NumFetchThreads, 1U);
+		m_numActiveFetchers = NumFetchThreads;
+		for (unsigned int n = 0U; n < NumFetchThreads; n++)
+			m_fetchThreads.emplace_back(&TileSeeder::FetchThreadMain, this);
+		m_writerThread = std::thread(&TileSeeder::WriterThreadMain, this);
+	}
+
+	TileSeeder::~TileSeeder() {
+		Cancel();
+		for (std::thread & thread : m_fetchThreads)
+			thread.join();
+		m_writerThread.join();
+	}
+
+	void TileSeeder::Cancel(void) {
+		{
+			std::scoped_lock lock(m_queueMtx);
+			m_cancel = true;
+		}
+		m_queueNotFull.notify_all();
+		m_queueNotEmpty.notify_all();
+	}
+
+	void TileSeeder::Wait(void) {
+		std::unique_lock lock(m_doneMtx);
+		m_doneCV.wait(lock, [this]() { return m_done.load(); });
+	}
+
+	TileSeeder::Progress TileSeeder::GetProgress(void) {
+		Progress progress;
+		progress.TilesTotal   = m_tiles.size();
+		progress.TilesCached  = m_numCached;
+		progress.TilesFetched = m_numFetched;
+		progress.TilesWritten = m_numWritten;
+		progress.TilesFailed  = m_numFailed;
+		progress.BytesFetched = m_bytesFetched;
+		progress.Done         = m_done;
+		progress.Cancelled    = m_cancel;
+
+		TimePoint endTime = std::chrono::steady_clock::now();
+		if (progress.Done) {
+			std::scoped_lock lock(m_doneMtx);
+			endTime = m_endTime;
+		}
+		progress.ElapsedSeconds = std::chrono::duration_cast<std::chrono::duration<double>>(endTime - m_startTime).count();
+		if (progress.ElapsedSeconds > 0.0) {
+			progress.TilesPerSecond = double(progress.TilesProcessed()) / progress.ElapsedSeconds;
+			progress.BytesPerSecond = double(progress.BytesFetched)     / progress.ElapsedSeconds;
+		}
+		if (progress.Done)
+			progress.ETASeconds = 0.0;
+		else if ((progress.TilesProcessed() >= 10U) && (progress.TilesPerSecond > 0.0))
+			progress.ETASeconds = double(progress.TilesTotal - progress.TilesProcessed()) / progress.TilesPerSecond;
+		else
+			progress.ETASeconds = std::nan("");
+		return progress;
+	}
+
+	void TileSeeder::FetchThreadMain(void) {
+		std::vector<uint8_t> data;
+		while (! m_cancel) {
+			size_t index = m_nextTileIndex++;
+			if (index >= m_tiles.size())
+				break;
+			Tile tile = m_tiles[index];
+			if (m_cache.BlockHas(tile, m_source)) {
+				m_numCached++;
+				continue;
+			}
+
+			std::string URL = m_URLTemplate.empty() ? GetDownloadURL(tile, m_source) : FormatTileURL(m_URLTemplate, tile);
+			int code = -1;
+			for (int attempt = 0; (attempt < MaxAttempts) && (! URL.empty()) && (! m_cancel); attempt++) {
+				if (attempt > 0)
+					std::this_thread::sleep_for(std::chrono::milliseconds(500*attempt));
+				code = m_download(URL, data);
+				if ((code == 200) || (code == 404)) //404 means the server doesn't have the tile - don't bother retrying
+					break;
+			}
+			if (code != 200) {
+				if (! m_cancel)
+					m_numFailed++;
+				continue;
+			}
+			m_numFetched++;
+			m_bytesFetched += data.size();
+
+			//Hand the tile to the writer - wait for room in the queue if it is behind
+			std::unique_lock lock(m_queueMtx);
+			m_queueNotFull.wait(lock, [this]() { return m_cancel || (m_writeQueue.size() < MaxQueuedTiles); });
+			m_queuedBytes += data.size();
+			m_writeQueue.emplace_back(tile, std::move(data));
+			data = std::vector<uint8_t>();
+			if ((m_writeQueue.size() >= BatchMaxTiles) || (m_queuedBytes >= BatchMaxBytes))
+				m_queueNotEmpty.notify_one();
+		}
+
+		{
+			std::scoped_lock lock(m_queueMtx);
+			m_numActiveFetchers--;
+		}
+		m_queueNotEmpty.notify_one();
+	}
+
+	void TileSeeder::WriterThreadMain(void) {
+		std::vector<std::tuple<Tile, std::vector<uint8_t>>> batch;
+		bool finished = false;
+		while (! finished) {
+			batch.clear();
+			{
+				std::unique_lock lock(m_queueMtx);
+				m_queueNotEmpty.wait_for(lock, BatchMaxAge, [this]() {
+					return (m_writeQueue.size() >= BatchMaxTiles) || (m_queuedBytes >= BatchMaxBytes) || (m_numActiveFetchers == 0U);
+				});
+				while ((! m_writeQueue.empty()) && (batch.size() < BatchMaxTiles)) {
+					m_queuedBytes -= std::get<1>(m_writeQueue.front()).size();
+					batch.push_back(std::move(m_writeQueue.front()));
+					m_writeQueue.pop_front();
+				}
+				finished = (m_numActiveFetchers == 0U) && m_writeQueue.empty();
+			}
+			m_queueNotFull.notify_all();
+
+			//Tiles that were cached in the meantime (e.g. by the map) are skipped by the cache file, but they were still downloaded by us
+			if (! batch.empty())
+				m_numWritten += m_cache.BlockAddBatch(m_source, batch);
+		}
+
+		auto progress = GetProgress();
+		Log.printf("Tile seeding %s: %zu tiles (%zu already cached, %zu downloaded, %zu failed) in %.1f seconds.",
+		           m_cancel ? "cancelled" : "finished", progress.TilesTotal, progress.TilesCached, progress.TilesFetched,
+		           progress.TilesFailed, progress.ElapsedSeconds);
+		{
+			std::scoped_lock lock(m_doneMtx);
+			m_endTime = std::chrono::steady_clock::now();
+			m_done = true;
+		}
+		m_doneCV.notify_all();
+	}
+}
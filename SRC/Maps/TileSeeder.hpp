@@ -0,0 +1,126 @@
+//This module provides bulk pre-seeding of the satellite tile cache, so an area can be cached before going somewhere with no connectivity.
+//Given an area (a polygon collection or an NM bounding box) and a range of zoom levels, a TileSeeder enumerates the tiles covering the
+//area, skips the ones already in the cache file, downloads the rest with a fixed number of fetch threads, and writes them to the cache
+//file in large batches from a single writer thread. Downloaded tiles wait for the writer in a bounded queue (fetchers block when it is
+//full), so memory use is bounded no matter how big the job is. Progress (including throughput and ETA) can be polled at any time.
+//
+//By default tiles are downloaded from the regular server of the satellite source. A URL template can be given instead (e.g. to seed from a
+//local tile server or an HTTP stand-in for testing): "{z}", "{x}", and "{y}" are replaced with the zoom level, column, and row of the tile.
+//The function used to download a URL can be replaced too (e.g. by a fake server in a test bench).
+//
+//Data tiles are not seeded - they are created locally by edits and have no upstream source to download from.
+//Author: Bryan Poling
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+#pragma once
+
+//System Includes
+#include <vector>
+#include <deque>
+#include <string>
+#include <tuple>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+//Project Includes
+#include "../EigenAliases.h"
+#include "../Polygon.hpp"
+#include "Tile.hpp"
+#include "SatelliteSources.hpp"
+#include "CacheFile.hpp"
+#include "../Journal.h"
+
+namespace Maps {
+	//A TileSeeder runs one seeding job. The job starts on construction and the destructor cancels it (if it is still running) and waits for
+	//the threads to finish. Tiles downloaded before a cancellation are still written to the cache. All public methods are thread-safe.
+	class TileSeeder {
+		public:
+			using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+			using DownloadFunction = std::function<int(std::string const & URL, std::vector<uint8_t> & Data)>; //Same contract as WebRetriever::Download()
+			static constexpr unsigned int DefaultNumFetchThreads = 8U;
+			static constexpr int32_t  MaxSeedZoom     = 20;            //Highest level of sat imagery available
+			static constexpr size_t   MaxTilesPerJob  = 4000000U;      //Refuse to enumerate jobs bigger than this
+			static constexpr size_t   MaxQueuedTiles  = 256U;          //Downloaded tiles waiting to be written
+			static constexpr size_t   BatchMaxTiles   = 256U;          //Write a batch once it has this many tiles...
+			static constexpr uint64_t BatchMaxBytes   = 16ULL << 20;   //... or this many bytes...
+			static constexpr std::chrono::milliseconds BatchMaxAge = std::chrono::milliseconds(2000); //... or the oldest tile has waited this long
+			static constexpr int      MaxAttempts     = 3;             //Download attempts per tile before it is counted as failed
+
+			struct Progress {
+				size_t   TilesTotal   = 0U; //Tiles in the job
+				size_t   TilesCached  = 0U; //Tiles that were already in the cache
+				size_t   TilesFetched = 0U; //Tiles downloaded
+				size_t   TilesWritten = 0U; //Downloaded tiles written to the cache
+				size_t   TilesFailed  = 0U; //Tiles that couldn't be downloaded
+				uint64_t BytesFetched = 0U;
+				double   ElapsedSeconds = 0.0;
+				double   TilesPerSecond = 0.0; //Tiles processed (cached, downloaded, or failed) per second
+				double   BytesPerSecond = 0.0; //Download throughput
+				double   ETASeconds     = 0.0; //Estimated time remaining (NaN until there is enough to go on)
+				bool     Done      = false;
+				bool     Cancelled = false;
+
+				size_t TilesProcessed(void) const { return TilesCached + TilesFetched + TilesFailed; }
+			};
+
+			//Get the tiles on levels MinZoom through MaxZoom (coarsest first) that intersect a region or an NM AABB (XMin, XMax, YMin, YMax).
+			//Returns false (and leaves Tiles empty) if there are more than MaxTilesPerJob of them or the arguments are invalid.
+			static bool EnumerateTiles(PolygonCollection const & Region, int32_t MinZoom, int32_t MaxZoom, std::vector<Tile> & Tiles);
+			static bool EnumerateTiles(Eigen::Vector4d const & AABB_NM, int32_t MinZoom, int32_t MaxZoom, std::vector<Tile> & Tiles);
+
+			//Substitute a tile into a URL template
+			static std::string FormatTileURL(std::string const & URLTemplate, Tile tile);
+
+			//Start seeding Tiles into Cache. An empty URLTemplate means tiles are downloaded from the regular server for Source, and an empty
+			//Downloader means URLs are downloaded with WebRetriever::Download().
+			TileSeeder(CacheFile & Cache, SatelliteSource Source, std::vector<Tile> Tiles, Journal & LogRef,
+			           unsigned int NumFetchThreads = DefaultNumFetchThreads, std::string const & URLTemplate = std::string(),
+			           DownloadFunction Downloader = DownloadFunction());
+			~TileSeeder();
+			TileSeeder(TileSeeder const &) = delete;
+			TileSeeder & operator=(TileSeeder const &) = delete;
+
+			void     Cancel(void);
+			void     Wait(void); //Block until the job is done (or cancelled and wrapped up)
+			bool     IsDone(void) { return m_done; }
+			Progress GetProgress(void);
+
+		private:
+			Journal & Log;
+			CacheFile & m_cache;
+			SatelliteSource m_source;
+			std::vector<Tile> m_tiles;
+			std::string m_URLTemplate;
+			DownloadFunction m_download;
+			TimePoint m_startTime;
+			TimePoint m_endTime;
+
+			std::atomic<size_t>   m_nextTileIndex{0U};
+			std::atomic<size_t>   m_numCached{0U};
+			std::atomic<size_t>   m_numFetched{0U};
+			std::atomic<size_t>   m_numWritten{0U};
+			std::atomic<size_t>   m_numFailed{0U};
+			std::atomic<uint64_t> m_bytesFetched{0U};
+			std::atomic_bool      m_cancel{false};
+			std::atomic_bool      m_done{false};
+
+			//Downloaded tiles waiting to be written
+			std::mutex m_queueMtx;
+			std::condition_variable m_queueNotFull;
+			std::condition_variable m_queueNotEmpty;
+			std::deque<std::tuple<Tile, std::vector<uint8_t>>> m_writeQueue;
+			uint64_t m_queuedBytes = 0U;
+			unsigned int m_numActiveFetchers = 0U;
+
+			std::mutex m_doneMtx;
+			std::condition_variable m_doneCV;
+
+			std::vector<std::thread> m_fetchThreads;
+			std::thread m_writerThread;
+			void FetchThreadMain(void);
+			void WriterThreadMain(void);
+	};
+}
@@ -10,6 +10,7 @@
 #include "SatelliteSources.hpp"
 #include "Tile.hpp"
 #include "Interfaces.hpp"
+#include "TileRequestQueue.hpp"
 #include "../Journal.h"
 
 //External Includes
@@ -20,27 +21,33 @@ namespace Maps {
 	class WebRetriever {
 		public:
 			static constexpr int32_t MaxOutstandingRequests = 10;
+			static constexpr int32_t MaxPendingPrefetches   = 4; //Keep most of our share of the server for tiles that are on screen
 
 		private:
 			Journal & Log;
 			std::mutex m_mutex;
 			ITileWebReceiver * m_receiver = nullptr;
-			std::unordered_set< std::tuple<Tile,SatelliteSource> > m_outstandingRequests;
 	
 			//m_failedRequests keeps a map of failed requests and maps them to the time of the most recent failure.
 			//This can be used to organize warnings and avoid server spamming.
 			std::unordered_map<std::tuple<Tile,SatelliteSource>, std::chrono::steady_clock::time_point> m_failedRequests;
 
-			Handy::ThreadPool m_threads;
+			TileRequestQueue<std::tuple<Tile,SatelliteSource>> m_requests;
 
 		public:
-			size_t NumOutstandingRequests() const { return m_outstandingRequests.size(); }
+			size_t NumOutstandingRequests() { return m_requests.NumOutstanding(); }
 
 			WebRetriever(ITileWebReceiver * receiver, Journal & LogRef);
 			~WebRetriever();
 
 			void WaitFinish();
-			void RetrieveAsync(Tile tile, SatelliteSource source);
+
+			//Priority < TileDemandPriority makes this a prefetch request (see TileRequestQueue.hpp)
+			void RetrieveAsync(Tile tile, SatelliteSource source, double Priority = TileDemandPriority);
+			void CancelStalePrefetches(std::chrono::time_point<std::chrono::steady_clock> Cutoff) { m_requests.CancelStalePrefetches(Cutoff); }
+
+			//Blocking download of a single resource - returns the HTTP response code (200 on success). Shared with the tile seeder.
+			static int Download(std::string const & URL, std::vector<uint8_t> & Data);
 	};
 
 }
@@ -21,6 +21,7 @@
 
 //Project Includes
 #include "../../EigenAliases.h"
+#include "../../Maps/LocalTangentPlane.hpp"
 #include "DroneComms.hpp"
 #include "DroneDataStructures.h"
 namespace DroneInterface {
@@ -333,6 +334,7 @@ namespace DroneInterface {
 			TimePoint m_LastVSCommand_ModeA_Timestamp;
 			TimePoint m_LastVSCommand_ModeB_Timestamp;
 			TimePoint m_LastPoseUpdate;
+			LocalTangentPlane m_simFrame; //Local ENU frame the flight dynamics are computed in - re-anchored near the drone as it moves
 
 			bool m_realtime = false;
 			std::filesystem::path m_videoPath;
@@ -354,12 +356,13 @@ namespace DroneInterface {
 
 			void   DroneMain(void);
 			void   UpdateDronePose(void);
-			void   UpdateDrone2DPositionBasedOnVelocity(double deltaT, Eigen::Matrix3d const & C_ENU_ECEF);
+			void   UpdateSimFrame(void);
+			Eigen::Vector3d GetSimFramePosition(double Lat, double Lon, double Alt) const;
+			void   UpdateDrone2DPositionBasedOnVelocity(double deltaT);
 			void   UpdateDroneVertChannelBasedOnTargetHAG(double deltaT, double TargetHAG, double climbRate, double descentRate);
 			double UpdateDroneOrientationBasedOnYawTarget(double deltaT, double TargetYaw, double turnRate);
 			void   Update2DVelocityBasedOnTarget(double deltaT, Eigen::Vector2d const & V_Target_EN, double max2DAcc, double max2DDec, double max2DSpeed);
-			void   ComputeTarget2DVelocityBasedOnTargetPosAndSpeed(double TargetLat, double TargetLon, double TargetMoveSpeed,
-			                                                       Eigen::Vector2d & V_Target_EN, Eigen::Matrix3d const & C_ECEF_ENU);
+			void   ComputeTarget2DVelocityBasedOnTargetPosAndSpeed(Eigen::Vector3d const & TargetPos_ENU, double TargetMoveSpeed, Eigen::Vector2d & V_Target_EN);
 			void   AddReceivedPacketToLog(TimePoint const & T, int PID, bool DecodeSuccess);
 	};
 
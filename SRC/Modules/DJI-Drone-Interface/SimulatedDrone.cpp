@@ -11,12 +11,19 @@
 #include "Drone.hpp"
 #include "../../Utilities.hpp"
 #include "../../Maps/MapUtils.hpp"
+#include "../../Maps/LocalTangentPlane.hpp"
 #include "../../UI/VehicleControlWidget.hpp"
 #include "../Guidance/Guidance.hpp"
 #include "DroneUtils.hpp"
 
 #define PI 3.14159265358979
 
+//The flight dynamics are computed in a local ENU frame (see UpdateSimFrame()). The frame is fitted over a square of half-width SimFrameRadius
+//(m) and is re-anchored at the drone whenever the drone gets more than SimFrameReanchorDist (m) from its origin, so the frame axes stay within
+//a few hundredths of a degree of the drone's own local East, North, and Up.
+static constexpr double SimFrameRadius       = 5000.0;
+static constexpr double SimFrameReanchorDist = 500.0;
+
 //DroneInterface::Drone::TimePoint InitTimepoint = std::chrono::steady_clock::now(); //Used for testing message age warnings
 
 static double sgn(double val) {
@@ -39,6 +46,7 @@ namespace DroneInterface {
 		m_Lat = Position_LLA(0);
 		m_Lon = Position_LLA(1);
 		m_Alt = Position_LLA(2);
+		m_simFrame = LocalTangentPlane(Eigen::Vector3d(m_Lat, m_Lon, 0.0), SimFrameRadius);
 		
 		//Set velocity
 		m_V_North = 0.0;
@@ -643,15 +651,35 @@ namespace DroneInterface {
 			return delta2;
 	}
 	
+	//Re-anchor the simulation frame at the drone if the drone has moved too far from the current frame origin
+	void SimulatedDrone::UpdateSimFrame(void) {
+		Eigen::Vector2d LL(m_Lat, m_Lon);
+		if ((! m_simFrame.IsInRangeLatLon(LL)) || (m_simFrame.LatLonToEN(LL).norm() > SimFrameReanchorDist))
+			m_simFrame = LocalTangentPlane(Eigen::Vector3d(m_Lat, m_Lon, 0.0), SimFrameRadius);
+	}
+
+	//Get the position of a point in the simulation frame. Points outside the area the frame is fitted over (e.g. a far-away home point) fall
+	//back on the exact conversion.
+	Eigen::Vector3d SimulatedDrone::GetSimFramePosition(double Lat, double Lon, double Alt) const {
+		Eigen::Vector3d LLA(Lat, Lon, Alt);
+		if (m_simFrame.IsInRangeLatLon(Eigen::Vector2d(Lat, Lon)))
+			return m_simFrame.LLAToENU(LLA);
+		else
+			return m_simFrame.LLAToENU_Exact(LLA);
+	}
+
 	//Updates m_Lat, m_Lon
-	void SimulatedDrone::UpdateDrone2DPositionBasedOnVelocity(double deltaT, Eigen::Matrix3d const & C_ENU_ECEF) {
-		//Update 2D Position
-		Eigen::Vector3d P_ECEF = LLA2ECEF(Eigen::Vector3d(m_Lat, m_Lon, m_Alt));
-		Eigen::Vector3d V_ECEF = C_ENU_ECEF * Eigen::Vector3d(m_V_East, m_V_North, 0.0);
-		P_ECEF += deltaT*V_ECEF;
-		Eigen::Vector3d LLA = ECEF2LLA(P_ECEF);
-		m_Lat = LLA(0);
-		m_Lon = LLA(1);
+	void SimulatedDrone::UpdateDrone2DPositionBasedOnVelocity(double deltaT) {
+		//Move the drone in the sim frame and apply the resulting change in Lat and Lon (instead of converting the new position back outright).
+		//This way conversion error can't accumulate from step to step - with 0 velocity the drone stays exactly where it is.
+		Eigen::Vector3d P_ENU = GetSimFramePosition(m_Lat, m_Lon, m_Alt);
+		double E[2] = { P_ENU(0), P_ENU(0) + deltaT*m_V_East };
+		double N[2] = { P_ENU(1), P_ENU(1) + deltaT*m_V_North };
+		double U[2] = { P_ENU(2), P_ENU(2) };
+		double Lat[2], Lon[2];
+		m_simFrame.ENUToLLA(E, N, U, 2U, Lat, Lon, nullptr);
+		m_Lat += Lat[1] - Lat[0];
+		m_Lon += Lon[1] - Lon[0];
 	}
 	
 	//Updates m_Alt, m_V_Down
@@ -703,15 +731,11 @@ namespace DroneInterface {
 	}
 	
 	//Compute the desired EN velocity vector needed to move to and/or hold a given position
-	//TargetLat and TargetLon are in radians.
+	//TargetPos_ENU is the target position in the sim frame (see GetSimFramePosition()).
 	//TargetMoveSpeed is in m/s.
 	//V_Target_EN is in m/s
-	void SimulatedDrone::ComputeTarget2DVelocityBasedOnTargetPosAndSpeed(double TargetLat, double TargetLon, double TargetMoveSpeed,
-	                                                                     Eigen::Vector2d & V_Target_EN, Eigen::Matrix3d const & C_ECEF_ENU) {
-		Eigen::Vector3d curentPos_ECEF = LLA2ECEF(Eigen::Vector3d(m_Lat, m_Lon, m_Alt));
-		Eigen::Vector3d targetPos_ECEF = LLA2ECEF(Eigen::Vector3d(TargetLat, TargetLon, m_Alt));
-		Eigen::Vector3d delta_ECEF     = targetPos_ECEF - curentPos_ECEF;
-		Eigen::Vector3d delta_ENU      = C_ECEF_ENU * delta_ECEF;
+	void SimulatedDrone::ComputeTarget2DVelocityBasedOnTargetPosAndSpeed(Eigen::Vector3d const & TargetPos_ENU, double TargetMoveSpeed, Eigen::Vector2d & V_Target_EN) {
+		Eigen::Vector3d delta_ENU = TargetPos_ENU - GetSimFramePosition(m_Lat, m_Lon, m_Alt);
 		Eigen::Vector2d V_EN(delta_ENU(0), delta_ENU(1));
 		double distFromTarget          = V_EN.norm();
 		V_EN.normalize();
@@ -750,8 +774,7 @@ namespace DroneInterface {
 		m_flightMode_LastPass = m_flightMode;
 
 		double HAG = m_Alt - m_groundAlt;
-		Eigen::Matrix3d C_ECEF_ENU = latLon_2_C_ECEF_ENU(m_Lat, m_Lon);
-		Eigen::Matrix3d C_ENU_ECEF = C_ECEF_ENU.transpose();
+		UpdateSimFrame();
 		TimePoint now = std::chrono::steady_clock::now();
 		double deltaT = SecondsElapsed(m_LastPoseUpdate, now);
 		m_LastPoseUpdate = now;
@@ -762,7 +785,7 @@ namespace DroneInterface {
 		
 		//First update 2D position (all flying modes)
 		if (m_flightMode > 0)
-			UpdateDrone2DPositionBasedOnVelocity(deltaT, C_ENU_ECEF);
+			UpdateDrone2DPositionBasedOnVelocity(deltaT);
 		
 		if (m_flightMode == 1) {
 			//P (Hover) mode
@@ -801,7 +824,7 @@ namespace DroneInterface {
 				else
 					speed = m_LastMission.Waypoints[m_targetWaypoint - 1].Speed;
 				Eigen::Vector2d V_Target_EN;
-				ComputeTarget2DVelocityBasedOnTargetPosAndSpeed(waypoint.Latitude, waypoint.Longitude, speed, V_Target_EN, C_ECEF_ENU);
+				ComputeTarget2DVelocityBasedOnTargetPosAndSpeed(GetSimFramePosition(waypoint.Latitude, waypoint.Longitude, m_Alt), speed, V_Target_EN);
 				Update2DVelocityBasedOnTarget(deltaT, V_Target_EN, max2DAcc, max2DDec, max2DSpeed);
 				
 				if (V_Target_EN.norm() > 0.1) {
@@ -810,8 +833,8 @@ namespace DroneInterface {
 				}
 				
 				//Detirmine when we have reached the waypoint and update state accordingly
-				Eigen::Vector3d P1 = LLA2ECEF(Eigen::Vector3d(m_Lat, m_Lon, m_Alt));
-				Eigen::Vector3d P2 = LLA2ECEF(Eigen::Vector3d(waypoint.Latitude, waypoint.Longitude, m_Alt));
+				Eigen::Vector3d P1 = GetSimFramePosition(m_Lat, m_Lon, m_Alt);
+				Eigen::Vector3d P2 = GetSimFramePosition(waypoint.Latitude, waypoint.Longitude, m_Alt);
 				if ((P2 - P1).norm() < 0.25) {
 					m_waypointMissionState = 2;
 					m_arrivalAtWaypoint_Timestamp = std::chrono::steady_clock::now();
@@ -837,7 +860,7 @@ namespace DroneInterface {
 					//Get EN vector to next waypoint (cheat by using our Compute2DVelocity function)
 					Waypoint const & nextWaypoint(m_LastMission.Waypoints[m_targetWaypoint + 1]);
 					Eigen::Vector2d V_Target_EN;
-					ComputeTarget2DVelocityBasedOnTargetPosAndSpeed(nextWaypoint.Latitude, nextWaypoint.Longitude, 10.0, V_Target_EN, C_ECEF_ENU);
+					ComputeTarget2DVelocityBasedOnTargetPosAndSpeed(GetSimFramePosition(nextWaypoint.Latitude, nextWaypoint.Longitude, m_Alt), 10.0, V_Target_EN);
 					
 					if (V_Target_EN.norm() > 0.1) {
 						double targetYaw = std::atan2(V_Target_EN(0), V_Target_EN(1));
@@ -865,7 +888,7 @@ namespace DroneInterface {
 				else
 					speed = m_LastMission.Waypoints[m_targetWaypoint - 1].Speed;
 				Eigen::Vector2d V_Target_EN;
-				ComputeTarget2DVelocityBasedOnTargetPosAndSpeed(waypoint.Latitude, waypoint.Longitude, speed, V_Target_EN, C_ECEF_ENU);
+				ComputeTarget2DVelocityBasedOnTargetPosAndSpeed(GetSimFramePosition(waypoint.Latitude, waypoint.Longitude, m_Alt), speed, V_Target_EN);
 				Update2DVelocityBasedOnTarget(deltaT, V_Target_EN, max2DAcc, max2DDec, max2DSpeed);
 				
 				if (V_Target_EN.norm() > 0.1) {
@@ -874,8 +897,8 @@ namespace DroneInterface {
 				}
 				
 				//When we get close enough to the waypoint change modes
-				Eigen::Vector3d P1 = LLA2ECEF(Eigen::Vector3d(m_Lat, m_Lon, m_Alt));
-				Eigen::Vector3d P2 = LLA2ECEF(Eigen::Vector3d(waypoint.Latitude, waypoint.Longitude, m_Alt));
+				Eigen::Vector3d P1 = GetSimFramePosition(m_Lat, m_Lon, m_Alt);
+				Eigen::Vector3d P2 = GetSimFramePosition(waypoint.Latitude, waypoint.Longitude, m_Alt);
 				if (m_targetWaypoint + 1 >= (int) m_LastMission.Waypoints.size()) {
 					//We are at the last waypoint
 					if ((P2 - P1).norm() < 0.25)
@@ -901,19 +924,14 @@ namespace DroneInterface {
 				//fully eliminates overshoot. Technically we are breaking the laws of physics here (which we already do with the vertical
 				//channel and orientation) but the violation is relatively minor and gives very realistic looking trajectories.
 				
-				Eigen::Vector3d P1_ECEF = LLA2ECEF(Eigen::Vector3d(waypoint.Latitude, waypoint.Longitude, m_Alt));
-				Eigen::Vector3d P2_ECEF = LLA2ECEF(Eigen::Vector3d(nextWaypoint.Latitude, nextWaypoint.Longitude, m_Alt));
-				Eigen::Vector3d V_ECEF = P2_ECEF - P1_ECEF;
-				V_ECEF.normalize();
-				Eigen::Vector3d V_ENU = C_ECEF_ENU * V_ECEF;
-				Eigen::Vector3d P3_ECEF = P1_ECEF + waypoint.CornerRadius * V_ECEF;
-				Eigen::Vector3d Target_LLA = ECEF2LLA(P3_ECEF);
+				Eigen::Vector3d P1_ENU = GetSimFramePosition(waypoint.Latitude, waypoint.Longitude, m_Alt);
+				Eigen::Vector3d P2_ENU = GetSimFramePosition(nextWaypoint.Latitude, nextWaypoint.Longitude, m_Alt);
+				Eigen::Vector3d V_ENU = P2_ENU - P1_ENU;
+				V_ENU.normalize();
+				Eigen::Vector3d P3_ENU = P1_ENU + waypoint.CornerRadius * V_ENU;
 
-				//std::cerr << "Turning through waypoint. Target Lat: " << std::fixed << std::setprecision(6) <<
-				//             Target_LLA(0)*180.0/PI << " deg. Target Lon: " << Target_LLA(1)*180.0/PI << " deg.\r\n";
-				
 				Eigen::Vector2d V_Target_EN;
-				ComputeTarget2DVelocityBasedOnTargetPosAndSpeed(Target_LLA(0), Target_LLA(1), m_turningSpeedThroughWaypoint, V_Target_EN, C_ECEF_ENU);
+				ComputeTarget2DVelocityBasedOnTargetPosAndSpeed(P3_ENU, m_turningSpeedThroughWaypoint, V_Target_EN);
 				Update2DVelocityBasedOnTarget(deltaT, V_Target_EN, 2.0*max2DAcc, 2.0*max2DDec, max2DSpeed);
 				//std::cerr << "Target speed: " << V_Target_EN.norm() << "m/s\r\n";
 
@@ -1009,7 +1027,7 @@ namespace DroneInterface {
 			//Returning to home
 			double RTHSpeed = 5.5; //m/s
 			Eigen::Vector2d V_Target_EN;
-			ComputeTarget2DVelocityBasedOnTargetPosAndSpeed(m_HomeLat, m_HomeLon, RTHSpeed, V_Target_EN, C_ECEF_ENU);
+			ComputeTarget2DVelocityBasedOnTargetPosAndSpeed(GetSimFramePosition(m_HomeLat, m_HomeLon, m_Alt), RTHSpeed, V_Target_EN);
 			Update2DVelocityBasedOnTarget(deltaT, V_Target_EN, max2DAcc, max2DDec, max2DSpeed);
 			
 			if (V_Target_EN.norm() > 0.1) {
@@ -1018,8 +1036,8 @@ namespace DroneInterface {
 			}
 			
 			//When we get close enough to the home position, land
-			Eigen::Vector3d P1 = LLA2ECEF(Eigen::Vector3d(m_Lat, m_Lon, m_Alt));
-			Eigen::Vector3d P2 = LLA2ECEF(Eigen::Vector3d(m_HomeLat, m_HomeLon, m_Alt));
+			Eigen::Vector3d P1 = GetSimFramePosition(m_Lat, m_Lon, m_Alt);
+			Eigen::Vector3d P2 = GetSimFramePosition(m_HomeLat, m_HomeLon, m_Alt);
 			if ((P2 - P1).norm() < 0.25)
 				m_flightMode = 6;
 		}
@@ -11,7 +11,10 @@
 
 //Project Includes
 #include "Guidance.hpp"
+#include "MissionPlanCache.hpp"
 #include "../../Utilities.hpp"
+#include "../../WorkStealingPool.hpp"
+#include "../../Maps/LocalTangentPlane.hpp"
 
 #define PI 3.14159265358979323846
 
@@ -417,94 +420,130 @@ static void PopulateMissionFromHatchLines_Greedy(std::Evector<LineSegment> const
 	}
 }
 
-static void SelectBestMission(std::Evector<DroneInterface::WaypointMission> const & CandidateMissions, DroneInterface::Waypoint const * StartPos,
-                              DroneInterface::WaypointMission & BestMission) {
-	int bestMissionIndex = -1;
+//Returns the index of the candidate mission with the lowest total travel distance from StartPos (or -1 if there are no candidates). The travel
+//distance is the distance from StartPos to the first waypoint plus the (start-independent) candidate length, so this works on cached plans.
+static int SelectBestCandidate(Guidance::CachedMissionPlan const & Plan, DroneInterface::Waypoint const * StartPos) {
+	int bestCandidateIndex = -1;
 	double lowestTravelDist = 0.0;
-	for (int missionIndex = 0; missionIndex < (int) CandidateMissions.size(); missionIndex++) {
-		double dist = CandidateMissions[missionIndex].TotalMissionDistance2D(StartPos);
-		if ((bestMissionIndex < 0) || (dist < lowestTravelDist)) {
-			bestMissionIndex = missionIndex;
+	for (int candidateIndex = 0; candidateIndex < (int) Plan.Candidates_LL.size(); candidateIndex++) {
+		if (Plan.Candidates_LL[candidateIndex].empty())
+			continue;
+		double dist = Plan.CandidateLengths[candidateIndex];
+		if (StartPos != nullptr) {
+			DroneInterface::Waypoint firstWaypoint;
+			firstWaypoint.Latitude  = Plan.Candidates_LL[candidateIndex][0](0);
+			firstWaypoint.Longitude = Plan.Candidates_LL[candidateIndex][0](1);
+			dist += DroneInterface::DistBetweenWaypoints2D(*StartPos, firstWaypoint);
+		}
+		if ((bestCandidateIndex < 0) || (dist < lowestTravelDist)) {
+			bestCandidateIndex = candidateIndex;
 			lowestTravelDist = dist;
 		}
 	}
-	if (bestMissionIndex < 0)
-		std::cerr << "Internal Error in SelectBestMission(): Failed to select a mission based on travel distance.\r\n";
-	else
-		BestMission = CandidateMissions[bestMissionIndex];
+	return bestCandidateIndex;
+}
+
+//Build a WaypointMission from the (Lat, Lon) waypoints of a candidate mission
+static void BuildMissionFromCandidate(std::Evector<Eigen::Vector2d> const & Candidate_LL, DroneInterface::WaypointMission & Mission,
+                                      Guidance::MissionParameters const & MissionParams) {
+	Mission.Waypoints.clear();
+	Mission.Waypoints.reserve(Candidate_LL.size());
+	Mission.LandAtLastWaypoint = false;
+	Mission.CurvedTrajectory = true;
+	for (Eigen::Vector2d const & waypoint_LatLon : Candidate_LL) {
+		Mission.Waypoints.emplace_back();
+		Mission.Waypoints.back().Latitude     = waypoint_LatLon(0);
+		Mission.Waypoints.back().Longitude    = waypoint_LatLon(1);
+		Mission.Waypoints.back().RelAltitude  = MissionParams.HAG;
+		Mission.Waypoints.back().CornerRadius = 5.0f;
+		Mission.Waypoints.back().Speed        = MissionParams.TargetSpeed;
+		Mission.Waypoints.back().LoiterTime   = std::nanf("");
+		Mission.Waypoints.back().GimbalPitch  = std::nanf("");
+	}
 }
 
 //Returns true if two waypoints are so close that keeping both would not be practically useful.
 //Note that we sanitize missions before sending them to the drone (this happens quietly in RealDrone) so this is not
 //about trying to make a mission acceptable to a drone, but about the practical usefulness of waypoints for a survey flight.
-static bool AreWaypointsTooClose(DroneInterface::Waypoint const & A, DroneInterface::Waypoint const & B) {
+//The _ENU arguments are the positions of the waypoints projected to the ref ellipsoid, in a common local ENU frame.
+static bool AreWaypointsTooClose(DroneInterface::Waypoint const & A, DroneInterface::Waypoint const & B,
+                                 Eigen::Vector3d const & A_ENU, Eigen::Vector3d const & B_ENU) {
 	if (std::abs(A.RelAltitude - B.RelAltitude) > 0.1)
 		return false;
-
-	//Project to ref ellipsoid and convert to ECEF
-	Eigen::Vector3d A_LLA(A.Latitude, A.Longitude, 0.0);
-	Eigen::Vector3d B_LLA(B.Latitude, B.Longitude, 0.0);
-	Eigen::Vector3d A_ECEF = LLA2ECEF(A_LLA);
-	Eigen::Vector3d B_ECEF = LLA2ECEF(B_LLA);
-	return ((A_ECEF - B_ECEF).norm() < 0.5);
+	return ((A_ENU - B_ENU).norm() < 0.5);
 }
 
-//Returns true if 3 waypoints are almost co-linear.
-static bool AreWaypointsColinear(DroneInterface::Waypoint const & A, DroneInterface::Waypoint const & B, DroneInterface::Waypoint const & C) {
+//Returns true if 3 waypoints are almost co-linear. The _ENU arguments are as in AreWaypointsTooClose().
+static bool AreWaypointsColinear(DroneInterface::Waypoint const & A, DroneInterface::Waypoint const & B, DroneInterface::Waypoint const & C,
+                                 Eigen::Vector3d const & A_ENU, Eigen::Vector3d const & B_ENU, Eigen::Vector3d const & C_ENU) {
 	if ((std::abs(A.RelAltitude - B.RelAltitude) > 0.1) || (std::abs(B.RelAltitude - C.RelAltitude) > 0.1) || (std::abs(A.RelAltitude - C.RelAltitude) > 0.1))
 		return false;
 
-	//Project to ref ellipsoid and convert to ECEF
-	Eigen::Vector3d A_LLA(A.Latitude, A.Longitude, 0.0);
-	Eigen::Vector3d B_LLA(B.Latitude, B.Longitude, 0.0);
-	Eigen::Vector3d C_LLA(C.Latitude, C.Longitude, 0.0);
-	Eigen::Vector3d A_ECEF = LLA2ECEF(A_LLA);
-	Eigen::Vector3d B_ECEF = LLA2ECEF(B_LLA);
-	Eigen::Vector3d C_ECEF = LLA2ECEF(C_LLA);
-
-	Eigen::Vector3d V1_ECEF = B_ECEF - A_ECEF;
-	Eigen::Vector3d V2_ECEF = C_ECEF - B_ECEF;
-	V1_ECEF.normalize();
-	V2_ECEF.normalize();
+	Eigen::Vector3d V1_ENU = B_ENU - A_ENU;
+	Eigen::Vector3d V2_ENU = C_ENU - B_ENU;
+	V1_ENU.normalize();
+	V2_ENU.normalize();
 
 	//If V1 or V2 is essentially 0 then we have basically identical points and the middle is redundant
-	if ((V1_ECEF.norm() < 0.5) && (V2_ECEF.norm() < 0.5))
+	if ((V1_ENU.norm() < 0.5) && (V2_ENU.norm() < 0.5))
 		return true;
 
 	//If V1 and V2 are within 0.1 degrees of each other, we will treat them as co-linear
-	return (V1_ECEF.dot(V2_ECEF) >= 0.999998476913288);
+	return (V1_ENU.dot(V2_ENU) >= 0.999998476913288);
 }
 
 //If a mission contains consecutive waypoints that are too close together or consecutive chains of co-linear waypoints,
 //remove redundant waypoints and interior waypoints from each co-linear chain. These aren't necessary and only serve to
-//slow down the drone without changing it's trajectory.
-static void RemoveRedundantWaypointsFromMission(DroneInterface::WaypointMission & Mission) {
+//slow down the drone without changing it's trajectory. LTP must cover every waypoint in the mission.
+static void RemoveRedundantWaypointsFromMission(DroneInterface::WaypointMission & Mission, LocalTangentPlane const & LTP) {
 	if (Mission.Waypoints.empty())
 		return;
 
+	//Get the positions of all waypoints (projected to the ref ellipsoid) in the local ENU frame, in one batch.
+	//ENU is just a rotation of ECEF so distances and angles are the same as if we worked in ECEF.
+	size_t numWaypoints = Mission.Waypoints.size();
+	std::vector<double> lat(numWaypoints), lon(numWaypoints), E(numWaypoints), North(numWaypoints), U(numWaypoints);
+	for (size_t n = 0U; n < numWaypoints; n++) {
+		lat[n] = Mission.Waypoints[n].Latitude;
+		lon[n] = Mission.Waypoints[n].Longitude;
+	}
+	LTP.LLAToENU(lat.data(), lon.data(), nullptr, numWaypoints, E.data(), North.data(), U.data());
+	std::Evector<Eigen::Vector3d> positions_ENU(numWaypoints);
+	for (size_t n = 0U; n < numWaypoints; n++)
+		positions_ENU[n] << E[n], North[n], U[n];
+
 	//First remove interior waypoints that are too close to adjacent waypoints. After this, waypoints n and n+1
 	//should not be too close together, for all n.
 	std::vector<DroneInterface::Waypoint> newWaypoints;
+	std::Evector<Eigen::Vector3d> newPositions_ENU;
 	newWaypoints.reserve(Mission.Waypoints.size());
+	newPositions_ENU.reserve(Mission.Waypoints.size());
 	newWaypoints.push_back(Mission.Waypoints[0U]);
+	newPositions_ENU.push_back(positions_ENU[0U]);
 	for (size_t n = 1U; n < Mission.Waypoints.size(); n++) {
-		if (! AreWaypointsTooClose(newWaypoints.back(), Mission.Waypoints[n]))
+		if (! AreWaypointsTooClose(newWaypoints.back(), Mission.Waypoints[n], newPositions_ENU.back(), positions_ENU[n])) {
 			newWaypoints.push_back(Mission.Waypoints[n]);
+			newPositions_ENU.push_back(positions_ENU[n]);
+		}
 	}
 	if (newWaypoints.size() < Mission.Waypoints.size())
 		std::cerr << Mission.Waypoints.size() - newWaypoints.size() << " waypoints removed in mission cleanup due to proximity.\r\n";
 	Mission.Waypoints.swap(newWaypoints);
+	positions_ENU.swap(newPositions_ENU);
 
 	//Now go through looking for chains of co-linear waypoints. When we find 3 or more, remove interior waypoints.
 	newWaypoints.clear();
+	newPositions_ENU.clear();
 	newWaypoints.reserve(Mission.Waypoints.size());
 	newWaypoints.push_back(Mission.Waypoints[0U]);
+	newPositions_ENU.push_back(positions_ENU[0U]);
 	for (size_t n1 = 1U; n1 < Mission.Waypoints.size(); n1++) {
 		size_t n2 = n1 + 1U;
-		if (n2 >= Mission.Waypoints.size())
-			newWaypoints.push_back(Mission.Waypoints[n1]);
-		else if (! AreWaypointsColinear(newWaypoints.back(), Mission.Waypoints[n1], Mission.Waypoints[n2]))
+		if ((n2 >= Mission.Waypoints.size()) ||
+		    (! AreWaypointsColinear(newWaypoints.back(), Mission.Waypoints[n1], Mission.Waypoints[n2], newPositions_ENU.back(), positions_ENU[n1], positions_ENU[n2]))) {
 			newWaypoints.push_back(Mission.Waypoints[n1]);
+			newPositions_ENU.push_back(positions_ENU[n1]);
+		}
 	}
 	if (newWaypoints.size() < Mission.Waypoints.size())
 		std::cerr << Mission.Waypoints.size() - newWaypoints.size() << " waypoints removed in mission cleanup due to co-linearity.\r\n";
@@ -513,10 +552,111 @@ static void RemoveRedundantWaypointsFromMission(DroneInterface::WaypointMission
 
 
 
+//Lay down hatch lines over a region and build every candidate mission PlanMission() chooses between, storing them in Plan (as (Lat, Lon)
+//waypoints along with the horizontal length of each). Nothing here depends on the vehicle start position. If no hatch lines intersect the
+//region, Plan is left with no candidates.
+static void BuildCandidateMissions(PolygonCollection const & Region, Guidance::MissionParameters const & MissionParams, Guidance::CachedMissionPlan & Plan) {
+	Plan.Candidates_LL.clear();
+	Plan.CandidateLengths.clear();
+
+	//Compute row spacing in meters
+	double RowSpacing_m = 2.0 * MissionParams.HAG * std::tan(0.5 * MissionParams.HFOV) * (1.0 - MissionParams.SidelapFraction);
+
+	//Lay down hatch lines separately for each disjoint component of the region.
+	std::Evector<LineSegment> hatchLines;
+	Eigen::Vector4d collectionAABB(std::nan(""), std::nan(""), std::nan(""), std::nan(""));
+	std::vector<size_t> extremeHatchLineSegmentIndices;
+	extremeHatchLineSegmentIndices.reserve(std::max((unsigned int) (2U * Region.m_components.size()), 4U));
+	for (Polygon const & comp : Region.m_components) {
+		//Get the AABB and minor axis for the polygon
+		Eigen::Vector4d AABB   = comp.GetAABB();
+		Eigen::Vector2d VMinor = comp.FindShortestAxis();
+
+		//If the polygon is empty, skip it
+		if (std::isnan(AABB(0)))
+			continue;
+
+		//Update AABB of collection
+		if (std::isnan(collectionAABB(0)))
+			collectionAABB = AABB;
+		collectionAABB(0) = std::min(collectionAABB(0), AABB(0));
+		collectionAABB(1) = std::max(collectionAABB(1), AABB(1));
+		collectionAABB(2) = std::min(collectionAABB(2), AABB(2));
+		collectionAABB(3) = std::max(collectionAABB(3), AABB(3));
+
+		//Convert row spacing to NM units based on center point of AABB
+		double RowSpacing_NMUnits = MetersToNMUnits(RowSpacing_m, 0.5*AABB(2) + 0.5*AABB(3));
+
+		//Lay down hatch lines orthogonal to the shortest axis to try and minimize the number of turns
+		double minProj = FindLowerBoundProjectionOntoUnitVec(AABB, VMinor);
+		double maxProj = FindUpperBoundProjectionOntoUnitVec(AABB, VMinor);
+		std::Evector<std::Evector<LineSegment>> segmentsByHatchLine;
+		segmentsByHatchLine.reserve((unsigned int) std::ceil((maxProj - minProj)/RowSpacing_NMUnits) + 2U);
+		for (double proj = minProj; proj <= maxProj; proj += RowSpacing_NMUnits) {
+			//Lay down the hatch line X dot VMinor = proj
+			std::Evector<LineSegment> segments = comp.ClipLine(VMinor, proj);
+			if (! segments.empty())
+				segmentsByHatchLine.push_back(segments);
+		}
+
+		for (size_t n = 0U; n < segmentsByHatchLine.size(); n++) {
+			if ((n == 0U) || (n + 1U >= segmentsByHatchLine.size())) {
+				for (size_t m = 0U; m < segmentsByHatchLine[n].size(); m++)
+					extremeHatchLineSegmentIndices.push_back(hatchLines.size() + m);
+			}
+			hatchLines.insert(hatchLines.end(), segmentsByHatchLine[n].begin(), segmentsByHatchLine[n].end());
+		}
+	}
+
+	//If no hatch lines intersected the region, it is too small or narrow to effectively fly with current settings using this strategy.
+	//We could do a few things in this case:
+	// 1 - Put one waypoint in the middle of the region
+	// 2 - Make a single hatch line going parallel to the longest axis of the region and try to put it through the middle
+	// 3 - Note that this usually happens when we get a tiny region due to a less-than-ideal cut location. Just drop the mission.
+	// We go with option 3 for now, although we could change this if we change things to proactively cut tiny sub-regions after partitioning.
+	if (hatchLines.empty())
+		return;
+
+	//Now build a collection of candidate missions by starting at each end of each extreme hatch line segment and greedily
+	//populating waypoints. Candidates are independent so they are built in parallel - candidate 2k starts at endpoint 1 of
+	//extreme segment k and candidate 2k+1 starts at endpoint 2. Ties in SelectBestCandidate() are broken by lowest index, so
+	//the result does not depend on scheduling.
+	std::Evector<DroneInterface::WaypointMission> candidateMissions(2U*extremeHatchLineSegmentIndices.size());
+	WorkStealingPool::Instance().ParallelFor(candidateMissions.size(), [&](size_t CandidateIndex) {
+		int segIndex = int(extremeHatchLineSegmentIndices[CandidateIndex / 2U]);
+		int endpoint = int(CandidateIndex % 2U) + 1;
+		PopulateMissionFromHatchLines_Greedy(hatchLines, candidateMissions[CandidateIndex], segIndex, endpoint, MissionParams);
+	});
+
+	//Keep only what is needed to choose between and rebuild the candidates
+	Plan.Candidates_LL.resize(candidateMissions.size());
+	Plan.CandidateLengths.resize(candidateMissions.size());
+	for (size_t n = 0U; n < candidateMissions.size(); n++) {
+		Plan.Candidates_LL[n].reserve(candidateMissions[n].Waypoints.size());
+		for (DroneInterface::Waypoint const & waypoint : candidateMissions[n].Waypoints)
+			Plan.Candidates_LL[n].push_back(Eigen::Vector2d(waypoint.Latitude, waypoint.Longitude));
+		Plan.CandidateLengths[n] = candidateMissions[n].TotalMissionDistance2D(nullptr);
+	}
+}
+
+
+
 // *********************************************************************************************************************************
 // ************************************************   Public Function Definitions   ************************************************
 // *********************************************************************************************************************************
 namespace Guidance {
+	//Get a tangent plane covering the given region (in NM coords), for use with PlanMission()
+	LocalTangentPlane TangentPlaneCoveringRegion(PolygonCollection const & Region) {
+		Eigen::Vector4d AABB_NM = Region.GetAABB();
+		if (! AABB_NM.allFinite())
+			return LocalTangentPlane::Covering(nullptr, nullptr, 0U);
+		Eigen::Vector2d LL_A = NMToLatLon(Eigen::Vector2d(AABB_NM(0), AABB_NM(2)));
+		Eigen::Vector2d LL_B = NMToLatLon(Eigen::Vector2d(AABB_NM(1), AABB_NM(3)));
+		double lat[2] = { LL_A(0), LL_B(0) };
+		double lon[2] = { LL_A(1), LL_B(1) };
+		return LocalTangentPlane::Covering(lat, lon, 2U);
+	}
+
 	//4 - Take a region or sub-region and plan a trajectory to cover it at a given height that meets the specified imaging requirements. In this case we specify
 	//    the imaging requirements using a maximum speed and sidelap fraction.
 	//Arguments:
@@ -524,91 +664,54 @@ namespace Guidance {
 	//Mission       - Output - The planned mission that covers the input region
 	//MissionParams - Input  - Parameters specifying speed and row spacing (see definitions in struct declaration)
 	//StartPos      - Input  - Optional: Initial position of vehicle (does not impact waypoints, but may impact ordering)
+	//
+	//Everything but the final choice between candidate missions is independent of StartPos, so the candidates are kept in the mission plan
+	//cache. Re-planning a region we have seen before (e.g. after a restart, or for a new start position) only repeats the choice and cleanup.
 	void PlanMission(PolygonCollection const & Region, DroneInterface::WaypointMission & Mission, MissionParameters const & MissionParams,
-	                 DroneInterface::Waypoint const * StartPos) {
+	                 DroneInterface::Waypoint const * StartPos, LocalTangentPlane const * LTP) {
 		//PlanMission_Elaina(Region, Mission, MissionParams);
 		//return;
 
 		Mission.Waypoints.clear();
 		auto startTime = std::chrono::steady_clock::now();
 
-		//Compute row spacing in meters
-		double RowSpacing_m = 2.0 * MissionParams.HAG * std::tan(0.5 * MissionParams.HFOV) * (1.0 - MissionParams.SidelapFraction);
-
-		//Lay down hatch lines separately for each disjoint component of the region.
-		std::Evector<LineSegment> hatchLines;
-		Eigen::Vector4d collectionAABB(std::nan(""), std::nan(""), std::nan(""), std::nan(""));
-		std::vector<size_t> extremeHatchLineSegmentIndices;
-		extremeHatchLineSegmentIndices.reserve(std::max((unsigned int) (2U * Region.m_components.size()), 4U));
-		for (Polygon const & comp : Region.m_components) {
-			//Get the AABB and minor axis for the polygon
-			Eigen::Vector4d AABB   = comp.GetAABB();
-			Eigen::Vector2d VMinor = comp.FindShortestAxis();
-
-			//If the polygon is empty, skip it
-			if (std::isnan(AABB(0)))
-				continue;
-
-			//Update AABB of collection
-			if (std::isnan(collectionAABB(0)))
-				collectionAABB = AABB;
-			collectionAABB(0) = std::min(collectionAABB(0), AABB(0));
-			collectionAABB(1) = std::max(collectionAABB(1), AABB(1));
-			collectionAABB(2) = std::min(collectionAABB(2), AABB(2));
-			collectionAABB(3) = std::max(collectionAABB(3), AABB(3));
-
-			//Convert row spacing to NM units based on center point of AABB
-			double RowSpacing_NMUnits = MetersToNMUnits(RowSpacing_m, 0.5*AABB(2) + 0.5*AABB(3));
-
-			//Lay down hatch lines orthogonal to the shortest axis to try and minimize the number of turns
-			double minProj = FindLowerBoundProjectionOntoUnitVec(AABB, VMinor);
-			double maxProj = FindUpperBoundProjectionOntoUnitVec(AABB, VMinor);
-			std::Evector<std::Evector<LineSegment>> segmentsByHatchLine;
-			segmentsByHatchLine.reserve((unsigned int) std::ceil((maxProj - minProj)/RowSpacing_NMUnits) + 2U);
-			for (double proj = minProj; proj <= maxProj; proj += RowSpacing_NMUnits) {
-				//Lay down the hatch line X dot VMinor = proj
-				std::Evector<LineSegment> segments = comp.ClipLine(VMinor, proj);
-				if (! segments.empty())
-					segmentsByHatchLine.push_back(segments);
-			}
-
-			for (size_t n = 0U; n < segmentsByHatchLine.size(); n++) {
-				if ((n == 0U) || (n + 1U >= segmentsByHatchLine.size())) {
-					for (size_t m = 0U; m < segmentsByHatchLine[n].size(); m++)
-						extremeHatchLineSegmentIndices.push_back(hatchLines.size() + m);
-				}
-				hatchLines.insert(hatchLines.end(), segmentsByHatchLine[n].begin(), segmentsByHatchLine[n].end());
-			}
+		CachedMissionPlan plan;
+		std::vector<double> keyData = MissionPlanCache::MakePlanKeyData(Region, MissionParams);
+		bool cacheHit = MissionPlanCache::Instance().LookupPlan(keyData, plan);
+		if (! cacheHit) {
+			BuildCandidateMissions(Region, MissionParams, plan);
+			plan.KeyData = std::move(keyData);
+			MissionPlanCache::Instance().StorePlan(plan);
 		}
 
-		//If no hatch lines intersected the region, it is too small or narrow to effectively fly with current settings using this strategy.
-		//We could do a few things in this case:
-		// 1 - Put one waypoint in the middle of the region
-		// 2 - Make a single hatch line going parallel to the longest axis of the region and try to put it through the middle
-		// 3 - Note that this usually happens when we get a tiny region due to a less-than-ideal cut location. Just drop the mission.
-		// We go with option 3 for now, although we could change this if we change things to proactively cut tiny sub-regions after partitioning.
-		if (hatchLines.empty()) {
+		//An empty plan means the region is too small or narrow to fly with current settings (see BuildCandidateMissions())
+		if (plan.Candidates_LL.empty()) {
 			std::cerr << "Dropping mission for pathological region since no hatch lines intersect it.\r\n";
 			return;
 		}
 
-		//Now build a collection of candidate missions by starting at each end of each extreme hatch line segment and greedily
-		//populating waypoints. Select the best candidate mission (the one with lowest total travel distance).
-		std::Evector<DroneInterface::WaypointMission> candidateMissions;
-		candidateMissions.reserve(2U*extremeHatchLineSegmentIndices.size());
-		for (size_t segIndex : extremeHatchLineSegmentIndices) {
-			candidateMissions.emplace_back();
-			PopulateMissionFromHatchLines_Greedy(hatchLines, candidateMissions.back(), int(segIndex), 1, MissionParams);
-
-			candidateMissions.emplace_back();
-			PopulateMissionFromHatchLines_Greedy(hatchLines, candidateMissions.back(), int(segIndex), 2, MissionParams);
+		//Select the best candidate mission (the one with lowest total travel distance)
+		int bestCandidateIndex = SelectBestCandidate(plan, StartPos);
+		if (bestCandidateIndex < 0) {
+			std::cerr << "Internal Error in PlanMission(): Failed to select a mission based on travel distance.\r\n";
+			return;
 		}
-		SelectBestMission(candidateMissions, StartPos, Mission);
-
-		//Remove redundant waypoints (consecutive waypoints that are too close or chains of co-linear waypoints)
-		RemoveRedundantWaypointsFromMission(Mission);
+		BuildMissionFromCandidate(plan.Candidates_LL[bestCandidateIndex], Mission, MissionParams);
+
+		//Remove redundant waypoints (consecutive waypoints that are too close or chains of co-linear waypoints). The mission stays inside the
+		//region, so a plane covering the region covers the mission - but don't trust a caller-supplied plane blindly.
+		bool LTPCoversMission = (LTP != nullptr);
+		for (size_t n = 0U; LTPCoversMission && (n < Mission.Waypoints.size()); n++)
+			LTPCoversMission = LTP->IsInRangeLatLon(Eigen::Vector2d(Mission.Waypoints[n].Latitude, Mission.Waypoints[n].Longitude));
+		if (LTPCoversMission)
+			RemoveRedundantWaypointsFromMission(Mission, *LTP);
+		else
+			RemoveRedundantWaypointsFromMission(Mission, TangentPlaneCoveringRegion(Region));
 		
+		//Build the message before printing so lines from missions planned concurrently don't interleave
 		double runtime_ms = SecondsElapsed(startTime)*1000.0;
-		std::cerr << "Considered " << candidateMissions.size() << " candidate missions. Runtime: " << runtime_ms << " ms.\r\n";
+		std::ostringstream outSS;
+		outSS << "Considered " << plan.Candidates_LL.size() << " candidate missions" << (cacheHit ? " (cached)" : "") << ". Runtime: " << runtime_ms << " ms.\r\n";
+		std::cerr << outSS.str();
 	}
-}
\ No newline at end of file
+}
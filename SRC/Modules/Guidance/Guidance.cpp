@@ -8,9 +8,13 @@
 
 //Project Includes
 #include "Guidance.hpp"
+#include "MissionPlanCache.hpp"
 #include "../../UI/VehicleControlWidget.hpp"
 #include "../../Utilities.hpp"
 #include "../../Maps/MapUtils.hpp"
+#include "../../Maps/LocalTangentPlane.hpp"
+#include "../../Maps/TilePrefetcher.hpp"
+#include "../../WorkStealingPool.hpp"
 
 #define PI 3.14159265358979323846
 
@@ -152,6 +156,7 @@ namespace Guidance {
 					std::cerr << "Bad or old telemetry for drone " << Serial << ". Treating as on ground.\r\n";
 					m_droneStates[Serial] = std::make_tuple(0, -1, NowTime); //On ground and available for tasking
 				}
+				m_sequencesStale = true;
 				
 				return true;
 			}
@@ -183,6 +188,7 @@ namespace Guidance {
 				m_dronesUnderCommand.erase(m_dronesUnderCommand.begin() + n);
 				m_droneHAGs.erase(Serial);
 				m_droneAllowedTakeoffTimes.erase(Serial);
+				m_sequencesStale = true;
 				std::cerr << "Removing drone " << Serial << " from command.\r\n";
 
 				//If we just removed the last drone, abort the mission - this makes it unnecessary to have an extra UI control
@@ -218,7 +224,11 @@ namespace Guidance {
 	//Clear mission prep data and periodically updated fields
 	void GuidanceEngine::ResetIntermediateData(void) {
 		m_surveyRegionPartition.clear();
+		if (Maps::TilePrefetcher::Instance() != nullptr)
+			Maps::TilePrefetcher::Instance()->ClearMissionAreas();
 		m_droneMissions.clear();
+		m_compiledMissions.clear();
+		m_compiledSubregions.clear();
 		m_droneAllowedTakeoffTimes.clear();
 		m_droneHAGs.clear();
 		m_droneStates.clear();
@@ -226,6 +236,9 @@ namespace Guidance {
 		m_taskedMissionProgress.clear();
 		m_dronePositions.clear();
 		m_availableMissionIndices.clear();
+		m_sequencer.Clear();
+		m_sequencingSerials.clear();
+		m_sequencesStale = true;
 	}
 
 	//Update our latched drone positions - also update progress fields for drones tasked to missions
@@ -265,14 +278,25 @@ namespace Guidance {
 		m_mutex.unlock();
 
 		std::cerr << "Doing mission preparation work.\r\n\r\n";
-		//MapWidget::Instance().m_messageBoxOverlay.AddMessage("Preparing mission for execution..."s, m_MessageToken1);
+		MapWidget::Instance().m_messageBoxOverlay.AddMessage("Preparing mission for execution: Partitioning survey region..."s, m_MessageToken1);
 
-		//Partition the survey region into components
+		//Partition the survey region into components (or re-use the partition from the last time we saw this region and these settings)
 		std::Evector<PolygonCollection> surveyRegionPartition;
-		if (PartitioningMethod == 0)
+		std::vector<double> partitionKeyData = MissionPlanCache::MakePartitionKeyData(surveyRegion, missionParams, PartitioningMethod);
+		if (MissionPlanCache::Instance().LookupPartition(partitionKeyData, surveyRegionPartition))
+			std::cerr << "Using cached partition of survey region.\r\n";
+		else if (PartitioningMethod == 0) {
 			PartitionSurveyRegion_TriangleFusion(surveyRegion, surveyRegionPartition, missionParams);
-		else if (PartitioningMethod == 1)
+			MissionPlanCache::Instance().StorePartition(partitionKeyData, surveyRegionPartition);
+		}
+		else if (PartitioningMethod == 1) {
 			PartitionSurveyRegion_IteratedCuts(surveyRegion, surveyRegionPartition, missionParams);
+			MissionPlanCache::Instance().StorePartition(partitionKeyData, surveyRegionPartition);
+		}
+		else if (PartitioningMethod == 2) {
+			PartitionSurveyRegion_BalancedCuts(surveyRegion, surveyRegionPartition, missionParams);
+			MissionPlanCache::Instance().StorePartition(partitionKeyData, surveyRegionPartition);
+		}
 		else
 			std::cerr << "Error: Unrecognized partitioning method. Skipping partitioning.\r\n";
 		std::vector<std::string> compLabels(surveyRegionPartition.size());
@@ -290,14 +314,34 @@ namespace Guidance {
 
 		//Plan missions for each component of the partition - we are guaranteed a mission object for each sub-region, but
 		//the missions may be empty if the region is too pathological. These should be treated as complete right off the bat.
-		std::vector<DroneInterface::WaypointMission> droneMissions;
-		droneMissions.reserve(surveyRegionPartition.size());
-		for (auto const & component : surveyRegionPartition) {
-			droneMissions.emplace_back();
-			PlanMission(component, droneMissions.back(), missionParams, nullptr);
-		}
+		//Sub-regions are planned in parallel on the shared work-stealing pool (PlanMission() fans out again over its candidate
+		//missions). Mission n only ever depends on sub-region n, so the result is the same as planning them one at a time.
+		std::vector<DroneInterface::WaypointMission> droneMissions(surveyRegionPartition.size());
+		std::vector<CompiledMission> compiledMissions(surveyRegionPartition.size());
+		std::Evector<CompiledPolygonCollection> compiledSubregions(surveyRegionPartition.size()); //For SelectSubRegion()
+		LocalTangentPlane surveyRegionLTP = TangentPlaneCoveringRegion(surveyRegion); //Fitted once and shared by every sub-region
+		std::atomic<size_t> numMissionsPlanned(0U);
+		std::mutex progressMutex;
+		auto progressMessage = [&surveyRegionPartition](size_t NumPlanned) {
+			return "Preparing mission for execution: Planned "s + std::to_string(NumPlanned) + " of "s +
+			       std::to_string(surveyRegionPartition.size()) + " sub-region missions..."s;
+		};
+		MapWidget::Instance().m_messageBoxOverlay.AddMessage(progressMessage(0U), m_MessageToken1);
+		WorkStealingPool::Instance().ParallelFor(surveyRegionPartition.size(), [&](size_t SubregionIndex) {
+			PlanMission(surveyRegionPartition[SubregionIndex], droneMissions[SubregionIndex], missionParams, nullptr, &surveyRegionLTP);
+			compiledMissions[SubregionIndex].Compile(droneMissions[SubregionIndex]);
+			compiledSubregions[SubregionIndex].Compile(surveyRegionPartition[SubregionIndex]);
+
+			//Lock so a slow thread can't overwrite the message with a smaller count
+			std::scoped_lock lock(progressMutex);
+			size_t numPlanned = ++numMissionsPlanned;
+			MapWidget::Instance().m_messageBoxOverlay.AddMessage(progressMessage(numPlanned), m_MessageToken1);
+		});
 		MapWidget::Instance().m_guidanceOverlay.SetData_PlannedMissions(droneMissions);
 
+		//Save the partition and plans now so a restart after a crash doesn't have to redo them
+		MissionPlanCache::Instance().Save();
+
 		//Set initial drone states
 		std::unordered_map<std::string, std::tuple<int, int, TimePoint>> droneStates;
 		TimePoint NowTime = std::chrono::steady_clock::now();
@@ -355,12 +399,15 @@ namespace Guidance {
 			nextAllowedHAG -= missionParams.HeightStaggerInterval;
 		}
 
-		//MapWidget::Instance().m_messageBoxOverlay.RemoveMessage(m_MessageToken1);
+		MapWidget::Instance().m_messageBoxOverlay.RemoveMessage(m_MessageToken1);
 
 		//Save all the mission prep work and reset progress tracking fields
 		m_mutex.lock();
 		m_surveyRegionPartition = surveyRegionPartition;
 		m_droneMissions = droneMissions;
+		m_compiledMissions = compiledMissions;
+		m_compiledSubregions = std::move(compiledSubregions);
+		m_surveyRegionLTP = surveyRegionLTP;
 		m_droneStates = droneStates;
 		m_availableMissionIndices = availableMissionIndices;
 		m_droneAllowedTakeoffTimes = droneAllowedTakeoffTimes;
@@ -370,6 +417,17 @@ namespace Guidance {
 		m_dronePositions.clear();
 		m_missionPrepDone = true; //Mark the prep work as done
 		m_mutex.unlock();
+
+		//Start loading imagery and data for the sub-regions in the background so they are at hand when drones are tasked to them
+		if (Maps::TilePrefetcher::Instance() != nullptr) {
+			std::Evector<Eigen::Vector4d> subRegionAABBs;
+			for (auto const & subRegion : surveyRegionPartition) {
+				Eigen::Vector4d AABB = subRegion.GetAABB();
+				if (! std::isnan(AABB(0)))
+					subRegionAABBs.push_back(AABB);
+			}
+			Maps::TilePrefetcher::Instance()->SetMissionAreas(subRegionAABBs);
+		}
 	}
 
 	//Assign the given drone to fly the given mission. This will override the HAG for the mission based on the drones serial number
@@ -451,13 +509,18 @@ namespace Guidance {
 			currentPos.Longitude = droneLLA(1);
 			currentPos.RelAltitude = 0.0;
 
-			int missionIndex = SelectSubRegion(m_TA, m_surveyRegionPartition, m_droneMissions, m_availableMissionIndices, currentPos, m_MissionParams);
+			//Use the next mission in this drones sequence if the sequencer has one for it - otherwise fall back on the closest viable sub-region
+			int missionIndex = GetSequencedMissionForDrone(serial, currentPos);
+			if (missionIndex < 0)
+				missionIndex = SelectSubRegion(*m_TA, m_compiledSubregions, m_droneMissions, m_compiledMissions, m_availableMissionIndices,
+				                               currentPos, m_MissionParams);
 			if (missionIndex >= 0) {
 				//There is sub-region we may be able to fly
 
 				//Re-optimize the mission for this sub-region based on the drones current (starting) position
 				//std::cerr << "Mission for sub-region " << missionIndex << " being re-optimized.\r\n";
-				PlanMission(m_surveyRegionPartition[missionIndex], m_droneMissions[missionIndex], m_MissionParams, &currentPos);
+				PlanMission(m_surveyRegionPartition[missionIndex], m_droneMissions[missionIndex], m_MissionParams, &currentPos, &m_surveyRegionLTP);
+				m_compiledMissions[missionIndex].Compile(m_droneMissions[missionIndex]);
 				MapWidget::Instance().m_guidanceOverlay.SetData_PlannedMissions(m_droneMissions);
 
 				//Task drone to the updated mission
@@ -468,22 +531,34 @@ namespace Guidance {
 				//Compute the total travel distance for the mission we are tasking and initialize progress fields
 				m_taskedMissionDistances[missionIndex] = m_droneMissions[missionIndex].TotalMissionDistance2D(&currentPos);
 				m_taskedMissionProgress[missionIndex]  = 0.0;
+				m_sequencesStale = true;
 			}
 		}
 	}
 
 	void GuidanceEngine::UpdateGuidanceOverlayWithMissionSequencesAndProgress(void) {
+		//Each drones sequence is its current mission (if any) followed by the missions the sequencer has planned for it that are still available
+		std::vector<std::vector<int>> plannedSequences;
+		uint64_t solutionID;
+		bool havePlan = m_sequencer.GetBestSoFar(plannedSequences, solutionID) && (plannedSequences.size() == m_sequencingSerials.size());
+
 		std::vector<std::vector<int>> Sequences;
 		std::unordered_set<int> missionsInProgress;
 		for (DroneInterface::Drone * drone : m_dronesUnderCommand) {
 			std::string serial = drone->GetDroneSerial();
+			Sequences.emplace_back();
 			if (std::get<0>(m_droneStates.at(serial)) > 1) {
 				int missionIndex = std::get<1>(m_droneStates.at(serial));
-				Sequences.emplace_back(1, missionIndex);
+				Sequences.back().push_back(missionIndex);
 				missionsInProgress.insert(missionIndex);
 			}
-			else
-				Sequences.emplace_back();
+			auto iter = std::find(m_sequencingSerials.begin(), m_sequencingSerials.end(), serial);
+			if (havePlan && (iter != m_sequencingSerials.end())) {
+				for (int missionIndex : plannedSequences[iter - m_sequencingSerials.begin()]) {
+					if (m_availableMissionIndices.count(missionIndex) > 0U)
+						Sequences.back().push_back(missionIndex);
+				}
+			}
 		}
 		MapWidget::Instance().m_guidanceOverlay.SetData_DroneMissionSequences(Sequences);
 
@@ -538,7 +613,7 @@ namespace Guidance {
 				//std::cerr << "currentWaypoint: " << currentWaypoint << "\r\n";
 
 				double margin = 0.0;
-				bool willFinish = IsPredictedToFinishWithoutShadows(m_TA, m_droneMissions[missionIndex], currentWaypoint, std::chrono::steady_clock::now(), margin);
+				bool willFinish = IsPredictedToFinishWithoutShadows(*m_TA, m_compiledMissions[missionIndex], currentWaypoint, std::chrono::steady_clock::now(), margin);
 				if (! willFinish) {
 					DroneInterface::WaypointMission LoiterMission;
 					LoiterMission.Waypoints.push_back(m_droneMissions[missionIndex].Waypoints[0]);
@@ -548,9 +623,81 @@ namespace Guidance {
 					m_availableMissionIndices.insert(missionIndex); //Mark the mission as available again
 					m_taskedMissionDistances.erase(missionIndex); //Clear progress data for mission
 					m_taskedMissionProgress.erase(missionIndex);  //Clear progress data for mission
+					m_sequencesStale = true;
+				}
+			}
+		}
+	}
+
+	//Start a new sequencing solve if the last one is out of date. Solves run in the background (see SubregionSequencer) on a snapshot of the current
+	//mission state. A drone that is busy with a mission is treated as starting from the end of that mission once it is done with it. We re-solve
+	//when drones are tasked or missions are aborted, and periodically as new TA functions come in.
+	void GuidanceEngine::UpdateSubregionSequencing(double TimeBudget) {
+		double TARefreshPeriod = 10.0; //Re-solve for new TA functions at most this often (s)
+
+		if (m_availableMissionIndices.empty() || m_dronesUnderCommand.empty()) {
+			m_sequencer.Cancel(); //Called with m_mutex held - don't wait on the worker here
+			return;
+		}
+		bool haveNewTA = (SecondsElapsed(m_sequencingTATimestamp, m_TA->Timestamp) > TARefreshPeriod);
+		if ((! m_sequencesStale) && ((! haveNewTA) || m_sequencer.IsRunning()))
+			return;
+
+		TimePoint now = std::chrono::steady_clock::now();
+		std::vector<DroneInterface::Waypoint> droneStartPositions;
+		std::vector<double> droneStartDelays;
+		m_sequencingSerials.clear();
+		for (DroneInterface::Drone * drone : m_dronesUnderCommand) {
+			std::string serial = drone->GetDroneSerial();
+			int activity = std::get<0>(m_droneStates.at(serial));
+			Eigen::Vector3d droneLLA = (m_dronePositions.count(serial) > 0U) ? m_dronePositions.at(serial) : Eigen::Vector3d(0.0, 0.0, 0.0);
+			DroneInterface::Waypoint startPos;
+			startPos.Latitude    = droneLLA(0);
+			startPos.Longitude   = droneLLA(1);
+			startPos.RelAltitude = 0.0;
+			double startDelay = 0.0;
+			if (activity == 0)
+				startDelay = std::max(SecondsElapsed(now, m_droneAllowedTakeoffTimes.at(serial)), 0.0);
+			else if (activity > 1) {
+				//Estimate the time left in the current mission from the distance left to fly (see AbortMissionsPredictedToGetHitWithShadows())
+				int missionIndex = std::get<1>(m_droneStates.at(serial));
+				if (! m_droneMissions[missionIndex].Waypoints.empty())
+					startPos = m_droneMissions[missionIndex].Waypoints.back();
+				if ((m_taskedMissionDistances.count(missionIndex) > 0U) && (m_taskedMissionProgress.count(missionIndex) > 0U)) {
+					double distRemaining = std::max(m_taskedMissionDistances.at(missionIndex) - m_taskedMissionProgress.at(missionIndex), 0.0);
+					startDelay = distRemaining / m_MissionParams.TargetSpeed;
 				}
 			}
+			droneStartPositions.push_back(startPos);
+			droneStartDelays.push_back(startDelay);
+			m_sequencingSerials.push_back(serial);
+		}
+		std::set<int> missionIndicesToAssign(m_availableMissionIndices.begin(), m_availableMissionIndices.end());
+		//Called with m_mutex held - Start() hands the problem to the worker and cancels the old solve without waiting for it to wind down
+		m_sequencer.Start(m_TA, m_droneMissions, m_compiledMissions, droneStartPositions, droneStartDelays, missionIndicesToAssign,
+		                  m_MissionParams, TimeBudget);
+		m_sequencesStale = false;
+		m_sequencingTATimestamp = m_TA->Timestamp;
+	}
+
+	//Get the next mission in the given drones sequence from the most recent sequencer solution. Missions that were taken since the solve started
+	//are skipped. Returns -1 if there is no solution with a sequence for the drone, if the sequence is exhausted, or if the next mission in it is not
+	//viable from where the drone is now (the sequencer worked from predicted start positions and possibly an older TA function).
+	int GuidanceEngine::GetSequencedMissionForDrone(std::string const & Serial, DroneInterface::Waypoint const & CurrentPos) {
+		std::vector<std::vector<int>> sequences;
+		uint64_t solutionID;
+		if ((! m_sequencer.GetBestSoFar(sequences, solutionID)) || (sequences.size() != m_sequencingSerials.size()))
+			return -1;
+		auto iter = std::find(m_sequencingSerials.begin(), m_sequencingSerials.end(), Serial);
+		if (iter == m_sequencingSerials.end())
+			return -1;
+		for (int missionIndex : sequences[iter - m_sequencingSerials.begin()]) {
+			if (m_availableMissionIndices.count(missionIndex) > 0U) {
+				std::unordered_set<int> candidate = { missionIndex };
+				return SelectSubRegion(*m_TA, m_compiledSubregions, m_droneMissions, m_compiledMissions, candidate, CurrentPos, m_MissionParams);
+			}
 		}
+		return -1;
 	}
 
 	//Note: Carefully evaluate risk of deadlocking due to mutex locking. The guidance module holds it's lock for way
@@ -558,7 +705,8 @@ namespace Guidance {
 	//mutexes. Try to shorten the lock holds and avoid lock nests.
 
 	void GuidanceEngine::ModuleMain(void) {
-		double AnalysisPeriod = 1.0; //Analyze drone tasking every this many seconds
+		double AnalysisPeriod = 1.0;       //Analyze drone tasking every this many seconds
+		double SequencingTimeBudget = 2.0; //Time limit for each sub-region sequencing solve (s) - solves run in the background
 		TimePoint LastAnalysisTP = AdvanceTimepoint(std::chrono::steady_clock::now(), -1.0*AnalysisPeriod);
 		while (! m_abort) {
 			//Grab any settings that we may need before starting the loop - ensure we don't hold a lock on m_mutex while locking the options mutex
@@ -572,6 +720,7 @@ namespace Guidance {
 				MapWidget::Instance().m_messageBoxOverlay.RemoveMessage(m_MessageToken2);
 				MapWidget::Instance().m_messageBoxOverlay.RemoveMessage(m_MessageToken3);
 				m_mutex.unlock();
+				m_sequencer.Stop(); //Join the worker without holding m_mutex
 				std::this_thread::sleep_for(std::chrono::milliseconds(100));
 				continue;
 			}
@@ -590,8 +739,11 @@ namespace Guidance {
 			std::chrono::time_point<std::chrono::steady_clock> newTimestamp;
 			if (ShadowPropagation::ShadowPropagationEngine::Instance().GetTimestampOfMostRecentTimeAvailFun(newTimestamp)) {
 				//A TA function is available and we now have it's timestamp
-				if (newTimestamp > m_TA.Timestamp)
-					ShadowPropagation::ShadowPropagationEngine::Instance().GetMostRecentTimeAvailFun(m_TA);
+				if (newTimestamp > m_TA->Timestamp) {
+					ShadowPropagation::TimeAvailableHandle newTA;
+					if (ShadowPropagation::ShadowPropagationEngine::Instance().GetMostRecentTimeAvailFun(newTA))
+						m_TA = newTA;
+				}
 			}
 
 			if (SecondsElapsed(LastAnalysisTP) > AnalysisPeriod) {
@@ -609,6 +761,9 @@ namespace Guidance {
 				for (DroneInterface::Drone * drone : dronesForTasking)
 					TaskDroneToAvailableMission(drone);
 
+				//Keep the multi-drone sequences up to date - they are used when tasking drones and shown in the guidance overlay
+				UpdateSubregionSequencing(SequencingTimeBudget);
+
 				UpdateGuidanceOverlayWithMissionSequencesAndProgress();
 
 				//Check to see if the mission is complete
@@ -675,20 +830,183 @@ namespace Guidance {
 		return (float) SampledTA;
 	}
 
+	//Compile a waypoint mission for fast checking against TA functions. The time to fly each segment is computed the same way as in the
+	//mission simulation this replaced: straight-line distance between the waypoints (projected to the ref ellipsoid) over the speed at the first waypoint.
+	void CompiledMission::Compile(DroneInterface::WaypointMission const & Mission) {
+		Waypoints_LL.clear();
+		CumulativeTime.clear();
+		Waypoints_LL.reserve(Mission.Waypoints.size());
+		CumulativeTime.reserve(Mission.Waypoints.size());
+		Eigen::Vector3d prevPos_ECEF;
+		for (size_t n = 0U; n < Mission.Waypoints.size(); n++) {
+			Waypoints_LL.emplace_back(Mission.Waypoints[n].Latitude, Mission.Waypoints[n].Longitude);
+			Eigen::Vector3d pos_ECEF = LLA2ECEF(Eigen::Vector3d(Mission.Waypoints[n].Latitude, Mission.Waypoints[n].Longitude, 0.0));
+			if (n == 0U)
+				CumulativeTime.push_back(0.0);
+			else
+				CumulativeTime.push_back(CumulativeTime.back() + (pos_ECEF - prevPos_ECEF).norm() / double(Mission.Waypoints[n - 1U].Speed));
+			prevPos_ECEF = pos_ECEF;
+		}
+	}
+
+	//Find the TA pixels crossed by the segment from P to Q (continuous pixel coords: (col, row), with pixel (r,c) covering [c-0.5, c+0.5) x [r-0.5, r+0.5)).
+	//For each pixel crossed, append its offset in the TA raster (in elements) to CellOffsets and the segment parameter (0 at P, 1 at Q) at which the
+	//segment leaves the pixel to ExitParams. The segment is clipped to the raster first. This is a standard grid traversal (Amanatides & Woo).
+	static void TraverseTAPixels(Eigen::Vector2d const & P, Eigen::Vector2d const & Q, int Rows, int Cols, size_t RowStride,
+	                             std::vector<int64_t> & CellOffsets, std::vector<double> & ExitParams) {
+		CellOffsets.clear();
+		ExitParams.clear();
+
+		//Clip the segment to the raster bounds (Liang-Barsky)
+		Eigen::Vector2d D = Q - P;
+		double s0 = 0.0, s1 = 1.0;
+		double lower[2] = { -0.5, -0.5 };
+		double upper[2] = { double(Cols) - 0.5, double(Rows) - 0.5 };
+		for (int axis = 0; axis < 2; axis++) {
+			if (D(axis) == 0.0) {
+				if ((P(axis) < lower[axis]) || (P(axis) >= upper[axis]))
+					return;
+			}
+			else {
+				double sA = (lower[axis] - P(axis)) / D(axis);
+				double sB = (upper[axis] - P(axis)) / D(axis);
+				s0 = std::max(s0, std::min(sA, sB));
+				s1 = std::min(s1, std::max(sA, sB));
+			}
+		}
+		if (s0 > s1)
+			return;
+
+		//Walk the pixels from the clipped start to the clipped end
+		Eigen::Vector2d start = P + s0*D;
+		Eigen::Vector2d end   = P + s1*D;
+		int col    = std::clamp(int(std::floor(start(0) + 0.5)), 0, Cols - 1);
+		int row    = std::clamp(int(std::floor(start(1) + 0.5)), 0, Rows - 1);
+		int endCol = std::clamp(int(std::floor(end(0)   + 0.5)), 0, Cols - 1);
+		int endRow = std::clamp(int(std::floor(end(1)   + 0.5)), 0, Rows - 1);
+		int stepCol = (D(0) > 0.0) ? 1 : -1;
+		int stepRow = (D(1) > 0.0) ? 1 : -1;
+		double inf = std::numeric_limits<double>::infinity();
+		double sDeltaCol = (D(0) != 0.0) ? std::abs(1.0 / D(0)) : inf;
+		double sDeltaRow = (D(1) != 0.0) ? std::abs(1.0 / D(1)) : inf;
+		double sNextCol  = (D(0) != 0.0) ? (double(col) + 0.5*double(stepCol) - P(0)) / D(0) : inf;
+		double sNextRow  = (D(1) != 0.0) ? (double(row) + 0.5*double(stepRow) - P(1)) / D(1) : inf;
+		int numCells = std::abs(endCol - col) + std::abs(endRow - row) + 1;
+		CellOffsets.reserve(numCells);
+		ExitParams.reserve(numCells);
+		for (int n = 0; n < numCells; n++) {
+			CellOffsets.push_back(int64_t(row)*int64_t(RowStride) + int64_t(col));
+			if (n + 1 == numCells) {
+				ExitParams.push_back(s1);
+				break;
+			}
+			//Step toward whichever pixel boundary comes first - but never past the end pixel on either axis (guards against round-off at corners)
+			if ((row == endRow) || ((col != endCol) && (sNextCol < sNextRow))) {
+				ExitParams.push_back(std::min(sNextCol, s1));
+				col += stepCol;
+				sNextCol += sDeltaCol;
+			}
+			else {
+				ExitParams.push_back(std::min(sNextRow, s1));
+				row += stepRow;
+				sNextRow += sDeltaRow;
+			}
+		}
+	}
+
 	//5 - Take a Time Available function, a waypoint mission, and a progress indicator (where in the mission you are) and detirmine whether or not the drone
 	//    will be able to complete the mission in the time remaining (i.e. at no point will the time available within a radius of the drone hit 0).
 	//    Additionally, we compute some notion of confidence as follows... we find the lowest that the TA function will be under the drone throughout the mission.
 	//    If this gets closer to 0 it means we are cutting it close and if the predicted TA function is off we could be in trouble.
 	//Arguments:
 	//TA                 - Input  - Time Available function
-	//Mission            - Input  - Drone Mission
+	//Mission            - Input  - Drone Mission (compiled)
 	//DroneStartWaypoint - Input  - The index of the waypoint the drone starts at. Can be non-integer - e.g. 2.4 means 40% of way between waypoint 2 and 3.
 	//DroneStartTime     - Input  - The time when the drone starts the mission. This is used to compare with the timestamped TA function
 	//Margin             - Output - The lowest the TA ever gets under the drone during the mission
 	//
 	//Returns: True if expected to finish without shadows and false otherwise
+	bool IsPredictedToFinishWithoutShadows(ShadowPropagation::TimeAvailableFunction const & TA, CompiledMission const & Mission,
+	                                       double DroneStartWaypoint, std::chrono::time_point<std::chrono::steady_clock> DroneStartTime, double & Margin) {
+		//For each pixel of the TA function the drone passes over, the worst case is the time it leaves the pixel. The margin for the pixel is
+		//the TA value minus that time, and Margin is the minimum of this over the rest of the mission. Pixels with the sentinel value (no shadow
+		//in the forseeable future) and parts of the mission outside the TA function are treated optimistically (no constraint). If the Margin is
+		//NaN, the mission is clear of shadows for the full prediction time interval.
+		Margin = std::nan(""); //Initialize Margin
+
+		int numWaypoints = (int) Mission.Waypoints_LL.size();
+		if ((numWaypoints < 2) || (Mission.CumulativeTime.size() != Mission.Waypoints_LL.size()))
+			return true;
+		int rows = TA.TimeAvailable.rows;
+		int cols = TA.TimeAvailable.cols;
+		if ((rows == 0) || (cols == 0) || (TA.TimeAvailable.type() != CV_16UC1))
+			return true;
+		double startPos = std::max(DroneStartWaypoint, 0.0);
+		if (startPos + 1.0 >= double(numWaypoints))
+			return true;
+
+		//Affine map from (Latitude, Longitude) to continuous pixel coords (col, row) - the same mapping the sampled version uses for rounding to pixels
+		double colsPerRadLon = double(cols - 1) / (TA.LR_LL[1] - TA.LL_LL[1]);
+		double rowsPerRadLat = double(rows - 1) / (TA.UR_LL[0] - TA.LR_LL[0]);
+		auto toPixelCoords = [&](Eigen::Vector2d const & LL) {
+			return Eigen::Vector2d((LL(1) - TA.LL_LL[1])*colsPerRadLon, double(rows - 1) - (LL(0) - TA.LR_LL[0])*rowsPerRadLat);
+		};
+
+		//Use the TA timestamp as our time-0 reference epoch. timeOffset converts mission time (from WP0) to time after the TA epoch.
+		int firstSegment = (int) std::floor(startPos);
+		double t = startPos - double(firstSegment);
+		double startMissionTime = (1.0 - t)*Mission.CumulativeTime[firstSegment] + t*Mission.CumulativeTime[firstSegment + 1];
+		double timeOffset = SecondsElapsed(TA.Timestamp, DroneStartTime) - startMissionTime;
+
+		uint16_t const * TAData = TA.TimeAvailable.ptr<uint16_t>(0);
+		size_t rowStride = TA.TimeAvailable.step1();
+		std::vector<int64_t> cellOffsets;
+		std::vector<double> exitParams;
+		double minMargin = std::numeric_limits<double>::infinity();
+		for (int segIndex = firstSegment; segIndex + 1 < numWaypoints; segIndex++) {
+			Eigen::Vector2d P = toPixelCoords(Mission.Waypoints_LL[segIndex]);
+			Eigen::Vector2d Q = toPixelCoords(Mission.Waypoints_LL[segIndex + 1]);
+			double segStartTime = Mission.CumulativeTime[segIndex] + timeOffset;
+			double segEndTime   = Mission.CumulativeTime[segIndex + 1] + timeOffset;
+			if (segIndex == firstSegment) {
+				P = (1.0 - t)*P + t*Q;
+				segStartTime = startMissionTime + timeOffset;
+			}
+			TraverseTAPixels(P, Q, rows, cols, rowStride, cellOffsets, exitParams);
+
+			//Min over the crossed pixels - written without branches so it vectorizes (gather + min)
+			double segDuration = segEndTime - segStartTime;
+			double segMin = std::numeric_limits<double>::infinity();
+			size_t numCells = cellOffsets.size();
+			for (size_t n = 0U; n < numCells; n++) {
+				uint16_t value = TAData[cellOffsets[n]];
+				double cellMargin = double(value) - (segStartTime + exitParams[n]*segDuration);
+				cellMargin = (value == std::numeric_limits<uint16_t>::max()) ? std::numeric_limits<double>::infinity() : cellMargin;
+				segMin = std::min(segMin, cellMargin);
+			}
+			minMargin = std::min(minMargin, segMin);
+			if (minMargin < 0.0) {
+				Margin = minMargin;
+				return false;
+			}
+		}
+		if (minMargin < std::numeric_limits<double>::infinity())
+			Margin = minMargin;
+
+		return true;
+	}
+
+	//5 - Version that takes an uncompiled mission (compiles it on the fly)
 	bool IsPredictedToFinishWithoutShadows(ShadowPropagation::TimeAvailableFunction const & TA, DroneInterface::WaypointMission const & Mission,
 	                                       double DroneStartWaypoint, std::chrono::time_point<std::chrono::steady_clock> DroneStartTime, double & Margin) {
+		CompiledMission compiledMission(Mission);
+		return IsPredictedToFinishWithoutShadows(TA, compiledMission, DroneStartWaypoint, DroneStartTime, Margin);
+	}
+
+	//Legacy version of 5 - we simulate the mission in 1-second steps and sample the TA function under the drone at each step. This can miss a
+	//pixel the drone crosses between samples and needs two geodetic conversions per step. Kept for comparison in test benches.
+	bool IsPredictedToFinishWithoutShadows_Sampled(ShadowPropagation::TimeAvailableFunction const & TA, DroneInterface::WaypointMission const & Mission,
+	                                               double DroneStartWaypoint, std::chrono::time_point<std::chrono::steady_clock> DroneStartTime, double & Margin) {
 		//We simulate a mission from the given starting waypoint and from the given starting time. As the drone flies the mission we check to
 		//see if it ever ends up hitting a point in the mission after shadows are expected to hit. If the simulated mission completes without
 		//hitting shadows (according to the given TA map) we return true. If it doesn't we return false. When true, we also populate Margin,
@@ -768,22 +1086,158 @@ namespace Guidance {
 		return true;
 	}
 
+	//Version of the legacy sampled check that interpolates positions in a local ENU frame covering the mission, so each step costs a polynomial
+	//evaluation instead of two geodetic conversions. Should agree with IsPredictedToFinishWithoutShadows_Sampled() to within the LTP error bounds.
+	bool IsPredictedToFinishWithoutShadows_SampledENU(ShadowPropagation::TimeAvailableFunction const & TA, DroneInterface::WaypointMission const & Mission,
+	                                                  double DroneStartWaypoint, std::chrono::time_point<std::chrono::steady_clock> DroneStartTime, double & Margin) {
+		//We simulate a mission from the given starting waypoint and from the given starting time. As the drone flies the mission we check to
+		//see if it ever ends up hitting a point in the mission after shadows are expected to hit. If the simulated mission completes without
+		//hitting shadows (according to the given TA map) we return true. If it doesn't we return false. When true, we also populate Margin,
+		//which is the closest the drone comes to seeing a shadow (measured in seconds between drone and shadow over the same point). For
+		//instance, if the margin is 5.0, it means the drone flies over some point in the mission just 5 seconds before that same point is hit
+		//by shadows and all other points in the mission are flown at least 5 seconds before being shadowed. If the Margin is NaN, the mission
+		//is clear of shadows for the full prediction time interval.
+		double deltaT = 1.0; //seconds
+
+		Margin = std::nan(""); //Initialize Margin
+
+		//If the mission is trivial, return true (edge case, but handle as gracefully as possible)
+		if (Mission.Waypoints.empty())
+			return true;
+
+		//Use the TA timestamp as our time-0 reference epoch. Convert start time to seconds after ref epoch.
+		//Track position using a floating-point version of the waypoint index
+		double currentTime = SecondsElapsed(TA.Timestamp, DroneStartTime);
+		double currentPos  = std::max(DroneStartWaypoint, 0.0);
+
+		//Set up a local ENU frame covering the mission and get the waypoint positions in it (projected to the ref ellipsoid)
+		size_t numWaypoints = Mission.Waypoints.size();
+		std::vector<double> lat(numWaypoints), lon(numWaypoints), E(numWaypoints), North(numWaypoints), U(numWaypoints);
+		for (size_t n = 0U; n < numWaypoints; n++) {
+			lat[n] = Mission.Waypoints[n].Latitude;
+			lon[n] = Mission.Waypoints[n].Longitude;
+		}
+		LocalTangentPlane LTP = LocalTangentPlane::Covering(lat.data(), lon.data(), numWaypoints);
+		LTP.LLAToENU(lat.data(), lon.data(), nullptr, numWaypoints, E.data(), North.data(), U.data());
+
+		//int numtests = 0;
+		while (currentPos + 1.0 < (double) Mission.Waypoints.size()) {
+			//The mission is not done yet
+			int wpIndexA = (int) std::floor(currentPos);
+			int wpIndexB = wpIndexA + 1;
+
+			if (wpIndexB < (int) Mission.Waypoints.size()) {
+				//In between waypoints A and B
+				Eigen::Vector3d PosA_ENU(E[wpIndexA], North[wpIndexA], U[wpIndexA]);
+				Eigen::Vector3d PosB_ENU(E[wpIndexB], North[wpIndexB], U[wpIndexB]);
+
+				double t = currentPos - std::floor(currentPos);
+				Eigen::Vector3d currentPos_ENU = (1.0 - t)*PosA_ENU + t*PosB_ENU;
+				Eigen::Vector3d currentPos_LLA = LTP.ENUToLLA(currentPos_ENU);
+
+				float timeRemainingAtPos = TimeRemainingAtPos(TA, currentPos_LLA(0), currentPos_LLA(1));
+				if ((! std::isnan(timeRemainingAtPos)) && (std::isnan(Margin) || (Margin > timeRemainingAtPos - currentTime)))
+					Margin = timeRemainingAtPos - currentTime;
+				if ((! std::isnan(Margin)) && (Margin < 0.0))
+					return false;
+
+				//Advance time and position - don't advance more than the next waypoint
+				//This is important since the separation between waypoint can vary wildly, so going
+				//back and forth between fractional waypoint index and time needs to be done within a given
+				//pass only or we could even end up skipping entire segments.
+				double distBetweenWaypoints = (PosB_ENU - PosA_ENU).norm(); //meters
+				double targetSpeed = Mission.Waypoints[wpIndexA].Speed; //m/s
+				double deltaPos = (deltaT*targetSpeed) / distBetweenWaypoints;
+				if (t + deltaPos <= 1.0) {
+					currentTime += deltaT;
+					currentPos  += deltaPos;
+				}
+				else {
+					double timeToNextWaypoint = ((1.0 - t)*distBetweenWaypoints) / targetSpeed;
+					currentTime += timeToNextWaypoint;
+					currentPos   = double(wpIndexB);
+				}
+			}
+			else {
+				//At last waypoint
+				Eigen::Vector3d currentPos_LLA(Mission.Waypoints.back().Latitude, Mission.Waypoints.back().Longitude, 0.0);
+
+				float timeRemainingAtPos = TimeRemainingAtPos(TA, currentPos_LLA(0), currentPos_LLA(1));
+				if ((! std::isnan(timeRemainingAtPos)) && (std::isnan(Margin) || (Margin > timeRemainingAtPos - currentTime)))
+					Margin = timeRemainingAtPos - currentTime;
+				if ((! std::isnan(Margin)) && (Margin < 0.0))
+					return false;
+
+				//Advance time and position
+				currentTime += deltaT;
+				currentPos += 1.0; //Ensure this is the last pass of the loop
+			}
+			//numtests++;
+		}
+		//std::cerr << "No shadows. Num tests: " << numtests << "\r\n";
+
+		return true;
+	}
+
+	//Convert a time (seconds after the TA epoch) to a threshold for TA pyramid queries - a query result is below the time if and only if it is
+	//below the threshold, so the query can stop as soon as it knows which side of the time the min is on.
+	static uint16_t TimeToTAThreshold(double Seconds) {
+		return (uint16_t) std::clamp(std::ceil(Seconds), 0.0, double(ShadowPropagation::TimeAvailablePyramid::Sentinel));
+	}
+
+	//Use the min-mip pyramid of a TA function to decide whether a sub-region mission is viable without simulating it. Returns 0 (not viable)
+	//if any part of the sub-region is predicted to be shadowed before the drone even gets there - the region can't be imaged without shadows
+	//regardless of the path flown. Returns 1 (viable) if no pixel the mission could possibly pass over is predicted to be shadowed before the
+	//mission is done. Returns -1 if neither is the case (or there is no pyramid) and the full check is needed. Both tests are usually decided
+	//near the top of the pyramid.
+	static int QuickViabilityCheck(ShadowPropagation::TimeAvailableFunction const & TA, CompiledPolygonCollection const & SubregionNM,
+	                               CompiledMission const & Mission, std::chrono::time_point<std::chrono::steady_clock> MissionStartTime) {
+		if ((TA.Pyramid == nullptr) || (TA.Pyramid->NumLevels() == 0) || (TA.TimeAvailable.rows < 2) || (TA.TimeAvailable.cols < 2) ||
+		    Mission.Waypoints_LL.empty() || (Mission.CumulativeTime.size() != Mission.Waypoints_LL.size()))
+			return -1;
+		double startTime  = SecondsElapsed(TA.Timestamp, MissionStartTime);
+		double finishTime = startTime + Mission.CumulativeTime.back();
+
+		//Reject if the sub-region will be hit before we arrive
+		if (double(TA.MinOverRegion(SubregionNM, TimeToTAThreshold(startTime))) < startTime)
+			return 0;
+
+		//Accept if the box around every pixel the mission could touch is clear until we are done
+		Eigen::Vector4d missionBox_PX(std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(),
+		                              std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity());
+		for (Eigen::Vector2d const & waypoint_LL : Mission.Waypoints_LL) {
+			Eigen::Vector2d waypoint_PX = TA.LatLonToPixelCoords(waypoint_LL);
+			missionBox_PX(0) = std::min(missionBox_PX(0), waypoint_PX(0) - 0.5);
+			missionBox_PX(1) = std::max(missionBox_PX(1), waypoint_PX(0) + 0.5);
+			missionBox_PX(2) = std::min(missionBox_PX(2), waypoint_PX(1) - 0.5);
+			missionBox_PX(3) = std::max(missionBox_PX(3), waypoint_PX(1) + 0.5);
+		}
+		if (double(TA.Pyramid->MinOverBox(missionBox_PX, TimeToTAThreshold(finishTime))) >= finishTime)
+			return 1;
+
+		return -1;
+	}
+
 	//6 - Given a Time Available function, a collection of sub-regions (with their pre-planned missions), and a start position for a drone, select a sub-region
 	//    to task the drone to. We are balancing 2 things here - trying to do useful work while avoiding shadows, but also avoiding non-sensical jumping to a
 	//    distant region. At a minimum we should ensure that we don't task a drone to a region that we don't expect it to be able to finish without getting hit
 	//    with shadows.
 	//Arguments:
 	//TA                      - Input - Time Available function
-	//SubRegionsNM            - Input - Polygon collections representing each sub-region (in Normalized Mercator)
+	//SubRegionsNM            - Input - Compiled polygon collections representing each sub-region (in Normalized Mercator) - compile once per mission
 	//SubregionMissions       - Input - A vector of drone Missions - Element n is the mission for sub-region n.
+	//CompiledMissions        - Input - Element n is SubregionMissions[n], compiled
 	//AvailableMissionIndices - Input - Set of indices of missions in SubregionMissions to consider
 	//StartPos                - Input - The starting position of the drone (to tell us how far away from each sub-region mission it is)
 	//MissionParams           - Input - Parameters specifying speed and row spacing (see definitions in struct declaration)
 	//
 	//Returns: The index of the drone mission (and sub-region) to task the drone to. Returns -1 if none are viable
-	int SelectSubRegion(ShadowPropagation::TimeAvailableFunction const & TA, std::Evector<PolygonCollection> const & SubRegionsNM,
-	                    std::vector<DroneInterface::WaypointMission> const & SubregionMissions, std::unordered_set<int> const & AvailableMissionIndices,
-	                    DroneInterface::Waypoint const & StartPos, MissionParameters const & MissionParams) {
+	//
+	//When the TA function has a pyramid, most sub-regions are accepted or rejected from the pyramid (see QuickViabilityCheck()) and
+	//only the rest are checked against their compiled missions.
+	int SelectSubRegion(ShadowPropagation::TimeAvailableFunction const & TA, std::Evector<CompiledPolygonCollection> const & SubRegionsNM,
+	                    std::vector<DroneInterface::WaypointMission> const & SubregionMissions, std::vector<CompiledMission> const & CompiledMissions,
+	                    std::unordered_set<int> const & AvailableMissionIndices, DroneInterface::Waypoint const & StartPos, MissionParameters const & MissionParams) {
 		using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
 
 		if (AvailableMissionIndices.empty())
@@ -810,13 +1264,17 @@ namespace Guidance {
 				double timeToReachRegion     = EstimateMissionTime(StartPos, WP0, MissionParams.TargetSpeed);
 				TimePoint missionStartTime   = AdvanceTimepoint(std::chrono::steady_clock::now(), timeToReachRegion);
 				double margin;
-				if (IsPredictedToFinishWithoutShadows(TA, SubregionMissions[subregionIndex], 0.0, missionStartTime, margin)) {
+				CompiledPolygonCollection const & subregionNM(SubRegionsNM[subregionIndex]);
+				int quickResult = QuickViabilityCheck(TA, subregionNM, CompiledMissions[subregionIndex], missionStartTime);
+				bool isViable = (quickResult >= 0) ? (quickResult == 1) :
+				                IsPredictedToFinishWithoutShadows(TA, CompiledMissions[subregionIndex], 0.0, missionStartTime, margin);
+				if (isViable) {
 					//This region is viable
 					numViableRegions++;
 
 					//Compute distance to sub-region. This is in NM units - we could convert to m using the drones position, but
 					//since we are only using this to compare distances we can skip that and just compare distances in NM units.
-					double distToSubregion = (SubRegionsNM[subregionIndex].ProjectPoint(StartPos_NM) - StartPos_NM).norm();
+					double distToSubregion = (subregionNM.ProjectPoint(StartPos_NM) - StartPos_NM).norm();
 					//std::cerr << "Viable sub-region. Dist: " << distToSubregion << " NM units.\r\n";
 					if ((bestSubregionIndex < 0) || (distToSubregion < distToBestRegion)) {
 						bestSubregionIndex = subregionIndex;
@@ -839,21 +1297,4 @@ namespace Guidance {
 
 		return bestSubregionIndex;
 	}
-
-	//7 - Given a Time Available function, a collection of sub-regions (with their pre-planned missions), and a collection of drone start positions, choose
-	//    sequences (of a given length) of sub-regions for each drone to fly, in order. When the mission time exceeds our prediction horizon the time available
-	//    function is no longer useful in choosing sub-regions but they can still be chosen in a logical fashion that avoids leaving holes in the map... making the
-	//    optimistic assumption that they will be shadow-free when we get there.
-	//TA                  - Input  - Time Available function
-	//SubregionMissions   - Input  - A vector of drone Missions - Element n is the mission for sub-region n.
-	//DroneStartPositions - Input  - Element k is the starting position of drone k
-	//Sequences           - Output - Element k is a vector of sub-region indices to task drone k to (in order)
-	void SelectSubregionSequences(ShadowPropagation::TimeAvailableFunction const & TA, std::vector<DroneInterface::WaypointMission> const & SubregionMissions,
-	                              std::vector<DroneInterface::Waypoint> const & DroneStartPositions, std::set<int> MissionIndicesToAssign, std::vector<std::vector<int>> & Sequences,
-	                              MissionParameters const & MissionParams) {
-
-		Sequences.clear();
-		Sequences.resize(DroneStartPositions.size(), std::vector<int>());
-		return;
-	}
 }
@@ -8,11 +8,16 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <memory>
 #include <iostream>
 #include <iomanip>
 #include <ctime>
 #include <sstream>
 #include <system_error>
+#include <set>
+#include <atomic>
+#include <functional>
 
 //External Includes
 #include "../../../../handycpp/Handy.hpp"
@@ -20,6 +25,7 @@
 
 //Project Includes
 #include "../../EigenAliases.h"
+#include "../../Utilities.hpp"
 #include "../../SurveyRegionManager.hpp"
 #include "../../Polygon.hpp"
 #include "../Shadow-Propagation/ShadowPropagation.hpp"
@@ -27,6 +33,7 @@
 #include "../../UI/MapWidget.hpp"
 #include "../../UI/GuidanceOverlay.hpp"
 #include "../../Maps/MapUtils.hpp"
+#include "../../Maps/LocalTangentPlane.hpp"
 
 //Much like the other modules, we have a singleton class with a private thread for running guidance algorithms. When active, this
 //thread will grab time available functions directly from the shadow propagation module and will send drone commands directly to the
@@ -58,6 +65,105 @@ namespace Guidance {
 				SubregionTargetFlightTime(100.0) { }
 	};
 	
+	//A waypoint mission reduced to what we need to check it against time available functions quickly. This should be built once when a
+	//mission is planned (and re-built if it is re-planned) so that checking the mission against each new TA function does not need to do any
+	//geodetic conversions. TA pixel coordinates are an affine function of (Latitude, Longitude), so mapping the waypoints onto the grid of a
+	//given TA function only costs a multiply-add per coordinate.
+	struct CompiledMission {
+		public:
+			std::Evector<Eigen::Vector2d> Waypoints_LL; //(Latitude, Longitude) of each waypoint (radians)
+			std::vector<double> CumulativeTime;         //Element n is the time (s) to fly from waypoint 0 to waypoint n (same size as Waypoints_LL)
+
+			CompiledMission() = default;
+			CompiledMission(DroneInterface::WaypointMission const & Mission) { Compile(Mission); }
+
+			void Compile(DroneInterface::WaypointMission const & Mission);
+	};
+	
+	//Controls for SelectSubregionSequences(). The solver is an anytime algorithm - it has a valid answer almost immediately and improves it
+	//until it runs out of time, stops improving, or is cancelled.
+	struct SequencingOptions {
+		public:
+			double TimeBudget;                 //Hard limit on wall-clock time (s) spent improving the solution
+			CancellationToken const * Cancel;  //Optional: if set and cancelled, the solver returns its best solution so far right away
+			unsigned int Seed;                 //Seed for the randomized search (the search is deterministic for a given seed and enough time)
+			std::function<void(std::vector<std::vector<int>> const & Sequences)> OnImprovement; //Optional: called (on the solver thread) with each new best solution
+
+			SequencingOptions() : TimeBudget(1.0), Cancel(nullptr), Seed(0U) { }
+	};
+
+	//Summary of a run of SelectSubregionSequences(). Times are in seconds. Cost is the solver objective: makespan + total transit time, plus
+	//a large penalty for each mission left unassigned. InitialCost is the cost of the greedy solution the search starts from (one drone at a
+	//time, each taking the closest viable sub-region - which is what tasking drones one at a time with SelectSubRegion() amounts to).
+	struct SequencingStats {
+		public:
+			double InitialCost      = 0.0;
+			double FinalCost        = 0.0;
+			double Makespan         = 0.0; //Time until the last drone finishes its last mission
+			double TotalTransitTime = 0.0; //Sum over all drones of time spent flying between missions (and to the first one)
+			int    NumUnassigned    = 0;   //Number of missions not in any sequence (not viable given the TA function)
+			int    NumIterations    = 0;
+			double SolveTime        = 0.0;
+			bool   Cancelled        = false;
+			bool   StoppedEarly     = false; //Out of time or cancelled before the travel-time tables were built - no sequences at all
+	};
+
+	//Runs SelectSubregionSequences() on its own thread so the guidance engine never waits on it. Start() hands it a copy of the problem
+	//and returns right away - the best solution found so far can be read at any time with GetBestSoFar(). Starting a new solve cancels
+	//the one in progress (if any). The worker thread is started on the first solve and then kept, waiting for the next problem, so no
+	//method but Stop() ever waits on it - Start(), Cancel() and Clear() are safe to call while holding a lock the solver might need.
+	//Only Stop() (also called by the destructor) joins the worker, and it must not be called while holding such a lock. Start() and Stop()
+	//touch the worker thread object and must only be called from one thread (the guidance thread). The other methods are thread-safe.
+	class SubregionSequencer {
+		public:
+			using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+
+			SubregionSequencer() : m_running(false), m_shutdown(false), m_haveSolution(false), m_solutionID(0U) { }
+			~SubregionSequencer() { Stop(); }
+
+			void Start(ShadowPropagation::TimeAvailableHandle TA, std::vector<DroneInterface::WaypointMission> const & SubregionMissions,
+			           std::vector<CompiledMission> const & CompiledMissions, std::vector<DroneInterface::Waypoint> const & DroneStartPositions,
+			           std::vector<double> const & DroneStartDelays, std::set<int> const & MissionIndicesToAssign,
+			           MissionParameters const & MissionParams, double TimeBudget);
+			void Stop(void);   //Cancel the solve in progress (if any) and shut down the worker, waiting for it to exit. The last solution is kept.
+			void Cancel(void); //Cancel the solve in progress (if any) without waiting for it. The last solution is kept.
+			void Clear(void);  //Cancel (without waiting) and forget the last solution
+			bool IsRunning(void) const { return m_running; }
+
+			//Get the best solution so far from the most recent solve. Returns false if there isn't one yet. SolutionID changes whenever a
+			//new solution is published, so callers can cheaply tell whether anything changed since they last looked.
+			bool GetBestSoFar(std::vector<std::vector<int>> & Sequences, uint64_t & SolutionID);
+
+		private:
+			//A snapshot of a sequencing problem, waiting for (or being solved by) the worker. Each solve has its own cancellation token, so
+			//cancelling a solve can never be undone by the start of the next one.
+			struct Problem {
+				ShadowPropagation::TimeAvailableHandle       TA;
+				std::vector<DroneInterface::WaypointMission> SubregionMissions;
+				std::vector<CompiledMission>                 CompiledMissions;
+				std::vector<DroneInterface::Waypoint>        DroneStartPositions;
+				std::vector<double>                          DroneStartDelays;
+				std::set<int>                                MissionIndicesToAssign;
+				MissionParameters                            MissionParams;
+				double                                       TimeBudget;
+				std::shared_ptr<CancellationToken>           Cancel = std::make_shared<CancellationToken>();
+			};
+
+			void WorkerMain(void);
+			void Solve(Problem const & Prob);
+
+			std::thread             m_thread;
+			std::atomic<bool>       m_running; //True from Start() until the worker is done with the last problem it was given
+			std::mutex              m_mutex;   //Protects the fields below
+			std::condition_variable m_cv;      //Signals a new problem (or shutdown) to the worker
+			bool                    m_shutdown;
+			std::unique_ptr<Problem>           m_pendingProblem; //The next problem to solve (nullptr if none)
+			std::shared_ptr<CancellationToken> m_activeCancel;   //Cancellation token of the solve in progress (nullptr if none)
+			bool                    m_haveSolution;
+			uint64_t                m_solutionID;
+			std::vector<std::vector<int>> m_bestSequences;
+	};
+	
 	//Singleton class for the Guidance system
 	class GuidanceEngine {
 		public:
@@ -82,11 +188,14 @@ namespace Guidance {
 			bool m_missionPrepDone;
 			std::Evector<PolygonCollection> m_surveyRegionPartition;
 			std::vector<DroneInterface::WaypointMission> m_droneMissions; //Item n covers component n of the partition
+			std::vector<CompiledMission> m_compiledMissions;              //Item n is compiled from m_droneMissions[n] - keep in sync
+			std::Evector<CompiledPolygonCollection> m_compiledSubregions; //Item n is compiled from m_surveyRegionPartition[n]
+			LocalTangentPlane m_surveyRegionLTP;                          //Covers the survey region - for (re-)planning sub-region missions
 			std::Eunordered_map<std::string, TimePoint> m_droneAllowedTakeoffTimes; //Serial -> timepoint after which drone can take off
 			std::Eunordered_map<std::string, double> m_droneHAGs; //Serial -> HAG (m), Values may be different if staggered.
 
 			//This block holds fields that are periodically updated throughout a mission
-			ShadowPropagation::TimeAvailableFunction m_TA; //Local copy of most recent time available function
+			ShadowPropagation::TimeAvailableHandle m_TA; //Handle to most recent time available function (never null)
 
 			//Drone state activity definition: 0 = On ground (available), 1 = In air (available), 2 = Tasked with mission (not started), 3 = Mission ongoing
 			std::unordered_map<std::string, std::tuple<int, int, TimePoint>> m_droneStates; //Serial -> (activity, missionIndex, timestamp). missionIndex = -1 when not tasked or flying a real mission
@@ -94,6 +203,13 @@ namespace Guidance {
 			std::unordered_map<int, double> m_taskedMissionProgress;  //MissionIndex -> Distance traveled since mission start
 			std::Eunordered_map<std::string, Eigen::Vector3d> m_dronePositions; //Serial -> last known position (LLA)
 			std::unordered_set<int> m_availableMissionIndices; //Indices of missions that have not been assigned yet
+
+			//This block holds the multi-drone sequencing state. The sequencer works on a snapshot of the fields above (taken when a solve starts) and
+			//its sequences are only used as suggestions - every suggestion is re-checked against current data before a drone is tasked.
+			SubregionSequencer       m_sequencer;
+			std::vector<std::string> m_sequencingSerials;   //Element k is the serial of the drone for sequence k of the sequencer solution
+			bool                     m_sequencesStale;      //Set when something happens that the sequencer solution doesn't account for
+			TimePoint                m_sequencingTATimestamp; //Timestamp of the TA function used for the most recent solve
 			
 			void ModuleMain(void);
 			void ResetIntermediateData(void); //Clear mission prep data and periodically updated fields
@@ -106,13 +222,17 @@ namespace Guidance {
 			void UpdateGuidanceOverlayWithMissionSequencesAndProgress(void);
 			bool AreAnyDronesTaskedWithOrFlyingMissions(void);
 			void AbortMissionsPredictedToGetHitWithShadows(void);
+			void UpdateSubregionSequencing(double TimeBudget); //Start a new sequencing solve if the last one is stale (and not still running)
+			int  GetSequencedMissionForDrone(std::string const & Serial, DroneInterface::Waypoint const & CurrentPos); //-1 if no viable suggestion
 			
 		public:
 			static GuidanceEngine & Instance() { static GuidanceEngine Obj; return Obj; }
 			
 			//Constructors and Destructors
-			GuidanceEngine() : m_running(false), m_abort(false), m_missionPrepDone(false) {
-				m_TA.Timestamp  = std::chrono::steady_clock::now(); //Will ensure any new TA functions trigger an update
+			GuidanceEngine() : m_running(false), m_abort(false), m_missionPrepDone(false), m_sequencesStale(true) {
+				std::shared_ptr<ShadowPropagation::TimeAvailableFunction> emptyTA = std::make_shared<ShadowPropagation::TimeAvailableFunction>();
+				emptyTA->Timestamp = std::chrono::steady_clock::now(); //Will ensure any new TA functions trigger an update
+				m_TA = emptyTA;
 				m_MessageToken1 = MapWidget::Instance().m_messageBoxOverlay.GetAvailableToken();
 				m_MessageToken2 = MapWidget::Instance().m_messageBoxOverlay.GetAvailableToken();
 				m_MessageToken3 = MapWidget::Instance().m_messageBoxOverlay.GetAvailableToken();
@@ -154,6 +274,7 @@ namespace Guidance {
 	//Note: These functions are not defined in Guidance.cpp, but are instead each in their own source files (RegionPartitioning_*.cpp)
 	void PartitionSurveyRegion_TriangleFusion(PolygonCollection const & Region, std::Evector<PolygonCollection> & Partition, MissionParameters const & MissionParams);
 	void PartitionSurveyRegion_IteratedCuts  (PolygonCollection const & Region, std::Evector<PolygonCollection> & Partition, MissionParameters const & MissionParams);
+	void PartitionSurveyRegion_BalancedCuts  (PolygonCollection const & Region, std::Evector<PolygonCollection> & Partition, MissionParameters const & MissionParams);
 	
 	//4 - Take a region or sub-region and plan a trajectory to cover it at a given height that meets the specified imaging requirements. In this case we specify
 	//    the imaging requirements using a maximum speed and sidelap fraction.
@@ -162,10 +283,15 @@ namespace Guidance {
 	//Mission       - Output - The planned mission that covers the input region
 	//MissionParams - Input  - Parameters specifying speed and row spacing (see definitions in struct declaration)
 	//StartPos      - Input  - Optional: Initial position of vehicle (does not impact waypoints, but may impact ordering)
+	//LTP           - Input  - Optional: Tangent plane covering the region (see TangentPlaneCoveringRegion()). Build one for the whole survey region
+	//                         and pass it in for every sub-region - if null, one is fitted for the region on each call.
 	//
 	//Note: This function is not defined in Guidance.cpp, but is instead in FlightPlanning.cpp
 	void PlanMission(PolygonCollection const & Region, DroneInterface::WaypointMission & Mission, MissionParameters const & MissionParams,
-	                 DroneInterface::Waypoint const * StartPos);
+	                 DroneInterface::Waypoint const * StartPos, LocalTangentPlane const * LTP = nullptr);
+
+	//Get a tangent plane covering the given region (in NM coords), for use with PlanMission(). Defined in FlightPlanning.cpp.
+	LocalTangentPlane TangentPlaneCoveringRegion(PolygonCollection const & Region);
 	
 	//5 - Take a Time Available function, a waypoint mission, and a progress indicator (where in the mission you are) and detirmine whether or not the drone
 	//    will be able to complete the mission in the time remaining (i.e. at no point will the time available within a radius of the drone hit 0).
@@ -179,8 +305,22 @@ namespace Guidance {
 	//Margin             - Output - The lowest the TA ever gets under the drone during the mission
 	//
 	//Returns: True if expected to finish without shadows and false otherwise
+	//
+	//The drone is treated as being over a TA pixel for as long as it is closer to that pixel's center than to any other. Each mission segment is
+	//traversed across the TA grid (DDA) and Margin is the minimum over all crossed pixels of (TA value - time the drone leaves the pixel), so it is
+	//exact rather than sampled. The WaypointMission version compiles the mission on each call - if checking the same mission repeatedly, compile it once.
+	bool IsPredictedToFinishWithoutShadows(ShadowPropagation::TimeAvailableFunction const & TA, CompiledMission const & Mission,
+	                                       double DroneStartWaypoint, std::chrono::time_point<std::chrono::steady_clock> DroneStartTime, double & Margin);
 	bool IsPredictedToFinishWithoutShadows(ShadowPropagation::TimeAvailableFunction const & TA, DroneInterface::WaypointMission const & Mission,
 	                                       double DroneStartWaypoint, std::chrono::time_point<std::chrono::steady_clock> DroneStartTime, double & Margin);
+
+	//Legacy version of 5 - simulates the mission in 1-second steps and samples the TA function at each step. Kept for comparison in test benches.
+	bool IsPredictedToFinishWithoutShadows_Sampled(ShadowPropagation::TimeAvailableFunction const & TA, DroneInterface::WaypointMission const & Mission,
+	                                               double DroneStartWaypoint, std::chrono::time_point<std::chrono::steady_clock> DroneStartTime, double & Margin);
+
+	//Legacy sampled check with positions interpolated in a local ENU frame (LocalTangentPlane) instead of ECEF. Compared against the geodetic version above.
+	bool IsPredictedToFinishWithoutShadows_SampledENU(ShadowPropagation::TimeAvailableFunction const & TA, DroneInterface::WaypointMission const & Mission,
+	                                                  double DroneStartWaypoint, std::chrono::time_point<std::chrono::steady_clock> DroneStartTime, double & Margin);
 	
 	//6 - Given a Time Available function, a collection of sub-regions (with their pre-planned missions), and a start position for a drone, select a sub-region
 	//    to task the drone to. We are balancing 2 things here - trying to do useful work while avoiding shadows, but also avoiding non-sensical jumping to a
@@ -188,31 +328,42 @@ namespace Guidance {
 	//    with shadows.
 	//Arguments:
 	//TA                      - Input - Time Available function
-	//SubRegionsNM            - Input - Polygon collections representing each sub-region (in Normalized Mercator)
+	//SubRegionsNM            - Input - Compiled polygon collections representing each sub-region (in Normalized Mercator) - compile once per mission
 	//SubregionMissions       - Input - A vector of drone Missions - Element n is the mission for sub-region n.
+	//CompiledMissions        - Input - Element n is SubregionMissions[n], compiled
 	//AvailableMissionIndices - Input - Set of indices of missions in SubregionMissions to consider
 	//StartPos                - Input - The starting position of the drone (to tell us how far away from each sub-region mission it is)
 	//MissionParams           - Input - Parameters specifying speed and row spacing (see definitions in struct declaration)
 	//
 	//Returns: The index of the drone mission (and sub-region) to task the drone to. Returns -1 if none are plausible
-	int SelectSubRegion(ShadowPropagation::TimeAvailableFunction const & TA, std::Evector<PolygonCollection> const & SubRegionsNM,
-	                    std::vector<DroneInterface::WaypointMission> const & SubregionMissions, std::unordered_set<int> const & AvailableMissionIndices,
-	                    DroneInterface::Waypoint const & StartPos, MissionParameters const & MissionParams);
+	int SelectSubRegion(ShadowPropagation::TimeAvailableFunction const & TA, std::Evector<CompiledPolygonCollection> const & SubRegionsNM,
+	                    std::vector<DroneInterface::WaypointMission> const & SubregionMissions, std::vector<CompiledMission> const & CompiledMissions,
+	                    std::unordered_set<int> const & AvailableMissionIndices, DroneInterface::Waypoint const & StartPos, MissionParameters const & MissionParams);
 	
 	//7 - Given a Time Available function, a collection of sub-regions (with their pre-planned missions), and a collection of drone start positions, choose
-	//    sequences (of a given length) of sub-regions for each drone to fly, in order. When the mission time exceeds our prediction horizon the time available
+	//    sequences of sub-regions for each drone to fly, in order. When the mission time exceeds our prediction horizon the time available
 	//    function is no longer useful in chosing sub-regions but they can still be chosen in a logical fashion that avoids leaving holes in the map... making the
 	//    optimistic assumption that they will be shadow-free when we get there.
-	//TA                  - Input  - Time Available function
-	//SubregionMissions   - Input  - A vector of drone Missions - Element n is the mission for sub-region n.
-	//DroneStartPositions - Input  - Element k is the starting position of drone k
-	//Sequences           - Output - Element k is a vector of sub-region indices to task drone k to (in order)
+	//TA                     - Input  - Time Available function
+	//SubregionMissions      - Input  - A vector of drone Missions - Element n is the mission for sub-region n.
+	//CompiledMissions       - Input  - Element n is SubregionMissions[n], compiled
+	//DroneStartPositions    - Input  - Element k is the starting position of drone k
+	//DroneStartDelays       - Input  - Element k is the time (s) from now until drone k is at its start position and free (empty = all 0)
+	//MissionIndicesToAssign - Input  - Indices of the missions in SubregionMissions to distribute among the drones
+	//Sequences              - Output - Element k is a vector of sub-region indices to task drone k to (in order)
+	//MissionParams          - Input  - Parameters specifying speed and row spacing (see definitions in struct declaration)
+	//Options                - Input  - Time budget, cancellation, etc. (see definitions in struct declaration)
+	//
+	//Returns: Statistics for the run (cost of the returned solution, etc.)
 	//
-	//Note: This function is not currently used - and is not currently implemented. The initial implementation was removed since
-	//it was unsafe (very high computational burden in many cases would lead to full program hang if not called very carefully)
-	void SelectSubregionSequences(ShadowPropagation::TimeAvailableFunction const & TA, std::vector<DroneInterface::WaypointMission> const & SubregionMissions,
-	                             std::vector<DroneInterface::Waypoint> const & DroneStartPositions, std::set<int> MissionIndicesToAssign, std::vector<std::vector<int>> & Sequences,
-	                             MissionParameters const & MissionParams);
+	//Every mission in the returned sequences is predicted to finish without shadows when flown in sequence order (missions that can't be fit in
+	//anywhere are left out). The search is a large neighbourhood search: repeatedly remove a few missions from the current solution and re-insert
+	//them where they fit best, keeping the change if it helps. It never runs past Options.TimeBudget and Sequences always holds the best solution found.
+	SequencingStats SelectSubregionSequences(ShadowPropagation::TimeAvailableFunction const & TA, std::vector<DroneInterface::WaypointMission> const & SubregionMissions,
+	                                         std::vector<CompiledMission> const & CompiledMissions, std::vector<DroneInterface::Waypoint> const & DroneStartPositions,
+	                                         std::vector<double> const & DroneStartDelays, std::set<int> const & MissionIndicesToAssign,
+	                                         std::vector<std::vector<int>> & Sequences, MissionParameters const & MissionParams,
+	                                         SequencingOptions const & Options = SequencingOptions());
 
 	// *********************************************************************************************************************************
 	// ****************************************   GuidanceEngine Inline Functions Definitions   ****************************************
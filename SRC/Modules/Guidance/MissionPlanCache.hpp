@@ -0,0 +1,294 @@
+//This module provides a content-addressed cache for the expensive, start-position-independent parts of mission planning: survey region
+//partitions and the candidate missions PlanMission() chooses between. Entries are keyed by the exact vertices of the region (or sub-region)
+//and the mission parameters that affect the result, so a cached result is only ever used for an input that would reproduce it. The cache
+//is saved to disk next to the survey region manager state, so restarting a survey (or re-planning a sub-region after an abort or when a
+//drone is added) skips partitioning and hatch line traversal entirely.
+//Author: Bryan Poling
+//Copyright (c) 2022 Sentek Systems, LLC. All rights reserved.
+#pragma once
+
+//System Includes
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+//External Includes
+#include "../../../../handycpp/Handy.hpp"
+
+//Cereal Includes
+#include "cereal/types/vector.hpp"
+#include "cereal/types/unordered_map.hpp"
+#include "cereal/archives/portable_binary.hpp"
+
+//Project Includes
+#include "../../EigenAliases.h"
+#include "../../Polygon.hpp"
+#include "Guidance.hpp"
+
+namespace Guidance {
+	//The start-position-independent result of planning a mission for a region: every candidate mission PlanMission() considered (as
+	//(Latitude, Longitude) waypoints, before redundant waypoints are removed) and the horizontal length of each one. Choosing among the
+	//candidates for a given start position only needs the distance from the start position to the first waypoint of each.
+	struct CachedMissionPlan {
+		std::vector<double> KeyData;                               //Region vertices and parameters this plan is for (see MakePlanKeyData())
+		std::Evector<std::Evector<Eigen::Vector2d>> Candidates_LL; //Element n holds the waypoints (Lat, Lon - radians) of candidate n
+		std::vector<double> CandidateLengths;                      //Element n is the horizontal length (m) of candidate n
+		uint64_t LastUsed = 0U;
+
+		template<class Archive> void serialize(Archive & archive) { archive(KeyData, Candidates_LL, CandidateLengths, LastUsed); }
+	};
+
+	//A partition of a survey region, as produced by one of the PartitionSurveyRegion_* functions
+	struct CachedPartition {
+		std::vector<double> KeyData;                //Region vertices, parameters, and partitioning method (see MakePartitionKeyData())
+		std::Evector<PolygonCollection> Partition;
+		uint64_t LastUsed = 0U;
+
+		template<class Archive> void serialize(Archive & archive) { archive(KeyData, Partition, LastUsed); }
+	};
+
+	//Singleton class - thread-safe. Entries are looked up by a 64-bit hash of their key data, and the key data itself is compared before
+	//an entry is used, so a hash collision costs a miss rather than a wrong plan. The least recently used entries are dropped when the cache
+	//is full. The cache is loaded on construction and saved on destruction, and can be saved at other times with Save().
+	class MissionPlanCache {
+		public:
+			static constexpr size_t MaxPlans      = 4096U; //Each plan is typically a few KB
+			static constexpr size_t MaxPartitions = 64U;
+
+			static MissionPlanCache & Instance() { static MissionPlanCache Obj; return Obj; }
+
+			MissionPlanCache()  : m_enabled(true), m_useCounter(0U), m_dirty(false) { std::scoped_lock lock(m_mutex); LoadFromDisk(); }
+			~MissionPlanCache() { std::scoped_lock lock(m_mutex); if (m_dirty) SaveToDisk(); }
+
+			//Key data for a region and the parameters that affect the plan or partition for it. Only exact matches hit in the cache.
+			static inline std::vector<double> MakePlanKeyData(PolygonCollection const & Region, MissionParameters const & MissionParams);
+			static inline std::vector<double> MakePartitionKeyData(PolygonCollection const & Region, MissionParameters const & MissionParams, int Method);
+
+			inline bool LookupPlan(std::vector<double> const & KeyData, CachedMissionPlan & Plan);  //Returns false on a miss
+			inline void StorePlan(CachedMissionPlan const & Plan);                                 //Plan.KeyData must be set
+			inline bool LookupPartition(std::vector<double> const & KeyData, std::Evector<PolygonCollection> & Partition); //Returns false on a miss
+			inline void StorePartition(std::vector<double> const & KeyData, std::Evector<PolygonCollection> const & Partition);
+
+			//While disabled, lookups miss and nothing is stored (for benchmarking the planners themselves)
+			void SetEnabled(bool Enabled) { std::scoped_lock lock(m_mutex); m_enabled = Enabled; }
+			bool IsEnabled(void)          { std::scoped_lock lock(m_mutex); return m_enabled; }
+
+			size_t NumPlans(void)      { std::scoped_lock lock(m_mutex); return m_plans.size(); }
+			size_t NumPartitions(void) { std::scoped_lock lock(m_mutex); return m_partitions.size(); }
+
+			inline void Save(void); //Save to disk now if anything changed since the last save
+			inline void Clear(void);
+
+			//Tell Cereal which members to serialize (must be public)
+			template<class Archive> void serialize(Archive & archive) { archive(m_plans, m_partitions, m_useCounter); }
+
+		private:
+			static constexpr uint32_t FormatVersion = 1U; //Bump when anything that affects cached results changes - old cache files are discarded
+
+			std::mutex m_mutex;
+			bool m_enabled;
+			std::unordered_map<uint64_t, CachedMissionPlan> m_plans;
+			std::unordered_map<uint64_t, CachedPartition>   m_partitions;
+			uint64_t m_useCounter; //Incremented on each hit or store, for least-recently-used eviction
+			bool m_dirty;          //True if there are changes that haven't been saved
+
+			static inline void AppendRegionKeyData(PolygonCollection const & Region, std::vector<double> & KeyData);
+			static inline uint64_t HashKeyData(std::vector<double> const & KeyData);
+			template <typename EntryType> static void EvictLeastRecentlyUsed(std::unordered_map<uint64_t, EntryType> & Entries, size_t MaxEntries);
+
+			static std::filesystem::path CacheFilePath(void) { return Handy::Paths::CacheDirectory("SentekRecon") / "MissionPlanCache.bin"; }
+			inline void SaveToDisk(void);   //Immediately save
+			inline void LoadFromDisk(void); //Immediately load from disk, replacing the current contents
+	};
+
+	// *********************************************************************************************************************************
+	// ***************************************************   MissionPlanCache Definitions   ********************************************
+	// *********************************************************************************************************************************
+	//Every vertex of every boundary and hole, with counts so that different splits of the same vertices can't collide
+	inline void MissionPlanCache::AppendRegionKeyData(PolygonCollection const & Region, std::vector<double> & KeyData) {
+		KeyData.push_back(double(Region.m_components.size()));
+		for (Polygon const & comp : Region.m_components) {
+			KeyData.push_back(double(comp.m_holes.size()));
+			for (size_t n = 0U; n <= comp.m_holes.size(); n++) {
+				std::Evector<Eigen::Vector2d> const & vertices = (n == 0U) ? comp.m_boundary.GetVertices() : comp.m_holes[n - 1U].GetVertices();
+				KeyData.push_back(double(vertices.size()));
+				for (Eigen::Vector2d const & vertex : vertices) {
+					KeyData.push_back(vertex(0));
+					KeyData.push_back(vertex(1));
+				}
+			}
+		}
+	}
+
+	inline std::vector<double> MissionPlanCache::MakePlanKeyData(PolygonCollection const & Region, MissionParameters const & MissionParams) {
+		std::vector<double> keyData;
+		keyData.push_back(double(FormatVersion));
+		keyData.push_back(MissionParams.HAG);
+		keyData.push_back(MissionParams.HFOV);
+		keyData.push_back(MissionParams.SidelapFraction);
+		keyData.push_back(MissionParams.TargetSpeed);
+		AppendRegionKeyData(Region, keyData);
+		return keyData;
+	}
+
+	inline std::vector<double> MissionPlanCache::MakePartitionKeyData(PolygonCollection const & Region, MissionParameters const & MissionParams, int Method) {
+		std::vector<double> keyData;
+		keyData.push_back(double(FormatVersion));
+		keyData.push_back(double(Method));
+		keyData.push_back(MissionParams.HAG);
+		keyData.push_back(MissionParams.HFOV);
+		keyData.push_back(MissionParams.SidelapFraction);
+		keyData.push_back(MissionParams.TargetSpeed);
+		keyData.push_back(MissionParams.SubregionTargetFlightTime);
+		AppendRegionKeyData(Region, keyData);
+		return keyData;
+	}
+
+	//64-bit FNV-1a over the bytes of the key data
+	inline uint64_t MissionPlanCache::HashKeyData(std::vector<double> const & KeyData) {
+		uint64_t hash = 14695981039346656037ULL;
+		for (double value : KeyData) {
+			uint64_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			for (int byteIndex = 0; byteIndex < 8; byteIndex++) {
+				hash ^= (bits >> (8*byteIndex)) & 0xFFULL;
+				hash *= 1099511628211ULL;
+			}
+		}
+		return hash;
+	}
+
+	template <typename EntryType>
+	void MissionPlanCache::EvictLeastRecentlyUsed(std::unordered_map<uint64_t, EntryType> & Entries, size_t MaxEntries) {
+		while (Entries.size() > MaxEntries) {
+			auto oldest = Entries.begin();
+			for (auto iter = Entries.begin(); iter != Entries.end(); iter++) {
+				if (iter->second.LastUsed < oldest->second.LastUsed)
+					oldest = iter;
+			}
+			Entries.erase(oldest);
+		}
+	}
+
+	inline bool MissionPlanCache::LookupPlan(std::vector<double> const & KeyData, CachedMissionPlan & Plan) {
+		std::scoped_lock lock(m_mutex);
+		if (! m_enabled)
+			return false;
+		auto iter = m_plans.find(HashKeyData(KeyData));
+		if ((iter == m_plans.end()) || (iter->second.KeyData != KeyData))
+			return false;
+		iter->second.LastUsed = ++m_useCounter;
+		Plan = iter->second;
+		return true;
+	}
+
+	inline void MissionPlanCache::StorePlan(CachedMissionPlan const & Plan) {
+		std::scoped_lock lock(m_mutex);
+		if (! m_enabled)
+			return;
+		CachedMissionPlan & entry = m_plans[HashKeyData(Plan.KeyData)];
+		entry = Plan;
+		entry.LastUsed = ++m_useCounter;
+		EvictLeastRecentlyUsed(m_plans, MaxPlans);
+		m_dirty = true;
+	}
+
+	inline bool MissionPlanCache::LookupPartition(std::vector<double> const & KeyData, std::Evector<PolygonCollection> & Partition) {
+		std::scoped_lock lock(m_mutex);
+		if (! m_enabled)
+			return false;
+		auto iter = m_partitions.find(HashKeyData(KeyData));
+		if ((iter == m_partitions.end()) || (iter->second.KeyData != KeyData))
+			return false;
+		iter->second.LastUsed = ++m_useCounter;
+		Partition = iter->second.Partition;
+		return true;
+	}
+
+	inline void MissionPlanCache::StorePartition(std::vector<double> const & KeyData, std::Evector<PolygonCollection> const & Partition) {
+		std::scoped_lock lock(m_mutex);
+		if (! m_enabled)
+			return;
+		CachedPartition & entry = m_partitions[HashKeyData(KeyData)];
+		entry.KeyData   = KeyData;
+		entry.Partition = Partition;
+		entry.LastUsed  = ++m_useCounter;
+		EvictLeastRecentlyUsed(m_partitions, MaxPartitions);
+		m_dirty = true;
+	}
+
+	//Save to disk now if anything changed since the last save
+	inline void MissionPlanCache::Save(void) {
+		std::scoped_lock lock(m_mutex);
+		if (m_dirty)
+			SaveToDisk();
+	}
+
+	inline void MissionPlanCache::Clear(void) {
+		std::scoped_lock lock(m_mutex);
+		m_plans.clear();
+		m_partitions.clear();
+		m_dirty = true;
+	}
+
+	//Immediately save. We write to a temporary file and rename it over the old one so a crash mid-save can't leave a truncated cache behind.
+	inline void MissionPlanCache::SaveToDisk(void) {
+		std::filesystem::path filePath = CacheFilePath();
+		std::filesystem::path tempPath = filePath;
+		tempPath += ".tmp";
+		{
+			std::ofstream fileStream(tempPath.string(), std::ofstream::out | std::ofstream::binary);
+			if (! fileStream.is_open()) {
+				std::cerr << "Error in MissionPlanCache::SaveToDisk: Could not open file for writing.\r\n";
+				return;
+			}
+			try {
+				cereal::PortableBinaryOutputArchive oArchive(fileStream);
+				oArchive(FormatVersion, *this);
+			}
+			catch (...) {
+				std::cerr << "Error in MissionPlanCache::SaveToDisk: Writing to Cereal archive failed.\r\n";
+				return;
+			}
+		}
+		std::error_code ec;
+		std::filesystem::rename(tempPath, filePath, ec);
+		if (ec)
+			std::cerr << "Error in MissionPlanCache::SaveToDisk: Could not replace cache file: " << ec.message() << "\r\n";
+		else
+			m_dirty = false;
+	}
+
+	//Immediately load from disk, replacing the current contents. A missing file just means an empty cache.
+	inline void MissionPlanCache::LoadFromDisk(void) {
+		m_plans.clear();
+		m_partitions.clear();
+		std::filesystem::path filePath = CacheFilePath();
+		if (! std::filesystem::exists(filePath))
+			return;
+		std::ifstream fileStream(filePath.string(), std::ifstream::in | std::ifstream::binary);
+		if (! fileStream.is_open()) {
+			std::cerr << "Error in MissionPlanCache::LoadFromDisk: Could not open file for reading.\r\n";
+			return;
+		}
+		try {
+			cereal::PortableBinaryInputArchive iArchive(fileStream);
+			uint32_t formatVersion = 0U;
+			iArchive(formatVersion);
+			if (formatVersion != FormatVersion) {
+				std::cerr << "Mission plan cache is from a different version - starting with an empty cache.\r\n";
+				return;
+			}
+			iArchive(*this);
+		}
+		catch (...) {
+			std::cerr << "Error in MissionPlanCache::LoadFromDisk: Reading from Cereal archive failed - starting with an empty cache.\r\n";
+			m_plans.clear();
+			m_partitions.clear();
+			m_useCounter = 0U;
+		}
+	}
+}
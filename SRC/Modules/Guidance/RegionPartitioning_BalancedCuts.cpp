@@ -0,0 +1,301 @@
+//This source file implements the Balanced Cuts survey region partitioning algorithm. Like Iterated Cuts, pieces of the region that are
+//too large are cut in two with straight lines until every piece is about the right size. The difference is in how each cut is chosen:
+//the cut position along a given direction is found by bisection so that the two sides have the areas we want (instead of assuming the
+//piece is nearly rectangular), several cut directions are tried for each piece (in parallel), and the candidates are scored by the
+//estimated flight time of serpentine missions over the resulting pieces. Cuts that leave slivers (pieces too small to be worth a sortie,
+//or that PlanMission() would drop) or that fragment a piece into more sorties than it needs are penalized.
+//Authors: Bryan Poling
+//Copyright (c) 2022 Sentek Systems, LLC. All rights reserved.
+
+//System Includes
+
+//External Includes
+#include "../../eigen/Eigen/LU"
+#include "../../eigen/Eigen/QR"
+#include "../../eigen/Eigen/Geometry"
+
+//Project Includes
+#include "Guidance.hpp"
+#include "../../Utilities.hpp"
+#include "../../Maps/MapUtils.hpp"
+#include "../../WorkStealingPool.hpp"
+
+#define PI 3.14159265358979323846
+
+// *********************************************************************************************************************************
+// ***************************************************   Local Data Structures   ***************************************************
+// *********************************************************************************************************************************
+static constexpr int    NumCutOrientations  = 8;    //Number of cut directions tried for each piece (evenly spaced over 180 degrees)
+static constexpr double MaxPieceAreaFactor  = 1.5;  //Pieces with area up to this multiple of the target area are not cut (same as Iterated Cuts)
+static constexpr double SliverAreaFactor    = 0.25; //Pieces with area below this multiple of the target area are slivers
+static constexpr double CutAreaTolerance    = 1e-4; //Relative area tolerance for cut position bisection
+static constexpr int    MaxBisectionSteps   = 60;
+static constexpr int    MaxSortiesToPlan    = 4;    //Pieces needing more sorties than this are scored by area (see EvaluateCut())
+
+struct CutCandidate {
+	std::Evector<Polygon> Pieces; //All pieces on both sides of the cut
+	double Score = std::numeric_limits<double>::infinity();
+	bool Valid = false;
+};
+
+
+// *********************************************************************************************************************************
+// *************************************************   Local Function Definitions   ************************************************
+// *********************************************************************************************************************************
+
+//Get the approximate area (in m^2) that can be flown in the given number of seconds, given the imaging requirements
+static double FlightTimeToApproxArea(Guidance::MissionParameters const & MissionParams) {
+	double rowSpacing = 2.0 * MissionParams.HAG * std::tan(0.5 * MissionParams.HFOV) * (1.0 - MissionParams.SidelapFraction);
+	double coverageRate = rowSpacing * MissionParams.TargetSpeed; //m^2/s - not including first pass, which is more productive
+	return MissionParams.SubregionTargetFlightTime * coverageRate;
+}
+
+//Convert an area from m^2 to squared NM units. This is approximate and depends on the NM y coordinate of our operating zone,
+//since the distortion of the NM projection varies by latitude
+static double Area_SquareMeters_To_NM(double Area_SqMeters, double ApproxY_NM) {
+	double NMUnitsPerM = MetersToNMUnits(1.0, ApproxY_NM);
+	double NMAreaUnitsPerSqMeter = NMUnitsPerM * NMUnitsPerM;
+	return Area_SqMeters * NMAreaUnitsPerSqMeter;
+}
+
+//Number of sorties we expect a piece of the given area to take (pieces are cut until they need just one)
+static int NumSortiesForArea(double Area, double TargetArea) {
+	if (Area <= MaxPieceAreaFactor*TargetArea)
+		return 1;
+	return std::max(2, int(std::round(Area / TargetArea)));
+}
+
+//Area of the part of the region bounded by a closed ring of vertices satisfying X dot V <= P. This clips the ring to the half plane
+//(Sutherland-Hodgman) and applies the shoelace formula to the result as it is generated. For a non-convex ring the clipped ring can run
+//back and forth along the cut line, but those overlapping edges enclose no area, so the result is exact.
+static double ClippedRingArea(std::Evector<Eigen::Vector2d> const & Ring, Eigen::Vector2d const & V, double P) {
+	if (Ring.size() < 3U)
+		return 0.0;
+	double twiceArea = 0.0;
+	bool haveFirst = false;
+	Eigen::Vector2d first, prev;
+	auto emit = [&](Eigen::Vector2d const & X) {
+		if (haveFirst)
+			twiceArea += prev(0)*X(1) - X(0)*prev(1);
+		else {
+			first = X;
+			haveFirst = true;
+		}
+		prev = X;
+	};
+	Eigen::Vector2d A = Ring.back();
+	double dA = A.dot(V) - P;
+	for (Eigen::Vector2d const & B : Ring) {
+		double dB = B.dot(V) - P;
+		if ((dA <= 0.0) != (dB <= 0.0))
+			emit(A + (dA / (dA - dB))*(B - A));
+		if (dB <= 0.0)
+			emit(B);
+		A = B;
+		dA = dB;
+	}
+	if (haveFirst)
+		twiceArea += prev(0)*first(1) - first(0)*prev(1);
+	return 0.5*std::abs(twiceArea);
+}
+
+//Total area of the part of a polygon satisfying X dot V <= P (same as the total area of IntersectWithHalfPlane(V, P), but much cheaper)
+static double AreaBelowCut(Polygon const & Poly, Eigen::Vector2d const & V, double P) {
+	double area = ClippedRingArea(Poly.m_boundary.GetVertices(), V, P);
+	for (SimplePolygon const & hole : Poly.m_holes)
+		area -= ClippedRingArea(hole.GetVertices(), V, P);
+	return std::max(area, 0.0);
+}
+
+//A quick stand-in for the mission PlanMission() would plan for a piece: hatch lines orthogonal to the shortest axis (as in PlanMission()),
+//flown in order back and forth. The greedy planner can only do better, so this is a slightly pessimistic (but consistent) basis for
+//comparing cuts. Returns an empty mission if no hatch lines intersect the piece (PlanMission() would drop it).
+static DroneInterface::WaypointMission QuickSerpentineMission(Polygon const & Poly, Guidance::MissionParameters const & MissionParams) {
+	DroneInterface::WaypointMission mission;
+	mission.LandAtLastWaypoint = false;
+	mission.CurvedTrajectory = true;
+	Eigen::Vector4d AABB = Poly.GetAABB();
+	if (std::isnan(AABB(0)))
+		return mission;
+
+	double RowSpacing_m = 2.0 * MissionParams.HAG * std::tan(0.5 * MissionParams.HFOV) * (1.0 - MissionParams.SidelapFraction);
+	double RowSpacing_NMUnits = MetersToNMUnits(RowSpacing_m, 0.5*AABB(2) + 0.5*AABB(3));
+	Eigen::Vector2d VMinor = Poly.FindShortestAxis();
+	double minProj = std::numeric_limits<double>::infinity();
+	double maxProj = -std::numeric_limits<double>::infinity();
+	for (Eigen::Vector2d const & vert : Poly.m_boundary.GetVertices()) {
+		minProj = std::min(minProj, vert.dot(VMinor));
+		maxProj = std::max(maxProj, vert.dot(VMinor));
+	}
+	bool reverse = false;
+	for (double proj = minProj; proj <= maxProj; proj += RowSpacing_NMUnits) {
+		std::Evector<LineSegment> segments = Poly.ClipLine(VMinor, proj);
+		if (reverse)
+			std::reverse(segments.begin(), segments.end());
+		for (LineSegment const & segment : segments) {
+			for (Eigen::Vector2d const & endpoint_NM : {reverse ? segment.m_endpoint2 : segment.m_endpoint1, reverse ? segment.m_endpoint1 : segment.m_endpoint2}) {
+				Eigen::Vector2d endpoint_LatLon = NMToLatLon(endpoint_NM);
+				mission.Waypoints.emplace_back();
+				mission.Waypoints.back().Latitude    = endpoint_LatLon(0);
+				mission.Waypoints.back().Longitude   = endpoint_LatLon(1);
+				mission.Waypoints.back().RelAltitude = MissionParams.HAG;
+				mission.Waypoints.back().Speed       = MissionParams.TargetSpeed;
+			}
+		}
+		if (! segments.empty())
+			reverse = ! reverse;
+	}
+	return mission;
+}
+
+//Cut a piece along the lines X dot V = P with P chosen so the area on the low side is LowFraction of the total, and score the result.
+//The score is the estimated flight time of the longest sortie, plus the target flight time for every sortie the cut adds beyond
+//NumSorties (from fragmenting the piece) and for every sliver it leaves. Lower is better.
+static CutCandidate EvaluateCut(Polygon const & Piece, double PieceArea, Eigen::Vector2d const & V, double LowFraction, int NumSorties,
+                                double TargetArea, Guidance::MissionParameters const & MissionParams) {
+	CutCandidate candidate;
+	double minDot = std::numeric_limits<double>::infinity();
+	double maxDot = -std::numeric_limits<double>::infinity();
+	for (Eigen::Vector2d const & vert : Piece.m_boundary.GetVertices()) {
+		minDot = std::min(minDot, vert.dot(V));
+		maxDot = std::max(maxDot, vert.dot(V));
+	}
+	if (! (maxDot > minDot))
+		return candidate;
+
+	//Area below the cut is monotone in P, so bisect for the balanced position
+	double targetLowArea = LowFraction * PieceArea;
+	double lower = minDot;
+	double upper = maxDot;
+	double P = 0.5*lower + 0.5*upper;
+	for (int step = 0; step < MaxBisectionSteps; step++) {
+		P = 0.5*lower + 0.5*upper;
+		double area = AreaBelowCut(Piece, V, P);
+		if (std::abs(area - targetLowArea) <= CutAreaTolerance*PieceArea)
+			break;
+		if (area < targetLowArea)
+			lower = P;
+		else
+			upper = P;
+	}
+
+	std::Evector<Polygon> partsLow  = Piece.IntersectWithHalfPlane(V, P);
+	std::Evector<Polygon> partsHigh = Piece.IntersectWithHalfPlane(-1.0*V, -1.0*P);
+	if (partsLow.empty() || partsHigh.empty())
+		return candidate;
+	candidate.Pieces.reserve(partsLow.size() + partsHigh.size());
+	candidate.Pieces.insert(candidate.Pieces.end(), partsLow.begin(),  partsLow.end());
+	candidate.Pieces.insert(candidate.Pieces.end(), partsHigh.begin(), partsHigh.end());
+
+	double longestSortie = 0.0;
+	int totalSorties = 0;
+	int numSlivers = 0;
+	for (Polygon const & part : candidate.Pieces) {
+		double area = part.GetArea();
+		int sorties = NumSortiesForArea(area, TargetArea);
+		//Shape only matters much for pieces that are close to being flown. Bigger pieces will be cut again anyway, and for them flight time
+		//is very nearly proportional to area, so we save the (relatively expensive) serpentine for the small ones.
+		double flightTime = (sorties > MaxSortiesToPlan) ? area / TargetArea * MissionParams.SubregionTargetFlightTime :
+		                    Guidance::EstimateMissionTime(QuickSerpentineMission(part, MissionParams), MissionParams.TargetSpeed);
+		if ((area < SliverAreaFactor*TargetArea) || (flightTime <= 0.0))
+			numSlivers++;
+		longestSortie = std::max(longestSortie, flightTime / double(sorties));
+		totalSorties += sorties;
+	}
+	int extraSorties = std::max(totalSorties - NumSorties, 0);
+	candidate.Score = longestSortie + MissionParams.SubregionTargetFlightTime * double(extraSorties + numSlivers);
+	candidate.Valid = true;
+	return candidate;
+}
+
+//Find the best balanced cut of a piece that needs NumSorties > 1 sorties. The low side of each cut gets floor(NumSorties/2) sorties worth
+//of area, so repeated cuts end with pieces of (nearly) equal area. Orientations are evaluated in parallel, and ties go to the lowest
+//orientation index (orientation 0 is the Iterated Cuts direction), so the result does not depend on scheduling.
+static CutCandidate FindBestCut(Polygon const & Piece, double PieceArea, int NumSorties, double TargetArea, Guidance::MissionParameters const & MissionParams) {
+	double lowFraction = double(NumSorties / 2) / double(NumSorties);
+	Eigen::Vector2d VMinor = Piece.FindShortestAxis();
+	Eigen::Vector2d VBase(VMinor(1), -1.0*VMinor(0));
+
+	std::vector<CutCandidate> candidates(NumCutOrientations);
+	WorkStealingPool::Instance().ParallelFor(candidates.size(), [&](size_t OrientationIndex) {
+		double theta = PI * double(OrientationIndex) / double(NumCutOrientations);
+		Eigen::Vector2d V(std::cos(theta)*VBase(0) - std::sin(theta)*VBase(1), std::sin(theta)*VBase(0) + std::cos(theta)*VBase(1));
+		candidates[OrientationIndex] = EvaluateCut(Piece, PieceArea, V.normalized(), lowFraction, NumSorties, TargetArea, MissionParams);
+	});
+
+	int bestIndex = -1;
+	for (int n = 0; n < (int) candidates.size(); n++) {
+		if (candidates[n].Valid && ((bestIndex < 0) || (candidates[n].Score < candidates[bestIndex].Score)))
+			bestIndex = n;
+	}
+	return (bestIndex < 0) ? CutCandidate() : std::move(candidates[bestIndex]);
+}
+
+
+// *********************************************************************************************************************************
+// ************************************************   Public Function Definitions   ************************************************
+// *********************************************************************************************************************************
+namespace Guidance {
+	//3 - Take a survey region, and break it into sub-regions of similar size that can all be flown in approximately the same flight time (argument).
+	//    A good partition uses as few components as possible for a given target execution time. Hueristically, this generally means simple shapes.
+	//    This function needs the target drone speed and imaging requirements because they impact what sized region can be flown in a given amount of time.
+	//Arguments:
+	//Region           - Input  - The input survey region to cover (polygon collection in NM coords)
+	//Partition        - Output - A vector of sub-regions, each one a polygon collection in NM coords (typical case will have a single poly in each sub-region)
+	//MissionParams    - Input  - Parameters specifying speed and row spacing (see definitions in struct declaration)
+	void PartitionSurveyRegion_BalancedCuts(PolygonCollection const & Region, std::Evector<PolygonCollection> & Partition,
+	                                        MissionParameters const & MissionParams) {
+		auto startTime = std::chrono::steady_clock::now();
+		Partition.clear();
+		Eigen::Vector4d AABB = Region.GetAABB();
+		if (std::isnan(AABB(0)))
+			return;
+		double targetArea = Area_SquareMeters_To_NM(FlightTimeToApproxArea(MissionParams), 0.5*AABB(2) + 0.5*AABB(3));
+
+		//Each pass cuts every piece that still needs more than one sortie (pieces are independent, so they are cut in parallel). A piece
+		//we fail to cut is kept as-is. Pieces keep their relative order from pass to pass, so the result does not depend on scheduling.
+		std::Evector<Polygon> pieces = Region.m_components;
+		std::vector<bool> isFinal(pieces.size(), false);
+		int passNum = 0;
+		for (; passNum < 64; passNum++) {
+			std::vector<CutCandidate> cuts(pieces.size());
+			std::vector<size_t> piecesToCut;
+			for (size_t n = 0U; n < pieces.size(); n++) {
+				if (! isFinal[n])
+					piecesToCut.push_back(n);
+			}
+			if (piecesToCut.empty())
+				break;
+			WorkStealingPool::Instance().ParallelFor(piecesToCut.size(), [&](size_t Index) {
+				size_t pieceIndex = piecesToCut[Index];
+				double pieceArea = pieces[pieceIndex].GetArea();
+				int numSorties = NumSortiesForArea(pieceArea, targetArea);
+				if (numSorties > 1)
+					cuts[pieceIndex] = FindBestCut(pieces[pieceIndex], pieceArea, numSorties, targetArea, MissionParams);
+			});
+
+			std::Evector<Polygon> newPieces;
+			std::vector<bool> newIsFinal;
+			newPieces.reserve(2U*pieces.size());
+			newIsFinal.reserve(2U*pieces.size());
+			for (size_t n = 0U; n < pieces.size(); n++) {
+				if (cuts[n].Valid) {
+					newPieces.insert(newPieces.end(), cuts[n].Pieces.begin(), cuts[n].Pieces.end());
+					newIsFinal.insert(newIsFinal.end(), cuts[n].Pieces.size(), false);
+				}
+				else {
+					newPieces.push_back(pieces[n]);
+					newIsFinal.push_back(true);
+				}
+			}
+			pieces.swap(newPieces);
+			isFinal.swap(newIsFinal);
+		}
+
+		Partition.reserve(pieces.size());
+		for (Polygon const & comp : pieces)
+			Partition.emplace_back(comp);
+		std::cerr << "Balanced cuts algorithm finished after " << passNum << " passes with " << pieces.size() << " pieces. Runtime: " <<
+		             SecondsElapsed(startTime)*1000.0 << " ms.\r\n";
+	}
+}
@@ -0,0 +1,610 @@
+//This source file implements multi-drone sub-region sequencing (SelectSubregionSequences) and the background worker that runs it.
+//Authors: Bryan Poling
+//Copyright (c) 2022 Sentek Systems, LLC. All rights reserved.
+
+//System Includes
+#include <random>
+#include <limits>
+#include <numeric>
+#include <functional>
+
+//External Includes
+
+//Project Includes
+#include "Guidance.hpp"
+#include "../../Utilities.hpp"
+#include "../../Maps/MapUtils.hpp"
+
+namespace Guidance {
+	// *********************************************************************************************************************************
+	// *************************************************   Local Types and Functions   *************************************************
+	// *********************************************************************************************************************************
+	//Every mission left unassigned costs this much (s) - more than any amount of flight time, so the solver always prefers assigning more missions
+	static constexpr double UnassignedMissionPenalty = 1.0e6;
+
+	//The problem, reduced to what the solver needs. Missions are numbered 0, 1, ..., NumMissions-1 here (MissionIndices maps them back). All times
+	//are in seconds, relative to the moment the solve started. A mission can be flown if it is started no later than its latest start time - since
+	//the margin from IsPredictedToFinishWithoutShadows() drops one-for-one with a later start, we get this from one check per mission.
+	struct SequencingProblem {
+		int NumDrones   = 0;
+		int NumMissions = 0;
+		std::vector<int>    MissionIndices;     //Element m is the index in SubregionMissions of mission m
+		std::vector<double> Durations;          //Element m is the time to fly mission m
+		std::vector<double> LatestStartTimes;   //Element m is the latest time mission m can be started and be flown without shadows (may be +inf)
+		std::vector<double> DroneStartDelays;   //Element k is the time drone k is ready to start its first mission
+		std::vector<double> DroneToMissionTime; //Element k*NumMissions + m is the flight time from the start of drone k to the start of mission m
+		std::vector<double> BetweenMissionTime; //Element i*NumMissions + j is the flight time from the end of mission i to the start of mission j
+
+		double FromDrone(int Drone, int Mission) const { return DroneToMissionTime[size_t(Drone)*size_t(NumMissions) + size_t(Mission)]; }
+		double Between(int MissionA, int MissionB) const { return BetweenMissionTime[size_t(MissionA)*size_t(NumMissions) + size_t(MissionB)]; }
+	};
+
+	//A solution: Routes[k] is the sequence of missions for drone k. Every mission is either in exactly one route or in Unassigned.
+	struct SequencingSolution {
+		std::vector<std::vector<int>> Routes;
+		std::vector<int> Unassigned;
+		double Cost             = std::numeric_limits<double>::infinity();
+		double Makespan         = 0.0;
+		double TotalTransitTime = 0.0;
+	};
+
+	//Timing details for one route, used to check insertions in constant time. StartTimes[i] is when mission i of the route starts, FinishTimes[i]
+	//when it ends, and Slack[i] is how much missions i and later can be pushed back before one of them starts too late.
+	struct RouteTiming {
+		std::vector<double> StartTimes;
+		std::vector<double> FinishTimes;
+		std::vector<double> Slack;
+		double EndTime = 0.0;
+	};
+
+	//Flight time between two points - the same as EstimateMissionTime() for two waypoints, but with the geodetic conversions done up front
+	static double FlightTime(Eigen::Vector3d const & A_ECEF, double A_RelAlt, Eigen::Vector3d const & B_ECEF, double B_RelAlt, double TargetSpeed) {
+		double horizontalDist = (B_ECEF - A_ECEF).norm();
+		double verticalDist   = std::fabs(B_RelAlt - A_RelAlt);
+		return std::sqrt(horizontalDist*horizontalDist + verticalDist*verticalDist) / TargetSpeed;
+	}
+
+	static void ComputeRouteTiming(SequencingProblem const & Problem, int Drone, std::vector<int> const & Route, RouteTiming & Timing) {
+		size_t length = Route.size();
+		Timing.StartTimes.resize(length);
+		Timing.FinishTimes.resize(length);
+		Timing.Slack.resize(length);
+		double t = Problem.DroneStartDelays[Drone];
+		for (size_t n = 0U; n < length; n++) {
+			t += (n == 0U) ? Problem.FromDrone(Drone, Route[0]) : Problem.Between(Route[n - 1U], Route[n]);
+			Timing.StartTimes[n] = t;
+			t += Problem.Durations[Route[n]];
+			Timing.FinishTimes[n] = t;
+		}
+		Timing.EndTime = t;
+		double slack = std::numeric_limits<double>::infinity();
+		for (size_t n = length; n-- > 0U;) {
+			slack = std::min(slack, Problem.LatestStartTimes[Route[n]] - Timing.StartTimes[n]);
+			Timing.Slack[n] = slack;
+		}
+	}
+
+	//Recompute the cost of a solution from scratch. Returns false if some mission starts too late (this should never happen for solutions built
+	//by the solver - it is a consistency check).
+	static bool EvaluateSolution(SequencingProblem const & Problem, SequencingSolution & Solution) {
+		bool feasible = true;
+		Solution.Makespan = 0.0;
+		Solution.TotalTransitTime = 0.0;
+		RouteTiming timing;
+		for (int drone = 0; drone < Problem.NumDrones; drone++) {
+			std::vector<int> const & route = Solution.Routes[drone];
+			ComputeRouteTiming(Problem, drone, route, timing);
+			if ((! route.empty()) && (timing.Slack[0] < 0.0))
+				feasible = false;
+			for (size_t n = 0U; n < route.size(); n++)
+				Solution.TotalTransitTime += (n == 0U) ? Problem.FromDrone(drone, route[0]) : Problem.Between(route[n - 1U], route[n]);
+			if (! route.empty())
+				Solution.Makespan = std::max(Solution.Makespan, timing.EndTime);
+		}
+		Solution.Cost = Solution.Makespan + Solution.TotalTransitTime + UnassignedMissionPenalty*double(Solution.Unassigned.size());
+		return feasible;
+	}
+
+	//Returns true when the solver should stop (out of time or cancelled)
+	using StopCheck = std::function<bool(void)>;
+
+	//Greedy starting solution - whichever drone is free first takes the closest (in flight time) mission it can still fly without shadows. This is
+	//what tasking drones one at a time with SelectSubRegion() amounts to, so it is also the baseline we report improvements against.
+	//If ShouldStop() fires, the missions not taken yet are left unassigned.
+	static void GreedySolution(SequencingProblem const & Problem, SequencingSolution & Solution, StopCheck const & ShouldStop) {
+		Solution.Routes.assign(Problem.NumDrones, std::vector<int>());
+		Solution.Unassigned.clear();
+		std::vector<double> readyTimes = Problem.DroneStartDelays;
+		std::vector<bool> droneActive(Problem.NumDrones, true);
+		std::vector<bool> missionTaken(Problem.NumMissions, false);
+		int numTaken = 0;
+		while ((numTaken < Problem.NumMissions) && (! ShouldStop())) {
+			int drone = -1;
+			for (int k = 0; k < Problem.NumDrones; k++) {
+				if (droneActive[k] && ((drone < 0) || (readyTimes[k] < readyTimes[drone])))
+					drone = k;
+			}
+			if (drone < 0)
+				break;
+			std::vector<int> const & route = Solution.Routes[drone];
+			int bestMission = -1;
+			double bestTravelTime = std::numeric_limits<double>::infinity();
+			for (int m = 0; m < Problem.NumMissions; m++) {
+				if (missionTaken[m])
+					continue;
+				double travelTime = route.empty() ? Problem.FromDrone(drone, m) : Problem.Between(route.back(), m);
+				if ((readyTimes[drone] + travelTime <= Problem.LatestStartTimes[m]) && (travelTime < bestTravelTime)) {
+					bestMission    = m;
+					bestTravelTime = travelTime;
+				}
+			}
+			if (bestMission < 0) {
+				droneActive[drone] = false;
+				continue;
+			}
+			Solution.Routes[drone].push_back(bestMission);
+			readyTimes[drone] += bestTravelTime + Problem.Durations[bestMission];
+			missionTaken[bestMission] = true;
+			numTaken++;
+		}
+		for (int m = 0; m < Problem.NumMissions; m++) {
+			if (! missionTaken[m])
+				Solution.Unassigned.push_back(m);
+		}
+		EvaluateSolution(Problem, Solution);
+	}
+
+	//Insert the given missions into the solution, one at a time, choosing each time the mission with the largest regret (how much worse off we
+	//are if we can't put it on the route where it fits best) and putting it where it fits best. A mission fits at a spot if neither it nor any mission
+	//after it on the route starts too late as a result. The cost of an insertion is the added transit time plus however much it extends the makespan.
+	//Noise (>= 0) randomly scales insertion costs to diversify the search. Missions that don't fit anywhere go to Solution.Unassigned, as do
+	//the missions not inserted yet if ShouldStop() fires.
+	static void RegretInsertion(SequencingProblem const & Problem, SequencingSolution & Solution, std::vector<int> MissionsToInsert,
+	                            double Noise, std::mt19937 & RNG, StopCheck const & ShouldStop) {
+		std::uniform_real_distribution<double> noiseDist(1.0 - Noise, 1.0 + Noise);
+		std::vector<RouteTiming> timings(Problem.NumDrones);
+		for (int drone = 0; drone < Problem.NumDrones; drone++)
+			ComputeRouteTiming(Problem, drone, Solution.Routes[drone], timings[drone]);
+
+		while (! MissionsToInsert.empty()) {
+			if (ShouldStop()) {
+				Solution.Unassigned.insert(Solution.Unassigned.end(), MissionsToInsert.begin(), MissionsToInsert.end());
+				break;
+			}
+			double makespan = 0.0;
+			for (int drone = 0; drone < Problem.NumDrones; drone++) {
+				if (! Solution.Routes[drone].empty())
+					makespan = std::max(makespan, timings[drone].EndTime);
+			}
+
+			int    chosenItem     = -1;
+			int    chosenDrone    = -1;
+			int    chosenPosition = -1;
+			double chosenRegret   = -1.0;
+			double chosenCost     = std::numeric_limits<double>::infinity();
+			for (int item = 0; item < (int) MissionsToInsert.size(); item++) {
+				int mission = MissionsToInsert[item];
+				double best1 = std::numeric_limits<double>::infinity(); //Cheapest insertion over all routes
+				double best2 = std::numeric_limits<double>::infinity(); //Cheapest insertion in any other route
+				int bestDrone    = -1;
+				int bestPosition = -1;
+				for (int drone = 0; drone < Problem.NumDrones; drone++) {
+					std::vector<int> const & route = Solution.Routes[drone];
+					RouteTiming const & timing = timings[drone];
+					int length = (int) route.size();
+					double routeBest = std::numeric_limits<double>::infinity();
+					int routeBestPosition = -1;
+					for (int pos = 0; pos <= length; pos++) {
+						double prevFinish = (pos == 0) ? Problem.DroneStartDelays[drone] : timing.FinishTimes[pos - 1];
+						double travelIn   = (pos == 0) ? Problem.FromDrone(drone, mission) : Problem.Between(route[pos - 1], mission);
+						if (prevFinish + travelIn > Problem.LatestStartTimes[mission])
+							continue;
+						double addedTransit, newEndTime;
+						if (pos < length) {
+							double travelOut = Problem.Between(mission, route[pos]);
+							double oldTravel = (pos == 0) ? Problem.FromDrone(drone, route[0]) : Problem.Between(route[pos - 1], route[pos]);
+							double shift = travelIn + Problem.Durations[mission] + travelOut - oldTravel;
+							if (shift > timing.Slack[pos])
+								continue;
+							addedTransit = travelIn + travelOut - oldTravel;
+							newEndTime   = timing.EndTime + shift;
+						}
+						else {
+							addedTransit = travelIn;
+							newEndTime   = prevFinish + travelIn + Problem.Durations[mission];
+						}
+						double cost = addedTransit + std::max(newEndTime - makespan, 0.0);
+						if (Noise > 0.0)
+							cost *= noiseDist(RNG);
+						if (cost < routeBest) {
+							routeBest = cost;
+							routeBestPosition = pos;
+						}
+					}
+					if (routeBest < best1) {
+						best2        = best1;
+						best1        = routeBest;
+						bestDrone    = drone;
+						bestPosition = routeBestPosition;
+					}
+					else
+						best2 = std::min(best2, routeBest);
+				}
+				if (bestDrone < 0) {
+					//Doesn't fit anywhere - and adding other missions won't change that, so it is out for good
+					Solution.Unassigned.push_back(mission);
+					MissionsToInsert[item] = MissionsToInsert.back();
+					MissionsToInsert.pop_back();
+					item--;
+					continue;
+				}
+				double regret = (best2 < std::numeric_limits<double>::infinity()) ? (best2 - best1) : std::numeric_limits<double>::max();
+				if ((regret > chosenRegret) || ((regret == chosenRegret) && (best1 < chosenCost))) {
+					chosenItem     = item;
+					chosenDrone    = bestDrone;
+					chosenPosition = bestPosition;
+					chosenRegret   = regret;
+					chosenCost     = best1;
+				}
+			}
+			if (chosenItem < 0)
+				break;
+			std::vector<int> & route = Solution.Routes[chosenDrone];
+			route.insert(route.begin() + chosenPosition, MissionsToInsert[chosenItem]);
+			ComputeRouteTiming(Problem, chosenDrone, route, timings[chosenDrone]);
+			MissionsToInsert[chosenItem] = MissionsToInsert.back();
+			MissionsToInsert.pop_back();
+		}
+		EvaluateSolution(Problem, Solution);
+	}
+
+	//Remove NumToRemove missions from the routes of a solution, using one of three strategies chosen at random: missions chosen at random, the missions
+	//closest to a random mission (so they can be re-distributed among the drones nearby), or a run of consecutive missions from one route (so they
+	//can be re-ordered). Appends the removed missions to Removed.
+	static void RemoveMissions(SequencingProblem const & Problem, SequencingSolution & Solution, int NumToRemove, std::vector<int> & Removed, std::mt19937 & RNG) {
+		std::vector<std::pair<int, int>> assigned; //(drone, mission)
+		for (int drone = 0; drone < Problem.NumDrones; drone++) {
+			for (int mission : Solution.Routes[drone])
+				assigned.emplace_back(drone, mission);
+		}
+		if (assigned.empty())
+			return;
+		NumToRemove = std::min(NumToRemove, (int) assigned.size());
+
+		std::vector<bool> remove(Problem.NumMissions, false);
+		int strategy = std::uniform_int_distribution<int>(0, 2)(RNG);
+		if (strategy == 0) {
+			std::shuffle(assigned.begin(), assigned.end(), RNG);
+			for (int n = 0; n < NumToRemove; n++)
+				remove[assigned[n].second] = true;
+		}
+		else if (strategy == 1) {
+			int seed = assigned[std::uniform_int_distribution<int>(0, (int) assigned.size() - 1)(RNG)].second;
+			auto distance = [&Problem, seed](int Mission) { return Problem.Between(seed, Mission) + Problem.Between(Mission, seed); };
+			std::nth_element(assigned.begin(), assigned.begin() + (NumToRemove - 1), assigned.end(),
+			                 [&distance](std::pair<int, int> const & A, std::pair<int, int> const & B) { return distance(A.second) < distance(B.second); });
+			for (int n = 0; n < NumToRemove; n++)
+				remove[assigned[n].second] = true;
+		}
+		else {
+			int drone = assigned[std::uniform_int_distribution<int>(0, (int) assigned.size() - 1)(RNG)].first;
+			int length = (int) Solution.Routes[drone].size();
+			int runLength = std::min(NumToRemove, length);
+			int start = std::uniform_int_distribution<int>(0, length - runLength)(RNG);
+			for (int n = start; n < start + runLength; n++)
+				remove[Solution.Routes[drone][n]] = true;
+		}
+
+		for (std::vector<int> & route : Solution.Routes) {
+			size_t kept = 0U;
+			for (int mission : route) {
+				if (remove[mission])
+					Removed.push_back(mission);
+				else
+					route[kept++] = mission;
+			}
+			route.resize(kept);
+		}
+	}
+
+	static void SolutionToSequences(SequencingProblem const & Problem, SequencingSolution const & Solution, std::vector<std::vector<int>> & Sequences) {
+		Sequences.assign(Problem.NumDrones, std::vector<int>());
+		for (int drone = 0; drone < Problem.NumDrones; drone++) {
+			Sequences[drone].reserve(Solution.Routes[drone].size());
+			for (int mission : Solution.Routes[drone])
+				Sequences[drone].push_back(Problem.MissionIndices[mission]);
+		}
+	}
+
+	// *********************************************************************************************************************************
+	// ********************************************   Guidance Algorithm Function Definitions   ****************************************
+	// *********************************************************************************************************************************
+	//7 - Given a Time Available function, a collection of sub-regions (with their pre-planned missions), and a collection of drone start positions, choose
+	//    sequences of sub-regions for each drone to fly, in order. When the mission time exceeds our prediction horizon the time available
+	//    function is no longer useful in choosing sub-regions but they can still be chosen in a logical fashion that avoids leaving holes in the map... making the
+	//    optimistic assumption that they will be shadow-free when we get there.
+	//TA                     - Input  - Time Available function
+	//SubregionMissions      - Input  - A vector of drone Missions - Element n is the mission for sub-region n.
+	//CompiledMissions       - Input  - Element n is SubregionMissions[n], compiled
+	//DroneStartPositions    - Input  - Element k is the starting position of drone k
+	//DroneStartDelays       - Input  - Element k is the time (s) from now until drone k is at its start position and free (empty = all 0)
+	//MissionIndicesToAssign - Input  - Indices of the missions in SubregionMissions to distribute among the drones
+	//Sequences              - Output - Element k is a vector of sub-region indices to task drone k to (in order)
+	//MissionParams          - Input  - Parameters specifying speed and row spacing (see definitions in struct declaration)
+	//Options                - Input  - Time budget, cancellation, etc. (see definitions in struct declaration)
+	//
+	//Returns: Statistics for the run (cost of the returned solution, etc.)
+	//
+	//The initial implementation of this function searched over all sequences, and the cost of that grows so quickly with the number of drones and
+	//sub-regions that it could hang the program. This version is a large neighbourhood search: starting from the greedy solution, repeatedly remove a
+	//few missions and re-insert them where they fit best (regret insertion), keeping the result if it is better than the current solution or not much
+	//worse than the best one (the allowed slack shrinks to 0 as the time budget runs out). Each iteration is cheap (all flight times and shadow
+	//constraints are computed up front) so we get through thousands of them per second, and we stop at the time limit, when cancelled, or when the
+	//search has stopped finding improvements - whichever comes first.
+	SequencingStats SelectSubregionSequences(ShadowPropagation::TimeAvailableFunction const & TA, std::vector<DroneInterface::WaypointMission> const & SubregionMissions,
+	                                         std::vector<CompiledMission> const & CompiledMissions, std::vector<DroneInterface::Waypoint> const & DroneStartPositions,
+	                                         std::vector<double> const & DroneStartDelays, std::set<int> const & MissionIndicesToAssign,
+	                                         std::vector<std::vector<int>> & Sequences, MissionParameters const & MissionParams,
+	                                         SequencingOptions const & Options) {
+		using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+		TimePoint startTime = std::chrono::steady_clock::now();
+		TimePoint deadline  = AdvanceTimepoint(startTime, Options.TimeBudget);
+		auto isCancelled = [&Options]() { return (Options.Cancel != nullptr) && Options.Cancel->IsCancelled(); };
+		StopCheck shouldStop = [&deadline, &isCancelled]() { return (std::chrono::steady_clock::now() >= deadline) || isCancelled(); };
+
+		SequencingStats stats;
+		Sequences.assign(DroneStartPositions.size(), std::vector<int>());
+		if (CompiledMissions.size() != SubregionMissions.size()) {
+			std::cerr << "Error in SelectSubregionSequences(): Compiled missions don't match sub-region missions.\r\n";
+			return stats;
+		}
+		if ((! DroneStartDelays.empty()) && (DroneStartDelays.size() != DroneStartPositions.size())) {
+			std::cerr << "Error in SelectSubregionSequences(): Number of drone start delays doesn't match number of drones.\r\n";
+			return stats;
+		}
+
+		//Set up the problem. Missions without waypoints can't be flown and are ignored (just like in SelectSubRegion()).
+		SequencingProblem problem;
+		problem.NumDrones = (int) DroneStartPositions.size();
+		for (int missionIndex : MissionIndicesToAssign) {
+			if ((missionIndex >= 0) && (missionIndex < (int) SubregionMissions.size()) && (! SubregionMissions[missionIndex].Waypoints.empty()))
+				problem.MissionIndices.push_back(missionIndex);
+		}
+		problem.NumMissions = (int) problem.MissionIndices.size();
+		problem.DroneStartDelays = DroneStartDelays;
+		problem.DroneStartDelays.resize(problem.NumDrones, 0.0);
+
+		std::vector<Eigen::Vector3d> missionStarts_ECEF(problem.NumMissions), missionEnds_ECEF(problem.NumMissions);
+		std::vector<double> missionStartAlts(problem.NumMissions), missionEndAlts(problem.NumMissions);
+		auto stopDuringSetup = [&]() {
+			stats.StoppedEarly = true;
+			stats.NumUnassigned = (int) MissionIndicesToAssign.size();
+			stats.SolveTime     = SecondsElapsed(startTime);
+			stats.Cancelled     = isCancelled();
+			return stats;
+		};
+		for (int m = 0; m < problem.NumMissions; m++) {
+			if (shouldStop())
+				return stopDuringSetup(); //The shadow checks can be slow for big missions
+			DroneInterface::WaypointMission const & mission = SubregionMissions[problem.MissionIndices[m]];
+			DroneInterface::Waypoint const & first = mission.Waypoints.front();
+			DroneInterface::Waypoint const & last  = mission.Waypoints.back();
+			missionStarts_ECEF[m] = LLA2ECEF(Eigen::Vector3d(first.Latitude, first.Longitude, 0.0));
+			missionEnds_ECEF[m]   = LLA2ECEF(Eigen::Vector3d(last.Latitude,  last.Longitude,  0.0));
+			missionStartAlts[m]   = first.RelAltitude;
+			missionEndAlts[m]     = last.RelAltitude;
+			problem.Durations.push_back(EstimateMissionTime(mission, MissionParams.TargetSpeed));
+
+			//Margin is how much later than now the mission could start and still finish without shadows (NaN if shadows never reach it)
+			double margin;
+			bool viableNow = IsPredictedToFinishWithoutShadows(TA, CompiledMissions[problem.MissionIndices[m]], 0.0, startTime, margin);
+			if (! viableNow)
+				problem.LatestStartTimes.push_back(-std::numeric_limits<double>::infinity());
+			else
+				problem.LatestStartTimes.push_back(std::isnan(margin) ? std::numeric_limits<double>::infinity() : margin);
+		}
+		problem.DroneToMissionTime.resize(size_t(problem.NumDrones)*size_t(problem.NumMissions));
+		for (int k = 0; k < problem.NumDrones; k++) {
+			DroneInterface::Waypoint const & start = DroneStartPositions[k];
+			Eigen::Vector3d start_ECEF = LLA2ECEF(Eigen::Vector3d(start.Latitude, start.Longitude, 0.0));
+			for (int m = 0; m < problem.NumMissions; m++)
+				problem.DroneToMissionTime[size_t(k)*size_t(problem.NumMissions) + size_t(m)] =
+					FlightTime(start_ECEF, start.RelAltitude, missionStarts_ECEF[m], missionStartAlts[m], MissionParams.TargetSpeed);
+		}
+		problem.BetweenMissionTime.resize(size_t(problem.NumMissions)*size_t(problem.NumMissions));
+		for (int i = 0; i < problem.NumMissions; i++) {
+			if (shouldStop())
+				return stopDuringSetup(); //O(NumMissions^2) flight times
+			for (int j = 0; j < problem.NumMissions; j++)
+				problem.BetweenMissionTime[size_t(i)*size_t(problem.NumMissions) + size_t(j)] =
+					FlightTime(missionEnds_ECEF[i], missionEndAlts[i], missionStarts_ECEF[j], missionStartAlts[j], MissionParams.TargetSpeed);
+		}
+
+		//Starting solution: the better of greedy and regret insertion from scratch
+		std::mt19937 RNG(Options.Seed);
+		SequencingSolution best;
+		GreedySolution(problem, best, shouldStop);
+		stats.InitialCost = best.Cost;
+		if (problem.NumDrones > 0) {
+			SequencingSolution regretSolution;
+			regretSolution.Routes.assign(problem.NumDrones, std::vector<int>());
+			std::vector<int> allMissions(problem.NumMissions);
+			std::iota(allMissions.begin(), allMissions.end(), 0);
+			RegretInsertion(problem, regretSolution, allMissions, 0.0, RNG, shouldStop);
+			if (regretSolution.Cost < best.Cost)
+				best = regretSolution;
+		}
+		SolutionToSequences(problem, best, Sequences);
+		if (Options.OnImprovement)
+			Options.OnImprovement(Sequences);
+
+		//Large neighbourhood search
+		int maxToRemove = std::clamp((int) std::ceil(0.3*double(problem.NumMissions)), 1, 30);
+		int maxIterationsWithoutImprovement = std::max(2000, 100*problem.NumMissions);
+		double maxDeviation = 0.02; //Accept a solution up to this fraction worse than the best (shrinks to 0 as we run out of time)
+		int iterationsWithoutImprovement = 0;
+		SequencingSolution current = best;
+		if ((problem.NumDrones > 0) && (problem.NumMissions > 1)) {
+			while (iterationsWithoutImprovement < maxIterationsWithoutImprovement) {
+				TimePoint now = std::chrono::steady_clock::now();
+				if ((now >= deadline) || isCancelled())
+					break;
+				stats.NumIterations++;
+				iterationsWithoutImprovement++;
+
+				SequencingSolution candidate = current;
+				std::vector<int> toInsert;
+				toInsert.swap(candidate.Unassigned); //Missions that didn't fit before may fit now
+				RemoveMissions(problem, candidate, std::uniform_int_distribution<int>(1, maxToRemove)(RNG), toInsert, RNG);
+				RegretInsertion(problem, candidate, toInsert, 0.1, RNG, shouldStop);
+
+				double timeFraction = std::clamp(SecondsElapsed(startTime, now) / std::max(Options.TimeBudget, 1.0e-6), 0.0, 1.0);
+				double threshold = maxDeviation * (1.0 - timeFraction) * (best.Makespan + best.TotalTransitTime);
+				if ((candidate.Cost < current.Cost) || (candidate.Cost < best.Cost + threshold))
+					current = candidate;
+				if (current.Cost < best.Cost - 1.0e-9) {
+					best = current;
+					iterationsWithoutImprovement = 0;
+					SolutionToSequences(problem, best, Sequences);
+					if (Options.OnImprovement)
+						Options.OnImprovement(Sequences);
+				}
+			}
+		}
+
+		if (! EvaluateSolution(problem, best))
+			std::cerr << "Error in SelectSubregionSequences(): Solution has a mission that starts too late - this shouldn't happen.\r\n";
+		stats.FinalCost        = best.Cost;
+		stats.Makespan         = best.Makespan;
+		stats.TotalTransitTime = best.TotalTransitTime;
+		stats.NumUnassigned    = (int) best.Unassigned.size() + (int) (MissionIndicesToAssign.size() - problem.MissionIndices.size());
+		stats.SolveTime        = SecondsElapsed(startTime);
+		stats.Cancelled        = isCancelled();
+		return stats;
+	}
+
+	// *********************************************************************************************************************************
+	// ******************************************   SubregionSequencer Function Definitions   ******************************************
+	// *********************************************************************************************************************************
+	//Start a new solve on the worker thread (cancelling the one in progress, if any). The worker gets its own copies of everything, so the caller
+	//is free to change its data while the solve runs. This never waits on the worker - a solve that is being cancelled winds down on its own and
+	//the worker picks up the new problem when it is done.
+	void SubregionSequencer::Start(ShadowPropagation::TimeAvailableHandle TA, std::vector<DroneInterface::WaypointMission> const & SubregionMissions,
+	                               std::vector<CompiledMission> const & CompiledMissions, std::vector<DroneInterface::Waypoint> const & DroneStartPositions,
+	                               std::vector<double> const & DroneStartDelays, std::set<int> const & MissionIndicesToAssign,
+	                               MissionParameters const & MissionParams, double TimeBudget) {
+		std::unique_ptr<Problem> problem = std::make_unique<Problem>();
+		problem->TA                     = TA;
+		problem->SubregionMissions      = SubregionMissions;
+		problem->CompiledMissions       = CompiledMissions;
+		problem->DroneStartPositions    = DroneStartPositions;
+		problem->DroneStartDelays       = DroneStartDelays;
+		problem->MissionIndicesToAssign = MissionIndicesToAssign;
+		problem->MissionParams          = MissionParams;
+		problem->TimeBudget             = TimeBudget;
+		{
+			std::scoped_lock lock(m_mutex);
+			if (m_activeCancel)
+				m_activeCancel->Cancel();
+			m_pendingProblem = std::move(problem); //Replaces any problem the worker hasn't gotten to yet
+			m_haveSolution   = false;
+			m_bestSequences.clear();
+			m_running  = true;
+			m_shutdown = false;
+			if (! m_thread.joinable())
+				m_thread = std::thread(&SubregionSequencer::WorkerMain, this);
+		}
+		m_cv.notify_all();
+	}
+
+	//Cancel the solve in progress (if any) and shut down the worker, waiting for it to exit. The last solution is kept. Every stage of the
+	//solver checks for cancellation so this doesn't block for long, but don't call it while holding a lock other threads may be waiting on.
+	void SubregionSequencer::Stop(void) {
+		{
+			std::scoped_lock lock(m_mutex);
+			if (m_activeCancel)
+				m_activeCancel->Cancel();
+			m_pendingProblem.reset();
+			m_shutdown = true;
+		}
+		m_cv.notify_all();
+		if (m_thread.joinable())
+			m_thread.join();
+		m_running = false;
+	}
+
+	//Cancel the solve in progress (if any) and drop the problem waiting for the worker (if any), without waiting for anything
+	void SubregionSequencer::Cancel(void) {
+		std::scoped_lock lock(m_mutex);
+		if (m_activeCancel)
+			m_activeCancel->Cancel();
+		m_pendingProblem.reset();
+		if (! m_activeCancel)
+			m_running = false;
+	}
+
+	//Forget the last solution and cancel the solve in progress (if any) without waiting for it. A cancelled solve publishes nothing more.
+	void SubregionSequencer::Clear(void) {
+		std::scoped_lock lock(m_mutex);
+		if (m_activeCancel)
+			m_activeCancel->Cancel();
+		m_pendingProblem.reset();
+		if (! m_activeCancel)
+			m_running = false;
+		m_haveSolution = false;
+		m_bestSequences.clear();
+	}
+
+	//Worker thread: solve problems as they are handed over by Start(), one at a time, until Stop() is called
+	void SubregionSequencer::WorkerMain(void) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true) {
+			m_cv.wait(lock, [this]() { return m_shutdown || m_pendingProblem; });
+			if (m_shutdown)
+				break;
+			std::unique_ptr<Problem> problem = std::move(m_pendingProblem);
+			m_activeCancel = problem->Cancel;
+			lock.unlock();
+			Solve(*problem);
+			lock.lock();
+			m_activeCancel.reset();
+			if (! m_pendingProblem)
+				m_running = false;
+		}
+		m_activeCancel.reset();
+	}
+
+	//Run a single solve on the worker thread, publishing improvements as they are found
+	void SubregionSequencer::Solve(Problem const & Prob) {
+		CancellationToken const & cancel(*Prob.Cancel);
+		SequencingOptions options;
+		options.TimeBudget = Prob.TimeBudget;
+		options.Cancel     = Prob.Cancel.get();
+		options.OnImprovement = [this, &cancel](std::vector<std::vector<int>> const & Sequences) {
+			std::scoped_lock lock(m_mutex);
+			if (cancel.IsCancelled())
+				return; //Don't publish over a Clear() or a newer Start() - the check has to be under the lock
+			m_bestSequences = Sequences;
+			m_haveSolution  = true;
+			m_solutionID++;
+		};
+		std::vector<std::vector<int>> sequences;
+		SequencingStats stats = SelectSubregionSequences(*Prob.TA, Prob.SubregionMissions, Prob.CompiledMissions, Prob.DroneStartPositions,
+		                                                 Prob.DroneStartDelays, Prob.MissionIndicesToAssign, sequences, Prob.MissionParams, options);
+		std::scoped_lock lock(m_mutex);
+		if ((! m_haveSolution) && (! stats.StoppedEarly) && (! cancel.IsCancelled())) {
+			m_bestSequences = sequences;
+			m_haveSolution  = true;
+			m_solutionID++;
+		}
+	}
+
+	bool SubregionSequencer::GetBestSoFar(std::vector<std::vector<int>> & Sequences, uint64_t & SolutionID) {
+		std::scoped_lock lock(m_mutex);
+		if (! m_haveSolution)
+			return false;
+		Sequences  = m_bestSequences;
+		SolutionID = m_solutionID;
+		return true;
+	}
+}
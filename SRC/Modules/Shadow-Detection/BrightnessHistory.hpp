@@ -0,0 +1,183 @@
+//This module provides a per-pixel brightness history for the EN-plane shadow detection pipeline. For each pixel we keep a ring buffer
+//of recent brightness samples and a running histogram of the same samples, so a given percentile of the history can be maintained
+//incrementally instead of being re-derived by partial sorting every frame.
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+#pragma once
+
+//System Includes
+#include <vector>
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+
+//External Includes
+#include <opencv2/opencv.hpp>
+
+namespace ShadowDetection {
+	//All per-pixel state is stored in flat arrays (structure-of-arrays) indexed by pixel index (row*cols + col) so that a frame update
+	//walks memory linearly and no per-pixel heap allocations are needed. For each pixel we track the bin that holds the target percentile
+	//sample and the number of samples in lower bins. Pushing a sample (and evicting the oldest) changes the target rank and histogram by
+	//at most one, so re-locating the percentile bin is O(1) amortized (brightness changes slowly from frame to frame).
+	//Sample counts are stored as uint8_t so the history length is limited to 255 samples.
+	class BrightnessHistory {
+		public:
+			static constexpr int MaxHistoryLength = 255;
+
+			BrightnessHistory() = default;
+			~BrightnessHistory() = default;
+
+			//Reset to an empty history for an image of the given size. HistoryLength is the max number of samples kept per pixel and
+			//Percentile (in [0,1]) is the percentile of the history reported by GetPercentileImage(). BinShift sets histogram resolution:
+			//0 gives 256 bins (exact percentiles), N gives (256 >> N) bins and percentiles are quantized to bin centers.
+			inline void Reset(int Rows, int Cols, int HistoryLength, double Percentile, int BinShift = 0);
+
+			//Add a sample from Values (CV_8UC1) for each pixel where Mask (CV_8UC1) >= MinMaskValue. When a pixel's history is full
+			//the oldest sample for that pixel is dropped.
+			inline void Push(cv::Mat const & Values, cv::Mat const & Mask, uint8_t MinMaskValue);
+
+			//Get the configured percentile of the history of each pixel where Mask >= MinMaskValue. Other pixels (and pixels with no
+			//history) are set to 0. Out is (re)allocated as CV_8UC1 if needed.
+			inline void GetPercentileImage(cv::Mat const & Mask, uint8_t MinMaskValue, cv::Mat & Out) const;
+
+			inline bool Empty(void) const { return m_numPixels == 0; }
+			inline int  Rows(void) const { return m_rows; }
+			inline int  Cols(void) const { return m_cols; }
+
+		private:
+			int    m_rows = 0;
+			int    m_cols = 0;
+			int    m_numPixels = 0;
+			int    m_historyLength = 0;
+			double m_percentile = 0.9;
+			int    m_binShift = 0;
+			int    m_numBins = 256;
+
+			std::vector<uint8_t> m_samples; //[pixel*m_historyLength + n] - ring buffer of samples for each pixel
+			std::vector<uint8_t> m_hist;    //[pixel*m_numBins + bin] - Number of samples in the ring buffer that fall in each bin
+			std::vector<uint8_t> m_head;    //[pixel] - Index in ring buffer of oldest sample
+			std::vector<uint8_t> m_count;   //[pixel] - Number of samples in ring buffer
+			std::vector<uint8_t> m_pBin;    //[pixel] - Bin holding the sample of target rank
+			std::vector<uint8_t> m_below;   //[pixel] - Number of samples in bins below m_pBin
+
+			std::vector<uint8_t> m_rankLUT; //[count] - Target rank (0-based) for a pixel with the given number of samples
+
+			inline void AddSample(int Pixel, uint8_t Value);
+	};
+
+	inline void BrightnessHistory::Reset(int Rows, int Cols, int HistoryLength, double Percentile, int BinShift) {
+		m_rows          = std::max(Rows, 0);
+		m_cols          = std::max(Cols, 0);
+		m_numPixels     = m_rows * m_cols;
+		m_historyLength = std::clamp(HistoryLength, 1, MaxHistoryLength);
+		m_percentile    = std::clamp(Percentile, 0.0, 1.0);
+		m_binShift      = std::clamp(BinShift, 0, 7);
+		m_numBins       = 256 >> m_binShift;
+
+		m_samples.assign(size_t(m_numPixels) * size_t(m_historyLength), 0U);
+		m_hist.assign(size_t(m_numPixels) * size_t(m_numBins), 0U);
+		m_head.assign(m_numPixels, 0U);
+		m_count.assign(m_numPixels, 0U);
+		m_pBin.assign(m_numPixels, 0U);
+		m_below.assign(m_numPixels, 0U);
+
+		//Same rank definition as the original nth_element implementation: round(P*(N-1))
+		m_rankLUT.assign(m_historyLength + 1, 0U);
+		for (int n = 1; n <= m_historyLength; n++)
+			m_rankLUT[n] = (uint8_t) std::clamp((int) std::round(m_percentile*double(n - 1)), 0, n - 1);
+	}
+
+	inline void BrightnessHistory::AddSample(int Pixel, uint8_t Value) {
+		uint8_t * hist  = &(m_hist[size_t(Pixel) * size_t(m_numBins)]);
+		uint8_t * ring  = &(m_samples[size_t(Pixel) * size_t(m_historyLength)]);
+		int count = m_count[Pixel];
+		int head  = m_head[Pixel];
+		int pBin  = m_pBin[Pixel];
+		int below = m_below[Pixel];
+
+		//Evict the oldest sample if the ring buffer is full
+		if (count == m_historyLength) {
+			int oldBin = ring[head] >> m_binShift;
+			hist[oldBin]--;
+			if (oldBin < pBin)
+				below--;
+			head = (head + 1 == m_historyLength) ? 0 : head + 1;
+			count--;
+		}
+
+		//Insert the new sample
+		int tail = head + count;
+		if (tail >= m_historyLength)
+			tail -= m_historyLength;
+		ring[tail] = Value;
+		int newBin = Value >> m_binShift;
+		hist[newBin]++;
+		if (count == 0) {
+			pBin  = newBin;
+			below = 0;
+		}
+		else if (newBin < pBin)
+			below++;
+		count++;
+
+		//Move the percentile bin until it holds the sample of target rank: below <= rank < below + hist[pBin]
+		int rank = m_rankLUT[count];
+		while (rank < below) {
+			pBin--;
+			below -= hist[pBin];
+		}
+		while (rank >= below + hist[pBin]) {
+			below += hist[pBin];
+			pBin++;
+		}
+
+		m_count[Pixel] = (uint8_t) count;
+		m_head[Pixel]  = (uint8_t) head;
+		m_pBin[Pixel]  = (uint8_t) pBin;
+		m_below[Pixel] = (uint8_t) below;
+	}
+
+	inline void BrightnessHistory::Push(cv::Mat const & Values, cv::Mat const & Mask, uint8_t MinMaskValue) {
+		if ((Values.rows != m_rows) || (Values.cols != m_cols) || (Mask.rows != m_rows) || (Mask.cols != m_cols) ||
+		    (Values.type() != CV_8UC1) || (Mask.type() != CV_8UC1)) {
+			std::cerr << "Error in BrightnessHistory::Push(): Input has wrong dimensions or type.\r\n";
+			return;
+		}
+
+		//Pixels are independent so rows can be updated in parallel
+		cv::parallel_for_(cv::Range(0, m_rows), [&](cv::Range const & Rows) {
+			for (int row = Rows.start; row < Rows.end; row++) {
+				uint8_t const * valuesRow = Values.ptr<uint8_t>(row);
+				uint8_t const * maskRow   = Mask.ptr<uint8_t>(row);
+				for (int col = 0; col < m_cols; col++) {
+					if (maskRow[col] >= MinMaskValue)
+						AddSample(row*m_cols + col, valuesRow[col]);
+				}
+			}
+		});
+	}
+
+	inline void BrightnessHistory::GetPercentileImage(cv::Mat const & Mask, uint8_t MinMaskValue, cv::Mat & Out) const {
+		if ((Out.rows != m_rows) || (Out.cols != m_cols) || (Out.type() != CV_8UC1))
+			Out = cv::Mat(m_rows, m_cols, CV_8UC1);
+		if ((Mask.rows != m_rows) || (Mask.cols != m_cols) || (Mask.type() != CV_8UC1)) {
+			std::cerr << "Error in BrightnessHistory::GetPercentileImage(): Mask has wrong dimensions or type.\r\n";
+			Out.setTo(0);
+			return;
+		}
+
+		//With exact bins the bin index is the value. Otherwise report the center of the bin.
+		int binOffset = (m_binShift == 0) ? 0 : (1 << (m_binShift - 1));
+		for (int row = 0; row < m_rows; row++) {
+			uint8_t const * maskRow = Mask.ptr<uint8_t>(row);
+			uint8_t * outRow = Out.ptr<uint8_t>(row);
+			int pixel = row*m_cols;
+			for (int col = 0; col < m_cols; col++, pixel++) {
+				if ((maskRow[col] >= MinMaskValue) && (m_count[pixel] > 0U))
+					outRow[col] = (uint8_t) ((int(m_pBin[pixel]) << m_binShift) + binOffset);
+				else
+					outRow[col] = 0U;
+			}
+		}
+	}
+}
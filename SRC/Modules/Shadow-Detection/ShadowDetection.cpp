@@ -15,77 +15,30 @@
 //inline bool TimestampToGPSTime(TimePoint const & Timestamp, uint32_t & GPS_Week, double & GPS_TOW);
 
 namespace ShadowDetection {
-	//Save the shadow map history to an FRF file with the given path. Return true on success and false on failure
-	bool ShadowMapHistory::SaveFRFFile(std::filesystem::path const & Filepath) {
-		// Save entire ShadowMapHistory entry, which is a vector maps
-		// Generate a Layer with all the correct settings
-		FRFImage shadowMap;
-		//Set Image dimensions - this must be done now, when there are no layers in the image yet.
-		if (!shadowMap.SetWidth(512U))
-		std::cerr << "Failed to set image width.\r\n";
-		if (!shadowMap.SetHeight(512U))
-		std::cerr << "Failed to set image height.\r\n";
-		
-		//Create a shadow map info block and default the absolute time info to "unknown time"
-		ShadowMapInfoBlock myShadowMapInfoBlock;
-		myShadowMapInfoBlock.FileTimeEpoch_Week = 0U;
-		myShadowMapInfoBlock.FileTimeEpoch_TOW  = std::nan("");
-
-		//Grab the first timestamp and use it as our file time reference epoch
-		if (! Timestamps.empty()) {
-			//If we have the ability to get the absolute time of the file time 0 reference epoch, set the absolute time
-			uint32_t GPS_Week = 0U;
-			double   GPS_TOW  = std::nan("");
-			if (GNSSReceiver::GNSSManager::Instance().TimestampToGPSTime(Timestamps[0], GPS_Week, GPS_TOW)) {
-				myShadowMapInfoBlock.FileTimeEpoch_Week = GPS_Week;
-				myShadowMapInfoBlock.FileTimeEpoch_TOW  = GPS_TOW;
-			}
-		}
-
-		// Iterate through the Maps
-		for (int i = 0; i < (int) Maps.size(); i++){
-			//Add a new layer and set it up
-			FRFLayer* newLayer = shadowMap.AddLayer();
-			newLayer->Name = std::string("Shadow Map Layer");
-			newLayer->Description = std::string("0 = Unshadowed, 1 = Fully shadowed");
-			newLayer->UnitsCode = -1; //No units
-			newLayer->SetTypeCode(8U); //See Table 1 in the spec. We are going to use 8-bit unsigned integers for each pixel in this layer
-			newLayer->HasValidityMask = true; //Add validity info for each pixel in this layer
-			newLayer->SetAlphaAndBetaForGivenRange(0.0, 1.0); //Let the FRF lib set coefficients so values are in range [0,1]
-			newLayer->AllocateStorage(); //This needs to be called before the layer can be accessed
-			
-			set_NewValue((uint) shadowMap.Rows(), (uint) shadowMap.Rows(), newLayer, Maps[i]);
-
-			//Get timestamp as a number of seconds from the reference epoch
-			double layerFileTime = SecondsElapsed(Timestamps[0], Timestamps[i]);
-			myShadowMapInfoBlock.LayerTimeTags.push_back(layerFileTime);
-		}
-		
-		FRFVisualizationColormap* viz = shadowMap.AddVisualizationColormap();
-		viz->LayerIndex = 0U; //Base the visualization on the first layer of the shadow map
-		viz->SetPoints.push_back(std::make_tuple(0.0, 1.0, 1.0, 1.0)); //Map value 0 (unshadowed) to white (RGB all set to 1)
-		viz->SetPoints.push_back(std::make_tuple(1.0, 0.0, 0.0, 0.0)); //Map value 1 (fully shadowed) to black (RGB all set to 0)
-
-		FRFGeoRegistration GeoRegistrationTag;
-		GeoRegistrationTag.Altitude = std::nan(""); 
-		GeoRegistrationTag.RegisterFromCornerLocations(UL_LL, UR_LL, LL_LL, LR_LL);
-		shadowMap.SetGeoRegistration(GeoRegistrationTag);
-		//TODO: When we have the ability, set the GPST field of GeoRegistrationTag
-		std::cout << "Geo Reg Finished, Saving FRF" << std::endl;
-		if (!myShadowMapInfoBlock.AttachToFRFFile(shadowMap))
-			std::cerr << "Error adding shadow map info block... do we have the right number of time tags? There should be 1 per layer.\r\n";
-		
-		if (!shadowMap.SaveToDisk(Filepath)) {
-			std::cerr << "ShadowMapHistory::SaveFRFFile(). Error saving ShadowMapHistory\r\n";
-			return false;
+	//First pipeline stage: get the stabilization matrix that mostly aligns the frame with the reference frame
+	//On entry we already know that we have at least 3 fiducials and a non-empty reference frame
+	//The reference state is grabbed under the lock, but registration (feature detection, matching, and RT estimation) runs unlocked so other
+	//engine calls don't block on it. SetReferenceFrame() replaces the context and mask instead of modifying them, so our copies stay valid.
+	//The context is only used from the stabilization stage, so updating its previous transformation here doesn't race.
+	cv::Mat ShadowDetectionEngine::StabilizeFrame(cv::Mat const & Frame) {
+		std::shared_ptr<StabilizationContext> context;
+		cv::Mat apertureMask;
+		{
+			std::scoped_lock lock(m_shadowMapMutex);
+			context = m_stabilizationContext;
+			apertureMask = m_apertureMask;
 		}
+		cv::Mat H;
+		if (context == nullptr)
+			H = cv::Mat::eye(2, 3, CV_64F);
 		else
-			return true;
+			GetStabilizationMatrix(*context, Frame, apertureMask, H);
+		return H;
 	}
 	
-	//A lock is already held on the object when this function is called so don't lock it here
-	//On entry we also already know that we have at least 3 fiducials and a non-empty reference frame
-	void ShadowDetectionEngine::ProcessFrame(cv::Mat const & Frame, TimePoint const & Timestamp) {
+	//Second pipeline stage: Given a frame and its stabilization matrix (from StabilizeFrame()), compute a new shadow map and publish it
+	//On entry we already know that we have at least 3 fiducials and a non-empty reference frame
+	void ShadowDetectionEngine::ProcessFrame(cv::Mat const & Frame, cv::Mat const & H, TimePoint const & Timestamp) {
 		/*cv::Mat PreWarp(2, 3, CV_64F);
 		PreWarp.at<double>(0,0) = std::cos(25.0*PI/180.0);
 		PreWarp.at<double>(0,1) = -1.0*std::sin(25.0*PI/180.0);
@@ -148,15 +101,10 @@ namespace ShadowDetection {
 		bool newMethod = true;
 		cv::Mat shadowMap_EN;
 		if (newMethod) {
-			cv::Mat H;
-			m_shadowMapMutex.lock();
-			GetStabilizationMatrix(ref_descriptors, keypoints_ref, Frame, m_apertureMask, H, m_ReferenceFrame);
-			m_shadowMapMutex.unlock();
-
 			//Using the pose of the reference camera and the stabilization matrix, map to the EN plane
 			cv::Mat frame_EN, frameApertureMask_EN;
-			RawImageToENImage(Frame, o, R_Cam_ENU, CamCenter_ENU, center, max_extent, OUTPUT_RESOLUTION_PX, false, frame_EN, H);
-			RawImageToENImage(m_apertureMask, o, R_Cam_ENU, CamCenter_ENU, center, max_extent, OUTPUT_RESOLUTION_PX, false, frameApertureMask_EN, H);
+			//The camera projection is pre-computed in m_ENRemapX and m_ENRemapY so we only need to compose it with H here
+			RemapToENImage(Frame, m_apertureMask, m_ENRemapX, m_ENRemapY, frame_EN, frameApertureMask_EN, H);
 			cv::threshold(frameApertureMask_EN, frameApertureMask_EN, 220.0, 255.0, cv::THRESH_BINARY);
 
 			//Compute the current "brightness" image in the EN plane
@@ -176,35 +124,12 @@ namespace ShadowDetection {
 
 			//Update the brightness history for all unmasked pixels
 			auto T0 = std::chrono::steady_clock::now();
-			size_t maxHistoryLength = 120U;
-			for (int row = 0; row < currentBrightness_EN.rows; row++) {
-				for (int col = 0; col < currentBrightness_EN.cols; col++) {
-					if (mask_EN.at<uint8_t>(row, col) >= (uint8_t) 128) {
-						m_brightnessHist_EN[row][col].push_back(currentBrightness_EN.at<uint8_t>(row, col));
-						if (m_brightnessHist_EN[row][col].size() > maxHistoryLength)
-							m_brightnessHist_EN[row][col].pop_front();
-					}
-				}
-			}
+			m_brightnessHist_EN.Push(currentBrightness_EN, mask_EN, (uint8_t) 128);
 			auto T1 = std::chrono::steady_clock::now();
 
 			//Compute the reference brightness image
-			cv::Mat refBrightness_EN(currentBrightness_EN.rows, currentBrightness_EN.cols, CV_8UC1, cv::Scalar(0));
-			for (int row = 0; row < refBrightness_EN.rows; row++) {
-				for (int col = 0; col < refBrightness_EN.cols; col++) {
-					if (mask_EN.at<uint8_t>(row, col) >= (uint8_t) 128) {
-						std::deque<uint8_t> hist = m_brightnessHist_EN[row][col]; //Get a copy of the history to partially sort
-						if (hist.empty())
-							std::cerr << "Internal error: Shouldn't have empty history for any unmasked pixels.\r\n";
-
-						//Get the 90'th percentile brightness value for this pixel
-						int index = (int) std::round(0.9*double(hist.size() - 1U));
-						index = std::clamp(index, 0, int(hist.size() - 1U));
-						std::nth_element(hist.begin(), hist.begin() + index, hist.end());
-						refBrightness_EN.at<uint8_t>(row,col) = hist[index];
-					}
-				}
-			}
+			cv::Mat refBrightness_EN;
+			m_brightnessHist_EN.GetPercentileImage(mask_EN, (uint8_t) 128, refBrightness_EN);
 			auto T2 = std::chrono::steady_clock::now();
 
 			bool printProcessingTimes = false;
@@ -271,116 +196,20 @@ namespace ShadowDetection {
 				cv::waitKey(1);
 			}
 
-			//Find the pixelwise brightness over the reference brightness, saturating at 1
-			cv::Mat relBrightness_EN;
-			cv::divide(currentBrightness_EN, refBrightness_EN, relBrightness_EN, 255);
-			//cv::addWeighted(refBrightness_EN, -1.0, currentBrightness_EN, 1.0, 255.0, relBrightness_EN);
-
 			//Fade in from the periphery of the visible area
 			cv::Mat erodedMask1_EN, erodedMask2_EN, erodedMask3_EN;
 			cv::erode(mask_EN, erodedMask1_EN, cv::Mat(), cv::Point(-1,-1), 2);
 			cv::erode(erodedMask1_EN, erodedMask2_EN, cv::Mat(), cv::Point(-1,-1), 3);
 			cv::erode(erodedMask2_EN, erodedMask3_EN, cv::Mat(), cv::Point(-1,-1), 3);
-			cv::Mat ring1, ring2, ring3;
-			cv::subtract(mask_EN, erodedMask1_EN, ring1);
-			cv::subtract(erodedMask1_EN, erodedMask2_EN, ring2);
-			cv::subtract(erodedMask2_EN, erodedMask3_EN, ring3);
-
-			cv::Mat multiplierMat;
-			cv::addWeighted(ring1, 1.0, ring2, 0.9, 0.0, multiplierMat);
-			cv::addWeighted(multiplierMat, 1.0, ring3, 0.8, 0.0, multiplierMat);
-			cv::addWeighted(multiplierMat, 1.0, erodedMask3_EN, 0.7, 0.0, multiplierMat);
-
-			cv::multiply(relBrightness_EN, multiplierMat, relBrightness_EN, 1.0/178.0);
-			relBrightness_EN.setTo(255, mask_EN < 128);
-
-			/*cv::Mat ringVis(mask_EN.rows, mask_EN.cols, CV_8UC3, cv::Scalar(0,0,0));
-			ringVis.setTo(cv::Scalar(255,0,0), ring1 > 128);
-			ringVis.setTo(cv::Scalar(0,255,0), ring2 > 128);
-			ringVis.setTo(cv::Scalar(0,0,255), ring3 > 128);
-			cv::imshow("Rings", multiplierMat);
-			cv::waitKey(1);*/
+
+			//Find the pixelwise brightness over the reference brightness, saturating at 1, and apply the ring fade-in weights
+			cv::Mat relBrightness_EN;
+			ComputeRelativeBrightness(currentBrightness_EN, refBrightness_EN, mask_EN, erodedMask1_EN, erodedMask2_EN, erodedMask3_EN, relBrightness_EN);
 
 			//Look for dark areas in the rel brightness image using multiple thresholds.
 			//We allow an small area to be detected if the brightness reduction is substantial,
 			//but require larger continuous area of reduced brightness for smaller reductions in brightness
-			{
-				std::vector<std::vector<cv::Point>> contours;
-				std::vector<cv::Vec4i> hierarchy;
-				cv::Mat threshImage;
-				
-				double threshold = 178.0;  //30% reduction in brightness
-				double minArea   = 200.0; //Approximately 0.1% of visible pixels
-				cv::threshold(relBrightness_EN, threshImage, threshold, 255.0, cv::THRESH_BINARY_INV);
-				cv::Mat shadowImage1(relBrightness_EN.rows, relBrightness_EN.cols, CV_8UC1, cv::Scalar(0));
-				cv::findContours(threshImage, contours, hierarchy, cv::RETR_CCOMP, cv::CHAIN_APPROX_NONE);
-				for (int n = 0; n < (int) contours.size(); n++) {
-					if ((hierarchy[n][3] < 0) && (cv::contourArea(contours[n]) > minArea)) {
-						cv::drawContours(shadowImage1, contours, n, cv::Scalar(254), -1);
-						int childIndex = hierarchy[n][2];
-						while (childIndex >= 0) {
-							if (cv::contourArea(contours[childIndex]) > minArea/5.0)
-								cv::drawContours(shadowImage1, contours, childIndex, cv::Scalar(0), -1);
-							childIndex = hierarchy[childIndex][0];
-						}
-					}
-				}
-
-				threshold = 204.0;  //20% reduction in brightness
-				//minArea   = 2071.0; //Approximately 1% of visible pixels
-				minArea   = 200.0; //Approximately 0.1% of visible pixels
-				contours.clear();
-				hierarchy.clear();
-				cv::threshold(relBrightness_EN, threshImage, threshold, 255.0, cv::THRESH_BINARY_INV);
-				cv::Mat shadowImage2(relBrightness_EN.rows, relBrightness_EN.cols, CV_8UC1, cv::Scalar(0));
-				cv::findContours(threshImage, contours, hierarchy, cv::RETR_CCOMP, cv::CHAIN_APPROX_NONE);
-				for (int n = 0; n < (int) contours.size(); n++) {
-					if ((hierarchy[n][3] < 0) && (cv::contourArea(contours[n]) > minArea)) {
-						cv::drawContours(shadowImage2, contours, n, cv::Scalar(254), -1);
-						int childIndex = hierarchy[n][2];
-						while (childIndex >= 0) {
-							if (cv::contourArea(contours[childIndex]) > minArea/5.0)
-								cv::drawContours(shadowImage2, contours, childIndex, cv::Scalar(0), -1);
-							childIndex = hierarchy[childIndex][0];
-						}
-					}
-				}
-
-				threshold = 217.0;  //15% reduction in brightness
-				//minArea   = 4142.0; //Approximately 2% of visible pixels
-				minArea   = 200.0; //Approximately 0.1% of visible pixels
-				contours.clear();
-				hierarchy.clear();
-				cv::threshold(relBrightness_EN, threshImage, threshold, 255.0, cv::THRESH_BINARY_INV);
-				cv::Mat shadowImage3(relBrightness_EN.rows, relBrightness_EN.cols, CV_8UC1, cv::Scalar(0));
-				cv::findContours(threshImage, contours, hierarchy, cv::RETR_CCOMP, cv::CHAIN_APPROX_NONE);
-				for (int n = 0; n < (int) contours.size(); n++) {
-					if ((hierarchy[n][3] < 0) && (cv::contourArea(contours[n]) > minArea)) {
-						cv::drawContours(shadowImage3, contours, n, cv::Scalar(254), -1);
-						int childIndex = hierarchy[n][2];
-						while (childIndex >= 0) {
-							if (cv::contourArea(contours[childIndex]) > minArea/5.0)
-								cv::drawContours(shadowImage3, contours, childIndex, cv::Scalar(0), -1);
-							childIndex = hierarchy[childIndex][0];
-						}
-					}
-				}
-				
-				//imshow("Temp", threshImage);
-				//cv::waitKey(1);
-
-				/*cv::Mat vis(relBrightness_EN.rows, relBrightness_EN.cols, CV_8UC3, cv::Scalar(0,0,0));
-				vis.setTo(cv::Scalar(255,0,0), shadowImage3 > 0);
-				vis.setTo(cv::Scalar(0,255,0), shadowImage2 > 0);
-				vis.setTo(cv::Scalar(0,0,255), shadowImage1 > 0);
-				imshow("Shadows", vis);
-				cv::waitKey(1);*/
-
-				cv::Mat temp(relBrightness_EN.rows, relBrightness_EN.cols, CV_8UC1);
-				cv::max(shadowImage1, shadowImage2, temp);
-				cv::max(temp, shadowImage3, shadowMap_EN);
-				shadowMap_EN.setTo(255, mask_EN < 128);
-			}
+			m_segmenter.Segment(relBrightness_EN, mask_EN, shadowMap_EN);
 
 			//Threshold the relative brightness image
 			//cv::threshold(relBrightness_EN, shadowMap_EN, 200.0, 254.0, cv::THRESH_BINARY_INV);
@@ -391,10 +220,7 @@ namespace ShadowDetection {
 		}
 		else {
 			//Compute new shadow map based on the newly received frame
-			cv::Mat H;
-			//H = cv::Mat::eye(2, 3, CV_64F);
 			m_shadowMapMutex.lock();
-			GetStabilizationMatrix(ref_descriptors, keypoints_ref, Frame, m_apertureMask, H, m_ReferenceFrame);
 			auto refFrameSize = m_ReferenceFrame.size();
 			m_shadowMapMutex.unlock();
 
@@ -487,30 +313,19 @@ namespace ShadowDetection {
 			}
 		}
 
-		//Update m_ShadowMap and m_History - copy current shadow map to pass to callbacks
+		//Build the published shadow map and update m_History. shadowMap_EN is freshly allocated for each frame and is never modified
+		//after this point, so the published map, the history, and every subscriber share the same pixel data.
 		m_shadowMapMutex.lock();
-
-		m_ShadowMap.Map = shadowMap_EN; //Shadow map based on most recently processed frame
-		m_ShadowMap.Timestamp = Timestamp;
+		std::shared_ptr<InstantaneousShadowMap> shadowMap = std::make_shared<InstantaneousShadowMap>(m_ShadowMap);
+		shadowMap->Map = shadowMap_EN;
+		shadowMap->Timestamp = Timestamp;
 
 		//Update m_History (Essentially a vector of ShadowMap Histories)
-		m_History.back().Maps.push_back(shadowMap_EN); //Record of all computed shadow maps - add new element when ref frame changes (since registration changes)
-		m_History.back().Timestamps.push_back(Timestamp);
-
-		InstantaneousShadowMap shadowMapCopy(m_ShadowMap); //Copy shadow map for use in callbacks (so we can release lock now)
+		m_History.back()->Append(shadowMap_EN, Timestamp); //Record of all computed shadow maps - add new element when ref frame changes (since registration changes)
 		m_shadowMapMutex.unlock();
 
-		//Check the callbacks staging zone for changes to our callbacks
-		m_callbacks_stagingMutex.lock();
-		if (m_callback_stagingModified) {
-			m_callbacks = m_callbacks_staging;
-			m_callback_stagingModified = false;
-		}
-		m_callbacks_stagingMutex.unlock();
-
-		//Call any registered callbacks - we don't need to lock the callback staging mutex for this.
-		for (auto const & kv : m_callbacks)
-			kv.second(shadowMapCopy);
+		//Publish - this makes the map available through the accessors and passes a handle to every registered callback
+		m_shadowMapChannel.Publish(shadowMap);
 	}
 	
 	//Set the reference frame to be used for registration and stabilization (all other frames are aligned to the reference frame)
@@ -526,14 +341,22 @@ namespace ShadowDetection {
 			return;
 		}
 		
+		//Compute the aperture mask and the reference keypoints and descriptors into fresh objects - StabilizeFrame() may hold onto the old ones
+		cv::Mat apertureMask;
+		getApertureMask(RefFrame, apertureMask);
+		std::vector<cv::KeyPoint> keypoints_ref;
+		cv::Mat ref_descriptors;
+		GetKeypointsAndDescriptors(RefFrame, keypoints_ref, ref_descriptors, apertureMask);
+		auto context = std::make_shared<StabilizationContext>();
+		context->SetReference(keypoints_ref, ref_descriptors);
+
 		std::scoped_lock lock(m_shadowMapMutex);
 
-		//Save the reference frame and compute the aperture mask
+		//Save the reference frame, aperture mask, and stabilization context
 		RefFrame.copyTo(m_ReferenceFrame);
-		getApertureMask(RefFrame, m_apertureMask);
-
-		//Compute reference keypoints and descriptors
-		GetKeypointsAndDescriptors(RefFrame, keypoints_ref, ref_descriptors, m_apertureMask);
+		m_apertureMask = apertureMask;
+		m_stabilizationContext = context;
+		m_lastH = cv::Mat(); //Stabilization matrices for the old reference frame are no longer meaningful
 
 		//Initialize "brightest" to the value channel of the reference frame
 		cv::Mat hsv;
@@ -595,18 +418,32 @@ namespace ShadowDetection {
 		poseLEA2ENU(LEAOrigin_ECEF, R_Cam_LEA, CamCenter_LEA, R_Cam_ENU, CamCenter_ENU, ENUOrigin_ECEF);
 
     		get_centered_extent(LEAOrigin_ECEF, APERTURE_DISTANCE_PX, FINAL_SIZE, R_Cam_ENU, CamCenter_ENU, CamCenter_LEA, o, center, max_extent);
+		
+		//The mapping from the EN plane to the reference image only depends on the pose, camera model, and EN grid - cache it
+		BuildENRemapTable(o, R_Cam_ENU, CamCenter_ENU, center, max_extent, OUTPUT_RESOLUTION_PX, m_ENRemapX, m_ENRemapY);
     		
     		TryInitShadowMapAndHistory();
 	}
 	
+	//Set the length of the per-pixel brightness history and the percentile of it used as the reference brightness
+	void ShadowDetectionEngine::SetBrightnessReferenceParams(int HistoryLength, double Percentile) {
+		if (m_running) {
+			std::cerr << "Error in ShadowDetectionEngine::SetBrightnessReferenceParams(): Module is currently running.\r\n";
+			return;
+		}
+		
+		std::scoped_lock lock(m_shadowMapMutex);
+		m_brightnessHistLength    = std::clamp(HistoryLength, 1, BrightnessHistory::MaxHistoryLength);
+		m_brightnessRefPercentile = std::clamp(Percentile, 0.0, 1.0);
+	}
+	
 	//Sets the corner coords in both m_ShadowMap and m_History if GCPs and a ref frame are set
 	//Also performs additional initialization that can only happen once fiducials and the reference frame have been set
 	//A lock should already be held on m_shadowMapMutex
 	void ShadowDetectionEngine::TryInitShadowMapAndHistory(void) {
 		if ((! m_ReferenceFrame.empty()) && (! m_Fiducials.empty())) {
 			cv::Mat refFrame_EN, refFrameGray_EN;
-			RawImageToENImage(m_ReferenceFrame, o, R_Cam_ENU, CamCenter_ENU, center, max_extent, OUTPUT_RESOLUTION_PX, false, refFrame_EN);
-			RawImageToENImage(m_apertureMask, o, R_Cam_ENU, CamCenter_ENU, center, max_extent, OUTPUT_RESOLUTION_PX, false, m_refFrameApertureMask_EN);
+			RemapToENImage(m_ReferenceFrame, m_apertureMask, m_ENRemapX, m_ENRemapY, refFrame_EN, m_refFrameApertureMask_EN);
 			cv::threshold(m_refFrameApertureMask_EN, m_refFrameApertureMask_EN, 220.0, 255.0, cv::THRESH_BINARY);
 			cv::cvtColor(refFrame_EN, refFrameGray_EN, cv::COLOR_BGR2GRAY);
 
@@ -614,14 +451,8 @@ namespace ShadowDetection {
 			MAFilter(refFrameGray_EN, m_refFrameApertureMask_EN, refBrightness_EN, 15);
 			refBrightness_EN.setTo(0, m_refFrameApertureMask_EN < 128);
 
-			m_brightnessHist_EN.clear();
-			m_brightnessHist_EN.resize(refBrightness_EN.rows, std::vector<std::deque<uint8_t>>(refBrightness_EN.cols));
-			for (int row = 0; row < refBrightness_EN.rows; row++) {
-				for (int col = 0; col < refBrightness_EN.cols; col++) {
-					if (m_refFrameApertureMask_EN.at<uint8_t>(row, col) > (uint8_t) 0)
-						m_brightnessHist_EN[row][col].push_back(refBrightness_EN.at<uint8_t>(row, col));
-				}
-			}
+			m_brightnessHist_EN.Reset(refBrightness_EN.rows, refBrightness_EN.cols, m_brightnessHistLength, m_brightnessRefPercentile);
+			m_brightnessHist_EN.Push(refBrightness_EN, m_refFrameApertureMask_EN, (uint8_t) 1);
 
 			Eigen::Vector2d UL(0, 0);
 			Eigen::Vector2d UR(OUTPUT_RESOLUTION_PX - 1, 0);
@@ -643,11 +474,11 @@ namespace ShadowDetection {
 			m_ShadowMap.LR_LL << LR_LLA(0), LR_LLA(1);
 			
 			//set up new element of shadowMapHistory and set the corners
-			m_History.emplace_back();
-			m_History.back().UL_LL << UL_LLA(0), UL_LLA(1);
-			m_History.back().UR_LL << UR_LLA(0), UR_LLA(1);
-			m_History.back().LL_LL << LL_LLA(0), LL_LLA(1);
-			m_History.back().LR_LL << LR_LLA(0), LR_LLA(1);
+			m_History.push_back(std::make_shared<ShadowMapHistory>(m_historyMemoryBudget, HistorySpillDirectory()));
+			m_History.back()->UL_LL << UL_LLA(0), UL_LLA(1);
+			m_History.back()->UR_LL << UR_LLA(0), UR_LLA(1);
+			m_History.back()->LL_LL << LL_LLA(0), LL_LLA(1);
+			m_History.back()->LR_LL << LR_LLA(0), LR_LLA(1);
 		}
 	}
 }
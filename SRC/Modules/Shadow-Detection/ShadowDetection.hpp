@@ -8,12 +8,16 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
 #include <iostream>
 #include <iomanip>
 #include <ctime>
 #include <sstream>
 #include <system_error>
 #include <unordered_map>
+#include <memory>
 
 //External Includes
 #include "../../../../handycpp/Handy.hpp"
@@ -23,12 +27,20 @@
 
 //Project Includes
 #include "../../EigenAliases.h"
+#include "../../Utilities.hpp"
+#include "../../FrameChannel.hpp"
 #include "../DJI-Drone-Interface/DroneManager.hpp"
 #include "ocam_utils.h"
+#include "BrightnessHistory.hpp"
+#include "ShadowSegmentation.hpp"
+#include "StabilizationContext.hpp"
+#include "ShadowMapHistory.hpp"
 
 namespace ShadowDetection {
 	using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
 	
+	//Shadow maps are published once by the shadow detection engine as immutable, reference-counted objects (see ShadowMapHandle).
+	//Copies share pixel data (cv::Mat semantics) - use Clone() to get a copy with its own pixel data if you need to modify the map.
 	class InstantaneousShadowMap {
 		public:
 			EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -41,63 +53,90 @@ namespace ShadowDetection {
 			TimePoint Timestamp;
 
 			InstantaneousShadowMap() = default;
-			InstantaneousShadowMap(InstantaneousShadowMap const & Other) {
-				Other.Map.copyTo(this->Map); //Deep copy the map
-				this->UL_LL     = Other.UL_LL;
-				this->UR_LL     = Other.UR_LL;
-				this->LL_LL     = Other.LL_LL;
-				this->LR_LL     = Other.LR_LL;
-				this->Timestamp = Other.Timestamp;
+			~InstantaneousShadowMap() = default;
+			
+			InstantaneousShadowMap Clone(void) const {
+				InstantaneousShadowMap copy(*this);
+				CountedCopy(this->Map, copy.Map); //Deep copy the map
+				return copy;
 			}
 	};
+	using ShadowMapHandle = std::shared_ptr<const InstantaneousShadowMap>;
 	
-	//This class holds a sequence of instantaneous shadow maps corresponding to different instants in time, but with the same
-	//registration data (pixel (n,m) corresponds to the same point on the ground in all maps).
-	class ShadowMapHistory {
-		public:
-			EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-			
-			std::vector<cv::Mat> Maps;         //Same definition as in InstantaneousShadowMap
-			std::vector<TimePoint> Timestamps; //Item n is the timestamp for Maps[n]
-			Eigen::Vector2d UL_LL; //(Latitude, Longitude) of center of upper-left pixel, in radians
-			Eigen::Vector2d UR_LL; //(Latitude, Longitude) of center of upper-right pixel, in radians
-			Eigen::Vector2d LL_LL; //(Latitude, Longitude) of center of lower-left pixel, in radians
-			Eigen::Vector2d LR_LL; //(Latitude, Longitude) of center of lower-right pixel, in radians
-			
-			bool SaveFRFFile(std::filesystem::path const & Filepath);
+	//Policy for handling frames when the drone feed outpaces processing
+	enum class FrameDropPolicy : int {
+		DropOldest = 0,        //When the input queue is full, drop the oldest queued frame
+		SkipStabilization = 1, //When the input queue is backed up, skip keypoint stabilization and reuse the last stabilization matrix
+		                       //(the queue is still bounded - if it fills anyway the oldest frame is dropped)
+		None = 2               //Unbounded queue - never drop frames (only appropriate for non-realtime simulations)
+	};
+	
+	//Processing statistics for the shadow detection pipeline. Latencies are exponential moving averages, in milliseconds.
+	struct PipelineStats {
+		uint64_t FramesReceived = 0U;             //Frames queued for processing
+		uint64_t FramesDropped = 0U;              //Frames dropped from the input queue
+		uint64_t FramesStabilizationSkipped = 0U; //Frames processed with the previous stabilization matrix
+		uint64_t FramesProcessed = 0U;            //Frames that made it all the way through the pipeline
+		size_t   InputQueueLength = 0U;           //Frames waiting for stabilization
+		size_t   StabilizedQueueLength = 0U;      //Frames waiting for EN-plane processing and segmentation
+		double   InputQueueWait_ms = 0.0;         //Time from frame timestamp to start of stabilization
+		double   Stabilization_ms = 0.0;          //Keypoints + stabilization matrix estimation
+		double   StabilizedQueueWait_ms = 0.0;    //Time between stabilization finishing and EN-plane processing starting
+		double   ENProcessing_ms = 0.0;           //EN resampling, brightness history, segmentation, and callbacks
+		double   EndToEnd_ms = 0.0;               //Time from frame timestamp to shadow map publication
 	};
 	
 	//Singleton class for the shadow detection system
+	//Processing is split into two pipeline stages, each on its own thread: stabilization (ModuleMain) and EN-plane processing and
+	//segmentation (SegmentationMain). This lets stabilization of frame N+1 overlap with processing of frame N. Both stages are
+	//FIFO so shadow maps are published in frame order.
 	class ShadowDetectionEngine {
 		private:
-			std::thread       m_engineThread;
+			std::thread       m_engineThread;       //Stage 1: Drone connection and stabilization
+			std::thread       m_segmentationThread; //Stage 2: EN-plane processing, segmentation, and publication
 			std::atomic<bool> m_running;
 			std::atomic<bool> m_abort;
 			std::atomic<bool> m_autosaveOnStop;
 			
-			//We use a staging area to register and unregister callbacks. In ProcessFrame(), we check to see if the staging area has
-			//been modified and update our "official" callbacks structure if necessary. This allows us to invoke our callbacks
-			//without holding a lock on our callback mutex, but it also only triggers a copy when a callback is registered or unregistered.
-			//m_callbacks and m_callbacks_staging are kept synchronized.
-			std::mutex m_callbacks_stagingMutex;
-			bool m_callback_stagingModified = false;
-			std::unordered_map<int, std::function<void(InstantaneousShadowMap const & ShadowMap)>> m_callbacks_staging;
-			
-			std::unordered_map<int, std::function<void(InstantaneousShadowMap const & ShadowMap)>> m_callbacks; //Only used in ProcessFrame()
+			//New shadow maps are published through this channel. It holds the most recent shadow map and hands every subscriber a
+			//reference-counted handle to it (no copies), without holding a lock while callbacks run.
+			FrameChannel<InstantaneousShadowMap> m_shadowMapChannel;
 			
 			//These are not directly accessed in ProcessFrame()
 			std::mutex m_ImageProviderMutex;
 			std::string m_ImageProviderDroneSerial; //Empty if none
 			DroneInterface::Drone * m_ImageProviderDrone = nullptr; //Pointer to image provider drone
 			int m_DroneImageCallbackHandle = -1;    //Handle for image callback (if registered). -1 if none registered.
-			std::vector<std::tuple<cv::Mat, TimePoint>> m_unprocessedFrames;
+			std::deque<std::tuple<cv::Mat, TimePoint>> m_unprocessedFrames; //Input queue - bounded by m_maxQueuedFrames unless policy is None
+			size_t m_maxQueuedFrames = 8U;
+			FrameDropPolicy m_dropPolicy = FrameDropPolicy::DropOldest;
+			
+			//Hand-off queue between the stabilization stage and the EN-plane processing stage. This is kept short - when it is full the
+			//stabilization stage waits, so any backlog accumulates in m_unprocessedFrames where the drop policy is applied.
+			struct StabilizedFrame {
+				cv::Mat   Frame;
+				cv::Mat   H;
+				TimePoint Timestamp;
+				TimePoint StabilizedTime;
+			};
+			static constexpr size_t MaxStabilizedFrames = 2U;
+			std::mutex m_stabilizedFramesMutex;
+			std::condition_variable m_stabilizedFramesCV;
+			std::deque<StabilizedFrame> m_stabilizedFrames;
+			cv::Mat m_lastH; //Accessed in stabilization stage. Reset in SetReferenceFrame() (which fails if module is running)
+			
+			std::mutex m_statsMutex;
+			PipelineStats m_stats;
 			
 			//These variables are modified in ProcessFrame()
 			std::mutex m_shadowMapMutex; //Protects the fields in this block
-			InstantaneousShadowMap m_ShadowMap; //Shadow map based on most recently processed frame
-			std::Evector<ShadowMapHistory> m_History; //Record of all computed shadow maps - add new element when ref frame changes (since registration changes)
+			InstantaneousShadowMap m_ShadowMap; //Registration of published shadow maps (corner coordinates) - pixel data is set on publication
+			std::vector<std::shared_ptr<ShadowMapHistory>> m_History; //Record of all computed shadow maps - add new element when ref frame changes (since registration changes)
+			size_t m_historyMemoryBudget = 64U*1024U*1024U; //Max bytes of (compressed) shadow maps each history keeps in RAM before spilling to disk
 			cv::Mat m_ReferenceFrame; //Computed in SetReferenceFrame()
 			std::Evector<std::tuple<Eigen::Vector2d, Eigen::Vector3d>> m_Fiducials; //Set in SetFiducials() - see method for structure
+			std::shared_ptr<StabilizationContext> m_stabilizationContext; //Reference keypoints and descriptors - replaced in SetReferenceFrame()
+			cv::Mat m_apertureMask; //Mask of which pixels are valid (in raw image space) - replaced, never modified in place, in SetReferenceFrame(). ProcessFrame() reads it unlocked (SetReferenceFrame() fails while running)
 			
 			//These variables can safely be accessed in ProcessFrame without locking since the other methods that modify them fail if module is running
 			//Some of these are only used in one or the two implementations in ProcessFrame().
@@ -108,15 +147,20 @@ namespace ShadowDetection {
 			Eigen::Matrix3d R_Cam_ENU;      //Computed in SetFiducials()
     			Eigen::Vector3d CamCenter_ENU;  //Computed in SetFiducials()
 			struct ocam_model o;            //Set in SetFiducials()
-			cv::Mat ref_descriptors;        //Computed in SetReferenceFrame()
-			std::vector<cv::KeyPoint> keypoints_ref; //Computed in SetReferenceFrame()
+			cv::Mat m_ENRemapX;             //Computed in SetFiducials() - Reference image col for each EN-plane pixel (see BuildENRemapTable())
+			cv::Mat m_ENRemapY;             //Computed in SetFiducials() - Reference image row for each EN-plane pixel (see BuildENRemapTable())
 			cv::Mat brightest;              //Initialized in SetReferenceFrame(), updated in ProcessFrame()
-			cv::Mat m_apertureMask;         //Mask of which pixels are valid (in raw image space - no distortion correction, etc.)
 			cv::Mat m_refFrameApertureMask_EN;
-			std::vector<std::vector<std::deque<uint8_t>>> m_brightnessHist_EN; //[row][col] -> deque of recent values for the given pixel
+			BrightnessHistory m_brightnessHist_EN;  //History of recent brightness values for each EN-plane pixel
+			int    m_brightnessHistLength = 120;     //Max number of samples in m_brightnessHist_EN for each pixel
+			double m_brightnessRefPercentile = 0.9;  //Percentile of brightness history used as the reference brightness for each pixel
+			ShadowSegmenter m_segmenter;           //Multi-threshold segmentation of relative brightness into shadow maps
 			
 			inline void ModuleMain(void);
-			void ProcessFrame(cv::Mat const & Frame, TimePoint const & Timestamp);
+			inline void SegmentationMain(void);
+			cv::Mat StabilizeFrame(cv::Mat const & Frame);
+			void ProcessFrame(cv::Mat const & Frame, cv::Mat const & H, TimePoint const & Timestamp);
+			inline void UpdateLatencyStat(double & Stat, double NewValue_ms);
 			
 			void TryInitShadowMapAndHistory(void); //Sets the corner coords in both m_ShadowMap and m_History if GCPs and a ref frame are provided
 			
@@ -126,8 +170,10 @@ namespace ShadowDetection {
 			static ShadowDetectionEngine & Instance() { static ShadowDetectionEngine Obj; return Obj; }
 			
 			//Constructors and Destructors
-			ShadowDetectionEngine() : m_running(false), m_abort(false), m_autosaveOnStop(false) {
-				m_engineThread = std::thread(&ShadowDetectionEngine::ModuleMain, this);
+			ShadowDetectionEngine() : m_running(false), m_abort(false), m_autosaveOnStop(false),
+			                          m_shadowMapChannel([](InstantaneousShadowMap const & Map) { return MatBytes(Map.Map); }) {
+				m_engineThread       = std::thread(&ShadowDetectionEngine::ModuleMain, this);
+				m_segmentationThread = std::thread(&ShadowDetectionEngine::SegmentationMain, this);
 			}
 			~ShadowDetectionEngine() { Shutdown(); }
 			inline void Shutdown(void);  //Stop processing and terminate engine thread
@@ -137,8 +183,13 @@ namespace ShadowDetection {
 			inline bool        IsRunning(void);                        //Returns true if running, false if stopped
 			inline std::string GetProviderDroneSerial(void);           //Returns serial of drone we are getting imagery from (empty string if not running)
 			inline int         RegisterCallback(std::function<void(InstantaneousShadowMap const & ShadowMap)> Callback); //Regester callback for new shadow maps
+			inline int         RegisterCallback(std::function<void(ShadowMapHandle const & ShadowMap)> Callback); //Same, but receive a handle you can keep
 			inline void        UnRegisterCallback(int Handle); //Unregister callback for new shadow maps (input is token returned by RegisterCallback()
 			
+			//Set the max number of frames waiting for processing and what to do when frames arrive faster than they can be processed
+			inline void          SetFrameQueuePolicy(size_t MaxQueuedFrames, FrameDropPolicy Policy);
+			inline PipelineStats GetPipelineStats(void); //Get a snapshot of the processing statistics
+			
 			//Set the reference frame to be used for registration and stabilization (all other frames are aligned to the reference frame)
 			void SetReferenceFrame(cv::Mat const & RefFrame);
 			inline bool IsReferenceFrameSet(void);
@@ -149,14 +200,29 @@ namespace ShadowDetection {
 			void SetFiducials(std::Evector<std::tuple<Eigen::Vector2d, Eigen::Vector3d>> const & Fiducials);
 			inline size_t GetNumberOfFiducials(void);
 			
+			//Set the number of frames of brightness history kept for each EN-plane pixel (at most 255) and the percentile of that
+			//history (in [0,1]) used as the unshadowed reference brightness. Takes effect the next time the history is initialized
+			//(when the reference frame or fiducials are set). Fails if the module is running.
+			void SetBrightnessReferenceParams(int HistoryLength, double Percentile);
+			
 			//Accessors - Each returns false if no shadow maps have been computed yet.
 			inline bool GetTimestampOfMostRecentShadowMap(TimePoint & Timestamp);
-			inline bool GetMostRecentShadowMap(InstantaneousShadowMap & ShadowMap);
+			inline bool GetMostRecentShadowMap(InstantaneousShadowMap & ShadowMap); //Shares pixel data with the published map
+			inline bool GetMostRecentShadowMap(ShadowMapHandle & ShadowMap);
+			
+			//Get the recorded shadow map in effect at the given time (the last one computed at or before Timestamp). Returns false if there
+			//is none. This may need to read a spilled chunk of the history from disk, so avoid calling it from the draw thread.
+			inline bool GetHistoricalShadowMap(TimePoint const & Timestamp, InstantaneousShadowMap & ShadowMap);
+			
+			//Set the max bytes of (compressed) shadow maps each history keeps in RAM - older maps are spilled to disk. Applies to new histories.
+			inline void SetShadowMapHistoryMemoryBudget(size_t Bytes);
 			
-			//Save accumulated shadow map history to a mission folder on disk and clear the in-memory history. Should be called after a mission.
-			//Note: During a mission we just accumulate shadow maps in memory and delay the FRF file generation until the mission is over. This
-			//results in about 15 MB / minute of memory demand if processing imagery ad 1 FPS. A 30 minute mission would amount to about 450 MB,
-			//which is an acceptable hit in exchange for delaying the processing burden until a mission is over.
+			//Folder that shadow map histories spill older maps to
+			static std::filesystem::path HistorySpillDirectory(void) { return Handy::Paths::ThisExecutableDirectory() / "Shadow Map Files" / "Spill"; }
+			
+			//Save accumulated shadow map history to a mission folder on disk and clear the history. Should be called after a mission.
+			//Note: During a mission the history keeps recent shadow maps in memory (compressed) and spills older ones to disk. Saving
+			//streams both back into one FRF file per shadow map sequence (see ShadowMapHistory::SaveFRFFile()).
 			inline void SaveAndFlushShadowMapHistory(void);
 	};
 
@@ -164,9 +230,16 @@ namespace ShadowDetection {
 		if (m_running)
 			Stop(); //Gracefully stop processing - will also trigger save if still running on real drone
 		
-		m_abort = true;
+		//Set the flag under the hand-off queue lock so a pipeline stage can't check it and then miss the notification
+		{
+			std::scoped_lock stabilizedLock(m_stabilizedFramesMutex);
+			m_abort = true;
+		}
+		m_stabilizedFramesCV.notify_all();
 		if (m_engineThread.joinable())
 			m_engineThread.join();
+		if (m_segmentationThread.joinable())
+			m_segmentationThread.join();
 	}
 
 	inline void ShadowDetectionEngine::Start(std::string const & DroneSerial) {
@@ -181,6 +254,14 @@ namespace ShadowDetection {
 		}
 		m_ImageProviderDroneSerial = DroneSerial; //Actual connection will occur in ModuleMain()
 		m_unprocessedFrames.clear(); //Clear any unprocessed imagery
+		{
+			std::scoped_lock stabilizedLock(m_stabilizedFramesMutex);
+			m_stabilizedFrames.clear();
+		}
+		{
+			std::scoped_lock statsLock(m_statsMutex);
+			m_stats = PipelineStats();
+		}
 		m_autosaveOnStop = false; //Default to false - will be set to true on drone connection if drone is real
 		m_running = true;
 	}
@@ -197,6 +278,13 @@ namespace ShadowDetection {
 		}
 		m_running = false;
 		m_ImageProviderMutex.unlock();
+		
+		//Drop anything waiting for the second pipeline stage and wake the first stage if it is waiting to hand off a frame. m_running
+		//is already cleared, and taking the queue lock before notifying means a waiting stage either sees that or gets the notification.
+		m_stabilizedFramesMutex.lock();
+		m_stabilizedFrames.clear();
+		m_stabilizedFramesMutex.unlock();
+		m_stabilizedFramesCV.notify_all();
 
 		if (m_autosaveOnStop)
 			SaveAndFlushShadowMapHistory();
@@ -212,22 +300,35 @@ namespace ShadowDetection {
 		return m_ImageProviderDroneSerial;
 	}
 	
-	//Regester callback for new shadow maps (returns handle)
+	//Regester callback for new shadow maps (returns handle). Callbacks are invoked on the segmentation thread and should return quickly.
 	inline int ShadowDetectionEngine::RegisterCallback(std::function<void(InstantaneousShadowMap const & ShadowMap)> Callback) {
-		std::scoped_lock lock(m_callbacks_stagingMutex);
-		int token = 0;
-		while (m_callbacks_staging.count(token) > 0U)
-			token++;
-		m_callbacks_staging[token] = Callback;
-		m_callback_stagingModified = true;
-		return token;
+		return m_shadowMapChannel.Subscribe([Callback](ShadowMapHandle const & ShadowMap) { Callback(*ShadowMap); });
+	}
+	
+	//Regester callback for new shadow maps (returns handle). The handle can be kept (e.g. queued for later processing) without copying the map.
+	inline int ShadowDetectionEngine::RegisterCallback(std::function<void(ShadowMapHandle const & ShadowMap)> Callback) {
+		return m_shadowMapChannel.Subscribe(Callback);
 	}
 	
 	//Unregister callback for new shadow maps (input is token returned by RegisterCallback())
 	inline void ShadowDetectionEngine::UnRegisterCallback(int Handle) {
-		std::scoped_lock lock(m_callbacks_stagingMutex);
-		m_callbacks_staging.erase(Handle);
-		m_callback_stagingModified = true;
+		m_shadowMapChannel.Unsubscribe(Handle);
+	}
+	
+	inline void ShadowDetectionEngine::SetFrameQueuePolicy(size_t MaxQueuedFrames, FrameDropPolicy Policy) {
+		std::scoped_lock lock(m_ImageProviderMutex);
+		m_maxQueuedFrames = std::max(MaxQueuedFrames, (size_t) 1U);
+		m_dropPolicy      = Policy;
+	}
+	
+	inline PipelineStats ShadowDetectionEngine::GetPipelineStats(void) {
+		std::scoped_lock lock(m_statsMutex);
+		return m_stats;
+	}
+	
+	//Exponential moving average for latency statistics - lock on m_statsMutex should be held
+	inline void ShadowDetectionEngine::UpdateLatencyStat(double & Stat, double NewValue_ms) {
+		Stat = (m_stats.FramesProcessed == 0U) ? NewValue_ms : 0.9*Stat + 0.1*NewValue_ms;
 	}
 	
 	//When we stop or restart processing we immediately unregister any image callback and trash our pointer to the drone. However, we don't
@@ -236,6 +337,7 @@ namespace ShadowDetection {
 	//Note: We don't chain callbacks - the callback copies data and returns and our own processing happens in our private thread (and any
 	//extra threads that it might want to create). Doing the heavy lifting in the callback itself is simpler but could slow down the drone
 	//objects internal thread, which is not good practice.
+	//This thread is also the first stage of the processing pipeline: it stabilizes queued frames and hands them off to SegmentationMain().
 	inline void ShadowDetectionEngine::ModuleMain(void) {
 		while (! m_abort) {
 			if (m_running) {
@@ -252,6 +354,19 @@ namespace ShadowDetection {
 								cv::Mat frameCopy;
 								Frame.copyTo(frameCopy);
 								m_unprocessedFrames.push_back(std::make_tuple(frameCopy, Timestamp));
+								
+								//Enforce the queue bound (for all policies except None) by dropping the oldest frames
+								size_t numDropped = 0U;
+								if (m_dropPolicy != FrameDropPolicy::None) {
+									while (m_unprocessedFrames.size() > m_maxQueuedFrames) {
+										m_unprocessedFrames.pop_front();
+										numDropped++;
+									}
+								}
+								std::scoped_lock statsLock(m_statsMutex);
+								m_stats.FramesReceived++;
+								m_stats.FramesDropped += numDropped;
+								m_stats.InputQueueLength = m_unprocessedFrames.size();
 							}
 						});
 
@@ -268,25 +383,49 @@ namespace ShadowDetection {
 
 				if ((! m_unprocessedFrames.empty()) && refFrameAndFiducialsSet) {
 					//Get the first unprocessed frame and timestamp - remove from queue.
-					cv::Mat frame = std::get<0>(m_unprocessedFrames[0]);
-					TimePoint timestamp = std::get<1>(m_unprocessedFrames[0]);
-					m_unprocessedFrames.erase(m_unprocessedFrames.begin()); //Will cause vector re-allocation but it's actually not a big deal
 					//Due to OpenCV ref counting this doesn't copy the image... it takes ownership of it
+					cv::Mat frame = std::get<0>(m_unprocessedFrames.front());
+					TimePoint timestamp = std::get<1>(m_unprocessedFrames.front());
+					m_unprocessedFrames.pop_front();
+					size_t backlog = m_unprocessedFrames.size();
 					
-					bool realtime = true;
-					if (m_unprocessedFrames.size() > 0U) {
-						realtime = false;
-						std::cerr << "Warning: Shadow Detection module falling behind real-time. ";
-						std::cerr << (unsigned int) m_unprocessedFrames.size() << " frames buffered.\r\n"; 
-					}
+					//Under the SkipStabilization policy, once the queue is half full we reuse the last stabilization matrix until we catch up
+					bool skipStabilization = (m_dropPolicy == FrameDropPolicy::SkipStabilization) && (! m_lastH.empty()) &&
+					                         (backlog >= std::max(m_maxQueuedFrames/2U, (size_t) 1U));
 					
 					m_ImageProviderMutex.unlock(); //Done modifying m_unprocessedFrames - release lock
 					
-					//Process the first unprocessed frame.
-					ProcessFrame(frame, timestamp);
+					//Stage 1: Compute the stabilization matrix for the frame
+					TimePoint T0 = std::chrono::steady_clock::now();
+					cv::Mat H;
+					if (skipStabilization)
+						H = m_lastH;
+					else {
+						H = StabilizeFrame(frame);
+						m_lastH = H;
+					}
+					TimePoint T1 = std::chrono::steady_clock::now();
+					
+					{
+						std::scoped_lock statsLock(m_statsMutex);
+						m_stats.InputQueueLength = backlog;
+						if (skipStabilization)
+							m_stats.FramesStabilizationSkipped++;
+						else
+							UpdateLatencyStat(m_stats.Stabilization_ms, 1000.0*SecondsElapsed(T0, T1));
+						UpdateLatencyStat(m_stats.InputQueueWait_ms, 1000.0*SecondsElapsed(timestamp, T0));
+					}
 					
-					if (! realtime)
-						std::cerr << "Frame processed.\r\n";
+					//Hand off to stage 2. If it is backed up, wait for room (backlog accumulates in the input queue instead)
+					std::unique_lock<std::mutex> stabilizedLock(m_stabilizedFramesMutex);
+					m_stabilizedFramesCV.wait(stabilizedLock, [this]() {
+						return m_abort || (! m_running) || (m_stabilizedFrames.size() < MaxStabilizedFrames);
+					});
+					if (m_running && (! m_abort)) {
+						m_stabilizedFrames.push_back(StabilizedFrame{ frame, H, timestamp, std::chrono::steady_clock::now() });
+						stabilizedLock.unlock();
+						m_stabilizedFramesCV.notify_all();
+					}
 				}
 				else {
 					m_ImageProviderMutex.unlock();
@@ -298,6 +437,37 @@ namespace ShadowDetection {
 		}
 	}
 	
+	//Stage 2 of the processing pipeline: Take stabilized frames in order, map them to the EN plane, segment them and publish the results.
+	inline void ShadowDetectionEngine::SegmentationMain(void) {
+		while (! m_abort) {
+			std::unique_lock<std::mutex> stabilizedLock(m_stabilizedFramesMutex);
+			m_stabilizedFramesCV.wait_for(stabilizedLock, std::chrono::milliseconds(100), [this]() {
+				return m_abort || (! m_stabilizedFrames.empty());
+			});
+			if (m_abort || m_stabilizedFrames.empty())
+				continue;
+			StabilizedFrame item = m_stabilizedFrames.front();
+			m_stabilizedFrames.pop_front();
+			size_t stabilizedQueueLength = m_stabilizedFrames.size();
+			bool stillRunning = m_running && (! m_abort); //We may have been stopped (or shut down) while waiting - if so drop the frame
+			stabilizedLock.unlock();
+			m_stabilizedFramesCV.notify_all(); //Wake the stabilization stage if it is waiting for room
+			if (! stillRunning)
+				continue;
+			
+			TimePoint T0 = std::chrono::steady_clock::now();
+			ProcessFrame(item.Frame, item.H, item.Timestamp);
+			TimePoint T1 = std::chrono::steady_clock::now();
+			
+			std::scoped_lock statsLock(m_statsMutex);
+			m_stats.StabilizedQueueLength = stabilizedQueueLength;
+			UpdateLatencyStat(m_stats.StabilizedQueueWait_ms, 1000.0*SecondsElapsed(item.StabilizedTime, T0));
+			UpdateLatencyStat(m_stats.ENProcessing_ms, 1000.0*SecondsElapsed(T0, T1));
+			UpdateLatencyStat(m_stats.EndToEnd_ms, 1000.0*SecondsElapsed(item.Timestamp, T1));
+			m_stats.FramesProcessed++;
+		}
+	}
+	
 	inline bool ShadowDetectionEngine::IsReferenceFrameSet(void) {
 		std::scoped_lock lock(m_shadowMapMutex);
 		return (! m_ReferenceFrame.empty());
@@ -309,21 +479,55 @@ namespace ShadowDetection {
 	}
 	
 	inline bool ShadowDetectionEngine::GetTimestampOfMostRecentShadowMap(TimePoint & Timestamp) {
-		std::scoped_lock lock(m_shadowMapMutex);
-		if ((m_ShadowMap.Map.rows == 0) || (m_ShadowMap.Map.cols == 0))
+		ShadowMapHandle latest = m_shadowMapChannel.Latest();
+		if (latest == nullptr)
 			return false;
-		Timestamp = m_ShadowMap.Timestamp;
+		Timestamp = latest->Timestamp;
 		return true;
 	}
 	
 	inline bool ShadowDetectionEngine::GetMostRecentShadowMap(InstantaneousShadowMap & ShadowMap) {
-		std::scoped_lock lock(m_shadowMapMutex);
-		if ((m_ShadowMap.Map.rows == 0) || (m_ShadowMap.Map.cols == 0))
+		ShadowMapHandle latest = m_shadowMapChannel.Latest();
+		if (latest == nullptr)
 			return false;
-		ShadowMap = m_ShadowMap;
+		ShadowMap = *latest;
 		return true;
 	}
 	
+	inline bool ShadowDetectionEngine::GetMostRecentShadowMap(ShadowMapHandle & ShadowMap) {
+		ShadowMap = m_shadowMapChannel.Latest();
+		return (ShadowMap != nullptr);
+	}
+	
+	inline bool ShadowDetectionEngine::GetHistoricalShadowMap(TimePoint const & Timestamp, InstantaneousShadowMap & ShadowMap) {
+		//Only hold the lock long enough to grab the histories - fetching a map may need to read a spilled chunk from disk
+		std::vector<std::shared_ptr<ShadowMapHistory>> histories;
+		{
+			std::scoped_lock lock(m_shadowMapMutex);
+			histories = m_History;
+		}
+		//Search the most recent history first - each history covers a later span of time than the ones before it
+		for (auto iter = histories.rbegin(); iter != histories.rend(); iter++) {
+			ShadowMapHistory & history(**iter);
+			int index = history.FindIndex(Timestamp);
+			if (index < 0)
+				continue;
+			if ((! history.GetMap(size_t(index), ShadowMap.Map)) || (! history.GetTimestamp(size_t(index), ShadowMap.Timestamp)))
+				return false;
+			ShadowMap.UL_LL = history.UL_LL;
+			ShadowMap.UR_LL = history.UR_LL;
+			ShadowMap.LL_LL = history.LL_LL;
+			ShadowMap.LR_LL = history.LR_LL;
+			return true;
+		}
+		return false;
+	}
+	
+	inline void ShadowDetectionEngine::SetShadowMapHistoryMemoryBudget(size_t Bytes) {
+		std::scoped_lock lock(m_shadowMapMutex);
+		m_historyMemoryBudget = Bytes;
+	}
+	
 	inline void ShadowDetectionEngine::SaveAndFlushShadowMapHistory(void) {
 		//Save each item of m_History to disk (each is a new FRF file)
 		//We will save all FRF files for the mission to a subdirectory of "Shadow Map Files" in the executable directory
@@ -374,8 +578,7 @@ namespace ShadowDetection {
 		std::scoped_lock lock(m_shadowMapMutex);
 		for (size_t n = 0U; n < m_History.size(); n++) {
 			std::filesystem::path Filepath = MissionFolderPath / ("Shadow Map Sequence "s + std::to_string(n + 1U) + ".frf"s);
-			std::cout<< "Saving to " << Filepath << std::endl;
-			if (! m_History[n].SaveFRFFile(Filepath)) {
+			if (! m_History[n]->SaveFRFFile(Filepath)) {
 				std::cerr << "Warning: Saving Shadow Map History to FRF file failed. File: " << Filepath.string() << "\r\n";
 				success = false;
 			}
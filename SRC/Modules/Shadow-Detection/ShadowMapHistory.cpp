@@ -0,0 +1,347 @@
+//This module provides a memory-bounded history of shadow maps for a single registration (see ShadowMapHistory.hpp)
+//Author: Bryan Poling
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+
+//System Includes
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+//Project Includes
+#include "ShadowMapHistory.hpp"
+#include "FRF.h"
+#include "ShadowMapIO.hpp"
+#include "shadow_utils.hpp"
+#include "../../Utilities.hpp"
+#include "../GNSS-Receiver/GNSSReceiver.hpp"
+
+namespace ShadowDetection {
+	using namespace std::string_literals;
+	using TimePoint = ShadowMapHistory::TimePoint;
+
+	//Start an FRF shadow map file. Layers are added with AddShadowMapLayer() and the file is written with SaveShadowMapFRFFile().
+	static void InitShadowMapFRFImage(FRFImage & ShadowMap) {
+		//Set Image dimensions - this must be done now, when there are no layers in the image yet.
+		if (!ShadowMap.SetWidth(512U))
+		std::cerr << "Failed to set image width.\r\n";
+		if (!ShadowMap.SetHeight(512U))
+		std::cerr << "Failed to set image height.\r\n";
+	}
+
+	//Add a shadow map to an FRF shadow map file as a new layer
+	static void AddShadowMapLayer(FRFImage & ShadowMap, cv::Mat const & Map) {
+		//Add a new layer and set it up
+		FRFLayer* newLayer = ShadowMap.AddLayer();
+		newLayer->Name = std::string("Shadow Map Layer");
+		newLayer->Description = std::string("0 = Unshadowed, 1 = Fully shadowed");
+		newLayer->UnitsCode = -1; //No units
+		newLayer->SetTypeCode(8U); //See Table 1 in the spec. We are going to use 8-bit unsigned integers for each pixel in this layer
+		newLayer->HasValidityMask = true; //Add validity info for each pixel in this layer
+		newLayer->SetAlphaAndBetaForGivenRange(0.0, 1.0); //Let the FRF lib set coefficients so values are in range [0,1]
+		newLayer->AllocateStorage(); //This needs to be called before the layer can be accessed
+
+		set_NewValue(int(ShadowMap.Rows()), int(ShadowMap.Cols()), newLayer, Map);
+	}
+
+	//Finish an FRF shadow map file (one time tag per layer, measured from Epoch, which is also used as the file time epoch) and save it.
+	//Return true on success and false on failure
+	static bool SaveShadowMapFRFFile(FRFImage & ShadowMap, std::filesystem::path const & Filepath, std::vector<TimePoint> const & Timestamps,
+	                                 TimePoint const & Epoch, Eigen::Vector2d const & UL_LL, Eigen::Vector2d const & UR_LL,
+	                                 Eigen::Vector2d const & LL_LL, Eigen::Vector2d const & LR_LL) {
+		//Create a shadow map info block and default the absolute time info to "unknown time"
+		ShadowMapInfoBlock myShadowMapInfoBlock;
+		myShadowMapInfoBlock.FileTimeEpoch_Week = 0U;
+		myShadowMapInfoBlock.FileTimeEpoch_TOW  = std::nan("");
+
+		//If we have the ability to get the absolute time of the file time 0 reference epoch, set the absolute time
+		uint32_t GPS_Week = 0U;
+		double   GPS_TOW  = std::nan("");
+		if (GNSSReceiver::GNSSManager::Instance().TimestampToGPSTime(Epoch, GPS_Week, GPS_TOW)) {
+			myShadowMapInfoBlock.FileTimeEpoch_Week = GPS_Week;
+			myShadowMapInfoBlock.FileTimeEpoch_TOW  = GPS_TOW;
+		}
+
+		//Get timestamps as a number of seconds from the reference epoch
+		for (TimePoint const & timestamp : Timestamps)
+			myShadowMapInfoBlock.LayerTimeTags.push_back(SecondsElapsed(Epoch, timestamp));
+
+		FRFVisualizationColormap* viz = ShadowMap.AddVisualizationColormap();
+		viz->LayerIndex = 0U; //Base the visualization on the first layer of the shadow map
+		viz->SetPoints.push_back(std::make_tuple(0.0, 1.0, 1.0, 1.0)); //Map value 0 (unshadowed) to white (RGB all set to 1)
+		viz->SetPoints.push_back(std::make_tuple(1.0, 0.0, 0.0, 0.0)); //Map value 1 (fully shadowed) to black (RGB all set to 0)
+
+		FRFGeoRegistration GeoRegistrationTag;
+		GeoRegistrationTag.Altitude = std::nan("");
+		GeoRegistrationTag.RegisterFromCornerLocations(UL_LL, UR_LL, LL_LL, LR_LL);
+		ShadowMap.SetGeoRegistration(GeoRegistrationTag);
+		//TODO: When we have the ability, set the GPST field of GeoRegistrationTag
+		if (!myShadowMapInfoBlock.AttachToFRFFile(ShadowMap))
+			std::cerr << "Error adding shadow map info block... do we have the right number of time tags? There should be 1 per layer.\r\n";
+
+		if (!ShadowMap.SaveToDisk(Filepath)) {
+			std::cerr << "Error in SaveShadowMapFRFFile(): Error saving shadow maps. File: " << Filepath.string() << "\r\n";
+			return false;
+		}
+		else
+			return true;
+	}
+
+	//Write the RLE maps of a chunk to a spill file: the number of maps (uint32), the size of each encoded map (uint32 each), then the
+	//encoded maps back to back. Spill files are private to the process that writes them, so they use native byte order.
+	static bool WriteSpillFile(std::filesystem::path const & Filepath, std::vector<std::vector<uint8_t>> const & EncodedMaps) {
+		std::ofstream file(Filepath, std::ios::binary | std::ios::trunc);
+		uint32_t numMaps = uint32_t(EncodedMaps.size());
+		file.write((char const *) &numMaps, sizeof(numMaps));
+		for (auto const & encoded : EncodedMaps) {
+			uint32_t size = uint32_t(encoded.size());
+			file.write((char const *) &size, sizeof(size));
+		}
+		for (auto const & encoded : EncodedMaps)
+			file.write((char const *) encoded.data(), std::streamsize(encoded.size()));
+		file.close();
+		return bool(file);
+	}
+
+	//Read the RLE maps of a chunk from a spill file written by WriteSpillFile(). Returns false if the file can't be read or is corrupt.
+	static bool ReadSpillFile(std::filesystem::path const & Filepath, std::vector<std::vector<uint8_t>> & EncodedMaps) {
+		EncodedMaps.clear();
+		std::ifstream file(Filepath, std::ios::binary);
+		uint32_t numMaps = 0U;
+		if ((! file.read((char *) &numMaps, sizeof(numMaps))) || (numMaps > ShadowMapHistory::MapsPerChunk))
+			return false;
+		std::vector<uint32_t> sizes(numMaps);
+		if (! file.read((char *) sizes.data(), std::streamsize(sizeof(uint32_t)*numMaps)))
+			return false;
+		EncodedMaps.resize(numMaps);
+		for (uint32_t n = 0U; n < numMaps; n++) {
+			EncodedMaps[n].resize(sizes[n]);
+			if (! file.read((char *) EncodedMaps[n].data(), std::streamsize(sizes[n])))
+				return false;
+		}
+		return true;
+	}
+
+	ShadowMapHistory::ShadowMapHistory(size_t MemoryBudget, std::filesystem::path const & SpillDirectory) :
+		m_memoryBudget(MemoryBudget), m_spillDirectory(SpillDirectory) {
+		UL_LL.setZero();
+		UR_LL.setZero();
+		LL_LL.setZero();
+		LR_LL.setZero();
+
+		//Give each history its own spill file names
+		static std::atomic<uint64_t> historyCounter(0U);
+		uint64_t uniqueID = uint64_t(std::chrono::system_clock::now().time_since_epoch().count());
+		m_spillFilePrefix = m_spillDirectory / (std::string(SpillFilePrefix) + std::to_string(uniqueID) + "-"s + std::to_string(historyCounter++));
+	}
+
+	size_t ShadowMapHistory::RemoveOrphanedSpillFiles(std::filesystem::path const & SpillDirectory) {
+		auto endsWith = [](std::string const & Str, std::string const & Suffix) {
+			return (Str.size() >= Suffix.size()) && (Str.compare(Str.size() - Suffix.size(), Suffix.size(), Suffix) == 0);
+		};
+		size_t numRemoved = 0U;
+		std::error_code ec;
+		for (auto const & entry : std::filesystem::directory_iterator(SpillDirectory, ec)) {
+			std::string filename = entry.path().filename().string();
+			bool isSpillFile = (filename.rfind(SpillFilePrefix, 0) == 0U) && (endsWith(filename, SpillFileExtension) || endsWith(filename, SpillFileExtension + ".tmp"s));
+			std::error_code removeEC;
+			if (isSpillFile && entry.is_regular_file(removeEC) && std::filesystem::remove(entry.path(), removeEC))
+				numRemoved++;
+		}
+		return numRemoved;
+	}
+
+	ShadowMapHistory::~ShadowMapHistory() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		WaitForSpills(lock);
+		std::error_code ec;
+		for (auto const & chunk : m_chunks) {
+			if (! chunk->SpillFile.empty())
+				std::filesystem::remove(chunk->SpillFile, ec);
+		}
+	}
+
+	void ShadowMapHistory::Append(cv::Mat const & Map, TimePoint const & Timestamp) {
+		if ((Map.type() != CV_8UC1) || Map.empty()) {
+			std::cerr << "Error in ShadowMapHistory::Append(): Shadow maps must be non-empty CV_8UC1 images.\r\n";
+			return;
+		}
+		std::vector<uint8_t> encoded;
+		RLEEncodeShadowMap(Map, encoded);
+
+		std::scoped_lock lock(m_mutex);
+		if (m_index.empty()) {
+			m_rows = Map.rows;
+			m_cols = Map.cols;
+		}
+		else if ((Map.rows != m_rows) || (Map.cols != m_cols)) {
+			std::cerr << "Error in ShadowMapHistory::Append(): All shadow maps in a history must have the same size.\r\n";
+			return;
+		}
+
+		if (m_chunks.empty() || (m_chunks.back()->NumMaps >= MapsPerChunk))
+			m_chunks.push_back(std::make_shared<Chunk>());
+		Chunk & chunk(*m_chunks.back());
+		m_index.push_back(IndexEntry{ Timestamp, uint32_t(m_chunks.size() - 1U), uint32_t(chunk.NumMaps) });
+		chunk.NumMaps++;
+		chunk.EncodedBytes += encoded.size();
+		m_residentBytes    += encoded.size();
+		chunk.EncodedMaps.push_back(std::move(encoded));
+
+		StartSpillsIfOverBudget();
+	}
+
+	size_t ShadowMapHistory::Size(void) {
+		std::scoped_lock lock(m_mutex);
+		return m_index.size();
+	}
+
+	size_t ShadowMapHistory::ResidentBytes(void) {
+		std::scoped_lock lock(m_mutex);
+		return m_residentBytes;
+	}
+
+	bool ShadowMapHistory::GetTimestamp(size_t Index, TimePoint & Timestamp) {
+		std::scoped_lock lock(m_mutex);
+		if (Index >= m_index.size())
+			return false;
+		Timestamp = m_index[Index].Timestamp;
+		return true;
+	}
+
+	bool ShadowMapHistory::GetMap(size_t Index, cv::Mat & Map) {
+		std::filesystem::path spillFile;
+		uint32_t chunkIndex = 0U, indexInChunk = 0U;
+		size_t numMaps = 0U;
+		{
+			std::scoped_lock lock(m_mutex);
+			if (Index >= m_index.size())
+				return false;
+			IndexEntry const & entry(m_index[Index]);
+			Chunk const & chunk(*m_chunks[entry.ChunkIndex]);
+			if (chunk.SpillFile.empty())
+				return RLEDecodeShadowMap(chunk.EncodedMaps[entry.IndexInChunk], m_rows, m_cols, Map);
+			if (m_cachedChunkIndex == int(entry.ChunkIndex))
+				return RLEDecodeShadowMap(m_cachedChunkMaps[entry.IndexInChunk], m_rows, m_cols, Map);
+			spillFile    = chunk.SpillFile;
+			chunkIndex   = entry.ChunkIndex;
+			indexInChunk = entry.IndexInChunk;
+			numMaps      = chunk.NumMaps;
+		}
+
+		//Read the spilled chunk without holding the lock. Spill files are never modified once written and are only deleted by the destructor.
+		std::vector<std::vector<uint8_t>> encodedMaps;
+		if ((! ReadSpillFile(spillFile, encodedMaps)) || (encodedMaps.size() != numMaps)) {
+			std::cerr << "Error in ShadowMapHistory::GetMap(): Failed to read shadow maps from file: " << spillFile.string() << "\r\n";
+			return false;
+		}
+
+		std::scoped_lock lock(m_mutex);
+		bool success = RLEDecodeShadowMap(encodedMaps[indexInChunk], m_rows, m_cols, Map);
+		m_cachedChunkMaps  = std::move(encodedMaps);
+		m_cachedChunkIndex = int(chunkIndex);
+		return success;
+	}
+
+	int ShadowMapHistory::FindIndex(TimePoint const & Timestamp) {
+		std::scoped_lock lock(m_mutex);
+		auto iter = std::upper_bound(m_index.begin(), m_index.end(), Timestamp,
+		                             [](TimePoint const & T, IndexEntry const & Entry) { return T < Entry.Timestamp; });
+		return int(iter - m_index.begin()) - 1;
+	}
+
+	std::vector<TimePoint> ShadowMapHistory::ChunkTimestamps(size_t ChunkIndex) {
+		size_t firstIndex = ChunkIndex*MapsPerChunk;
+		std::vector<TimePoint> timestamps;
+		timestamps.reserve(m_chunks[ChunkIndex]->NumMaps);
+		for (size_t n = 0U; n < m_chunks[ChunkIndex]->NumMaps; n++)
+			timestamps.push_back(m_index[firstIndex + n].Timestamp);
+		return timestamps;
+	}
+
+	//Spill full chunks, oldest first, until what will be left in RAM fits the budget. The last chunk is only spilled once it is full.
+	//Each spill writes the encoded maps of the chunk to a spill file on its own thread. The chunk stays readable from RAM until it is on disk.
+	void ShadowMapHistory::StartSpillsIfOverBudget(void) {
+		while ((m_residentBytes - m_spillingBytes > m_memoryBudget) && (m_nextChunkToSpill < m_chunks.size()) &&
+		       (m_chunks[m_nextChunkToSpill]->NumMaps == MapsPerChunk)) {
+			size_t chunkIndex = m_nextChunkToSpill++;
+			std::shared_ptr<Chunk> chunk = m_chunks[chunkIndex];
+			std::filesystem::path spillFile = m_spillFilePrefix.string() + " Chunk "s + std::to_string(chunkIndex + 1U) + SpillFileExtension;
+			m_spillingBytes += chunk->EncodedBytes;
+
+			chunk->SpillJob = std::async(std::launch::async, [this, chunk, spillFile]() {
+				//The encoded maps of a full chunk are not modified until we are done, so we can read them without the lock
+				std::error_code ec;
+				std::filesystem::create_directories(m_spillDirectory, ec);
+				std::filesystem::path tempFile = spillFile.string() + ".tmp"s;
+				bool success = WriteSpillFile(tempFile, chunk->EncodedMaps);
+				if (success) {
+					std::filesystem::rename(tempFile, spillFile, ec);
+					success = ! ec;
+				}
+
+				std::scoped_lock lock(m_mutex);
+				m_spillingBytes -= chunk->EncodedBytes;
+				if (success) {
+					m_residentBytes -= chunk->EncodedBytes;
+					chunk->SpillFile = spillFile;
+					chunk->EncodedBytes = 0U;
+					std::vector<std::vector<uint8_t>>().swap(chunk->EncodedMaps);
+				}
+				else {
+					std::cerr << "Warning: Failed to spill shadow map history chunk to disk - keeping it in memory. File: " << spillFile.string() << "\r\n";
+					std::filesystem::remove(tempFile, ec);
+				}
+				return success;
+			}).share();
+		}
+	}
+
+	void ShadowMapHistory::WaitForSpills(std::unique_lock<std::mutex> & Lock) {
+		std::vector<std::shared_future<bool>> jobs;
+		for (auto const & chunk : m_chunks) {
+			if (chunk->SpillJob.valid())
+				jobs.push_back(chunk->SpillJob);
+		}
+		Lock.unlock();
+		for (auto const & job : jobs)
+			job.wait();
+		Lock.lock();
+	}
+
+	//Stream the chunks, oldest first, into a single FRF file. Each chunk is decoded (read from its spill file first if needed) and added to
+	//the file one map at a time, so nothing but the FRF image itself grows with the length of the history.
+	bool ShadowMapHistory::SaveFRFFile(std::filesystem::path const & Filepath) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		WaitForSpills(lock);
+		TimePoint epoch = m_index.empty() ? TimePoint() : m_index.front().Timestamp;
+		std::cout << "Saving to " << Filepath << std::endl;
+
+		FRFImage shadowMap;
+		InitShadowMapFRFImage(shadowMap);
+		std::vector<TimePoint> timestamps;
+		timestamps.reserve(m_index.size());
+		for (size_t chunkIndex = 0U; chunkIndex < m_chunks.size(); chunkIndex++) {
+			Chunk const & chunk(*m_chunks[chunkIndex]);
+			std::vector<std::vector<uint8_t>> spilledMaps;
+			if ((! chunk.SpillFile.empty()) && ((! ReadSpillFile(chunk.SpillFile, spilledMaps)) || (spilledMaps.size() != chunk.NumMaps))) {
+				std::cerr << "Error in ShadowMapHistory::SaveFRFFile(): Failed to read shadow maps from file: " << chunk.SpillFile.string() << "\r\n";
+				return false;
+			}
+			std::vector<std::vector<uint8_t>> const & encodedMaps(chunk.SpillFile.empty() ? chunk.EncodedMaps : spilledMaps);
+			cv::Mat map;
+			for (size_t n = 0U; n < encodedMaps.size(); n++) {
+				if (! RLEDecodeShadowMap(encodedMaps[n], m_rows, m_cols, map)) {
+					std::cerr << "Error in ShadowMapHistory::SaveFRFFile(): Corrupt shadow map in chunk " << chunkIndex + 1U << "\r\n";
+					return false;
+				}
+				AddShadowMapLayer(shadowMap, map);
+			}
+			std::vector<TimePoint> chunkTimestamps = ChunkTimestamps(chunkIndex);
+			timestamps.insert(timestamps.end(), chunkTimestamps.begin(), chunkTimestamps.end());
+		}
+		return SaveShadowMapFRFFile(shadowMap, Filepath, timestamps, epoch, UL_LL, UR_LL, LL_LL, LR_LL);
+	}
+}
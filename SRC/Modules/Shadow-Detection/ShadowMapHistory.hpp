@@ -0,0 +1,145 @@
+//This module provides a memory-bounded history of shadow maps for a single registration. Recent maps are kept in RAM, run-length
+//encoded, and once the encoded maps exceed a configurable budget the oldest ones are streamed (in chunks, on a background thread) to
+//spill files in a spill directory. An index of all maps is kept in RAM so any map can be fetched by index or timestamp, whether it is
+//still resident or has been spilled. Saving the history at the end of a mission streams every chunk into a single FRF shadow map file.
+//Author: Bryan Poling
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+#pragma once
+
+//System Includes
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+
+//External Includes
+#include <opencv2/opencv.hpp>
+#include "../../../../eigen/Eigen/Core"
+
+namespace ShadowDetection {
+	//Run-length encode a shadow map (CV_8UC1). Shadow maps are mostly long runs of 0, 254 and 255, so this usually takes a 512x512 map
+	//from 256 KB to a few KB. The encoding is a sequence of (RunLength - 1, Value) byte pairs over the pixels in row-major order.
+	inline void RLEEncodeShadowMap(cv::Mat const & Map, std::vector<uint8_t> & Encoded) {
+		Encoded.clear();
+		if ((Map.type() != CV_8UC1) || Map.empty())
+			return;
+		uint8_t value = Map.at<uint8_t>(0, 0);
+		int runLength = 0;
+		for (int row = 0; row < Map.rows; row++) {
+			uint8_t const * rowPtr = Map.ptr<uint8_t>(row);
+			for (int col = 0; col < Map.cols; col++) {
+				if ((rowPtr[col] != value) || (runLength == 256)) {
+					Encoded.push_back(uint8_t(runLength - 1));
+					Encoded.push_back(value);
+					value = rowPtr[col];
+					runLength = 0;
+				}
+				runLength++;
+			}
+		}
+		Encoded.push_back(uint8_t(runLength - 1));
+		Encoded.push_back(value);
+	}
+
+	//Decode a map encoded with RLEEncodeShadowMap(). Returns false if the encoded data does not describe a Rows x Cols map.
+	inline bool RLEDecodeShadowMap(std::vector<uint8_t> const & Encoded, int Rows, int Cols, cv::Mat & Map) {
+		Map.create(Rows, Cols, CV_8UC1);
+		uint8_t * data = Map.ptr<uint8_t>(0);
+		size_t numPixels = size_t(Rows) * size_t(Cols);
+		size_t pos = 0U;
+		for (size_t n = 0U; n + 1U < Encoded.size(); n += 2U) {
+			size_t runLength = size_t(Encoded[n]) + 1U;
+			if (pos + runLength > numPixels)
+				return false;
+			std::fill(data + pos, data + pos + runLength, Encoded[n + 1U]);
+			pos += runLength;
+		}
+		return (pos == numPixels) && (Encoded.size() % 2U == 0U);
+	}
+
+	//This class holds a sequence of instantaneous shadow maps corresponding to different instants in time, but with the same
+	//registration data (pixel (n,m) corresponds to the same point on the ground in all maps). Maps are grouped into chunks of
+	//MapsPerChunk maps. A chunk is either resident (RLE maps in RAM) or spilled (the same RLE maps in a file in the spill directory).
+	//Spill files hold the encoded maps byte for byte, so spilled maps read back exactly as they were appended (any value 0-255, not just
+	//0/254/255). Spill files are private to the history and are deleted with it - the FRF file written by SaveFRFFile() is the output.
+	//All public methods are thread safe.
+	class ShadowMapHistory {
+		public:
+			EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+			using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+
+			static constexpr size_t MapsPerChunk = 64U;
+
+			Eigen::Vector2d UL_LL; //(Latitude, Longitude) of center of upper-left pixel, in radians
+			Eigen::Vector2d UR_LL; //(Latitude, Longitude) of center of upper-right pixel, in radians
+			Eigen::Vector2d LL_LL; //(Latitude, Longitude) of center of lower-left pixel, in radians
+			Eigen::Vector2d LR_LL; //(Latitude, Longitude) of center of lower-right pixel, in radians
+
+			//MemoryBudget is the max number of bytes of RLE map data kept in RAM. Spilled chunks are written to SpillDirectory.
+			ShadowMapHistory(size_t MemoryBudget, std::filesystem::path const & SpillDirectory);
+			~ShadowMapHistory(); //Waits for any spills in progress and deletes spilled chunks that were never saved
+			ShadowMapHistory(ShadowMapHistory const &) = delete;
+			ShadowMapHistory & operator=(ShadowMapHistory const &) = delete;
+
+			void   Append(cv::Mat const & Map, TimePoint const & Timestamp); //Add a map (CV_8UC1) to the end of the history
+			size_t Size(void);
+			bool   Empty(void) { return (Size() == 0U); }
+			size_t ResidentBytes(void); //Bytes of RLE map data currently in RAM
+
+			bool GetTimestamp(size_t Index, TimePoint & Timestamp);
+			bool GetMap(size_t Index, cv::Mat & Map);    //Get the map with the given index - may need to read a spilled chunk from disk
+			int  FindIndex(TimePoint const & Timestamp); //Index of the last map at or before Timestamp (-1 if there is none)
+
+			//Delete spill files left in SpillDirectory by a session that didn't shut down cleanly - nothing else will ever remove them.
+			//Only call this when no histories are using the directory (e.g. on startup, once the single-instance lock is held).
+			//Returns the number of files removed.
+			static size_t RemoveOrphanedSpillFiles(std::filesystem::path const & SpillDirectory);
+
+			//Save the whole history to a single FRF shadow map file at Filepath (one layer per map, in order, with the time of the first map
+			//as the file time epoch). Chunks are decoded and added one at a time, but the FRF library writes a file from a complete in-memory
+			//image, so the save briefly holds every map at FRF precision (1 byte per pixel). Maps are written with set_NewValue(), like every
+			//shadow map file: masked pixels (255) become NaN and other values go into a layer with range [0, 1], so the file keeps masked,
+			//unshadowed (0) and shadowed pixels but not intermediate values. The history itself is unchanged and stays readable afterwards.
+			//Returns true on success.
+			bool SaveFRFFile(std::filesystem::path const & Filepath);
+
+		private:
+			static constexpr char const * SpillFilePrefix    = "History "; //Start of the name of every spill file (and its temp file)
+			static constexpr char const * SpillFileExtension = ".chunk";   //End of the name of every spill file (temp files add ".tmp")
+
+			struct Chunk {
+				std::vector<std::vector<uint8_t>> EncodedMaps; //Empty once the chunk has been spilled
+				std::filesystem::path SpillFile;               //Empty until the chunk has been spilled
+				std::shared_future<bool> SpillJob;             //Valid once a spill has been started
+				size_t NumMaps = 0U;
+				size_t EncodedBytes = 0U;
+			};
+			struct IndexEntry {
+				TimePoint Timestamp;
+				uint32_t  ChunkIndex;
+				uint32_t  IndexInChunk;
+			};
+
+			std::mutex m_mutex;
+			size_t m_memoryBudget;
+			std::filesystem::path m_spillDirectory;
+			std::filesystem::path m_spillFilePrefix;
+			int m_rows = 0, m_cols = 0;
+			size_t m_residentBytes = 0U;
+			size_t m_spillingBytes = 0U; //Part of m_residentBytes in chunks that are being spilled
+			size_t m_nextChunkToSpill = 0U;
+			std::vector<std::shared_ptr<Chunk>> m_chunks;
+			std::vector<IndexEntry> m_index;
+
+			//Most recently read spilled chunk (RLE maps) - so sequential reads of spilled maps only load each file once
+			int m_cachedChunkIndex = -1;
+			std::vector<std::vector<uint8_t>> m_cachedChunkMaps;
+
+			void StartSpillsIfOverBudget(void);                      //Lock on m_mutex should be held
+			void WaitForSpills(std::unique_lock<std::mutex> & Lock); //Lock is released while waiting
+			std::vector<TimePoint> ChunkTimestamps(size_t ChunkIndex); //Lock on m_mutex should be held
+	};
+}
@@ -0,0 +1,218 @@
+//This module provides the per-frame segmentation stage of the EN-plane shadow detection pipeline: the relative brightness computation
+//(current brightness over reference brightness, faded in from the periphery of the visible area) and the multi-threshold segmentation
+//of the relative brightness image into a shadow map.
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+#pragma once
+
+//System Includes
+#include <vector>
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+//External Includes
+#include <opencv2/opencv.hpp>
+
+namespace ShadowDetection {
+	//Multipliers applied to the relative brightness in the outer ring of the visible area, the next two rings, and the interior.
+	//These are the uint8 results of weighting 255-valued masks by 1.0, 0.9, 0.8, and 0.7 (as done by cv::addWeighted). The
+	//relative brightness is scaled by Multiplier/RING_MULTIPLIER_NORM so the interior is unchanged and the periphery is brightened.
+	static constexpr int RING_MULTIPLIERS[4] = { 255, 229, 204, 178 };
+	static constexpr int RING_MULTIPLIER_NORM = 178;
+
+	//Compute the relative brightness image used for shadow segmentation. For each pixel this is Current/Ref (scaled to 255 and saturating
+	//at 255, 0 if Ref is 0), multiplied by a ring-dependent fade-in factor. Mask is the visibility mask and Eroded1-3 are successive
+	//erosions of it, so the rings are Mask - Eroded1, Eroded1 - Eroded2, Eroded2 - Eroded3 and the interior is Eroded3.
+	//Masked pixels (Mask < 128) are set to 255. All inputs are CV_8UC1 of the same size. This is a fused (and, where available, AVX2)
+	//replacement for a cv::divide, a chain of cv::addWeighted calls to build the ring multiplier image, and a cv::multiply.
+	inline void ComputeRelativeBrightness(cv::Mat const & Current, cv::Mat const & Ref, cv::Mat const & Mask, cv::Mat const & Eroded1,
+	                                      cv::Mat const & Eroded2, cv::Mat const & Eroded3, cv::Mat & Rel) {
+		if ((Current.type() != CV_8UC1) || (Ref.size() != Current.size()) || (Mask.size() != Current.size()) ||
+		    (Eroded1.size() != Current.size()) || (Eroded2.size() != Current.size()) || (Eroded3.size() != Current.size())) {
+			std::cerr << "Error in ComputeRelativeBrightness(): Inputs have wrong type or dimensions.\r\n";
+			return;
+		}
+		Rel.create(Current.rows, Current.cols, CV_8UC1);
+
+		cv::parallel_for_(cv::Range(0, Current.rows), [&](cv::Range const & Rows) {
+			for (int row = Rows.start; row < Rows.end; row++) {
+				uint8_t const * curRow = Current.ptr<uint8_t>(row);
+				uint8_t const * refRow = Ref.ptr<uint8_t>(row);
+				uint8_t const * mRow   = Mask.ptr<uint8_t>(row);
+				uint8_t const * e1Row  = Eroded1.ptr<uint8_t>(row);
+				uint8_t const * e2Row  = Eroded2.ptr<uint8_t>(row);
+				uint8_t const * e3Row  = Eroded3.ptr<uint8_t>(row);
+				uint8_t * relRow = Rel.ptr<uint8_t>(row);
+
+				int col = 0;
+				#if defined(__AVX2__)
+				{
+					__m256i const thresh  = _mm256_set1_epi32(127);
+					__m256i const zero    = _mm256_setzero_si256();
+					__m256i const sat     = _mm256_set1_epi32(255);
+					__m256  const scale   = _mm256_set1_ps(255.0f);
+					__m256  const normInv = _mm256_set1_ps(1.0f / float(RING_MULTIPLIER_NORM));
+					__m256  const w0 = _mm256_set1_ps(float(RING_MULTIPLIERS[0]));
+					__m256  const w1 = _mm256_set1_ps(float(RING_MULTIPLIERS[1]));
+					__m256  const w2 = _mm256_set1_ps(float(RING_MULTIPLIERS[2]));
+					__m256  const w3 = _mm256_set1_ps(float(RING_MULTIPLIERS[3]));
+					auto load8 = [](uint8_t const * p) { return _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i const *) p)); };
+					for (; col + 8 <= Current.cols; col += 8) {
+						__m256 cur = _mm256_cvtepi32_ps(load8(curRow + col));
+						__m256i refI = load8(refRow + col);
+						__m256 ref = _mm256_cvtepi32_ps(refI);
+						__m256 m  = _mm256_castsi256_ps(_mm256_cmpgt_epi32(load8(mRow  + col), thresh));
+						__m256 e1 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(load8(e1Row + col), thresh));
+						__m256 e2 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(load8(e2Row + col), thresh));
+						__m256 e3 = _mm256_castsi256_ps(_mm256_cmpgt_epi32(load8(e3Row + col), thresh));
+
+						//Ratio, rounded and saturated to uint8 (0 where the reference is 0)
+						__m256i ratio = _mm256_cvtps_epi32(_mm256_div_ps(_mm256_mul_ps(cur, scale), _mm256_max_ps(ref, _mm256_set1_ps(1.0f))));
+						ratio = _mm256_min_epi32(ratio, sat);
+						ratio = _mm256_blendv_epi8(ratio, zero, _mm256_cmpeq_epi32(refI, zero));
+
+						//Ring multiplier - the masks are nested so later blends override earlier ones
+						__m256 mult = _mm256_and_ps(m, w0);
+						mult = _mm256_blendv_ps(mult, w1, e1);
+						mult = _mm256_blendv_ps(mult, w2, e2);
+						mult = _mm256_blendv_ps(mult, w3, e3);
+
+						__m256i rel = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(ratio), mult), normInv));
+						rel = _mm256_min_epi32(rel, sat);
+						rel = _mm256_blendv_epi8(sat, rel, _mm256_castps_si256(m));
+
+						//Pack 8 x int32 down to 8 x uint8 and store
+						__m128i lo = _mm256_castsi256_si128(rel);
+						__m128i hi = _mm256_extracti128_si256(rel, 1);
+						__m128i packed16 = _mm_packus_epi32(lo, hi);
+						__m128i packed8  = _mm_packus_epi16(packed16, packed16);
+						_mm_storel_epi64((__m128i *) (relRow + col), packed8);
+					}
+				}
+				#endif
+
+				//Scalar path (and tail of each row for the AVX2 path)
+				for (; col < Current.cols; col++) {
+					if (mRow[col] < 128U) {
+						relRow[col] = 255U;
+						continue;
+					}
+					int ratio = 0;
+					if (refRow[col] > 0U)
+						ratio = std::min((int) std::nearbyint(float(curRow[col])*255.0f / float(refRow[col])), 255);
+					int mult = (e3Row[col] >= 128U) ? RING_MULTIPLIERS[3] :
+					           (e2Row[col] >= 128U) ? RING_MULTIPLIERS[2] :
+					           (e1Row[col] >= 128U) ? RING_MULTIPLIERS[1] : RING_MULTIPLIERS[0];
+					int rel = (int) std::nearbyint(float(ratio) * float(mult) * (1.0f / float(RING_MULTIPLIER_NORM)));
+					relRow[col] = (uint8_t) std::min(rel, 255);
+				}
+			}
+		});
+	}
+
+	//Multi-threshold shadow segmentation. For each threshold level, pixels with relative brightness at or below the threshold are
+	//candidate shadow pixels. Connected regions of candidates (8-connected) are accepted if their pixel area exceeds the level's
+	//MinArea, and holes in an accepted region (4-connected non-candidate regions enclosed by it) are filled unless their area exceeds
+	//MinHoleArea. This lets small regions be detected if the brightness reduction is substantial, while requiring larger continuous
+	//areas for smaller reductions. A pixel is shadowed if it is accepted at any level.
+	//Area and hole filtering use connected component statistics so each level costs two labelling passes, and all levels are composed
+	//into the output shadow map in a single traversal. Label buffers are kept between calls to avoid re-allocation.
+	class ShadowSegmenter {
+		public:
+			struct ThresholdLevel {
+				uint8_t Threshold;   //Relative brightness threshold (0-255, 255 = no reduction)
+				int     MinArea;     //Min area (pixels) of a region for it to be accepted
+				int     MinHoleArea; //Holes in accepted regions are filled unless they are larger than this (pixels)
+			};
+
+			//Defaults: 30%, 20%, and 15% reduction in brightness, each with a min area of about 0.1% of visible pixels
+			std::vector<ThresholdLevel> Levels = { { 178U, 200, 40 }, { 204U, 200, 40 }, { 217U, 200, 40 } };
+
+			//Segment RelBrightness (CV_8UC1) into ShadowMap (CV_8UC1): 0 = unshadowed, 254 = shadowed, 255 = masked (Mask < 128).
+			inline void Segment(cv::Mat const & RelBrightness, cv::Mat const & Mask, cv::Mat & ShadowMap);
+
+		private:
+			cv::Mat m_candidates;     //Shared binary buffer for the current level
+			cv::Mat m_nonCandidates;  //Shared binary buffer for the current level
+			cv::Mat m_stats;          //Shared component stats buffer
+			cv::Mat m_centroids;      //Shared component centroids buffer (unused but required by OpenCV)
+			std::vector<cv::Mat> m_regionLabels;           //[level] - Labels of candidate regions
+			std::vector<cv::Mat> m_holeLabels;             //[level] - Labels of non-candidate regions
+			std::vector<std::vector<uint8_t>> m_regionLUT; //[level][label] - 1 if region is accepted
+			std::vector<std::vector<uint8_t>> m_holeLUT;   //[level][label] - 1 if non-candidate region is a hole that gets filled
+	};
+
+	inline void ShadowSegmenter::Segment(cv::Mat const & RelBrightness, cv::Mat const & Mask, cv::Mat & ShadowMap) {
+		if ((RelBrightness.type() != CV_8UC1) || (Mask.type() != CV_8UC1) || (Mask.size() != RelBrightness.size())) {
+			std::cerr << "Error in ShadowSegmenter::Segment(): Inputs have wrong type or dimensions.\r\n";
+			return;
+		}
+		int rows = RelBrightness.rows;
+		int cols = RelBrightness.cols;
+		size_t numLevels = Levels.size();
+		m_regionLabels.resize(numLevels);
+		m_holeLabels.resize(numLevels);
+		m_regionLUT.resize(numLevels);
+		m_holeLUT.resize(numLevels);
+
+		for (size_t level = 0U; level < numLevels; level++) {
+			ThresholdLevel const & params(Levels[level]);
+			cv::threshold(RelBrightness, m_candidates, double(params.Threshold), 255.0, cv::THRESH_BINARY_INV);
+			cv::bitwise_not(m_candidates, m_nonCandidates);
+
+			//Label candidate regions and accept the ones that are big enough (label 0 is the non-candidate pixels)
+			int numRegions = cv::connectedComponentsWithStats(m_candidates, m_regionLabels[level], m_stats, m_centroids, 8, CV_32S);
+			std::vector<uint8_t> & regionLUT(m_regionLUT[level]);
+			regionLUT.assign(numRegions, 0U);
+			for (int label = 1; label < numRegions; label++)
+				regionLUT[label] = (m_stats.at<int>(label, cv::CC_STAT_AREA) > params.MinArea) ? 1U : 0U;
+
+			//Label non-candidate regions. A region that doesn't touch the image border is a hole in the candidate region that borders
+			//the pixel just above its first pixel. We fill small holes in accepted regions.
+			int numHoles = cv::connectedComponentsWithStats(m_nonCandidates, m_holeLabels[level], m_stats, m_centroids, 4, CV_32S);
+			std::vector<uint8_t> & holeLUT(m_holeLUT[level]);
+			holeLUT.assign(numHoles, 0U);
+			cv::Mat const & regionLabels(m_regionLabels[level]);
+			cv::Mat const & holeLabels(m_holeLabels[level]);
+			for (int label = 1; label < numHoles; label++) {
+				int left   = m_stats.at<int>(label, cv::CC_STAT_LEFT);
+				int top    = m_stats.at<int>(label, cv::CC_STAT_TOP);
+				int width  = m_stats.at<int>(label, cv::CC_STAT_WIDTH);
+				int height = m_stats.at<int>(label, cv::CC_STAT_HEIGHT);
+				int area   = m_stats.at<int>(label, cv::CC_STAT_AREA);
+				if ((left == 0) || (top == 0) || (left + width >= cols) || (top + height >= rows) || (area > params.MinHoleArea))
+					continue;
+				int const * holeRow = holeLabels.ptr<int>(top);
+				for (int col = left; col < left + width; col++) {
+					if (holeRow[col] == label) {
+						holeLUT[label] = regionLUT[regionLabels.at<int>(top - 1, col)];
+						break;
+					}
+				}
+			}
+		}
+
+		//Compose all levels into the output shadow map in a single pass
+		ShadowMap.create(rows, cols, CV_8UC1);
+		cv::parallel_for_(cv::Range(0, rows), [&](cv::Range const & Rows) {
+			for (int row = Rows.start; row < Rows.end; row++) {
+				uint8_t const * maskRow = Mask.ptr<uint8_t>(row);
+				uint8_t * outRow = ShadowMap.ptr<uint8_t>(row);
+				for (int col = 0; col < cols; col++) {
+					if (maskRow[col] < 128U) {
+						outRow[col] = 255U;
+						continue;
+					}
+					uint8_t shadowed = 0U;
+					for (size_t level = 0U; (level < numLevels) && (shadowed == 0U); level++)
+						shadowed = m_regionLUT[level][m_regionLabels[level].ptr<int>(row)[col]] | m_holeLUT[level][m_holeLabels[level].ptr<int>(row)[col]];
+					outRow[col] = shadowed ? 254U : 0U;
+				}
+			}
+		});
+	}
+}
@@ -0,0 +1,310 @@
+//This module provides a persistent keypoint matching context for frame stabilization in the shadow detection module. It owns the
+//reference keypoints and descriptors and matches each new frame against them using a spatially gridded candidate search and a SIMD
+//Hamming distance kernel, optionally seeded with the previous frame's stabilization transform.
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+#pragma once
+
+//System Includes
+#include <vector>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+//External Includes
+#include <opencv2/opencv.hpp>
+
+namespace ShadowDetection {
+	//Hamming distance between two binary descriptors stored with a stride that is a multiple of 32 bytes (padding bytes are 0)
+	inline int HammingDistance_Padded(uint8_t const * A, uint8_t const * B, int NumBytes) {
+		int dist = 0;
+		#if defined(__AVX2__)
+		//Nibble lookup-table popcount (vpshufb) with byte sums accumulated by vpsadbw
+		__m256i const lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+		__m256i const lowMask = _mm256_set1_epi8(0x0F);
+		__m256i acc = _mm256_setzero_si256();
+		for (int n = 0; n < NumBytes; n += 32) {
+			__m256i x = _mm256_xor_si256(_mm256_loadu_si256((__m256i const *) (A + n)), _mm256_loadu_si256((__m256i const *) (B + n)));
+			__m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(x, lowMask));
+			__m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), lowMask));
+			acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+		}
+		dist = (int) (_mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) + _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3));
+		#else
+		for (int n = 0; n < NumBytes; n += 8) {
+			uint64_t a, b;
+			std::memcpy(&a, A + n, 8);
+			std::memcpy(&b, B + n, 8);
+			dist += __builtin_popcountll(a ^ b);
+		}
+		#endif
+		return dist;
+	}
+
+	//Persistent keypoint matching context for stabilization against a fixed reference frame.
+	//Matches are globally cross-checked (each keypoint must be the other's closest descriptor among all keypoints), exactly like the
+	//brute-force matcher approach, and pairs farther apart than a search radius are rejected. Each keypoint's closest descriptor on the other
+	//side is found once and the pairs that picked each other are kept. The radius is only used to prune: frame keypoints with no reference
+	//keypoint in radius (found through a uniform grid over the reference keypoints, built once) are skipped, and only reference keypoints
+	//picked by an in-radius frame keypoint are searched in the other direction. All positions are compared in reference-frame
+	//coordinates: frame keypoints are first mapped through a prior transformation (the previous frame's stabilization matrix, if seeding is
+	//enabled, or identity).
+	class StabilizationContext {
+		public:
+			double MaxKeypointMovement = 200.0; //Search radius (pixels) when not seeded - same gate as the brute-force approach
+			double SeededSearchRadius  = 100.0; //Search radius (pixels) around the predicted position when seeded with the previous transform
+			bool   SeedFromPrevious    = true;  //Use the previous frame's transformation to predict keypoint locations
+			size_t MinSeededMatches    = 20U;   //If seeded matching gives fewer matches than this, fall back to an unseeded search
+
+			StabilizationContext() = default;
+			~StabilizationContext() = default;
+
+			//Set the reference keypoints and descriptors (binary descriptors, CV_8U). Clears the stored previous transformation.
+			inline void SetReference(std::vector<cv::KeyPoint> const & Keypoints, cv::Mat const & Descriptors);
+			inline void Clear(void);
+			inline bool Empty(void) const { return m_refKeypoints.empty(); }
+
+			std::vector<cv::KeyPoint> const & GetRefKeypoints(void) const { return m_refKeypoints; }
+
+			//Match frame keypoints against the reference keypoints. If seeding is enabled and a previous transformation has been set,
+			//search around predicted locations first and fall back to an unseeded search if that gives too few matches.
+			inline void Match(std::vector<cv::KeyPoint> const & KeypointsFrame, cv::Mat const & DescriptorsFrame,
+			                  std::vector<cv::Point2f> & RefPoints, std::vector<cv::Point2f> & FramePoints) const;
+
+			//Record the stabilization matrix (2x3, frame to reference) estimated for the most recent frame, for seeding the next one
+			inline void SetPreviousTransformation(cv::Mat const & H) { m_prevH = H.clone(); }
+
+			//Globally cross-checked matching of frame keypoints against the reference keypoints. PriorH is a 2x3 transformation taking frame
+			//coords to (approximate) reference coords (use identity if unknown). On return, element n of RefPoints and FramePoints are a match.
+			inline void MatchKeypoints(std::vector<cv::KeyPoint> const & KeypointsFrame, cv::Mat const & DescriptorsFrame, cv::Mat const & PriorH,
+			                           double SearchRadius, std::vector<cv::Point2f> & RefPoints, std::vector<cv::Point2f> & FramePoints) const;
+
+		private:
+			static constexpr float CellSize = 64.0f; //Grid cell size (pixels)
+
+			//Keypoint locations binned in a uniform grid. Indices of the points in cell c are Indices[CellStarts[c]] to Indices[CellStarts[c+1] - 1].
+			struct PointGrid {
+				float MinX = 0.0f, MinY = 0.0f;
+				int   Cols = 0, Rows = 0;
+				std::vector<int> CellStarts;
+				std::vector<int> Indices;
+
+				inline void Build(std::vector<cv::Point2f> const & Points);
+				template <typename Func> inline void ForEachInRadius(cv::Point2f const & P, float Radius, Func F) const;
+			};
+
+			std::vector<cv::KeyPoint> m_refKeypoints;
+			std::vector<cv::Point2f>  m_refPoints;
+			std::vector<uint8_t>      m_refDescriptors; //Padded descriptors - row n starts at n*m_descriptorStride
+			int                       m_descriptorBytes  = 0;
+			int                       m_descriptorStride = 0;
+			PointGrid                 m_refGrid;
+			cv::Mat                   m_prevH;          //Most recent stabilization matrix (empty if none)
+
+			inline void PackDescriptors(cv::Mat const & Descriptors, std::vector<uint8_t> & Packed) const;
+	};
+
+	inline void StabilizationContext::PointGrid::Build(std::vector<cv::Point2f> const & Points) {
+		Cols = Rows = 0;
+		CellStarts.clear();
+		Indices.clear();
+		if (Points.empty())
+			return;
+
+		float maxX = Points[0].x, maxY = Points[0].y;
+		MinX = Points[0].x;
+		MinY = Points[0].y;
+		for (cv::Point2f const & p : Points) {
+			MinX = std::min(MinX, p.x); maxX = std::max(maxX, p.x);
+			MinY = std::min(MinY, p.y); maxY = std::max(maxY, p.y);
+		}
+		Cols = int((maxX - MinX) / CellSize) + 1;
+		Rows = int((maxY - MinY) / CellSize) + 1;
+
+		//Counting sort of point indices by cell
+		std::vector<int> cellOfPoint(Points.size());
+		CellStarts.assign(size_t(Cols*Rows + 1), 0);
+		for (size_t n = 0U; n < Points.size(); n++) {
+			int col = std::min(int((Points[n].x - MinX) / CellSize), Cols - 1);
+			int row = std::min(int((Points[n].y - MinY) / CellSize), Rows - 1);
+			cellOfPoint[n] = row*Cols + col;
+			CellStarts[cellOfPoint[n] + 1]++;
+		}
+		for (size_t c = 1U; c < CellStarts.size(); c++)
+			CellStarts[c] += CellStarts[c - 1];
+		Indices.resize(Points.size());
+		std::vector<int> fill(CellStarts.begin(), CellStarts.end() - 1);
+		for (size_t n = 0U; n < Points.size(); n++)
+			Indices[fill[cellOfPoint[n]]++] = (int) n;
+	}
+
+	//Call F(index) for each point in a cell that overlaps the box of half-width Radius centered at P (caller does the exact distance check)
+	template <typename Func>
+	inline void StabilizationContext::PointGrid::ForEachInRadius(cv::Point2f const & P, float Radius, Func F) const {
+		if (Cols == 0)
+			return;
+		int colMin = std::max(int(std::floor((P.x - Radius - MinX) / CellSize)), 0);
+		int colMax = std::min(int(std::floor((P.x + Radius - MinX) / CellSize)), Cols - 1);
+		int rowMin = std::max(int(std::floor((P.y - Radius - MinY) / CellSize)), 0);
+		int rowMax = std::min(int(std::floor((P.y + Radius - MinY) / CellSize)), Rows - 1);
+		for (int row = rowMin; row <= rowMax; row++) {
+			for (int col = colMin; col <= colMax; col++) {
+				int cell = row*Cols + col;
+				for (int n = CellStarts[cell]; n < CellStarts[cell + 1]; n++)
+					F(Indices[n]);
+			}
+		}
+	}
+
+	inline void StabilizationContext::PackDescriptors(cv::Mat const & Descriptors, std::vector<uint8_t> & Packed) const {
+		Packed.assign(size_t(Descriptors.rows) * size_t(m_descriptorStride), 0U);
+		for (int row = 0; row < Descriptors.rows; row++)
+			std::memcpy(&(Packed[size_t(row) * size_t(m_descriptorStride)]), Descriptors.ptr<uint8_t>(row), size_t(m_descriptorBytes));
+	}
+
+	inline void StabilizationContext::SetReference(std::vector<cv::KeyPoint> const & Keypoints, cv::Mat const & Descriptors) {
+		Clear();
+		if ((Descriptors.rows != (int) Keypoints.size()) || (Descriptors.depth() != CV_8U)) {
+			std::cerr << "Error in StabilizationContext::SetReference(): Keypoints and descriptors are inconsistent.\r\n";
+			return;
+		}
+		m_refKeypoints    = Keypoints;
+		m_descriptorBytes  = Descriptors.cols * Descriptors.channels();
+		m_descriptorStride = ((m_descriptorBytes + 31) / 32) * 32;
+		PackDescriptors(Descriptors, m_refDescriptors);
+
+		m_refPoints.resize(Keypoints.size());
+		for (size_t n = 0U; n < Keypoints.size(); n++)
+			m_refPoints[n] = Keypoints[n].pt;
+		m_refGrid.Build(m_refPoints);
+	}
+
+	inline void StabilizationContext::Clear(void) {
+		m_refKeypoints.clear();
+		m_refPoints.clear();
+		m_refDescriptors.clear();
+		m_descriptorBytes  = 0;
+		m_descriptorStride = 0;
+		m_refGrid.Build(m_refPoints);
+		m_prevH = cv::Mat();
+	}
+
+	inline void StabilizationContext::MatchKeypoints(std::vector<cv::KeyPoint> const & KeypointsFrame, cv::Mat const & DescriptorsFrame,
+	                                                 cv::Mat const & PriorH, double SearchRadius, std::vector<cv::Point2f> & RefPoints,
+	                                                 std::vector<cv::Point2f> & FramePoints) const {
+		RefPoints.clear();
+		FramePoints.clear();
+		if (m_refKeypoints.empty() || KeypointsFrame.empty())
+			return;
+		if ((DescriptorsFrame.rows != (int) KeypointsFrame.size()) || (DescriptorsFrame.cols * DescriptorsFrame.channels() != m_descriptorBytes)) {
+			std::cerr << "Error in StabilizationContext::MatchKeypoints(): Frame descriptors are inconsistent with reference descriptors.\r\n";
+			return;
+		}
+
+		std::vector<uint8_t> frameDescriptors;
+		PackDescriptors(DescriptorsFrame, frameDescriptors);
+		auto frameDesc = [&](int j) { return &(frameDescriptors[size_t(j) * size_t(m_descriptorStride)]); };
+		auto refDesc   = [&](int i) { return &(m_refDescriptors[size_t(i) * size_t(m_descriptorStride)]); };
+
+		//Predicted locations of the frame keypoints in the reference frame
+		std::vector<cv::Point2f> framePoints(KeypointsFrame.size());
+		for (size_t n = 0U; n < KeypointsFrame.size(); n++)
+			framePoints[n] = KeypointsFrame[n].pt;
+		std::vector<cv::Point2f> predictedPoints;
+		cv::transform(framePoints, predictedPoints, PriorH);
+
+		float radius = (float) SearchRadius;
+		float radiusSq = radius*radius;
+		auto closeEnough = [radiusSq](cv::Point2f const & A, cv::Point2f const & B) {
+			cv::Point2f d = A - B;
+			return d.x*d.x + d.y*d.y <= radiusSq;
+		};
+
+		//A match must be each keypoint's globally closest descriptor (ties go to the lower index, like the brute-force matcher) and the
+		//pair must be within the search radius. So we find the closest reference keypoint of each frame keypoint (one pass over the reference
+		//keypoints each, skipping frame keypoints with nothing in radius), then the closest frame keypoint of each reference keypoint that was
+		//picked by an in-radius frame keypoint (one pass over the frame keypoints each), and keep the pairs that picked each other.
+		auto closestRef = [&](uint8_t const * Desc) {
+			int bestIndex = -1;
+			int bestDist  = std::numeric_limits<int>::max();
+			for (int i = 0; i < (int) m_refKeypoints.size(); i++) {
+				int dist = HammingDistance_Padded(Desc, refDesc(i), m_descriptorStride);
+				if (dist < bestDist) {
+					bestDist  = dist;
+					bestIndex = i;
+				}
+			}
+			return bestIndex;
+		};
+		auto closestFrame = [&](uint8_t const * Desc) {
+			int bestIndex = -1;
+			int bestDist  = std::numeric_limits<int>::max();
+			for (int j = 0; j < (int) KeypointsFrame.size(); j++) {
+				int dist = HammingDistance_Padded(Desc, frameDesc(j), m_descriptorStride);
+				if (dist < bestDist) {
+					bestDist  = dist;
+					bestIndex = j;
+				}
+			}
+			return bestIndex;
+		};
+
+		std::vector<int> frameToRef(KeypointsFrame.size(), -1);
+		cv::parallel_for_(cv::Range(0, (int) KeypointsFrame.size()), [&](cv::Range const & Range) {
+			for (int j = Range.start; j < Range.end; j++) {
+				bool anyInRadius = false;
+				m_refGrid.ForEachInRadius(predictedPoints[j], radius, [&](int i) {
+					anyInRadius = anyInRadius || closeEnough(m_refPoints[i], predictedPoints[j]);
+				});
+				if (! anyInRadius)
+					continue;
+				int i = closestRef(frameDesc(j));
+				if (closeEnough(m_refPoints[i], predictedPoints[j]))
+					frameToRef[j] = i;
+			}
+		});
+
+		std::vector<int> candidateRefs;
+		std::vector<int> refToFrame(m_refKeypoints.size(), -1);
+		for (int i : frameToRef) {
+			if ((i >= 0) && (refToFrame[i] == -1)) {
+				refToFrame[i] = -2; //Mark as a candidate so it is only searched once
+				candidateRefs.push_back(i);
+			}
+		}
+		cv::parallel_for_(cv::Range(0, (int) candidateRefs.size()), [&](cv::Range const & Range) {
+			for (int n = Range.start; n < Range.end; n++)
+				refToFrame[candidateRefs[n]] = closestFrame(refDesc(candidateRefs[n]));
+		});
+		for (size_t j = 0U; j < frameToRef.size(); j++) {
+			if ((frameToRef[j] >= 0) && (refToFrame[frameToRef[j]] != int(j)))
+				frameToRef[j] = -1;
+		}
+
+		//Keep cross-checked matches (in frame keypoint order)
+		for (size_t j = 0U; j < frameToRef.size(); j++) {
+			int i = frameToRef[j];
+			if (i >= 0) {
+				RefPoints.push_back(m_refPoints[i]);
+				FramePoints.push_back(framePoints[j]);
+			}
+		}
+	}
+
+	inline void StabilizationContext::Match(std::vector<cv::KeyPoint> const & KeypointsFrame, cv::Mat const & DescriptorsFrame,
+	                                        std::vector<cv::Point2f> & RefPoints, std::vector<cv::Point2f> & FramePoints) const {
+		bool seeded = SeedFromPrevious && (m_prevH.rows == 2) && (m_prevH.cols == 3) && cv::checkRange(m_prevH);
+		if (seeded) {
+			MatchKeypoints(KeypointsFrame, DescriptorsFrame, m_prevH, SeededSearchRadius, RefPoints, FramePoints);
+			if (RefPoints.size() < MinSeededMatches)
+				seeded = false;
+		}
+		if (! seeded)
+			MatchKeypoints(KeypointsFrame, DescriptorsFrame, cv::Mat::eye(2, 3, CV_64F), MaxKeypointMovement, RefPoints, FramePoints);
+	}
+}
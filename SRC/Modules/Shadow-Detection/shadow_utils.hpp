@@ -3,6 +3,7 @@
 //External Includes
 #include <opencv2/features2d.hpp>
 #include "FRF.h"
+#include "StabilizationContext.hpp"
 
 //inline int minHessian = 400;
 
@@ -327,6 +328,29 @@ inline void GetStabilizationMatrix(cv::Mat const & Descriptors_Ref, std::vector<
 	}
 }
 
+//Same as above, but matching is done through a persistent StabilizationContext (set up with the reference keypoints and descriptors).
+//The context restricts candidate matches to nearby keypoints, uses a SIMD Hamming distance kernel, and predicts keypoint locations
+//from the previous frame's transformation when available. The estimated H is recorded in the context for seeding the next frame.
+inline void GetStabilizationMatrix(ShadowDetection::StabilizationContext & Context, cv::Mat const & Frame_BGR, cv::Mat const & ApertureMask, cv::Mat & H) {
+	std::vector<cv::KeyPoint> Keypoints_Frame;
+	cv::Mat Descriptors_Frame;
+	GetKeypointsAndDescriptors(Frame_BGR, Keypoints_Frame, Descriptors_Frame, ApertureMask);
+
+	std::vector<cv::Point2f> RefKeypoints;
+	std::vector<cv::Point2f> FrameKeypoints;
+	Context.Match(Keypoints_Frame, Descriptors_Frame, RefKeypoints, FrameKeypoints);
+
+	//See the comments in the function above for why we use a simple RT model here
+	try {
+		H = EstimateRTTransformation(FrameKeypoints, RefKeypoints);
+	}
+	catch (...) {
+		std::cerr << "EstimateRTTransformation failed. Defaulting stabilization homography.\r\n";
+		H = cv::Mat::eye(2, 3, CV_64F);
+	}
+	Context.SetPreviousTransformation(H);
+}
+
 //Note: This function is misleadingly named. estimateAffinePartial2D() estimates a 4DOF affine transformation that allows rotation, translation,
 //and uniform scaling. This is likily too general for image stabilization... rotation and translation only would be better.
 /*inline void getOrbRotation(const cv::Mat& descriptors_ref, const std::vector<cv::KeyPoint>& keypoints_ref, const cv::Mat& rot_color, cv::Mat& H) {
@@ -6,6 +6,7 @@
 #pragma once
 
 //System Includes
+#include <cmath>
 #include <random>
 #include <chrono>
 #include <numeric>
@@ -314,6 +315,22 @@ inline void sampleENUSquare(cv::Mat & inputFrame, ocam_model const & o, Eigen::M
 	}
 }
 
+//Invert a 2x3 affine stabilization matrix H (which maps current-frame coords to reference-frame coords). On return, the inverse
+//transformation (reference-frame coords to current-frame coords) is T(x) = A*x + b.
+inline void InvertStabilizationMatrix(cv::Mat const & StabilizationMatrix, Eigen::Matrix2d & A, Eigen::Vector2d & b) {
+	double h11 = StabilizationMatrix.at<double>(0,0);
+	double h12 = StabilizationMatrix.at<double>(0,1);
+	double h13 = StabilizationMatrix.at<double>(0,2);
+	double h21 = StabilizationMatrix.at<double>(1,0);
+	double h22 = StabilizationMatrix.at<double>(1,1);
+	double h23 = StabilizationMatrix.at<double>(1,2);
+	Eigen::Matrix2d H_2X2;
+	H_2X2 << h11, h12,
+	         h21, h22;
+	A = H_2X2.inverse();
+	b = -1.0 * A * Eigen::Vector2d(h13, h23);
+}
+
 //Composes a sequence of transformations to go from pixel coordinates in the EN-plane image to raw image coordinates
 //and then for each pixel in the EN-plane image, we sample the raw image in the corresponding location.
 inline void RawImageToENImage(cv::Mat const & ImageRaw, ocam_model const & o, Eigen::Matrix3d const & R_Cam_ENU,
@@ -331,19 +348,7 @@ inline void RawImageToENImage(cv::Mat const & ImageRaw, ocam_model const & o, Ei
 	//Invert the stabilization transformation. Inverse transformation will be applied: T(x) = A*x + b
 	Eigen::Matrix2d A;
 	Eigen::Vector2d b;
-	{
-		double h11 = StabilizationMatrix.at<double>(0,0);
-		double h12 = StabilizationMatrix.at<double>(0,1);
-		double h13 = StabilizationMatrix.at<double>(0,2);
-		double h21 = StabilizationMatrix.at<double>(1,0);
-		double h22 = StabilizationMatrix.at<double>(1,1);
-		double h23 = StabilizationMatrix.at<double>(1,2);
-		Eigen::Matrix2d H_2X2;
-		H_2X2 << h11, h12,
-		         h21, h22;
-		A = H_2X2.inverse();
-		b = -1.0 * A * Eigen::Vector2d(h13, h23);
-	}
+	InvertStabilizationMatrix(StabilizationMatrix, A, b);
 
 	Eigen::Vector2d NorthBounds(Center_EN(1) - max_extent / 2, Center_EN(1) + max_extent / 2);
 	Eigen::Vector2d EastBounds(Center_EN(0) - max_extent / 2, Center_EN(0) + max_extent / 2);
@@ -390,3 +395,118 @@ inline void RawImageToENImage(cv::Mat const & ImageRaw, ocam_model const & o, Ei
 		cv::waitKey(1);
 	}
 }
+
+//Build the remap table used by RemapToENImage(). For each pixel in the EN-plane image, MapX and MapY (both CV_32FC1) hold the
+//(col, row) coordinates of the corresponding point in the reference image. This is the expensive part of RawImageToENImage()
+//(ENU to camera projection and world2cam() for every output pixel), but it only depends on the reference camera pose, the camera
+//model, and the EN grid, so it only needs to be rebuilt when those change (i.e. in SetFiducials()).
+inline void BuildENRemapTable(ocam_model const & o, Eigen::Matrix3d const & R_Cam_ENU, Eigen::Vector3d const & CamCenter_ENU,
+	                         Eigen::Vector2d const & Center_EN, double max_extent, double num_pixels, cv::Mat & MapX, cv::Mat & MapY) {
+	Eigen::Vector2d NorthBounds(Center_EN(1) - max_extent / 2, Center_EN(1) + max_extent / 2);
+	Eigen::Vector2d EastBounds(Center_EN(0) - max_extent / 2, Center_EN(0) + max_extent / 2);
+	double GSD = max_extent / num_pixels;
+
+	MapX = cv::Mat(num_pixels, num_pixels, CV_32FC1);
+	MapY = cv::Mat(num_pixels, num_pixels, CV_32FC1);
+
+	Eigen::Matrix3d R_ENU_Cam = R_Cam_ENU.transpose();
+	cv::parallel_for_(cv::Range(0, MapX.rows), [&](cv::Range const & Rows) {
+		for (int row = Rows.start; row < Rows.end; row++) {
+			float * mapXRow = MapX.ptr<float>(row);
+			float * mapYRow = MapY.ptr<float>(row);
+			for (int col = 0; col < MapX.cols; col++) {
+				Eigen::Vector2d X_ENImageCoords(col, row);
+				Eigen::Vector2d X_EN = PixCoordsToRefCoords(X_ENImageCoords, GSD, num_pixels, NorthBounds, EastBounds);
+				Eigen::Vector3d X_ENU(X_EN(0), X_EN(1), 0);
+
+				Eigen::Vector3d X_Cam = R_ENU_Cam * (X_ENU - CamCenter_ENU);
+				double point_bearing[3] = { X_Cam(0), X_Cam(1), X_Cam(2) };
+				double point_pixel[2];
+				world2cam(point_pixel, point_bearing, &o);
+				mapXRow[col] = (float) point_pixel[1];
+				mapYRow[col] = (float) point_pixel[0];
+			}
+		}
+	});
+}
+
+//Bilinear sample of a uint8 image at (x,y) = (col, row) with replicated borders - same result as getColorSubpixHelper_UC*()
+//but without the per-call allocation. Channels are written to Out[0] through Out[NumChannels - 1].
+template <int NumChannels>
+inline void SampleBilinear_UC(cv::Mat const & Img, float x, float y, uint8_t * Out) {
+	int x0 = (int) std::floor(x);
+	int y0 = (int) std::floor(y);
+	float fx = x - float(x0);
+	float fy = y - float(y0);
+	int x1 = std::clamp(x0 + 1, 0, Img.cols - 1);
+	int y1 = std::clamp(y0 + 1, 0, Img.rows - 1);
+	x0 = std::clamp(x0, 0, Img.cols - 1);
+	y0 = std::clamp(y0, 0, Img.rows - 1);
+
+	uint8_t const * row0 = Img.ptr<uint8_t>(y0);
+	uint8_t const * row1 = Img.ptr<uint8_t>(y1);
+	float w00 = (1.0f - fx)*(1.0f - fy);
+	float w01 = fx*(1.0f - fy);
+	float w10 = (1.0f - fx)*fy;
+	float w11 = fx*fy;
+	for (int ch = 0; ch < NumChannels; ch++) {
+		float val = w00*float(row0[NumChannels*x0 + ch]) + w01*float(row0[NumChannels*x1 + ch]) +
+		            w10*float(row1[NumChannels*x0 + ch]) + w11*float(row1[NumChannels*x1 + ch]);
+		Out[ch] = (uint8_t) std::clamp(std::round(val), 0.0f, 255.0f);
+	}
+}
+
+//Fast replacement for calling RawImageToENImage() on both a frame and its aperture mask. MapX and MapY come from BuildENRemapTable()
+//and take EN-plane pixels to reference image coords. The (inverted) stabilization transformation is composed with the table on the fly
+//and the frame and mask are sampled together in a single pass. ImageRaw must be CV_8UC1 or CV_8UC3 and MaskRaw must be CV_8UC1 with
+//the same dimensions as ImageRaw. MaskRaw may be empty, in which case ENMask is not touched.
+inline void RemapToENImage(cv::Mat const & ImageRaw, cv::Mat const & MaskRaw, cv::Mat const & MapX, cv::Mat const & MapY,
+	                      cv::Mat & ENImage, cv::Mat & ENMask, cv::Mat StabilizationMatrix = cv::Mat::eye(2, 3, CV_64F)) {
+	if ((ImageRaw.type() != CV_8UC1) && (ImageRaw.type() != CV_8UC3)) {
+		std::cerr << "Error in RemapToENImage: Unsupported image type.\r\n";
+		return;
+	}
+	bool doMask = ! MaskRaw.empty();
+	if (doMask && ((MaskRaw.type() != CV_8UC1) || (MaskRaw.size() != ImageRaw.size()))) {
+		std::cerr << "Error in RemapToENImage: Mask has unsupported type or dimensions.\r\n";
+		return;
+	}
+	if ((StabilizationMatrix.rows != 2) || (StabilizationMatrix.cols != 3)) {
+		std::cerr << "Error in RemapToENImage: Stabilization matrix has unsupported dimensions.\r\n";
+		return;
+	}
+	if ((MapX.type() != CV_32FC1) || (MapY.type() != CV_32FC1) || (MapX.size() != MapY.size()) || MapX.empty()) {
+		std::cerr << "Error in RemapToENImage: Remap table not initialized.\r\n";
+		return;
+	}
+
+	Eigen::Matrix2d A;
+	Eigen::Vector2d b;
+	InvertStabilizationMatrix(StabilizationMatrix, A, b);
+	float a11 = (float) A(0,0), a12 = (float) A(0,1), b1 = (float) b(0);
+	float a21 = (float) A(1,0), a22 = (float) A(1,1), b2 = (float) b(1);
+
+	ENImage.create(MapX.rows, MapX.cols, ImageRaw.type());
+	if (doMask)
+		ENMask.create(MapX.rows, MapX.cols, CV_8UC1);
+
+	bool color = (ImageRaw.channels() == 3);
+	cv::parallel_for_(cv::Range(0, MapX.rows), [&](cv::Range const & Rows) {
+		for (int row = Rows.start; row < Rows.end; row++) {
+			float const * mapXRow = MapX.ptr<float>(row);
+			float const * mapYRow = MapY.ptr<float>(row);
+			uint8_t * imageRow = ENImage.ptr<uint8_t>(row);
+			uint8_t * maskRow  = doMask ? ENMask.ptr<uint8_t>(row) : nullptr;
+			for (int col = 0; col < MapX.cols; col++) {
+				float x = a11*mapXRow[col] + a12*mapYRow[col] + b1;
+				float y = a21*mapXRow[col] + a22*mapYRow[col] + b2;
+				if (color)
+					SampleBilinear_UC<3>(ImageRaw, x, y, imageRow + 3*col);
+				else
+					SampleBilinear_UC<1>(ImageRaw, x, y, imageRow + col);
+				if (doMask)
+					SampleBilinear_UC<1>(MaskRaw, x, y, maskRow + col);
+			}
+		}
+	});
+}
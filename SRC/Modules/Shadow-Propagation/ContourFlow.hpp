@@ -0,0 +1,491 @@
+//This module provides geometry utilities for the contour flow shadow propagation method: extraction of shadow polygons from instantaneous
+//shadow maps, nearest-boundary queries against the shadows of a previous map (both brute-force and through a spatial index), and
+//rasterization of the area swept by propagated shadows into a time available function.
+//Authors: Bryan Poling
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+#pragma once
+
+//System Includes
+#include <vector>
+#include <tuple>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+
+//External Includes
+#include <opencv2/opencv.hpp>
+
+//Project Includes
+#include "../../EigenAliases.h"
+#include "../../Polygon.hpp"
+
+namespace ShadowPropagation {
+	//Take a vector of cv::Point objects and populate the given simple polygon using it.
+	//N controls thinning behavior... we take every N'th point when making the simple polygon
+	//Returns true on success and false if the source contour is degenerate (fewer than 3 points) or
+	//if it is very small and should be ignored.
+	inline bool CVContourToSimplePolygon(std::vector<cv::Point> const & Contour, SimplePolygon & SPoly, int N = 1) {
+		if (Contour.size() < 3U)
+			return false;
+		N = std::clamp(N, 1, int(Contour.size())/3);
+
+		std::Evector<Eigen::Vector2d> points;
+		points.reserve(int(Contour.size())/N + 3);
+		for (int index = 0; index < (int) Contour.size(); index += N)
+			points.push_back(Eigen::Vector2d(Contour[index].x, Contour[index].y));
+
+		SPoly.SetBoundary(points);
+
+		//Return success if the simple ploygon has significant area - this ignores tiny shadows
+		//We just use a hard-coded limit of 10 pixels... anything smaller than this gets culled.
+		//if (SPoly.GetArea() <= 10.0)
+		//	std::cerr << "Culling small contour. Area: " << SPoly.GetArea() << "\r\n";
+		return (SPoly.GetArea() > 10.0);
+	}
+
+	//Build a polygon (with holes) for each shadow in an instantaneous shadow map (Map has the same definition as in InstantaneousShadowMap).
+	//Contours are thinned by taking every N'th point.
+	inline void ShadowMapToShadowPolygons(cv::Mat const & Map, std::Evector<Polygon> & Shadows, int N = 4) {
+		cv::Mat unmaskedShadowMap;
+		Map.copyTo(unmaskedShadowMap);
+		unmaskedShadowMap.setTo(0, unmaskedShadowMap == 255);
+		unmaskedShadowMap.setTo(0, unmaskedShadowMap  < 128);
+		std::vector<std::vector<cv::Point>> contours;
+		std::vector<cv::Vec4i> hierarchy;
+		cv::findContours(unmaskedShadowMap, contours, hierarchy, cv::RETR_CCOMP, cv::CHAIN_APPROX_NONE);
+
+		Shadows.clear();
+		for (int index = 0; index < (int) contours.size(); index++) {
+			if (hierarchy[index][3] < 0) {
+				//This is a shadow outer boundary
+				Shadows.emplace_back();
+				if (! CVContourToSimplePolygon(contours[index], Shadows.back().m_boundary, N))
+					Shadows.pop_back();
+				else {
+					//Add any child contours as holes in the shadow
+					int childIndex = hierarchy[index][2];
+					while (childIndex >= 0) {
+						Shadows.back().m_holes.emplace_back();
+						if (! CVContourToSimplePolygon(contours[childIndex], Shadows.back().m_holes.back(), N))
+							Shadows.back().m_holes.pop_back();
+						childIndex = hierarchy[childIndex][0];
+					}
+				}
+			}
+		}
+	}
+
+	//For a given point X find the closest boundary point in the collection of provided shadows. If shadows is empty, we return false.
+	//Otherwise we will find a closest boundary point and return true. When successful we pass back the location of the
+	//point we found, along with it's location in the input shadow data structure: <polyIndex, simplePolyIndex, vertexIndex>
+	//There is an important subtlety here: the output index will refer to an existing vertex in the input Shadows data structure,
+	//but the output ClosestBdryPoint may not coincide with an actual vertex of any simple polygon... this is because we
+	//find the closest point on the boundary of a shadow... which may be on a segment between vertices.
+	//This is a linear scan over all vertices of all shadows. See ShadowBoundaryIndex for a faster way to answer the same query.
+	inline bool FindClosestBoundaryPoint(Eigen::Vector2d const & X, std::Evector<Polygon> const & Shadows, int & PolyIndex,
+		                                int & SimplePolyIndex, int & VertexIndex, Eigen::Vector2d & ClosestBdryPoint) {
+		double closestPointDist = std::nan("");
+		for (int polyIndex = 0; polyIndex < (int) Shadows.size(); polyIndex++) {
+			Polygon const & poly(Shadows[polyIndex]);
+			for (int simplePolyIndex = -1; simplePolyIndex < (int) poly.m_holes.size(); simplePolyIndex++) {
+				SimplePolygon const & simplePoly(simplePolyIndex < 0 ? poly.m_boundary : poly.m_holes[simplePolyIndex]);
+
+				size_t closestVertexIndex = 0U;
+				Eigen::Vector2d projection = simplePoly.ProjectPointToBoundary(X, closestVertexIndex);
+				double projectionDist = (X - projection).norm();
+
+				if (std::isnan(closestPointDist) || (projectionDist < closestPointDist)) {
+					PolyIndex        = polyIndex;
+					SimplePolyIndex  = simplePolyIndex;
+					VertexIndex      = (int) closestVertexIndex;
+					ClosestBdryPoint = projection;
+					closestPointDist = projectionDist;
+				}
+			}
+		}
+		return (! std::isnan(closestPointDist));
+	}
+
+	//Spatial index over the boundary segments of a collection of shadows, for nearest-boundary queries. The index is a uniform grid where each
+	//segment is registered in every cell overlapped by its bounding box. Queries visit rings of cells around the query point, moving outward,
+	//and stop once no unvisited cell can hold a closer segment. FindClosestBoundaryPoint() gives exactly the same answers as the brute-force
+	//function of the same name: distances are computed the same way (SimplePolygon::ProjectPointToBoundary() logic) and ties are broken in favor
+	//of the segment that comes first in (polyIndex, simplePolyIndex, segment) order, which is the segment the linear scan would keep.
+	//The index holds its own copy of the segments, so it remains valid if the source shadows are modified or destroyed.
+	class ShadowBoundaryIndex {
+		public:
+			EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+			ShadowBoundaryIndex() = default;
+			ShadowBoundaryIndex(std::Evector<Polygon> const & Shadows) { Build(Shadows); }
+			~ShadowBoundaryIndex() = default;
+
+			inline void Build(std::Evector<Polygon> const & Shadows);
+			inline bool Empty(void) const { return m_segments.empty() && m_emptySimplePolys.empty(); }
+			inline bool FindClosestBoundaryPoint(Eigen::Vector2d const & X, int & PolyIndex, int & SimplePolyIndex, int & VertexIndex,
+			                                     Eigen::Vector2d & ClosestBdryPoint) const;
+
+		private:
+			//Boundary segment from vertex VertexA to vertex VertexB of simple polygon (PolyIndex, SimplePolyIndex)
+			struct IndexedSegment {
+				EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+				LineSegment Segment;
+				Eigen::Vector2d BoxMin;
+				Eigen::Vector2d BoxMax;
+				int PolyIndex;
+				int SimplePolyIndex;
+				int VertexA;
+				int VertexB;
+			};
+
+			std::Evector<IndexedSegment> m_segments;
+			std::vector<std::tuple<int,int>> m_emptySimplePolys; //Simple polygons with no vertices - these "project" every point to itself
+
+			double m_minX = 0.0, m_minY = 0.0;
+			double m_cellSize = 1.0;
+			int    m_cols = 0, m_rows = 0;
+			std::vector<int> m_cellStarts; //Segments in cell c are m_cellSegments[m_cellStarts[c]] to m_cellSegments[m_cellStarts[c+1] - 1]
+			std::vector<int> m_cellSegments;
+
+			inline int CellCol(double x) const { return (int) std::floor((x - m_minX) / m_cellSize); }
+			inline int CellRow(double y) const { return (int) std::floor((y - m_minY) / m_cellSize); }
+
+			//Returns true if candidate (Dist, Key) beats (BestDist, BestKey) - lower distance wins and ties go to the lower key
+			static inline bool IsBetter(double Dist, std::tuple<int,int,int> const & Key, double BestDist, std::tuple<int,int,int> const & BestKey) {
+				return std::isnan(BestDist) || (Dist < BestDist) || ((Dist == BestDist) && (Key < BestKey));
+			}
+	};
+
+	inline void ShadowBoundaryIndex::Build(std::Evector<Polygon> const & Shadows) {
+		m_segments.clear();
+		m_emptySimplePolys.clear();
+		m_cellStarts.clear();
+		m_cellSegments.clear();
+		m_cols = m_rows = 0;
+
+		for (int polyIndex = 0; polyIndex < (int) Shadows.size(); polyIndex++) {
+			Polygon const & poly(Shadows[polyIndex]);
+			for (int simplePolyIndex = -1; simplePolyIndex < (int) poly.m_holes.size(); simplePolyIndex++) {
+				SimplePolygon const & simplePoly(simplePolyIndex < 0 ? poly.m_boundary : poly.m_holes[simplePolyIndex]);
+				std::Evector<Eigen::Vector2d> const & vertices(simplePoly.GetVertices());
+				if (vertices.empty()) {
+					m_emptySimplePolys.push_back(std::make_tuple(polyIndex, simplePolyIndex));
+					continue;
+				}
+				//Same segments as SimplePolygon::ProjectPointToBoundary(), including the closing segment. A single-vertex polygon gives
+				//a single degenerate segment, which projects every point to that vertex (as ProjectPointToBoundary() does).
+				for (int n = 0; n < (int) vertices.size(); n++) {
+					int nextIndex = (n + 1 < (int) vertices.size()) ? n + 1 : 0;
+					m_segments.emplace_back();
+					IndexedSegment & seg(m_segments.back());
+					seg.Segment         = LineSegment(vertices[n], vertices[nextIndex]);
+					seg.BoxMin          = vertices[n].cwiseMin(vertices[nextIndex]);
+					seg.BoxMax          = vertices[n].cwiseMax(vertices[nextIndex]);
+					seg.PolyIndex       = polyIndex;
+					seg.SimplePolyIndex = simplePolyIndex;
+					seg.VertexA         = n;
+					seg.VertexB         = nextIndex;
+				}
+			}
+		}
+		if (m_segments.empty())
+			return;
+
+		//Size the grid for roughly 2 segments per cell
+		Eigen::Vector2d boxMin = m_segments[0].BoxMin;
+		Eigen::Vector2d boxMax = m_segments[0].BoxMax;
+		for (IndexedSegment const & seg : m_segments) {
+			boxMin = boxMin.cwiseMin(seg.BoxMin);
+			boxMax = boxMax.cwiseMax(seg.BoxMax);
+		}
+		double width  = boxMax(0) - boxMin(0);
+		double height = boxMax(1) - boxMin(1);
+		m_cellSize = std::sqrt(2.0 * std::max(width*height, 1.0) / double(m_segments.size()));
+		m_cellSize = std::max({m_cellSize, width/1024.0, height/1024.0, 1e-6});
+		m_minX = boxMin(0);
+		m_minY = boxMin(1);
+		m_cols = std::max(CellCol(boxMax(0)), 0) + 1;
+		m_rows = std::max(CellRow(boxMax(1)), 0) + 1;
+
+		//Counting sort of segment indices into cells (two passes over the cells overlapped by each segment bounding box)
+		m_cellStarts.assign(size_t(m_cols) * size_t(m_rows) + 1U, 0);
+		for (int pass = 0; pass < 2; pass++) {
+			std::vector<int> fill;
+			if (pass == 1) {
+				for (size_t c = 1U; c < m_cellStarts.size(); c++)
+					m_cellStarts[c] += m_cellStarts[c - 1];
+				m_cellSegments.resize(m_cellStarts.back());
+				fill.assign(m_cellStarts.begin(), m_cellStarts.end() - 1);
+			}
+			for (int segIndex = 0; segIndex < (int) m_segments.size(); segIndex++) {
+				IndexedSegment const & seg(m_segments[segIndex]);
+				int colMin = std::clamp(CellCol(seg.BoxMin(0)), 0, m_cols - 1);
+				int colMax = std::clamp(CellCol(seg.BoxMax(0)), 0, m_cols - 1);
+				int rowMin = std::clamp(CellRow(seg.BoxMin(1)), 0, m_rows - 1);
+				int rowMax = std::clamp(CellRow(seg.BoxMax(1)), 0, m_rows - 1);
+				for (int row = rowMin; row <= rowMax; row++) {
+					for (int col = colMin; col <= colMax; col++) {
+						int cell = row*m_cols + col;
+						if (pass == 0)
+							m_cellStarts[cell + 1]++;
+						else
+							m_cellSegments[fill[cell]++] = segIndex;
+					}
+				}
+			}
+		}
+	}
+
+	inline bool ShadowBoundaryIndex::FindClosestBoundaryPoint(Eigen::Vector2d const & X, int & PolyIndex, int & SimplePolyIndex,
+	                                                          int & VertexIndex, Eigen::Vector2d & ClosestBdryPoint) const {
+		double bestDist = std::nan("");
+		std::tuple<int,int,int> bestKey(0, 0, 0);
+		int bestSegment = -1;
+
+		//Simple polygons with no vertices project X to itself (distance 0)
+		for (auto const & item : m_emptySimplePolys) {
+			std::tuple<int,int,int> key(std::get<0>(item), std::get<1>(item), 0);
+			if (IsBetter(0.0, key, bestDist, bestKey)) {
+				bestDist = 0.0;
+				bestKey  = key;
+			}
+		}
+
+		if (! m_segments.empty()) {
+			//Chebyshev distance (in cells) from X's cell to the grid - rings closer than this have no cells in the grid
+			int col = CellCol(X(0));
+			int row = CellRow(X(1));
+			int ringStart = std::max({0, -col, col - (m_cols - 1), -row, row - (m_rows - 1)});
+			int ringEnd   = std::max({std::abs(col), std::abs(col - (m_cols - 1)), std::abs(row), std::abs(row - (m_rows - 1))});
+
+			//Returns true if a lower bound on a candidate's distance rules it out. The projection computed for a segment can land a rounding
+			//error outside of the segment bounding box, so we allow a little slack - pruning must never drop a candidate that could tie.
+			auto RuledOut = [&bestDist](double LowerBound) {
+				return (! std::isnan(bestDist)) && (LowerBound > bestDist + 1e-9*(1.0 + bestDist));
+			};
+
+			//Every point of a cell in ring r is at least (r-1)*m_cellSize from X
+			auto VisitCell = [&](int CellRow, int CellCol) {
+				if ((CellRow < 0) || (CellRow >= m_rows) || (CellCol < 0) || (CellCol >= m_cols))
+					return;
+				int cell = CellRow*m_cols + CellCol;
+				for (int n = m_cellStarts[cell]; n < m_cellStarts[cell + 1]; n++) {
+					int segIndex = m_cellSegments[n];
+					IndexedSegment const & seg(m_segments[segIndex]);
+
+					//Every projection onto the segment lies in its bounding box, so the box distance is a lower bound on the
+					//projection distance. Only skip when it is strictly larger than the best so ties are still resolved by key.
+					double dx = std::max({seg.BoxMin(0) - X(0), 0.0, X(0) - seg.BoxMax(0)});
+					double dy = std::max({seg.BoxMin(1) - X(1), 0.0, X(1) - seg.BoxMax(1)});
+					if (RuledOut(std::sqrt(dx*dx + dy*dy)))
+						continue;
+					Eigen::Vector2d projection = seg.Segment.ProjectPoint(X);
+					double dist = (projection - X).norm();
+					std::tuple<int,int,int> key(seg.PolyIndex, seg.SimplePolyIndex, seg.VertexA);
+					if (IsBetter(dist, key, bestDist, bestKey)) {
+						bestDist         = dist;
+						bestKey          = key;
+						bestSegment      = segIndex;
+						ClosestBdryPoint = projection;
+					}
+				}
+			};
+
+			for (int r = ringStart; r <= ringEnd; r++) {
+				if (RuledOut(double(r - 1)*m_cellSize))
+					break;
+				if (r == 0)
+					VisitCell(row, col);
+				else {
+					for (int c = col - r; c <= col + r; c++) {
+						VisitCell(row - r, c);
+						VisitCell(row + r, c);
+					}
+					for (int rr = row - r + 1; rr <= row + r - 1; rr++) {
+						VisitCell(rr, col - r);
+						VisitCell(rr, col + r);
+					}
+				}
+			}
+		}
+
+		if (std::isnan(bestDist))
+			return false;
+		PolyIndex       = std::get<0>(bestKey);
+		SimplePolyIndex = std::get<1>(bestKey);
+		if (bestSegment < 0) {
+			//An empty simple polygon won
+			VertexIndex      = 0;
+			ClosestBdryPoint = X;
+		}
+		else {
+			//Same endpoint choice as SimplePolygon::ProjectPointToBoundary()
+			IndexedSegment const & seg(m_segments[bestSegment]);
+			double distFromPointA = (X - seg.Segment.m_endpoint1).norm();
+			double distFromPointB = (X - seg.Segment.m_endpoint2).norm();
+			VertexIndex = (distFromPointA < distFromPointB) ? seg.VertexA : seg.VertexB;
+		}
+		return true;
+	}
+
+	//A simple polygon whose vertices move with constant velocity. At step k, vertex i is at Vertices[i] + k*StepDisplacements[i].
+	struct MovingRing {
+		std::Evector<Eigen::Vector2d> Vertices;
+		std::Evector<Eigen::Vector2d> StepDisplacements;
+	};
+
+	//A moving shadow: its outer boundary followed by any holes. Pixels are in the shadow at a given step if they are inside an odd number
+	//of rings at that step (even-odd rule), or if they lie on one of the ring outlines.
+	struct MovingShadow {
+		std::vector<MovingRing> Rings;
+	};
+
+	namespace ContourFlowInternal {
+		//Reusable buffers for RasterizeMovingShadow()
+		struct ScanlineScratch {
+			std::vector<int>    BucketStarts; //Crossings in bucket b are Crossings[BucketStarts[b]] to Crossings[BucketStarts[b+1] - 1]
+			std::vector<int>    Fill;
+			std::vector<double> Crossings;
+		};
+
+		//Rasterize a single moving shadow into Canvas (CV_16UC1), writing min(Canvas(pixel), StepValues[k]) for every step k at which
+		//the pixel is covered. We make one pass over the shadow edges, and for each edge we emit the scan-line crossings (at integer
+		//row coordinates) of each of its future instances. Crossings are bucketed by (step, row) with a counting sort, and spans between
+		//pairs of crossings are filled. Since StepValues is non-decreasing, min-writes leave each pixel holding the value of the first
+		//step covering it, regardless of the order we visit steps in.
+		inline void RasterizeMovingShadow(MovingShadow const & Shadow, std::vector<uint16_t> const & StepValues, cv::Mat & Canvas,
+		                                  ScanlineScratch & Scratch) {
+			int numSteps = (int) StepValues.size();
+			double lastStep = double(numSteps - 1);
+
+			//Rows touched by the shadow at any step (a half-pixel margin for the outlines, which are drawn with rounding)
+			double yMin = std::numeric_limits<double>::infinity();
+			double yMax = -std::numeric_limits<double>::infinity();
+			for (MovingRing const & ring : Shadow.Rings) {
+				for (size_t n = 0U; n < ring.Vertices.size(); n++) {
+					double y0 = ring.Vertices[n](1);
+					double y1 = y0 + lastStep*ring.StepDisplacements[n](1);
+					yMin = std::min({yMin, y0, y1});
+					yMax = std::max({yMax, y0, y1});
+				}
+			}
+			if (yMin > yMax)
+				return;
+			int rowLo = std::max(0, (int) std::floor(yMin - 0.5));
+			int rowHi = std::min(Canvas.rows - 1, (int) std::ceil(yMax + 0.5));
+			if (rowLo > rowHi)
+				return;
+			int numRows = rowHi - rowLo + 1;
+
+			//Calls Emit(bucket, x) for each crossing of each future instance of each edge with a row center line. Each edge covers
+			//the half-open interval [yLow, yHigh) so shared vertices are counted once and horizontal edges are skipped.
+			auto ForEachCrossing = [&](auto && Emit) {
+				for (MovingRing const & ring : Shadow.Rings) {
+					int numVertices = (int) ring.Vertices.size();
+					for (int n = 0; n < numVertices; n++) {
+						int nextIndex = (n + 1 < numVertices) ? n + 1 : 0;
+						for (int step = 0; step < numSteps; step++) {
+							Eigen::Vector2d A = ring.Vertices[n]         + double(step)*ring.StepDisplacements[n];
+							Eigen::Vector2d B = ring.Vertices[nextIndex] + double(step)*ring.StepDisplacements[nextIndex];
+							if (A(1) == B(1))
+								continue;
+							int rowStart = std::max(rowLo, (int) std::ceil(std::min(A(1), B(1))));
+							int rowEnd   = std::min(rowHi, (int) std::ceil(std::max(A(1), B(1))) - 1);
+							double slope = (B(0) - A(0)) / (B(1) - A(1));
+							for (int row = rowStart; row <= rowEnd; row++)
+								Emit(step*numRows + row - rowLo, A(0) + (double(row) - A(1))*slope);
+						}
+					}
+				}
+			};
+
+			Scratch.BucketStarts.assign(size_t(numSteps)*size_t(numRows) + 1U, 0);
+			ForEachCrossing([&Scratch](int Bucket, double) { Scratch.BucketStarts[Bucket + 1]++; });
+			for (size_t b = 1U; b < Scratch.BucketStarts.size(); b++)
+				Scratch.BucketStarts[b] += Scratch.BucketStarts[b - 1];
+			Scratch.Crossings.resize(Scratch.BucketStarts.back());
+			Scratch.Fill.assign(Scratch.BucketStarts.begin(), Scratch.BucketStarts.end() - 1);
+			ForEachCrossing([&Scratch](int Bucket, double x) { Scratch.Crossings[Scratch.Fill[Bucket]++] = x; });
+
+			//Fill interior spans - pixel centers with ceil(xIn) <= col <= floor(xOut)
+			for (int step = 0; step < numSteps; step++) {
+				uint16_t value = StepValues[step];
+				for (int rowOffset = 0; rowOffset < numRows; rowOffset++) {
+					int bucket = step*numRows + rowOffset;
+					double * begin = Scratch.Crossings.data() + Scratch.BucketStarts[bucket];
+					double * end   = Scratch.Crossings.data() + Scratch.BucketStarts[bucket + 1];
+					if (end - begin < 2)
+						continue;
+					std::sort(begin, end);
+					uint16_t * rowPtr = Canvas.ptr<uint16_t>(rowLo + rowOffset);
+					for (double * x = begin; x + 1 < end; x += 2) {
+						int colStart = std::max(0, (int) std::ceil(x[0]));
+						int colEnd   = std::min(Canvas.cols - 1, (int) std::floor(x[1]));
+						for (int col = colStart; col <= colEnd; col++)
+							rowPtr[col] = std::min(rowPtr[col], value);
+					}
+				}
+			}
+
+			//Outlines - these catch the boundary pixels that the interior fill misses (e.g. the bottom row of a shadow, or slivers
+			//thinner than a pixel), so the result covers what cv::drawContours() would cover.
+			for (MovingRing const & ring : Shadow.Rings) {
+				int numVertices = (int) ring.Vertices.size();
+				for (int n = 0; n < numVertices; n++) {
+					int nextIndex = (n + 1 < numVertices) ? n + 1 : 0;
+					for (int step = 0; step < numSteps; step++) {
+						uint16_t value = StepValues[step];
+						Eigen::Vector2d A = ring.Vertices[n]         + double(step)*ring.StepDisplacements[n];
+						Eigen::Vector2d B = ring.Vertices[nextIndex] + double(step)*ring.StepDisplacements[nextIndex];
+						int numSamples = std::max(1, (int) std::ceil((B - A).cwiseAbs().maxCoeff()));
+						for (int sample = 0; sample <= numSamples; sample++) {
+							Eigen::Vector2d P = A + (B - A)*(double(sample) / double(numSamples));
+							int col = (int) std::lround(P(0));
+							int row = (int) std::lround(P(1));
+							if ((row >= 0) && (row < Canvas.rows) && (col >= 0) && (col < Canvas.cols)) {
+								uint16_t & pixel(Canvas.at<uint16_t>(row, col));
+								pixel = std::min(pixel, value);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	//Rasterize the area swept by a collection of moving shadows over steps 0, 1, ..., StepValues.size() - 1 into TA (CV_16UC1). Each pixel
+	//covered by some shadow at some step is set to min(TA(pixel), StepValues[k]), where k is the first step at which the pixel is covered.
+	//StepValues must be non-decreasing. Pixels that are never covered are left untouched, so TA should be initialized by the caller.
+	//Shadows are dealt round-robin to one chunk per thread. Each chunk is rasterized into a private canvas and the canvases are then
+	//min-reduced into TA, so the result does not depend on the number of threads.
+	inline void RasterizeTimeAvailable(std::vector<MovingShadow> const & Shadows, std::vector<uint16_t> const & StepValues, cv::Mat & TA) {
+		if (TA.type() != CV_16UC1) {
+			std::cerr << "Error in RasterizeTimeAvailable(): TA must be of type CV_16UC1.\r\n";
+			return;
+		}
+		if (Shadows.empty() || StepValues.empty())
+			return;
+
+		int numChunks = std::clamp(cv::getNumThreads(), 1, (int) Shadows.size());
+		if (numChunks == 1) {
+			ContourFlowInternal::ScanlineScratch scratch;
+			for (MovingShadow const & shadow : Shadows)
+				ContourFlowInternal::RasterizeMovingShadow(shadow, StepValues, TA, scratch);
+			return;
+		}
+
+		std::vector<cv::Mat> canvases(numChunks);
+		cv::parallel_for_(cv::Range(0, numChunks), [&](cv::Range const & Range) {
+			ContourFlowInternal::ScanlineScratch scratch;
+			for (int chunk = Range.start; chunk < Range.end; chunk++) {
+				canvases[chunk] = cv::Mat(TA.rows, TA.cols, CV_16UC1, cv::Scalar(std::numeric_limits<uint16_t>::max()));
+				for (size_t shadowIndex = size_t(chunk); shadowIndex < Shadows.size(); shadowIndex += size_t(numChunks))
+					ContourFlowInternal::RasterizeMovingShadow(Shadows[shadowIndex], StepValues, canvases[chunk], scratch);
+			}
+		}, numChunks);
+		for (cv::Mat const & canvas : canvases)
+			cv::min(TA, canvas, TA);
+	}
+}
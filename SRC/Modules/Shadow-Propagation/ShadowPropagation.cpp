@@ -15,45 +15,25 @@
 #include "ShadowPropagation.hpp"
 #include "../../Utilities.hpp"
 #include "../../Polygon.hpp"
+#include "ContourFlow.hpp"
 
+//Report NaN, negative, and >1 elements of a tensor. Counting is done with whole-tensor ops (a few reductions) rather than per-element access
 static void CheckForBadTensorValues(torch::Tensor const & T) {
-	int NaNCount = 0;
-	int negativeCount = 0;
-	int over1Count = 0;
-	
-	for (int n = 0; n < 64; n++) {
-		for (int m = 0; m < 64; m++) {
-			float val = T[0][0][n][m].item<float>();
-			if (std::isnan(val)) {
-				//std::cerr << "Element (0,0," << n << "," << m << ") is NaN.\r\n";
-				NaNCount++;
-			}
-			else if (val < 0.0f) {
-				//std::cerr << "Element (0,0," << n << "," << m << ") is negative.\r\n";
-				negativeCount++;
-			}
-			else if (val > 1.0f) {
-				//std::cerr << "Element (0,0," << n << "," << m << ") exceeds 1.0\r\n";
-				over1Count++;
-			}
-		}
-	}
+	int64_t NaNCount      = T.isnan().sum().item<int64_t>();
+	int64_t negativeCount = T.lt(0.0f).sum().item<int64_t>(); //Comparisons with NaN are false so NaNs aren't double-counted
+	int64_t over1Count    = T.gt(1.0f).sum().item<int64_t>();
 	if ((NaNCount == 0) && (negativeCount == 0) && (over1Count == 0))
 		std::cerr << "All elements are OK.\r\n";
 	else
 		std::cerr << "Tensor contains " << NaNCount << " NaNs, " << negativeCount << " negative vals, " << over1Count << " vals over 1.\r\n";
 }
 
+//Eigen matrices are column-major so we wrap the data in a strided view and let LibTorch do the (single) copy to a contiguous tensor on Dev
 static torch::Tensor EigenMatrixToTensor(Eigen::MatrixXf const & M, torch::Device const & Dev) {
 	auto options = torch::TensorOptions().dtype(torch::kFloat32).layout(torch::kStrided).device(torch::kCPU);
-	torch::Tensor T = torch::empty({1, 1, 64, 64}, options);
-	
-	auto accessor = T.accessor<float,4>();
-	for (int n = 0; n < 64; n++) {
-		for (int m = 0; m < 64; m++)
-			accessor[0][0][n][m] = M(n,m);
-	}
-	return T.to(Dev);
+	torch::Tensor view = torch::from_blob(const_cast<float *>(M.data()), {1, 1, M.rows(), M.cols()},
+	                                      {M.rows()*M.cols(), M.rows()*M.cols(), 1, M.rows()}, options);
+	return view.contiguous().to(Dev);
 }
 
 //Create a 64x64 floating point shadow map matrix where each pixel is in the range 0-1 from an instantanious shadow map object.
@@ -170,6 +150,33 @@ static Eigen::MatrixXf ShadowMapIntToFloat_UsingMask(ShadowDetection::Instantane
 	return shadowMapMatrix;
 }
 
+//Same conversion as ShadowMapIntToFloat_UsingMask(), but writes into a caller-owned 64x64 CV_32FC1 matrix (row-major, continuous) so it can
+//be wrapped by a tensor without copying. Out is only (re)allocated if it has the wrong size or type.
+static void ShadowMapIntToFloat_UsingMask(ShadowDetection::InstantaneousShadowMap const & ShadowMap, cv::Mat & Out) {
+	if ((Out.rows != 64) || (Out.cols != 64) || (Out.type() != CV_32FC1) || (! Out.isContinuous()))
+		Out = cv::Mat(64, 64, CV_32FC1);
+	for (int targetRow = 0; targetRow < 64; targetRow++) {
+		float * outRow = Out.ptr<float>(targetRow);
+		for (int targetCol = 0; targetCol < 64; targetCol++) {
+			float sum = 0.0f;
+			int count = 0;
+			for (int sourceRow = 8*targetRow+3; sourceRow <= 8*targetRow+4; sourceRow++) {
+				uint8_t const * sourceRowPtr = ShadowMap.Map.ptr<uint8_t>(sourceRow);
+				for (int sourceCol = 8*targetCol+3; sourceCol <= 8*targetCol+4; sourceCol++) {
+					uint8_t intVal = sourceRowPtr[sourceCol];
+					float floatVal = float(intVal) / 254.0;
+					if (intVal < uint8_t(255)) {
+						//Non-masked pixel
+						sum += floatVal;
+						count++;
+					}
+				}
+			}
+			outRow[targetCol] = (count > 0) ? sum / float(count) : 0.0f;
+		}
+	}
+}
+
 //Show a shadow map matrix after it has been converted to a 64x64 float matrix. This is a development function and should
 //not normally be called. This is really to compare different conversion methods.
 static void ShowShadowMapFloatMatrix(Eigen::MatrixXf const & ShadowMapMatrix, std::string const & WindowName) {
@@ -196,21 +203,50 @@ static void ShowShadowMapFloatMatrix(Eigen::MatrixXf const & ShadowMapMatrix, st
 }
 
 //Take a predicted shadow map, a given number of epochs in the future and update an epochs available map
+//CurrentPredictionTensor must be a contiguous 1x1x64x64 float tensor on the CPU
 static void UpdateEAMap(cv::Mat & EA, torch::Tensor const & CurrentPredictionTensor, uint16_t EpochsInFuture, float DetThreshold) {
 	if ((EA.rows != 64) || (EA.cols != 64)) {
 		std::cerr << "Error in UpdateEAMap: EA (Epochs Available) map has wrong dimensions.\r\n";
 		return;
 	}
+	if ((! CurrentPredictionTensor.device().is_cpu()) || (! CurrentPredictionTensor.is_contiguous()) || (CurrentPredictionTensor.numel() != 64*64)) {
+		std::cerr << "Error in UpdateEAMap: Prediction tensor must be a contiguous 64x64 CPU tensor.\r\n";
+		return;
+	}
+	float const * predictedVals = CurrentPredictionTensor.data_ptr<float>();
 	for (int i = 0; i < 64; i++) {
+		uint16_t * EARow = EA.ptr<uint16_t>(i);
 		for (int j = 0; j < 64; j++) {
-			float predictedVal = CurrentPredictionTensor[0][0][i][j].item<float>();
-			uint16_t currentEA = EA.at<uint16_t>(i, j);
-			if ((predictedVal > DetThreshold) && (EpochsInFuture < currentEA))
-				EA.at<uint16_t>(i, j) = EpochsInFuture;
+			if ((predictedVals[64*i + j] > DetThreshold) && (EpochsInFuture < EARow[j]))
+				EARow[j] = EpochsInFuture;
 		}
 	}
 }
 
+//The recurrent state of the TorchScript model lives in List[Tensor] attributes of its submodules (e.g. the H and C lists of the ConvLSTM).
+//Forward steps replace list elements rather than modifying tensors in place, so a snapshot only needs to hold on to the tensor handles.
+//This lets us roll the model forward into the future and then rewind it to the state it had after the last observed shadow map.
+class RecurrentStateSnapshot {
+	public:
+		void Save(torch::jit::script::Module const & Module) {
+			m_state.clear();
+			for (auto const & submodule : Module.named_modules()) {
+				for (auto const & attr : submodule.value.named_attributes(false)) {
+					if (attr.value.isTensorList())
+						m_state.push_back(std::make_tuple(submodule.value, attr.name, attr.value.toTensorVector()));
+				}
+			}
+		}
+
+		void Restore(void) {
+			for (auto & item : m_state)
+				std::get<0>(item).setattr(std::get<1>(item), c10::List<at::Tensor>(std::get<2>(item)));
+		}
+
+	private:
+		std::vector<std::tuple<torch::jit::script::Module, std::string, std::vector<at::Tensor>>> m_state;
+};
+
 /*static cv::Mat EAMapToTAMap(cv::Mat const & EA, double SecondsPerEpoch) {
 	uint16_t maxUint16Val = std::numeric_limits<uint16_t>::max();
 	cv::Mat TA(EA.size(), CV_16UC1, cv::Scalar(maxUint16Val));
@@ -276,6 +312,10 @@ namespace ShadowPropagation {
 		const     int   TIME_HORIZON        = 10;   //Number of epochs (not necessarily seconds) to predict into future
 		constexpr float OUTPUT_THRESHOLD    = 0.4f; //Min float value in prediction to be interpreted as shadowing
 
+		//When true, the LSTM hidden state is carried from one shadow map to the next, so each new map costs a single step plus the
+		//rollout. When false, the LSTM is re-bootstrapped from the last TARGET_INPUT_LENGTH maps for every new map (the original behavior).
+		const bool PERSISTENT_HIDDEN_STATE = true;
+
 		//LibTorch Setup - if CUDA is available we will use CUDA... otherwise fallback to CPU evaluation
 		torch::Device torchDevice(torch::cuda::is_available() ? torch::kCUDA : torch::kCPU);
 
@@ -293,9 +333,47 @@ namespace ShadowPropagation {
 			at::set_num_threads(1);         //model evaluation while using more CPU. Turn off all LibTorch SMP
 		}
 		torchModule.eval();
-
-		std::Edeque<Eigen::MatrixXf> inputHist_maps; //Stores previous shadow maps in the form of Eigen::MatrixXf
-		std::deque<TimePoint> inputHist_timestamps;  //History of timestamps for recently received shadow
+		torch::NoGradGuard noGrad; //We never need autograd bookkeeping here
+
+		//Converted shadow maps are kept in a ring of preallocated 64x64 float matrices. Each is wrapped (without copying) by a CPU tensor.
+		//On the CPU these views are fed to the model directly. On CUDA each map is copied to the device once, when it enters the ring, into
+		//a new device tensor for its slot. Forward passes run asynchronously on CUDA, so a device input must not be overwritten while a pass
+		//may still be reading it - giving every map its own tensor guarantees that. The tensor it replaces goes back to LibTorch's caching
+		//allocator, which only hands that memory out again to work queued on the stream after the passes that read it.
+		auto CPUOptions = torch::TensorOptions().dtype(torch::kFloat32).layout(torch::kStrided).device(torch::kCPU);
+		std::vector<cv::Mat>       inputHist_maps(TARGET_INPUT_LENGTH);
+		std::vector<torch::Tensor> inputHist_tensors(TARGET_INPUT_LENGTH);
+		for (int n = 0; n < TARGET_INPUT_LENGTH; n++) {
+			inputHist_maps[n] = cv::Mat(64, 64, CV_32FC1, cv::Scalar(0.0f));
+			inputHist_tensors[n] = torch::from_blob(inputHist_maps[n].ptr<float>(), {1, 1, 64, 64}, CPUOptions);
+		}
+		int inputHist_next  = 0; //Ring index where the next converted map will be written
+		int inputHist_count = 0; //Number of valid maps in the ring
+		std::deque<TimePoint> inputHist_timestamps; //History of timestamps for recently received shadow
+		std::vector<torch::Tensor> deviceHist_tensors(TARGET_INPUT_LENGTH); //Device copies of the ring slots (CUDA only)
+		
+		torch::Tensor predictionCPU = torch::empty({1, 1, 64, 64}, CPUOptions); //CPU copy of the current prediction (for UpdateEAMap)
+		cv::Mat EpochsAvailable(cv::Size(64, 64), CV_16UC1);
+		RecurrentStateSnapshot stateSnapshot;
+		int stepsSinceInit = 0; //Number of maps fed to the model since the hidden state was last initialized (persistent mode)
+
+		//Run one model step on the given input, which must be on the model device. firstTimestep (re)initializes the model's internal state.
+		auto Step = [&torchModule](torch::Tensor const & Input, bool FirstTimestep) -> torch::Tensor {
+			// The LSTM takes in 3 values for inputs: torch::Tensor tensor, bool firstTimestep, bool decoding
+			// "tensor" is the input tensor to use for bootstrapping or prediction
+			// "firstTimestep" is a bool indicating whether an input is the first in a sequence (inits the models internal states)
+			// "decoding" is not used for anything in the model code (always set to false)
+			std::vector<torch::jit::IValue> inputs;
+			inputs.reserve(3);
+			inputs.push_back(Input);
+			inputs.push_back(FirstTimestep);
+			inputs.push_back(false);
+			return torchModule.forward(inputs).toTensor();
+		};
+		//Get the model input for a ring slot (on the model device)
+		auto ModelInput = [&](int Index) -> torch::Tensor const & {
+			return torchDevice.is_cuda() ? deviceHist_tensors[Index] : inputHist_tensors[Index];
+		};
 
 		bool initNeeded = true; //When true, we need to clear our history and re-initialize internal state
 		while (! m_abort) {
@@ -318,13 +396,16 @@ namespace ShadowPropagation {
 			
 			//If this is the first received shadow map since (re)-starting, clear internal state data
 			if (initNeeded) {
-				inputHist_maps.clear();
+				inputHist_next  = 0;
+				inputHist_count = 0;
 				inputHist_timestamps.clear();
+				stepsSinceInit = 0;
 				initNeeded = false;
 			}
 			
 			//Grab the first unprocessed shadow map and remove it from the dequeue
-			ShadowDetection::InstantaneousShadowMap map = m_unprocessedShadowMaps.front();
+			ShadowDetection::ShadowMapHandle mapHandle = m_unprocessedShadowMaps.front();
+			ShadowDetection::InstantaneousShadowMap const & map(*mapHandle);
 			m_unprocessedShadowMaps.pop_front();
 
 			bool behindRealtime = !m_unprocessedShadowMaps.empty();
@@ -339,19 +420,23 @@ namespace ShadowPropagation {
 			//Convert the instantaneous shadow map from a 512x512 integer image with sentinal mask value to a 64x64 float
 			//matrix with "masked" pixels treated as unshadowed. 0 corresponds to no shadow and 1 corresponds to full shadow.
 			//This is the input format that the NN was trained on and knows how to handle.
-			//auto t1 = std::chrono::steady_clock::now();
-			Eigen::MatrixXf shadowMapMatrix = ShadowMapIntToFloat_UsingMask(map);
-			//Eigen::MatrixXf shadowMapMatrix = ShadowMapIntToFloat_UsingContours(map);
-			//auto t2 = std::chrono::steady_clock::now();
-			//std::cerr << "Shadow map conversion time: " << 1000.0*SecondsElapsed(t1, t2) << " ms\r\n";
-			//ShowShadowMapFloatMatrix(shadowMapMatrix, "ShadowMapMatrix"s);
-
-			//Save the converted shadow map to our history buffer
-			inputHist_maps.push_back(shadowMapMatrix);
+			//The map is written straight into the next ring slot (and thus into the tensor viewing it).
+			int latestIndex = inputHist_next;
+			ShadowMapIntToFloat_UsingMask(map, inputHist_maps[latestIndex]);
+			if (torchDevice.is_cuda())
+				deviceHist_tensors[latestIndex] = inputHist_tensors[latestIndex].to(torchDevice);
+			inputHist_next = (inputHist_next + 1) % TARGET_INPUT_LENGTH;
+			inputHist_count = std::min(inputHist_count + 1, TARGET_INPUT_LENGTH);
 			inputHist_timestamps.push_back(map.Timestamp);
-			if (inputHist_maps.size() > TARGET_INPUT_LENGTH) {
-				inputHist_maps.pop_front();
+			if (inputHist_timestamps.size() > TARGET_INPUT_LENGTH)
 				inputHist_timestamps.pop_front();
+
+			//Feed the new map to the model. In persistent mode this is the only step needed to absorb the new observation, and it also produces
+			//the first predicted epoch. In bootstrap mode we only feed maps when we are about to predict (below).
+			torch::Tensor currentPredictionTensor;
+			if (PERSISTENT_HIDDEN_STATE) {
+				currentPredictionTensor = Step(ModelInput(latestIndex), stepsSinceInit == 0);
+				stepsSinceInit++;
 			}
 
 			if (behindRealtime) {
@@ -359,174 +444,72 @@ namespace ShadowPropagation {
 				continue;
 			}
 
-			if (inputHist_maps.size() < TARGET_INPUT_LENGTH) {
+			if (inputHist_count < TARGET_INPUT_LENGTH) {
 				//Not enough shadow maps to bootstrap the LSTM yet
 				continue;
 			}
 			
 			//If we get here, we want to evaluate the LSTM and compute a new TA function
-			
-			//Bootstrap the LSTM by feeding in our history of shadow maps - all but the most recent map
-			for (int i = 0; i+1 < (int) inputHist_maps.size(); i++) {
-				// The LSTM takes in 3 values for inputs: torch::Tensor tensor, bool firstTimestep, bool decoding
-				// "tensor" is the input tensor to use for bootstrapping or prediction
-				// "firstTimestep" is a bool indicating whether an input is the first in a sequence (inits the models internal states)
-				// "decoding" is not used for anything in the model code (always set to false)
-				std::vector<torch::jit::IValue> inputs;
-				torch::Tensor histInput = EigenMatrixToTensor(inputHist_maps[i], torchDevice);
-				inputs.push_back(histInput);
-				inputs.push_back((i == 0));
-				inputs.push_back(false);
-
-				torchModule.forward(inputs);
+			if (! PERSISTENT_HIDDEN_STATE) {
+				//Bootstrap the LSTM by feeding in our history of shadow maps (oldest first) - all but the most recent map
+				for (int i = 0; i+1 < inputHist_count; i++) {
+					int index = (inputHist_next + i) % TARGET_INPUT_LENGTH;
+					Step(ModelInput(index), (i == 0));
+				}
+				currentPredictionTensor = Step(ModelInput(latestIndex), false);
+			}
+			else {
+				//Remember the state after absorbing the latest map so we can rewind to it after rolling forward into the future
+				stateSnapshot.Save(torchModule);
 			}
 
-			//Grab the most recent shadow map and initialize a local (64x64) Epochs Available (EA) function
+			//Initialize a local (64x64) Epochs Available (EA) function with the most recent shadow map
 			//The epochs available function counts epochs (instead of seconds) before expected shadowing
-			cv::Mat EpochsAvailable(cv::Size(64, 64), CV_16UC1, cv::Scalar(std::numeric_limits<uint16_t>::max()));
-			torch::Tensor currentPredictionTensor = EigenMatrixToTensor(inputHist_maps.back(), torchDevice);
-			UpdateEAMap(EpochsAvailable, currentPredictionTensor, uint16_t(0), OUTPUT_THRESHOLD);
+			EpochsAvailable.setTo(cv::Scalar(std::numeric_limits<uint16_t>::max()));
+			UpdateEAMap(EpochsAvailable, inputHist_tensors[latestIndex], uint16_t(0), OUTPUT_THRESHOLD);
 
+			//currentPredictionTensor holds the prediction for epoch 1 at this point
 			for (int epoch = 1; epoch <= TIME_HORIZON; epoch++) {
-				//Propogate the current prediction a single epoch into the future and update EA function
-				std::vector<torch::jit::IValue> inputs;
-				inputs.push_back(currentPredictionTensor);
-				inputs.push_back(false);
-				inputs.push_back(false);
+				predictionCPU.copy_(currentPredictionTensor);
+				UpdateEAMap(EpochsAvailable, predictionCPU, uint16_t(epoch), OUTPUT_THRESHOLD);
 
+				//Propogate the current prediction a single epoch into the future
 				// The output from torchModule.forward() is really a tuple with multiple tensors:
 				// [decoder_input, decoder_hidden, output_image, _, _]
 				// For this, the only tensor that matters is the output_image, as it is the prediction generated by the LSTM
-				currentPredictionTensor = torchModule.forward(inputs).toTensor().clone().detach();
-				UpdateEAMap(EpochsAvailable, currentPredictionTensor, uint16_t(epoch), OUTPUT_THRESHOLD);
+				if (epoch < TIME_HORIZON)
+					currentPredictionTensor = Step(currentPredictionTensor, false);
 			}
 
+			if (PERSISTENT_HIDDEN_STATE)
+				stateSnapshot.Restore();
+
 			//Build TA map from EA map
 			double historyDuration = SecondsElapsed(inputHist_timestamps.front(), inputHist_timestamps.back());
 			double secondsPerEpoch = historyDuration / double(inputHist_timestamps.size() - 1);
 			//cv::Mat TimeAvailable64x64 = EAMapToTAMap(EpochsAvailable, secondsPerEpoch);
 			cv::Mat TimeAvailable512x512 = EAMapToTAMap(EpochsAvailable, secondsPerEpoch);
 
-			{
-				std::scoped_lock lock(m_mutex);
-				//Scale up localTimeAvailable from 64x64 to 512x512 and copy registration and timestamp from map
-				//TODO - This won't cut it... using bilinear interp on this map is problematic since we use a sentinal
-				//value to represent locations that are free for the full time horizon. Using interpolation here
-				//results in pixels near sentinal-valued pixels getting interpolated to very large but non-sentinal values.
-				//This isn't right... we should probably do sentinal-aware interpolation.
-				//cv::resize(TimeAvailable64x64, m_TimeAvail.TimeAvailable, cv::Size(512, 512), cv::INTER_LINEAR);
-
-				m_TimeAvail.TimeAvailable = TimeAvailable512x512;
-				m_TimeAvail.UL_LL = map.UL_LL;
-				m_TimeAvail.UR_LL = map.UR_LL;
-				m_TimeAvail.LL_LL = map.LL_LL;
-				m_TimeAvail.LR_LL = map.LR_LL;
-				m_TimeAvail.Timestamp = map.Timestamp;
-
-				for (auto const & kv : m_callbacks)
-					kv.second(m_TimeAvail);
-			}
+			//Scale up localTimeAvailable from 64x64 to 512x512 and copy registration and timestamp from map
+			//TODO - This won't cut it... using bilinear interp on this map is problematic since we use a sentinal
+			//value to represent locations that are free for the full time horizon. Using interpolation here
+			//results in pixels near sentinal-valued pixels getting interpolated to very large but non-sentinal values.
+			//This isn't right... we should probably do sentinal-aware interpolation.
+			//cv::resize(TimeAvailable64x64, timeAvail->TimeAvailable, cv::Size(512, 512), cv::INTER_LINEAR);
+			std::shared_ptr<TimeAvailableFunction> timeAvail = std::make_shared<TimeAvailableFunction>();
+			timeAvail->TimeAvailable = TimeAvailable512x512;
+			timeAvail->UL_LL = map.UL_LL;
+			timeAvail->UR_LL = map.UR_LL;
+			timeAvail->LL_LL = map.LL_LL;
+			timeAvail->LR_LL = map.LR_LL;
+			timeAvail->Timestamp = map.Timestamp;
+			timeAvail->BuildPyramid();
+
+			//Publish our new TA function - this updates our public TA function and calls all registered callbacks
+			m_timeAvailChannel.Publish(timeAvail);
 		}
 	}
 
-	//Take a vector of cv::Point objects and populate the given simple polygon using it. 
-	//N controls thinning behavior... we take every N'th point when making the simple polygon
-	//Returns true on success and false if the source contour is degenerate (fewer than 3 points) or
-	//if it is very small and should be ignored.
-	static bool CVContourToSimplePolygon(std::vector<cv::Point> const & Contour, SimplePolygon & SPoly, int N = 1) {
-		if (Contour.size() < 3U)
-			return false;
-		N = std::clamp(N, 1, int(Contour.size())/3);
-		
-		std::Evector<Eigen::Vector2d> points;
-		points.reserve(int(Contour.size())/N + 3);
-		for (int index = 0; index < (int) Contour.size(); index += N)
-			points.push_back(Eigen::Vector2d(Contour[index].x, Contour[index].y));
-
-		SPoly.SetBoundary(points);
-
-		//Return success if the simple ploygon has significant area - this ignores tiny shadows
-		//We just use a hard-coded limit of 10 pixels... anything smaller than this gets culled.
-		//if (SPoly.GetArea() <= 10.0)
-		//	std::cerr << "Culling small contour. Area: " << SPoly.GetArea() << "\r\n";
-		return (SPoly.GetArea() > 10.0);
-	}
-
-	//For a given point X find the closest boundary point in the collection of provided shadows. If shadows is empty, we return false.
-	//Otherwise we will find a closest boundary point and return true. When successful we pass back the location of the
-	//point we found, along with it's location in the input shadow data structure: <polyIndex, simplePolyIndex, vertexIndex>
-	//There is an important subtlety here: the output index will refer to an existing vertex in the input Shadows data structure,
-	//but the output ClosestBdryPoint may not coincide with an actual vertex of any simple polygon... this is because we
-	//find the closest point on the boundary of a shadow... which may be on a segment between vertices.
-	static bool FindClosestBoundaryPoint(Eigen::Vector2d const & X, std::Evector<Polygon> const & Shadows, int & PolyIndex,
-		                                int & SimplePolyIndex, int & VertexIndex, Eigen::Vector2d & ClosestBdryPoint) {
-		double closestPointDist = std::nan("");
-		for (int polyIndex = 0; polyIndex < (int) Shadows.size(); polyIndex++) {
-			Polygon const & poly(Shadows[polyIndex]);
-			for (int simplePolyIndex = -1; simplePolyIndex < (int) poly.m_holes.size(); simplePolyIndex++) {
-				SimplePolygon const & simplePoly(simplePolyIndex < 0 ? poly.m_boundary : poly.m_holes[simplePolyIndex]);
-				
-				size_t closestVertexIndex = 0U;
-				Eigen::Vector2d projection = simplePoly.ProjectPointToBoundary(X, closestVertexIndex);
-				double projectionDist = (X - projection).norm();
-
-				if (std::isnan(closestPointDist) || (projectionDist < closestPointDist)) {
-					PolyIndex        = polyIndex;
-					SimplePolyIndex  = simplePolyIndex;
-					VertexIndex      = (int) closestVertexIndex;
-					ClosestBdryPoint = projection;
-					closestPointDist = projectionDist;
-				}
-			}
-		}
-		return (! std::isnan(closestPointDist));
-	}
-
-	//Render the given shadows to an image - leaves untouched pixels that are not in shadow
-	static void PaintShadows_UC16(cv::Mat & TargetImage, std::Eunordered_map<std::tuple<int,int>, SimplePolygon> const & ShadowSimplePolys,
-		                         uint16_t ShadowValue) {
-		//Get a unique value to use for unshadowed regions
-		//uint16_t noShadowValue = (ShadowValue == uint16_t(0)) ? uint16_t(1) : uint16_t(0);
-
-		cv::Mat myShadows(TargetImage.rows, TargetImage.cols, CV_8UC1);
-		myShadows.setTo(0);
-
-		//First paint all boundary polygons
-		for (auto const & kv : ShadowSimplePolys) {
-			//int polyIndex = std::get<0>(kv.first);
-			int simplePolyIndex = std::get<1>(kv.first);
-			if (simplePolyIndex < 0) {
-				//This is a boundary polygon
-				std::vector<std::vector<cv::Point>> tempContours;
-				tempContours.emplace_back();
-				std::Evector<Eigen::Vector2d> const & vertices(kv.second.GetVertices());
-				tempContours.back().reserve(vertices.size());
-				for (Eigen::Vector2d const & v : vertices)
-					tempContours.back().push_back(cv::Point(v(0), v(1)));
-				cv::drawContours(myShadows, tempContours, 0, cv::Scalar(1), -1);
-			}
-		}
-
-		//Now paint all hole polygons
-		for (auto const & kv : ShadowSimplePolys) {
-			//int polyIndex = std::get<0>(kv.first);
-			int simplePolyIndex = std::get<1>(kv.first);
-			if (simplePolyIndex >= 0) {
-				//This is a hole polygon
-				std::vector<std::vector<cv::Point>> tempContours;
-				tempContours.emplace_back();
-				std::Evector<Eigen::Vector2d> const & vertices(kv.second.GetVertices());
-				tempContours.back().reserve(vertices.size());
-				for (Eigen::Vector2d const & v : vertices)
-					tempContours.back().push_back(cv::Point(v(0), v(1)));
-				cv::drawContours(myShadows, tempContours, 0, cv::Scalar(0), -1);
-			}
-		}
-
-		//Paint our shadows onto the target image
-		TargetImage.setTo(ShadowValue, myShadows == 1);
-	}
-
 	//If we have an array of length N and we want the n'th element using circular (wrap-around) indexing, this function
 	//returns the actual index in the array that corresponds to the n'th element. For example, if n = -1 and N = 7, this function
 	//returns 6, since that is the last element, which is seen as 1 left of the first element. If n = 7 and N = 7, this function
@@ -541,7 +524,7 @@ namespace ShadowPropagation {
 		return (wasNegative) ? (N - offset) : (offset);
 	}
 
-	static void DisplayInstantaneousShadowsAndFlows(std::Evector<Polygon> const & Shadows, cv::Mat & UnmaskedShadowMap,
+	static void DisplayInstantaneousShadowsAndFlows(std::Evector<Polygon> const & Shadows, cv::Mat const & UnmaskedShadowMap,
 		                         std::Eunordered_map<std::tuple<int,int,int>, Eigen::Vector2d> const & CurrentBestEstimateFlow) {
 		cv::Mat visBGR(UnmaskedShadowMap.rows, UnmaskedShadowMap.cols, CV_8UC3, cv::Scalar(55,55,55));
 		for (auto const & shadow : Shadows) {
@@ -658,7 +641,8 @@ namespace ShadowPropagation {
 			}
 			
 			//Grab the first unprocessed shadow map and remove it from the dequeue
-			ShadowDetection::InstantaneousShadowMap map = m_unprocessedShadowMaps.front();
+			ShadowDetection::ShadowMapHandle mapHandle = m_unprocessedShadowMaps.front();
+			ShadowDetection::InstantaneousShadowMap const & map(*mapHandle);
 			m_unprocessedShadowMaps.pop_front();
 
 			bool behindRealtime = !m_unprocessedShadowMaps.empty();
@@ -681,35 +665,10 @@ namespace ShadowPropagation {
 			}
 
 			//Here is where we do the work
-			cv::Mat unmaskedShadowMap;
-			map.Map.copyTo(unmaskedShadowMap);
-			unmaskedShadowMap.setTo(0, unmaskedShadowMap == 255);
-			unmaskedShadowMap.setTo(0, unmaskedShadowMap  < 128);
-			std::vector<std::vector<cv::Point>> contours;
-			std::vector<cv::Vec4i> hierarchy;
-			cv::findContours(unmaskedShadowMap, contours, hierarchy, cv::RETR_CCOMP, cv::CHAIN_APPROX_NONE);
-
 			//Build Polygons for each shadow
 			TimePoint T0 = std::chrono::steady_clock::now();
 			std::Evector<Polygon> newShadows;
-			for (int index = 0; index < (int) contours.size(); index++) {
-				if (hierarchy[index][3] < 0) {
-					//This is a shadow outer boundary
-					newShadows.emplace_back();
-					if (! CVContourToSimplePolygon(contours[index], newShadows.back().m_boundary, 4))
-						newShadows.pop_back();
-					else {
-						//Add any child contours as holes in the shadow
-						int childIndex = hierarchy[index][2];
-						while (childIndex >= 0) {
-							newShadows.back().m_holes.emplace_back();
-							if (! CVContourToSimplePolygon(contours[childIndex], newShadows.back().m_holes.back(), 4))
-								newShadows.back().m_holes.pop_back();
-							childIndex = hierarchy[childIndex][0];
-						}
-					}
-				}
-			}
+			ShadowMapToShadowPolygons(map.Map, newShadows, 4);
 			//if (newShadows.empty())
 			//	std::cerr << "No shadows.\r\n";
 
@@ -745,6 +704,7 @@ namespace ShadowPropagation {
 
 			//Update contourFlowMap and shadows - Also compute current best estimate of flow for each boundary point
 			TimePoint T1 = std::chrono::steady_clock::now();
+			ShadowBoundaryIndex prevShadowsIndex(shadows); //Built once per epoch for the nearest-boundary queries below
 			std::Eunordered_map<std::tuple<int,int,int>, std::Edeque<Eigen::Vector2d>> newContourFlowMap;
 			std::Eunordered_map<std::tuple<int,int,int>, Eigen::Vector2d> currentBestEstimateFlow;
 			for (int polyIndex = 0; polyIndex < (int) newShadows.size(); polyIndex++) {
@@ -760,8 +720,8 @@ namespace ShadowPropagation {
 						int simplePolyIndexPrevMap = 0;
 						int vertexIndexPrevMap = 0;
 						Eigen::Vector2d ClosestBdryPointInPrevMap;
-						bool pointFound = FindClosestBoundaryPoint(boundaryPoint, shadows, polyIndexPrevMap, simplePolyIndexPrevMap,
-						                                           vertexIndexPrevMap, ClosestBdryPointInPrevMap);
+						bool pointFound = prevShadowsIndex.FindClosestBoundaryPoint(boundaryPoint, polyIndexPrevMap, simplePolyIndexPrevMap,
+						                                                            vertexIndexPrevMap, ClosestBdryPointInPrevMap);
 
 						if (pointFound) {
 							std::tuple<int,int,int> prevPointIndex(polyIndexPrevMap, simplePolyIndexPrevMap, vertexIndexPrevMap);
@@ -864,35 +824,27 @@ namespace ShadowPropagation {
 
 			bool showCurrentShadowsAndFlows = false;
 			if (showCurrentShadowsAndFlows)
-				DisplayInstantaneousShadowsAndFlows(shadows, unmaskedShadowMap, currentBestEstimateFlow);
-
-			//Now we propagate the vertices of all simple polygons forward in time.
-			//We build a data structure to hold the vertices of each simple polygon over some future time horizon
-			//We need to do this so we can propagate boundaries into the future without having to constantly sanitize
-			//simple polygons and re-compute flows by associating new boundary points with old ones (which isn't cheap)
-			//Structure: <polyIndex,simplePolyIndex,PredictionNum> -> vector of vertex locations
-			//PredictionNum corresponds to PredictionNum*deltaE epochs into the future.
-			//Thus, Epoch 0 corresponds to the present epoch, not the first prediction.
-			//We also track which simple polygons have flow data... that is, which contain at least 1 vertex with a flow estimate
-			double deltaE = 0.5; //Time resolution of forward predictions, in epochs (1 means step forward 1 epoch at a time)
+				DisplayInstantaneousShadowsAndFlows(shadows, map.Map, currentBestEstimateFlow);
+
+			//Now we propagate the vertices of all simple polygons forward in time. Rather than materializing the vertices of every future
+			//instance of every simple polygon, we record the current vertices and the per-step displacement of each vertex: at step k
+			//(k*deltaE epochs into the future) a vertex is at its current position plus k times its displacement. Step 0 corresponds to
+			//the present epoch, not the first prediction. We only keep simple polygons with flow data... that is, those containing
+			//at least 1 vertex with a flow estimate. A shadow whose boundary has no flow data is dropped (along with its holes).
+			double deltaE = 0.25; //Time resolution of forward predictions, in epochs (1 means step forward 1 epoch at a time)
 			int numPredictions = (int) std::round(double(PREDICTION_HORIZON)/deltaE);
-			std::Eunordered_map<std::tuple<int,int,int>, std::Evector<Eigen::Vector2d>> simplePolyVertices;
-			std::Eunordered_map<std::tuple<int,int>, bool> simplePolyFlowKnown; //<polyIndex,simplePolyIndex> -> valid
+			std::vector<MovingShadow> movingShadows;
+			movingShadows.reserve(shadows.size());
 			for (int polyIndex = 0; polyIndex < (int) shadows.size(); polyIndex++) {
 				Polygon & poly(shadows[polyIndex]);
 				for (int simplePolyIndex = -1; simplePolyIndex < (int) poly.m_holes.size(); simplePolyIndex++) {
 					SimplePolygon & simplePoly(simplePolyIndex < 0 ? poly.m_boundary : poly.m_holes[simplePolyIndex]);
-					std::tuple<int,int> simplePolyAddress(polyIndex,simplePolyIndex);
-					simplePolyFlowKnown[simplePolyAddress] = false; //initialize flowKnown flag to false
-
 					std::Evector<Eigen::Vector2d> const & vertices_CurrentPos(simplePoly.GetVertices());
 
-					//Copy the current vertex locations to all future epochs for initialization
-					for (int predNum = 0; predNum < numPredictions + 1; predNum++) {
-						std::tuple<int,int,int> address(polyIndex, simplePolyIndex, predNum);
-						simplePolyVertices[address] = vertices_CurrentPos;
-					}
-
+					MovingRing ring;
+					ring.Vertices = vertices_CurrentPos;
+					ring.StepDisplacements.resize(vertices_CurrentPos.size());
+					bool flowKnown = false;
 					for (int vertexIndex = 0; vertexIndex < (int) vertices_CurrentPos.size(); vertexIndex++) {
 						std::tuple<int,int,int> currentPointIndex(polyIndex, simplePolyIndex, vertexIndex);
 
@@ -902,115 +854,39 @@ namespace ShadowPropagation {
 						Eigen::Vector2d flow = Eigen::Vector2d::Zero();
 						if (currentBestEstimateFlow.count(currentPointIndex) > 0U) {
 							flow = currentBestEstimateFlow.at(currentPointIndex);
-							simplePolyFlowKnown[simplePolyAddress] = true;
+							flowKnown = true;
 						}
+						ring.StepDisplacements[vertexIndex] = flow*deltaE;
+					}
 
-						for (int predNum = 0; predNum < numPredictions + 1; predNum++) {
-							std::tuple<int,int,int> address(polyIndex, simplePolyIndex, predNum);
-							double epochsIntoFuture = double(predNum)*deltaE;
-							simplePolyVertices.at(address)[vertexIndex] = vertices_CurrentPos[vertexIndex] + flow*epochsIntoFuture;
-						}
+					if (! flowKnown) {
+						if (simplePolyIndex < 0)
+							break; //Skip this shadow entirely
+						continue;
 					}
+					if (simplePolyIndex < 0)
+						movingShadows.emplace_back();
+					movingShadows.back().Rings.push_back(std::move(ring));
 				}
 			}
 			TimePoint T4 = std::chrono::steady_clock::now();
 
-			//The next step is to build a TA function by initializing a canvas to the sentinal value and iteratively
-			//painting our predictions to the canvas, starting with the farthest prediction into the future, and working
-			//backwards to the current instantaneous shadow map. This ensures that predictions that are closer to the present
-			//take precedent over those farther into the future, which is what we want in the time available function.
-			//We have two implementations for this. The first uses the raw vertex vectors that we computed in the previous step.
-			//The second sanitizes these vertex vectors before painting. The sanitizing ensures that the countours that we
-			//propagated into the future still, in fact, represent valid simple polygons, without things like self-intersections.
-			//This is technically safer, but comes with added computational expense. It seems that the vast majority of the time
-			//the resulting TA functions are nearly indistinguishable. Skipping sanitization speeds up this step by about 2-4X
-			//and since this step is by far the most expensive step in the module, this is significant.
-
-			//One thing we don't want to do here is convert all future predictions to polygons and do an inclusion test
-			//for each pixel in each prediction. This uses a winding number test which requires us to iterate over all vertices
-			//for each simple polygon in each prediction, and doing this for every pixel is too expensive. We did an initial
-			//implementation this way for simplicity and it takes about 2 seconds per TA evaluation in a typical case... which is
-			//about 400X slower than Implementation 1 below, even when running with reduced temporal resolution. Since this is
-			//completely non-viable there is no need to include this as an option.
-
-			//Implementation 1   *******************************************************************************
-			//Compute the time available map by iteratively "painting" the shadow predictions on the same canvas
-			//We paint to a vector of canvases... one per prediction where 0 means no shadow and 1 means shadow
-			//We first paint all boundary polygons and then come back and paint all holes. This implementation does
-			//not sanitize our predictions and so is a little bit unsafe but faster (in practice artifacts seem to
-			//be both rare and minor).
-			std::vector<cv::Mat> futurePredictionRasters(numPredictions + 1);
-			for (cv::Mat & raster : futurePredictionRasters)
-				raster = cv::Mat(map.Map.rows, map.Map.cols, CV_8UC1, cv::Scalar(0));
-			for (auto const & kv : simplePolyVertices) {
-				int polyIndex       = std::get<0>(kv.first);
-				int simplePolyIndex = std::get<1>(kv.first);
-				int predictionNum   = std::get<2>(kv.first);
-				std::tuple<int,int> simplePolyAddress(polyIndex, simplePolyIndex);
-
-				//If this is a boundary polygon with known flow somewhere along it's contour, paint it now
-				if ((simplePolyIndex < 0) && (simplePolyFlowKnown.at(simplePolyAddress))) {
-					std::Evector<Eigen::Vector2d> const & vertices(kv.second);
-					std::vector<std::vector<cv::Point>> tempContours;
-					tempContours.emplace_back();
-					tempContours.back().reserve(vertices.size());
-					for (Eigen::Vector2d const & v : vertices)
-						tempContours.back().push_back(cv::Point(v(0), v(1)));
-					cv::drawContours(futurePredictionRasters[predictionNum], tempContours, 0, cv::Scalar(1), -1);
-				}
-			}
-			for (auto const & kv : simplePolyVertices) {
-				int polyIndex       = std::get<0>(kv.first);
-				int simplePolyIndex = std::get<1>(kv.first);
-				int predictionNum   = std::get<2>(kv.first);
-				std::tuple<int,int> simplePolyAddress(polyIndex, simplePolyIndex);
-
-				//If this is a hole polygon with known flow somewhere along it's contour, paint it now
-				if ((simplePolyIndex >= 0) && (simplePolyFlowKnown.at(simplePolyAddress))) {
-					std::Evector<Eigen::Vector2d> const & vertices(kv.second);
-					std::vector<std::vector<cv::Point>> tempContours;
-					tempContours.emplace_back();
-					tempContours.back().reserve(vertices.size());
-					for (Eigen::Vector2d const & v : vertices)
-						tempContours.back().push_back(cv::Point(v(0), v(1)));
-					cv::drawContours(futurePredictionRasters[predictionNum], tempContours, 0, cv::Scalar(0), -1);
-				}
-			}
-			//Now combine all of the raster predictions into a TA function
-			cv::Mat TA(map.Map.rows, map.Map.cols, CV_16UC1, cv::Scalar(std::numeric_limits<uint16_t>::max()));
-			for (int predictionNum = numPredictions; predictionNum >= 0; predictionNum--) {
+			//The next step is to build a TA function. Each pixel should hold the time until the first prediction that covers it.
+			//We used to paint every prediction of every shadow to its own canvas, from the farthest prediction back to the present,
+			//so that closer predictions took precedence. That costs a full polygon fill per shadow per prediction, which made this
+			//the most expensive step in the module and kept deltaE coarse. Instead we rasterize the swept area of each shadow with
+			//a scan-line rasterizer that makes one pass over the edges of the shadow for all predictions and min-writes the time
+			//of each prediction straight into the TA raster (see RasterizeTimeAvailable()). Propagated contours are not sanitized,
+			//which is a little bit unsafe, but in practice artifacts from self-intersections seem to be both rare and minor.
+			std::vector<uint16_t> secondsIntoFuture(numPredictions + 1);
+			for (int predictionNum = 0; predictionNum <= numPredictions; predictionNum++) {
 				double epochsIntoFuture = double(predictionNum)*deltaE;
-				uint16_t secondsIntoFuture = uint16_t(std::round(epochsIntoFuture * secondsPerEpoch));
-				//std::cerr << secondsIntoFuture << "\r\n";
-				TA.setTo(secondsIntoFuture, futurePredictionRasters[predictionNum] == 1);
+				secondsIntoFuture[predictionNum] = uint16_t(std::round(epochsIntoFuture * secondsPerEpoch));
 			}
+			cv::Mat TA(map.Map.rows, map.Map.cols, CV_16UC1, cv::Scalar(std::numeric_limits<uint16_t>::max()));
+			RasterizeTimeAvailable(movingShadows, secondsIntoFuture, TA);
 			cv::medianBlur(TA, TA, 5); //Clean up tiny holes and imperfections in TA function
 			TimePoint T5 = std::chrono::steady_clock::now();
-
-			//Implementation 2   *******************************************************************************
-			//Start by sanitizing all propagated simple polygon boundaries
-			//This is the safer but slower implementation.
-			//One map per prediction: <polyIndex,simplePolyIndex> -> simplePoly
-			/*std::Evector<std::Eunordered_map<std::tuple<int,int>, SimplePolygon>> futureSimplePolys(numPredictions + 1);
-			for (auto const & kv : simplePolyVertices) {
-				int predictionNum = std::get<2>(kv.first);
-				std::tuple<int,int> simplePolyAddress(std::get<0>(kv.first), std::get<1>(kv.first));
-				
-				//We skip any simple polygon with unknown flow
-				if (simplePolyFlowKnown.at(simplePolyAddress))
-					(futureSimplePolys[predictionNum])[simplePolyAddress] = SimplePolygon(kv.second);
-			}
-			//Compute a time available map by iteratively "painting" the shadow predictions on the same canvas
-			cv::Mat TA(map.Map.rows, map.Map.cols, CV_16UC1);
-			uint16_t maxUint16Val = std::numeric_limits<uint16_t>::max();
-			TA.setTo(maxUint16Val);
-			for (int predNum = numPredictions; predNum >= 0; predNum--) {
-				double epochsIntoFuture = double(predNum)*deltaE;
-				uint16_t secondsIntoFuture = uint16_t(std::round(epochsIntoFuture * secondsPerEpoch));
-				PaintShadows_UC16(TA, futureSimplePolys[predNum], secondsIntoFuture);
-			}
-			cv::medianBlur(TA, TA, 5); //Clean up tiny holes and imperfections in TA function
-			TimePoint T5 = std::chrono::steady_clock::now();*/
 			
 			//Hole In-painting   *******************************************************************************
 			//In-paint holes in the TA function, which can happen when the propogated contours deform over time or when a shadow is
@@ -1053,20 +929,17 @@ namespace ShadowPropagation {
 				std::cerr << "Full processing time ---: " << fullProcessingTime*1000.0 << " ms\r\n\r\n";
 			}
 
-			{
-				//Lock our mutex and update our public TA function and call all registered callbacks.
-				std::scoped_lock lock(m_mutex);
-
-				m_TimeAvail.TimeAvailable = TA;
-				m_TimeAvail.UL_LL = map.UL_LL;
-				m_TimeAvail.UR_LL = map.UR_LL;
-				m_TimeAvail.LL_LL = map.LL_LL;
-				m_TimeAvail.LR_LL = map.LR_LL;
-				m_TimeAvail.Timestamp = map.Timestamp;
-
-				for (auto const & kv : m_callbacks)
-					kv.second(m_TimeAvail);
-			}
+			//Publish our new TA function - this updates our public TA function and calls all registered callbacks.
+			//TA is allocated fresh on each pass, so it is never modified after publication.
+			std::shared_ptr<TimeAvailableFunction> timeAvail = std::make_shared<TimeAvailableFunction>();
+			timeAvail->TimeAvailable = TA;
+			timeAvail->UL_LL = map.UL_LL;
+			timeAvail->UR_LL = map.UR_LL;
+			timeAvail->LL_LL = map.LL_LL;
+			timeAvail->LR_LL = map.LR_LL;
+			timeAvail->Timestamp = map.Timestamp;
+			timeAvail->BuildPyramid();
+			m_timeAvailChannel.Publish(timeAvail);
 		}
 	}
 }
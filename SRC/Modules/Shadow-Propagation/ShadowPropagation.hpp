@@ -10,13 +10,20 @@
 #include <thread>
 #include <mutex>
 #include <iostream>
+#include <memory>
+#include <limits>
 
 //External Includes
 #include <opencv2/opencv.hpp>
 
 //Project Includes
 #include "../../EigenAliases.h"
+#include "../../FrameChannel.hpp"
+#include "../../Polygon.hpp"
+#include "../../CompiledPolygon.hpp"
+#include "../../Maps/MapUtils.hpp"
 #include "../Shadow-Detection/ShadowDetection.hpp"
+#include "TimeAvailablePyramid.hpp"
 
 
 namespace ShadowPropagation {
@@ -27,6 +34,8 @@ namespace ShadowPropagation {
 	//be easy to estimate the horizon for a given pixel (it depends on cloud speed and direction). It is likely also not very actionable information so
 	//to avoid the added complexity of trying to estimate this we will just use a sentinel value to indicate this condition (that nothing currently visible
 	//is expected to hit a given pixel). We will use std::numeric_limits<uint16_t>::max() to indicate this.
+	//TA functions are published as immutable, reference-counted objects (see TimeAvailableHandle). Copies share raster data (cv::Mat semantics).
+	//The shadow propagation module builds the min-mip pyramid for each TA function before publishing it, so consumers can run region queries on it.
 	class TimeAvailableFunction {
 		public:
 			EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -38,7 +47,30 @@ namespace ShadowPropagation {
 			Eigen::Vector2d LL_LL; //(Latitude, Longitude) of center of lower-left pixel, in radians
 			Eigen::Vector2d LR_LL; //(Latitude, Longitude) of center of lower-right pixel, in radians
 			TimePoint Timestamp;
+			std::shared_ptr<const TimeAvailablePyramid> Pyramid; //Optional min-mip pyramid over TimeAvailable (null until BuildPyramid() is called)
+			
+			//Build the pyramid from TimeAvailable. Call this before the TA function is published (it is immutable after that).
+			inline void BuildPyramid(void) { Pyramid = std::make_shared<const TimeAvailablePyramid>(TimeAvailable); }
+			
+			//Map between (Latitude, Longitude) in radians and continuous pixel coords (x = col, y = row) of TimeAvailable
+			inline Eigen::Vector2d LatLonToPixelCoords(Eigen::Vector2d const & LL) const;
+			inline Eigen::Vector2d PixelCoordsToLatLon(Eigen::Vector2d const & PX) const;
+			
+			//Region queries (all in Normalized Mercator). Each returns the min TA value over a set of pixels, or the sentinel if the set is empty
+			//(e.g. it's out of bounds) or every pixel in it has the sentinel value. A pixel is in an AABB or region if its center is, and is on a
+			//segment if the segment touches it. Threshold has the same meaning as in TimeAvailablePyramid: if the min is below Threshold the exact
+			//min is returned, otherwise the query may return early with a lower bound that is >= Threshold. These use Pyramid (if it hasn't
+			//been built, a temporary pyramid is built for the query - which is no faster than scanning the raster).
+			inline uint16_t MinOverAABB(Eigen::Vector4d const & AABB_NM, uint16_t Threshold = TimeAvailablePyramid::Sentinel) const;
+			inline uint16_t MinAlongSegment(Eigen::Vector2d const & A_NM, Eigen::Vector2d const & B_NM, uint16_t Threshold = TimeAvailablePyramid::Sentinel) const;
+			inline uint16_t MinOverRegion(PolygonCollection const & Region_NM, uint16_t Threshold = TimeAvailablePyramid::Sentinel) const;
+			inline uint16_t MinOverRegion(CompiledPolygonCollection const & Region_NM, uint16_t Threshold = TimeAvailablePyramid::Sentinel) const;
+			
+		private:
+			inline std::shared_ptr<const TimeAvailablePyramid> GetPyramid(void) const;
+			inline Eigen::Vector4d NMAABBToPixelBox(Eigen::Vector4d const & AABB_NM) const;
 	};
+	using TimeAvailableHandle = std::shared_ptr<const TimeAvailableFunction>;
 	
 	//Singleton class for the shadow propagation system - We use a callback system to ensure that every new shadow map that is computed is received by
 	//this function (even if we are falling behind real-time in processing). We use a similar mechanism in the shadow detection module to ensure that
@@ -54,9 +86,10 @@ namespace ShadowPropagation {
 			std::mutex m_mutex;
 			bool m_running;       //Whether the module is currently running or not
 			int m_callbackHandle; //Handle for this objects shadow detection engine callback
-			std::unordered_map<int, std::function<void(TimeAvailableFunction const & TA)>> m_callbacks;
-			std::Edeque<ShadowDetection::InstantaneousShadowMap> m_unprocessedShadowMaps;
-			TimeAvailableFunction m_TimeAvail; //Most recent time available function
+			std::deque<ShadowDetection::ShadowMapHandle> m_unprocessedShadowMaps; //Handles to published shadow maps (not copies)
+			
+			//New TA functions are published through this channel, which also holds the most recent one. It has its own synchronization.
+			FrameChannel<TimeAvailableFunction> m_timeAvailChannel;
 			
 			void ModuleMain_LSTM(void);
 			void ModuleMain_ContourFlow(void);
@@ -68,7 +101,8 @@ namespace ShadowPropagation {
 			static ShadowPropagationEngine & Instance() { static ShadowPropagationEngine Obj; return Obj; }
 			
 			//Constructors and Destructors
-			ShadowPropagationEngine() : m_abort(false), m_running(false) {
+			ShadowPropagationEngine() : m_abort(false), m_running(false),
+			                            m_timeAvailChannel([](TimeAvailableFunction const & TA) { return MatBytes(TA.TimeAvailable); }) {
 				//m_engineThread = std::thread(&ShadowPropagationEngine::ModuleMain_LSTM, this);
 				m_engineThread = std::thread(&ShadowPropagationEngine::ModuleMain_ContourFlow, this);
 			}
@@ -81,13 +115,89 @@ namespace ShadowPropagation {
 			
 			//Callback access
 			inline int  RegisterCallback(std::function<void(TimeAvailableFunction const & TA)> Callback); //Regester callback for new TA functions
+			inline int  RegisterCallback(std::function<void(TimeAvailableHandle const & TA)> Callback);   //Same, but receive a handle you can keep
 			inline void UnRegisterCallback(int Handle); //Unregister callback for new TA functions (input is token returned by RegisterCallback()
 			
 			//Accessors - Each returns false if no Time Available functions have been computed yet
 			inline bool GetTimestampOfMostRecentTimeAvailFun(TimePoint & Timestamp);
-			inline bool GetMostRecentTimeAvailFun(TimeAvailableFunction & TimeAvailFun);
+			inline bool GetMostRecentTimeAvailFun(TimeAvailableFunction & TimeAvailFun); //Shares raster data with the published function
+			inline bool GetMostRecentTimeAvailFun(TimeAvailableHandle & TimeAvailFun);
 	};
 
+	// *********************************************************************************************************************************
+	// *********************************************   TimeAvailableFunction Definitions   *********************************************
+	// *********************************************************************************************************************************
+	//The TA raster is axis-aligned in (Latitude, Longitude): columns run from LL_LL to LR_LL in longitude and rows run from UR_LL (row 0)
+	//down to LR_LL (last row) in latitude. This is the same mapping used when sampling the raster at a position.
+	inline Eigen::Vector2d TimeAvailableFunction::LatLonToPixelCoords(Eigen::Vector2d const & LL) const {
+		double x = double(TimeAvailable.cols - 1) * (LL(1) - LL_LL(1)) / (LR_LL(1) - LL_LL(1));
+		double y = double(TimeAvailable.rows - 1) * (1.0 - (LL(0) - LR_LL(0)) / (UR_LL(0) - LR_LL(0)));
+		return Eigen::Vector2d(x, y);
+	}
+
+	inline Eigen::Vector2d TimeAvailableFunction::PixelCoordsToLatLon(Eigen::Vector2d const & PX) const {
+		double lat = LR_LL(0) + (1.0 - PX(1) / double(TimeAvailable.rows - 1)) * (UR_LL(0) - LR_LL(0));
+		double lon = LL_LL(1) + (PX(0) / double(TimeAvailable.cols - 1)) * (LR_LL(1) - LL_LL(1));
+		return Eigen::Vector2d(lat, lon);
+	}
+
+	inline std::shared_ptr<const TimeAvailablePyramid> TimeAvailableFunction::GetPyramid(void) const {
+		if (Pyramid != nullptr)
+			return Pyramid;
+		return std::make_shared<const TimeAvailablePyramid>(TimeAvailable);
+	}
+
+	//Rows and cols of the raster are lines of constant latitude and longitude, and NM is monotonic in each, so an NM box maps to a box in pixel coords
+	inline Eigen::Vector4d TimeAvailableFunction::NMAABBToPixelBox(Eigen::Vector4d const & AABB_NM) const {
+		Eigen::Vector2d cornerA = LatLonToPixelCoords(NMToLatLon(Eigen::Vector2d(AABB_NM(0), AABB_NM(2))));
+		Eigen::Vector2d cornerB = LatLonToPixelCoords(NMToLatLon(Eigen::Vector2d(AABB_NM(1), AABB_NM(3))));
+		return Eigen::Vector4d(std::min(cornerA(0), cornerB(0)), std::max(cornerA(0), cornerB(0)),
+		                       std::min(cornerA(1), cornerB(1)), std::max(cornerA(1), cornerB(1)));
+	}
+
+	inline uint16_t TimeAvailableFunction::MinOverAABB(Eigen::Vector4d const & AABB_NM, uint16_t Threshold) const {
+		if ((TimeAvailable.rows < 2) || (TimeAvailable.cols < 2))
+			return TimeAvailablePyramid::Sentinel;
+		return GetPyramid()->MinOverBox(NMAABBToPixelBox(AABB_NM), Threshold);
+	}
+
+	inline uint16_t TimeAvailableFunction::MinAlongSegment(Eigen::Vector2d const & A_NM, Eigen::Vector2d const & B_NM, uint16_t Threshold) const {
+		if ((TimeAvailable.rows < 2) || (TimeAvailable.cols < 2))
+			return TimeAvailablePyramid::Sentinel;
+		Eigen::Vector2d A_PX = LatLonToPixelCoords(NMToLatLon(A_NM));
+		Eigen::Vector2d B_PX = LatLonToPixelCoords(NMToLatLon(B_NM));
+		return GetPyramid()->MinAlongSegment(A_PX, B_PX, Threshold);
+	}
+
+	//Every pixel that survives block pruning gets a containment test, so the region is flattened once up front
+	inline uint16_t TimeAvailableFunction::MinOverRegion(PolygonCollection const & Region_NM, uint16_t Threshold) const {
+		if ((TimeAvailable.rows < 2) || (TimeAvailable.cols < 2))
+			return TimeAvailablePyramid::Sentinel;
+		return MinOverRegion(CompiledPolygonCollection(Region_NM), Threshold);
+	}
+
+	inline uint16_t TimeAvailableFunction::MinOverRegion(CompiledPolygonCollection const & Region_NM, uint16_t Threshold) const {
+		if ((TimeAvailable.rows < 2) || (TimeAvailable.cols < 2))
+			return TimeAvailablePyramid::Sentinel;
+		Eigen::Vector4d regionAABB_NM = Region_NM.GetAABB();
+		if (! regionAABB_NM.allFinite())
+			return TimeAvailablePyramid::Sentinel;
+		Eigen::Vector4d regionBox_PX = NMAABBToPixelBox(regionAABB_NM);
+
+		//Blocks are pruned against the AABB of the region and only individual pixels are tested against the region itself
+		auto blockMayBeInRegion = [&regionBox_PX](int R0, int R1, int C0, int C1) {
+			return (double(C0) <= regionBox_PX(1)) && (double(C1) >= regionBox_PX(0)) &&
+			       (double(R0) <= regionBox_PX(3)) && (double(R1) >= regionBox_PX(2));
+		};
+		auto pixelInRegion = [this, &Region_NM](int R, int C) {
+			return Region_NM.ContainsPoint(LatLonToNM(PixelCoordsToLatLon(Eigen::Vector2d(double(C), double(R)))));
+		};
+		return GetPyramid()->MinOverPixels(blockMayBeInRegion, pixelInRegion, Threshold);
+	}
+
+	// *********************************************************************************************************************************
+	// ********************************************   ShadowPropagationEngine Definitions   ********************************************
+	// *********************************************************************************************************************************
 	inline void ShadowPropagationEngine::Shutdown(void) {
 		m_abort = true;
 		if (m_engineThread.joinable())
@@ -101,9 +211,9 @@ namespace ShadowPropagation {
 
 		m_unprocessedShadowMaps.clear(); //Ditch any old unprocessed data in the buffer
 		
-		//Register a callback for handling new shadow maps. Note that our callback just copies the data to a buffer - we don't do any actual
+		//Register a callback for handling new shadow maps. Note that our callback just queues a handle to the map - we don't do any actual
 		//processing here or it would hold up the shadow detection module. The heavy lifting is done in ModuleMain()
-		m_callbackHandle = ShadowDetection::ShadowDetectionEngine::Instance().RegisterCallback([this](ShadowDetection::InstantaneousShadowMap const & NewMap) {
+		m_callbackHandle = ShadowDetection::ShadowDetectionEngine::Instance().RegisterCallback([this](ShadowDetection::ShadowMapHandle const & NewMap) {
 			std::scoped_lock lock(m_mutex);
 			m_unprocessedShadowMaps.push_back(NewMap);
 		});
@@ -125,35 +235,39 @@ namespace ShadowPropagation {
 
 	//Register callback for new TA functions (returns handle)
 	inline int ShadowPropagationEngine::RegisterCallback(std::function<void(TimeAvailableFunction const & TA)> Callback) {
-		std::scoped_lock lock(m_mutex);
-		int token = 0;
-		while (m_callbacks.count(token) > 0U)
-			token++;
-		m_callbacks[token] = Callback;
-		return token;
+		return m_timeAvailChannel.Subscribe([Callback](TimeAvailableHandle const & TA) { Callback(*TA); });
+	}
+	
+	//Register callback for new TA functions (returns handle). The handle can be kept without copying the TA function.
+	inline int ShadowPropagationEngine::RegisterCallback(std::function<void(TimeAvailableHandle const & TA)> Callback) {
+		return m_timeAvailChannel.Subscribe(Callback);
 	}
 	
 	//Unregister callback for new TA functions (input is token returned by RegisterCallback()
 	inline void ShadowPropagationEngine::UnRegisterCallback(int Handle) {
-		std::scoped_lock lock(m_mutex);
-		m_callbacks.erase(Handle);
+		m_timeAvailChannel.Unsubscribe(Handle);
 	}
 
 	inline bool ShadowPropagationEngine::GetTimestampOfMostRecentTimeAvailFun(TimePoint & Timestamp) {
-		std::scoped_lock lock(m_mutex);
-		if ((m_TimeAvail.TimeAvailable.rows == 0) || (m_TimeAvail.TimeAvailable.cols == 0))
+		TimeAvailableHandle latest = m_timeAvailChannel.Latest();
+		if (latest == nullptr)
 			return false;
-		Timestamp = m_TimeAvail.Timestamp;
+		Timestamp = latest->Timestamp;
 		return true;
 	}
 
 	inline bool ShadowPropagationEngine::GetMostRecentTimeAvailFun(TimeAvailableFunction & TimeAvailFun) {
-		std::scoped_lock lock(m_mutex);
-		if ((m_TimeAvail.TimeAvailable.rows == 0) || (m_TimeAvail.TimeAvailable.cols == 0))
+		TimeAvailableHandle latest = m_timeAvailChannel.Latest();
+		if (latest == nullptr)
 			return false;
-		TimeAvailFun = m_TimeAvail;
+		TimeAvailFun = *latest;
 		return true;
 	}
+
+	inline bool ShadowPropagationEngine::GetMostRecentTimeAvailFun(TimeAvailableHandle & TimeAvailFun) {
+		TimeAvailFun = m_timeAvailChannel.Latest();
+		return (TimeAvailFun != nullptr);
+	}
 }
 
 
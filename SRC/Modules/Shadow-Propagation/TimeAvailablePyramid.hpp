@@ -0,0 +1,171 @@
+//This module provides a min-mip pyramid over a time available raster. Level 0 is the raster itself and each pixel of level k+1 holds the min
+//of the (up to) 2x2 block of level k pixels under it, so every pixel of every level is the min over a square block of the raster. Guidance only
+//ever needs the minimum time available along a path or over an area, and the pyramid answers these questions by best-first descent, which
+//stops as soon as the answer is known. In the common case (nothing under the query is close to the threshold of interest) this touches
+//a handful of pixels near the top of the pyramid instead of every raster pixel under the query.
+//Author: Bryan Poling
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+#pragma once
+
+//System Includes
+#include <vector>
+#include <queue>
+#include <tuple>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+
+//External Includes
+#include <opencv2/opencv.hpp>
+
+//Project Includes
+#include "../../EigenAliases.h"
+
+namespace ShadowPropagation {
+	class TimeAvailablePyramid {
+		public:
+			static constexpr uint16_t Sentinel = std::numeric_limits<uint16_t>::max(); //TA value meaning "no shadow expected" - see TimeAvailableFunction
+
+			TimeAvailablePyramid() = default;
+			TimeAvailablePyramid(cv::Mat const & TimeAvailable) { Build(TimeAvailable); } //Level 0 shares data with TimeAvailable (no copy)
+			~TimeAvailablePyramid() = default;
+
+			inline void Build(cv::Mat const & TimeAvailable); //TimeAvailable must be CV_16UC1 (if it isn't, the pyramid is left empty)
+
+			int NumLevels(void) const { return (int) m_levels.size(); }
+			cv::Mat const & Level(int Index) const { return m_levels[Index]; } //Level 0 is full resolution - the last level is 1x1
+			int Rows(void) const { return m_levels.empty() ? 0 : m_levels[0].rows; }
+			int Cols(void) const { return m_levels.empty() ? 0 : m_levels[0].cols; }
+
+			//Min over the raster pixels whose centers lie in the box [XMin, XMax] x [YMin, YMax] (continuous pixel coords: x = col, y = row)
+			inline uint16_t MinOverBox(Eigen::Vector4d const & Box_PX, uint16_t Threshold = Sentinel) const;
+
+			//Min over the raster pixels touched by the segment from A to B (continuous pixel coords: x = col, y = row). Pixel (r,c) covers
+			//[c - 0.5, c + 0.5] x [r - 0.5, r + 0.5].
+			inline uint16_t MinAlongSegment(Eigen::Vector2d const & A_PX, Eigen::Vector2d const & B_PX, uint16_t Threshold = Sentinel) const;
+
+			//Generic query: min over the raster pixels (r,c) for which ContainsPixel(r,c) is true. MayContainPixels(Row0, Row1, Col0, Col1) is called
+			//on blocks of raster pixels (inclusive ranges) and must return true if ContainsPixel() could be true for any pixel in the block.
+			//It may be conservative (false positives only cost time).
+			//
+			//All queries return the sentinel if no pixel satisfies the query or if all that do hold the sentinel. Threshold lets a caller who only
+			//needs to know whether the min is below some value stop early: if the min is below Threshold the exact min is returned. Otherwise the
+			//query may stop as soon as it knows the min is at least Threshold, and returns a lower bound on the min that is >= Threshold.
+			template <typename BlockPredicate, typename PixelPredicate>
+			uint16_t MinOverPixels(BlockPredicate MayContainPixels, PixelPredicate ContainsPixel, uint16_t Threshold = Sentinel) const;
+
+		private:
+			std::vector<cv::Mat> m_levels;
+	};
+
+	inline void TimeAvailablePyramid::Build(cv::Mat const & TimeAvailable) {
+		m_levels.clear();
+		if ((TimeAvailable.type() != CV_16UC1) || TimeAvailable.empty())
+			return;
+		m_levels.push_back(TimeAvailable);
+		while ((m_levels.back().rows > 1) || (m_levels.back().cols > 1)) {
+			cv::Mat const & src = m_levels.back();
+			cv::Mat dst((src.rows + 1) / 2, (src.cols + 1) / 2, CV_16UC1);
+			int lastCol = src.cols - 1;
+			for (int row = 0; row < dst.rows; row++) {
+				uint16_t const * srcRowA = src.ptr<uint16_t>(2*row);
+				uint16_t const * srcRowB = src.ptr<uint16_t>(std::min(2*row + 1, src.rows - 1));
+				uint16_t * dstRow = dst.ptr<uint16_t>(row);
+				int numFullCols = src.cols / 2;
+				for (int col = 0; col < numFullCols; col++) {
+					uint16_t minA = std::min(srcRowA[2*col], srcRowA[2*col + 1]);
+					uint16_t minB = std::min(srcRowB[2*col], srcRowB[2*col + 1]);
+					dstRow[col] = std::min(minA, minB);
+				}
+				if (numFullCols < dst.cols)
+					dstRow[numFullCols] = std::min(srcRowA[lastCol], srcRowB[lastCol]);
+			}
+			m_levels.push_back(dst);
+		}
+	}
+
+	template <typename BlockPredicate, typename PixelPredicate>
+	uint16_t TimeAvailablePyramid::MinOverPixels(BlockPredicate MayContainPixels, PixelPredicate ContainsPixel, uint16_t Threshold) const {
+		if (m_levels.empty())
+			return Sentinel;
+
+		//Best-first descent: always expand the block with the lowest min. The first raster pixel we pop that satisfies the query holds the exact
+		//min, since everything left in the queue is at least as large. Queue items are (value, level, row, col).
+		using Item = std::tuple<uint16_t, int, int, int>;
+		std::priority_queue<Item, std::vector<Item>, std::greater<Item>> queue;
+		int topLevel = NumLevels() - 1;
+		int rows = Rows();
+		int cols = Cols();
+		auto pushIfRelevant = [&](int Level, int Row, int Col) {
+			int row0 = Row << Level;
+			int col0 = Col << Level;
+			int row1 = std::min(((Row + 1) << Level) - 1, rows - 1);
+			int col1 = std::min(((Col + 1) << Level) - 1, cols - 1);
+			if (MayContainPixels(row0, row1, col0, col1))
+				queue.emplace(m_levels[Level].at<uint16_t>(Row, Col), Level, Row, Col);
+		};
+		pushIfRelevant(topLevel, 0, 0);
+		while (! queue.empty()) {
+			auto [value, level, row, col] = queue.top();
+			queue.pop();
+			if ((value >= Threshold) || (value == Sentinel))
+				return value;
+			if (level == 0) {
+				if (ContainsPixel(row, col))
+					return value;
+				continue;
+			}
+			int childRows = m_levels[level - 1].rows;
+			int childCols = m_levels[level - 1].cols;
+			for (int childRow = 2*row; childRow <= std::min(2*row + 1, childRows - 1); childRow++) {
+				for (int childCol = 2*col; childCol <= std::min(2*col + 1, childCols - 1); childCol++)
+					pushIfRelevant(level - 1, childRow, childCol);
+			}
+		}
+		return Sentinel;
+	}
+
+	inline uint16_t TimeAvailablePyramid::MinOverBox(Eigen::Vector4d const & Box_PX, uint16_t Threshold) const {
+		//Pixel centers are at integer coords, so the pixels in the box are a range of rows and cols
+		int col0 = std::max(int(std::ceil(Box_PX(0))), 0);
+		int col1 = std::min(int(std::floor(Box_PX(1))), Cols() - 1);
+		int row0 = std::max(int(std::ceil(Box_PX(2))), 0);
+		int row1 = std::min(int(std::floor(Box_PX(3))), Rows() - 1);
+		if ((col0 > col1) || (row0 > row1) || (! Box_PX.allFinite()))
+			return Sentinel;
+		auto blockOverlaps = [row0, row1, col0, col1](int R0, int R1, int C0, int C1) {
+			return (R0 <= row1) && (R1 >= row0) && (C0 <= col1) && (C1 >= col0);
+		};
+		auto pixelInBox = [row0, row1, col0, col1](int R, int C) { return (R >= row0) && (R <= row1) && (C >= col0) && (C <= col1); };
+		return MinOverPixels(blockOverlaps, pixelInBox, Threshold);
+	}
+
+	inline uint16_t TimeAvailablePyramid::MinAlongSegment(Eigen::Vector2d const & A_PX, Eigen::Vector2d const & B_PX, uint16_t Threshold) const {
+		if ((! A_PX.allFinite()) || (! B_PX.allFinite()))
+			return Sentinel;
+
+		//A block of pixels covers a closed box in pixel coords - clip the segment to it (Liang-Barsky) to see if they touch
+		Eigen::Vector2d D = B_PX - A_PX;
+		auto segmentTouchesBlock = [&A_PX, &D](int R0, int R1, int C0, int C1) {
+			double lower[2] = { double(C0) - 0.5, double(R0) - 0.5 };
+			double upper[2] = { double(C1) + 0.5, double(R1) + 0.5 };
+			double s0 = 0.0, s1 = 1.0;
+			for (int axis = 0; axis < 2; axis++) {
+				if (D(axis) == 0.0) {
+					if ((A_PX(axis) < lower[axis]) || (A_PX(axis) > upper[axis]))
+						return false;
+				}
+				else {
+					double sA = (lower[axis] - A_PX(axis)) / D(axis);
+					double sB = (upper[axis] - A_PX(axis)) / D(axis);
+					s0 = std::max(s0, std::min(sA, sB));
+					s1 = std::min(s1, std::max(sA, sB));
+				}
+			}
+			return (s0 <= s1);
+		};
+		auto segmentTouchesPixel = [&segmentTouchesBlock](int R, int C) { return segmentTouchesBlock(R, R, C, C); };
+		return MinOverPixels(segmentTouchesBlock, segmentTouchesPixel, Threshold);
+	}
+}
@@ -5,6 +5,8 @@
 //System Includes
 #include <tuple>
 #include <limits>
+#include <algorithm>
+#include <unordered_map>
 
 //External Includes
 #include "HandyImGuiInclude.hpp"
@@ -30,6 +32,10 @@ static void RemoveEdgeFromAdjacencyMap(std::vector<std::vector<int>> & AdjacentN
 static bool PointsAreColinear(Eigen::Vector2d const & p1, Eigen::Vector2d const & p2, Eigen::Vector2d const & p3);
 static int PointIsInsidePolygonHelper_wn_PnPoly(Eigen::Vector2d const & P, std::Evector<Eigen::Vector2d> const & V);
 static double PointIsInsidePolygonHelper_isLeft(Eigen::Vector2d const & P0, Eigen::Vector2d const & P1, Eigen::Vector2d const & P2);
+static void GetInteriorOverlapGraph(std::Evector<LineSegment> const & Segments, std::vector<std::vector<int>> & AdjacencyMap);
+static void GetInteriorOverlapGraph_BruteForce(std::Evector<LineSegment> const & Segments, std::vector<std::vector<int>> & AdjacencyMap);
+static void GetConvexHull(std::Evector<Eigen::Vector2d> const & Points, std::Evector<Eigen::Vector2d> & Hull);
+static Eigen::Vector2d GetCanonicalAxis(Eigen::Vector2d const & V);
 
 // ************************************************************************************************************************************************
 // *******************************************************   Generic Local Utility Functions   ****************************************************
@@ -63,6 +69,52 @@ static Eigen::Vector2d GetNextVertex(size_t ThisIndex, std::Evector<Eigen::Vecto
 }
 
 
+//Spatial hash of points for merging nearly-coincident points (closer than TOLERANCE) into graph nodes. Cells are 2*TOLERANCE wide, so
+//two points closer than TOLERANCE always land in the same or adjacent cells, even with round-off in the cell computation. Cell keys may
+//collide - that only adds candidates, since every candidate is checked against the exact distance test. Non-finite points never match
+//anything under that test (as with a linear scan) so they are not stored.
+class PointMergeHash {
+public:
+	void Insert(Eigen::Vector2d const & Point, int Index) {
+		if (Point.allFinite())
+			m_cells[GetCellKey(GetCellCoord(Point(0)), GetCellCoord(Point(1)))].push_back(Index);
+	}
+
+	//Get the indices of all inserted points within TOLERANCE of Point, in increasing order
+	void FindAll(Eigen::Vector2d const & Point, std::Evector<Eigen::Vector2d> const & Locations, std::vector<int> & Matches) const {
+		Matches.clear();
+		if (! Point.allFinite())
+			return;
+		int64_t cellX = GetCellCoord(Point(0));
+		int64_t cellY = GetCellCoord(Point(1));
+		for (int64_t dx = -1; dx <= 1; dx++) {
+			for (int64_t dy = -1; dy <= 1; dy++) {
+				auto iter = m_cells.find(GetCellKey(cellX + dx, cellY + dy));
+				if (iter == m_cells.end())
+					continue;
+				for (int index : iter->second) {
+					if ((Point - Locations[index]).norm() < TOLERANCE)
+						Matches.push_back(index);
+				}
+			}
+		}
+		//Colliding keys can put the same bucket in the neighborhood more than once
+		std::sort(Matches.begin(), Matches.end());
+		Matches.erase(std::unique(Matches.begin(), Matches.end()), Matches.end());
+	}
+
+private:
+	std::unordered_map<uint64_t, std::vector<int>> m_cells;
+
+	static int64_t GetCellCoord(double X) {
+		//Clamp so the conversion is defined for huge coordinates (points that far out all share a cell and get compared exactly)
+		return (int64_t) std::clamp(std::floor(X / (2.0*TOLERANCE)), -4.0e18, 4.0e18);
+	}
+	static uint64_t GetCellKey(int64_t CellX, int64_t CellY) {
+		return uint64_t(CellX) * 0x9E3779B97F4A7C15ULL ^ (uint64_t(CellY) + 0x632BE59BD9B4E019ULL);
+	}
+};
+
 // ************************************************************************************************************************************************
 // ***********************************************************   LineSegment Definitions   ********************************************************
 // ************************************************************************************************************************************************
@@ -618,7 +670,85 @@ bool SimplePolygon::IntersectsWith(SimplePolygon const & OtherPoly) const {
 }
 
 //Find the vector that minimizes the size of the orthogonal projection of the polygon onto the line defined by the vector
-Eigen::Vector2d SimplePolygon::FindShortestAxis(void) const {
+Eigen::Vector2d SimplePolygon::FindShortestAxis(AxisSearchMethod Method) const {
+	if (Method == AxisSearchMethod::AngleSweep)
+		return FindShortestAxis_AngleSweep();
+	else
+		return FindShortestAxis_RotatingCalipers();
+}
+
+//Find the vector that maximizes the size of the orthogonal projection of the polygon onto the line defined by the vector
+Eigen::Vector2d SimplePolygon::FindLongestAxis(AxisSearchMethod Method) const {
+	if (Method == AxisSearchMethod::AngleSweep)
+		return FindLongestAxis_AngleSweep();
+	else
+		return FindLongestAxis_RotatingCalipers();
+}
+
+//The width of the polygon in direction V (the length of its projection onto V) is the width of its convex hull. As a function of V this
+//is minimized with V normal to one of the hull edges. For each hull edge we track the hull vertex furthest from it (the antipodal vertex),
+//which only moves forward as we walk around the hull, so all edges are checked in a single pass.
+Eigen::Vector2d SimplePolygon::FindShortestAxis_RotatingCalipers(void) const {
+	std::Evector<Eigen::Vector2d> hull;
+	GetConvexHull(m_vertices, hull);
+	if (hull.size() < 2U)
+		return Eigen::Vector2d(1.0, 0.0); //All vectors will have 0 orthogonal projection, so just pick one
+	if (hull.size() == 2U) {
+		Eigen::Vector2d edge = (hull[1] - hull[0]).normalized();
+		return GetCanonicalAxis(Eigen::Vector2d(-1.0*edge(1), edge(0)));
+	}
+
+	size_t N = hull.size();
+	size_t antipodalIndex = 1U;
+	double minWidth = std::numeric_limits<double>::infinity();
+	Eigen::Vector2d bestV(1.0, 0.0);
+	for (size_t n = 0U; n < N; n++) {
+		Eigen::Vector2d edge = hull[(n + 1U) % N] - hull[n];
+		Eigen::Vector2d normal = Eigen::Vector2d(-1.0*edge(1), edge(0)).normalized(); //Points into the hull (hull is counter-clockwise)
+		while (normal.dot(hull[(antipodalIndex + 1U) % N] - hull[n]) > normal.dot(hull[antipodalIndex] - hull[n]))
+			antipodalIndex = (antipodalIndex + 1U) % N;
+		double width = normal.dot(hull[antipodalIndex] - hull[n]);
+		if (width < minWidth) {
+			minWidth = width;
+			bestV = normal;
+		}
+	}
+	return GetCanonicalAxis(bestV);
+}
+
+//The longest projection of the polygon has the length of its diameter (the largest distance between two vertices), and is in the direction
+//between those vertices. The furthest pair of vertices is an antipodal pair on the convex hull, which we find with rotating calipers.
+Eigen::Vector2d SimplePolygon::FindLongestAxis_RotatingCalipers(void) const {
+	std::Evector<Eigen::Vector2d> hull;
+	GetConvexHull(m_vertices, hull);
+	if (hull.size() < 2U)
+		return Eigen::Vector2d(1.0, 0.0); //All vectors will have 0 orthogonal projection, so just pick one
+	if (hull.size() == 2U)
+		return GetCanonicalAxis((hull[1] - hull[0]).normalized());
+
+	size_t N = hull.size();
+	size_t antipodalIndex = 1U;
+	double maxSquaredDist = -1.0;
+	Eigen::Vector2d bestV(1.0, 0.0);
+	for (size_t n = 0U; n < N; n++) {
+		Eigen::Vector2d edge = hull[(n + 1U) % N] - hull[n];
+		Eigen::Vector2d normal(-1.0*edge(1), edge(0));
+		while (normal.dot(hull[(antipodalIndex + 1U) % N] - hull[n]) > normal.dot(hull[antipodalIndex] - hull[n]))
+			antipodalIndex = (antipodalIndex + 1U) % N;
+		//Both endpoints of the edge are antipodal to the furthest vertex from the edge
+		for (size_t endpointIndex : {n, (n + 1U) % N}) {
+			Eigen::Vector2d V = hull[antipodalIndex] - hull[endpointIndex];
+			if (V.squaredNorm() > maxSquaredDist) {
+				maxSquaredDist = V.squaredNorm();
+				bestV = V;
+			}
+		}
+	}
+	return GetCanonicalAxis(bestV.normalized());
+}
+
+//Legacy version of FindShortestAxis() - search directions at 10 degree intervals and then refine around the best at 1 and 0.1 degree intervals
+Eigen::Vector2d SimplePolygon::FindShortestAxis_AngleSweep(void) const {
 	if (m_vertices.size() < 2U)
 		return Eigen::Vector2d(1.0, 0.0); //All vectors will have 0 orthogonal projection, so just pick one
 
@@ -700,8 +830,8 @@ Eigen::Vector2d SimplePolygon::FindShortestAxis(void) const {
 	return bestV;
 }
 
-//Find the vector that maximizes the size of the orthogonal projection of the polygon onto the line defined by the vector
-Eigen::Vector2d SimplePolygon::FindLongestAxis(void) const {
+//Legacy version of FindLongestAxis() - search directions at 10 degree intervals and then refine around the best at 1 and 0.1 degree intervals
+Eigen::Vector2d SimplePolygon::FindLongestAxis_AngleSweep(void) const {
 	if (m_vertices.size() < 2U)
 		return Eigen::Vector2d(1.0, 0.0); //All vectors will have 0 orthogonal projection, so just pick one
 
@@ -1203,74 +1333,78 @@ void SimplePolygon::Sanitize(void) {
 	//However, some new segments may contain endpoints that were not endpoints of the initial segment and there can be some round-off
 	//error in the computation of these points.
 
-	//Change our representation to a node graph
+	//Change our representation to a node graph. Segment endpoints closer than TOLERANCE are merged into a single node. When an endpoint
+	//is within TOLERANCE of several existing nodes we choose the same node that a linear scan of NodeLocations would: the scan visits nodes
+	//in order, remembers the last match for each endpoint, and stops at the first node where both endpoints have been matched.
 	std::Evector<Eigen::Vector2d> NodeLocations;        NodeLocations.reserve(segments.size());
 	std::vector<std::unordered_set<int>> AdjacentNodes; AdjacentNodes.reserve(segments.size());
+	PointMergeHash nodeHash;
+	std::vector<int> endpoint1Matches, endpoint2Matches;
 	for (auto const & segment : segments) {
+		nodeHash.FindAll(segment.m_endpoint1, NodeLocations, endpoint1Matches);
+		nodeHash.FindAll(segment.m_endpoint2, NodeLocations, endpoint2Matches);
+		int lastScannedIndex = std::numeric_limits<int>::max();
+		if ((! endpoint1Matches.empty()) && (! endpoint2Matches.empty()))
+			lastScannedIndex = std::max(endpoint1Matches.front(), endpoint2Matches.front());
+
 		int endpoint1Index = -1;
 		int endpoint2Index = -1;
-		for (size_t n = 0U; n < NodeLocations.size(); n++) {
-			if ((segment.m_endpoint1 - NodeLocations[n]).norm() < TOLERANCE)
-				endpoint1Index = int(n);
-			if ((segment.m_endpoint2 - NodeLocations[n]).norm() < TOLERANCE)
-				endpoint2Index = int(n);
-			if ((endpoint1Index >= 0) && (endpoint2Index >= 0))
-				break;
+		for (int index : endpoint1Matches) {
+			if (index <= lastScannedIndex)
+				endpoint1Index = index;
+		}
+		for (int index : endpoint2Matches) {
+			if (index <= lastScannedIndex)
+				endpoint2Index = index;
 		}
 
 		if (endpoint1Index < 0) {
 			endpoint1Index = (int) NodeLocations.size();
 			NodeLocations.push_back(segment.m_endpoint1);
 			AdjacentNodes.emplace_back();
+			nodeHash.Insert(segment.m_endpoint1, endpoint1Index);
 		}
 		if (endpoint2Index < 0) {
 			endpoint2Index = (int) NodeLocations.size();
 			NodeLocations.push_back(segment.m_endpoint2);
 			AdjacentNodes.emplace_back();
+			nodeHash.Insert(segment.m_endpoint2, endpoint2Index);
 		}
 
 		AdjacentNodes[endpoint1Index].insert(endpoint2Index);
 		AdjacentNodes[endpoint2Index].insert(endpoint1Index);
 	}
 
-	//Iteratively identify leaf nodes to prune from the graph until none remain
-	std::unordered_set<int> indicesToPrune;
-	while (true) {
-		bool leavesFound = false;
-		for (int n = 0; n < (int) AdjacentNodes.size(); n++) {
-			if (indicesToPrune.count(n) > 0U)
-				continue; //This node is already marked for deletion - skip it
-			int numberOfAdjacentNodes = 0;
-			for (int adjacentNodeIndex : AdjacentNodes[n]) {
-				if (indicesToPrune.count(adjacentNodeIndex) == 0U)
-					numberOfAdjacentNodes++;
-			}
-			//std::cerr << "Node " << n << ": Adjacent nodes: " << numberOfAdjacentNodes << "\r\n";
-			if (numberOfAdjacentNodes <= 1) {
-				indicesToPrune.insert(n);
-				leavesFound = true;
+	//Iteratively identify leaf nodes (at most 1 adjacent node that isn't already pruned) to prune from the graph until none remain.
+	//Pruning a node can only turn its neighbors into leaves, so we track the number of un-pruned neighbors of each node and work
+	//through a stack of new leaves instead of repeatedly scanning the whole graph.
+	std::vector<bool> pruned(NodeLocations.size(), false);
+	std::vector<int> numberOfAdjacentNodes(NodeLocations.size());
+	std::vector<int> leaves;
+	for (int n = 0; n < (int) AdjacentNodes.size(); n++) {
+		numberOfAdjacentNodes[n] = (int) AdjacentNodes[n].size();
+		if (numberOfAdjacentNodes[n] <= 1) {
+			pruned[n] = true;
+			leaves.push_back(n);
+		}
+	}
+	while (! leaves.empty()) {
+		int leaf = leaves.back();
+		leaves.pop_back();
+		for (int adjacentNodeIndex : AdjacentNodes[leaf]) {
+			if ((! pruned[adjacentNodeIndex]) && (--numberOfAdjacentNodes[adjacentNodeIndex] <= 1)) {
+				pruned[adjacentNodeIndex] = true;
+				leaves.push_back(adjacentNodeIndex);
 			}
 		}
-		if (! leavesFound)
-			break;
 	}
-	//if (! indicesToPrune.empty())
-	//	std::cerr << "Pruning " << (int) indicesToPrune.size() << " leaf nodes.\r\n";
 	//Re-build our graph data structures without the pruned nodes
+	//The new index is the old index minus the number of nodes with lower indices marked for deletion (-1 for nodes marked for deletion)
 	std::vector<int> oldIndexToNewIndex(NodeLocations.size());
-	for (int oldIndex = 0; oldIndex < (int) NodeLocations.size(); oldIndex++) {
-		//The new index is the old index minus the number of nodes with lower indices marked for deletion
-		//If this node is marked for deletion, we use -1 for the new index
-		if (indicesToPrune.count(oldIndex) > 0U)
-			oldIndexToNewIndex[oldIndex] = -1;
-		else {
-			int numberOfNodesWithLowerIndicesMarkedForDeletion = 0;
-			for (int index : indicesToPrune) {
-				if (index < oldIndex)
-					numberOfNodesWithLowerIndicesMarkedForDeletion++;
-			}
-			oldIndexToNewIndex[oldIndex] = oldIndex - numberOfNodesWithLowerIndicesMarkedForDeletion;
-		}
+	{
+		int numberOfNodesKept = 0;
+		for (int oldIndex = 0; oldIndex < (int) NodeLocations.size(); oldIndex++)
+			oldIndexToNewIndex[oldIndex] = pruned[oldIndex] ? -1 : numberOfNodesKept++;
 	}
 	{
 		std::Evector<Eigen::Vector2d> NewNodeLocations;        NewNodeLocations.reserve(NodeLocations.size());
@@ -1626,13 +1760,13 @@ bool Polygon::IntersectsWith(Polygon const & OtherPoly) const {
 }
 
 //Find the vector that minimizes the size of the orthogonal projection of the polygon onto the line defined by the vector
-Eigen::Vector2d Polygon::FindShortestAxis(void) const {
-	return m_boundary.FindShortestAxis();
+Eigen::Vector2d Polygon::FindShortestAxis(AxisSearchMethod Method) const {
+	return m_boundary.FindShortestAxis(Method);
 }
 
 //Find the vector that maximizes the size of the orthogonal projection of the polygon onto the line defined by the vector
-Eigen::Vector2d Polygon::FindLongestAxis(void) const {
-	return m_boundary.FindLongestAxis();
+Eigen::Vector2d Polygon::FindLongestAxis(AxisSearchMethod Method) const {
+	return m_boundary.FindLongestAxis(Method);
 }
 
 //Helper function for Polygon::IntersectWithHalfPlane()
@@ -2276,17 +2410,13 @@ Eigen::Vector2d PolygonCollection::GetSomeBoundaryVertex(void) const {
 
 //Take a collection of line segments and break/merge as needed to get a new collection that covers the same path but for
 //which segments can only intersect at vertices.
-std::Evector<LineSegment> SanitizeCollectionOfSegments(std::Evector<LineSegment> const & InputSegments) {
+std::Evector<LineSegment> SanitizeCollectionOfSegments(std::Evector<LineSegment> const & InputSegments, bool UseBruteForce) {
 	//First we build a graph where each node represents a segment and nodes are adjacent if the segments share a non-empty interior intersection
-	std::vector<std::vector<int>> adjacencyMap(InputSegments.size());
-	for (int n = 0; n < (int) InputSegments.size(); n++) {
-		for (int m = n + 1; m < (int) InputSegments.size(); m++) {
-			if (LineSegment::HasInteriorOverlap(InputSegments[n], InputSegments[m])) {
-				adjacencyMap[n].push_back(m);
-				adjacencyMap[m].push_back(n);
-			}
-		}
-	}
+	std::vector<std::vector<int>> adjacencyMap;
+	if (UseBruteForce)
+		GetInteriorOverlapGraph_BruteForce(InputSegments, adjacencyMap);
+	else
+		GetInteriorOverlapGraph(InputSegments, adjacencyMap);
 
 	//Break the segments into clusters where there are no non-vertex intersections between segments in different clusters
 	std::vector<std::unordered_set<int>> clusters;
@@ -2410,6 +2540,125 @@ static double getInternalAngle(Eigen::Vector2d const & A, Eigen::Vector2d const
 	return (PI - theta);
 }
 
+//Build a graph where each node represents a segment and nodes are adjacent if the segments share a non-empty interior intersection
+//(see LineSegment::HasInteriorOverlap()). Each adjacency list is sorted. SanitizeSegments() rules out any pair of non-degenerate
+//segments whose centers are further apart than half their total length, so only segments whose bounding discs overlap can have
+//interior overlap. We find those pairs with a sweep over the X extents of the discs (keeping the segments whose extents contain the
+//sweep position in an active list) and run the exact test on each pair whose Y extents overlap too. Degenerate segments (and segments
+//with non-finite coordinates) aren't ruled out by the disc test, so they are tested against every other segment. The result is
+//identical to testing all pairs.
+static void GetInteriorOverlapGraph(std::Evector<LineSegment> const & Segments, std::vector<std::vector<int>> & AdjacencyMap) {
+	AdjacencyMap.clear();
+	AdjacencyMap.resize(Segments.size());
+
+	//The exact test is always called with the lower index first to match the brute-force version
+	auto testPair = [&Segments, &AdjacencyMap](int n, int m) {
+		if (n > m)
+			std::swap(n, m);
+		if (LineSegment::HasInteriorOverlap(Segments[n], Segments[m])) {
+			AdjacencyMap[n].push_back(m);
+			AdjacencyMap[m].push_back(n);
+		}
+	};
+
+	//Get the bounding box of each segments bounding disc: (XMin, XMax, YMin, YMax). It is padded a little so round-off in the
+	//disc test in SanitizeSegments() can't let a pair through that the boxes rule out.
+	std::vector<Eigen::Vector4d> boxes(Segments.size());
+	std::vector<int> sweepOrder;   sweepOrder.reserve(Segments.size());
+	std::vector<int> testAllIndices;
+	for (int n = 0; n < (int) Segments.size(); n++) {
+		LineSegment const & segment(Segments[n]);
+		Eigen::Vector2d center = 0.5*segment.m_endpoint1 + 0.5*segment.m_endpoint2;
+		double radius = 0.5*segment.GetLength();
+		double pad = 1e-9*(radius + center.cwiseAbs().maxCoeff()) + TOLERANCE;
+		boxes[n] << center(0) - radius - pad, center(0) + radius + pad, center(1) - radius - pad, center(1) + radius + pad;
+		if (segment.IsDegenerate() || (! boxes[n].allFinite()))
+			testAllIndices.push_back(n);
+		else
+			sweepOrder.push_back(n);
+	}
+	std::sort(sweepOrder.begin(), sweepOrder.end(), [&boxes](int A, int B) { return boxes[A](0) < boxes[B](0); });
+
+	std::vector<int> active;
+	for (int n : sweepOrder) {
+		//Drop segments from the active list that end before this one starts
+		double xMin = boxes[n](0);
+		active.erase(std::remove_if(active.begin(), active.end(), [&boxes, xMin](int m) { return boxes[m](1) < xMin; }), active.end());
+		for (int m : active) {
+			if ((boxes[m](2) <= boxes[n](3)) && (boxes[n](2) <= boxes[m](3)))
+				testPair(n, m);
+		}
+		active.push_back(n);
+	}
+
+	for (size_t k = 0U; k < testAllIndices.size(); k++) {
+		int n = testAllIndices[k];
+		for (int m : sweepOrder)
+			testPair(n, m);
+		for (size_t j = k + 1U; j < testAllIndices.size(); j++)
+			testPair(n, testAllIndices[j]);
+	}
+
+	for (auto & adjacentSegments : AdjacencyMap)
+		std::sort(adjacentSegments.begin(), adjacentSegments.end());
+}
+
+//Reference version of GetInteriorOverlapGraph() that tests all pairs of segments
+static void GetInteriorOverlapGraph_BruteForce(std::Evector<LineSegment> const & Segments, std::vector<std::vector<int>> & AdjacencyMap) {
+	AdjacencyMap.clear();
+	AdjacencyMap.resize(Segments.size());
+	for (int n = 0; n < (int) Segments.size(); n++) {
+		for (int m = n + 1; m < (int) Segments.size(); m++) {
+			if (LineSegment::HasInteriorOverlap(Segments[n], Segments[m])) {
+				AdjacencyMap[n].push_back(m);
+				AdjacencyMap[m].push_back(n);
+			}
+		}
+	}
+}
+
+//Get the convex hull of a set of points (Andrew's monotone chain). The hull is counter-clockwise, starting from the lowest-leftmost point,
+//with no repeated or co-linear vertices. For a set of co-linear points this gives the 2 extreme points, and for a single point just that point.
+static void GetConvexHull(std::Evector<Eigen::Vector2d> const & Points, std::Evector<Eigen::Vector2d> & Hull) {
+	Hull.clear();
+	std::Evector<Eigen::Vector2d> sortedPoints(Points);
+	std::sort(sortedPoints.begin(), sortedPoints.end(), [](Eigen::Vector2d const & A, Eigen::Vector2d const & B) {
+		return (A(0) < B(0)) || ((A(0) == B(0)) && (A(1) < B(1)));
+	});
+	sortedPoints.erase(std::unique(sortedPoints.begin(), sortedPoints.end()), sortedPoints.end());
+	if (sortedPoints.size() < 3U) {
+		Hull = sortedPoints;
+		return;
+	}
+
+	//Returns a positive number if O->A->B turns left (counter-clockwise)
+	auto cross = [](Eigen::Vector2d const & O, Eigen::Vector2d const & A, Eigen::Vector2d const & B) {
+		return (A(0) - O(0))*(B(1) - O(1)) - (A(1) - O(1))*(B(0) - O(0));
+	};
+
+	Hull.resize(2U*sortedPoints.size());
+	size_t k = 0U;
+	for (size_t n = 0U; n < sortedPoints.size(); n++) { //Lower hull
+		while ((k >= 2U) && (cross(Hull[k - 2U], Hull[k - 1U], sortedPoints[n]) <= 0.0))
+			k--;
+		Hull[k++] = sortedPoints[n];
+	}
+	for (size_t n = sortedPoints.size() - 1U, lowerHullSize = k + 1U; n > 0U; n--) { //Upper hull
+		while ((k >= lowerHullSize) && (cross(Hull[k - 2U], Hull[k - 1U], sortedPoints[n - 1U]) <= 0.0))
+			k--;
+		Hull[k++] = sortedPoints[n - 1U];
+	}
+	Hull.resize(k - 1U); //The last point is the same as the first
+}
+
+//Axes are only defined up to sign - pick the representative with angle in [0, pi)
+static Eigen::Vector2d GetCanonicalAxis(Eigen::Vector2d const & V) {
+	if ((V(1) < 0.0) || ((V(1) == 0.0) && (V(0) < 0.0)))
+		return -1.0*V;
+	else
+		return V;
+}
+
 //Try to remove an edge from a graph adjacency map. The edge need not exist, but IndexA and IndexB must be valid node indices.
 static void RemoveEdgeFromAdjacencyMap(std::vector<std::vector<int>> & AdjacentNodes, int IndexA, int IndexB) {
 	//Remove IndexB from the adjacent nodes vector for IndexA
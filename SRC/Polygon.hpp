@@ -101,6 +101,12 @@ inline std::ostream & operator<<(std::ostream & Str, LineSegment const & v) {
 	return Str;
 }
 
+//Methods for finding the shortest and longest axes of a polygon (see SimplePolygon::FindShortestAxis() and SimplePolygon::FindLongestAxis())
+enum class AxisSearchMethod : int {
+	RotatingCalipers = 0, //Exact: rotating calipers over the convex hull of the boundary vertices - O(n log n)
+	AngleSweep = 1        //Legacy: coarse-to-fine sweep over directions (10, 1, and 0.1 degree steps) - kept for regression comparison
+};
+
 //The Triangle class isn't meant to be used as a workhorse since it is geometrically a special case of a simple polygon.
 //It is really just a super simple structure used for triangulation.
 class Triangle {
@@ -184,11 +190,13 @@ public:
 	//Returns true if this polygon intersects with the given "other" polygon. Not stable if the intersection has 0 area.
 	bool IntersectsWith(SimplePolygon const & OtherPoly) const;
 
-	//Find the vector that minimizes the size of the orthogonal projection of the polygon onto the line defined by the vector
-	Eigen::Vector2d FindShortestAxis(void) const;
+	//Find the vector that minimizes the size of the orthogonal projection of the polygon onto the line defined by the vector.
+	//The result is a unit vector with angle in [0, pi). With RotatingCalipers it is exactly normal to an edge of the convex hull.
+	Eigen::Vector2d FindShortestAxis(AxisSearchMethod Method = AxisSearchMethod::RotatingCalipers) const;
 
-	//Find the vector that maximizes the size of the orthogonal projection of the polygon onto the line defined by the vector
-	Eigen::Vector2d FindLongestAxis(void) const;
+	//Find the vector that maximizes the size of the orthogonal projection of the polygon onto the line defined by the vector.
+	//The result is a unit vector with angle in [0, pi). With RotatingCalipers it points between the two vertices furthest apart.
+	Eigen::Vector2d FindLongestAxis(AxisSearchMethod Method = AxisSearchMethod::RotatingCalipers) const;
 
 	//Cut simple polygon with a half plane. Keep the portion satisfying X dot V <= P. This may result in 0 simple polygons
 	//or arbitrarily many, depending on the geometry of the polygon and the chosen half plane. V must be a unit vector.
@@ -220,6 +228,12 @@ private:
 	//Get the length of the projection of the polygon onto the line in the given direction (V must be a unit vector)
 	double GetLengthOfProjection(Eigen::Vector2d const & V) const;
 
+	//Implementations of FindShortestAxis() and FindLongestAxis()
+	Eigen::Vector2d FindShortestAxis_RotatingCalipers(void) const;
+	Eigen::Vector2d FindLongestAxis_RotatingCalipers(void) const;
+	Eigen::Vector2d FindShortestAxis_AngleSweep(void) const;
+	Eigen::Vector2d FindLongestAxis_AngleSweep(void) const;
+
 	//Find index of the first vertex that lies in the half plane (-1 if all vertices lie outside half plane)
 	//The half plane is defined by X dot V <= P. V should be a unit vector.
 	int FindFirstVertexInHalfPlane(Eigen::Vector2d const & V, double P) const;
@@ -283,10 +297,10 @@ public:
 	bool IntersectsWith(Polygon const & OtherPoly) const;
 
 	//Find the vector that minimizes the size of the orthogonal projection of the polygon onto the line defined by the vector
-	Eigen::Vector2d FindShortestAxis(void) const;
+	Eigen::Vector2d FindShortestAxis(AxisSearchMethod Method = AxisSearchMethod::RotatingCalipers) const;
 	
 	//Find the vector that maximizes the size of the orthogonal projection of the polygon onto the line defined by the vector
-	Eigen::Vector2d FindLongestAxis(void) const;
+	Eigen::Vector2d FindLongestAxis(AxisSearchMethod Method = AxisSearchMethod::RotatingCalipers) const;
 
 	//Cut polygon with a half plane. Keep the portion satisfying X dot V <= P. This may result in 0 polygons
 	//or arbitrarily many, depending on the geometry of the polygon and the chosen half plane. V must be a unit vector.
@@ -373,5 +387,9 @@ inline std::ostream & operator<<(std::ostream & Str, PolygonCollection const & v
 
 //Public Utility functions
 //static bool PointsAreColinear(Eigen::Vector2d const & p1, Eigen::Vector2d const & p2, Eigen::Vector2d const & p3);
-std::Evector<LineSegment> SanitizeCollectionOfSegments(std::Evector<LineSegment> const & InputSegments);
+
+//Take a collection of line segments and break/merge as needed to get a new collection that covers the same path but for which segments can
+//only intersect at vertices. Overlapping segments are found with a sweep over segment extents. UseBruteForce selects the original all-pairs
+//search instead, which gives identical results and is only kept as a reference for testing and benchmarking.
+std::Evector<LineSegment> SanitizeCollectionOfSegments(std::Evector<LineSegment> const & InputSegments, bool UseBruteForce = false);
 
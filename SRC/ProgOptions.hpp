@@ -61,7 +61,7 @@ class ProgOptions {
 		int GNSSReceiverBaudRate;           //Baud rate for serial device
 
 		//Guidance Module options
-		int SurveyRegionPartitioningMethod; //0=triangle fusion, 1=iterated cuts	
+		int SurveyRegionPartitioningMethod; //0=triangle fusion, 1=iterated cuts, 2=balanced cuts	
 		
 		void LoadDefaults(void);    //Set all options to defaults (good fallback if file loading fails)
 		void SanitizeOptions(void); //Make sure all options are reasonable
@@ -104,7 +104,7 @@ inline void ProgOptions::SanitizeOptions(void) {
 	DroneIconScale                 = std::min(std::max(DroneIconScale,            0.250f),   2.0f);
 	zoomSpeed                      = std::min(std::max(zoomSpeed,                 0.125f),   8.0f);
 	GNSSReceiverBaudRate           =          std::max(GNSSReceiverBaudRate,        1200);
-	SurveyRegionPartitioningMethod = std::min(std::max(SurveyRegionPartitioningMethod, 0),      1);
+	SurveyRegionPartitioningMethod = std::min(std::max(SurveyRegionPartitioningMethod, 0),      2);
 }
 
 inline void ProgOptions::SaveToDisk(void) {
@@ -12,6 +12,8 @@
 #include <string>
 #include <array>
 #include <cstdio>
+#include <sstream>
+#include <thread>
 
 //External Includes
 #include "HandyImGuiInclude.hpp"
@@ -24,10 +26,15 @@
 #include "ProgOptions.hpp"
 #include "Maps/DataTileProvider.hpp"
 #include "Maps/SatelliteCacheMaster.hpp"
+#include "Maps/TilePrefetcher.hpp"
+#include "Maps/TileSeeder.hpp"
+#include "Maps/MapUtils.hpp"
+#include "SurveyRegionManager.hpp"
 #include "TestBenches.hpp"
 #include "Modules/GNSS-Receiver/GNSSReceiver.hpp"
 #include "UI/CommandWidget.hpp"
 #include "UI/VehicleControlWidget.hpp"
+#include "UI/TileSeedingWindow.hpp"
 #include "Modules/Shadow-Detection/ShadowDetection.hpp"
 #include "Modules/Shadow-Propagation/ShadowPropagation.hpp"
 
@@ -47,6 +54,10 @@ namespace Arguments {
 	FrameSyncType FrameSync    = FrameSyncType::INVALID;  //VSync on/off or enabled dynamically
 	int           TestBenchNum = -1;                      //-1: Run Recon, -2: List Tests, >=0: Run TestBench and exit
 	std::string   TestBenchArg = ""s;                     //Argument to testbench
+	std::string   SeedArea     = ""s;                     //If not empty, seed the sat tile cache for this area and exit (no UI)
+	std::string   SeedZoom     = "10:17"s;                //Zoom levels to seed: "Min:Max"
+	std::string   SeedURL      = ""s;                     //Tile URL template for seeding (empty: regular server)
+	int           SeedThreads  = 8;                       //Number of download threads for seeding
 };
 
 static RenderingAPI RenderingAPIFromString(std::string const & s) {
@@ -161,6 +172,13 @@ void parseArgs(int argc, const char * argv[], std::string const & VersionString,
 		Handy::Args::ValueArg<std::string> frameSyncOption("s", "framesync",      fsDesc.str(), false, DefaultFrameSyncString.c_str(), "Frame Syncing Type", cmd);
 		Handy::Args::ValueArg<int>         TestBenchOption("t", "test", "Run testbench instead of running Recon"s, false, -1, "int", cmd);
 		Handy::Args::SwitchArg             ListTestsSwitch("l", "list", "List available testbenches and exit."s, cmd, false);
+		Handy::Args::ValueArg<std::string>   SeedAreaOption("", "seed", "Seed the satellite tile cache for an area and exit instead of running Recon. "
+		                                                    "The area is a survey region name or \"MinLat,MaxLat,MinLon,MaxLon\" (degrees)."s,
+		                                                    false, "", "Area", cmd);
+		Handy::Args::ValueArg<std::string>   SeedZoomOption("", "seed-zoom", "Zoom levels to seed, as \"Min:Max\" (default 10:17)"s, false, "10:17", "Min:Max", cmd);
+		Handy::Args::ValueArg<std::string>    SeedURLOption("", "seed-url", "Tile URL template to seed from - {z}, {x}, and {y} are replaced with "
+		                                                    "the tile zoom, column, and row (default: the regular imagery server)"s, false, "", "URL", cmd);
+		Handy::Args::ValueArg<int>        SeedThreadsOption("", "seed-threads", "Number of download threads for seeding (default 8)"s, false, 8, "int", cmd);
 		Handy::Args::UnlabeledValueArg<std::string> TestBenchArg("Testbench-Arg", "Argument to test bench (optional)", false, "", "String", cmd);
 		cmd.parse(argc, argv);
 		
@@ -169,6 +187,10 @@ void parseArgs(int argc, const char * argv[], std::string const & VersionString,
 		Arguments::FrameSync    = FrameSyncTypeFromString(frameSyncOption.getValue());
 		Arguments::TestBenchNum = TestBenchOption.getValue();
 		Arguments::TestBenchArg = TestBenchArg.getValue();
+		Arguments::SeedArea     = SeedAreaOption.getValue();
+		Arguments::SeedZoom     = SeedZoomOption.getValue();
+		Arguments::SeedURL      = SeedURLOption.getValue();
+		Arguments::SeedThreads  = SeedThreadsOption.getValue();
 		if (ListTestsSwitch.getValue())
 			Arguments::TestBenchNum = -2;
 	}
@@ -255,6 +277,67 @@ void PrintProgramLaunchInfo(std::string const & VersionString, Journal & Log) {
 	Log.print ("Info: User Data Directory:       " + Handy::Paths::ThisExecutableDirectory()       .u8string());
 }
 
+//Seed the satellite tile cache for the area given on the command line, printing progress until the job is done. Returns the exit code.
+//This must only be called when no other instance of Recon is running, since it opens the tile cache itself.
+static int RunHeadlessSeeding(Journal & Log) {
+	int32_t MinZoom = -1, MaxZoom = -1;
+	if (std::sscanf(Arguments::SeedZoom.c_str(), "%d:%d", &MinZoom, &MaxZoom) != 2) {
+		Log.print("Error: Invalid seeding zoom range \"" + Arguments::SeedZoom + "\". Expected \"Min:Max\".");
+		return -1;
+	}
+
+	//The area is either 4 comma-separated numbers (a Lat/Lon box in degrees) or the name of a survey region
+	std::vector<Maps::Tile> tiles;
+	bool enumerated = false;
+	double MinLat, MaxLat, MinLon, MaxLon;
+	char trailing;
+	if (std::sscanf(Arguments::SeedArea.c_str(), "%lf,%lf,%lf,%lf%c", &MinLat, &MaxLat, &MinLon, &MaxLon, &trailing) == 4) {
+		const double DegToRad = 3.14159265358979/180.0;
+		Eigen::Vector2d LL_NM = LatLonToNM(Eigen::Vector2d(MinLat*DegToRad, MinLon*DegToRad));
+		Eigen::Vector2d UR_NM = LatLonToNM(Eigen::Vector2d(MaxLat*DegToRad, MaxLon*DegToRad));
+		Eigen::Vector4d AABB_NM(std::min(LL_NM(0), UR_NM(0)), std::max(LL_NM(0), UR_NM(0)), std::min(LL_NM(1), UR_NM(1)), std::max(LL_NM(1), UR_NM(1)));
+		enumerated = Maps::TileSeeder::EnumerateTiles(AABB_NM, MinZoom, MaxZoom, tiles);
+	}
+	else {
+		std::filesystem::path regionPath = Handy::Paths::ThisExecutableDirectory() / "Survey Regions" / (Arguments::SeedArea + ".region");
+		if (! std::filesystem::exists(regionPath)) {
+			Log.print("Error: \"" + Arguments::SeedArea + "\" is neither a Lat/Lon box nor the name of a survey region.");
+			return -1;
+		}
+		PolygonCollection region;
+		{
+			SurveyRegion surveyRegion(Arguments::SeedArea);
+			std::scoped_lock lock(surveyRegion.m_mutex);
+			region = surveyRegion.m_Region;
+		}
+		enumerated = Maps::TileSeeder::EnumerateTiles(region, MinZoom, MaxZoom, tiles);
+	}
+	if (! enumerated) {
+		Log.printf("Error: Can't seed area - the zoom range is invalid or the job would exceed %zu tiles.", Maps::TileSeeder::MaxTilesPerJob);
+		return -1;
+	}
+
+	Log.printf("Seeding %zu satellite tiles (levels %d - %d) with %d download threads.", tiles.size(), MinZoom, MaxZoom, Arguments::SeedThreads);
+	RestClient::init();
+	bool failed = false;
+	{
+		Maps::CacheFile cache(nullptr, Log);
+		Maps::TileSeeder seeder(cache, Maps::SatelliteCacheMaster::DefaultSource, std::move(tiles), Log,
+		                        (unsigned int) std::max(Arguments::SeedThreads, 1), Arguments::SeedURL);
+		while (! seeder.IsDone()) {
+			std::this_thread::sleep_for(std::chrono::seconds(2));
+			Maps::TileSeeder::Progress progress = seeder.GetProgress();
+			std::fprintf(stderr, "Seeding: %zu / %zu tiles (%zu cached, %zu downloaded, %zu failed) - %.1f tiles/s, %.2f MB/s, ETA: %.0f s\r\n",
+			             progress.TilesProcessed(), progress.TilesTotal, progress.TilesCached, progress.TilesFetched, progress.TilesFailed,
+			             progress.TilesPerSecond, progress.BytesPerSecond/1.0e6, progress.ETASeconds);
+		}
+		seeder.Wait();
+		failed = (seeder.GetProgress().TilesFailed > 0U);
+	}
+	RestClient::disable();
+	return failed ? 1 : 0;
+}
+
 int main(int argc, const char * argv[]) {
 	//Setup stdout and stderr capture
 	Handy::Console::Capture(std::cout);
@@ -309,6 +392,21 @@ int main(int argc, const char * argv[]) {
 	else if (result == SingleInstanceLock::ResultType::Lock_Succeeded_ButPreviousInstanceCrashed)
 		log.print("Warning: It looks like Recon didn't exit properly last time it ran.");
 	
+	//If we have been asked to seed the tile cache instead of starting Recon, do that. This happens after taking the instance lock
+	//since it opens the tile cache files, which a running instance would also have open.
+	if (! Arguments::SeedArea.empty()) {
+		int exitCode = RunHeadlessSeeding(log);
+		Handy::Console::Release(std::cout);
+		Handy::Console::Release(std::cerr);
+		return exitCode;
+	}
+	
+	//Remove shadow map history spill files left behind by a session that crashed (a clean shutdown removes them). This happens
+	//after taking the instance lock so we can't delete the spill files of a running instance.
+	size_t numOrphanedSpillFiles = ShadowDetection::ShadowMapHistory::RemoveOrphanedSpillFiles(ShadowDetection::ShadowDetectionEngine::HistorySpillDirectory());
+	if (numOrphanedSpillFiles > 0U)
+		log.print("Removed "s + std::to_string(numOrphanedSpillFiles) + " orphaned shadow map history spill files."s);
+	
 	log.print_continued("Loading program options ... ... ... ");
 	ProgOptions::Init(UserDataFolderPath / "ProgOptionsV2.json", log);
 	log.print("Done.");
@@ -320,6 +418,7 @@ int main(int argc, const char * argv[]) {
 	log.print_continued("Initializing Tile Providers ... ... ");
 	Maps::DataTileProvider::Init(log);
 	Maps::SatelliteCacheMaster::Instance()->Init(log);
+	Maps::TilePrefetcher::Init(log);
 	log.print("Done.");
 	
 	//Touch the GNSS Manager to trigger singleton object creation
@@ -358,8 +457,10 @@ int main(int argc, const char * argv[]) {
 	//Stop modules with private threads before cleaning up the data providers
 	VehicleControlWidget::Instance().Stop();
 	CommandWidget::Instance().Stop();
+	TileSeedingWindow::Instance().Stop();
 	
 	log.print_continued("Destroying Tile Providers . ... ... ");
+	Maps::TilePrefetcher::Destroy();
 	Maps::SatelliteCacheMaster::Instance()->Destroy();
 	Maps::DataTileProvider::Destroy();
 	log.print("Done.");
@@ -1,24 +1,71 @@
-//This module provides a simple, persistent, two-file KV store for arbitrary data. Values are loaded from disk
-//in a lazy fashion, but the key table is pre-loaded. This makes it fast to check if keys exist and it speeds up
-//value retrieval, but it makes this store inappropriate for massive databases.
+//This module provides a simple, persistent KV store for arbitrary data. Values are loaded from disk in a lazy fashion, but the
+//key table is held in memory. This makes it fast to check if keys exist and it speeds up value retrieval, but it makes this
+//store inappropriate for databases with a massive number of keys (tens of GB of values is fine - it is the key count that matters).
 //
-//Values are written immediately to a values file, but new keys are only written (along with the old keys) back to the
-//keys file when the store is closed. As a result, there is only a short window of time (closing the store) when a
-//write interruption (e.g. program crash) could corrupt the store. If the program crashes while the store is open
-//the keys file will have the same contents as when the store was last opened. There will be some unreferenced items
-//at the end of the values file, but they will be purged the next time the store is densified.
+//The store is log-structured and crash-safe:
+//  - Values are appended to segment files (<Store>.Values.<n>). Only the newest segment (the active segment) is written to and a
+//    value is never modified in place - replacing or deleting an item just leaves dead bytes behind in an older segment.
+//  - Every change to the key table (put, delete, clear, or a value moved by compaction) is appended as a small checksummed record to
+//    a journal file (<Store>.Journal.<g>). Records are written and fsynced in batches by a background thread, and always after the
+//    segment data they refer to has been fsynced. A crash therefore loses at most the last batch (a fraction of a second of writes)
+//    and can never leave the key table pointing at data that didn't make it to disk.
+//  - When the journal gets large the background thread starts a new journal generation and writes a checkpoint (<Store>.Checkpoint.<g>),
+//    which is a complete copy of the key table. Opening the store loads the newest complete checkpoint and replays the journals after it.
+//  - The background thread also compacts the store incrementally: it picks a sealed segment with too much dead space, moves its live
+//    values into the active segment a few MB at a time, and deletes the segment once the moves are durable. Closing the store is instant.
+//The key table is split into shards, each with its own lock, and values are read with pread() outside of any lock. Concurrent readers
+//and writers (e.g. the thread pools of the tile caches) only contend when they touch the same shard, and never around disk reads.
+//
+//Stores in the previous two-file format (<Store>.Keys and <Store>.Values) are converted in place when opened: the values file becomes
+//segment 0 and the keys file becomes the first checkpoint, so existing caches are kept.
 //
 //This KV store type-punnes primitive types and is unaware of endianness for any data that may be encoded in values.
 //Thus, KV store files may not be compatible accross different CPU architectures and platforms. This is done for
 //simplicity and performance and makes the format ideal for data caches, but not really for data exchange.
+//File access goes through a small portable layer (OpenFile(), PReadAll(), SyncFile(), ...) with POSIX and Windows implementations.
+//On POSIX systems each segment is also memory-mapped (read-only) so GetView() can hand out values without copying them - the view
+//holds a reference to the mapping, so it stays valid after the item is replaced or compacted. On Windows views are always copies.
 //Author: Bryan Poling
-//Copyright (c) 2019 Sentek Systems, LLC. All rights reserved. 
+//Copyright (c) 2019 Sentek Systems, LLC. All rights reserved.
 #pragma once
 
 //System Includes
 #include <string>
+#include <vector>
+#include <array>
+#include <map>
 #include <unordered_map>
 #include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <utility>
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+	#include <io.h>
+	#include <fcntl.h>
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/stat.h>
+	#include <sys/mman.h>
+#endif
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
 
 //External Includes
 #include "../../handycpp/Handy.hpp" //Provides std::filesystem and Handy::File
@@ -26,72 +73,392 @@
 //GEMS-Core Includes
 #include "Journal.h"
 
-//There are two files in a KVStore: A Keys file and a Values file. The keys file consists of a sequence of items
-//of the form: KeyLength, Key, ValueOffset, ValueLength
-//KeyLength:   uint16 - implicitly limits key strings to 65,535 chars. This field cannot be 0 (empty keys are not allowed)
-//Key:         String
-//ValueOffset: uint64 - offset in values file where value begins
-//ValueLength: uint64 - number of bytes in the value
+//Journal and checkpoint files start with an 8-byte magic number, followed by a sequence of records of the form:
+//CRC, RecordLength, Type, Payload
+//CRC:          uint32 - CRC-32C of everything in the record after this field
+//RecordLength: uint32 - number of bytes in the record after this field (Type and Payload)
+//Type:         uint8  - 1 = Put, 2 = Delete, 3 = Clear (delete everything), 4 = End (last record of a complete checkpoint)
+//Payload:      Put:    KeyLength (uint16), Key (string), Segment (uint32), ValueOffset (uint64), ValueLength (uint64)
+//              Delete: KeyLength (uint16), Key (string)
+//              Clear:  Nothing
+//              End:    NumItems (uint64)
+//Key strings are limited to 65,535 chars and cannot be empty. Records are applied in order. Reading a file stops at the first
+//incomplete record or record with a bad CRC (i.e. the tail of a journal that was being written when the program died).
 //
-//The values file simply consists of densely packed value items.
+//Segment files simply consist of densely packed values.
 
 //This class is thread-safe
 class SimpleKVStore {
 	private:
-		std::mutex Mtx;
-		
+		//Where a value lives: segment ID, offset in the segment file, and length (bytes)
+		struct Location {
+			uint32_t Segment = 0U;
+			uint64_t Offset  = 0U;
+			uint64_t Length  = 0U;
+
+			bool operator==(Location const & Other) const {
+				return (Segment == Other.Segment) && (Offset == Other.Offset) && (Length == Other.Length);
+			}
+		};
+
+		//One shard of the key table
+		struct Shard {
+			std::mutex Mtx;
+			std::unordered_map<std::string, Location> Index; //Key --> Location of value
+		};
+
+		//An open segment file. Readers hold a shared_ptr to the segment while reading from it, so compaction can drop a segment
+		//(and delete its file) without closing the file descriptor out from under a read in progress.
+		struct Segment {
+			uint32_t ID = 0U;
+			int      FD = -1;
+			uint8_t const * Map = nullptr;        //Read-only mapping of the file (nullptr if mapping failed)
+			uint64_t        MapLength = 0U;       //Length of the mapping (bytes) - it may extend past the end of the file
+			std::atomic<uint64_t> Size{0U};      //Size of the file, including space reserved for writes in progress (bytes)
+			std::atomic<uint64_t> LiveBytes{0U}; //Bytes of values referenced by the key table
+			std::atomic<bool>     NeedsSync{false};
+			std::atomic<uint32_t> PendingWrites{0U}; //Values reserved in the segment that aren't in the key table yet
+
+			~Segment() {
+				#if !defined(_WIN32)
+				if (Map != nullptr)
+					::munmap((void *) Map, MapLength);
+				#endif
+				CloseFile(FD);
+			}
+		};
+
+		enum class RecordType : uint8_t { Put = 1U, Delete = 2U, Clear = 3U, End = 4U };
+		enum FileFlags : int { FileCreate = 1, FileTruncate = 2, FileAppend = 4 }; //Options for OpenFile() - files are always opened read/write
+
+		static constexpr size_t   NumShards               = 64U;
+		static constexpr uint64_t SegmentTargetSize       = 256ULL << 20; //Start a new active segment when the current one gets this big (bytes)
+		static constexpr double   CompactionWasteFraction = 0.25;         //Compact sealed segments with more than this fraction of dead bytes
+		static constexpr uint64_t CompactionStepBytes     = 16ULL << 20;  //Max live bytes moved by compaction per background pass
+		static constexpr uint64_t JournalFlushBytes       = 1ULL << 20;   //Flush early if this many record bytes are waiting to be written
+		static constexpr uint64_t MinCheckpointJournal    = 64ULL << 20;  //Don't bother checkpointing until the journal is at least this big (bytes)
+		static constexpr int      FlushIntervalMs         = 250;          //Max time between journal flushes (ms)
+		static constexpr uint64_t JournalMagic            = 0x314C4E524A564B53ULL; //"SKVJRNL1"
+		static constexpr uint64_t CheckpointMagic         = 0x3154504B43564B53ULL; //"SKVCKPT1"
+
 		Journal & Log;
 		std::filesystem::path StorePath; //Path to store (without file extension)
-		Handy::File ValuesFile;
-		std::unordered_map<std::string, std::tuple<uint64_t, uint64_t>> Index; //Key --> <Offset, ValueLength>
-		
+		std::atomic<bool> m_open{false};
+
+		std::array<Shard, NumShards> m_shards;
+		std::atomic<uint64_t> m_numItems{0U};
+
+		std::shared_mutex m_segmentsMtx;                         //Protects m_segments (the map - segments have their own atomics)
+		std::map<uint32_t, std::shared_ptr<Segment>> m_segments; //All segments, by ID
+		std::mutex m_appendMtx;                                  //Protects m_activeSegment and serializes space reservation in it
+		std::shared_ptr<Segment> m_activeSegment;
+
+		std::mutex m_journalMtx;              //Protects the staged records and journal fields below
+		std::vector<uint8_t> m_stagedRecords; //Records waiting to be written to the journal
+		int      m_journalFD       = -1;
+		uint32_t m_journalGen      = 0U;
+		uint64_t m_journalBytes    = 0U;
+		uint64_t m_checkpointBytes = 0U;
+		std::mutex m_flushMtx;                //Serializes journal flushes and journal generation changes
+
+		std::mutex m_maintenanceMtx;          //Held while compacting or checkpointing (and by Clear())
+		std::thread m_bgThread;
+		std::mutex m_bgMtx;
+		std::condition_variable m_bgCV;
+		bool m_bgAbort = false;
+		bool m_bgWake  = false;
+
 		inline bool Open();
 		inline void Close();
-		
-		inline bool DensifyValuesFile();
-		inline bool ReadValue(uint64_t Offset, uint64_t Size, std::vector<uint8_t> & Value);
-		
+
+		inline bool MigrateLegacyStore(void);
+		inline bool Write(std::string const & Key, std::vector<uint8_t> const & Value, bool OnlyIfNew);
+		inline void RemoveIfAt(std::string const & Key, Location const & Loc);
+		inline void ReleaseLocation(Location const & Loc);
+
+		inline std::shared_ptr<Segment> OpenSegment(uint32_t ID, bool Create);
+		inline std::shared_ptr<Segment> GetSegment(uint32_t ID);
+		inline std::shared_ptr<Segment> AppendValue(uint8_t const * Data, uint64_t Size, Location & Loc);
+		inline bool RollActiveSegment(void);
+		inline void SyncSegments(void);
+
+		inline void StageRecord(RecordType Type, std::string const & Key, Location const * Loc);
+		inline bool FlushJournal(void);
+		inline bool FlushJournalLocked(void);
+		inline int  CreateJournalFile(uint32_t Gen);
+		inline bool WriteCheckpoint(void);
+		inline void CompactionStep(void);
+		inline void BackgroundMain(void);
+		inline void WakeBackgroundThread(void);
+
+		Shard & GetShard(std::string const & Key) { return m_shards[std::hash<std::string>()(Key) % NumShards]; }
+		std::filesystem::path GetFilePath(std::string const & Suffix) const { return std::filesystem::path(StorePath.string() + Suffix); }
+		std::filesystem::path GetFilePath(std::string const & Kind, uint32_t ID) const { return GetFilePath("."s + Kind + "."s + std::to_string(ID)); }
+		inline std::vector<uint32_t> ListStoreFiles(std::string const & Kind) const;
+		inline bool WriteFileDurably(std::filesystem::path const & Path, std::vector<uint8_t> const & Buffer);
+		inline void SyncDirectory(void) const;
+
+		static inline uint32_t CRC32C(uint8_t const * Data, size_t Size);
+		static inline void EncodeRecord(std::vector<uint8_t> & Buffer, RecordType Type, std::string const & Key, Location const * Loc, uint64_t Count = 0U);
+		template <typename Func> static size_t ParseRecords(std::vector<uint8_t> const & Buffer, size_t Offset, Func && Callback);
+
+		//Portable file layer. Files are identified by a CRT/POSIX file descriptor on every platform.
+		static inline int  OpenFile(std::filesystem::path const & Path, int Flags);
+		static inline void CloseFile(int FD);
+		static inline bool SyncFile(int FD);
+		static inline bool TruncateFile(int FD, uint64_t Size);
+		static inline bool GetFileSize(int FD, uint64_t & Size);
+		static inline bool PReadAll(int FD, uint8_t * Data, uint64_t Size, uint64_t Offset);
+		static inline bool PWriteAll(int FD, uint8_t const * Data, uint64_t Size, uint64_t Offset);
+		static inline bool WriteAll(int FD, uint8_t const * Data, uint64_t Size);
+
 		//We use a stopwatch to update internal measurements of store size periodically (if being polled).
 		//This is to reduce overhead if hammering the inspection methods. We don't update these at all except in those methods.
+		std::mutex m_sizeMtx;
 		Handy::StopWatch m_sizeRefreshStopwatch;
-		uint64_t m_numBytes;
-		uint64_t m_numBytesOnDisk;
+		uint64_t m_numBytes = 0U;
+		uint64_t m_numBytesOnDisk = 0U;
 		inline void RefreshSizesIfNeeded();
 	public:
 		SimpleKVStore() = delete;
 		SimpleKVStore(std::filesystem::path const & StorePathArg, Journal & LogRef) : Log(LogRef), StorePath(StorePathArg) { Open(); }
 		~SimpleKVStore() { Close(); }
-		
-		bool IsOpen(void) {	std::scoped_lock slock(Mtx); return ValuesFile.IsOpen(); }
-		bool Has(std::string const & Key) { std::scoped_lock slock(Mtx); return (Index.count(Key) > 0U); }
-		
+
+		bool IsOpen(void) { return m_open; }
+		inline bool Has(std::string const & Key);
+
 		inline bool Get(std::string const & Key, std::vector<uint8_t> & Value);
-		inline bool Put(std::string const & Key, std::vector<uint8_t> const & Value);
-		inline bool PutIfNew(std::string const & Key, std::vector<uint8_t> const & Value);
-		
-		void Delete(std::string const & Key) { std::scoped_lock slock(Mtx); Index.erase(Key); }
-		void Clear(void) { std::scoped_lock slock(Mtx); Index.clear(); DensifyValuesFile(); }
-		
+		inline bool GetView(std::string const & Key, std::shared_ptr<uint8_t const> & Data, uint64_t & Size);
+		inline bool Put(std::string const & Key, std::vector<uint8_t> const & Value) { return Write(Key, Value, false); }
+		inline bool PutIfNew(std::string const & Key, std::vector<uint8_t> const & Value) { return Write(Key, Value, true); }
+
+		//Add or replace many items at once (skipping keys that are already in the store if OnlyIfNew is true). The values are written
+		//with a single write and the batch is durable when this returns, so bulk loads avoid paying for a write per item and a journal
+		//flush per FlushIntervalMs. Returns the number of items written.
+		inline size_t PutBatch(std::vector<std::pair<std::string, std::vector<uint8_t>>> const & Items, bool OnlyIfNew);
+
+		inline void Delete(std::string const & Key);
+		inline void Clear(void);
+
 		//Store Size Inspection
-		uint64_t GetNumItems() { std::scoped_lock slock(Mtx); return (ValuesFile.IsOpen() ? Index.size() : 0U); }
-		uint64_t GetNumBytes() { std::scoped_lock slock(Mtx); RefreshSizesIfNeeded(); return m_numBytes; }
-		uint64_t GetNumBytesOnDisk() { std::scoped_lock slock(Mtx); RefreshSizesIfNeeded(); return m_numBytesOnDisk; }
+		uint64_t GetNumItems() { return (m_open ? m_numItems.load() : 0U); }
+		uint64_t GetNumBytes() { std::scoped_lock slock(m_sizeMtx); RefreshSizesIfNeeded(); return m_numBytes; }
+		uint64_t GetNumBytesOnDisk() { std::scoped_lock slock(m_sizeMtx); RefreshSizesIfNeeded(); return m_numBytesOnDisk; }
 };
 
+// ****************************************************************************************************************************************
+// ************************************************   SimpleKVStore Open, Close, and Recovery   *******************************************
+// ****************************************************************************************************************************************
 inline bool SimpleKVStore::Open() {
-	if (ValuesFile.IsOpen())
+	if (m_open)
 		Close();
-	Index.clear();
-	if (! ValuesFile.Open(StorePath + ".Values"s, false)) {
-		Log.print("Error in SimpleKVStore::Open(): Could not open values file.");
+	for (Shard & shard : m_shards)
+		shard.Index.clear();
+	m_numItems = 0U;
+	m_segments.clear();
+	m_activeSegment.reset();
+	m_stagedRecords.clear();
+
+	if (! MigrateLegacyStore())
 		return false;
+
+	auto applyRecord = [this](RecordType Type, std::string const & Key, Location const & Loc) {
+		if (Type == RecordType::Put)
+			GetShard(Key).Index[Key] = Loc;
+		else if (Type == RecordType::Delete)
+			GetShard(Key).Index.erase(Key);
+		else if (Type == RecordType::Clear) {
+			for (Shard & shard : m_shards)
+				shard.Index.clear();
+		}
+	};
+
+	//Load the newest complete checkpoint (if there is one). Its generation is the oldest journal we need.
+	std::vector<uint32_t> checkpointGens = ListStoreFiles("Checkpoint"s);
+	uint32_t baseGen = 0U;
+	for (auto iter = checkpointGens.rbegin(); iter != checkpointGens.rend(); iter++) {
+		std::vector<uint8_t> buffer;
+		if ((! Handy::TryReadFile(GetFilePath("Checkpoint"s, *iter), buffer)) || (buffer.size() < 8U) || (*((uint64_t *) buffer.data()) != CheckpointMagic))
+			continue;
+		bool complete = false;
+		ParseRecords(buffer, 8U, [&](RecordType Type, std::string const & Key, Location const & Loc, uint64_t) {
+			if (Type == RecordType::End)
+				complete = true;
+			else if (! complete)
+				applyRecord(Type, Key, Loc);
+		});
+		if (complete) {
+			baseGen = *iter;
+			m_checkpointBytes = buffer.size();
+			break;
+		}
+		Log.printf("Warning in SimpleKVStore::Open(): Ignoring incomplete checkpoint (generation %u).", (unsigned int) *iter);
+		for (Shard & shard : m_shards)
+			shard.Index.clear();
+	}
+
+	//Replay the journals from the checkpoint generation on
+	std::vector<uint32_t> journalGens = ListStoreFiles("Journal"s);
+	uint32_t lastGen = std::max(baseGen, 1U);
+	uint64_t lastValidBytes = 0U;
+	bool haveJournal = false;
+	for (uint32_t gen : journalGens) {
+		if (gen < baseGen)
+			continue;
+		std::vector<uint8_t> buffer;
+		size_t validBytes = 0U;
+		if (Handy::TryReadFile(GetFilePath("Journal"s, gen), buffer) && (buffer.size() >= 8U) && (*((uint64_t *) buffer.data()) == JournalMagic)) {
+			validBytes = ParseRecords(buffer, 8U, [&](RecordType Type, std::string const & Key, Location const & Loc, uint64_t) {
+				applyRecord(Type, Key, Loc);
+			});
+		}
+		if (validBytes < buffer.size())
+			Log.printf("Warning in SimpleKVStore::Open(): Dropped %llu bytes of incomplete records at the end of journal generation %u.",
+			           (unsigned long long int) (buffer.size() - validBytes), (unsigned int) gen);
+		lastGen = gen;
+		lastValidBytes = validBytes;
+		haveJournal = true;
+	}
+
+	//Remove files from older generations (and incomplete checkpoints)
+	std::error_code ec;
+	for (uint32_t gen : journalGens) {
+		if (gen < baseGen)
+			std::filesystem::remove(GetFilePath("Journal"s, gen), ec);
+	}
+	for (uint32_t gen : checkpointGens) {
+		if (gen != baseGen)
+			std::filesystem::remove(GetFilePath("Checkpoint"s, gen), ec);
+	}
+
+	//Open the segments and drop keys whose values aren't on disk (e.g. a segment was deleted or truncated outside of the store)
+	for (uint32_t ID : ListStoreFiles("Values"s)) {
+		std::shared_ptr<Segment> segment = OpenSegment(ID, false);
+		if (segment)
+			m_segments[ID] = segment;
+	}
+	std::vector<std::string> droppedKeys;
+	for (Shard & shard : m_shards) {
+		for (auto iter = shard.Index.begin(); iter != shard.Index.end();) {
+			Location const & loc(iter->second);
+			auto segIter = m_segments.find(loc.Segment);
+			if ((segIter == m_segments.end()) || (loc.Offset + loc.Length > segIter->second->Size)) {
+				droppedKeys.push_back(iter->first);
+				iter = shard.Index.erase(iter);
+			}
+			else {
+				segIter->second->LiveBytes += loc.Length;
+				iter++;
+			}
+		}
+		m_numItems += shard.Index.size();
+	}
+	if (! droppedKeys.empty())
+		Log.printf("Warning in SimpleKVStore::Open(): Dropped %llu items whose values are missing from disk.", (unsigned long long int) droppedKeys.size());
+
+	//Keep appending to the newest segment unless it is full
+	if ((! m_segments.empty()) && (m_segments.rbegin()->second->Size < SegmentTargetSize))
+		m_activeSegment = m_segments.rbegin()->second;
+	else if (! RollActiveSegment()) {
+		Log.print("Error in SimpleKVStore::Open(): Could not create values file.");
+		return false;
+	}
+
+	//Open the journal for appending. If the last journal has a damaged tail we cut it off so new records follow the valid ones.
+	if (haveJournal) {
+		m_journalFD = OpenFile(GetFilePath("Journal"s, lastGen), FileAppend);
+		if ((m_journalFD >= 0) && (lastValidBytes < 8U)) {
+			bool ok = TruncateFile(m_journalFD, 0U) && WriteAll(m_journalFD, (uint8_t const *) &JournalMagic, 8U);
+			lastValidBytes = ok ? 8U : 0U;
+		}
+		else if (m_journalFD >= 0)
+			TruncateFile(m_journalFD, lastValidBytes);
+		m_journalBytes = lastValidBytes;
 	}
-	
-	//Parse the Keys file
-	std::vector<uint8_t> KeysBuffer;
-	if (! Handy::TryReadFile(StorePath + ".Keys"s, KeysBuffer))
-		Log.print("Unable to read Keys file: Starting with empty key map");
 	else {
+		m_journalFD = CreateJournalFile(lastGen);
+		m_journalBytes = 8U;
+	}
+	if (m_journalFD < 0) {
+		Log.print("Error in SimpleKVStore::Open(): Could not open journal file.");
+		m_segments.clear();
+		m_activeSegment.reset();
+		return false;
+	}
+	m_journalGen = lastGen;
+
+	//Record the dropped items in the journal. Otherwise the checkpoint and journals still reference the missing values, and if a new
+	//segment with the same ID is created later the stale records would point into it the next time the store is opened.
+	if (! droppedKeys.empty()) {
+		for (std::string const & key : droppedKeys)
+			StageRecord(RecordType::Delete, key, nullptr);
+		if (! FlushJournal())
+			Log.print("Warning in SimpleKVStore::Open(): Could not record dropped items in the journal.");
+	}
+
+	m_bgAbort = false;
+	m_bgWake  = false;
+	m_open = true;
+	m_bgThread = std::thread(&SimpleKVStore::BackgroundMain, this);
+	return true;
+}
+
+inline void SimpleKVStore::Close() {
+	if (! m_open)
+		return;
+
+	//Stop the background thread and make everything written so far durable. Nothing else needs to happen - compaction is
+	//incremental and picks up where it left off next time the store is opened.
+	{
+		std::scoped_lock lock(m_bgMtx);
+		m_bgAbort = true;
+	}
+	m_bgCV.notify_all();
+	if (m_bgThread.joinable())
+		m_bgThread.join();
+	FlushJournal();
+	m_open = false;
+
+	{
+		std::scoped_lock jlock(m_journalMtx);
+		CloseFile(m_journalFD);
+		m_journalFD = -1;
+	}
+	{
+		std::scoped_lock alock(m_appendMtx);
+		m_activeSegment.reset();
+	}
+	{
+		std::unique_lock lock(m_segmentsMtx);
+		m_segments.clear();
+	}
+}
+
+//Convert a store in the old two-file format (<Store>.Keys and <Store>.Values) in place. Each step can be repeated, so a conversion
+//that is interrupted just finishes next time.
+inline bool SimpleKVStore::MigrateLegacyStore(void) {
+	std::error_code ec;
+	std::filesystem::path legacyValuesPath = GetFilePath(".Values"s);
+	std::filesystem::path legacyKeysPath   = GetFilePath(".Keys"s);
+	if (std::filesystem::exists(legacyValuesPath, ec) && (! std::filesystem::exists(GetFilePath("Values"s, 0U), ec))) {
+		std::filesystem::rename(legacyValuesPath, GetFilePath("Values"s, 0U), ec);
+		if (ec) {
+			Log.print("Error in SimpleKVStore::Open(): Could not convert values file to new format.");
+			return false;
+		}
+		SyncDirectory();
+	}
+	if (! std::filesystem::exists(legacyKeysPath, ec))
+		return true;
+
+	if (ListStoreFiles("Checkpoint"s).empty() && ListStoreFiles("Journal"s).empty()) {
+		std::vector<uint8_t> KeysBuffer;
+		if (! Handy::TryReadFile(legacyKeysPath, KeysBuffer))
+			Log.print("Unable to read Keys file: Starting with empty key map");
+
+		std::vector<uint8_t> checkpoint(8U);
+		std::memcpy(checkpoint.data(), &CheckpointMagic, 8U);
+		uint64_t numItems = 0U;
 		size_t offset = 0U;
 		while (offset < KeysBuffer.size()) {
 			//There is data left in the buffer
@@ -111,212 +478,645 @@ inline bool SimpleKVStore::Open() {
 				Log.print("Warning: Dropping incomplete key item.");
 				break;
 			}
-			uint64_t ValueOffset = *((uint64_t *) &(KeysBuffer[offset]));
+			Location loc;
+			loc.Segment = 0U;
+			loc.Offset  = *((uint64_t *) &(KeysBuffer[offset]));
 			offset += 8U;
-			uint64_t ValueLength = *((uint64_t *) &(KeysBuffer[offset]));
+			loc.Length  = *((uint64_t *) &(KeysBuffer[offset]));
 			offset += 8U;
-			
-			Index[Key] = std::tuple<uint64_t,uint64_t>(ValueOffset, ValueLength);
+
+			if (! Key.empty()) {
+				EncodeRecord(checkpoint, RecordType::Put, Key, &loc);
+				numItems++;
+			}
+		}
+		EncodeRecord(checkpoint, RecordType::End, std::string(), nullptr, numItems);
+		if (! WriteFileDurably(GetFilePath("Checkpoint"s, 1U), checkpoint)) {
+			Log.print("Error in SimpleKVStore::Open(): Could not write checkpoint while converting store to new format.");
+			return false;
 		}
+		Log.printf("Converted KV store to log-structured format (%llu items).", (unsigned long long int) numItems);
 	}
-	
+	std::filesystem::remove(legacyKeysPath, ec);
 	return true;
 }
 
-inline void SimpleKVStore::Close() {
-	//If necessary, densify the values file - This must be done before writing the keys file since bad keys can be removed here
-	ValuesFile.Flush();
-	//DensifyValuesFile();
-	std::error_code ec;
-	double ValueFileSizeBytes = (double) std::filesystem::file_size(StorePath + ".Values"s, ec);
-	if (ec)
-		Log.print("Warning: Skipping densification because we couldn't get values file size.");
-	else {
-		uint64_t TotalValueBytes = 0U;
-		for (auto const & kv : Index)
-			TotalValueBytes += std::get<1>(kv.second);
-		double WastedBytes = ValueFileSizeBytes - (double) TotalValueBytes;
-		if (WastedBytes / ValueFileSizeBytes > 0.25) {
-			Log.print("Wasted space in values file exceeds 25%. Attempting densification."s);
-			if (DensifyValuesFile())
-				Log.print("Densification succeeded.");
-			else
-				Log.print("Densification failed.");
+// ****************************************************************************************************************************************
+// *****************************************************   SimpleKVStore Item Access   ****************************************************
+// ****************************************************************************************************************************************
+inline bool SimpleKVStore::Has(std::string const & Key) {
+	Shard & shard = GetShard(Key);
+	std::scoped_lock slock(shard.Mtx);
+	return (shard.Index.count(Key) > 0U);
+}
+
+inline bool SimpleKVStore::Get(std::string const & Key, std::vector<uint8_t> & Value) {
+	if (! m_open)
+		return false;
+	Shard & shard = GetShard(Key);
+	Location loc;
+	for (int attempt = 0; attempt < 2; attempt++) {
+		{
+			std::scoped_lock slock(shard.Mtx);
+			auto iter = shard.Index.find(Key);
+			if (iter == shard.Index.end())
+				return false;
+			loc = iter->second;
+		}
+
+		//Read outside of the index lock. If the segment is gone it was just compacted away - look the key up again for its new location.
+		std::shared_ptr<Segment> segment = GetSegment(loc.Segment);
+		if (! segment)
+			continue;
+		Value.resize(loc.Length);
+		if (PReadAll(segment->FD, Value.data(), loc.Length, loc.Offset))
+			return true;
+		break;
+	}
+
+	Log.printf("ReadValue Failed. Tried reading bytes [%llu, %llu] of values file %u.", (unsigned long long int) loc.Offset,
+	           (unsigned long long int) (loc.Offset + loc.Length - 1U), (unsigned int) loc.Segment);
+
+	//If we couldn't read the value for this item, remove it from the index.
+	RemoveIfAt(Key, loc);
+	return false;
+}
+
+//Get a value without copying it. On success Data points to the value (Size bytes) and holds a reference to the memory behind it -
+//normally the mapping of its values file, or a private copy if the value isn't covered by a mapping. The pages of the value are
+//advised in, since a view is usually decoded right away and tiles that were viewed once tend to be viewed again soon.
+//Touching a mapped page past the end of the file raises SIGBUS, so before handing out a mapped view the value is checked against the
+//current size of the file - if the file was truncated outside of the store the value is read with pread() instead, which fails cleanly
+//and drops the item. Values files are only ever appended to by the store, so a view that passed the check stays readable.
+inline bool SimpleKVStore::GetView(std::string const & Key, std::shared_ptr<uint8_t const> & Data, uint64_t & Size) {
+	if (! m_open)
+		return false;
+	Shard & shard = GetShard(Key);
+	Location loc;
+	{
+		std::scoped_lock slock(shard.Mtx);
+		auto iter = shard.Index.find(Key);
+		if (iter == shard.Index.end())
+			return false;
+		loc = iter->second;
+	}
+
+	std::shared_ptr<Segment> segment = GetSegment(loc.Segment);
+	uint64_t fileSize = 0U;
+	if (segment && (segment->Map != nullptr) && (loc.Offset + loc.Length <= segment->MapLength) &&
+	    GetFileSize(segment->FD, fileSize) && (loc.Offset + loc.Length <= fileSize)) {
+		if (loc.Length > 0U) {
+			static uint64_t const pageSize = (uint64_t) ::sysconf(_SC_PAGESIZE);
+			uint64_t start = loc.Offset - loc.Offset % pageSize;
+			::madvise((void *) (segment->Map + start), loc.Offset + loc.Length - start, MADV_WILLNEED);
 		}
+		Data = std::shared_ptr<uint8_t const>(segment, segment->Map + loc.Offset);
+		Size = loc.Length;
+		return true;
 	}
-	
-	//Close the Values file
-	ValuesFile.Close();
-	
-	//Write Keys file
-	std::vector<uint8_t> KeysBuffer;
-	for (auto const & kv : Index) {
-		uint16_t KeySize = kv.first.size();
-		uint64_t ValueOffset = std::get<0>(kv.second);
-		uint64_t ValueLength = std::get<1>(kv.second);
-		size_t BlockSize = 18U + KeySize;
-		KeysBuffer.resize(KeysBuffer.size() + BlockSize);
-		
-		std::copy_n((uint8_t *)(&KeySize), 2U, KeysBuffer.end() - BlockSize);
-		std::copy_n((uint8_t *)(&kv.first[0]), KeySize, KeysBuffer.end() - BlockSize + 2U);
-		std::copy_n((uint8_t *)(&ValueOffset), 8U, KeysBuffer.end() - 16U);
-		std::copy_n((uint8_t *)(&ValueLength), 8U, KeysBuffer.end() - 8U);
-	}
-	if (! Handy::TryWriteFile(StorePath + ".Keys"s, KeysBuffer)) {
-		Log.print("Warning: Failed to write Keys file.");
-	}
-}
-
-//Re-build the values file, copying only the data referenced in the index (removes empty space in values file).
-//Can only be called when the store is open. After densification, the store should be open (unless something failed)
-inline bool SimpleKVStore::DensifyValuesFile() {
-	if (! ValuesFile.IsOpen())
+
+	//No mapping covers the value, the file is shorter than it should be, or the segment was just compacted away - fall back on a copy
+	std::shared_ptr<std::vector<uint8_t>> value = std::make_shared<std::vector<uint8_t>>();
+	if (! Get(Key, *value))
 		return false;
-	
-	Handy::File NewValuesFile;
-	if (! NewValuesFile.Open(StorePath + ".NewValues"s, true))
+	Data = std::shared_ptr<uint8_t const>(value, value->data());
+	Size = value->size();
+	return true;
+}
+
+//Shared implementation of Put() and PutIfNew()
+inline bool SimpleKVStore::Write(std::string const & Key, std::vector<uint8_t> const & Value, bool OnlyIfNew) {
+	if (! m_open)
+		return false;
+	if (Key.empty() || (Key.size() > 65535U)) {
+		Log.print("Warning in SimpleKVStore::Put: Invalid key length.");
+		return false;
+	}
+	Shard & shard = GetShard(Key);
+	if (OnlyIfNew) {
+		std::scoped_lock slock(shard.Mtx);
+		if (shard.Index.count(Key) > 0U)
+			return false;
+	}
+
+	//Write the value outside of the index lock
+	Location loc;
+	std::shared_ptr<Segment> segment = AppendValue(Value.data(), Value.size(), loc);
+	if (! segment) {
+		Log.print("Warning in SimpleKVStore::Put: Failed to write value to file.");
 		return false;
-	std::vector<std::string> KeysToRemove;
-	for (auto & kv : Index) {
-		std::string Key = kv.first;
-		uint64_t OldValueOffset = std::get<0>(kv.second);
-		uint64_t ValueLength    = std::get<1>(kv.second);
-		
-		std::vector<uint8_t> Value;
-		if ((! ReadValue(OldValueOffset, ValueLength, Value)) || (Value.size() != ValueLength)) {
-			Log.print("Dropping item during densification since value could not be read.");
-			KeysToRemove.push_back(Key);
+	}
+
+	std::scoped_lock slock(shard.Mtx);
+	auto iter = shard.Index.find(Key);
+	if ((iter != shard.Index.end()) && OnlyIfNew) {
+		//Another thread added the key while we were writing - our copy of the value is just dead space now
+		segment->PendingWrites--;
+		return false;
+	}
+	if (iter != shard.Index.end()) {
+		ReleaseLocation(iter->second);
+		iter->second = loc;
+	}
+	else {
+		shard.Index.emplace(Key, loc);
+		m_numItems++;
+	}
+	segment->LiveBytes += loc.Length;
+	segment->PendingWrites--;
+	StageRecord(RecordType::Put, Key, &loc);
+	return true;
+}
+
+inline size_t SimpleKVStore::PutBatch(std::vector<std::pair<std::string, std::vector<uint8_t>>> const & Items, bool OnlyIfNew) {
+	if ((! m_open) || Items.empty())
+		return 0U;
+
+	//Pack the values we are going to write into one buffer
+	std::vector<size_t>   itemIndices;
+	std::vector<uint64_t> offsets;
+	std::vector<uint8_t>  buffer;
+	itemIndices.reserve(Items.size());
+	offsets.reserve(Items.size());
+	for (size_t n = 0U; n < Items.size(); n++) {
+		std::string const & key = Items[n].first;
+		if (key.empty() || (key.size() > 65535U)) {
+			Log.print("Warning in SimpleKVStore::PutBatch: Invalid key length.");
+			continue;
 		}
-		else {
-			uint64_t NewValueOffset = (uint64_t) NewValuesFile.Tell(Handy::AccessPosition::Write);
-			if (NewValuesFile.Write(Value))
-				std::get<0>(kv.second) = NewValueOffset;
-			else {
-				Log.print("Dropping item during densification since value could not be written.");
-				KeysToRemove.push_back(Key);
-			}
+		if (OnlyIfNew) {
+			Shard & shard = GetShard(key);
+			std::scoped_lock slock(shard.Mtx);
+			if (shard.Index.count(key) > 0U)
+				continue;
 		}
+		itemIndices.push_back(n);
+		offsets.push_back(buffer.size());
+		buffer.insert(buffer.end(), Items[n].second.begin(), Items[n].second.end());
 	}
-	for (std::string Key : KeysToRemove)
-		Index.erase(Key);
-	NewValuesFile.Flush();
-	NewValuesFile.Close();
-	
-	//Now, close the values file, replace it with NewValues, and re-open it
-	ValuesFile.Flush();
-	ValuesFile.Close();
-	std::error_code ec;
-	std::filesystem::rename(StorePath + ".Values"s, StorePath + ".OldValues"s, ec);
-	if (! ec) {
-		std::filesystem::rename(StorePath + ".NewValues"s, StorePath + ".Values"s, ec);
-		if (! ec) {
-			std::filesystem::remove(StorePath + ".OldValues"s, ec);
-			if (ec)
-				Log.print("Warning: During KV store densification, could not remove old values file.");
+	if (itemIndices.empty())
+		return 0U;
+
+	Location batchLoc;
+	std::shared_ptr<Segment> segment = AppendValue(buffer.data(), buffer.size(), batchLoc);
+	if (! segment) {
+		Log.print("Warning in SimpleKVStore::PutBatch: Failed to write values to file.");
+		return 0U;
+	}
+
+	size_t numWritten = 0U;
+	for (size_t k = 0U; k < itemIndices.size(); k++) {
+		std::string const & key = Items[itemIndices[k]].first;
+		Location loc;
+		loc.Segment = batchLoc.Segment;
+		loc.Offset  = batchLoc.Offset + offsets[k];
+		loc.Length  = Items[itemIndices[k]].second.size();
+
+		Shard & shard = GetShard(key);
+		std::scoped_lock slock(shard.Mtx);
+		auto iter = shard.Index.find(key);
+		if (iter != shard.Index.end()) {
+			if (OnlyIfNew)
+				continue; //Another thread added the key while we were writing - our copy of the value is just dead space now
+			ReleaseLocation(iter->second);
+			iter->second = loc;
 		}
 		else {
-			Log.print("Error: During KV store densification, could not replace old values file with new one. Trying to restore.");
-			std::filesystem::rename(StorePath + ".OldValues"s, StorePath + ".Values"s, ec);
-			if (! ec)
-				Log.print("Restore was successful.");
-			else
-				Log.print("Restore failed.");
+			shard.Index.emplace(key, loc);
+			m_numItems++;
 		}
+		segment->LiveBytes += loc.Length;
+		StageRecord(RecordType::Put, key, &loc);
+		numWritten++;
+	}
+	segment->PendingWrites--;
+	FlushJournal();
+	return numWritten;
+}
+
+inline void SimpleKVStore::Delete(std::string const & Key) {
+	if (! m_open)
+		return;
+	Shard & shard = GetShard(Key);
+	std::scoped_lock slock(shard.Mtx);
+	auto iter = shard.Index.find(Key);
+	if (iter != shard.Index.end()) {
+		ReleaseLocation(iter->second);
+		shard.Index.erase(iter);
+		m_numItems--;
+		StageRecord(RecordType::Delete, Key, nullptr);
+	}
+}
+
+//Remove an item, but only if its value is still at the given location (it hasn't been replaced or moved since we looked it up)
+inline void SimpleKVStore::RemoveIfAt(std::string const & Key, Location const & Loc) {
+	Shard & shard = GetShard(Key);
+	std::scoped_lock slock(shard.Mtx);
+	auto iter = shard.Index.find(Key);
+	if ((iter != shard.Index.end()) && (iter->second == Loc)) {
+		ReleaseLocation(iter->second);
+		shard.Index.erase(iter);
+		m_numItems--;
+		StageRecord(RecordType::Delete, Key, nullptr);
+	}
+}
+
+//Remove everything from the store. The segments become entirely dead space and are deleted by the background thread.
+inline void SimpleKVStore::Clear(void) {
+	if (! m_open)
+		return;
+	std::scoped_lock mlock(m_maintenanceMtx);
+	{
+		std::vector<std::unique_lock<std::mutex>> locks;
+		locks.reserve(NumShards);
+		for (Shard & shard : m_shards)
+			locks.emplace_back(shard.Mtx);
+		for (Shard & shard : m_shards)
+			shard.Index.clear();
+		m_numItems = 0U;
+		{
+			std::shared_lock lock(m_segmentsMtx);
+			for (auto const & kv : m_segments)
+				kv.second->LiveBytes = 0U;
+		}
+		StageRecord(RecordType::Clear, std::string(), nullptr);
+	}
+
+	//Seal the active segment so it can be deleted too
+	{
+		std::scoped_lock alock(m_appendMtx);
+		if (m_activeSegment->Size > 0U)
+			RollActiveSegment();
+	}
+	FlushJournal();
+	WakeBackgroundThread();
+}
+
+//Called with the lock of the shard holding the location - the value at Loc is no longer referenced
+inline void SimpleKVStore::ReleaseLocation(Location const & Loc) {
+	std::shared_ptr<Segment> segment = GetSegment(Loc.Segment);
+	if (segment)
+		segment->LiveBytes -= Loc.Length;
+}
+
+// ****************************************************************************************************************************************
+// ********************************************************   SimpleKVStore Segments   ****************************************************
+// ****************************************************************************************************************************************
+inline std::shared_ptr<SimpleKVStore::Segment> SimpleKVStore::OpenSegment(uint32_t ID, bool Create) {
+	std::filesystem::path path = GetFilePath("Values"s, ID);
+	int FD = OpenFile(path, Create ? FileCreate : 0);
+	uint64_t fileSize = 0U;
+	if ((FD < 0) || (! GetFileSize(FD, fileSize))) {
+		Log.print("Error in SimpleKVStore::OpenSegment(): Could not open values file: " + path.string());
+		CloseFile(FD);
+		return nullptr;
+	}
+	std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+	segment->ID   = ID;
+	segment->FD   = FD;
+	segment->Size = fileSize;
+
+	#if !defined(_WIN32)
+
+	//Map the whole range the segment can grow into, so values appended later are covered without remapping. Values are only read
+	//once they are in the key table, and so never from the part of the mapping beyond the end of the file.
+	uint64_t pageSize  = (uint64_t) ::sysconf(_SC_PAGESIZE);
+	uint64_t mapLength = std::max(segment->Size.load(), SegmentTargetSize);
+	mapLength = (mapLength + pageSize - 1U) / pageSize * pageSize;
+	void * map = ::mmap(nullptr, mapLength, PROT_READ, MAP_SHARED, FD, 0);
+	if (map != MAP_FAILED) {
+		::madvise(map, mapLength, MADV_RANDOM); //Tiles are read individually - don't drag their neighbors in with them
+		segment->Map       = (uint8_t const *) map;
+		segment->MapLength = mapLength;
 	}
 	else
-		Log.print("Error: During KV store densification, could not rename values file. Store will not be modified.");
-	if (! ValuesFile.Open(StorePath + ".Values"s, false)) {
-		Log.print("Error: During KV store densification, could not open densified values file.");
-		return false;
+		Log.print("Warning in SimpleKVStore::OpenSegment(): Could not map values file - views will fall back on copies: " + path.string());
+	#endif
+	return segment;
+}
+
+inline std::shared_ptr<SimpleKVStore::Segment> SimpleKVStore::GetSegment(uint32_t ID) {
+	std::shared_lock lock(m_segmentsMtx);
+	auto iter = m_segments.find(ID);
+	return (iter == m_segments.end()) ? nullptr : iter->second;
+}
+
+//Reserve space at the end of the active segment and write a value there. Only the reservation is serialized - concurrent writers
+//fill their reserved ranges in parallel. Returns the segment written to, or nullptr on failure. On success the caller must decrement
+//the segment's PendingWrites once it has put the location in the key table (or decided not to).
+inline std::shared_ptr<SimpleKVStore::Segment> SimpleKVStore::AppendValue(uint8_t const * Data, uint64_t Size, Location & Loc) {
+	std::shared_ptr<Segment> segment;
+	{
+		std::scoped_lock alock(m_appendMtx);
+		if (! m_activeSegment)
+			return nullptr;
+		if ((m_activeSegment->Size > 0U) && (m_activeSegment->Size + Size > SegmentTargetSize) && (! RollActiveSegment()))
+			return nullptr;
+		segment = m_activeSegment;
+		Loc.Segment = segment->ID;
+		Loc.Offset  = segment->Size;
+		Loc.Length  = Size;
+		segment->Size += Size;
+		segment->PendingWrites++;
 	}
-	return true;
+	if ((Size > 0U) && (! PWriteAll(segment->FD, Data, Size, Loc.Offset))) {
+		segment->PendingWrites--;
+		return nullptr;
+	}
+	segment->NeedsSync = true;
+	return segment;
 }
 
-inline bool SimpleKVStore::ReadValue(uint64_t Offset, uint64_t Size, std::vector<uint8_t> & Value) {
-	if (! ValuesFile.IsOpen())
+//Start a new active segment. Called with m_appendMtx held (or during Open()).
+inline bool SimpleKVStore::RollActiveSegment(void) {
+	uint32_t newID = 0U;
+	{
+		std::shared_lock lock(m_segmentsMtx);
+		if (! m_segments.empty())
+			newID = m_segments.rbegin()->first + 1U;
+	}
+	std::shared_ptr<Segment> segment = OpenSegment(newID, true);
+	if (! segment)
 		return false;
-	ValuesFile.Seek(Handy::AccessPosition::Read, Offset);
+	SyncDirectory();
+	{
+		std::unique_lock lock(m_segmentsMtx);
+		m_segments[newID] = segment;
+	}
+	m_activeSegment = segment;
+	return true;
+}
 
-	if (!ValuesFile.ReadTo(Value, Size))
+//fsync every segment that has been written to since it was last synced
+inline void SimpleKVStore::SyncSegments(void) {
+	std::vector<std::shared_ptr<Segment>> segments;
 	{
-		/// FAILED
-		Log.printf("ReadValue Failed. Tried reading bytes [%llu, %llu].",
-		          (unsigned long long int) Offset,
-		          (unsigned long long int) (Offset + Size - 1U));
-		ValuesFile.SeekEnd(Handy::AccessPosition::Read);
-		unsigned long long int maxIndex = (unsigned long long int) ValuesFile.Tell(Handy::AccessPosition::Read);
-		Log.printf("Last index in Values file: %llu", maxIndex);
+		std::shared_lock lock(m_segmentsMtx);
+		for (auto const & kv : m_segments) {
+			if (kv.second->NeedsSync.exchange(false))
+				segments.push_back(kv.second);
+		}
+	}
+	for (auto const & segment : segments)
+		SyncFile(segment->FD);
+}
 
-		return false;
+// ****************************************************************************************************************************************
+// ***************************************************   SimpleKVStore Journal and Checkpoints   ******************************************
+// ****************************************************************************************************************************************
+//Queue a record for the journal. Called with the lock of the shard the key belongs to held (all shard locks for Clear records),
+//so records for any one key are queued in the same order the changes were made to the key table.
+inline void SimpleKVStore::StageRecord(RecordType Type, std::string const & Key, Location const * Loc) {
+	bool flushNow = false;
+	{
+		std::scoped_lock jlock(m_journalMtx);
+		EncodeRecord(m_stagedRecords, Type, Key, Loc);
+		flushNow = (m_stagedRecords.size() >= JournalFlushBytes);
 	}
+	if (flushNow)
+		WakeBackgroundThread();
+}
 
-	return true;
+inline bool SimpleKVStore::FlushJournal(void) {
+	std::scoped_lock flock(m_flushMtx);
+	return FlushJournalLocked();
 }
 
-inline bool SimpleKVStore::Get(std::string const & Key, std::vector<uint8_t> & Value) {
-	std::scoped_lock slock(Mtx);
-	if (Index.count(Key) == 0U)
-		return false;
-	bool success = ReadValue(std::get<0>(Index.at(Key)), std::get<1>(Index.at(Key)), Value);
-	//If we couldn't read the value for this item, remove it from the index.
+//Write staged records to the journal. The segment data the records refer to is synced first, so the journal never references data
+//that isn't on disk. Called with m_flushMtx held.
+inline bool SimpleKVStore::FlushJournalLocked(void) {
+	std::vector<uint8_t> records;
+	int FD = -1;
+	{
+		std::scoped_lock jlock(m_journalMtx);
+		records.swap(m_stagedRecords);
+		FD = m_journalFD;
+	}
+	if (records.empty())
+		return true;
+
+	SyncSegments();
+	bool success = (FD >= 0) && WriteAll(FD, records.data(), records.size()) && SyncFile(FD);
+	{
+		std::scoped_lock jlock(m_journalMtx);
+		m_journalBytes += records.size();
+	}
 	if (! success)
-		Index.erase(Key);
+		Log.print("Error in SimpleKVStore::FlushJournal(): Failed to write journal. Recent changes may not survive a crash.");
 	return success;
 }
 
-inline bool SimpleKVStore::Put(std::string const & Key, std::vector<uint8_t> const & Value) {
-	std::scoped_lock slock(Mtx);
-	if (! ValuesFile.IsOpen())
-		return false;
-	ValuesFile.SeekEnd(Handy::AccessPosition::Write);
-	uint64_t ValueOffset = (uint64_t) ValuesFile.Tell(Handy::AccessPosition::Write);
-	if (ValuesFile.Write(Value)) {
-		Index[Key] = std::make_tuple(ValueOffset, (uint64_t) Value.size());
-		return true;
+inline int SimpleKVStore::CreateJournalFile(uint32_t Gen) {
+	int FD = OpenFile(GetFilePath("Journal"s, Gen), FileCreate | FileTruncate | FileAppend);
+	if (FD < 0)
+		return -1;
+	if ((! WriteAll(FD, (uint8_t const *) &JournalMagic, 8U)) || (! SyncFile(FD))) {
+		CloseFile(FD);
+		return -1;
 	}
-	else {
-		Log.print("Warning in SimpleKVStore::Put: Failed to write value to file.");
+	SyncDirectory();
+	return FD;
+}
+
+//Start a new journal generation and write a checkpoint for it, then remove the files of older generations. A checkpoint is taken
+//while the store is in use, so it may already reflect some of the records in the new journal - this is fine since replaying a record
+//sets a key to an absolute state. Called from the background thread with m_maintenanceMtx held.
+inline bool SimpleKVStore::WriteCheckpoint(void) {
+	uint32_t newGen = 0U;
+	{
+		std::scoped_lock flock(m_flushMtx);
+		FlushJournalLocked();
+		newGen = m_journalGen + 1U;
+		int FD = CreateJournalFile(newGen);
+		if (FD < 0) {
+			Log.print("Error in SimpleKVStore::WriteCheckpoint(): Could not create journal file.");
+			return false;
+		}
+		std::scoped_lock jlock(m_journalMtx);
+		CloseFile(m_journalFD);
+		m_journalFD    = FD;
+		m_journalGen   = newGen;
+		m_journalBytes = 8U;
+	}
+
+	std::vector<uint8_t> checkpoint(8U);
+	std::memcpy(checkpoint.data(), &CheckpointMagic, 8U);
+	uint64_t numItems = 0U;
+	for (Shard & shard : m_shards) {
+		std::scoped_lock slock(shard.Mtx);
+		for (auto const & kv : shard.Index)
+			EncodeRecord(checkpoint, RecordType::Put, kv.first, &(kv.second));
+		numItems += shard.Index.size();
+	}
+	EncodeRecord(checkpoint, RecordType::End, std::string(), nullptr, numItems);
+
+	//The checkpoint may reference values written since the last journal flush - make sure they are on disk before the checkpoint is
+	SyncSegments();
+	if (! WriteFileDurably(GetFilePath("Checkpoint"s, newGen), checkpoint)) {
+		Log.print("Error in SimpleKVStore::WriteCheckpoint(): Could not write checkpoint.");
 		return false;
 	}
+	{
+		std::scoped_lock jlock(m_journalMtx);
+		m_checkpointBytes = checkpoint.size();
+	}
+
+	std::error_code ec;
+	for (uint32_t gen : ListStoreFiles("Journal"s)) {
+		if (gen < newGen)
+			std::filesystem::remove(GetFilePath("Journal"s, gen), ec);
+	}
+	for (uint32_t gen : ListStoreFiles("Checkpoint"s)) {
+		if (gen < newGen)
+			std::filesystem::remove(GetFilePath("Checkpoint"s, gen), ec);
+	}
+	return true;
 }
 
-//Same as Put(), but checks to see if an item with the given key is already present and fails if it finds one (and returns false)
-inline bool SimpleKVStore::PutIfNew(std::string const & Key, std::vector<uint8_t> const & Value) {
-	std::scoped_lock slock(Mtx);
-	if (Index.count(Key) > 0U)
-		return false;
-	if (! ValuesFile.IsOpen())
-		return false;
-	ValuesFile.SeekEnd(Handy::AccessPosition::Write);
-	uint64_t ValueOffset = (uint64_t) ValuesFile.Tell(Handy::AccessPosition::Write);
-	if (ValuesFile.Write(Value)) {
-		Index[Key] = std::make_tuple(ValueOffset, (uint64_t) Value.size());
-		return true;
+// ****************************************************************************************************************************************
+// *******************************************************   SimpleKVStore Maintenance   **************************************************
+// ****************************************************************************************************************************************
+//Do one increment of compaction: pick the sealed segment with the most dead space (if it has enough to be worth it) and move up to
+//CompactionStepBytes of its live values to the active segment. Once nothing references the segment it is deleted - but only after
+//the records for the moved values are durable. Called from the background thread with m_maintenanceMtx held.
+inline void SimpleKVStore::CompactionStep(void) {
+	uint32_t activeID = 0U;
+	{
+		std::scoped_lock alock(m_appendMtx);
+		activeID = m_activeSegment->ID;
 	}
-	else {
-		Log.print("Warning in SimpleKVStore::Put: Failed to write value to file.");
-		return false;
+	std::shared_ptr<Segment> victim;
+	double worstWaste = CompactionWasteFraction;
+	{
+		std::shared_lock lock(m_segmentsMtx);
+		for (auto const & kv : m_segments) {
+			if ((kv.first == activeID) || (kv.second->PendingWrites > 0U))
+				continue;
+			uint64_t size = kv.second->Size;
+			double waste = (size == 0U) ? 1.0 : 1.0 - double(std::min(kv.second->LiveBytes.load(), size)) / double(size);
+			if (waste > worstWaste) {
+				victim = kv.second;
+				worstWaste = waste;
+			}
+		}
+	}
+	if (! victim)
+		return;
+
+	//Find the values still in the victim segment
+	std::vector<std::tuple<std::string, Location>> moves;
+	uint64_t moveBytes = 0U;
+	for (Shard & shard : m_shards) {
+		std::scoped_lock slock(shard.Mtx);
+		for (auto const & kv : shard.Index) {
+			if ((kv.second.Segment == victim->ID) && (moveBytes < CompactionStepBytes)) {
+				moves.push_back(std::make_tuple(kv.first, kv.second));
+				moveBytes += kv.second.Length;
+			}
+		}
+		if (moveBytes >= CompactionStepBytes)
+			break;
+	}
+
+	if (moves.empty()) {
+		//Nothing references the segment. Make the records of earlier moves durable and then drop it.
+		if (! FlushJournal())
+			return;
+		{
+			std::unique_lock lock(m_segmentsMtx);
+			m_segments.erase(victim->ID);
+		}
+		std::error_code ec;
+		std::filesystem::remove(GetFilePath("Values"s, victim->ID), ec);
+		if (ec)
+			Log.print("Warning in SimpleKVStore::CompactionStep(): Could not remove values file.");
+		return;
+	}
+
+	std::vector<uint8_t> value;
+	for (auto const & move : moves) {
+		std::string const & key(std::get<0>(move));
+		Location const & oldLoc(std::get<1>(move));
+		value.resize(oldLoc.Length);
+		if (! PReadAll(victim->FD, value.data(), oldLoc.Length, oldLoc.Offset)) {
+			Log.print("Dropping item during compaction since value could not be read.");
+			RemoveIfAt(key, oldLoc);
+			continue;
+		}
+		Location newLoc;
+		std::shared_ptr<Segment> segment = AppendValue(value.data(), value.size(), newLoc);
+		if (! segment)
+			return;
+
+		//The item may have been replaced or deleted while we copied it - in that case the copy is just dead space
+		Shard & shard = GetShard(key);
+		std::scoped_lock slock(shard.Mtx);
+		auto iter = shard.Index.find(key);
+		if ((iter != shard.Index.end()) && (iter->second == oldLoc)) {
+			iter->second = newLoc;
+			victim->LiveBytes -= oldLoc.Length;
+			segment->LiveBytes += newLoc.Length;
+			StageRecord(RecordType::Put, key, &newLoc);
+		}
+		segment->PendingWrites--;
 	}
 }
 
+inline void SimpleKVStore::BackgroundMain(void) {
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(m_bgMtx);
+			m_bgCV.wait_for(lock, std::chrono::milliseconds(FlushIntervalMs), [this]() { return m_bgAbort || m_bgWake; });
+			if (m_bgAbort)
+				return;
+			m_bgWake = false;
+		}
+		FlushJournal();
+
+		std::scoped_lock mlock(m_maintenanceMtx);
+		bool checkpointDue = false;
+		{
+			std::scoped_lock jlock(m_journalMtx);
+			checkpointDue = (m_journalBytes > std::max(MinCheckpointJournal, m_checkpointBytes));
+		}
+		if (checkpointDue)
+			WriteCheckpoint();
+		CompactionStep();
+	}
+}
+
+inline void SimpleKVStore::WakeBackgroundThread(void) {
+	{
+		std::scoped_lock lock(m_bgMtx);
+		m_bgWake = true;
+	}
+	m_bgCV.notify_one();
+}
+
 inline void SimpleKVStore::RefreshSizesIfNeeded() {
 	if (m_sizeRefreshStopwatch.SecondsF() > 2.0f) {
-		if (ValuesFile.IsOpen()) {
+		if (m_open) {
 			m_numBytes = 0U;
-			for (auto const & kv : Index) {
-				uint16_t KeySize = kv.first.size();
-				uint64_t BlockSize = 18U + KeySize;
-				uint64_t ValueLength = std::get<1>(kv.second);
-				m_numBytes += BlockSize + ValueLength;
+			for (Shard & shard : m_shards) {
+				std::scoped_lock slock(shard.Mtx);
+				for (auto const & kv : shard.Index) {
+					uint16_t KeySize = kv.first.size();
+					uint64_t BlockSize = 18U + KeySize;
+					m_numBytes += BlockSize + kv.second.Length;
+				}
 			}
-			
-			std::error_code ec1, ec2;
-			uint64_t KeyFileSizeBytes   = (uint64_t) std::filesystem::file_size(StorePath + ".Keys"s, ec1);
-			uint64_t ValueFileSizeBytes = (uint64_t) std::filesystem::file_size(StorePath + ".Values"s, ec2);
-			if (ec1 || ec2)
-				m_numBytesOnDisk = 0U;
-			else
-				m_numBytesOnDisk = KeyFileSizeBytes + ValueFileSizeBytes;
+
+			uint64_t numBytesOnDisk = 0U;
+			{
+				std::shared_lock lock(m_segmentsMtx);
+				for (auto const & kv : m_segments)
+					numBytesOnDisk += kv.second->Size;
+			}
+			{
+				std::scoped_lock jlock(m_journalMtx);
+				numBytesOnDisk += m_journalBytes + m_checkpointBytes;
+			}
+			m_numBytesOnDisk = numBytesOnDisk;
 		}
 		else {
 			m_numBytes = 0U;
@@ -326,5 +1126,325 @@ inline void SimpleKVStore::RefreshSizesIfNeeded() {
 	}
 }
 
+// ****************************************************************************************************************************************
+// ***************************************************   SimpleKVStore File and Record Utilities   ****************************************
+// ****************************************************************************************************************************************
+//Get the IDs of the store files of a given kind (<Store>.<Kind>.<ID>), in ascending order
+inline std::vector<uint32_t> SimpleKVStore::ListStoreFiles(std::string const & Kind) const {
+	std::vector<uint32_t> IDs;
+	std::string prefix = StorePath.filename().string() + "."s + Kind + "."s;
+	std::filesystem::path dir = StorePath.parent_path().empty() ? std::filesystem::path(".") : StorePath.parent_path();
+	std::error_code ec;
+	for (auto const & entry : std::filesystem::directory_iterator(dir, ec)) {
+		std::string name = entry.path().filename().string();
+		if ((name.size() <= prefix.size()) || (name.compare(0U, prefix.size(), prefix) != 0))
+			continue;
+		std::string suffix = name.substr(prefix.size());
+		if ((suffix.size() > 9U) || (! std::all_of(suffix.begin(), suffix.end(), [](char c) { return (c >= '0') && (c <= '9'); })))
+			continue;
+		IDs.push_back((uint32_t) std::stoul(suffix));
+	}
+	std::sort(IDs.begin(), IDs.end());
+	return IDs;
+}
+
+//Write a file so that it either fully replaces any existing file at Path or (on failure or crash) doesn't change it at all
+inline bool SimpleKVStore::WriteFileDurably(std::filesystem::path const & Path, std::vector<uint8_t> const & Buffer) {
+	std::filesystem::path tempPath(Path.string() + ".tmp"s);
+	int FD = OpenFile(tempPath, FileCreate | FileTruncate);
+	if (FD < 0)
+		return false;
+	bool success = WriteAll(FD, Buffer.data(), Buffer.size()) && SyncFile(FD);
+	CloseFile(FD);
+	std::error_code ec;
+	if (success)
+		std::filesystem::rename(tempPath, Path, ec);
+	if ((! success) || ec) {
+		std::filesystem::remove(tempPath, ec);
+		return false;
+	}
+	SyncDirectory();
+	return true;
+}
+
+//fsync the directory holding the store, so file creation, renaming and removal are durable. Windows has no equivalent (NTFS
+//journals directory changes itself), so there this does nothing.
+inline void SimpleKVStore::SyncDirectory(void) const {
+	#if !defined(_WIN32)
+	std::filesystem::path dir = StorePath.parent_path().empty() ? std::filesystem::path(".") : StorePath.parent_path();
+	int FD = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+	if (FD >= 0) {
+		::fsync(FD);
+		::close(FD);
+	}
+	#endif
+}
+
+//CRC-32C (Castagnoli), using the SSE 4.2 instructions when available
+inline uint32_t SimpleKVStore::CRC32C(uint8_t const * Data, size_t Size) {
+	uint32_t crc = 0xFFFFFFFFU;
+	size_t n = 0U;
+	#if defined(__SSE4_2__)
+	uint64_t crc64 = crc;
+	for (; n + 8U <= Size; n += 8U) {
+		uint64_t word;
+		std::memcpy(&word, Data + n, 8U);
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = (uint32_t) crc64;
+	for (; n < Size; n++)
+		crc = _mm_crc32_u8(crc, Data[n]);
+	#else
+	for (; n < Size; n++) {
+		crc ^= Data[n];
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0x82F63B78U & (0U - (crc & 1U)));
+	}
+	#endif
+	return ~crc;
+}
+
+inline void SimpleKVStore::EncodeRecord(std::vector<uint8_t> & Buffer, RecordType Type, std::string const & Key, Location const * Loc, uint64_t Count) {
+	size_t start = Buffer.size();
+	Buffer.resize(start + 8U); //CRC and length - filled in below
+	auto append = [&Buffer](void const * Data, size_t Size) {
+		Buffer.insert(Buffer.end(), (uint8_t const *) Data, (uint8_t const *) Data + Size);
+	};
+	uint8_t type = (uint8_t) Type;
+	append(&type, 1U);
+	if ((Type == RecordType::Put) || (Type == RecordType::Delete)) {
+		uint16_t keyLength = (uint16_t) Key.size();
+		append(&keyLength, 2U);
+		append(Key.data(), keyLength);
+	}
+	if (Type == RecordType::Put) {
+		append(&(Loc->Segment), 4U);
+		append(&(Loc->Offset),  8U);
+		append(&(Loc->Length),  8U);
+	}
+	else if (Type == RecordType::End)
+		append(&Count, 8U);
+
+	uint32_t recordLength = (uint32_t) (Buffer.size() - start - 8U);
+	std::memcpy(&Buffer[start + 4U], &recordLength, 4U);
+	uint32_t crc = CRC32C(&Buffer[start + 4U], Buffer.size() - start - 4U);
+	std::memcpy(&Buffer[start], &crc, 4U);
+}
+
+//Decode records from Buffer, starting at Offset, calling Callback(Type, Key, Location, Count) for each. Returns the offset just past
+//the last good record (so Buffer.size() if every record was good).
+template <typename Func>
+size_t SimpleKVStore::ParseRecords(std::vector<uint8_t> const & Buffer, size_t Offset, Func && Callback) {
+	while (Offset + 9U <= Buffer.size()) {
+		uint32_t crc, recordLength;
+		std::memcpy(&crc,          &Buffer[Offset],      4U);
+		std::memcpy(&recordLength, &Buffer[Offset + 4U], 4U);
+		if ((recordLength == 0U) || (Offset + 8U + recordLength > Buffer.size()) || (CRC32C(&Buffer[Offset + 4U], 4U + recordLength) != crc))
+			break;
+
+		uint8_t const * p   = &Buffer[Offset + 8U];
+		uint8_t const * end = p + recordLength;
+		RecordType type = (RecordType) *p++;
+		std::string key;
+		Location loc;
+		uint64_t count = 0U;
+		bool valid = true;
+		if ((type == RecordType::Put) || (type == RecordType::Delete)) {
+			uint16_t keyLength = 0U;
+			if (end - p >= 2) {
+				std::memcpy(&keyLength, p, 2U);
+				p += 2;
+			}
+			valid = (keyLength > 0U) && (end - p >= (ptrdiff_t) keyLength);
+			if (valid) {
+				key.assign((char const *) p, keyLength);
+				p += keyLength;
+			}
+		}
+		if (valid && (type == RecordType::Put)) {
+			valid = (end - p >= 20);
+			if (valid) {
+				std::memcpy(&loc.Segment, p,       4U);
+				std::memcpy(&loc.Offset,  p + 4U,  8U);
+				std::memcpy(&loc.Length,  p + 12U, 8U);
+			}
+		}
+		else if (valid && (type == RecordType::End)) {
+			valid = (end - p >= 8);
+			if (valid)
+				std::memcpy(&count, p, 8U);
+		}
+		else if ((type != RecordType::Delete) && (type != RecordType::Clear))
+			valid = false;
+		if (! valid)
+			break;
+
+		Callback(type, key, loc, count);
+		Offset += 8U + recordLength;
+	}
+	return Offset;
+}
+
+//Open (and optionally create or truncate) a file for reading and writing. Returns a file descriptor, or -1 on failure. On Windows the
+//file is shared for deletion, so compaction can remove a segment file while a reader still has it open (as on POSIX systems).
+inline int SimpleKVStore::OpenFile(std::filesystem::path const & Path, int Flags) {
+	#if defined(_WIN32)
+	DWORD disposition = OPEN_EXISTING;
+	if ((Flags & FileCreate) && (Flags & FileTruncate))
+		disposition = CREATE_ALWAYS;
+	else if (Flags & FileCreate)
+		disposition = OPEN_ALWAYS;
+	else if (Flags & FileTruncate)
+		disposition = TRUNCATE_EXISTING;
+	HANDLE handle = ::CreateFileW(Path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+	                              nullptr, disposition, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		return -1;
+	int FD = ::_open_osfhandle((intptr_t) handle, (Flags & FileAppend) ? _O_APPEND : 0);
+	if (FD < 0)
+		::CloseHandle(handle);
+	return FD;
+	#else
+	int flags = O_RDWR;
+	if (Flags & FileCreate)   flags |= O_CREAT;
+	if (Flags & FileTruncate) flags |= O_TRUNC;
+	if (Flags & FileAppend)   flags |= O_APPEND;
+	return ::open(Path.c_str(), flags, 0644);
+	#endif
+}
+
+inline void SimpleKVStore::CloseFile(int FD) {
+	if (FD < 0)
+		return;
+	#if defined(_WIN32)
+	::_close(FD);
+	#else
+	::close(FD);
+	#endif
+}
+
+//Make the contents of a file durable (its metadata only as far as needed to read the contents back)
+inline bool SimpleKVStore::SyncFile(int FD) {
+	#if defined(_WIN32)
+	return (::FlushFileBuffers((HANDLE) ::_get_osfhandle(FD)) != 0);
+	#elif defined(__APPLE__)
+	return (::fsync(FD) == 0);
+	#else
+	return (::fdatasync(FD) == 0);
+	#endif
+}
+
+inline bool SimpleKVStore::TruncateFile(int FD, uint64_t Size) {
+	#if defined(_WIN32)
+	return (::_chsize_s(FD, (__int64) Size) == 0);
+	#else
+	return (::ftruncate(FD, (off_t) Size) == 0);
+	#endif
+}
+
+inline bool SimpleKVStore::GetFileSize(int FD, uint64_t & Size) {
+	#if defined(_WIN32)
+	LARGE_INTEGER fileSize;
+	if (! ::GetFileSizeEx((HANDLE) ::_get_osfhandle(FD), &fileSize))
+		return false;
+	Size = (uint64_t) fileSize.QuadPart;
+	#else
+	struct stat fileStat;
+	if (::fstat(FD, &fileStat) != 0)
+		return false;
+	Size = (uint64_t) fileStat.st_size;
+	#endif
+	return true;
+}
+
+//Positioned reads and writes. On Windows these move the file pointer, which doesn't matter since the store never writes at it
+//(see WriteAll()).
+inline bool SimpleKVStore::PReadAll(int FD, uint8_t * Data, uint64_t Size, uint64_t Offset) {
+	#if defined(_WIN32)
+	HANDLE handle = (HANDLE) ::_get_osfhandle(FD);
+	while (Size > 0U) {
+		OVERLAPPED overlapped = {};
+		overlapped.Offset     = (DWORD) (Offset & 0xFFFFFFFFULL);
+		overlapped.OffsetHigh = (DWORD) (Offset >> 32);
+		DWORD result = 0U;
+		if ((! ::ReadFile(handle, Data, (DWORD) std::min<uint64_t>(Size, 1ULL << 30), &result, &overlapped)) || (result == 0U))
+			return false;
+		Data   += result;
+		Size   -= result;
+		Offset += result;
+	}
+	#else
+	while (Size > 0U) {
+		ssize_t result = ::pread(FD, Data, Size, (off_t) Offset);
+		if ((result < 0) && (errno == EINTR))
+			continue;
+		if (result <= 0)
+			return false;
+		Data   += result;
+		Size   -= (uint64_t) result;
+		Offset += (uint64_t) result;
+	}
+	#endif
+	return true;
+}
+
+inline bool SimpleKVStore::PWriteAll(int FD, uint8_t const * Data, uint64_t Size, uint64_t Offset) {
+	#if defined(_WIN32)
+	HANDLE handle = (HANDLE) ::_get_osfhandle(FD);
+	while (Size > 0U) {
+		OVERLAPPED overlapped = {};
+		overlapped.Offset     = (DWORD) (Offset & 0xFFFFFFFFULL);
+		overlapped.OffsetHigh = (DWORD) (Offset >> 32);
+		DWORD result = 0U;
+		if ((! ::WriteFile(handle, Data, (DWORD) std::min<uint64_t>(Size, 1ULL << 30), &result, &overlapped)) || (result == 0U))
+			return false;
+		Data   += result;
+		Size   -= result;
+		Offset += result;
+	}
+	#else
+	while (Size > 0U) {
+		ssize_t result = ::pwrite(FD, Data, Size, (off_t) Offset);
+		if ((result < 0) && (errno == EINTR))
+			continue;
+		if (result <= 0)
+			return false;
+		Data   += result;
+		Size   -= (uint64_t) result;
+		Offset += (uint64_t) result;
+	}
+	#endif
+	return true;
+}
+
+//Sequential write. The store only calls this on files opened for appending or files it writes front to back, so on Windows we
+//always write at the end of the file rather than depending on the file pointer.
+inline bool SimpleKVStore::WriteAll(int FD, uint8_t const * Data, uint64_t Size) {
+	#if defined(_WIN32)
+	HANDLE handle = (HANDLE) ::_get_osfhandle(FD);
+	while (Size > 0U) {
+		OVERLAPPED overlapped = {};
+		overlapped.Offset     = 0xFFFFFFFFU; //Both halves set to this means "the end of the file"
+		overlapped.OffsetHigh = 0xFFFFFFFFU;
+		DWORD result = 0U;
+		if ((! ::WriteFile(handle, Data, (DWORD) std::min<uint64_t>(Size, 1ULL << 30), &result, &overlapped)) || (result == 0U))
+			return false;
+		Data += result;
+		Size -= result;
+	}
+	#else
+	while (Size > 0U) {
+		ssize_t result = ::write(FD, Data, Size);
+		if ((result < 0) && (errno == EINTR))
+			continue;
+		if (result <= 0)
+			return false;
+		Data += result;
+		Size -= (uint64_t) result;
+	}
+	#endif
+	return true;
+}
+
 
 
@@ -7,6 +7,16 @@
 #include <iostream>
 #include <chrono>
 #include <limits>
+#include <random>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <cstdio>
+#include <algorithm>
 
 //External Includes
 #include "../../handycpp/Handy.hpp"
@@ -22,11 +32,22 @@
 //Project Includes
 #include "TestBenches.hpp"
 #include "Polygon.hpp"
+#include "CompiledPolygon.hpp"
 #include "SurveyRegionManager.hpp"
 #include "Maps/MapUtils.hpp"
+#include "Maps/LocalTangentPlane.hpp"
+#include "Maps/TileRequestQueue.hpp"
+#include "Maps/TileSeeder.hpp"
+#include "Maps/CacheFile.hpp"
+#include "SimpleKVStore.hpp"
+#include "WorkStealingPool.hpp"
 #include "Modules/Guidance/Guidance.hpp"
+#include "Modules/Guidance/MissionPlanCache.hpp"
 #include "Modules/DJI-Drone-Interface/DroneManager.hpp"
 #include "Modules/DJI-Drone-Interface/DroneComms.hpp"
+#include "Modules/Shadow-Detection/ShadowMapIO.hpp"
+#include "Modules/Shadow-Detection/StabilizationContext.hpp"
+#include "Modules/Shadow-Propagation/ContourFlow.hpp"
 #include <torch/script.h>
 
 #define PI 3.14159265358979
@@ -46,6 +67,8 @@ static bool TestBench20(std::string const & Arg);  static bool TestBench21(std::
 static bool TestBench22(std::string const & Arg);  static bool TestBench23(std::string const & Arg);
 static bool TestBench24(std::string const & Arg);  static bool TestBench25(std::string const & Arg);
 static bool TestBench26(std::string const & Arg);  static bool TestBench27(std::string const & Arg);
+static bool TestBench28(std::string const & Arg);  static bool TestBench29(std::string const & Arg);
+static bool TestBench30(std::string const & Arg);
 
 // ************************************************************************************************************************************************
 // *********************************************************   Public Function Definitions   ******************************************************
@@ -89,6 +112,9 @@ namespace TestBenches {
 			case 25: result = TestBench25(TestBenchArg); break;
 			case 26: result = TestBench26(TestBenchArg); break;
 			case 27: result = TestBench27(TestBenchArg); break;
+			case 28: result = TestBench28(TestBenchArg); break;
+			case 29: result = TestBench29(TestBenchArg); break;
+			case 30: result = TestBench30(TestBenchArg); break;
 			default: break;
 		}
 		if (result)
@@ -102,6 +128,21 @@ namespace TestBenches {
 // ********************************************************   Internal Function Definitions   *****************************************************
 // ************************************************************************************************************************************************
 
+//Closed, wiggly outline with integer vertices (like a traced contour) and a handful of self-intersections, for scaling benchmarks.
+//Consecutive vertices are distinct, and the outline has close to NumVertices vertices.
+static std::Evector<Eigen::Vector2d> TracedContourLikeOutline(int NumVertices) {
+	std::Evector<Eigen::Vector2d> outline;
+	for (int n = 0; n < NumVertices; n++) {
+		double theta  = 2.0*PI*double(n)/double(NumVertices);
+		double radius = 0.1*double(NumVertices) + 3.0*std::sin(13.0*theta) + double((n*7919) % 5);
+		outline.emplace_back(std::round(radius*std::cos(theta)), std::round(radius*std::sin(theta)));
+	}
+	outline.erase(std::unique(outline.begin(), outline.end()), outline.end()); //Traced contours don't repeat vertices
+	for (size_t n = 1U; n < 6U; n++)
+		std::swap(outline[n*outline.size()/6U], outline[n*outline.size()/6U + 1U]);
+	return outline;
+}
+
 static bool TestBench0(std::string const & Arg) {
 	std::Evector<LineSegment> InputSegments;
 	InputSegments.emplace_back(Eigen::Vector2d(0.0, 0.0), Eigen::Vector2d(1.0, 0.0));
@@ -143,7 +184,34 @@ static bool TestBench0(std::string const & Arg) {
 		std::cerr << item << "\r\n";
 	std::cerr << "\r\n";
 	
-	return true;
+	//Scaling benchmark: sanitize the edges of a traced-contour-like outline using both the sweep and the brute-force all-pairs overlap
+	//search. The outputs must be identical.
+	std::cerr << "Scaling benchmark (sweep vs. brute-force overlap search):\r\n";
+	bool identical = true;
+	for (int numSegments : {250, 500, 1000, 2000, 4000}) {
+		std::Evector<Eigen::Vector2d> outline = TracedContourLikeOutline(numSegments);
+		InputSegments.clear();
+		for (size_t n = 0U; n < outline.size(); n++)
+			InputSegments.emplace_back(outline[n], outline[(n + 1U) % outline.size()]);
+		
+		std::chrono::time_point<std::chrono::steady_clock> T0 = std::chrono::steady_clock::now();
+		std::Evector<LineSegment> sweepSegments = SanitizeCollectionOfSegments(InputSegments);
+		std::chrono::time_point<std::chrono::steady_clock> T1 = std::chrono::steady_clock::now();
+		std::Evector<LineSegment> bruteForceSegments = SanitizeCollectionOfSegments(InputSegments, true);
+		std::chrono::time_point<std::chrono::steady_clock> T2 = std::chrono::steady_clock::now();
+		
+		bool same = (sweepSegments.size() == bruteForceSegments.size());
+		for (size_t n = 0U; same && (n < sweepSegments.size()); n++) {
+			same = (sweepSegments[n].m_endpoint1 == bruteForceSegments[n].m_endpoint1) &&
+			       (sweepSegments[n].m_endpoint2 == bruteForceSegments[n].m_endpoint2);
+		}
+		identical = identical && same;
+		std::cerr << numSegments << " segments -> " << sweepSegments.size() << " segments. Sweep: " << 1000.0*SecondsElapsed(T0, T1) << " ms, ";
+		std::cerr << "Brute force: " << 1000.0*SecondsElapsed(T1, T2) << " ms. Outputs " << (same ? "identical" : "DIFFER") << ".\r\n";
+	}
+	std::cerr << "\r\n";
+	
+	return identical;
 }
 
 static bool TestBench1(std::string const & Arg) {
@@ -350,6 +418,22 @@ static bool TestBench1(std::string const & Arg) {
 
 	poly.SetBoundary(vertices);
 	
+	//Scaling benchmark: sanitize traced-contour-like outlines of increasing size (integer vertices, a handful of self-intersections).
+	//With spatial indexing for segment overlaps and node merging, run time should grow roughly linearly with the number of vertices.
+	std::cerr << "Scaling benchmark:\r\n";
+	for (int numVertices : {500, 1000, 2000, 4000, 8000, 16000}) {
+		vertices = TracedContourLikeOutline(numVertices);
+		
+		std::chrono::time_point<std::chrono::steady_clock> T0 = std::chrono::steady_clock::now();
+		poly.SetBoundary(vertices);
+		std::chrono::time_point<std::chrono::steady_clock> T1 = std::chrono::steady_clock::now();
+		std::cerr << numVertices << " vertices -> " << poly.NumVertices() << " vertices: " << 1000.0*SecondsElapsed(T0, T1) << " ms (";
+		std::cerr << 1.0e6*SecondsElapsed(T0, T1)/double(numVertices) << " us per vertex)\r\n";
+		if (poly.NumVertices() < 3U)
+			return false;
+	}
+	std::cerr << "\r\n";
+	
 	return true;
 }
 
@@ -654,49 +738,342 @@ static bool TestBench7(std::string const & Arg)  {
 }
 
 static bool TestBench8(std::string const & Arg)  {
-	// Test GetCoverage()
-	return true;
+	//Mission planning benchmark: partition a county-scale survey region and plan a mission for every sub-region, first one sub-region
+	//at a time and then with sub-regions spread over the work-stealing pool (as in GuidanceEngine::MissionPrepWork()). The two
+	//sets of missions must be identical. The mission plan cache is disabled for these timings - it is tested separately below.
+	Guidance::MissionParameters missionParams;
+	Eigen::Vector2d center_LL = PI/180.0*Eigen::Vector2d(44.2380, -95.2990); //Near Lamberton, MN
+	double metersPerRadLat = 6371000.0;
+	double metersPerRadLon = 6371000.0*std::cos(center_LL(0));
+	std::Evector<Eigen::Vector2d> vertices;
+	int numVertices = 720;
+	for (int n = 0; n < numVertices; n++) {
+		double theta = 2.0*PI*double(n)/double(numVertices);
+		double r = 1.0 + 0.08*std::sin(7.0*theta) + 0.04*std::cos(19.0*theta);
+		double east  = 6000.0*r*std::cos(theta); //Meters
+		double north = 4000.0*r*std::sin(theta); //Meters
+		vertices.push_back(LatLonToNM(center_LL + Eigen::Vector2d(north/metersPerRadLat, east/metersPerRadLon)));
+	}
+	PolygonCollection region;
+	region.m_components.emplace_back();
+	region.m_components.back().m_boundary.SetBoundary(vertices);
+
+	std::Evector<PolygonCollection> partition;
+	Guidance::PartitionSurveyRegion_IteratedCuts(region, partition, missionParams);
+	std::cerr << "Partitioned region into " << partition.size() << " sub-regions.\r\n";
+
+	bool cacheWasEnabled = Guidance::MissionPlanCache::Instance().IsEnabled();
+	Guidance::MissionPlanCache::Instance().SetEnabled(false);
+
+	std::vector<DroneInterface::WaypointMission> missionsSerial(partition.size());
+	std::chrono::time_point<std::chrono::steady_clock> T0 = std::chrono::steady_clock::now();
+	for (size_t n = 0U; n < partition.size(); n++)
+		Guidance::PlanMission(partition[n], missionsSerial[n], missionParams, nullptr);
+	std::chrono::time_point<std::chrono::steady_clock> T1 = std::chrono::steady_clock::now();
+
+	std::vector<DroneInterface::WaypointMission> missionsParallel(partition.size());
+	std::chrono::time_point<std::chrono::steady_clock> T2 = std::chrono::steady_clock::now();
+	WorkStealingPool::Instance().ParallelFor(partition.size(), [&](size_t n) {
+		Guidance::PlanMission(partition[n], missionsParallel[n], missionParams, nullptr);
+	});
+	std::chrono::time_point<std::chrono::steady_clock> T3 = std::chrono::steady_clock::now();
+
+	auto sameWaypoints = [](DroneInterface::WaypointMission const & A, DroneInterface::WaypointMission const & B) {
+		if (A.Waypoints.size() != B.Waypoints.size())
+			return false;
+		for (size_t m = 0U; m < A.Waypoints.size(); m++) {
+			if ((A.Waypoints[m].Latitude != B.Waypoints[m].Latitude) || (A.Waypoints[m].Longitude != B.Waypoints[m].Longitude) ||
+			    (A.Waypoints[m].RelAltitude != B.Waypoints[m].RelAltitude) || (A.Waypoints[m].Speed != B.Waypoints[m].Speed))
+				return false;
+		}
+		return true;
+	};
+	bool identical = true;
+	for (size_t n = 0U; n < partition.size(); n++)
+		identical = identical && sameWaypoints(missionsSerial[n], missionsParallel[n]);
+
+	std::cerr << "\r\nPlanned " << partition.size() << " missions using " << WorkStealingPool::Instance().NumWorkers() + 1U << " threads.\r\n";
+	std::cerr << "One sub-region at a time: " << SecondsElapsed(T0, T1)*1000.0 << " ms\r\n";
+	std::cerr << "Sub-regions in parallel:  " << SecondsElapsed(T2, T3)*1000.0 << " ms\r\n";
+	std::cerr << "Missions identical: " << (identical ? "Yes" : "No") << "\r\n";
+
+	//Plan everything twice more with the cache enabled: the first pass fills the cache (unless this region is already in it from an earlier
+	//run) and the second should be served entirely from it. Cached missions must match freshly planned ones, both without a start position and
+	//with one (which only changes which cached candidate is chosen).
+	Guidance::MissionPlanCache::Instance().SetEnabled(true);
+	std::vector<DroneInterface::WaypointMission> missionsFill(partition.size()), missionsCached(partition.size());
+	std::chrono::time_point<std::chrono::steady_clock> T5 = std::chrono::steady_clock::now();
+	WorkStealingPool::Instance().ParallelFor(partition.size(), [&](size_t n) {
+		Guidance::PlanMission(partition[n], missionsFill[n], missionParams, nullptr);
+	});
+	std::chrono::time_point<std::chrono::steady_clock> T6 = std::chrono::steady_clock::now();
+	WorkStealingPool::Instance().ParallelFor(partition.size(), [&](size_t n) {
+		Guidance::PlanMission(partition[n], missionsCached[n], missionParams, nullptr);
+	});
+	std::chrono::time_point<std::chrono::steady_clock> T7 = std::chrono::steady_clock::now();
+
+	DroneInterface::Waypoint startPos;
+	startPos.Latitude  = center_LL(0) + 4500.0/metersPerRadLat;
+	startPos.Longitude = center_LL(1) - 6500.0/metersPerRadLon;
+	std::vector<DroneInterface::WaypointMission> missionsFromStartCached(partition.size()), missionsFromStartUncached(partition.size());
+	WorkStealingPool::Instance().ParallelFor(partition.size(), [&](size_t n) {
+		Guidance::PlanMission(partition[n], missionsFromStartCached[n], missionParams, &startPos);
+	});
+	Guidance::MissionPlanCache::Instance().SetEnabled(false);
+	WorkStealingPool::Instance().ParallelFor(partition.size(), [&](size_t n) {
+		Guidance::PlanMission(partition[n], missionsFromStartUncached[n], missionParams, &startPos);
+	});
+	Guidance::MissionPlanCache::Instance().SetEnabled(cacheWasEnabled);
+
+	bool cachedIdentical = true;
+	for (size_t n = 0U; n < partition.size(); n++) {
+		cachedIdentical = cachedIdentical && sameWaypoints(missionsParallel[n], missionsFill[n]) && sameWaypoints(missionsParallel[n], missionsCached[n]);
+		cachedIdentical = cachedIdentical && sameWaypoints(missionsFromStartUncached[n], missionsFromStartCached[n]);
+	}
+	std::cerr << "\r\nMission plan cache (" << Guidance::MissionPlanCache::Instance().NumPlans() << " plans):\r\n";
+	std::cerr << "Fill pass:    " << SecondsElapsed(T5, T6)*1000.0 << " ms\r\n";
+	std::cerr << "Cached pass:  " << SecondsElapsed(T6, T7)*1000.0 << " ms\r\n";
+	std::cerr << "Cached missions identical (with and without start position): " << (cachedIdentical ? "Yes" : "No") << "\r\n";
+	identical = identical && cachedIdentical;
+
+	//Check every mission against a synthetic TA function (a shadow front sweeping in from the west, with the east edge clear), using both
+	//the compiled, exact check and the legacy sampled check. The exact margin should never be less conservative than the sampled one.
+	ShadowPropagation::TimeAvailableFunction TA;
+	int TARows = 512, TACols = 512;
+	double halfHeight_rad = 5000.0/metersPerRadLat;
+	double halfWidth_rad  = 7000.0/metersPerRadLon;
+	TA.UL_LL = center_LL + Eigen::Vector2d( halfHeight_rad, -halfWidth_rad);
+	TA.UR_LL = center_LL + Eigen::Vector2d( halfHeight_rad,  halfWidth_rad);
+	TA.LL_LL = center_LL + Eigen::Vector2d(-halfHeight_rad, -halfWidth_rad);
+	TA.LR_LL = center_LL + Eigen::Vector2d(-halfHeight_rad,  halfWidth_rad);
+	TA.TimeAvailable = cv::Mat(TARows, TACols, CV_16UC1);
+	for (int row = 0; row < TARows; row++) {
+		for (int col = 0; col < TACols; col++)
+			TA.TimeAvailable.at<uint16_t>(row, col) = (col > 9*TACols/10) ? std::numeric_limits<uint16_t>::max() : uint16_t(60 + 3*col + (row % 7));
+	}
+	TA.Timestamp = std::chrono::steady_clock::now();
+
+	std::chrono::time_point<std::chrono::steady_clock> T4 = std::chrono::steady_clock::now();
+	std::vector<Guidance::CompiledMission> compiledMissions(missionsParallel.begin(), missionsParallel.end());
+	std::chrono::time_point<std::chrono::steady_clock> T5 = std::chrono::steady_clock::now();
+	std::vector<std::pair<bool, double>> resultsExact(missionsParallel.size());
+	for (size_t n = 0U; n < missionsParallel.size(); n++)
+		resultsExact[n].first = Guidance::IsPredictedToFinishWithoutShadows(TA, compiledMissions[n], 0.0, TA.Timestamp, resultsExact[n].second);
+	std::chrono::time_point<std::chrono::steady_clock> T6 = std::chrono::steady_clock::now();
+	std::vector<std::pair<bool, double>> resultsSampled(missionsParallel.size());
+	for (size_t n = 0U; n < missionsParallel.size(); n++)
+		resultsSampled[n].first = Guidance::IsPredictedToFinishWithoutShadows_Sampled(TA, missionsParallel[n], 0.0, TA.Timestamp, resultsSampled[n].second);
+	std::chrono::time_point<std::chrono::steady_clock> T7 = std::chrono::steady_clock::now();
+	std::vector<std::pair<bool, double>> resultsSampledENU(missionsParallel.size());
+	for (size_t n = 0U; n < missionsParallel.size(); n++)
+		resultsSampledENU[n].first = Guidance::IsPredictedToFinishWithoutShadows_SampledENU(TA, missionsParallel[n], 0.0, TA.Timestamp, resultsSampledENU[n].second);
+	std::chrono::time_point<std::chrono::steady_clock> T7b = std::chrono::steady_clock::now();
+
+	int numViableExact = 0, numViableSampled = 0, numInconsistent = 0;
+	for (size_t n = 0U; n < missionsParallel.size(); n++) {
+		numViableExact   += resultsExact[n].first   ? 1 : 0;
+		numViableSampled += resultsSampled[n].first ? 1 : 0;
+		if (resultsExact[n].first && (! resultsSampled[n].first))
+			numInconsistent++;
+		else if (resultsExact[n].first && (! std::isnan(resultsExact[n].second)) && (resultsExact[n].second > resultsSampled[n].second))
+			numInconsistent++;
+	}
+
+	//The ENU sampled check should reproduce the geodetic one - sample points only move by the LTP conversion error (mm), so margins can only
+	//differ where a sample lands right on a TA pixel boundary.
+	int numViableSampledENU = 0, numSampledMismatch = 0;
+	double maxSampledMarginDiff = 0.0;
+	for (size_t n = 0U; n < missionsParallel.size(); n++) {
+		numViableSampledENU += resultsSampledENU[n].first ? 1 : 0;
+		if (resultsSampledENU[n].first != resultsSampled[n].first)
+			numSampledMismatch++;
+		else if (std::isnan(resultsSampledENU[n].second) != std::isnan(resultsSampled[n].second))
+			numSampledMismatch++;
+		else if (! std::isnan(resultsSampled[n].second))
+			maxSampledMarginDiff = std::max(maxSampledMarginDiff, std::fabs(resultsSampledENU[n].second - resultsSampled[n].second));
+	}
+	std::cerr << "\r\nShadow check on " << missionsParallel.size() << " missions:\r\n";
+	std::cerr << "Compile missions:         " << SecondsElapsed(T4, T5)*1000.0 << " ms\r\n";
+	std::cerr << "Exact (compiled) check:   " << SecondsElapsed(T5, T6)*1000.0 << " ms (" << numViableExact   << " viable)\r\n";
+	std::cerr << "Sampled (legacy) check:   " << SecondsElapsed(T6, T7)*1000.0 << " ms (" << numViableSampled << " viable)\r\n";
+	std::cerr << "Sampled (ENU) check:      " << SecondsElapsed(T7, T7b)*1000.0 << " ms (" << numViableSampledENU << " viable)\r\n";
+	std::cerr << "Exact check less conservative than sampled check: " << numInconsistent << " missions\r\n";
+	std::cerr << "ENU sampled check disagrees with geodetic sampled check: " << numSampledMismatch << " missions (max margin difference ";
+	std::cerr << maxSampledMarginDiff << " s)\r\n";
+
+	//Select a sub-region for a drone starting at the west edge of the region, with and without the TA min-mip pyramid. The pyramid version
+	//must pick a mission that passes the full check.
+	std::unordered_set<int> availableMissionIndices;
+	for (int n = 0; n < (int) missionsParallel.size(); n++) {
+		if (! missionsParallel[n].Waypoints.empty())
+			availableMissionIndices.insert(n);
+	}
+	DroneInterface::Waypoint startPos;
+	startPos.Latitude    = center_LL(0);
+	startPos.Longitude   = center_LL(1) - 6500.0/metersPerRadLon;
+	startPos.RelAltitude = 0.0;
+	ShadowPropagation::TimeAvailableFunction TAWithPyramid = TA;
+	TAWithPyramid.BuildPyramid();
+	std::chrono::time_point<std::chrono::steady_clock> TC = std::chrono::steady_clock::now();
+	std::Evector<CompiledPolygonCollection> compiledPartition(partition.size()); //Done once at mission prep in GuidanceEngine
+	WorkStealingPool::Instance().ParallelFor(partition.size(), [&](size_t n) { compiledPartition[n].Compile(partition[n]); });
+	std::chrono::time_point<std::chrono::steady_clock> T8 = std::chrono::steady_clock::now();
+	int selectionNoPyramid = Guidance::SelectSubRegion(TA, compiledPartition, missionsParallel, compiledMissions, availableMissionIndices, startPos, missionParams);
+	std::chrono::time_point<std::chrono::steady_clock> T9 = std::chrono::steady_clock::now();
+	int selectionPyramid = Guidance::SelectSubRegion(TAWithPyramid, compiledPartition, missionsParallel, compiledMissions, availableMissionIndices, startPos, missionParams);
+	std::chrono::time_point<std::chrono::steady_clock> T10 = std::chrono::steady_clock::now();
+	bool selectionOK = true;
+	if (selectionPyramid >= 0) {
+		double margin;
+		double timeToReachRegion = Guidance::EstimateMissionTime(startPos, missionsParallel[selectionPyramid].Waypoints[0], missionParams.TargetSpeed);
+		selectionOK = Guidance::IsPredictedToFinishWithoutShadows(TA, compiledMissions[selectionPyramid], 0.0,
+		                                                           AdvanceTimepoint(std::chrono::steady_clock::now(), timeToReachRegion), margin);
+	}
+	std::cerr << "\r\nCompile sub-regions:                  " << SecondsElapsed(TC, T8)*1000.0 << " ms\r\n";
+	std::cerr << "SelectSubRegion() without TA pyramid: " << SecondsElapsed(T8, T9)*1000.0 << " ms (selected " << selectionNoPyramid << ")\r\n";
+	std::cerr << "SelectSubRegion() with TA pyramid:    " << SecondsElapsed(T9, T10)*1000.0 << " ms (selected " << selectionPyramid << ")\r\n";
+	std::cerr << "Selection passes full check: " << (selectionOK ? "Yes" : "No") << "\r\n";
+
+	return identical && (numInconsistent == 0) && (numSampledMismatch == 0) && selectionOK;
 }
 
 static bool TestBench9(std::string const & Arg)  { 
-	// Test SelectSubregionSequences()
+	//Test SelectSubregionSequences(): plan sequences for 4 drones on a partitioned county-scale region under a synthetic TA function (a shadow
+	//front sweeping in from the west) with a few time budgets. Every mission in a returned sequence must pass the full shadow check when flown
+	//in order, no mission may be used twice, and the search must never end up worse than the greedy solution it starts from. Finally, check
+	//that the background sequencer can be cancelled promptly.
+	Guidance::MissionParameters missionParams;
+	Eigen::Vector2d center_LL = PI/180.0*Eigen::Vector2d(44.2380, -95.2990); //Near Lamberton, MN
+	double metersPerRadLat = 6371000.0;
+	double metersPerRadLon = 6371000.0*std::cos(center_LL(0));
+	std::Evector<Eigen::Vector2d> vertices;
+	for (int n = 0; n < 360; n++) {
+		double theta = 2.0*PI*double(n)/360.0;
+		double east  = 4000.0*std::cos(theta); //Meters
+		double north = 2500.0*std::sin(theta); //Meters
+		vertices.push_back(LatLonToNM(center_LL + Eigen::Vector2d(north/metersPerRadLat, east/metersPerRadLon)));
+	}
+	PolygonCollection region;
+	region.m_components.emplace_back();
+	region.m_components.back().m_boundary.SetBoundary(vertices);
+
+	std::Evector<PolygonCollection> partition;
+	Guidance::PartitionSurveyRegion_IteratedCuts(region, partition, missionParams);
+	std::vector<DroneInterface::WaypointMission> missions(partition.size());
+	WorkStealingPool::Instance().ParallelFor(partition.size(), [&](size_t n) {
+		Guidance::PlanMission(partition[n], missions[n], missionParams, nullptr);
+	});
+	std::vector<Guidance::CompiledMission> compiledMissions(missions.begin(), missions.end());
+	std::set<int> missionIndicesToAssign;
+	for (int n = 0; n < (int) missions.size(); n++)
+		missionIndicesToAssign.insert(n);
+
 	ShadowPropagation::TimeAvailableFunction TA;
-	std::vector<DroneInterface::WaypointMission> SubregionMissions;
-	std::vector<std::vector<int>> Sequences;
-	std::vector<DroneInterface::Waypoint> DroneStartPositions;
-	DroneInterface::WaypointMission wm;
-	DroneInterface::Waypoint w;
-	w.Latitude = 34;
-	w.Longitude = 40;
-	w.RelAltitude = 10;
-	wm.Waypoints.push_back(w);
-
-	for (int d = 1; d < 6; d++) {
-		for (int m = 3; m < 11; m++) {
-			SubregionMissions.clear();
-			DroneStartPositions.clear();
-			for (int i = 0; i < m; i++) {
-				SubregionMissions.push_back(wm);
-			}
-			for (int i = 0; i < d; i++) {
-				DroneStartPositions.push_back(w);
-			}
-			std::set<int> MissionIndicesToAssign;
-			for (int i = 0; i < m; i++) {
-				MissionIndicesToAssign.insert(i);    
-			}
+	int TARows = 256, TACols = 256;
+	double halfHeight_rad = 3000.0/metersPerRadLat;
+	double halfWidth_rad  = 5000.0/metersPerRadLon;
+	TA.UL_LL = center_LL + Eigen::Vector2d( halfHeight_rad, -halfWidth_rad);
+	TA.UR_LL = center_LL + Eigen::Vector2d( halfHeight_rad,  halfWidth_rad);
+	TA.LL_LL = center_LL + Eigen::Vector2d(-halfHeight_rad, -halfWidth_rad);
+	TA.LR_LL = center_LL + Eigen::Vector2d(-halfHeight_rad,  halfWidth_rad);
+	TA.TimeAvailable = cv::Mat(TARows, TACols, CV_16UC1);
+	for (int row = 0; row < TARows; row++) {
+		for (int col = 0; col < TACols; col++)
+			TA.TimeAvailable.at<uint16_t>(row, col) = (col > 3*TACols/4) ? std::numeric_limits<uint16_t>::max() : uint16_t(300 + 12*col);
+	}
+	TA.Timestamp = std::chrono::steady_clock::now();
+
+	//Drones start spread along the south edge of the region, taking off 15 s apart
+	std::vector<DroneInterface::Waypoint> droneStartPositions;
+	std::vector<double> droneStartDelays;
+	for (int k = 0; k < 4; k++) {
+		DroneInterface::Waypoint startPos;
+		startPos.Latitude    = center_LL(0) - 2700.0/metersPerRadLat;
+		startPos.Longitude   = center_LL(1) + (-3000.0 + 2000.0*double(k))/metersPerRadLon;
+		startPos.RelAltitude = 0.0;
+		droneStartPositions.push_back(startPos);
+		droneStartDelays.push_back(15.0*double(k));
+	}
 
-			Guidance::MissionParameters ImagingReqs;
-			ImagingReqs.TargetSpeed = 10;
-			std::chrono::time_point<std::chrono::steady_clock> T0 = std::chrono::steady_clock::now();
-			SelectSubregionSequences(TA, SubregionMissions, DroneStartPositions, MissionIndicesToAssign, Sequences, ImagingReqs);
-			std::chrono::time_point<std::chrono::steady_clock> T1 = std::chrono::steady_clock::now();
-			double processingTime_A = SecondsElapsed(T0, T1);
-			std::cerr << "Sequencing: " << m << ", " << d << ", " << processingTime_A*1000.0 << " ms\r\n";
+	bool allOK = true;
+	std::cerr << "Sequencing " << missions.size() << " sub-region missions for " << droneStartPositions.size() << " drones.\r\n";
+	for (double timeBudget : {0.0, 0.25, 1.0, 4.0}) {
+		std::vector<std::vector<int>> sequences;
+		Guidance::SequencingOptions options;
+		options.TimeBudget = timeBudget;
+		Guidance::SequencingStats stats = Guidance::SelectSubregionSequences(TA, missions, compiledMissions, droneStartPositions, droneStartDelays,
+		                                                                     missionIndicesToAssign, sequences, missionParams, options);
+
+		//Fly each sequence in simulation and check every mission at the time the drone would start it
+		int numUsed = 0, numNotViable = 0;
+		std::vector<bool> used(missions.size(), false);
+		bool duplicates = false;
+		for (int k = 0; k < (int) sequences.size(); k++) {
+			double t = droneStartDelays[k];
+			DroneInterface::Waypoint position = droneStartPositions[k];
+			for (int missionIndex : sequences[k]) {
+				duplicates = duplicates || used[missionIndex];
+				used[missionIndex] = true;
+				numUsed++;
+				t += Guidance::EstimateMissionTime(position, missions[missionIndex].Waypoints.front(), missionParams.TargetSpeed);
+				double margin;
+				if (! Guidance::IsPredictedToFinishWithoutShadows(TA, compiledMissions[missionIndex], 0.0, AdvanceTimepoint(TA.Timestamp, t), margin))
+					numNotViable += (margin < -0.01) ? 1 : 0; //Allow for the 1 ms resolution of AdvanceTimepoint()
+				t += Guidance::EstimateMissionTime(missions[missionIndex], missionParams.TargetSpeed);
+				position = missions[missionIndex].Waypoints.back();
+			}
 		}
+		bool OK = (! duplicates) && (numNotViable == 0) && (stats.FinalCost <= stats.InitialCost) &&
+		          (numUsed + stats.NumUnassigned == (int) missions.size()) && (stats.SolveTime <= timeBudget + 0.1);
+		if (timeBudget == 0.0)
+			OK = OK && stats.StoppedEarly && (numUsed == 0); //The budget covers setup too - with none we get nothing
+		allOK = allOK && OK;
+		std::cerr << "\r\nTime budget " << timeBudget << " s: " << stats.NumIterations << " iterations in " << stats.SolveTime*1000.0 << " ms\r\n";
+		std::cerr << "Cost: " << stats.InitialCost << " (greedy) -> " << stats.FinalCost << "\r\n";
+		std::cerr << "Makespan: " << stats.Makespan << " s, Total transit time: " << stats.TotalTransitTime << " s, Unassigned missions: " << stats.NumUnassigned << "\r\n";
+		std::cerr << "Missions not viable when reached: " << numNotViable << (duplicates ? " (duplicate missions!)" : "") << (OK ? "" : " - FAIL") << "\r\n";
 	}
 
-	return true;
+	//A solve that is already cancelled should stop during setup, before the O(M^2) travel-time table
+	{
+		CancellationToken cancel;
+		cancel.Cancel();
+		std::vector<std::vector<int>> sequences;
+		Guidance::SequencingOptions options;
+		options.TimeBudget = 30.0;
+		options.Cancel     = &cancel;
+		Guidance::SequencingStats stats = Guidance::SelectSubregionSequences(TA, missions, compiledMissions, droneStartPositions, droneStartDelays,
+		                                                                     missionIndicesToAssign, sequences, missionParams, options);
+		bool OK = stats.Cancelled && stats.StoppedEarly && (stats.SolveTime < 0.01);
+		allOK = allOK && OK;
+		std::cerr << "\r\nPre-cancelled solve returned in " << stats.SolveTime*1000.0 << " ms" << (OK ? "" : " - FAIL") << "\r\n";
+	}
+
+	//Start a long solve in the background, make sure we get a solution right away, then cancel it
+	Guidance::SubregionSequencer sequencer;
+	ShadowPropagation::TimeAvailableHandle TAHandle = std::make_shared<ShadowPropagation::TimeAvailableFunction>(TA);
+	sequencer.Start(TAHandle, missions, compiledMissions, droneStartPositions, droneStartDelays, missionIndicesToAssign, missionParams, 30.0);
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	std::vector<std::vector<int>> bestSoFar;
+	uint64_t solutionID = 0U;
+	bool haveSolution = sequencer.GetBestSoFar(bestSoFar, solutionID);
+
+	//Restarting while a solve is in progress must not wait for it (the guidance engine restarts it while holding its lock)
+	std::chrono::time_point<std::chrono::steady_clock> T0 = std::chrono::steady_clock::now();
+	sequencer.Start(TAHandle, missions, compiledMissions, droneStartPositions, droneStartDelays, missionIndicesToAssign, missionParams, 30.0);
+	double restartTime = SecondsElapsed(T0);
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	bool haveRestartSolution = sequencer.GetBestSoFar(bestSoFar, solutionID);
+
+	T0 = std::chrono::steady_clock::now();
+	sequencer.Stop();
+	double stopTime = SecondsElapsed(T0);
+	std::cerr << "\r\nBackground sequencer: " << (haveSolution ? "solution available after 200 ms" : "NO solution after 200 ms") << ", ";
+	std::cerr << "restarted in " << restartTime*1000.0 << " ms (" << (haveRestartSolution ? "solution" : "NO solution") << " after 200 ms), ";
+	std::cerr << "cancelled in " << stopTime*1000.0 << " ms\r\n";
+	allOK = allOK && haveSolution && haveRestartSolution && (restartTime < 0.05) && (stopTime < 0.1) && (! sequencer.IsRunning());
+
+	return allOK;
 }
 
 static bool TestBench10(std::string const & Arg) {
@@ -740,7 +1117,115 @@ static bool TestBench10(std::string const & Arg) {
 	for (auto const & piece : piecesHigh)
 		std::cerr << piece << "\r\n\r\n";
 
-	return true;
+	//Compare the rotating calipers and the legacy angle sweep for finding the shortest and longest axes (used to orient cuts and hatch
+	//lines). The calipers result is exact, so its width can't be more than the sweep's and its diameter can't be less.
+	auto projectionLength = [](SimplePolygon const & Poly, Eigen::Vector2d const & V) {
+		double minDot = std::numeric_limits<double>::infinity();
+		double maxDot = -std::numeric_limits<double>::infinity();
+		for (Eigen::Vector2d const & vert : Poly.GetVertices()) {
+			minDot = std::min(minDot, vert.dot(V));
+			maxDot = std::max(maxDot, vert.dot(V));
+		}
+		return maxDot - minDot;
+	};
+	std::cerr << "Shortest/longest axis: rotating calipers vs. angle sweep:\r\n";
+	bool consistent = true;
+	for (int numVertices : {8, 64, 512, 4096}) {
+		std::Evector<Eigen::Vector2d> ellipseVertices;
+		for (int n = 0; n < numVertices; n++) {
+			double theta = 2.0*PI*double(n)/double(numVertices);
+			double radius = 1.0 + 0.1*std::sin(7.0*theta);
+			Eigen::Vector2d P(2.0*radius*std::cos(theta), radius*std::sin(theta));
+			ellipseVertices.emplace_back(std::cos(0.3)*P(0) - std::sin(0.3)*P(1), std::sin(0.3)*P(0) + std::cos(0.3)*P(1));
+		}
+		SimplePolygon poly(ellipseVertices);
+		
+		std::chrono::time_point<std::chrono::steady_clock> T0 = std::chrono::steady_clock::now();
+		Eigen::Vector2d VMinorCalipers = poly.FindShortestAxis(AxisSearchMethod::RotatingCalipers);
+		Eigen::Vector2d VMajorCalipers = poly.FindLongestAxis(AxisSearchMethod::RotatingCalipers);
+		std::chrono::time_point<std::chrono::steady_clock> T1 = std::chrono::steady_clock::now();
+		Eigen::Vector2d VMinorSweep = poly.FindShortestAxis(AxisSearchMethod::AngleSweep);
+		Eigen::Vector2d VMajorSweep = poly.FindLongestAxis(AxisSearchMethod::AngleSweep);
+		std::chrono::time_point<std::chrono::steady_clock> T2 = std::chrono::steady_clock::now();
+		
+		double widthCalipers = projectionLength(poly, VMinorCalipers);
+		double widthSweep    = projectionLength(poly, VMinorSweep);
+		double lengthCalipers = projectionLength(poly, VMajorCalipers);
+		double lengthSweep    = projectionLength(poly, VMajorSweep);
+		consistent = consistent && (widthCalipers <= widthSweep + 1e-12) && (lengthCalipers >= lengthSweep - 1e-12);
+		std::cerr << numVertices << " vertices: Width " << widthCalipers << " (calipers) vs. " << widthSweep << " (sweep), ";
+		std::cerr << "Length " << lengthCalipers << " (calipers) vs. " << lengthSweep << " (sweep). ";
+		std::cerr << "Time: " << 1.0e6*SecondsElapsed(T0, T1) << " us (calipers) vs. " << 1.0e6*SecondsElapsed(T1, T2) << " us (sweep)\r\n";
+	}
+
+	//Compare the Iterated Cuts and Balanced Cuts partitioners on a smooth county-scale region and on an irregular one (an L shape with a
+	//narrow peninsula, a notch, and a hole). Slivers (pieces under a quarter of the target area) each waste a sortie. Balanced Cuts should
+	//leave none, and both partitions must cover the region exactly.
+	Guidance::MissionParameters missionParams;
+	missionParams.SubregionTargetFlightTime = 600.0;
+	Eigen::Vector2d center_LL = PI/180.0*Eigen::Vector2d(44.2380, -95.2990); //Near Lamberton, MN
+	double metersPerRadLat = 6371000.0;
+	double metersPerRadLon = 6371000.0*std::cos(center_LL(0));
+	auto ENToNM = [&](double East, double North) { return LatLonToNM(center_LL + Eigen::Vector2d(North/metersPerRadLat, East/metersPerRadLon)); };
+	std::Evector<PolygonCollection> testRegions(2);
+	{
+		std::Evector<Eigen::Vector2d> vertices;
+		for (int n = 0; n < 720; n++) {
+			double theta = 2.0*PI*double(n)/720.0;
+			double r = 1.0 + 0.08*std::sin(7.0*theta) + 0.04*std::cos(19.0*theta);
+			vertices.push_back(ENToNM(6000.0*r*std::cos(theta), 4000.0*r*std::sin(theta)));
+		}
+		testRegions[0].m_components.emplace_back(SimplePolygon(vertices));
+	}
+	{
+		std::Evector<Eigen::Vector2d> vertices;
+		for (auto const & [east, north] : std::vector<std::pair<double, double>>{{0.0, 0.0}, {5000.0, 0.0}, {5000.0, 1500.0}, {5600.0, 1500.0},
+		     {5600.0, 1700.0}, {5000.0, 1700.0}, {5000.0, 2500.0}, {2000.0, 2500.0}, {2000.0, 3000.0}, {2600.0, 3600.0}, {1800.0, 6000.0},
+		     {0.0, 6000.0}, {0.0, 3100.0}, {900.0, 3050.0}, {900.0, 2950.0}, {0.0, 2900.0}})
+			vertices.push_back(ENToNM(east, north));
+		testRegions[1].m_components.emplace_back(SimplePolygon(vertices));
+		std::Evector<Eigen::Vector2d> hole = { ENToNM(600.0, 600.0), ENToNM(600.0, 1400.0), ENToNM(1800.0, 1400.0), ENToNM(1800.0, 600.0) };
+		testRegions[1].m_components.back().m_holes.emplace_back(hole);
+	}
+
+	std::cerr << "\r\nPartitioner comparison (areas relative to target sub-region area):\r\n";
+	bool partitionsOK = true;
+	for (size_t regionIndex = 0U; regionIndex < testRegions.size(); regionIndex++) {
+		PolygonCollection const & region = testRegions[regionIndex];
+		Eigen::Vector4d AABB = region.GetAABB();
+		double rowSpacing = 2.0 * missionParams.HAG * std::tan(0.5 * missionParams.HFOV) * (1.0 - missionParams.SidelapFraction);
+		double NMUnitsPerMeter = MetersToNMUnits(1.0, 0.5*AABB(2) + 0.5*AABB(3));
+		double targetArea = missionParams.SubregionTargetFlightTime * rowSpacing * missionParams.TargetSpeed * NMUnitsPerMeter * NMUnitsPerMeter;
+		for (int method : {1, 2}) {
+			std::Evector<PolygonCollection> partition;
+			std::chrono::time_point<std::chrono::steady_clock> T0 = std::chrono::steady_clock::now();
+			if (method == 1)
+				Guidance::PartitionSurveyRegion_IteratedCuts(region, partition, missionParams);
+			else
+				Guidance::PartitionSurveyRegion_BalancedCuts(region, partition, missionParams);
+			std::chrono::time_point<std::chrono::steady_clock> T1 = std::chrono::steady_clock::now();
+
+			double totalArea = 0.0;
+			double minArea = std::numeric_limits<double>::infinity();
+			double maxArea = 0.0;
+			int numSlivers = 0;
+			for (PolygonCollection const & piece : partition) {
+				double area = piece.GetArea();
+				totalArea += area;
+				minArea = std::min(minArea, area);
+				maxArea = std::max(maxArea, area);
+				if (area < 0.25*targetArea)
+					numSlivers++;
+			}
+			bool covered = (std::abs(totalArea - region.GetArea()) <= 1e-4*region.GetArea());
+			partitionsOK = partitionsOK && covered && ((method != 2) || (numSlivers == 0));
+			std::cerr << "Region " << regionIndex << ", " << ((method == 1) ? "Iterated Cuts: " : "Balanced Cuts: ") << partition.size() << " pieces, ";
+			std::cerr << numSlivers << " slivers, area " << minArea/targetArea << " to " << maxArea/targetArea << ", ";
+			std::cerr << (covered ? "" : "AREA MISMATCH, ") << SecondsElapsed(T0, T1)*1000.0 << " ms\r\n";
+		}
+	}
+
+	return consistent && partitionsOK;
 }
 
 static std::filesystem::path SimDatasetStringArgToDatasetPath(std::string const & Arg) {
@@ -796,7 +1281,18 @@ static bool TestBench11(std::string const & Arg) {
 		});
 	}
 	
-	//Start the shadow detection engine, using imagery from the sim drone
+	//Record the timestamp of every shadow map so we can replay the history once the run is done
+	std::mutex timestampsMutex;
+	std::vector<ShadowDetection::TimePoint> timestamps;
+	int timestampsCallbackHandle = ShadowDetection::ShadowDetectionEngine::Instance().RegisterCallback(
+		[&timestampsMutex, &timestamps](ShadowDetection::InstantaneousShadowMap const & ShadowMap) {
+			std::scoped_lock lock(timestampsMutex);
+			timestamps.push_back(ShadowMap.Timestamp);
+		});
+	
+	//Start the shadow detection engine, using imagery from the sim drone. The sim drone is not realtime so it produces frames as fast
+	//as it can decode them - don't drop any frames.
+	ShadowDetection::ShadowDetectionEngine::Instance().SetFrameQueuePolicy(8U, ShadowDetection::FrameDropPolicy::None);
 	ShadowDetection::ShadowDetectionEngine::Instance().Start("Simulation A"s);
 	
 	//Start the sim drone video feed
@@ -806,12 +1302,30 @@ static bool TestBench11(std::string const & Arg) {
 	while (myDrone->IsCamImageFeedOn())
 		std::this_thread::sleep_for(std::chrono::milliseconds(100));
 	
-	//Stop the shadow detection engine and instruct it to save it's shadow map history
+	//Stop the shadow detection engine
 	ShadowDetection::ShadowDetectionEngine::Instance().Stop();
+	ShadowDetection::ShadowDetectionEngine::Instance().UnRegisterCallback(timestampsCallbackHandle);
+	
+	//Replay the recorded history (older maps have likely been spilled to disk by now) - each lookup should give the map we received
+	size_t numMismatches = 0U;
+	for (ShadowDetection::TimePoint const & timestamp : timestamps) {
+		ShadowDetection::InstantaneousShadowMap recordedMap;
+		if ((! ShadowDetection::ShadowDetectionEngine::Instance().GetHistoricalShadowMap(timestamp, recordedMap)) || (recordedMap.Timestamp != timestamp)) {
+			numMismatches++;
+			continue;
+		}
+		if (showLiveOutput) {
+			cv::imshow("Shadow Map Replay", recordedMap.Map);
+			cv::waitKey(1);
+		}
+	}
+	std::cerr << "Replayed " << timestamps.size() << " shadow maps from history. Lookup failures: " << numMismatches << "\r\n";
+	
+	//Instruct the shadow detection engine to save it's shadow map history
 	ShadowDetection::ShadowDetectionEngine::Instance().SaveAndFlushShadowMapHistory();
 	std::cerr << "Shadow map history saved to FRF files. Look in 'Shadow Map Files' folder in BIN directory.\r\n";
 	
-	return true;
+	return (numMismatches == 0U);
 }
 
 //Shadow Detection: Realtime simulation
@@ -864,6 +1378,13 @@ static bool TestBench12(std::string const & Arg) {
 	while (myDrone->IsCamImageFeedOn())
 		std::this_thread::sleep_for(std::chrono::milliseconds(100));
 	
+	//Print pipeline statistics
+	ShadowDetection::PipelineStats stats = ShadowDetection::ShadowDetectionEngine::Instance().GetPipelineStats();
+	std::cerr << "Frames received: " << stats.FramesReceived << ", processed: " << stats.FramesProcessed << ", dropped: " << stats.FramesDropped;
+	std::cerr << ", stabilization skipped: " << stats.FramesStabilizationSkipped << "\r\n";
+	std::cerr << "Mean stabilization time: " << stats.Stabilization_ms << " ms. Mean EN processing time: " << stats.ENProcessing_ms << " ms.\r\n";
+	std::cerr << "Mean end-to-end latency: " << stats.EndToEnd_ms << " ms.\r\n";
+	
 	//Stop the shadow detection engine and instruct it to save it's shadow map history
 	ShadowDetection::ShadowDetectionEngine::Instance().Stop();
 	ShadowDetection::ShadowDetectionEngine::Instance().SaveAndFlushShadowMapHistory();
@@ -872,9 +1393,320 @@ static bool TestBench12(std::string const & Arg) {
 	return true;
 }
 
-static bool TestBench13(std::string const & Arg) { return false; }
-static bool TestBench14(std::string const & Arg) { return false; }
-static bool TestBench15(std::string const & Arg) { return false; }
+//Shadow Detection: Shadow map fan-out copy benchmark. Publishes synthetic 512x512 shadow maps to a set of consumers that keep what they
+//receive (like the propagation queue, the history recorder, the overlays, and guidance do), first giving each consumer its own deep copy
+//(the old behavior) and then handing out shared handles through a FrameChannel. Reports bytes copied per second for each. The optional
+//argument is the number of maps to publish (default 1000).
+static bool TestBench13(std::string const & Arg) {
+	int numMaps = 1000;
+	if ((! Arg.empty()) && ((! Handy::TryConvert<int>(Arg, numMaps)) || (numMaps <= 0))) {
+		std::cerr << "Invalid argument. Provide the number of shadow maps to publish (or leave empty for the default).\r\n";
+		return false;
+	}
+	const int    NUM_CONSUMERS = 4;   //Consumers that keep each map
+	const size_t MAX_KEPT = 16U;      //Each consumer keeps this many recent maps - older ones are released
+
+	std::vector<std::deque<ShadowDetection::InstantaneousShadowMap>> copyConsumers(NUM_CONSUMERS);
+	std::vector<std::deque<ShadowDetection::ShadowMapHandle>> handleConsumers(NUM_CONSUMERS);
+	FrameChannel<ShadowDetection::InstantaneousShadowMap> channel([](ShadowDetection::InstantaneousShadowMap const & Map) { return MatBytes(Map.Map); });
+	for (int consumer = 0; consumer < NUM_CONSUMERS; consumer++) {
+		channel.Subscribe([&handleConsumers, consumer, MAX_KEPT](ShadowDetection::ShadowMapHandle const & Map) {
+			handleConsumers[consumer].push_back(Map);
+			if (handleConsumers[consumer].size() > MAX_KEPT)
+				handleConsumers[consumer].pop_front();
+		});
+	}
+
+	cv::RNG rng(0);
+	auto MakeMap = [&rng]() {
+		std::shared_ptr<ShadowDetection::InstantaneousShadowMap> map = std::make_shared<ShadowDetection::InstantaneousShadowMap>();
+		map->Map = cv::Mat(512, 512, CV_8UC1);
+		rng.fill(map->Map, cv::RNG::UNIFORM, 0, 256);
+		map->Timestamp = std::chrono::steady_clock::now();
+		return map;
+	};
+
+	//Before: every consumer gets a deep copy of every map
+	FrameCopyStats::Instance().Reset();
+	std::chrono::time_point<std::chrono::steady_clock> T0 = std::chrono::steady_clock::now();
+	for (int n = 0; n < numMaps; n++) {
+		std::shared_ptr<ShadowDetection::InstantaneousShadowMap> map = MakeMap();
+		for (auto & consumer : copyConsumers) {
+			consumer.push_back(map->Clone());
+			if (consumer.size() > MAX_KEPT)
+				consumer.pop_front();
+		}
+	}
+	std::chrono::time_point<std::chrono::steady_clock> T1 = std::chrono::steady_clock::now();
+	double copyBytesPerSecond = FrameCopyStats::Instance().BytesCopiedPerSecond();
+	uint64_t copyBytes = FrameCopyStats::Instance().BytesCopied();
+
+	//After: maps are published once and consumers share them
+	FrameCopyStats::Instance().Reset();
+	std::chrono::time_point<std::chrono::steady_clock> T2 = std::chrono::steady_clock::now();
+	for (int n = 0; n < numMaps; n++)
+		channel.Publish(MakeMap());
+	std::chrono::time_point<std::chrono::steady_clock> T3 = std::chrono::steady_clock::now();
+	double channelBytesPerSecond = FrameCopyStats::Instance().BytesCopiedPerSecond();
+	uint64_t channelBytes = FrameCopyStats::Instance().BytesCopied();
+	uint64_t sharedBytes  = FrameCopyStats::Instance().BytesShared();
+
+	bool allDelivered = true;
+	for (auto const & consumer : handleConsumers)
+		allDelivered = allDelivered && (consumer.size() == std::min(MAX_KEPT, size_t(numMaps))) && (consumer.back() == channel.Latest());
+
+	std::cerr << "Maps published: " << numMaps << ", Consumers: " << NUM_CONSUMERS << "\r\n";
+	std::cerr << "Per-consumer copies: " << double(copyBytes)/1.0e6 << " MB copied, " << copyBytesPerSecond/1.0e6 << " MB/s, "
+	          << 1000.0*SecondsElapsed(T0, T1)/double(numMaps) << " ms per map\r\n";
+	std::cerr << "Shared handles:      " << double(channelBytes)/1.0e6 << " MB copied, " << channelBytesPerSecond/1.0e6 << " MB/s, "
+	          << 1000.0*SecondsElapsed(T2, T3)/double(numMaps) << " ms per map (" << double(sharedBytes)/1.0e6 << " MB delivered by reference)\r\n";
+	if (! allDelivered)
+		std::cerr << "Error: Not all consumers received the published maps.\r\n";
+	return allDelivered && (channelBytes == 0U);
+}
+
+//Shadow Detection: Shadow map history RLE and spill/reload round trip. Checks that RLE encoding round trips synthetic maps exactly (including
+//runs longer than 256 pixels and rejection of corrupt encodings), then records maps in a ShadowMapHistory with a tiny memory budget so
+//nearly every chunk is spilled to disk, and checks that every map (and timestamp lookup) comes back unchanged - before and after saving -
+//and that saving writes a single FRF file with every map in order. Also checks that the startup sweep removes orphaned spill files and
+//nothing else.
+static bool TestBench14(std::string const & Arg) {
+	using TimePoint = ShadowDetection::ShadowMapHistory::TimePoint;
+	std::mt19937 gen(14);
+	std::uniform_int_distribution<int> coordDist(0, 511);
+	std::uniform_int_distribution<int> sizeDist(5, 120);
+	std::bernoulli_distribution noiseDist(0.001);
+
+	//Synthetic shadow maps: unshadowed background, masked outside a circular aperture, shadowed blobs (a couple of them at intermediate
+	//values), and some isolated shadowed pixels
+	auto MakeMap = [&]() {
+		cv::Mat map(512, 512, CV_8UC1, cv::Scalar(255));
+		cv::circle(map, cv::Point(256, 256), 250, cv::Scalar(0), cv::FILLED);
+		for (int n = 0; n < 6; n++)
+			cv::ellipse(map, cv::Point(coordDist(gen), coordDist(gen)), cv::Size(sizeDist(gen), sizeDist(gen)), double(coordDist(gen)), 0.0, 360.0,
+			            cv::Scalar((n < 4) ? 254 : 100*n - 300), cv::FILLED);
+		for (int row = 0; row < map.rows; row++) {
+			for (int col = 0; col < map.cols; col++) {
+				if ((map.at<uint8_t>(row, col) != 255U) && noiseDist(gen))
+					map.at<uint8_t>(row, col) = 254U;
+			}
+		}
+		return map;
+	};
+	auto SameMap = [](cv::Mat const & A, cv::Mat const & B) {
+		return (A.size() == B.size()) && (A.type() == B.type()) && (cv::countNonZero(A != B) == 0);
+	};
+
+	//RLE round trips
+	bool rleOK = true;
+	size_t rawBytes = 0U, encodedBytes = 0U;
+	std::vector<uint8_t> encoded;
+	cv::Mat decoded;
+	for (int n = 0; n < 20; n++) {
+		cv::Mat map = MakeMap();
+		ShadowDetection::RLEEncodeShadowMap(map, encoded);
+		rleOK = rleOK && ShadowDetection::RLEDecodeShadowMap(encoded, map.rows, map.cols, decoded) && SameMap(map, decoded);
+		rawBytes     += map.total();
+		encodedBytes += encoded.size();
+	}
+	cv::Mat uniformMap(512, 512, CV_8UC1, cv::Scalar(0)); //A single 262144 pixel run
+	ShadowDetection::RLEEncodeShadowMap(uniformMap, encoded);
+	rleOK = rleOK && (encoded.size() == 2U*512U*512U/256U);
+	rleOK = rleOK && ShadowDetection::RLEDecodeShadowMap(encoded, 512, 512, decoded) && SameMap(uniformMap, decoded);
+	cv::Mat onePixelMap(1, 1, CV_8UC1, cv::Scalar(254));
+	ShadowDetection::RLEEncodeShadowMap(onePixelMap, encoded);
+	rleOK = rleOK && ShadowDetection::RLEDecodeShadowMap(encoded, 1, 1, decoded) && SameMap(onePixelMap, decoded);
+	ShadowDetection::RLEEncodeShadowMap(MakeMap(), encoded);
+	std::vector<uint8_t> truncated(encoded.begin(), encoded.end() - 2);
+	std::vector<uint8_t> oddLength(encoded.begin(), encoded.end() - 1);
+	rleOK = rleOK && (! ShadowDetection::RLEDecodeShadowMap(truncated, 512, 512, decoded));
+	rleOK = rleOK && (! ShadowDetection::RLEDecodeShadowMap(oddLength, 512, 512, decoded));
+	rleOK = rleOK && (! ShadowDetection::RLEDecodeShadowMap(encoded, 256, 512, decoded));
+	std::cerr << "RLE round trips: " << (rleOK ? "OK" : "FAILED") << " (" << 100.0*double(encodedBytes)/double(rawBytes) << "% of raw size)\r\n";
+
+	//Spill and reload
+	std::filesystem::path testDir  = std::filesystem::temp_directory_path() / "Recon Shadow Map History Test";
+	std::filesystem::path spillDir = testDir / "Spill";
+	std::error_code ec;
+	std::filesystem::remove_all(testDir, ec);
+	std::filesystem::create_directories(spillDir, ec);
+
+	size_t const numMaps = 3U*ShadowDetection::ShadowMapHistory::MapsPerChunk + 10U;
+	std::vector<cv::Mat> maps;
+	std::vector<TimePoint> timestamps;
+	bool historyOK = true;
+	{
+		ShadowDetection::ShadowMapHistory history(1U, spillDir);
+		TimePoint T0 = std::chrono::steady_clock::now();
+		for (size_t n = 0U; n < numMaps; n++) {
+			maps.push_back(MakeMap());
+			timestamps.push_back(T0 + std::chrono::seconds(n));
+			history.Append(maps.back(), timestamps.back());
+		}
+		historyOK = (history.Size() == numMaps);
+
+		auto CheckAllMaps = [&](char const * Stage) {
+			bool ok = true;
+			cv::Mat map;
+			TimePoint timestamp;
+			for (size_t n = 0U; n < numMaps; n++) {
+				ok = ok && history.GetMap(n, map) && SameMap(map, maps[n]);
+				ok = ok && history.GetTimestamp(n, timestamp) && (timestamp == timestamps[n]);
+				ok = ok && (history.FindIndex(timestamps[n]) == int(n)) && (history.FindIndex(timestamps[n] + std::chrono::milliseconds(500)) == int(n));
+			}
+			ok = ok && (history.FindIndex(T0 - std::chrono::seconds(1)) == -1);
+			std::cerr << "Maps read back " << Stage << ": " << (ok ? "OK" : "FAILED") << "\r\n";
+			return ok;
+		};
+		historyOK = CheckAllMaps("while spilling") && historyOK;
+
+		//Saving waits for the spills and streams every chunk (spilled or resident) into one FRF file
+		std::filesystem::path saveFile = testDir / "History.frf";
+		historyOK = history.SaveFRFFile(saveFile) && historyOK;
+		std::vector<std::filesystem::path> savedFiles = GetNormalFilesInDirectory(testDir);
+		FRFImage savedImage;
+		ShadowMapInfoBlock savedInfo;
+		bool fileOK = (savedFiles.size() == 1U) && savedImage.LoadFromDisk(saveFile.string()) && savedInfo.LoadFromFRFFile(savedImage) &&
+		              (savedImage.NumberOfLayers() == numMaps);
+		for (size_t n = 0U; fileOK && (n < numMaps); n++) {
+			fileOK = (std::fabs(savedInfo.LayerTimeTags[n] - double(n)) < 1.0e-6);
+			for (int row = 0; fileOK && (row < 512); row += 7) {
+				for (int col = 0; fileOK && (col < 512); col += 7) {
+					uint8_t value = maps[n].at<uint8_t>(row, col);
+					double savedValue = savedImage.GetValue(uint16_t(n), uint32_t(row), uint32_t(col));
+					if (value == 255U)
+						fileOK = std::isnan(savedValue);
+					else if (value == 0U)
+						fileOK = (savedValue == 0.0);
+					else if (value == 254U)
+						fileOK = (savedValue >= 0.5);
+				}
+			}
+		}
+		historyOK = fileOK && historyOK;
+		std::cerr << "Saved to a single FRF file: " << (fileOK ? "OK" : "FAILED") << " (" << savedFiles.size() << " files, "
+		          << savedImage.NumberOfLayers() << " layers)\r\n";
+		historyOK = CheckAllMaps("after saving") && historyOK;
+	}
+	historyOK = historyOK && std::filesystem::is_empty(spillDir, ec); //Destroying the history deletes its spill files
+	std::cerr << "Spill folder empty after the history is destroyed: " << std::filesystem::is_empty(spillDir, ec) << "\r\n";
+
+	//Orphan sweep - spill files (and temp files) from a crashed session are removed, anything else is left alone
+	for (std::string const & name : {"History 1234-0 Chunk 1.chunk"s, "History 1234-0 Chunk 2.chunk.tmp"s, "Notes.txt"s, "History.txt"s})
+		std::ofstream(spillDir / name) << "x";
+	size_t numRemoved = ShadowDetection::ShadowMapHistory::RemoveOrphanedSpillFiles(spillDir);
+	bool sweepOK = (numRemoved == 2U) && std::filesystem::exists(spillDir / "Notes.txt") && std::filesystem::exists(spillDir / "History.txt");
+	std::cerr << "Orphaned spill file sweep: " << (sweepOK ? "OK" : "FAILED") << " (" << numRemoved << " files removed)\r\n";
+
+	std::filesystem::remove_all(testDir, ec);
+	return rleOK && historyOK && sweepOK;
+}
+
+static bool TestBench15(std::string const & Arg) {
+	//Check StabilizationContext::MatchKeypoints() against a brute-force reference: a pair matches iff each keypoint is the other's closest
+	//descriptor among ALL keypoints (ties go to the lower index) and the pair is within the search radius. The frame is the reference shifted
+	//by a known translation with noisy descriptors, plus distractor keypoints, some of which are exact copies of reference descriptors placed far
+	//away (these steal the global best from in-radius candidates, which a locally cross-checked matcher would wrongly accept).
+	std::mt19937 gen(15);
+	std::uniform_real_distribution<float> posDist(0.0f, 1920.0f);
+	std::uniform_int_distribution<int> byteDist(0, 255);
+	std::uniform_int_distribution<int> bitDist(0, 255);
+	int numRef = 1500, numDescBytes = 32;
+	cv::Point2f shift(37.0f, -21.0f);
+
+	std::vector<cv::KeyPoint> refKeypoints, frameKeypoints;
+	cv::Mat refDescriptors(numRef, numDescBytes, CV_8UC1), frameDescriptors(0, numDescBytes, CV_8UC1);
+	auto flipBits = [&](cv::Mat Row, int NumBits) {
+		for (int n = 0; n < NumBits; n++) {
+			int bit = bitDist(gen);
+			Row.at<uint8_t>(0, bit / 8) ^= uint8_t(1U << (bit % 8));
+		}
+	};
+	for (int i = 0; i < numRef; i++) {
+		refKeypoints.emplace_back(posDist(gen), posDist(gen), 31.0f);
+		for (int b = 0; b < numDescBytes; b++)
+			refDescriptors.at<uint8_t>(i, b) = uint8_t(byteDist(gen));
+	}
+	for (int i = 0; i < numRef; i++) {
+		int kind = i % 10;
+		if (kind < 7) { //Shifted copy with a few bits flipped
+			frameKeypoints.emplace_back(refKeypoints[i].pt - shift, 31.0f);
+			cv::Mat row = refDescriptors.row(i).clone();
+			flipBits(row, 1 + (i % 12));
+			frameDescriptors.push_back(row);
+		}
+		else if (kind < 9) { //Unrelated distractor
+			frameKeypoints.emplace_back(posDist(gen), posDist(gen), 31.0f);
+			cv::Mat row(1, numDescBytes, CV_8UC1);
+			for (int b = 0; b < numDescBytes; b++)
+				row.at<uint8_t>(0, b) = uint8_t(byteDist(gen));
+			frameDescriptors.push_back(row);
+		}
+		else { //Exact copy of the descriptor of an earlier shifted keypoint, placed far from it
+			int src = i - 2;
+			cv::Point2f p = refKeypoints[src].pt + cv::Point2f(900.0f, 900.0f);
+			frameKeypoints.emplace_back(cv::Point2f(std::fmod(p.x, 1920.0f), std::fmod(p.y, 1920.0f)), 31.0f);
+			frameDescriptors.push_back(refDescriptors.row(src).clone());
+		}
+	}
+
+	ShadowDetection::StabilizationContext context;
+	context.SetReference(refKeypoints, refDescriptors);
+
+	auto BruteForce = [&](cv::Mat const & PriorH, double Radius, std::vector<std::pair<int, int>> & Matches) {
+		Matches.clear();
+		std::vector<cv::Point2f> framePoints, predicted;
+		for (cv::KeyPoint const & kp : frameKeypoints)
+			framePoints.push_back(kp.pt);
+		cv::transform(framePoints, predicted, PriorH);
+		int numFrame = (int) frameKeypoints.size();
+		cv::Mat dists(numFrame, numRef, CV_32SC1);
+		for (int j = 0; j < numFrame; j++) {
+			for (int i = 0; i < numRef; i++)
+				dists.at<int>(j, i) = (int) cv::norm(frameDescriptors.row(j), refDescriptors.row(i), cv::NORM_HAMMING);
+		}
+		//cv::minMaxLoc() returns the first minimum, so ties go to the lower index as required
+		std::vector<int> bestRef(numFrame), bestFrame(numRef);
+		for (int j = 0; j < numFrame; j++) {
+			cv::Point minLoc;
+			cv::minMaxLoc(dists.row(j), nullptr, nullptr, &minLoc, nullptr);
+			bestRef[j] = minLoc.x;
+		}
+		for (int i = 0; i < numRef; i++) {
+			cv::Point minLoc;
+			cv::minMaxLoc(dists.col(i), nullptr, nullptr, &minLoc, nullptr);
+			bestFrame[i] = minLoc.y;
+		}
+		for (int j = 0; j < numFrame; j++) {
+			int i = bestRef[j];
+			if ((bestFrame[i] == j) && (cv::norm(refKeypoints[i].pt - predicted[j]) <= Radius))
+				Matches.emplace_back(i, j);
+		}
+	};
+
+	bool allOK = true;
+	std::vector<std::tuple<std::string, cv::Mat, double>> cases;
+	cv::Mat seedH = (cv::Mat_<double>(2, 3) << 1.0, 0.0, shift.x, 0.0, 1.0, shift.y);
+	cases.emplace_back("Unseeded", cv::Mat::eye(2, 3, CV_64F), context.MaxKeypointMovement);
+	cases.emplace_back("Seeded",   seedH,                      context.SeededSearchRadius);
+	cases.emplace_back("Tight",    seedH,                      2.0);
+	for (auto const & [name, H, radius] : cases) {
+		std::vector<std::pair<int, int>> expected;
+		BruteForce(H, radius, expected);
+		std::vector<cv::Point2f> refPoints, framePoints;
+		std::chrono::time_point<std::chrono::steady_clock> T0 = std::chrono::steady_clock::now();
+		context.MatchKeypoints(frameKeypoints, frameDescriptors, H, radius, refPoints, framePoints);
+		double matchTime = SecondsElapsed(T0);
+
+		bool OK = (refPoints.size() == expected.size());
+		for (size_t n = 0U; OK && (n < expected.size()); n++)
+			OK = (refPoints[n] == refKeypoints[expected[n].first].pt) && (framePoints[n] == frameKeypoints[expected[n].second].pt);
+		allOK = allOK && OK;
+		std::cerr << name << " (radius " << radius << " px): " << refPoints.size() << " matches (brute force: " << expected.size() << ") in ";
+		std::cerr << matchTime*1000.0 << " ms" << (OK ? "" : " - MISMATCH") << "\r\n";
+	}
+	return allOK;
+}
 
 //Shadow Propagation: Non-realtime simulation
 static bool TestBench16(std::string const & Arg) {
@@ -920,7 +1752,9 @@ static bool TestBench16(std::string const & Arg) {
 	std::chrono::time_point<std::chrono::steady_clock> TA_Timestamp = std::chrono::steady_clock::now(); //Init timestamp before starting modules
 	ShadowPropagation::ShadowPropagationEngine::Instance().Start();
 	
-	//Start the shadow detection engine, using imagery from the sim drone
+	//Start the shadow detection engine, using imagery from the sim drone. The sim drone is not realtime so it produces frames as fast
+	//as it can decode them - don't drop any frames.
+	ShadowDetection::ShadowDetectionEngine::Instance().SetFrameQueuePolicy(8U, ShadowDetection::FrameDropPolicy::None);
 	ShadowDetection::ShadowDetectionEngine::Instance().Start("Simulation A"s);
 	
 	//Start the sim drone video feed
@@ -1076,9 +1910,295 @@ static bool TestBench17(std::string const & Arg) {
 	return true;
 }
 
-static bool TestBench18(std::string const & Arg) { return false; }
-static bool TestBench19(std::string const & Arg) { return false; }
-static bool TestBench20(std::string const & Arg) { return false; }
+//Load every layer of a shadow map FRF file (as saved by ShadowMapHistory::SaveFRFFile()) into 8-bit shadow maps with the
+//InstantaneousShadowMap conventions: 0 = unshadowed, 254 = shadowed, 255 = masked. Returns false if the file can't be loaded.
+static bool LoadShadowMapFRFFile(std::filesystem::path const & Filepath, std::vector<cv::Mat> & Maps) {
+	Maps.clear();
+	FRFImage file;
+	if ((! file.LoadFromDisk(Filepath.string())) || (! IsShadowMapFile(file)))
+		return false;
+	for (uint16_t layerIndex = 0U; layerIndex < file.NumberOfLayers(); layerIndex++) {
+		cv::Mat map(int(file.Rows()), int(file.Cols()), CV_8UC1);
+		for (uint32_t row = 0U; row < file.Rows(); row++) {
+			for (uint32_t col = 0U; col < file.Cols(); col++) {
+				double value = file.GetValue(layerIndex, row, col);
+				if (std::isnan(value))
+					map.at<uint8_t>(int(row), int(col)) = 255U;
+				else
+					map.at<uint8_t>(int(row), int(col)) = (value >= 0.5) ? 254U : 0U;
+			}
+		}
+		Maps.push_back(map);
+	}
+	return true;
+}
+
+//Shadow Propagation: Contour flow boundary matching benchmark. For each pair of consecutive recorded shadow maps, match every boundary point
+//of the new shadows to the previous shadows using both the linear scan and the spatial index, verify that the answers are identical, and
+//compare run times. Arg is the path to a shadow map FRF file or to a folder of them (defaults to the "Shadow Map Files" folder in BIN).
+static bool TestBench18(std::string const & Arg) {
+	std::filesystem::path sourcePath = Arg.empty() ? Handy::Paths::ThisExecutableDirectory() / "Shadow Map Files" : std::filesystem::path(Arg);
+	std::vector<std::filesystem::path> files;
+	std::error_code ec;
+	if (std::filesystem::is_directory(sourcePath, ec)) {
+		for (auto const & entry : std::filesystem::recursive_directory_iterator(sourcePath, ec)) {
+			if (entry.is_regular_file() && (entry.path().extension() == ".frf"))
+				files.push_back(entry.path());
+		}
+		std::sort(files.begin(), files.end());
+	}
+	else
+		files.push_back(sourcePath);
+
+	int    numEpochs = 0;
+	size_t numQueries = 0U;
+	size_t numMismatches = 0U;
+	double linearScanTime = 0.0; //Seconds
+	double indexTime      = 0.0; //Seconds (including building the index every epoch)
+	for (std::filesystem::path const & file : files) {
+		std::vector<cv::Mat> maps;
+		if (! LoadShadowMapFRFFile(file, maps)) {
+			std::cerr << "Skipping file (not a shadow map file or failed to load): " << file.string() << "\r\n";
+			continue;
+		}
+		std::cerr << "Processing " << maps.size() << " shadow maps from file: " << file.string() << "\r\n";
+
+		std::Evector<Polygon> prevShadows;
+		for (size_t mapIndex = 0U; mapIndex < maps.size(); mapIndex++) {
+			std::Evector<Polygon> shadows;
+			ShadowPropagation::ShadowMapToShadowPolygons(maps[mapIndex], shadows, 4);
+			if (mapIndex > 0U) {
+				std::Evector<Eigen::Vector2d> queries;
+				for (Polygon const & poly : shadows) {
+					for (int simplePolyIndex = -1; simplePolyIndex < (int) poly.m_holes.size(); simplePolyIndex++) {
+						SimplePolygon const & simplePoly(simplePolyIndex < 0 ? poly.m_boundary : poly.m_holes[simplePolyIndex]);
+						queries.insert(queries.end(), simplePoly.GetVertices().begin(), simplePoly.GetVertices().end());
+					}
+				}
+
+				std::vector<std::tuple<bool,int,int,int>> resultsA(queries.size()), resultsB(queries.size());
+				std::Evector<Eigen::Vector2d> pointsA(queries.size()), pointsB(queries.size());
+
+				std::chrono::time_point<std::chrono::steady_clock> T0 = std::chrono::steady_clock::now();
+				for (size_t n = 0U; n < queries.size(); n++) {
+					int polyIndex = -1, simplePolyIndex = -1, vertexIndex = -1;
+					bool found = ShadowPropagation::FindClosestBoundaryPoint(queries[n], prevShadows, polyIndex, simplePolyIndex, vertexIndex, pointsA[n]);
+					resultsA[n] = std::make_tuple(found, polyIndex, simplePolyIndex, vertexIndex);
+				}
+				std::chrono::time_point<std::chrono::steady_clock> T1 = std::chrono::steady_clock::now();
+				ShadowPropagation::ShadowBoundaryIndex index(prevShadows);
+				for (size_t n = 0U; n < queries.size(); n++) {
+					int polyIndex = -1, simplePolyIndex = -1, vertexIndex = -1;
+					bool found = index.FindClosestBoundaryPoint(queries[n], polyIndex, simplePolyIndex, vertexIndex, pointsB[n]);
+					resultsB[n] = std::make_tuple(found, polyIndex, simplePolyIndex, vertexIndex);
+				}
+				std::chrono::time_point<std::chrono::steady_clock> T2 = std::chrono::steady_clock::now();
+
+				for (size_t n = 0U; n < queries.size(); n++) {
+					if ((resultsA[n] != resultsB[n]) || (std::get<0>(resultsA[n]) && (pointsA[n] != pointsB[n])))
+						numMismatches++;
+				}
+				linearScanTime += SecondsElapsed(T0, T1);
+				indexTime      += SecondsElapsed(T1, T2);
+				numQueries     += queries.size();
+				numEpochs++;
+			}
+			prevShadows.swap(shadows);
+		}
+	}
+	if (numEpochs == 0) {
+		std::cerr << "No shadow map pairs found. Provide the path to a shadow map FRF file or a folder containing them.\r\n";
+		return false;
+	}
+
+	std::cerr << "Epochs: " << numEpochs << ", Boundary point queries: " << numQueries << ", Mismatches: " << numMismatches << "\r\n";
+	std::cerr << "Linear scan:   " << 1000.0*linearScanTime << " ms total, " << 1000.0*linearScanTime/double(numEpochs) << " ms per epoch\r\n";
+	std::cerr << "Spatial index: " << 1000.0*indexTime      << " ms total, " << 1000.0*indexTime/double(numEpochs)      << " ms per epoch\r\n";
+	if (indexTime > 0.0)
+		std::cerr << "Speedup: " << linearScanTime / indexTime << "X\r\n";
+	return (numMismatches == 0U);
+}
+
+static bool TestBench19(std::string const & Arg) {
+	//Compiled polygon benchmark: flatten a survey-region-like collection (wavy components with holes) and check that containment and
+	//projection agree with PolygonCollection, with and without the edge grid. Then check TA MinOverRegion() against a brute-force scan.
+	Eigen::Vector2d center_LL = PI/180.0*Eigen::Vector2d(44.2380, -95.2990); //Near Lamberton, MN
+	double metersPerRadLat = 6371000.0;
+	double metersPerRadLon = 6371000.0*std::cos(center_LL(0));
+	auto wavyRing = [&](Eigen::Vector2d const & Center_m, double Radius_m, int NumVertices, bool Clockwise) {
+		std::Evector<Eigen::Vector2d> vertices;
+		for (int n = 0; n < NumVertices; n++) {
+			double theta = 2.0*PI*double(Clockwise ? NumVertices - n : n)/double(NumVertices);
+			double r = Radius_m*(1.0 + 0.08*std::sin(7.0*theta) + 0.04*std::cos(19.0*theta));
+			Eigen::Vector2d p_m = Center_m + r*Eigen::Vector2d(1.5*std::cos(theta), std::sin(theta));
+			vertices.push_back(LatLonToNM(center_LL + Eigen::Vector2d(p_m(1)/metersPerRadLat, p_m(0)/metersPerRadLon)));
+		}
+		return vertices;
+	};
+	PolygonCollection region;
+	for (int n = 0; n < 3; n++) {
+		Eigen::Vector2d compCenter_m(-4000.0 + 4000.0*double(n), 500.0*double(n % 2));
+		region.m_components.emplace_back();
+		region.m_components.back().m_boundary.SetBoundary(wavyRing(compCenter_m, 1200.0, 720, false));
+		region.m_components.back().m_holes.emplace_back(wavyRing(compCenter_m + Eigen::Vector2d(300.0, 0.0), 300.0, 90, true));
+	}
+
+	std::chrono::time_point<std::chrono::steady_clock> T0 = std::chrono::steady_clock::now();
+	CompiledPolygonCollection compiledGrid(region, true);
+	std::chrono::time_point<std::chrono::steady_clock> T1 = std::chrono::steady_clock::now();
+	CompiledPolygonCollection compiledRings(region, false);
+	std::cerr << "Compiled region with " << compiledGrid.NumRings() << " rings in " << SecondsElapsed(T0, T1)*1000.0 << " ms\r\n";
+
+	//Random points over (and a little beyond) the AABB of the region
+	Eigen::Vector4d AABB = region.GetAABB();
+	std::mt19937 generator(19);
+	std::uniform_real_distribution<double> distX(AABB(0) - 0.05*(AABB(1) - AABB(0)), AABB(1) + 0.05*(AABB(1) - AABB(0)));
+	std::uniform_real_distribution<double> distY(AABB(2) - 0.05*(AABB(3) - AABB(2)), AABB(3) + 0.05*(AABB(3) - AABB(2)));
+	std::Evector<Eigen::Vector2d> points;
+	for (int n = 0; n < 200000; n++)
+		points.emplace_back(distX(generator), distY(generator));
+
+	std::vector<uint8_t> resultsPoly(points.size()), resultsRings(points.size()), resultsGrid;
+	std::chrono::time_point<std::chrono::steady_clock> T2 = std::chrono::steady_clock::now();
+	for (size_t n = 0U; n < points.size(); n++)
+		resultsPoly[n] = region.ContainsPoint(points[n]) ? 1U : 0U;
+	std::chrono::time_point<std::chrono::steady_clock> T3 = std::chrono::steady_clock::now();
+	for (size_t n = 0U; n < points.size(); n++)
+		resultsRings[n] = compiledRings.ContainsPoint(points[n]) ? 1U : 0U;
+	std::chrono::time_point<std::chrono::steady_clock> T4 = std::chrono::steady_clock::now();
+	resultsGrid = compiledGrid.ContainsPoints(points);
+	std::chrono::time_point<std::chrono::steady_clock> T5 = std::chrono::steady_clock::now();
+
+	int numContainsMismatches = 0;
+	for (size_t n = 0U; n < points.size(); n++) {
+		if ((resultsRings[n] != resultsPoly[n]) || (resultsGrid[n] != resultsPoly[n]))
+			numContainsMismatches++;
+	}
+	std::cerr << "ContainsPoint() on " << points.size() << " points:\r\n";
+	std::cerr << "PolygonCollection:           " << SecondsElapsed(T2, T3)*1000.0 << " ms\r\n";
+	std::cerr << "Compiled (no edge grid):     " << SecondsElapsed(T3, T4)*1000.0 << " ms\r\n";
+	std::cerr << "Compiled (edge grid, batch): " << SecondsElapsed(T4, T5)*1000.0 << " ms\r\n";
+	std::cerr << "Mismatches: " << numContainsMismatches << "\r\n";
+
+	int numProjectionMismatches = 0;
+	for (size_t n = 0U; n < points.size(); n += 100U) {
+		if ((region.ProjectPoint(points[n]) - compiledGrid.ProjectPoint(points[n])).norm() > 1e-12)
+			numProjectionMismatches++;
+	}
+	PolygonCollection roundTrip = compiledGrid.ToPolygonCollection();
+	bool roundTripOK = (roundTrip.m_components.size() == region.m_components.size()) && (std::fabs(roundTrip.GetArea() - region.GetArea()) < 1e-15);
+	std::cerr << "ProjectPoint() mismatches: " << numProjectionMismatches << "\r\n";
+	std::cerr << "Round trip to PolygonCollection: " << (roundTripOK ? "OK" : "Failed") << "\r\n";
+
+	//Region query on a synthetic TA function covering the region, against a brute-force scan of every pixel
+	ShadowPropagation::TimeAvailableFunction TA;
+	int TARows = 512, TACols = 768;
+	double halfHeight_rad = 2500.0/metersPerRadLat;
+	double halfWidth_rad  = 7500.0/metersPerRadLon;
+	TA.UL_LL = center_LL + Eigen::Vector2d( halfHeight_rad, -halfWidth_rad);
+	TA.UR_LL = center_LL + Eigen::Vector2d( halfHeight_rad,  halfWidth_rad);
+	TA.LL_LL = center_LL + Eigen::Vector2d(-halfHeight_rad, -halfWidth_rad);
+	TA.LR_LL = center_LL + Eigen::Vector2d(-halfHeight_rad,  halfWidth_rad);
+	TA.TimeAvailable = cv::Mat(TARows, TACols, CV_16UC1);
+	for (int row = 0; row < TARows; row++) {
+		for (int col = 0; col < TACols; col++)
+			TA.TimeAvailable.at<uint16_t>(row, col) = uint16_t(60 + ((7*row + 13*col) % 5000));
+	}
+	TA.Timestamp = std::chrono::steady_clock::now();
+	TA.BuildPyramid();
+
+	std::chrono::time_point<std::chrono::steady_clock> T6 = std::chrono::steady_clock::now();
+	uint16_t minBruteForce = ShadowPropagation::TimeAvailablePyramid::Sentinel;
+	for (int row = 0; row < TARows; row++) {
+		for (int col = 0; col < TACols; col++) {
+			if (region.ContainsPoint(LatLonToNM(TA.PixelCoordsToLatLon(Eigen::Vector2d(double(col), double(row))))))
+				minBruteForce = std::min(minBruteForce, TA.TimeAvailable.at<uint16_t>(row, col));
+		}
+	}
+	std::chrono::time_point<std::chrono::steady_clock> T7 = std::chrono::steady_clock::now();
+	uint16_t minRegionQuery = TA.MinOverRegion(region);
+	std::chrono::time_point<std::chrono::steady_clock> T8 = std::chrono::steady_clock::now();
+	std::cerr << "\r\nMin over region (brute force, PolygonCollection): " << minBruteForce << " in " << SecondsElapsed(T6, T7)*1000.0 << " ms\r\n";
+	std::cerr << "Min over region (pyramid, compiled region):      " << minRegionQuery << " in " << SecondsElapsed(T7, T8)*1000.0 << " ms\r\n";
+
+	return (numContainsMismatches == 0) && (numProjectionMismatches == 0) && roundTripOK && (minBruteForce == minRegionQuery);
+}
+
+static bool TestBench20(std::string const & Arg) {
+	//Check the error bounds documented in LocalTangentPlane.hpp: the polynomial conversions are compared against the exact ENU frame
+	//(LLA2ECEF() followed by the rotation from latLon_2_C_ECEF_ENU() at the origin) and against LatLonToNM() at random points over the whole
+	//fitted square, for each documented latitude and radius. The measured error stored in each context (GetMaxError()) must respect the
+	//same bounds. The "about" figures get 50% headroom.
+	struct ErrorBoundCase { double Lat_deg; double Radius; double Bound; };
+	std::vector<ErrorBoundCase> cases = { { 45.0,   5000.0, 1.0e-5 },   //5 km, mid-latitudes: under 0.01 mm
+	                                      { 45.0,  20000.0, 5.0e-4 },   //Default radius, mid-latitudes: under 0.5 mm
+	                                      { 60.0,  20000.0, 3.0e-3 },   //Default radius, 60 degrees: about 2 mm
+	                                      { 80.0,  20000.0, 7.5e-2 },   //Default radius, 80 degrees: about 5 cm
+	                                      { 45.0, 100000.0, 3.75e-1 } };//100 km: about 25 cm
+	double maxAltitude = 300.0;   //"Altitudes up to a few hundred metres..."
+	double altitudeBound = 1.0e-3; //"...add well under a millimetre"
+	std::mt19937 gen(20);
+	std::uniform_real_distribution<double> unitDist(-1.0, 1.0);
+	std::uniform_real_distribution<double> altDist(0.0, maxAltitude);
+	int numPoints = 20000;
+
+	bool allOK = true;
+	for (ErrorBoundCase const & testCase : cases) {
+		double lat0 = testCase.Lat_deg*PI/180.0;
+		double lon0 = -95.3*PI/180.0;
+		LocalTangentPlane LTP(Eigen::Vector3d(lat0, lon0, 0.0), testCase.Radius);
+		Eigen::Vector3d origin_ECEF = LLA2ECEF(Eigen::Vector3d(lat0, lon0, 0.0));
+		Eigen::Matrix3d C_ECEF_ENU  = latLon_2_C_ECEF_ENU(lat0, lon0);
+		auto ExactENU = [&](Eigen::Vector3d const & LLA) { return Eigen::Vector3d(C_ECEF_ENU*(LLA2ECEF(LLA) - origin_ECEF)); };
+
+		//Radii of curvature at the origin (meridian and prime vertical) - these give the Lat/Lon extent of the fitted square
+		double a = 6378137.0;
+		double eccSquared = 0.081819190842621*0.081819190842621;
+		double w = 1.0 - eccSquared*std::sin(lat0)*std::sin(lat0);
+		double R_M = a*(1.0 - eccSquared)/(w*std::sqrt(w));
+		double R_N = a/std::sqrt(w);
+
+		std::vector<double> lat(numPoints), lon(numPoints), alt(numPoints), E(numPoints), North(numPoints), U(numPoints);
+		std::vector<double> E0(numPoints), North0(numPoints), U0(numPoints);
+		int numOutOfRange = 0;
+		for (int n = 0; n < numPoints; n++) {
+			lat[n] = lat0 + unitDist(gen)*testCase.Radius/R_M;
+			lon[n] = lon0 + unitDist(gen)*testCase.Radius/(R_N*std::cos(lat0));
+			alt[n] = altDist(gen);
+			numOutOfRange += LTP.IsInRangeLatLon(Eigen::Vector2d(lat[n], lon[n])) ? 0 : 1;
+		}
+		LTP.LLAToENU(lat.data(), lon.data(), nullptr,    numPoints, E0.data(), North0.data(), U0.data());
+		LTP.LLAToENU(lat.data(), lon.data(), alt.data(), numPoints, E.data(),  North.data(),  U.data());
+
+		double errLLToEN = 0.0, errLLAToENU = 0.0, errENToLL = 0.0, errNMToEN = 0.0, errENToNM = 0.0;
+		for (int n = 0; n < numPoints; n++) {
+			Eigen::Vector2d LL(lat[n], lon[n]);
+			Eigen::Vector3d ENU_Exact = ExactENU(Eigen::Vector3d(lat[n], lon[n], 0.0));
+			Eigen::Vector2d EN_Exact(ENU_Exact(0), ENU_Exact(1));
+			Eigen::Vector3d ENUAlt_Exact = ExactENU(Eigen::Vector3d(lat[n], lon[n], alt[n]));
+			Eigen::Vector2d NM_Exact = LatLonToNM(LL);
+
+			errLLToEN   = std::max(errLLToEN,   (Eigen::Vector2d(E0[n], North0[n]) - EN_Exact).norm());
+			errLLAToENU = std::max(errLLAToENU, (Eigen::Vector2d(E[n], North[n]) - ENUAlt_Exact.head<2>()).norm());
+
+			//Inverse conversions - measure the error by taking the result back to the exact frame
+			Eigen::Vector2d LL_Poly = LTP.ENToLatLon(EN_Exact);
+			errENToLL = std::max(errENToLL, (ExactENU(Eigen::Vector3d(LL_Poly(0), LL_Poly(1), 0.0)).head<2>() - EN_Exact).norm());
+			errNMToEN = std::max(errNMToEN, (LTP.NMToEN(NM_Exact) - EN_Exact).norm());
+			errENToNM = std::max(errENToNM, (LTP.ENToNM(EN_Exact) - NM_Exact).norm()*NMUnitsToMeters(1.0, NM_Exact(1)));
+		}
+		double worst = std::max({errLLToEN, errENToLL, errNMToEN, errENToNM});
+		bool OK = (numOutOfRange == 0) && (worst <= testCase.Bound) && (LTP.GetMaxError() <= testCase.Bound) &&
+		          (errLLAToENU <= testCase.Bound + altitudeBound);
+		allOK = allOK && OK;
+		std::cerr << "Lat " << testCase.Lat_deg << " deg, radius " << testCase.Radius/1000.0 << " km (bound " << testCase.Bound*1000.0 << " mm):\r\n";
+		std::cerr << "   LL->EN " << errLLToEN*1000.0 << " mm, EN->LL " << errENToLL*1000.0 << " mm, NM->EN " << errNMToEN*1000.0;
+		std::cerr << " mm, EN->NM " << errENToNM*1000.0 << " mm, LLA->ENU (0-" << maxAltitude << " m) " << errLLAToENU*1000.0 << " mm\r\n";
+		std::cerr << "   GetMaxError(): " << LTP.GetMaxError()*1000.0 << " mm" << (numOutOfRange > 0 ? ", points out of range!" : "");
+		std::cerr << (OK ? "" : " - FAIL") << "\r\n";
+	}
+	return allOK;
+}
 
 //DJI Drone Interface: Simulated Drone Imagery. This test bench sets up the simulated drone for non-realtime operation and just displays video
 static bool TestBench21(std::string const & Arg) {
@@ -1529,6 +2649,672 @@ static bool TestBench27(std::string const & Arg) {
     return true;
 }
 
+//Simple KV Store: Recovery, compaction and migration. Runs a store in a scratch folder through the states it can be left in on disk - closed
+//cleanly, with a torn or corrupt journal tail, with a values file missing, and part way through converting from the old two-file format - and
+//checks that reopening it gives back exactly the items that were durable. Also checks journal/checkpoint generation rollover, incremental
+//compaction while other threads put, get and delete items, PutBatch(), and GetView().
+static bool TestBench28(std::string const & Arg) {
+	using Contents = std::map<std::string, std::vector<uint8_t>>;
+	std::filesystem::path testDir   = std::filesystem::temp_directory_path() / "Recon KV Store Test";
+	std::filesystem::path storeDir  = testDir / "Store";
+	std::filesystem::path storePath = storeDir / "Test";
+	std::error_code ec;
+	std::filesystem::remove_all(testDir, ec);
+	std::filesystem::create_directories(storeDir, ec);
+
+	auto ResetStore = [&]() {
+		std::filesystem::remove_all(storeDir, ec);
+		std::filesystem::create_directories(storeDir, ec);
+	};
+	auto StoreFile = [&](std::string const & Suffix) { return std::filesystem::path(storePath.string() + Suffix); };
+	auto StoreFileIDs = [&](std::string const & Kind) { //IDs of the store files of a kind (<Store>.<Kind>.<ID>), ascending
+		std::vector<uint32_t> IDs;
+		std::string prefix = storePath.filename().string() + "."s + Kind + "."s;
+		for (auto const & entry : std::filesystem::directory_iterator(storeDir, ec)) {
+			std::string name = entry.path().filename().string();
+			if ((name.compare(0U, prefix.size(), prefix) == 0) && (name.size() > prefix.size()) &&
+			    (name.find_first_not_of("0123456789", prefix.size()) == std::string::npos))
+				IDs.push_back((uint32_t) std::stoul(name.substr(prefix.size())));
+		}
+		std::sort(IDs.begin(), IDs.end());
+		return IDs;
+	};
+	auto MakeValue = [](uint32_t Seed, size_t Size) {
+		std::vector<uint8_t> value(Size);
+		uint32_t state = Seed*2654435761U + 1U;
+		for (uint8_t & byte : value) {
+			state = state*1664525U + 1013904223U;
+			byte = uint8_t(state >> 24);
+		}
+		return value;
+	};
+	auto Check = [](SimpleKVStore & Store, Contents const & Expected) {
+		if ((! Store.IsOpen()) || (Store.GetNumItems() != Expected.size()))
+			return false;
+		std::vector<uint8_t> value;
+		for (auto const & kv : Expected) {
+			if ((! Store.Get(kv.first, value)) || (value != kv.second))
+				return false;
+		}
+		return true;
+	};
+	auto Report = [](char const * Name, bool OK) {
+		std::cerr << Name << ": " << (OK ? "OK" : "FAILED") << "\r\n";
+		return OK;
+	};
+
+	bool allOK = true;
+	{
+		Journal storeLog(testDir / "Log.txt", &std::cerr, false);
+
+		//Replay after a clean close
+		Contents expected;
+		bool ok = true;
+		{
+			SimpleKVStore store(storePath, storeLog);
+			for (int n = 0; n < 500; n++) {
+				std::string key = "Item "s + std::to_string(n);
+				expected[key] = MakeValue(n, 1U + (n*37) % 5000);
+				ok = store.Put(key, expected[key]) && ok;
+			}
+			for (int n = 0; n < 500; n += 5) {
+				std::string key = "Item "s + std::to_string(n);
+				expected[key] = MakeValue(n + 1000, 1U + (n*53) % 5000);
+				ok = store.Put(key, expected[key]) && ok;
+			}
+			for (int n = 1; n < 500; n += 10) {
+				std::string key = "Item "s + std::to_string(n);
+				expected.erase(key);
+				store.Delete(key);
+			}
+			ok = ok && (! store.PutIfNew("Item 2"s, MakeValue(2000, 10U))) && Check(store, expected);
+		}
+		{
+			SimpleKVStore store(storePath, storeLog);
+			ok = ok && Check(store, expected);
+		}
+		allOK = Report("Replay after clean close", ok) && allOK;
+
+		//Torn and corrupt journal tails - the damaged last record is dropped, and new records written after it are replayed next time
+		auto DamagedTailCase = [&](bool Corrupt) {
+			{
+				SimpleKVStore store(storePath, storeLog);
+				store.Put("Last Item"s, MakeValue(7, 100U));
+			}
+			std::vector<uint32_t> gens = StoreFileIDs("Journal"s);
+			if (gens.empty())
+				return false;
+			std::filesystem::path journalPath = StoreFile(".Journal."s + std::to_string(gens.back()));
+			std::vector<uint8_t> journal;
+			if ((! Handy::TryReadFile(journalPath, journal)) || (journal.size() < 16U))
+				return false;
+			if (Corrupt)
+				journal[journal.size() - 10U] ^= 0x5AU;
+			else
+				journal.resize(journal.size() - 3U);
+			std::ofstream(journalPath, std::ios::binary | std::ios::trunc).write((char const *) journal.data(), journal.size());
+
+			std::string newKey = Corrupt ? "After Corrupt Tail"s : "After Torn Tail"s;
+			bool ok = true;
+			{
+				SimpleKVStore store(storePath, storeLog);
+				ok = Check(store, expected);
+				expected[newKey] = MakeValue(8, 200U);
+				ok = store.Put(newKey, expected[newKey]) && ok;
+			}
+			SimpleKVStore store(storePath, storeLog);
+			return Check(store, expected) && ok;
+		};
+		allOK = Report("Torn journal tail", DamagedTailCase(false)) && allOK;
+		allOK = Report("Corrupt journal tail", DamagedTailCase(true)) && allOK;
+
+		//Generation rollover: once the journal passes the checkpoint threshold the background thread starts a new generation, writes a
+		//checkpoint for it, and removes the older files. Long keys make the journal big without writing much value data.
+		ok = true;
+		{
+			SimpleKVStore store(storePath, storeLog);
+			std::vector<uint32_t> startGens = StoreFileIDs("Journal"s);
+			uint32_t startGen = startGens.empty() ? 0U : startGens.back();
+			std::string longKey(60000U, 'K');
+			for (int n = 0; n < 1200; n++) {
+				std::string key = longKey + std::to_string(n % 8);
+				expected[key] = MakeValue(n + 3000, 16U);
+				ok = store.Put(key, expected[key]) && ok;
+			}
+			bool rolledOver = false;
+			for (int n = 0; (n < 200) && (! rolledOver); n++) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				std::vector<uint32_t> journalGens    = StoreFileIDs("Journal"s);
+				std::vector<uint32_t> checkpointGens = StoreFileIDs("Checkpoint"s);
+				rolledOver = (journalGens.size() == 1U) && (journalGens[0] > startGen) &&
+				             (checkpointGens.size() == 1U) && (checkpointGens[0] == journalGens[0]);
+			}
+			ok = ok && rolledOver && Check(store, expected);
+			expected["After Rollover"s] = MakeValue(9, 300U);
+			ok = store.Put("After Rollover"s, expected["After Rollover"s]) && ok;
+		}
+		{
+			SimpleKVStore store(storePath, storeLog);
+			ok = ok && Check(store, expected);
+		}
+		allOK = Report("Checkpoint and generation rollover", ok) && allOK;
+
+		//Items whose values file has gone missing are dropped - and stay dropped if a values file with the same ID shows up later
+		ResetStore();
+		expected.clear();
+		ok = true;
+		{
+			SimpleKVStore store(storePath, storeLog);
+			for (int n = 0; n < 200; n++)
+				ok = store.Put("Sealed "s + std::to_string(n), MakeValue(n + 4000, 1000U)) && ok;
+		}
+		std::ofstream(StoreFile(".Values.1"s), std::ios::binary); //The newest values file is the active one, so this seals segment 0
+		{
+			SimpleKVStore store(storePath, storeLog);
+			for (int n = 0; n < 100; n++) {
+				std::string key = "Active "s + std::to_string(n);
+				expected[key] = MakeValue(n + 5000, 1000U);
+				ok = store.Put(key, expected[key]) && ok;
+			}
+		}
+		std::filesystem::remove(StoreFile(".Values.0"s), ec);
+		{
+			SimpleKVStore store(storePath, storeLog);
+			ok = ok && Check(store, expected);
+		}
+		{
+			std::vector<uint8_t> junk = MakeValue(6000, 1U << 20);
+			std::ofstream(StoreFile(".Values.0"s), std::ios::binary).write((char const *) junk.data(), junk.size());
+		}
+		{
+			SimpleKVStore store(storePath, storeLog);
+			ok = ok && Check(store, expected);
+		}
+		allOK = Report("Items with missing values dropped durably", ok) && allOK;
+
+		//Compaction of a sealed segment while other threads put, get and delete items
+		ResetStore();
+		expected.clear();
+		ok = true;
+		{
+			SimpleKVStore store(storePath, storeLog);
+			for (int n = 0; n < 4000; n++) {
+				std::string key = "Item "s + std::to_string(n);
+				expected[key] = MakeValue(n, 4000U + (n*7919) % 8000);
+				ok = store.Put(key, expected[key]) && ok;
+			}
+		}
+		std::ofstream(StoreFile(".Values.1"s), std::ios::binary);
+		std::vector<std::tuple<std::shared_ptr<uint8_t const>, uint64_t, std::vector<uint8_t>>> views; //Data, Size, and value at the time
+		{
+			SimpleKVStore store(storePath, storeLog);
+
+			//Views of items that are about to be replaced or deleted, and then compacted - they must keep the values they were taken with
+			for (int n = 0; n < 4000; n += 97) {
+				std::string key = "Item "s + std::to_string(n);
+				std::shared_ptr<uint8_t const> data;
+				uint64_t size = 0U;
+				ok = store.GetView(key, data, size) && ok;
+				views.emplace_back(data, size, expected[key]);
+				if (n % 2 == 1) {
+					expected[key] = MakeValue(n + 20000, 3000U);
+					ok = store.Put(key, expected[key]) && ok;
+				}
+			}
+			for (int n = 0; n < 4000; n += 2) {
+				std::string key = "Item "s + std::to_string(n);
+				expected.erase(key);
+				store.Delete(key);
+			}
+
+			//Each thread has its own keys to change, and reads the items left over from the sealed segment (which nothing changes)
+			int const numThreads = 4;
+			std::vector<Contents> threadExpected(numThreads);
+			std::atomic<bool> stop(false);
+			std::atomic<int>  numErrors(0);
+			std::atomic<int>  numOps(0);
+			std::vector<std::thread> threads;
+			for (int t = 0; t < numThreads; t++) {
+				threads.emplace_back([&, t]() {
+					std::mt19937 gen(28U + t);
+					std::uniform_int_distribution<int> keyDist(0, 199);
+					std::uniform_int_distribution<int> sharedDist(0, 1999);
+					std::uniform_int_distribution<int> opDist(0, 3);
+					std::vector<uint8_t> value;
+					Contents & mine(threadExpected[t]);
+					for (uint32_t n = 0U; ! stop; n++) {
+						std::string key = "Thread "s + std::to_string(t) + " Item "s + std::to_string(keyDist(gen));
+						switch (opDist(gen)) {
+							case 0:
+								mine[key] = MakeValue(100000U*(t + 1) + n, 1000U + n % 3000U);
+								if (! store.Put(key, mine[key]))
+									numErrors++;
+								break;
+							case 1:
+								mine.erase(key);
+								store.Delete(key);
+								break;
+							case 2:
+								if (store.Get(key, value) != (mine.count(key) > 0U))
+									numErrors++;
+								else if ((mine.count(key) > 0U) && (value != mine[key]))
+									numErrors++;
+								break;
+							default: {
+								std::string sharedKey = "Item "s + std::to_string(2*sharedDist(gen) + 1);
+								if ((! store.Get(sharedKey, value)) || (value != expected.at(sharedKey)))
+									numErrors++;
+								break;
+							}
+						}
+						numOps++;
+					}
+				});
+			}
+			std::chrono::time_point<std::chrono::steady_clock> T0 = std::chrono::steady_clock::now();
+			auto SecondsSince = [](std::chrono::time_point<std::chrono::steady_clock> T) {
+				return std::chrono::duration<double>(std::chrono::steady_clock::now() - T).count();
+			};
+			bool compacted = false;
+			while ((SecondsSince(T0) < 60.0) && ((! compacted) || (numOps < 20000))) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				compacted = ! std::filesystem::exists(StoreFile(".Values.0"s));
+			}
+			stop = true;
+			for (std::thread & thread : threads)
+				thread.join();
+			for (Contents const & mine : threadExpected)
+				expected.insert(mine.begin(), mine.end());
+			std::cerr << "Compaction took " << SecondsSince(T0) << " s alongside " << numOps << " operations from " << numThreads << " threads (" <<
+			             numErrors << " errors)\r\n";
+			ok = ok && compacted && (numErrors == 0) && Check(store, expected);
+		}
+		{
+			SimpleKVStore store(storePath, storeLog);
+			ok = ok && Check(store, expected);
+		}
+		allOK = Report("Compaction with concurrent access", ok) && allOK;
+
+		//The views outlive the replacements, deletions, compaction, and even the store
+		bool viewsOK = true;
+		for (auto const & view : views) {
+			std::vector<uint8_t> const & value(std::get<2>(view));
+			viewsOK = viewsOK && (std::get<1>(view) == value.size()) && (std::memcmp(std::get<0>(view).get(), value.data(), value.size()) == 0);
+		}
+		allOK = Report("GetView views after replace and compaction", viewsOK) && allOK;
+
+		//Conversion from the old two-file format - cleanly, after a crash that left the values file renamed but no checkpoint, and after a
+		//crash while the checkpoint was being written
+		for (int scenario = 0; scenario < 3; scenario++) {
+			ResetStore();
+			expected.clear();
+			std::vector<uint8_t> keysFile, valuesFile;
+			for (int n = 0; n < 300; n++) {
+				std::string key = "Legacy "s + std::to_string(n);
+				expected[key] = MakeValue(n + 7000, 100U + n*13);
+				uint16_t keyLength = (uint16_t) key.size();
+				uint64_t offset    = valuesFile.size();
+				uint64_t length    = expected[key].size();
+				keysFile.insert(keysFile.end(), (uint8_t const *) &keyLength, (uint8_t const *) &keyLength + 2);
+				keysFile.insert(keysFile.end(), key.begin(), key.end());
+				keysFile.insert(keysFile.end(), (uint8_t const *) &offset, (uint8_t const *) &offset + 8);
+				keysFile.insert(keysFile.end(), (uint8_t const *) &length, (uint8_t const *) &length + 8);
+				valuesFile.insert(valuesFile.end(), expected[key].begin(), expected[key].end());
+			}
+			std::ofstream(StoreFile(".Keys"s),   std::ios::binary).write((char const *) keysFile.data(),   keysFile.size());
+			std::ofstream(StoreFile(".Values"s), std::ios::binary).write((char const *) valuesFile.data(), valuesFile.size());
+			if (scenario >= 1)
+				std::filesystem::rename(StoreFile(".Values"s), StoreFile(".Values.0"s), ec);
+			if (scenario == 2)
+				std::ofstream(StoreFile(".Checkpoint.1.tmp"s), std::ios::binary).write((char const *) keysFile.data(), keysFile.size()/2U);
+
+			ok = true;
+			{
+				SimpleKVStore store(storePath, storeLog);
+				ok = Check(store, expected);
+				expected["Converted"s] = MakeValue(8000, 500U);
+				ok = store.Put("Converted"s, expected["Converted"s]) && ok;
+			}
+			ok = ok && (! std::filesystem::exists(StoreFile(".Keys"s))) && (! std::filesystem::exists(StoreFile(".Values"s))) &&
+			     (! std::filesystem::exists(StoreFile(".Checkpoint.1.tmp"s)));
+			{
+				SimpleKVStore store(storePath, storeLog);
+				ok = ok && Check(store, expected);
+			}
+			char const * names[3] = {"Legacy store conversion", "Legacy store conversion - crash after renaming values file",
+			                         "Legacy store conversion - crash while writing checkpoint"};
+			allOK = Report(names[scenario], ok) && allOK;
+		}
+
+		//PutBatch(), and GetView()
+		ResetStore();
+		expected.clear();
+		ok = true;
+		std::filesystem::path crashCopyDir = testDir / "Crash Copy";
+		{
+			SimpleKVStore store(storePath, storeLog);
+			for (int n = 0; n < 50; n++) {
+				std::string key = "Batch "s + std::to_string(n);
+				expected[key] = MakeValue(n + 9000, 700U);
+				ok = store.Put(key, expected[key]) && ok;
+			}
+			std::vector<std::pair<std::string, std::vector<uint8_t>>> items;
+			for (int n = 0; n < 150; n++)
+				items.emplace_back("Batch "s + std::to_string(n), MakeValue(n + 10000, 1U + (n*101) % 3000));
+			items.emplace_back(std::string(), MakeValue(1, 10U)); //Invalid key - skipped
+			ok = ok && (store.PutBatch(items, true) == 100U);
+			for (int n = 50; n < 150; n++)
+				expected[items[n].first] = items[n].second;
+			ok = ok && (store.PutBatch(items, true) == 0U) && Check(store, expected);
+			for (int n = 0; n < 150; n++) {
+				items[n].second = MakeValue(n + 11000, 1U + (n*211) % 3000);
+				expected[items[n].first] = items[n].second;
+			}
+			ok = ok && (store.PutBatch(items, false) == 150U) && Check(store, expected);
+
+			//A batch is durable when PutBatch() returns - a copy of the files taken now is what a crash would leave behind
+			std::filesystem::copy(storeDir, crashCopyDir, std::filesystem::copy_options::recursive, ec);
+			ok = ok && (! ec);
+		}
+		{
+			SimpleKVStore store(crashCopyDir / storePath.filename(), storeLog);
+			ok = ok && Check(store, expected);
+		}
+		allOK = Report("PutBatch", ok) && allOK;
+
+		ok = true;
+		{
+			SimpleKVStore store(storePath, storeLog);
+			for (auto const & kv : expected) {
+				std::shared_ptr<uint8_t const> data;
+				uint64_t size = 0U;
+				ok = ok && store.GetView(kv.first, data, size) && (size == kv.second.size()) && (std::memcmp(data.get(), kv.second.data(), size) == 0);
+			}
+			std::shared_ptr<uint8_t const> data;
+			uint64_t size = 0U;
+			ok = ok && (! store.GetView("Missing"s, data, size));
+
+			//Cut the active values file in half behind the store's back - views of the values that are gone must fail (not fault)
+			std::vector<uint32_t> segmentIDs = StoreFileIDs("Values"s);
+			std::filesystem::path valuesPath = StoreFile(".Values."s + std::to_string(segmentIDs.empty() ? 0U : segmentIDs.back()));
+			std::filesystem::resize_file(valuesPath, std::filesystem::file_size(valuesPath, ec) / 2U, ec);
+			int numGone = 0;
+			for (auto const & kv : expected) {
+				if (store.GetView(kv.first, data, size))
+					ok = ok && (size == kv.second.size()) && (std::memcmp(data.get(), kv.second.data(), size) == 0);
+				else
+					numGone++;
+			}
+			ok = ok && (numGone > 0) && (numGone < (int) expected.size());
+		}
+		allOK = Report("GetView", ok) && allOK;
+	}
+
+	std::filesystem::remove_all(testDir, ec);
+	return allOK;
+}
+
+//Maps: Tile request queue ordering, eviction, dedup and stale-cancel. Runs a single-worker TileRequestQueue whose worker is held up by a gate
+//job while requests are submitted, then checks which jobs ran, in what order, and with what priority.
+static bool TestBench29(std::string const & Arg) {
+	using Queue = Maps::TileRequestQueue<int>;
+	std::mutex ranMutex;
+	std::vector<std::tuple<int, double>> ran; //Key and priority of each job, in the order they ran
+	auto MakeJob = [&](int K) {
+		return [&, K](double Priority) {
+			std::scoped_lock lock(ranMutex);
+			ran.emplace_back(K, Priority);
+		};
+	};
+
+	bool ok = true;
+	{
+		Queue queue(1U, 8U, 4U); //1 worker, at most 8 requests outstanding, at most 4 pending prefetches
+		std::promise<void> gateStarted, gateRelease;
+		std::shared_future<void> release = gateRelease.get_future().share();
+		queue.Submit(0, 10.0, [&, release](double Priority) {
+			MakeJob(0)(Priority);
+			gateStarted.set_value();
+			release.wait();
+		});
+		gateStarted.get_future().wait();
+
+		//Ordering: highest priority first, most recently submitted first among equal priorities
+		ok = queue.Submit(1, 2.0, MakeJob(1)) && queue.Submit(2, 3.0, MakeJob(2)) && queue.Submit(3, 2.0, MakeJob(3)) && ok;
+
+		//Dedup: re-submitting a pending request only re-queues it (as the most recent), and running requests can't be submitted again
+		ok = (! queue.Submit(1, 2.0, MakeJob(1))) && (! queue.Submit(0, 10.0, MakeJob(0))) && ok;
+
+		//Prefetches get a limited share of the queue
+		for (int K = 10; K < 14; K++)
+			ok = queue.Submit(K, 0.5, MakeJob(K)) && ok;
+		ok = (! queue.Submit(14, 0.5, MakeJob(14))) && (queue.NumOutstanding() == 8U) && ok;
+		std::cerr << "Ordering, dedup and prefetch limit: " << (ok ? "OK" : "FAILED") << "\r\n";
+
+		//Eviction: a demand request for a full queue evicts the least important prefetch (lowest priority, then least recent)
+		bool evictOK = queue.Submit(4, 2.0, MakeJob(4)) && (! queue.IsOutstanding(10)) && (queue.NumOutstanding() == 8U);
+		evictOK = evictOK && (! queue.Submit(5, 0.9, MakeJob(5))); //A prefetch can't evict anything
+		std::cerr << "Prefetch eviction: " << (evictOK ? "OK" : "FAILED") << "\r\n";
+
+		//Upgrades and downgrades: a prefetch upgraded to a demand request runs (and is told it runs) at the demand priority, and a prefetch
+		//re-submitted at a lower prefetch priority takes the new priority
+		ok = (! queue.Submit(11, 5.0, MakeJob(11))) && (! queue.Submit(12, 0.2, MakeJob(12))) && evictOK && ok;
+
+		//Stale-cancel: only prefetches that haven't been re-submitted since the cutoff are dropped - demand requests are never dropped
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		Queue::TimePoint cutoff = std::chrono::steady_clock::now();
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		queue.Submit(13, 0.5, MakeJob(13));
+		size_t numCancelled = queue.CancelStalePrefetches(cutoff);
+		bool cancelOK = (numCancelled == 1U) && (! queue.IsOutstanding(12)) && queue.IsOutstanding(13) && queue.IsOutstanding(11);
+		std::cerr << "Stale prefetch cancellation: " << (cancelOK ? "OK" : "FAILED") << " (" << numCancelled << " cancelled)\r\n";
+		ok = ok && cancelOK;
+
+		gateRelease.set_value();
+		queue.Wait();
+		ok = ok && (queue.NumOutstanding() == 0U);
+
+		//Once a job has run its key can be requested again
+		ok = queue.Submit(1, 2.0, MakeJob(1)) && ok;
+		queue.Wait();
+	}
 
+	std::vector<std::tuple<int, double>> expected = { {0, 10.0}, {11, 5.0}, {2, 3.0}, {4, 2.0}, {1, 2.0}, {3, 2.0}, {13, 0.5}, {1, 2.0} };
+	bool orderOK = (ran == expected);
+	std::cerr << "Run order and priorities: " << (orderOK ? "OK" : "FAILED") << "\r\n";
+	for (auto const & job : ran)
+		std::cerr << "  Key " << std::get<0>(job) << " at priority " << std::get<1>(job) << "\r\n";
+	return ok && orderOK;
+}
 
+//Maps: Tile seeding. Checks tile enumeration (GetTilesCoveringAABB() and both versions of TileSeeder::EnumerateTiles()) and URL templates,
+//then seeds a small box near Lamberton into a scratch cache file from a fake tile server and checks the tile counts, failures and retries,
+//that a second run skips the tiles that are already cached, cancellation, and the cache file's batch insert.
+static bool TestBench30(std::string const & Arg) {
+	Eigen::Vector2d center_LL = PI/180.0*Eigen::Vector2d(44.2380, -95.2990); //Near Lamberton, MN
+	double metersPerRadLat = 6371000.0;
+	double metersPerRadLon = 6371000.0*std::cos(center_LL(0));
+	auto ENToNM = [&](double East, double North) { return LatLonToNM(center_LL + Eigen::Vector2d(North/metersPerRadLat, East/metersPerRadLon)); };
+	Eigen::Vector2d LL_NM = ENToNM(-1500.0, -1500.0);
+	Eigen::Vector2d UR_NM = ENToNM( 1500.0,  1500.0);
+	Eigen::Vector4d AABB_NM(LL_NM(0), UR_NM(0), LL_NM(1), UR_NM(1));
+	int32_t const minZoom = 10;
+	int32_t const maxZoom = 16;
+	auto Report = [](char const * Name, bool OK) {
+		std::cerr << Name << ": " << (OK ? "OK" : "FAILED") << "\r\n";
+		return OK;
+	};
+	auto ZoomOrder = [](Maps::Tile const & A, Maps::Tile const & B) { return A.Zoom < B.Zoom; };
+	bool allOK = true;
+
+	//URL templates
+	bool urlOK = (Maps::TileSeeder::FormatTileURL("http://tiles/{z}/{x}/{y}.png?z={z}"s, Maps::Tile(5, 7, 3)) == "http://tiles/3/5/7.png?z=3"s);
+	urlOK = urlOK && (Maps::TileSeeder::FormatTileURL("http://tiles/{y}{x}"s, Maps::Tile(123, 45, 9)) == "http://tiles/45123"s);
+	urlOK = urlOK && (Maps::TileSeeder::FormatTileURL("no fields"s, Maps::Tile(5, 7, 3)) == "no fields"s);
+	allOK = Report("URL templates", urlOK) && allOK;
+
+	//Enumeration over the box: every tile in the covering range of each level, coarsest level first, and nothing else
+	std::vector<Maps::Tile> tiles;
+	bool boxOK = Maps::TileSeeder::EnumerateTiles(AABB_NM, minZoom, maxZoom, tiles);
+	size_t expectedCount = 0U;
+	for (int32_t level = minZoom; level <= maxZoom; level++) {
+		auto [XMin, XMax, YMin, YMax] = GetTileRangeCoveringAABB(AABB_NM, level);
+		expectedCount += size_t(XMax - XMin + 1)*size_t(YMax - YMin + 1);
+	}
+	std::unordered_set<Maps::Tile> boxTiles(tiles.begin(), tiles.end());
+	boxOK = boxOK && (tiles.size() == expectedCount) && (boxTiles.size() == tiles.size()) && std::is_sorted(tiles.begin(), tiles.end(), ZoomOrder);
+	for (Maps::Tile const & tile : tiles) {
+		auto [XMin, XMax, YMin, YMax] = GetTileRangeCoveringAABB(AABB_NM, tile.Zoom);
+		boxOK = boxOK && (tile.Zoom >= minZoom) && (tile.Zoom <= maxZoom) && (tile.Xi >= XMin) && (tile.Xi <= XMax) && (tile.Yi >= YMin) && (tile.Yi <= YMax);
+	}
+
+	//Bad arguments and jobs that are too big are refused
+	std::vector<Maps::Tile> refused;
+	Eigen::Vector4d world(-1.0, 1.0, -1.0, 1.0);
+	boxOK = boxOK && (! Maps::TileSeeder::EnumerateTiles(AABB_NM, 12, 11, refused)) && refused.empty();
+	boxOK = boxOK && (! Maps::TileSeeder::EnumerateTiles(AABB_NM, -1, 11, refused)) && refused.empty();
+	boxOK = boxOK && (! Maps::TileSeeder::EnumerateTiles(AABB_NM, 10, Maps::TileSeeder::MaxSeedZoom + 1, refused)) && refused.empty();
+	boxOK = boxOK && (! Maps::TileSeeder::EnumerateTiles(world, 0, Maps::TileSeeder::MaxSeedZoom, refused)) && refused.empty();
+	boxOK = boxOK && (! GetTilesCoveringAABB(world, 12, 1000U, refused)) && refused.empty();
+	boxOK = boxOK && GetTilesCoveringAABB(world, 2, 16U, refused) && (refused.size() == 16U);
+	std::cerr << "Box covers " << tiles.size() << " tiles on levels " << minZoom << " - " << maxZoom << "\r\n";
+	allOK = Report("Tile enumeration over a box", boxOK) && allOK;
+
+	//Enumeration over a region - a triangle filling the lower-left half of the box. It needs fewer tiles than the box, always includes the
+	//tile under a point inside the triangle, and leaves out the tile under a point well outside of it once tiles are small enough.
+	PolygonCollection region;
+	region.m_components.emplace_back();
+	std::Evector<Eigen::Vector2d> vertices = { ENToNM(-1500.0, -1500.0), ENToNM(1500.0, -1500.0), ENToNM(-1500.0, 1500.0) };
+	region.m_components.back().m_boundary.SetBoundary(vertices);
+	std::vector<Maps::Tile> regionTiles;
+	bool regionOK = Maps::TileSeeder::EnumerateTiles(region, minZoom, maxZoom, regionTiles);
+	std::unordered_set<Maps::Tile> regionTileSet(regionTiles.begin(), regionTiles.end());
+	regionOK = regionOK && (regionTiles.size() < tiles.size()) && (regionTileSet.size() == regionTiles.size()) &&
+	           std::is_sorted(regionTiles.begin(), regionTiles.end(), ZoomOrder);
+	Eigen::Vector2d inside_NM  = ENToNM(-1000.0, -1000.0);
+	Eigen::Vector2d outside_NM = ENToNM( 1300.0,  1300.0);
+	for (int32_t level = minZoom; level <= maxZoom; level++) {
+		auto [insideX,  insideY]  = getCoordsOfTileContainingPoint(inside_NM,  level);
+		auto [outsideX, outsideY] = getCoordsOfTileContainingPoint(outside_NM, level);
+		regionOK = regionOK && (regionTileSet.count(Maps::Tile(insideX, insideY, level)) > 0U);
+		if (level >= 15) //Tiles here are under 900 m wide, and the point is over 1800 m from the triangle
+			regionOK = regionOK && (regionTileSet.count(Maps::Tile(outsideX, outsideY, level)) == 0U);
+	}
+	std::cerr << "Triangle covers " << regionTiles.size() << " tiles\r\n";
+	allOK = Report("Tile enumeration over a region", regionOK) && allOK;
 
+	std::filesystem::path testDir = std::filesystem::temp_directory_path() / "Recon Tile Seeding Test";
+	std::error_code ec;
+	std::filesystem::remove_all(testDir, ec);
+	std::filesystem::create_directories(testDir, ec);
+	{
+		Journal seedLog(testDir / "Log.txt", &std::cerr, false);
+		Maps::CacheFile cache(nullptr, seedLog, testDir / "SatCache");
+		Maps::SatelliteSource const source = Maps::SatelliteSource::OSMPublicServer;
+		std::string const URLTemplate = "fake://{z}/{x}/{y}"s;
+
+		//The fake tile server: the body of a tile is its URL. Tiles with (X + Y) % 11 == 0 don't exist (404), and the first request for a tile
+		//with (X + 2Y) % 13 == 0 fails (so the seeder has to retry it).
+		std::mutex serverMutex;
+		std::unordered_map<std::string, int> requestCounts;
+		auto IsMissing   = [](Maps::Tile const & T) { return (T.Xi + T.Yi) % 11 == 0; };
+		auto IsFlaky     = [](Maps::Tile const & T) { return (T.Xi + 2*T.Yi) % 13 == 0; };
+		auto FakeServer = [&](std::string const & URL, std::vector<uint8_t> & Data) {
+			Data.clear();
+			Maps::Tile tile;
+			if (std::sscanf(URL.c_str(), "fake://%d/%d/%d", &tile.Zoom, &tile.Xi, &tile.Yi) != 3)
+				return 404;
+			int requestNum = 0;
+			{
+				std::scoped_lock lock(serverMutex);
+				requestNum = ++requestCounts[URL];
+			}
+			if (IsMissing(tile))
+				return 404;
+			if (IsFlaky(tile) && (requestNum == 1))
+				return -42;
+			Data.assign(URL.begin(), URL.end());
+			return 200;
+		};
+		size_t numMissing = (size_t) std::count_if(tiles.begin(), tiles.end(), IsMissing);
+
+		Maps::TileSeeder::Progress first;
+		{
+			Maps::TileSeeder seeder(cache, source, tiles, seedLog, 4U, URLTemplate, FakeServer);
+			seeder.Wait();
+			first = seeder.GetProgress();
+		}
+		bool seedOK = first.Done && (! first.Cancelled) && (first.TilesTotal == tiles.size()) && (first.TilesCached == 0U) &&
+		              (first.TilesFailed == numMissing) && (first.TilesFetched == tiles.size() - numMissing) && (first.TilesWritten == first.TilesFetched) &&
+		              (cache.GetNumItems() == first.TilesFetched);
+		for (Maps::Tile const & tile : tiles) {
+			std::string URL = Maps::TileSeeder::FormatTileURL(URLTemplate, tile);
+			std::shared_ptr<uint8_t const> data;
+			size_t size = 0U;
+			bool cached = cache.BlockTryGet(tile, source, data, size);
+			seedOK = seedOK && (cached == (! IsMissing(tile)));
+			if (cached)
+				seedOK = seedOK && (std::string((char const *) data.get(), size) == URL);
+			if (IsFlaky(tile) && (! IsMissing(tile)))
+				seedOK = seedOK && (requestCounts[URL] == 2);
+		}
+		std::cerr << first.TilesFetched << " tiles downloaded, " << first.TilesFailed << " missing, in " << first.ElapsedSeconds << " s\r\n";
+		allOK = Report("Seeding from a fake server", seedOK) && allOK;
+
+		//Running the job again skips the cached tiles - only the missing tiles are requested again
+		requestCounts.clear();
+		Maps::TileSeeder::Progress second;
+		{
+			Maps::TileSeeder seeder(cache, source, tiles, seedLog, 4U, URLTemplate, FakeServer);
+			seeder.Wait();
+			second = seeder.GetProgress();
+		}
+		bool resumeOK = second.Done && (second.TilesCached == first.TilesFetched) && (second.TilesFetched == 0U) && (second.TilesFailed == numMissing) &&
+		                (requestCounts.size() == numMissing) && (cache.GetNumItems() == first.TilesFetched);
+		allOK = Report("Second run skips cached tiles", resumeOK) && allOK;
+
+		//Cancellation - tiles downloaded before the cancel are still written to the cache
+		std::vector<Maps::Tile> bigJob;
+		bool cancelOK = Maps::TileSeeder::EnumerateTiles(AABB_NM, 17, 18, bigJob);
+		auto SlowServer = [](std::string const & URL, std::vector<uint8_t> & Data) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			Data.assign(URL.begin(), URL.end());
+			return 200;
+		};
+		Maps::TileSeeder::Progress cancelled;
+		{
+			Maps::TileSeeder seeder(cache, source, bigJob, seedLog, 4U, URLTemplate, SlowServer);
+			while (seeder.GetProgress().TilesProcessed() < 40U)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			seeder.Cancel();
+			seeder.Wait();
+			cancelled = seeder.GetProgress();
+		}
+		cancelOK = cancelOK && cancelled.Done && cancelled.Cancelled && (cancelled.TilesProcessed() < cancelled.TilesTotal) &&
+		           (cancelled.TilesWritten == cancelled.TilesFetched) && (cache.GetNumItems() == first.TilesFetched + cancelled.TilesFetched);
+		std::cerr << "Cancelled after " << cancelled.TilesProcessed() << " of " << cancelled.TilesTotal << " tiles\r\n";
+		allOK = Report("Cancellation", cancelOK) && allOK;
+
+		//The batch insert skips tiles that are already cached and leaves them alone
+		std::vector<std::tuple<Maps::Tile, std::vector<uint8_t>>> batch;
+		for (size_t n = 0U; (n < tiles.size()) && (batch.size() < 10U); n++) {
+			if (! IsMissing(tiles[n]))
+				batch.emplace_back(tiles[n], std::vector<uint8_t>(3U, 0U));
+		}
+		for (int32_t n = 0; n < 5; n++)
+			batch.emplace_back(Maps::Tile(n, 0, 19), std::vector<uint8_t>(3U, uint8_t(n)));
+		bool batchOK = (cache.BlockAddBatch(source, batch) == 5U) && (cache.GetNumItems() == first.TilesFetched + cancelled.TilesFetched + 5U);
+		for (auto const & item : batch) {
+			std::shared_ptr<uint8_t const> data;
+			size_t size = 0U;
+			Maps::Tile tile = std::get<0>(item);
+			bool isNew = (tile.Zoom == 19);
+			batchOK = batchOK && cache.BlockTryGet(tile, source, data, size) &&
+			          (isNew ? (std::memcmp(data.get(), std::get<1>(item).data(), 3U) == 0) && (size == 3U) :
+			                   (std::string((char const *) data.get(), size) == Maps::TileSeeder::FormatTileURL(URLTemplate, tile)));
+		}
+		allOK = Report("Batch insert", batchOK) && allOK;
+	}
+	std::filesystem::remove_all(testDir, ec);
+	return allOK;
+}
@@ -18,26 +18,29 @@ namespace TestBenches {
 		/*  5 */ "Survey Regions: Create Sample Minneapolis Region",
 		/*  6 */ "Guidance: EstimateMissionTime() - Between 2 points",
 		/*  7 */ "Guidance: Internal test bench - no documentation",
-		/*  8 */ "Guidance: Internal test bench - no documentation",
-		/*  9 */ "Guidance: Internal test bench - no documentation",
-		/* 10 */ "Guidance: Cut polygon tests for region partitioning",
+		/*  8 */ "Guidance: Mission planning, shadow check and sub-region selection benchmark",
+		/*  9 */ "Guidance: Multi-drone sub-region sequencing (anytime solver) benchmark",
+		/* 10 */ "Guidance: Cut polygon and region partitioning tests",
 		/* 11 */ "Shadow Detection: Non-realtime simulation",
 		/* 12 */ "Shadow Detection: Realtime simulation",
-		/* 13 */ "Shadow Detection: ",
-		/* 14 */ "Shadow Detection: ",
-		/* 15 */ "Shadow Detection: ",
+		/* 13 */ "Shadow Detection: Shadow map fan-out copy benchmark",
+		/* 14 */ "Shadow Detection: Shadow map history RLE and spill/reload round trip",
+		/* 15 */ "Shadow Detection: Stabilization keypoint matching vs. brute-force cross-check",
 		/* 16 */ "Shadow Propagation: Non-realtime simulation",
 		/* 17 */ "Shadow Propagation: Realtime simulation",
-		/* 18 */ "Shadow Propagation: ",
-		/* 19 */ "Shadow Propagation: ",
-		/* 20 */ "Shadow Propagation: ",
+		/* 18 */ "Shadow Propagation: Contour flow boundary matching benchmark",
+		/* 19 */ "Shadow Propagation: Compiled polygon region query benchmark",
+		/* 20 */ "Maps: Local tangent plane conversion error bounds",
 		/* 21 */ "DJI Drone Interface: Simulated Drone Imagery (Non-Realtime)",
 		/* 22 */ "DJI Drone Interface: Simulated Drone Imagery (Realtime)",
 		/* 23 */ "DJI Drone Interface: Serialization/Deserialization",
 		/* 24 */ "DJI Drone Interface: Compressed Image Test",
 		/* 25 */ "DJI Drone Interface: ",
 		/* 26 */ "TorchLib basic testbench",
-		/* 27 */ "Torchlib loading file"
+		/* 27 */ "Torchlib loading file",
+		/* 28 */ "Simple KV Store: Recovery, compaction, and legacy conversion",
+		/* 29 */ "Maps: Tile request queue ordering, eviction, dedup and stale-cancel",
+		/* 30 */ "Maps: Tile seeder enumeration, pipeline and resume"
 	};
 	
 	void RunTestBench(int TestNum, std::string const & TestBenchArg);
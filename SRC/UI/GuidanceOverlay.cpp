@@ -2,6 +2,9 @@
 //Author: Bryan Poling
 //Copyright (c) 2021 Sentek Systems, LLC. All rights reserved. 
 
+//System Includes
+#include <algorithm>
+
 //Project Includes
 #include "GuidanceOverlay.hpp"
 #include "MapWidget.hpp"
@@ -162,13 +165,17 @@ void GuidanceOverlay::Draw_Partition(Eigen::Vector2d const & CursorPos_NM, ImDra
 
 			if (CenteredLabels) {
 				//Draw if the text can be fully contained within the first component simple polygon (maybe overkill, but nice)
+				//The corners are tested in NM against the boundary compiled in the data setter instead of building a polygon each frame
 				Eigen::Vector2d Centroid_SS = GetCentroid(Vertices_SS);
-				SimplePolygon sp_SS(Vertices_SS);
-				Eigen::Vector2d p1 = Centroid_SS + Eigen::Vector2d(-0.5*textSize(0), -0.5*textSize(1));
-				Eigen::Vector2d p2 = Centroid_SS + Eigen::Vector2d(-0.5*textSize(0),  0.5*textSize(1));
-				Eigen::Vector2d p3 = Centroid_SS + Eigen::Vector2d( 0.5*textSize(0), -0.5*textSize(1));
-				Eigen::Vector2d p4 = Centroid_SS + Eigen::Vector2d( 0.5*textSize(0),  0.5*textSize(1));
-				if (sp_SS.ContainsPoint(p1) && sp_SS.ContainsPoint(p2) && sp_SS.ContainsPoint(p3) && sp_SS.ContainsPoint(p4))
+				CompiledPolygonCollection const & labelRegion(m_PartitionLabelRegions[compIndex]);
+				std::Evector<Eigen::Vector2d> corners_NM;
+				corners_NM.reserve(4);
+				corners_NM.push_back(MapWidget::Instance().ScreenCoordsToNormalizedMercator(Centroid_SS + Eigen::Vector2d(-0.5*textSize(0), -0.5*textSize(1))));
+				corners_NM.push_back(MapWidget::Instance().ScreenCoordsToNormalizedMercator(Centroid_SS + Eigen::Vector2d(-0.5*textSize(0),  0.5*textSize(1))));
+				corners_NM.push_back(MapWidget::Instance().ScreenCoordsToNormalizedMercator(Centroid_SS + Eigen::Vector2d( 0.5*textSize(0), -0.5*textSize(1))));
+				corners_NM.push_back(MapWidget::Instance().ScreenCoordsToNormalizedMercator(Centroid_SS + Eigen::Vector2d( 0.5*textSize(0),  0.5*textSize(1))));
+				std::vector<uint8_t> cornersInRegion = labelRegion.ContainsPoints(corners_NM);
+				if (std::all_of(cornersInRegion.begin(), cornersInRegion.end(), [](uint8_t InRegion) { return InRegion != 0U; }))
 					MyGui::AddText(DrawList, Centroid_SS, IM_COL32(255, 255, 255, 255), label.c_str(), NULL, true, true);
 			}
 			else {
@@ -198,7 +205,7 @@ Eigen::Vector2d GuidanceOverlay::GetCentralPointForComponentOfPartition(size_t C
 	if (! vertices.empty())
 		centroid /= double(vertices.size());
 
-	return boundary.ProjectPoint(centroid);
+	return m_PartitionLabelRegions[CompIndex].ProjectPoint(centroid);
 }
 
 //Find the intersection of the line from A to B with the boundary of the first element of the given component.
@@ -409,12 +416,26 @@ void GuidanceOverlay::Draw_Overlay(Eigen::Vector2d const & CursorPos_NM, ImDrawL
 	}
 }
 
+//Compile the outer boundary of the first polygon of each partition component. These are used for label placement every frame.
+//Must be called with m_mutex held, after m_SurveyRegionPartition changes.
+void GuidanceOverlay::CompilePartitionLabelRegions(void) {
+	m_PartitionLabelRegions.clear();
+	m_PartitionLabelRegions.reserve(m_SurveyRegionPartition.size());
+	for (PolygonCollection const & comp : m_SurveyRegionPartition) {
+		if (comp.m_components.empty())
+			m_PartitionLabelRegions.emplace_back();
+		else
+			m_PartitionLabelRegions.emplace_back(Polygon(comp.m_components[0].m_boundary));
+	}
+}
+
 // Data Setters   ***************************************************************************************************************
 void GuidanceOverlay::Reset() {
 	std::scoped_lock lock(m_mutex);
 	m_SurveyRegionPartition.clear();
 	m_SurveyRegionPartitionTriangulation.clear();
 	m_PartitionLabels.clear();
+	m_PartitionLabelRegions.clear();
 	m_Triangles.clear();
 	m_TriangleLabels.clear();
 	m_Missions.clear();
@@ -433,6 +454,7 @@ void GuidanceOverlay::SetData_SurveyRegionPartition(std::Evector<PolygonCollecti
 		m_SurveyRegionPartitionTriangulation.push_back(triangles);
 	}
 	m_PartitionLabels.clear();
+	CompilePartitionLabelRegions();
 }
 
 void GuidanceOverlay::SetData_SurveyRegionPartition(std::Evector<PolygonCollection> const & Partition, std::vector<std::string> const & Labels) {
@@ -446,6 +468,7 @@ void GuidanceOverlay::SetData_SurveyRegionPartition(std::Evector<PolygonCollecti
 		m_SurveyRegionPartitionTriangulation.push_back(triangles);
 	}
 	m_PartitionLabels = Labels;
+	CompilePartitionLabelRegions();
 }
 
 void GuidanceOverlay::ClearData_SurveyRegionPartition(void) {
@@ -453,6 +476,7 @@ void GuidanceOverlay::ClearData_SurveyRegionPartition(void) {
 	m_SurveyRegionPartition.clear();
 	m_SurveyRegionPartitionTriangulation.clear();
 	m_PartitionLabels.clear();
+	m_PartitionLabelRegions.clear();
 }
 
 void GuidanceOverlay::SetData_Triangulation(std::Evector<Triangle> const & Triangles) {
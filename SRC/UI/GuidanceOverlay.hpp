@@ -13,6 +13,7 @@
 //Project Includes
 #include "../EigenAliases.h"
 #include "../Polygon.hpp"
+#include "../CompiledPolygon.hpp"
 #include "../Modules/DJI-Drone-Interface/Drone.hpp"
 
 class GuidanceOverlay {
@@ -21,6 +22,7 @@ class GuidanceOverlay {
 		std::Evector<PolygonCollection>      m_SurveyRegionPartition;
 		std::Evector<std::Evector<Triangle>> m_SurveyRegionPartitionTriangulation;
 		std::vector<std::string>             m_PartitionLabels;
+		std::Evector<CompiledPolygonCollection> m_PartitionLabelRegions; //Outer boundary of the first polygon of each partition component
 		
 		std::Evector<Triangle>   m_Triangles;
 		std::vector<std::string> m_TriangleLabels;
@@ -30,6 +32,7 @@ class GuidanceOverlay {
 		std::unordered_set<int> m_CompletedSubRegions;
 		
 		static ImU32 IndexToColor(size_t Index, size_t N, float Opacity);
+		void CompilePartitionLabelRegions(void);
 		void Draw_Partition(Eigen::Vector2d const & CursorPos_NM, ImDrawList * DrawList, bool CursorInBounds,
 		                    std::vector<ImU32> const & Colors, std::vector<std::string> const & Labels, bool CenteredLabels,
 		                    bool HideComponentsMarketComplete) const;
@@ -24,6 +24,7 @@
 #include "GNSSReceiverWindow.hpp"
 #include "LiveFiducialsWidget.hpp"
 #include "DJICommLinkAnalysisWindow.hpp"
+#include "TileSeedingWindow.hpp"
 
 class MainMenu {
 	public:
@@ -47,6 +48,11 @@ inline void MainMenu::Draw() {
 				ImExt::Window::FocusWindow("Settings");
 			}
 			
+			if (MyGui::MenuItem(u8"\uf019", labelMargin, "Seed Offline Tiles")) {
+				TileSeedingWindow::Instance().Visible = true;
+				ImExt::Window::FocusWindow("Offline Tile Seeding");
+			}
+			
 			if (MyGui::MenuItem(u8"\uf057", labelMargin, "Exit"))
 				ReconUI::Instance().DrawLoopEnabled = false;
 			ImGui::EndMenu();
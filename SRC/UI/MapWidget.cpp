@@ -12,6 +12,7 @@
 #include "VisWidget.hpp"
 #include "../Maps/SatelliteCacheMaster.hpp"
 #include "../Maps/DataTileProvider.hpp"
+#include "../Maps/TilePrefetcher.hpp"
 #include "../ProgOptions.hpp"
 #include "../Maps/MapUtils.hpp"
 #include "VehicleControlWidget.hpp"
@@ -144,6 +145,17 @@ void MapWidget::StartAnimation(Eigen::Vector2d const & LatBounds, Eigen::Vector2
 		std::tuple<Eigen::Vector2d, double> EndState   = GetMapLocationAndZoomForGivenLatLonBounds(LatBounds, LonBounds);
 		ComputeNavigationProfiles(StartState, EndState);
 		AnimationInProgress = true;
+		
+		//Have the tiles for the end of the animation loaded by the time we get there
+		if (Maps::TilePrefetcher::Instance() != nullptr) {
+			double endZoom = std::get<1>(EndState);
+			Eigen::Vector4d EndViewableAreaNM = GetViewableArea_NormalizedMercator(std::get<0>(EndState), MapWidgetDims, endZoom, tileWidth);
+			int32_t EndMaxTileZoomLevel = std::max((int32_t) ceil(endZoom + log2(ProgOptions::Instance()->MapDPIPercentage / 100.0)), 0);
+			int32_t EndDataTileZoomLevel = std::min(EndMaxTileZoomLevel, Maps::DataTileProvider::TileEditZoomLevel);
+			if (EndDataTileZoomLevel < Maps::DataTileProvider::DataTileMinZoomLevel)
+				EndDataTileZoomLevel = -1;
+			Maps::TilePrefetcher::Instance()->SetAnimationTarget(EndViewableAreaNM, std::min(EndMaxTileZoomLevel, 20), EndDataTileZoomLevel);
+		}
 	}
 }
 
@@ -176,6 +188,8 @@ bool MapWidget::Draw_NavigationAnimation(void) {
 			this->zoom = zoomProfile.back();
 			this->WindowULCorner_NormalizedMercator = panProfile.back();
 			AnimationInProgress = false;
+			if (Maps::TilePrefetcher::Instance() != nullptr)
+				Maps::TilePrefetcher::Instance()->ClearAnimationTarget();
 			return false;
 		}
 	}
@@ -442,11 +456,14 @@ void MapWidget::Draw(void) {
 	//Draw data tiles
 	VisWidget & visWidget(VisWidget::Instance());
 	bool someLayerVisible = visWidget.LayerVisible_MSA || visWidget.LayerVisible_AvoidanceZones || visWidget.LayerVisible_SafeLandingZones;
-	if (DrawDataTiles && someLayerVisible && (! AnimationInProgress)) {
-		int32_t RecDataTileZoomLevel = std::min(MaxTileZoomLevel, Maps::DataTileProvider::TileEditZoomLevel);
-		if (RecDataTileZoomLevel >= Maps::DataTileProvider::DataTileMinZoomLevel)
-			Draw_DataTiles(RecDataTileZoomLevel, ViewableAreaNM, draw_list);
-	}
+	int32_t RecDataTileZoomLevel = std::min(MaxTileZoomLevel, Maps::DataTileProvider::TileEditZoomLevel);
+	bool dataTilesShown = DrawDataTiles && someLayerVisible && (RecDataTileZoomLevel >= Maps::DataTileProvider::DataTileMinZoomLevel);
+	if (dataTilesShown && (! AnimationInProgress))
+		Draw_DataTiles(RecDataTileZoomLevel, ViewableAreaNM, draw_list);
+	
+	//Let the prefetcher know what we are looking at so it can load what we are likely to look at next
+	if (Maps::TilePrefetcher::Instance() != nullptr)
+		Maps::TilePrefetcher::Instance()->SetViewport(ViewableAreaNM, maxSatTileZoomLevel, dataTilesShown ? RecDataTileZoomLevel : -1);
 	
 	//std::cerr << "Sat Tiles Drawn: " << numSatTilesDrawn << "\r\n";
 	//std::cerr << "Data Tiles Drawn: " << numDataTilesDrawn << "\r\n";
@@ -23,6 +23,7 @@
 #include "LiveFiducialsWidget.hpp"
 #include "GNSSReceiverWindow.hpp"
 #include "DJICommLinkAnalysisWindow.hpp"
+#include "TileSeedingWindow.hpp"
 #include "../Utilities.hpp"
 
 #define PI 3.14159265358979
@@ -128,6 +129,7 @@ void ReconUI::Draw() {
 	LiveFiducialsWidget::Instance().Draw();
 	GNSSReceiverWindow::Instance().Draw();
 	DJICommLinkAnalysisWindow::Instance().Draw();
+	TileSeedingWindow::Instance().Draw();
 	
 	//Draw secondary non-singleton windows
 	DrawChildren();
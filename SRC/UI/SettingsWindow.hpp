@@ -283,7 +283,10 @@ inline void SettingsWindow::Draw() {
 			                       "iteratively merged into larger and larger regions until components of appropriate size are obtained. This is "
 			                       "very general, but can result in 'pointier', or more irregular-shaped components.\n\n"
 			                       "Iterated Cuts: Pieces of the survey region that are too large are repeatedly cut based on heuristics until pieces "
-			                       "of appropriate size are obtained.");
+			                       "of appropriate size are obtained.\n\n"
+			                       "Balanced Cuts: Like Iterated Cuts, but each cut is placed to split the piece into parts of the right areas, and "
+			                       "several cut directions are tried, keeping the one with the best estimated flight times. This avoids small slivers "
+			                       "that waste a sortie, at the cost of more computation.");
 			ImGui::PopTextWrapPos();
 			ImGui::EndTooltip();
 		}
@@ -293,7 +296,7 @@ inline void SettingsWindow::Draw() {
 		ImGui::PushItemWidth(sliderWidth);
 		{
 			ImExt::Style popupStyle(StyleVar::WindowPadding, Math::Vector2(4.0f, 4.0f));
-			ImGui::Combo("## Partitioning-Method-Combo", &(ProgOptions::Instance()->SurveyRegionPartitioningMethod), "Triangle Fusion\0Iterated Cuts\0");
+			ImGui::Combo("## Partitioning-Method-Combo", &(ProgOptions::Instance()->SurveyRegionPartitioningMethod), "Triangle Fusion\0Iterated Cuts\0Balanced Cuts\0");
 		}
 		ImGui::PopItemWidth();
 		ImGui::SameLine(col3Start);
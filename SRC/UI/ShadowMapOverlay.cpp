@@ -14,42 +14,75 @@
 
 ShadowMapOverlay::ShadowMapOverlay() {
 	m_callbackHandle = ShadowDetection::ShadowDetectionEngine::Instance().RegisterCallback([this](ShadowDetection::InstantaneousShadowMap const & NewMap) {
-		//Copy our visualization settings so we don't need to hold onto our mutex while we evaluate the texture
+		//Don't replace a recorded map we are showing
 		m_mutex.lock();
-		uint8_t red   = (uint8_t) std::round(255.0f*m_Color[0]);
-		uint8_t green = (uint8_t) std::round(255.0f*m_Color[1]);
-		uint8_t blue  = (uint8_t) std::round(255.0f*m_Color[2]);
-		uint8_t alpha = (uint8_t) std::round(255.0f*m_Opacity/100.0f);
+		bool lookingBack = (m_LookBack > 0.0f);
 		m_mutex.unlock();
-		
-		std::vector<uint8_t> data(NewMap.Map.rows * NewMap.Map.cols * 4, 0);
-		int index = 0;
-		for (int row = 0; row < NewMap.Map.rows; row++) {
-			for (int col = 0; col < NewMap.Map.cols; col++) {
-				uint8_t shadowMapVal = NewMap.Map.at<uint8_t>(row, col);
-				if ((shadowMapVal == 255) || (shadowMapVal <= 127)) {
-					data[index++] = 0;
-					data[index++] = 0;
-					data[index++] = 0;
-					data[index++] = 0;
-				}
-				else {
-					data[index++] = red;
-					data[index++] = green;
-					data[index++] = blue;
-					data[index++] = alpha;
-				}
+		if (! lookingBack)
+			SetTexture(NewMap);
+	});
+}
+
+void ShadowMapOverlay::SetTexture(ShadowDetection::InstantaneousShadowMap const & NewMap) {
+	//Copy our visualization settings so we don't need to hold onto our mutex while we evaluate the texture
+	m_mutex.lock();
+	uint8_t red   = (uint8_t) std::round(255.0f*m_Color[0]);
+	uint8_t green = (uint8_t) std::round(255.0f*m_Color[1]);
+	uint8_t blue  = (uint8_t) std::round(255.0f*m_Color[2]);
+	uint8_t alpha = (uint8_t) std::round(255.0f*m_Opacity/100.0f);
+	m_mutex.unlock();
+	
+	std::vector<uint8_t> data(NewMap.Map.rows * NewMap.Map.cols * 4, 0);
+	int index = 0;
+	for (int row = 0; row < NewMap.Map.rows; row++) {
+		for (int col = 0; col < NewMap.Map.cols; col++) {
+			uint8_t shadowMapVal = NewMap.Map.at<uint8_t>(row, col);
+			if ((shadowMapVal == 255) || (shadowMapVal <= 127)) {
+				data[index++] = 0;
+				data[index++] = 0;
+				data[index++] = 0;
+				data[index++] = 0;
+			}
+			else {
+				data[index++] = red;
+				data[index++] = green;
+				data[index++] = blue;
+				data[index++] = alpha;
 			}
 		}
-		TextureUploadFlowRestrictor::Instance().WaitUntilUploadIsAllowed();
-		ImTextureID tex = ImGuiApp::Instance().CreateImageRGBA8888(&data[0], NewMap.Map.cols, NewMap.Map.rows);
-		
-		std::scoped_lock lock(m_mutex);
-		m_shadowMapTexture = tex;
-		UL_LL = NewMap.UL_LL;
-		UR_LL = NewMap.UR_LL;
-		LL_LL = NewMap.LL_LL;
-		LR_LL = NewMap.LR_LL;
+	}
+	TextureUploadFlowRestrictor::Instance().WaitUntilUploadIsAllowed();
+	ImTextureID tex = ImGuiApp::Instance().CreateImageRGBA8888(&data[0], NewMap.Map.cols, NewMap.Map.rows);
+	
+	std::scoped_lock lock(m_mutex);
+	m_shadowMapTexture = tex;
+	UL_LL = NewMap.UL_LL;
+	UR_LL = NewMap.UR_LL;
+	LL_LL = NewMap.LL_LL;
+	LR_LL = NewMap.LR_LL;
+}
+
+//Start fetching the recorded shadow map from m_LookBack seconds ago, unless a fetch is already in progress or we fetched one recently
+void ShadowMapOverlay::RequestReplayMap(void) {
+	using Clock = std::chrono::steady_clock;
+	Clock::time_point now = Clock::now();
+	if (m_replayJob.valid() && (m_replayJob.wait_for(std::chrono::seconds(0)) != std::future_status::ready))
+		return;
+	if (now - m_lastReplayFetch < std::chrono::milliseconds(500))
+		return;
+	m_lastReplayFetch = now;
+	Clock::time_point target = now - std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_LookBack));
+	m_replayJob = std::async(std::launch::async, [this, target]() {
+		ShadowDetection::InstantaneousShadowMap map;
+		if (! ShadowDetection::ShadowDetectionEngine::Instance().GetHistoricalShadowMap(target, map))
+			return;
+		{
+			std::scoped_lock lock(m_mutex);
+			if ((m_LookBack <= 0.0f) || (map.Timestamp == m_replayMapTimestamp))
+				return; //Back to live, or we are already showing this map
+			m_replayMapTimestamp = map.Timestamp;
+		}
+		SetTexture(map);
 	});
 }
 
@@ -68,6 +101,13 @@ void ShadowMapOverlay::Draw_Overlay(Eigen::Vector2d const & CursorPos_NM, ImDraw
 	m_Opacity = VisWidget::Instance().Opacity_ShadowMapOverlay;
 	m_Color   = VisWidget::Instance().ShadowMapColor;
 	
+	//When looking back, keep the texture showing the recorded map from that long ago. Otherwise live maps arrive through our callback.
+	m_LookBack = VisWidget::Instance().ShadowMapOverlay_LookBack;
+	if (m_LookBack > 0.0f)
+		RequestReplayMap();
+	else
+		m_replayMapTimestamp = std::chrono::time_point<std::chrono::steady_clock>();
+	
 	//Convert the necessary corners to NM and then to screen space
 	Eigen::Vector2d UL_NM = LatLonToNM(UL_LL);
 	Eigen::Vector2d LR_NM = LatLonToNM(LR_LL);
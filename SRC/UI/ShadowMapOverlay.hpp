@@ -3,12 +3,18 @@
 //Copyright (c) 2021 Sentek Systems, LLC. All rights reserved. 
 #pragma once
 
+//System Includes
+#include <future>
+#include <chrono>
+
 //External Includes
 #include "../HandyImGuiInclude.hpp"
 
 //Project Includes
 #include "../EigenAliases.h"
 
+namespace ShadowDetection { class InstantaneousShadowMap; }
+
 class ShadowMapOverlay {
 	private:
 		std::mutex m_mutex;
@@ -25,10 +31,19 @@ class ShadowMapOverlay {
 		//to the callback function that evaluates the texture.
 		float m_Opacity; //0-100
 		std::array<float, 3> m_Color; //Each item between 0 and 1
+		float m_LookBack = 0.0f; //Seconds - when positive we show the recorded shadow map from this long ago instead of the live one
+		
+		//Recorded maps may need to be read from disk, so they are fetched on a worker thread instead of in the draw loop
+		std::future<void> m_replayJob;
+		std::chrono::time_point<std::chrono::steady_clock> m_lastReplayFetch;
+		std::chrono::time_point<std::chrono::steady_clock> m_replayMapTimestamp; //Timestamp of the recorded map in the texture (when looking back)
+		
+		void SetTexture(ShadowDetection::InstantaneousShadowMap const & Map); //Evaluate the texture for a shadow map and make it current
+		void RequestReplayMap(void); //Lock on m_mutex should be held
 		
 	public:
 		 ShadowMapOverlay();
-		~ShadowMapOverlay() = default;
+		~ShadowMapOverlay() = default; //Waits for any replay fetch in progress
 		
 		//Called in the draw loop for the map widget
 		void Draw_Overlay(Eigen::Vector2d const & CursorPos_NM, ImDrawList * DrawList, bool CursorInBounds);
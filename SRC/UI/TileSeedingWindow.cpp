@@ -0,0 +1,166 @@
+//The Tile Seeding Window lets the user download the satellite imagery for an area into the local tile cache ahead of time,
+//so the map is usable in the field without an internet connection.
+//Author: Bryan Poling
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+
+//System Includes
+#include <cmath>
+
+//Project Includes
+#include "TileSeedingWindow.hpp"
+#include "ReconUI.hpp"
+#include "MapWidget.hpp"
+#include "../SurveyRegionManager.hpp"
+#include "../Maps/SatelliteCacheMaster.hpp"
+#include "../Maps/MapUtils.hpp"
+
+//Upper bound on the number of tiles a job over the given NM AABB would contain (region jobs contain fewer). This is just arithmetic, so it
+//is cheap enough to call every frame, unlike enumerating the tiles.
+static double CountTilesCoveringAABB(Eigen::Vector4d const & AABB_NM, int MinZoom, int MaxZoom) {
+	double count = 0.0;
+	for (int level = MinZoom; level <= MaxZoom; level++) {
+		auto [XMin, XMax, YMin, YMax] = GetTileRangeCoveringAABB(AABB_NM, level);
+		count += double(XMax - XMin + 1)*double(YMax - YMin + 1);
+	}
+	return count;
+}
+
+static std::string FormatDuration(double Seconds) {
+	if (! std::isfinite(Seconds))
+		return std::string("--");
+	int totalSeconds = int(std::round(Seconds));
+	char buf[64];
+	if (totalSeconds >= 3600)
+		snprintf(buf, sizeof(buf), "%dh %02dm %02ds", totalSeconds / 3600, (totalSeconds % 3600) / 60, totalSeconds % 60);
+	else if (totalSeconds >= 60)
+		snprintf(buf, sizeof(buf), "%dm %02ds", totalSeconds / 60, totalSeconds % 60);
+	else
+		snprintf(buf, sizeof(buf), "%ds", totalSeconds);
+	return std::string(buf);
+}
+
+TileSeedingWindow::TileSeedingWindow() : Log(*(ReconUI::Instance().Log)) { }
+
+void TileSeedingWindow::Stop(void) {
+	m_seeder.reset(); //The destructor cancels the job and waits for it
+}
+
+//Get the area to seed. If UseRegion comes back true, Region holds it (and AABB_NM its bounding box). Otherwise only AABB_NM is set.
+bool TileSeedingWindow::GetArea(PolygonCollection & Region, Eigen::Vector4d & AABB_NM, bool & UseRegion) {
+	if (m_areaSource == int(AreaSource::SurveyRegion)) {
+		UseRegion = true;
+		if ((! SurveyRegionManager::Instance().GetCopyOfActiveRegionData(nullptr, &Region, nullptr)) || Region.m_components.empty())
+			return false;
+		AABB_NM = Region.GetAABB();
+	}
+	else {
+		UseRegion = false;
+		Eigen::Vector2d LatBounds, LonBounds;
+		MapWidget::Instance().GetCurrentLatLonBounds(LatBounds, LonBounds);
+		Eigen::Vector2d LL_NM = LatLonToNM(Eigen::Vector2d(LatBounds(0), LonBounds(0)));
+		Eigen::Vector2d UR_NM = LatLonToNM(Eigen::Vector2d(LatBounds(1), LonBounds(1)));
+		AABB_NM << LL_NM(0), UR_NM(0), LL_NM(1), UR_NM(1);
+	}
+	return AABB_NM.allFinite();
+}
+
+void TileSeedingWindow::StartSeeding(void) {
+	Maps::SatelliteCacheMaster * cacheMaster = Maps::SatelliteCacheMaster::Instance();
+	PolygonCollection region;
+	Eigen::Vector4d AABB_NM;
+	bool useRegion = false;
+	if ((cacheMaster == nullptr) || (! GetArea(region, AABB_NM, useRegion))) {
+		m_statusMessage = "No area to seed.";
+		return;
+	}
+
+	std::vector<Maps::Tile> tiles;
+	bool enumerated = useRegion ? Maps::TileSeeder::EnumerateTiles(region,  m_minZoom, m_maxZoom, tiles) :
+	                              Maps::TileSeeder::EnumerateTiles(AABB_NM, m_minZoom, m_maxZoom, tiles);
+	if (! enumerated) {
+		m_statusMessage = "Area is too large - reduce the max zoom level or seed a smaller area.";
+		return;
+	}
+	m_statusMessage.clear();
+	Log.printf("Seeding %zu satellite tiles (levels %d - %d).", tiles.size(), m_minZoom, m_maxZoom);
+	m_seeder.reset(new Maps::TileSeeder(cacheMaster->GetCacheFile(), cacheMaster->GetSource(), std::move(tiles), Log));
+}
+
+void TileSeedingWindow::Draw() {
+	ImExt::Window::Options wOpts;
+	wOpts.Flags = WindowFlags::NoCollapse | WindowFlags::NoSavedSettings | WindowFlags::NoDocking | WindowFlags::NoTitleBar | WindowFlags::NoResize;
+	wOpts.POpen = &Visible;
+	wOpts.Size(Math::Vector2(32.0f*ImGui::GetFontSize(), 20.0f*ImGui::GetFontSize()), Condition::Appearing);
+	if (ImExt::Window window("Offline Tile Seeding", wOpts); window.ShouldDrawContents()) {
+		ImExt::Style style(StyleVar::WindowPadding, Math::Vector2(20.0f));
+
+		ImGui::BeginChild("Tile Seeding Scrollable Region", ImVec2(0,0), true, ImGuiWindowFlags_AlwaysUseWindowPadding);
+		float col2Start = ImGui::GetCursorPosX() + ImGui::CalcTextSize("Zoom Levels:     ").x;
+		bool running = (m_seeder != nullptr) && (! m_seeder->IsDone());
+
+		ImGui::TextUnformatted("Area:");
+		ImGui::SameLine(col2Start);
+		if (running) {
+			ImGui::TextUnformatted(m_areaSource == int(AreaSource::SurveyRegion) ? "Active survey region" : "Current map view");
+			ImGui::TextUnformatted("Zoom Levels:");
+			ImGui::SameLine(col2Start);
+			ImGui::Text("%d - %d", m_minZoom, m_maxZoom);
+		}
+		else {
+			ImGui::RadioButton("Active survey region", &m_areaSource, int(AreaSource::SurveyRegion));
+			ImGui::SameLine();
+			ImGui::RadioButton("Current map view", &m_areaSource, int(AreaSource::MapView));
+
+			ImGui::TextUnformatted("Zoom Levels:");
+			ImGui::SameLine(col2Start);
+			ImGui::PushItemWidth(std::max(ImGui::GetContentRegionAvail().x, 50.0f));
+			ImGui::DragIntRange2("##Seed Zoom Range", &m_minZoom, &m_maxZoom, 0.1f, 0, Maps::TileSeeder::MaxSeedZoom, "Min: %d", "Max: %d");
+			ImGui::PopItemWidth();
+			m_minZoom = std::clamp(m_minZoom, 0, Maps::TileSeeder::MaxSeedZoom);
+			m_maxZoom = std::clamp(m_maxZoom, m_minZoom, Maps::TileSeeder::MaxSeedZoom);
+
+			PolygonCollection region;
+			Eigen::Vector4d AABB_NM;
+			bool useRegion = false;
+			ImGui::TextUnformatted("Tiles:");
+			ImGui::SameLine(col2Start);
+			if (GetArea(region, AABB_NM, useRegion)) {
+				double count = CountTilesCoveringAABB(AABB_NM, m_minZoom, m_maxZoom);
+				ImGui::Text(useRegion ? "At most %.0f" : "%.0f", count);
+				if (count > double(Maps::TileSeeder::MaxTilesPerJob)) {
+					ImGui::SameLine();
+					ImGui::TextDisabled("(too many - reduce the max zoom level)");
+				}
+			}
+			else
+				ImGui::TextDisabled(m_areaSource == int(AreaSource::SurveyRegion) ? "No active survey region" : "--");
+		}
+		ImExt::Dummy(5_f, 10_f);
+
+		if (m_seeder != nullptr) {
+			Maps::TileSeeder::Progress progress = m_seeder->GetProgress();
+			float fraction = (progress.TilesTotal > 0U) ? float(progress.TilesProcessed()) / float(progress.TilesTotal) : 1.0f;
+			std::string overlay = std::to_string(progress.TilesProcessed()) + " / " + std::to_string(progress.TilesTotal);
+			ImGui::ProgressBar(fraction, ImVec2(-1.0f, 0.0f), overlay.c_str());
+			ImGui::Text("Already cached: %zu   Downloaded: %zu   Failed: %zu", progress.TilesCached, progress.TilesFetched, progress.TilesFailed);
+			ImGui::Text("%.1f tiles/s   %.2f MB/s   Elapsed: %s   Remaining: %s", progress.TilesPerSecond, progress.BytesPerSecond/1.0e6,
+			            FormatDuration(progress.ElapsedSeconds).c_str(), FormatDuration(progress.ETASeconds).c_str());
+			if (progress.Done)
+				ImGui::TextUnformatted(progress.Cancelled ? "Seeding cancelled." : "Seeding finished.");
+		}
+		if (! m_statusMessage.empty())
+			ImGui::TextUnformatted(m_statusMessage.c_str());
+		ImExt::Dummy(5_f, 10_f);
+
+		if (running) {
+			if (ImGui::Button(" Cancel ##Tile Seeding"))
+				m_seeder->Cancel();
+		}
+		else if (ImGui::Button(" Start Seeding ##Tile Seeding")) {
+			m_seeder.reset();
+			StartSeeding();
+		}
+
+		ImGui::EndChild();
+	}
+}
@@ -0,0 +1,43 @@
+//The Tile Seeding Window lets the user download the satellite imagery for an area into the local tile cache ahead of time,
+//so the map is usable in the field without an internet connection.
+//Author: Bryan Poling
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+#pragma once
+
+//System Includes
+#include <vector>
+#include <memory>
+#include <string>
+
+//External Includes
+#include "../HandyImGuiInclude.hpp"
+
+//Project Includes
+#include "../EigenAliases.h"
+#include "../Maps/TileSeeder.hpp"
+#include "../Journal.h"
+
+class TileSeedingWindow {
+	public:
+		TileSeedingWindow();
+		~TileSeedingWindow() { Stop(); }
+		static TileSeedingWindow & Instance() { static TileSeedingWindow win; return win; }
+
+		void Draw();
+		void Stop(void); //Cancel any running job and wait for it - must be called before the satellite cache is destroyed
+
+		bool Visible = false;
+
+	private:
+		enum class AreaSource : int { SurveyRegion = 0, MapView };
+
+		Journal & Log;
+		int m_areaSource = int(AreaSource::SurveyRegion);
+		int m_minZoom = 10;
+		int m_maxZoom = 17;
+		std::unique_ptr<Maps::TileSeeder> m_seeder;
+		std::string m_statusMessage;
+
+		bool GetArea(PolygonCollection & Region, Eigen::Vector4d & AABB_NM, bool & UseRegion);
+		void StartSeeding(void);
+};
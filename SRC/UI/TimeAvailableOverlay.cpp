@@ -55,18 +55,33 @@ TimeAvailableOverlay::TimeAvailableOverlay() {
 		//Copy our visualization settings so we don't need to hold onto our mutex while we evaluate the texture
 		m_mutex.lock();
 		uint8_t alpha = (uint8_t) std::round(255.0f*m_Opacity/100.0f);
+		double screenWidth = m_ScreenWidth;
 		m_mutex.unlock();
 		
+		//When zoomed out, the TA function covers fewer screen pixels than it has raster pixels. In that case, render the coarsest pyramid level
+		//that is still at least as wide as the image on screen instead of the full-resolution raster. Pyramid levels hold the min over each block,
+		//so coarse levels err on the side of showing shadows early. Zoom changes take effect with the next TA function.
+		cv::Mat const * raster = &(TAFun.TimeAvailable);
+		if (TAFun.Pyramid != nullptr) {
+			for (int level = 1; level < TAFun.Pyramid->NumLevels(); level++) {
+				if (double(TAFun.Pyramid->Level(level).cols) < screenWidth)
+					break;
+				raster = &(TAFun.Pyramid->Level(level));
+			}
+		}
+		if (raster->empty())
+			return;
+		
 		//Set hard-coded vis parameters
 		std::vector<std::tuple<uint8_t,uint8_t,uint8_t>> const & cmap = Colormaps::GetColormap(Colormap::RedToBlue);
 		uint16_t CmapMinVal = 0;  //Time available for low end of colormap (seconds)
 		uint16_t CmapMaxVal = 20; //Time available for high end of colormap (seconds)
 		
-		std::vector<uint8_t> data(TAFun.TimeAvailable.rows * TAFun.TimeAvailable.cols * 4, 0);
+		std::vector<uint8_t> data(raster->rows * raster->cols * 4, 0);
 		int index = 0;
-		for (int row = 0; row < TAFun.TimeAvailable.rows; row++) {
-			for (int col = 0; col < TAFun.TimeAvailable.cols; col++) {
-				uint16_t TAFunVal = TAFun.TimeAvailable.at<uint16_t>(row, col);
+		for (int row = 0; row < raster->rows; row++) {
+			for (int col = 0; col < raster->cols; col++) {
+				uint16_t TAFunVal = raster->at<uint16_t>(row, col);
 				if (TAFunVal == std::numeric_limits<uint16_t>::max()) {
 					data[index++] = 0;
 					data[index++] = 0;
@@ -84,7 +99,7 @@ TimeAvailableOverlay::TimeAvailableOverlay() {
 			}
 		}
 		TextureUploadFlowRestrictor::Instance().WaitUntilUploadIsAllowed();
-		ImTextureID tex = ImGuiApp::Instance().CreateImageRGBA8888(&data[0], TAFun.TimeAvailable.cols, TAFun.TimeAvailable.rows);
+		ImTextureID tex = ImGuiApp::Instance().CreateImageRGBA8888(&data[0], raster->cols, raster->rows);
 		
 		std::scoped_lock lock(m_mutex);
 		m_TimeAvailableTexture = tex;
@@ -115,6 +130,7 @@ void TimeAvailableOverlay::Draw_Overlay(Eigen::Vector2d const & CursorPos_NM, Im
 	
 	Eigen::Vector2d UL_SS = MapWidget::Instance().NormalizedMercatorToScreenCoords(UL_NM);
 	Eigen::Vector2d LR_SS = MapWidget::Instance().NormalizedMercatorToScreenCoords(LR_NM);
+	m_ScreenWidth = std::abs(LR_SS(0) - UL_SS(0));
 	
 	DrawList->AddImage(m_TimeAvailableTexture, UL_SS, LR_SS);
 }
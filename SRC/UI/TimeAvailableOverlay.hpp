@@ -24,6 +24,7 @@ class TimeAvailableOverlay {
 		//We latch the current values of the relavent layer settings in our Draw pass so they are available asynchronously
 		//to the callback function that evaluates the texture.
 		float m_Opacity; //0-100
+		double m_ScreenWidth = 1.0e6; //Width (screen pixels) of the TA function on the map widget - used to pick a pyramid level to render
 		//std::array<float, 3> m_Color; //Each item between 0 and 1
 		
 	public:
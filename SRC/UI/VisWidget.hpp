@@ -59,6 +59,7 @@ class VisWidget {
 		bool GuidanceOverlay_HideCompleteSubregions; //Relavent when view is "Sequences"
 		
 		std::array<float, 3> ShadowMapColor; //RGB in range 0 to 1
+		float ShadowMapOverlay_LookBack;     //Show the recorded shadow map from this many seconds ago (0 = live). Not saved.
 		
 		//Constructors and Destructors
 		VisWidget() : Log(*(ReconUI::Instance().Log)) { LoadDefaults(); LoadFromDisk(); }
@@ -170,6 +171,7 @@ inline void VisWidget::LoadDefaults(void) {
 	GuidanceOverlay_HideCompleteSubregions = true;
 	
 	ShadowMapColor = {0.4f, 0.4f, 0.7f};
+	ShadowMapOverlay_LookBack = 0.0f;
 }
 
 //Make sure all vis parameters are reasonable
@@ -197,6 +199,7 @@ inline void VisWidget::SanitizeState(void) {
 	ShadowMapColor[0] = std::clamp(ShadowMapColor[0], 0.0f, 1.0f);
 	ShadowMapColor[1] = std::clamp(ShadowMapColor[1], 0.0f, 1.0f);
 	ShadowMapColor[2] = std::clamp(ShadowMapColor[2], 0.0f, 1.0f);
+	ShadowMapOverlay_LookBack = std::clamp(ShadowMapOverlay_LookBack, 0.0f, 600.0f);
 }
 
 inline void VisWidget::Draw() {
@@ -392,7 +395,7 @@ inline void VisWidget::Draw() {
 	{
 		ImExt::Style styleSitter(StyleVar::WindowPadding, Math::Vector2(4.0f));
 		if (ImGui::BeginPopup("Shadow Map Overlay Settings", ImGuiWindowFlags_NoMove | ImGuiWindowFlags_AlwaysAutoResize)) {
-			float col2Start = ImGui::GetCursorPosX() + ImGui::CalcTextSize("Opacity  ").x;
+			float col2Start = ImGui::GetCursorPosX() + ImGui::CalcTextSize("Look Back  ").x;
 			std::string label = "Opacity  "s;
 			ImGui::SetCursorPosX(col2Start - ImGui::CalcTextSize(label.c_str()).x);
 			ImGui::TextUnformatted(label.c_str());
@@ -406,6 +409,14 @@ inline void VisWidget::Draw() {
 			ImGui::SameLine(col2Start);
 			ImGui::ColorEdit3("##ShadowMapColor", &(ShadowMapColor[0]), ImGuiColorEditFlags_NoInputs);
 			
+			label = "Look Back "s;
+			ImGui::SetCursorPosX(col2Start - ImGui::CalcTextSize(label.c_str()).x);
+			ImGui::TextUnformatted(label.c_str());
+			ImGui::SameLine(col2Start);
+			ImGui::SetNextItemWidth(15.0f*ImGui::GetFontSize());
+			ImGui::SliderFloat("##ShadowMapOverlay_LookBack", &ShadowMapOverlay_LookBack, 0.0f, 600.0f,
+			                   (ShadowMapOverlay_LookBack > 0.0f) ? "%.0f s ago" : "Live");
+			
 			ImGui::EndPopup();
 		}
 	}
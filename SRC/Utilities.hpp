@@ -6,6 +6,7 @@
 //System Includes
 #include <string>
 #include <chrono>
+#include <atomic>
 
 //External Includes
 #include "../../handycpp/Handy.hpp"
@@ -42,6 +43,19 @@ inline std::chrono::time_point<std::chrono::steady_clock> AdvanceTimepoint(std::
 	return (T + std::chrono::milliseconds(int64_t(std::round(1000.0*Seconds))));
 }
 
+//A flag one thread sets to ask a long-running computation on another thread to stop early. Computations that accept a token poll it
+//and, when it is set, return the best result they have so far instead of running to completion.
+class CancellationToken {
+	public:
+		CancellationToken() : m_cancelled(false) { }
+		void Cancel(void)            { m_cancelled = true; }
+		void Reset(void)             { m_cancelled = false; }
+		bool IsCancelled(void) const { return m_cancelled; }
+
+	private:
+		std::atomic<bool> m_cancelled;
+};
+
 //Make sure a filename is sane (no crazy characters or too short/long). This looks at the name only - it does not check the filesystem in any way
 inline bool isFilenameReasonable(std::string Filename) {
 	const std::string allowedChars("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ1234567890 (),[]:.<>'+=-_");
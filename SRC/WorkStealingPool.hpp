@@ -0,0 +1,198 @@
+//This module provides a small work-stealing thread pool for fork-join parallelism (e.g. planning many independent missions at once).
+//Each worker has its own deque of tasks: a worker pushes and pops tasks at the back of its own deque and, when it runs dry, steals
+//from the front of the other deques. Tasks submitted from threads that are not workers of the pool go into a shared injection queue.
+//
+//The only way to submit work is ParallelFor(), which blocks until all of its iterations are done. While it waits, the calling thread
+//runs queued tasks itself, so ParallelFor() can be nested (a task may call ParallelFor()) without deadlocking or idling a worker.
+//ParallelFor() makes no promises about which thread runs which iteration or in what order. Callers that need deterministic results
+//should have iteration n write only to slot n of a pre-sized output and do any reduction serially afterwards.
+//Author: Bryan Poling
+//Copyright (c) 2021 Sentek Systems, LLC. All rights reserved.
+#pragma once
+
+//System Includes
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <algorithm>
+
+class WorkStealingPool {
+	public:
+		//Shared pool used by the guidance module and anything else that wants one. Uses one worker per hardware thread, less one
+		//for the thread that calls ParallelFor() (which helps out while it waits).
+		static WorkStealingPool & Instance() { static WorkStealingPool Obj(DefaultNumWorkers()); return Obj; }
+
+		explicit WorkStealingPool(unsigned int NumWorkers);
+		~WorkStealingPool(); //Waits for the workers to finish the task they are on (queued tasks are abandoned)
+		WorkStealingPool(WorkStealingPool const &) = delete;
+		WorkStealingPool & operator=(WorkStealingPool const &) = delete;
+
+		static unsigned int DefaultNumWorkers(void) { return std::max(std::thread::hardware_concurrency(), 2U) - 1U; }
+		unsigned int NumWorkers(void) const { return (unsigned int) m_workers.size(); }
+
+		//Call Func(n) for n = 0, 1, ..., N-1, spread over the workers of the pool and the calling thread. Returns when all calls are done.
+		//If any call throws, the first exception caught is re-thrown here (after all other calls have finished).
+		inline void ParallelFor(size_t N, std::function<void(size_t)> const & Func);
+
+	private:
+		struct TaskGroup {
+			std::atomic<size_t> Pending;
+			std::mutex Mutex;
+			std::condition_variable Done;
+			std::exception_ptr Exception;
+		};
+		struct Task {
+			std::function<void(size_t)> const * Func;
+			size_t     Index;
+			TaskGroup * Group;
+		};
+		struct TaskQueue {
+			std::mutex Mutex;
+			std::deque<Task> Tasks;
+		};
+
+		std::vector<std::thread> m_workers;
+		std::vector<std::unique_ptr<TaskQueue>> m_queues; //Element n is the deque for worker n - the last element is the injection queue
+		std::atomic<size_t> m_numQueued;                  //Total tasks in all queues (used to put idle workers to sleep)
+		std::atomic<bool>   m_stop;
+		std::mutex m_sleepMutex;
+		std::condition_variable m_sleepCV;
+
+		static int & ThisWorkerIndex(void) { thread_local int index = -1; return index; }   //Worker index of calling thread in its pool
+		static WorkStealingPool * & ThisWorkerPool(void) { thread_local WorkStealingPool * pool = nullptr; return pool; }
+
+		inline int  QueueIndexForCallingThread(void);
+		inline bool TryRunOneTask(int QueueIndex); //Run a task from our own queue, the injection queue, or stolen from another worker
+		inline void RunTask(Task const & T);
+		inline void WorkerMain(int WorkerIndex);
+};
+
+inline WorkStealingPool::WorkStealingPool(unsigned int NumWorkers) : m_numQueued(0U), m_stop(false) {
+	for (unsigned int n = 0U; n <= NumWorkers; n++)
+		m_queues.push_back(std::make_unique<TaskQueue>());
+	for (unsigned int n = 0U; n < NumWorkers; n++)
+		m_workers.emplace_back(&WorkStealingPool::WorkerMain, this, int(n));
+}
+
+inline WorkStealingPool::~WorkStealingPool() {
+	{
+		std::scoped_lock lock(m_sleepMutex);
+		m_stop = true;
+	}
+	m_sleepCV.notify_all();
+	for (std::thread & worker : m_workers) {
+		if (worker.joinable())
+			worker.join();
+	}
+}
+
+inline int WorkStealingPool::QueueIndexForCallingThread(void) {
+	if (ThisWorkerPool() == this)
+		return ThisWorkerIndex();
+	else
+		return int(m_workers.size()); //Injection queue
+}
+
+inline void WorkStealingPool::ParallelFor(size_t N, std::function<void(size_t)> const & Func) {
+	if (N == 0U)
+		return;
+	if ((N == 1U) || m_workers.empty()) {
+		for (size_t n = 0U; n < N; n++)
+			Func(n);
+		return;
+	}
+
+	TaskGroup group;
+	group.Pending = N;
+	int queueIndex = QueueIndexForCallingThread();
+	{
+		//Push in reverse so the owner (popping from the back) starts at iteration 0 and thieves (popping from the front) take the end
+		std::scoped_lock lock(m_queues[queueIndex]->Mutex);
+		for (size_t n = N; n-- > 0U;)
+			m_queues[queueIndex]->Tasks.push_back(Task{&Func, n, &group});
+		m_numQueued += N;
+	}
+	{
+		std::scoped_lock lock(m_sleepMutex); //Don't notify between a sleeping worker checking m_numQueued and starting to wait
+	}
+	m_sleepCV.notify_all();
+
+	//Help out until every iteration in our group is done. Once there is nothing left to run, the remaining iterations are running
+	//on other threads - sleep until the last one finishes (with a short timeout in case one of them submits nested work we can help with).
+	while (group.Pending > 0U) {
+		if (! TryRunOneTask(queueIndex)) {
+			std::unique_lock<std::mutex> lock(group.Mutex);
+			group.Done.wait_for(lock, std::chrono::milliseconds(1), [&group]() { return group.Pending == 0U; });
+		}
+	}
+
+	//Make sure the last task to finish is done touching the group before it goes out of scope
+	std::scoped_lock lock(group.Mutex);
+	if (group.Exception)
+		std::rethrow_exception(group.Exception);
+}
+
+inline bool WorkStealingPool::TryRunOneTask(int QueueIndex) {
+	if (m_numQueued == 0U)
+		return false;
+	int numQueues = int(m_queues.size());
+	int injectionQueueIndex = numQueues - 1;
+	Task task;
+	bool found = false;
+
+	//Our own deque first (newest task first), then the injection queue and the other workers' deques (oldest task first)
+	{
+		std::scoped_lock lock(m_queues[QueueIndex]->Mutex);
+		if (! m_queues[QueueIndex]->Tasks.empty()) {
+			task = m_queues[QueueIndex]->Tasks.back();
+			m_queues[QueueIndex]->Tasks.pop_back();
+			found = true;
+		}
+	}
+	for (int offset = 0; (offset < numQueues) && (! found); offset++) {
+		int victim = (injectionQueueIndex + offset) % numQueues; //Injection queue, then workers 0, 1, ...
+		if (victim == QueueIndex)
+			continue;
+		std::scoped_lock lock(m_queues[victim]->Mutex);
+		if (! m_queues[victim]->Tasks.empty()) {
+			task = m_queues[victim]->Tasks.front();
+			m_queues[victim]->Tasks.pop_front();
+			found = true;
+		}
+	}
+	if (! found)
+		return false;
+	m_numQueued--;
+	RunTask(task);
+	return true;
+}
+
+inline void WorkStealingPool::RunTask(Task const & T) {
+	try { (*T.Func)(T.Index); }
+	catch (...) {
+		std::scoped_lock lock(T.Group->Mutex);
+		if (! T.Group->Exception)
+			T.Group->Exception = std::current_exception();
+	}
+	std::scoped_lock lock(T.Group->Mutex);
+	if (--(T.Group->Pending) == 0U)
+		T.Group->Done.notify_all();
+}
+
+inline void WorkStealingPool::WorkerMain(int WorkerIndex) {
+	ThisWorkerPool()  = this;
+	ThisWorkerIndex() = WorkerIndex;
+	while (! m_stop) {
+		if (! TryRunOneTask(WorkerIndex)) {
+			std::unique_lock<std::mutex> lock(m_sleepMutex);
+			m_sleepCV.wait_for(lock, std::chrono::milliseconds(50), [this]() { return m_stop || (m_numQueued > 0U); });
+		}
+	}
+}